@@ -11,6 +11,8 @@
 #include <pthread.h>
 #include <stdint.h>
 #include <stdarg.h>
+#include <ctype.h>
+#include <errno.h>
 #include <netdb.h>
 
 #include <sys/socket.h>
@@ -39,6 +41,11 @@ static ptrie_context_t *cb_ptrie_ctx;
 static pthread_t ptrie_update_thread_id;
 static pthread_t get_asset_map_server_thread_id;
 
+#define CB_ROUTE_NOT_FOUND 5 // route_lookup() no match
+
+static int route_lookup(const char *URL_abs_path, int all_locations, 
+			int exact, cb_route_data_t *cb_rd);
+
 static char MAP2UPPER[128] = {
     0,				// 000 000 00000000 NUL (Null char.)
     1,				// 001 001 00000001 SOH (Start of Header)
@@ -179,6 +186,15 @@ const char *http_resp_body_hdr =
 int http_resp_body_trailer_strlen; // Set at init
 const char *http_resp_body_trailer = "</OCRP>\r\n";
 
+int http_resp_update_body_hdr_strlen; // Set at init
+const char *http_resp_update_body_hdr =
+	"<?xml version=\"1.0\" encoding=\"ISO-8859-1\"?>"
+	"<!DOCTYPE OCRPupdate SYSTEM \"OCRPupdate.dtd\">"
+	"\r\n<OCRPupdate>\r\n";
+
+int http_resp_update_body_trailer_strlen; // Set at init
+const char *http_resp_update_body_trailer = "</OCRPupdate>\r\n";
+
 /*
  *******************************************************************************
  * Static ptrie callback functions
@@ -246,6 +262,185 @@ make_H_record(uint64_t seqno, uint64_t version, char *buf, int sizeof_buf)
     }
 }
 
+/*
+ *******************************************************************************
+ * Asset map change journal
+ *
+ *  Asset keys changed by committed updates, in commit order.  A
+ *  get-asset-map request with "since=<seqno>:<version>" is answered with
+ *  an OCRPupdate document holding only the keys changed after <seqno>,
+ *  provided the journal still covers it.  Otherwise (version mismatch,
+ *  journal wrapped, load in progress or done since, unknown seqno) the
+ *  full OCRP map is returned.
+ *******************************************************************************
+ */
+typedef struct journal_entry {
+    uint64_t seqno;
+    char *key;
+} journal_entry_t;
+
+static pthread_mutex_t journal_mutex = PTHREAD_MUTEX_INITIALIZER;
+static journal_entry_t journal[CB_ASSET_MAP_JOURNAL_ENTRIES];
+static long journal_head; // Next insert, journal[head % ENTRIES]
+static long journal_tail; // Oldest valid entry
+static int journal_valid; // 0 => No deltas, full map only
+static uint64_t journal_base_seqno; // Changes after base_seqno are present
+static uint64_t journal_seqno; // Last committed
+static uint64_t journal_vers;
+
+/* Update thread only */
+static int journal_loading;
+static journal_entry_t *journal_pending;
+static int journal_pending_entries;
+static int journal_pending_maxentries;
+
+static void
+journal_free_pending(void)
+{
+    int n;
+
+    for (n = 0; n < journal_pending_entries; n++) {
+    	FREE(journal_pending[n].key);
+    }
+    journal_pending_entries = 0;
+}
+
+/*
+ * journal_add_pending() - Note key changed by the current transaction
+ *
+ *  Return:
+ *    == 0, Success
+ *    != 0, Error, journal reset at commit
+ */
+static int
+journal_add_pending(const char *key, uint64_t seqno)
+{
+    journal_entry_t *p;
+    int maxentries;
+
+    if (journal_pending_entries >= journal_pending_maxentries) {
+    	maxentries = journal_pending_maxentries ? 
+		2 * journal_pending_maxentries : 1024;
+    	p = REALLOC(journal_pending, maxentries * sizeof(journal_entry_t));
+	if (!p) {
+	    goto err_exit;
+	}
+	journal_pending = p;
+	journal_pending_maxentries = maxentries;
+    }
+
+    journal_pending[journal_pending_entries].key = STRDUP(key);
+    if (!journal_pending[journal_pending_entries].key) {
+    	goto err_exit;
+    }
+    journal_pending[journal_pending_entries++].seqno = seqno;
+    return 0;
+
+err_exit:
+
+    CB_LOG(CB_ERROR, "Out of memory, key=%s, journal reset at commit", key);
+    pthread_mutex_lock(&journal_mutex);
+    journal_valid = 0;
+    pthread_mutex_unlock(&journal_mutex);
+    return 1;
+}
+
+/*
+ * journal_reset() - Drop all changes, deltas start at the given state
+ */
+static void
+journal_reset(const OCRP_fh_user_data_t *fhd)
+{
+    journal_free_pending();
+    journal_loading = 0;
+
+    pthread_mutex_lock(&journal_mutex);
+    while (journal_tail < journal_head) {
+    	FREE(journal[journal_tail++ % CB_ASSET_MAP_JOURNAL_ENTRIES].key);
+    }
+    journal_valid = 1;
+    journal_base_seqno = fhd->u.d.OCRP_seqno;
+    journal_seqno = fhd->u.d.OCRP_seqno;
+    journal_vers = fhd->u.d.OCRP_version;
+    pthread_mutex_unlock(&journal_mutex);
+}
+
+/*
+ * journal_begin_load() - No deltas until the load is committed
+ */
+static void
+journal_begin_load(void)
+{
+    journal_loading = 1;
+
+    pthread_mutex_lock(&journal_mutex);
+    journal_valid = 0;
+    pthread_mutex_unlock(&journal_mutex);
+}
+
+/*
+ * journal_abort() - Drop the changes of an aborted transaction
+ */
+static void
+journal_abort(void)
+{
+    journal_free_pending();
+}
+
+/*
+ * journal_commit() - Pending changes committed with the given state
+ */
+static void
+journal_commit(const OCRP_fh_user_data_t *fhd)
+{
+    journal_entry_t *je;
+    int n;
+
+    if (journal_loading) {
+    	// Partial load, journal_reset() at the end of the load
+    	journal_free_pending();
+	return;
+    }
+
+    pthread_mutex_lock(&journal_mutex);
+
+    if (journal_valid && (fhd->u.d.OCRP_version != journal_vers)) {
+    	CB_LOG(CB_MSG, "OCRP version %ld => %ld, journal reset", 
+	       journal_vers, fhd->u.d.OCRP_version);
+    	journal_valid = 0;
+    }
+
+    for (n = 0; journal_valid && (n < journal_pending_entries); n++) {
+	if (journal_pending[n].seqno < journal_seqno) {
+	    // Out of order, "since" no longer implies all older changes
+    	    CB_LOG(CB_MSG, "seqno %ld < %ld key=%s, journal reset", 
+	    	   journal_pending[n].seqno, journal_seqno, 
+		   journal_pending[n].key);
+	    journal_valid = 0;
+	    break;
+	}
+	if ((journal_head - journal_tail) >= CB_ASSET_MAP_JOURNAL_ENTRIES) {
+	    je = &journal[journal_tail++ % CB_ASSET_MAP_JOURNAL_ENTRIES];
+	    journal_base_seqno = je->seqno;
+	    FREE(je->key);
+	}
+	je = &journal[journal_head++ % CB_ASSET_MAP_JOURNAL_ENTRIES];
+	*je = journal_pending[n];
+	journal_pending[n].key = 0;
+	journal_seqno = je->seqno;
+    }
+
+    if (journal_valid) {
+    	journal_seqno = fhd->u.d.OCRP_seqno;
+    	journal_vers = fhd->u.d.OCRP_version;
+    	pthread_mutex_unlock(&journal_mutex);
+    	journal_free_pending(); // Entries not moved
+    } else {
+    	pthread_mutex_unlock(&journal_mutex);
+    	journal_reset(fhd);
+    }
+}
+
 /*
  * OCRP ptrie mappings:
  *  1) URL absolute path to OCRP_app_data_t.u.d.u.rec
@@ -727,6 +922,8 @@ commit_begin_xaction(ptrie_context_t *pctx, OCRP_fh_user_data_t *fhd)
 	       "rv=%d ctx=%p", rv, pctx);
 	return 1;
     }
+    journal_commit(fhd);
+
     rv = ptrie_begin_xaction(pctx);
     if (rv) {
 	CB_LOG(CB_ERROR, "ptrie_begin_xaction() failed, "
@@ -903,6 +1100,7 @@ process_OCRP_Entry(ptrie_context_t *pctx, OCRP_fh_user_data_t *fhd,
 	    	dump_OCRP_AD(tbuf, sizeof(tbuf), &new_app_data);
 	    	CB_LOG(CB_MSG, "Add key=%s ctx=%p app_data=%s",
 		       key, pctx, tbuf);
+		journal_add_pending(key, seqno);
 		break;
 	    } else if (rv < 0) { // Commit xaction and retry
 	    	rv = commit_begin_xaction(pctx, fhd);
@@ -959,6 +1157,7 @@ process_OCRP_Entry(ptrie_context_t *pctx, OCRP_fh_user_data_t *fhd,
 	    	dump_OCRP_AD(tbuf, sizeof(tbuf), &new_app_data);
 	    	CB_LOG(CB_MSG, "Update key=%s ctx=%p app_data=%s",
 		       key, pctx, tbuf);
+		journal_add_pending(key, seqno);
 	    	break;
 	    } else if (rv < 0) { // Commit xaction and retry
 	    	rv = commit_begin_xaction(pctx, fhd);
@@ -1031,6 +1230,7 @@ process_OCRP_DeleteEntry(ptrie_context_t *pctx, OCRP_fh_user_data_t *fhd,
 	    fhd->u.d.OCRP_seqno = seqno;
 	    fhd->u.d.OCRP_version = vers;
 	    CB_LOG(CB_MSG, "Remove key=%s ctx=%p", key, pctx);
+	    journal_add_pending(key, seqno);
 	    break;
 	} else if (rv < 0) { // commit and retry
 	    rv = commit_begin_xaction(pctx, fhd);
@@ -1081,10 +1281,12 @@ update_ptrie(ptrie_context_t *pctx, int load_op, XMLDocCTX_t *doc_ctx)
     }
 
     if (load_op) {
+    	journal_begin_load();
     	rv = ptrie_reset(pctx);
 	if (rv) {
 	    CB_LOG(CB_ERROR, "ptrie_reset() failed, rv=%d", rv);
 	    ptrie_end_xaction(pctx, 0 /*abort*/, (fh_user_data_t *) &fhd);
+	    journal_reset((OCRP_fh_user_data_t *) ptrie_get_fh_data(pctx));
 	    ret = 2;
 	    break;
 	}
@@ -1126,11 +1328,30 @@ update_ptrie(ptrie_context_t *pctx, int load_op, XMLDocCTX_t *doc_ctx)
 
     if (ret) {
     	ptrie_end_xaction(pctx, 0 /*abort*/, (fh_user_data_t *) &fhd);
+	if (load_op) {
+	    // Partial load may have been committed
+	    journal_reset((OCRP_fh_user_data_t *) ptrie_get_fh_data(pctx));
+	} else {
+	    journal_abort();
+	}
 	break;
     }
 
     rv = ptrie_end_xaction(pctx, 1 /*commit*/, (fh_user_data_t *) &fhd);
     if (!rv) {
+    	// Durable before the new state is reported
+    	rv = ptrie_sync(pctx);
+	if (rv) {
+	    CB_LOG(CB_ERROR, "ptrie_sync() error, rv=%d", rv);
+	    journal_reset(&fhd);
+	    ret = 8;
+	    break;
+	}
+	if (load_op) {
+	    journal_reset(&fhd);
+	} else {
+	    journal_commit(&fhd);
+	}
     	rv = make_H_record(fhd.u.d.OCRP_seqno, fhd.u.d.OCRP_version,
 			   OCRP_state_str, sizeof(OCRP_state_str));
     	if (!rv) {
@@ -1145,6 +1366,7 @@ update_ptrie(ptrie_context_t *pctx, int load_op, XMLDocCTX_t *doc_ctx)
 	}
     } else {
 	CB_LOG(CB_ERROR, "ptrie_end_xaction() error, rv=%d", rv);
+	journal_reset((OCRP_fh_user_data_t *) ptrie_get_fh_data(pctx));
 	ret = 7;
     }
     break;
@@ -1310,7 +1532,7 @@ int write_data(int fd, const char *data, long datalen)
 }
 
 static int
-mk_http_response(token_data_t token, int http_resp_code, 
+mk_http_response(token_data_t token, int http_resp_code, const char *H_str,
 		 const char **buf, int *buflen)
 {
     int rv;
@@ -1325,6 +1547,15 @@ mk_http_response(token_data_t token, int http_resp_code,
 	if (rv) {
 	    return 1001;
 	}
+	if (H_str) {
+	    rv = HTTPAddUnknownHeader(token, 1, 
+				      HTTP_GET_ASSET_H_HEADER, 
+				      HTTP_GET_ASSET_H_HEADER_STRLEN,
+				      H_str, strlen(H_str));
+	    if (rv) {
+	    	return 1002;
+	    }
+	}
 	rv = HTTPResponse(token, 200, buf, buflen, 0);
 
     } else {
@@ -1337,7 +1568,7 @@ mk_http_response(token_data_t token, int http_resp_code,
 	if (rv) {
 	    return 2001;
 	}
-	rv = HTTPResponse(token, 404, buf, buflen, 0);
+	rv = HTTPResponse(token, http_resp_code, buf, buflen, 0);
     }
     return rv;
 }
@@ -1433,6 +1664,233 @@ ptrie_list_keys_callback(const char *key, void *arg)
     return 0;
 }
 
+static int
+qsort_cmp_journal_entry_t(const void *p1, const void *p2)
+{
+    journal_entry_t *pje1 = (journal_entry_t *) p1;
+    journal_entry_t *pje2 = (journal_entry_t *) p2;
+    int rv;
+
+    rv = strcmp(pje1->key, pje2->key);
+    if (rv) {
+    	return rv;
+    }
+    // Most recent first
+    if (pje1->seqno < pje2->seqno) {
+    	return 1;
+    } else if (pje1->seqno > pje2->seqno) {
+    	return -1;
+    } else {
+    	return 0;
+    }
+}
+
+/*
+ * get_asset_delta() - Keys changed after since_seqno, unique and sorted,
+ *		       if the journal covers since_seqno:since_vers
+ *
+ *  Return:
+ *    == 0, Success, caller frees (*pje)[].key and *pje
+ *    != 0, Not covered, full map required
+ */
+static int
+get_asset_delta(uint64_t since_seqno, uint64_t since_vers,
+		journal_entry_t **pje, int *pentries, 
+		uint64_t *pseqno, uint64_t *pvers)
+{
+    journal_entry_t *je = 0;
+    long ix;
+    int entries = 0;
+    int n;
+    int k;
+
+    pthread_mutex_lock(&journal_mutex);
+
+    if (!journal_valid || (since_vers != journal_vers) ||
+    	(since_seqno < journal_base_seqno) || (since_seqno > journal_seqno)) {
+    	pthread_mutex_unlock(&journal_mutex);
+	return 1;
+    }
+
+    for (ix = journal_head; ix > journal_tail; ix--) {
+    	if (journal[(ix-1) % CB_ASSET_MAP_JOURNAL_ENTRIES].seqno <= 
+	    since_seqno) {
+	    break;
+	}
+    }
+    if (ix < journal_head) {
+    	je = MALLOC((journal_head - ix) * sizeof(journal_entry_t));
+	if (!je) {
+	    pthread_mutex_unlock(&journal_mutex);
+	    return 2;
+	}
+    	for (; ix < journal_head; ix++) {
+	    je[entries] = journal[ix % CB_ASSET_MAP_JOURNAL_ENTRIES];
+	    je[entries].key = STRDUP(je[entries].key);
+	    if (!je[entries].key) {
+	    	break;
+	    }
+	    entries++;
+	}
+    }
+    *pseqno = journal_seqno;
+    *pvers = journal_vers;
+
+    pthread_mutex_unlock(&journal_mutex);
+
+    if (je && (ix < journal_head)) { // STRDUP() failed
+	for (n = 0; n < entries; n++) {
+	    FREE(je[n].key);
+	}
+	FREE(je);
+	return 3;
+    }
+
+    if (entries) {
+    	qsort(je, entries, sizeof(journal_entry_t), qsort_cmp_journal_entry_t);
+	for (n = 1, k = 0; n < entries; n++) {
+	    if (strcmp(je[k].key, je[n].key)) {
+	    	je[++k] = je[n];
+	    } else {
+	    	FREE(je[n].key);
+	    }
+	}
+	entries = k + 1;
+    }
+    *pje = je;
+    *pentries = entries;
+    return 0;
+}
+
+/*
+ * send_get_asset_delta() - OCRPupdate body, Entry for each changed key
+ *			    still present followed by DeleteEntry for the
+ *			    removed ones (OCRPupdate.dtd order).
+ */
+static int
+send_get_asset_delta(journal_entry_t *je, int entries, uint64_t vers, int fd)
+{
+    char body[4096];
+    int bodylen;
+    int rv;
+    int n;
+    cb_route_data_t cb_rd;
+
+    for (n = 0; n < entries; n++) {
+    	rv = route_lookup(je[n].key, 1 /* all routes */, 1 /* exact */, 
+			  &cb_rd);
+	if (!rv) {
+	    bodylen = mk_record_response(je[n].key, &cb_rd, body, sizeof(body));
+	    if (bodylen <= 0) {
+		CB_LOG(CB_ERROR, "mk_record_response() failed, rv=%d", bodylen);
+		return 1;
+	    }
+	    rv = write_chunk(fd, body, bodylen);
+	    if (rv) {
+		CB_LOG(CB_MSG, "write_chunk() failed, rv=%d fd=%d", rv, fd);
+		return 2;
+	    }
+	    je[n].seqno = 0; // Sent
+	} else if (rv != CB_ROUTE_NOT_FOUND) {
+	    CB_LOG(CB_ERROR, "route_lookup() failed, rv=%d key=%s", 
+	    	   rv, je[n].key);
+	    return 3;
+	}
+    }
+
+    for (n = 0; n < entries; n++) {
+    	if (!je[n].seqno) {
+	    continue;
+	}
+	bodylen = snprintf(body, sizeof(body), 
+			   "<DeleteEntry>\n<H>%ld:%ld</H>\n<K>%s</K>\n"
+			   "</DeleteEntry>\n", je[n].seqno, vers, je[n].key);
+	if (bodylen >= (int)sizeof(body)) {
+	    CB_LOG(CB_ERROR, "DeleteEntry overflow, key=%s", je[n].key);
+	    return 4;
+	}
+	rv = write_chunk(fd, body, bodylen);
+	if (rv) {
+	    CB_LOG(CB_MSG, "write_chunk() failed, rv=%d fd=%d", rv, fd);
+	    return 5;
+	}
+    }
+    return 0;
+}
+
+/*
+ * parse_since() - "since" query value, <seqno>:<vers> in decimal digits,
+ *		   each within the signed 64 bit range the H records use
+ */
+static int
+parse_since(const char *since, uint64_t *pseqno, uint64_t *pvers)
+{
+    uint64_t val[2];
+    const char *p = since;
+    char *endptr;
+    int n;
+
+    for (n = 0; n < 2; n++) {
+    	if (!isdigit((unsigned char)*p)) {
+	    return 1;
+	}
+	errno = 0;
+	val[n] = strtoull(p, &endptr, 10);
+	if ((errno == ERANGE) || (val[n] > INT64_MAX)) {
+	    return 2;
+	}
+	p = endptr;
+	if (*p != (n ? '\0' : ':')) {
+	    return 3;
+	}
+	p++;
+    }
+    *pseqno = val[0];
+    *pvers = val[1];
+    return 0;
+}
+
+/*
+ * send_bad_request() - Empty 400 reply
+ */
+static int
+send_bad_request(token_data_t token, int fd)
+{
+    const char *http_resp;
+    int http_resp_len;
+    int rv;
+
+    rv = mk_http_response(token, 400, 0, &http_resp, &http_resp_len);
+    if (rv) {
+	CB_LOG(CB_ERROR, "mk_http_response() failed, rv=%d", rv);
+	return 2;
+    }
+    rv = write_data(fd, http_resp, http_resp_len);
+    if (rv) {
+	CB_LOG(CB_ERROR, "write_data() failed, rv=%d fd=%d", rv, fd);
+	return 3;
+    }
+    rv = write_chunk(fd, 0, 0); // write zero chunk
+    if (rv) {
+	CB_LOG(CB_MSG, "write_chunk() failed, rv=%d fd=%d", rv, fd);
+	return 6;
+    }
+    return 0;
+}
+
+/*
+ * send_get_asset_response() - Reply to a get-asset-map request
+ *
+ *  "/<key>"              - Entry for the given key
+ *  "/"                   - Full OCRP map
+ *  "/?since=<seqno>:<vers>" - OCRPupdate with the changes after seqno,
+ *			    full OCRP map if not covered by the journal,
+ *			    400 if not a valid H record
+ *
+ *  Map replies carry the H record they are current to in the
+ *  HTTP_GET_ASSET_H_HEADER response header, the "since" of the next
+ *  request.
+ */
 static int 
 send_get_asset_response(ptrie_context_t *ctx, token_data_t token, int fd)
 {
@@ -1440,37 +1898,95 @@ send_get_asset_response(ptrie_context_t *ctx, token_data_t token, int fd)
     int vallen;
     int hdrcnt;
     char uristr[1024];
+    char H_str[64];
     const char *http_resp;
     int http_resp_len;
+    char *query;
+    char *since;
+    uint64_t since_seqno;
+    uint64_t since_vers;
+    uint64_t seqno;
+    uint64_t vers;
+    journal_entry_t *je = 0;
+    int entries = 0;
+    int delta = 0;
+    int n;
     int rv;
+    int ret = 0;
 
     rv = HTTPGetKnownHeader(token, 0, H_X_NKN_URI, &val, &vallen, &hdrcnt);
     if (!rv) {
     	if (vallen < (int)sizeof(uristr)) {
 	    memcpy(uristr, val, vallen);
 	    uristr[vallen] = '\0';
+	} else {
+	    CB_LOG(CB_ERROR, "URI too long, len=%d", vallen);
+	    return 1;
 	}
     } else {
 	CB_LOG(CB_ERROR, "HTTPGetKnownHeader() failed, rv=%d", rv);
 	return 1;
     }
 
-    rv = mk_http_response(token, 200, &http_resp, &http_resp_len);
+    query = strchr(uristr, '?');
+    if (query) {
+    	*(query++) = '\0';
+	vallen = query - uristr - 1;
+    }
+
+    if (vallen <= 1) {
+    	since = query ? strstr(query, GET_ASSET_MAP_QS_SINCE) : 0;
+	if (since) {
+	    since += GET_ASSET_MAP_QS_SINCE_STRLEN;
+	    since[strcspn(since, "&")] = '\0';
+	    rv = parse_since(since, &since_seqno, &since_vers);
+	    if (rv) {
+		CB_LOG(CB_MSG, "parse_since(data=%s) failed, rv=%d", 
+		       since, rv);
+		return send_bad_request(token, fd);
+	    }
+	    rv = get_asset_delta(since_seqno, since_vers, &je, &entries, 
+				 &seqno, &vers);
+	    delta = !rv;
+	}
+	if (!delta) {
+	    pthread_mutex_lock(&journal_mutex);
+	    seqno = journal_seqno;
+	    vers = journal_vers;
+	    pthread_mutex_unlock(&journal_mutex);
+	}
+	snprintf(H_str, sizeof(H_str), "%ld:%ld", seqno, vers);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    while (1) { // Begin while
+    ////////////////////////////////////////////////////////////////////////////
+
+    rv = mk_http_response(token, 200, (vallen <= 1) ? H_str : 0, 
+			  &http_resp, &http_resp_len);
     if (rv) {
 	CB_LOG(CB_ERROR, "mk_http_response() failed, rv=%d", rv);
-	return 2;
+	ret = 2;
+	break;
     }
 
     rv = write_data(fd, http_resp, http_resp_len);
     if (rv) {
 	CB_LOG(CB_ERROR, "write_data() failed, rv=%d fd=%d", rv, fd);
-	return 3;
+	ret = 3;
+	break;
     }
 
-    rv = write_chunk(fd, http_resp_body_hdr, http_resp_body_hdr_strlen);
+    if (delta) {
+    	rv = write_chunk(fd, http_resp_update_body_hdr, 
+			 http_resp_update_body_hdr_strlen);
+    } else {
+    	rv = write_chunk(fd, http_resp_body_hdr, http_resp_body_hdr_strlen);
+    }
     if (rv) {
 	CB_LOG(CB_ERROR, "write_chunk() failed, rv=%d fd=%d", rv, fd);
-	return 4;
+	ret = 4;
+	break;
     }
 
     if (vallen > 1) {
@@ -1478,6 +1994,17 @@ send_get_asset_response(ptrie_context_t *ctx, token_data_t token, int fd)
     	if (rv) {
 	    CB_LOG(CB_MSG, "send_get_asset_data() failed, rv=%d fd=%d", rv, fd);
     	}
+    } else if (delta) {
+    	rv = send_get_asset_delta(je, entries, vers, fd);
+	if (rv) {
+	    // Truncated document, client retries
+	    CB_LOG(CB_ERROR, "send_get_asset_delta() failed, rv=%d fd=%d", 
+	    	   rv, fd);
+	    ret = 7;
+	    break;
+	}
+	CB_LOG(CB_MSG, "Delta since=%ld:%ld to %s, keys=%d", 
+	       since_seqno, since_vers, H_str, entries);
     } else {
     	rv = ptrie_list_keys(ctx, (void *)&fd, ptrie_list_keys_callback);
 	if (rv) {
@@ -1485,20 +2012,38 @@ send_get_asset_response(ptrie_context_t *ctx, token_data_t token, int fd)
 	}
     }
 
-    rv = write_chunk(fd, http_resp_body_trailer, 
-		     http_resp_body_trailer_strlen);
+    if (delta) {
+    	rv = write_chunk(fd, http_resp_update_body_trailer, 
+			 http_resp_update_body_trailer_strlen);
+    } else {
+    	rv = write_chunk(fd, http_resp_body_trailer, 
+		     	 http_resp_body_trailer_strlen);
+    }
     if (rv) {
 	CB_LOG(CB_MSG, "write_chunk() failed, rv=%d fd=%d", rv, fd);
-	return 5;
+	ret = 5;
+	break;
     }
 
     rv = write_chunk(fd, 0, 0); // write zero chunk
     if (rv) {
 	CB_LOG(CB_MSG, "write_chunk() failed, rv=%d fd=%d", rv, fd);
-	return 6;
+	ret = 6;
+	break;
     }
+    break;
 
-    return 0;
+    ////////////////////////////////////////////////////////////////////////////
+    } // End while
+    ////////////////////////////////////////////////////////////////////////////
+
+    for (n = 0; n < entries; n++) {
+    	FREE(je[n].key);
+    }
+    if (je) {
+    	FREE(je);
+    }
+    return ret;
 }
 
 static void *
@@ -1656,12 +2201,16 @@ cb_init()
     const OCRP_fh_user_data_t *OCRP_fh;
     char OCRP_state_str[1024];
     ptrie_config_t ptrie_cfg;
+    ptrie_snap_config_t snap_cfg;
 
     assert(sizeof(OCRP_fh_user_data_t) <= sizeof(fh_user_data_t));
     assert(sizeof(OCRP_app_data_t) <= sizeof(app_data_t));
 
     http_resp_body_hdr_strlen = strlen(http_resp_body_hdr);
     http_resp_body_trailer_strlen = strlen(http_resp_body_trailer);
+    http_resp_update_body_hdr_strlen = strlen(http_resp_update_body_hdr);
+    http_resp_update_body_trailer_strlen = 
+    	strlen(http_resp_update_body_trailer);
 
     // Setup ptrie
     memset(&ptrie_cfg, 0, sizeof(ptrie_cfg));
@@ -1685,14 +2234,19 @@ cb_init()
 	return 2;
     }
 
-    rv = ptrie_recover_from_ckpt(pctx, CB_TRIE_CKP_1, CB_TRIE_CKP_2);
+    // Snapshot mode, the checkpoint files of earlier releases are imported
+    memset(&snap_cfg, 0, sizeof(snap_cfg));
+    snap_cfg.group_commit_msecs = CB_TRIE_GROUP_COMMIT_MSECS;
+    rv = ptrie_recover_from_snapshot(pctx, CB_TRIE_SNAP,
+    				     CB_TRIE_CKP_1, CB_TRIE_CKP_2, &snap_cfg);
     if (rv) {
-    	CB_LOG(CB_SEVERE, "ptrie_recover_from_ckpt() failed, rv=%d", rv);
+    	CB_LOG(CB_SEVERE, "ptrie_recover_from_snapshot() failed, rv=%d", rv);
 	return 3;
     }
 
     // Update OCRP state
     OCRP_fh = (OCRP_fh_user_data_t *) ptrie_get_fh_data(pctx);
+    journal_reset(OCRP_fh);
     rv = make_H_record(OCRP_fh->u.d.OCRP_seqno, OCRP_fh->u.d.OCRP_version,
     		       OCRP_state_str, sizeof(OCRP_state_str));
     if (rv) {
@@ -1739,16 +2293,16 @@ cb_init()
 }
 
 /*
- * cb_route -- Given URL_abs_path return the associated route data.
+ * route_lookup -- Route data of the longest prefix of URL_abs_path or, with
+ *		   exact, of URL_abs_path itself.
  *
  * Return:
  *  ==0, Success
- *  !=0, Error
- *
- * 1) port is returned in native byte order
+ *  !=0, Error, CB_ROUTE_NOT_FOUND if no match
  */
-int
-cb_route(const char *URL_abs_path, int all_locations, cb_route_data_t *cb_rd)
+static int
+route_lookup(const char *URL_abs_path, int all_locations, int exact,
+	     cb_route_data_t *cb_rd)
 {
     OCRP_app_data_t ad;
     int rv = 0;
@@ -1777,7 +2331,11 @@ cb_route(const char *URL_abs_path, int all_locations, cb_route_data_t *cb_rd)
 	    break;
 	}
 
-    	rv = ptrie_prefix_match(cb_ptrie_ctx, URL_abs_path, &ad.u.apd);
+	if (exact) {
+	    rv = !ptrie_exact_match(cb_ptrie_ctx, URL_abs_path, &ad.u.apd);
+	} else {
+    	    rv = ptrie_prefix_match(cb_ptrie_ctx, URL_abs_path, &ad.u.apd);
+	}
 	if (rv) {
 	    if (ad.u.d.type == OCRP_AD_TYPE_RECORD) {
 	    	if (all_locations) {
@@ -1812,7 +2370,7 @@ cb_route(const char *URL_abs_path, int all_locations, cb_route_data_t *cb_rd)
 	    	rv = 4; // Bad record type, expected OCRP_AD_TYPE_RECORD
 	    }
 	} else {
-	    rv = 5; // Prefix lookup failed
+	    rv = CB_ROUTE_NOT_FOUND; // Lookup failed
 	}
 
 	/* Unlock ptrie */
@@ -1834,6 +2392,21 @@ cb_route(const char *URL_abs_path, int all_locations, cb_route_data_t *cb_rd)
     return rv;
 }
 
+/*
+ * cb_route -- Given URL_abs_path return the associated route data.
+ *
+ * Return:
+ *  ==0, Success
+ *  !=0, Error
+ *
+ * 1) port is returned in native byte order
+ */
+int
+cb_route(const char *URL_abs_path, int all_locations, cb_route_data_t *cb_rd)
+{
+    return route_lookup(URL_abs_path, all_locations, 0 /* prefix */, cb_rd);
+}
+
 /*
  * End of cb_router.c
  */
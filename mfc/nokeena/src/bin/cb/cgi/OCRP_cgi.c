@@ -567,12 +567,40 @@ int process_get_status(void)
     return rv;
 }
 
+static char get_asset_H_header[128]; // Broker HTTP_GET_ASSET_H_HEADER line
+static int get_asset_hdr_sent;
+
+static size_t
+curl_headerfunc(void* buffer, size_t size, size_t nmemb, void *userp)
+{
+    UNUSED_ARGUMENT(userp);
+    size_t bytes = size * nmemb;
+
+    if ((bytes > HTTP_GET_ASSET_H_HEADER_STRLEN) && 
+    	(bytes < sizeof(get_asset_H_header)) &&
+	!strncasecmp((char *)buffer, HTTP_GET_ASSET_H_HEADER ":", 
+		     HTTP_GET_ASSET_H_HEADER_STRLEN + 1)) {
+	memcpy(get_asset_H_header, buffer, bytes);
+	get_asset_H_header[bytes] = '\0';
+	DBGMSG("%s", get_asset_H_header);
+    }
+    return bytes;
+}
+
 static size_t 
 curl_writefunc(void* buffer, size_t size, size_t nmemb, void *userp)
 {
     UNUSED_ARGUMENT(userp);
     size_t bytes;
 
+    if (!get_asset_hdr_sent) {
+    	// Pass the map H record on, ahead of the terminating content type
+    	if (get_asset_H_header[0]) {
+	    fputs(get_asset_H_header, cgiOut);
+	}
+    	cgiHeaderContentType((char *)"application/octet-stream");
+	get_asset_hdr_sent = 1;
+    }
     bytes = fwrite(buffer, size, nmemb, cgiOut);
 
     DBGMSG("fwrite(bytes=%ld buf=%p, size=%ld nmemb=%ld userp=%p", 
@@ -622,8 +650,10 @@ int process_get_asset_map(void)
 {
     char errbuf[1024 * 1024];
     char URL[4 * 1024];
-    const char *key;
+    const char *key = 0;
+    const char *since = 0;
     const char *format;
+    int sincelen;
     CURL *ech = 0;
     CURLcode eret = CURLE_OK;
     long arglval;
@@ -636,14 +666,18 @@ int process_get_asset_map(void)
 	key = strstr(cgiQueryString, GET_ASSET_MAP_QS_KEY);
 	if (key) {
 	    key += GET_ASSET_MAP_QS_KEY_STRLEN;
+	} else {
+	    // Get the changes since the given H record
+	    since = strstr(cgiQueryString, GET_ASSET_MAP_QS_SINCE);
 	}
 
-	if (!key || !(*key)) {
+	if (key ? !(*key) : !since) {
 	    ERRMSG(ER_BAD_QUERYSTRING, "[Invalid querystring=[%s]]", 
 	    	   cgiQueryString);
 	    return 1;
 	}
-    } else {
+    }
+    if (!key) {
     	// Get all entries
 	key = "/";
     }
@@ -658,6 +692,10 @@ int process_get_asset_map(void)
 		  HTTP_GET_ASSET_SERVER_IP, HTTP_GET_ASSET_SERVER_PORT, key);
     if (rv >= sizeof(URL)) {
     	URL[sizeof(URL)-1] = '\0';
+    } else if (since) {
+    	// Broker falls back to the full map if it cannot serve the delta
+    	sincelen = strcspn(since, "&");
+	snprintf(&URL[rv], sizeof(URL) - rv, "?%.*s", sincelen, since);
     }
 
 
@@ -692,6 +730,12 @@ int process_get_asset_map(void)
 	break;
     }
 
+    eret = curl_easy_setopt(ech, CURLOPT_HEADERFUNCTION, curl_headerfunc);
+    if (eret != CURLE_OK) {
+    	ret = 19;
+	break;
+    }
+
     eret = curl_easy_setopt(ech, CURLOPT_DEBUGFUNCTION, curl_debugfunc);
     if (eret != CURLE_OK) {
     	ret = 14;
@@ -719,13 +763,21 @@ int process_get_asset_map(void)
 	break;
     }
 
-    cgiHeaderContentType((char *)"application/octet-stream");
-
     eret = curl_easy_perform(ech);
     if (eret != CURLE_OK) {
     	ret = 18;
 	break;
     }
+    if (!get_asset_hdr_sent) { // No body
+	arglval = 0;
+	curl_easy_getinfo(ech, CURLINFO_RESPONSE_CODE, &arglval);
+	if (arglval == 400) {
+	    // Broker rejected the "since" value
+	    cgiHeaderStatus(400, (char *)"Bad Request");
+	} else {
+	    cgiHeaderContentType((char *)"application/octet-stream");
+	}
+    }
 
     break;
     ////////////////////////////////////////////////////////////////////////////
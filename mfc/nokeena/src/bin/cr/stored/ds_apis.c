@@ -16,6 +16,9 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/prctl.h>
 
 #include "ds_hash_table_mgmt.h"
 #include "nkn_memalloc.h"
@@ -23,6 +26,7 @@
 #include "ds_api.h"
 #include "ds_glob_ctx.h"
 #include "de_intf.h"
+#include "de_snapshot.h"
 #include "ds_tables.h"
 #include "store_errno.h"
 #include "common/nkn_ref_count_mem.h"
@@ -41,6 +45,22 @@ AO_t glob_crst_num_cache_entities_active;
 
 uint64_t glob_crst_lookup_err = 0;
 uint64_t glob_crst_de_fail = 0;
+AO_t glob_crst_de_snap_hits;
+AO_t glob_crst_de_snap_miss;
+AO_t glob_crst_de_snap_builds;
+AO_t glob_crst_de_snap_build_err;
+
+/* decision snapshot builder; domains whose published snapshot is
+ * stale are queued here from the data plane and recompiled off the
+ * query path
+ */
+#define DS_DE_SNAP_RECLAIM_INTERVAL 1 // seconds
+/* LF load change that invalidates the decision snapshots */
+#define DS_LF_LOAD_GEN_DELTA 5.0
+static pthread_t ds_de_snap_thread;
+static pthread_mutex_t ds_de_snap_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ds_de_snap_cond = PTHREAD_COND_INITIALIZER;
+static GQueue ds_de_snap_queue = G_QUEUE_INIT;
 
 /* Function declarations*/
 static int32_t cleanup_CE(cache_entity_t *ce);
@@ -82,6 +102,11 @@ static int32_t create_new_domain(char *domain_name,
 				 domain_t **out);
 static int32_t static_route_list_cleanup(
 		 struct ip_addr_range_list_t *head);
+static int32_t fill_search_out(cache_group_t *cg_ctx,
+			       crst_search_out_t *out);
+static void ds_de_snap_schedule(ref_count_mem_t *ref);
+static void ds_de_snap_build(ref_count_mem_t *ref);
+static void *ds_de_snap_builder(void *arg);
 /*===============================
    Data plane access commands
 ===============================*/
@@ -328,6 +353,7 @@ int32_t add_CE_to_CG(char* cg_name,
     /*Update CE in CG and vice versa*/
     cg->ce_ptr_list = g_list_append(cg->ce_ptr_list, ce);
     ce->cg_ptr_list = g_list_append(ce->cg_ptr_list, cg);
+    ds_cont_mark_updated();
     ds_cont_write_unlock(ds_ce);
     ds_cont_write_unlock(ds_cg);
     return 0;
@@ -369,6 +395,7 @@ int32_t del_CE_from_CG(char* cg_name, char* ce_name){
     /*Update CE in CG and vice versa*/
     cg->ce_ptr_list = g_list_remove(cg->ce_ptr_list, ce);
     ce->cg_ptr_list = g_list_remove(ce->cg_ptr_list, cg);
+    ds_cont_mark_updated();
     ds_cont_write_unlock(ds_ce);
     ds_cont_write_unlock(ds_cg);
     return 0;
@@ -655,6 +682,8 @@ int32_t create_new_CE(const char* ce_name,
 	}
 	AO_fetch_and_add1(&glob_crst_num_cache_entities_active);
     }
+    /* address or load watermark may have changed */
+    ds_cont_mark_updated();
     ds_cont_write_unlock(ds_ce);
     return rv;
 
@@ -755,7 +784,25 @@ static int32_t CE_lf_update(void *arg, const lf_stats_t *const stats,
     
     switch (ce->state) {
 	case CE_ACTIVE:
-	    memcpy(&ce->fb, stats, sizeof(lf_stats_t));
+	    if (memcmp(&ce->fb, stats, sizeof(lf_stats_t))) {
+		/* decision snapshots built from the old stats are only
+		 * stale if the CE went up/down, crossed its watermark or
+		 * its load moved noticeably; small load jitter is
+		 * ignored so that snapshots and their prefix memos
+		 * survive between polls
+		 */
+		if (ce->fb.status != stats->status ||
+		    (ce->fb.cpu_load > ce->load_watermark) !=
+		    (stats->cpu_load > ce->load_watermark) ||
+		    fabs(stats->cpu_load - ce->fb_gen_load) >=
+		    DS_LF_LOAD_GEN_DELTA) {
+		    ce->fb_gen_load = stats->cpu_load;
+		    memcpy(&ce->fb, stats, sizeof(lf_stats_t));
+		    ds_cont_mark_updated();
+		} else {
+		    memcpy(&ce->fb, stats, sizeof(lf_stats_t));
+		}
+	    }
 	    break;
 	case CE_DEAD:
 	    ce->lfc->set_state(ce->lfc, LF_CLIENT_STOP);
@@ -889,6 +936,7 @@ int32_t create_new_POP(char* pop_name,
 
     if (latitude) pop->location.latitude = atof(latitude);
     if (longitude) pop->location.longitude = atof(longitude);
+    if (latitude || longitude) ds_cont_mark_updated();
 
     if (add_flag) {
 	/*Add POP to its hash table*/
@@ -968,6 +1016,7 @@ int32_t map_CE_to_POP(char* pop_name, char* ce_name){
      */
     pop->ce_ptr_list = g_list_append(pop->ce_ptr_list, ce);
     ce->pop = pop;
+    ds_cont_mark_updated();
 
     ds_cont_write_unlock(ds_pp);
     ds_cont_write_unlock(ds_ce);
@@ -1012,6 +1061,7 @@ int32_t del_CE_from_POP(char* pop_name, char* ce_name){
 
     pop->ce_ptr_list= g_list_remove(pop->ce_ptr_list, ce);
     ce->pop = NULL;
+    ds_cont_mark_updated();
     
     ds_cont_write_unlock(ds_pp);
     ds_cont_write_unlock(ds_ce);
@@ -1333,6 +1383,8 @@ int32_t update_attr_domain(char* domain_name,
 	ref->hold_ref_cont(ref);
     }
 
+    /* routing policy or TTL may have changed */
+    ds_cont_mark_updated();
     free(rev_str);
     ds_cont_write_unlock(ds_dn);
     return rv;
@@ -1436,6 +1488,7 @@ static void free_ref_domain(void *arg) {
 static void cleanup_domain(domain_t *domain) {
     
     if (domain) {
+	de_snapshot_publish(&domain->de_snap, NULL);
 	domain->de_cb->cleanup(domain->de_state);
 	if(domain->attributes) 
 	    ds_hash_table_mgmt_deinit(domain->attributes);
@@ -1492,6 +1545,7 @@ int32_t add_cg_to_domain(char* domain_name, char* cg_name){
     domain = ref_domain->mem;
     domain->cg_ptr_list = g_list_append(domain->cg_ptr_list, cg);
     cg->domain_list = g_list_append(cg->domain_list, domain);
+    ds_cont_mark_updated();
 
     free(rev_str);
     ds_cont_write_unlock(ds_cg);
@@ -1542,6 +1596,7 @@ int32_t del_cg_from_domain(char*domain_name, char* cg_name){
     /*Delete CG from domain list*/
     domain->cg_ptr_list= g_list_remove(domain->cg_ptr_list, cg);
     cg->domain_list = g_list_remove(cg->domain_list, domain);
+    ds_cont_mark_updated();
     free(rev_str);
     ds_cont_write_unlock(ds_cg);
     ds_cont_write_unlock(ds_dn);
@@ -1634,9 +1689,146 @@ int32_t init_dstore(void){
     ds_hash_table_mgmt_init( ds_glob_ctx->CEname_CEptr);
     ds_hash_table_mgmt_init( ds_glob_ctx->POPname_POPptr);
     ds_trie_mgmt_init( ds_glob_ctx->domainname_domainptr);
+    pthread_create(&ds_de_snap_thread, NULL, ds_de_snap_builder, NULL);
     return  0;
 }
 
+/** 
+ * queues a domain for a decision snapshot rebuild. Called from the
+ * data plane with the domain container read locked; at most one
+ * rebuild per domain is queued at any time
+ * 
+ * @param ref - reference counted domain
+ */
+static void ds_de_snap_schedule(ref_count_mem_t *ref) {
+
+    domain_t *domain = ref->mem;
+
+    if (domain->rp.type != ROUTING_TYPE_RR &&
+	domain->rp.type != ROUTING_TYPE_GEOLOAD) {
+	return;
+    }
+    if (domain->de_snap_fail_gen == ds_cont_get_gen()) {
+	return;
+    }
+    if (!AO_compare_and_swap(&domain->de_snap_pending, 0, 1)) {
+	return;
+    }
+
+    ref->hold_ref_cont(ref);
+    pthread_mutex_lock(&ds_de_snap_lock);
+    g_queue_push_tail(&ds_de_snap_queue, ref);
+    pthread_cond_signal(&ds_de_snap_cond);
+    pthread_mutex_unlock(&ds_de_snap_lock);
+}
+
+/** 
+ * compiles and publishes a fresh decision snapshot for a domain. The
+ * store is read under the same locks as the slow lookup path, the
+ * snapshot itself is compiled and swapped in after they are dropped
+ * 
+ * @param ref - reference counted domain, the reference taken when
+ * the domain was queued is released here
+ */
+static void ds_de_snap_build(ref_count_mem_t *ref) {
+
+    domain_t *domain = ref->mem;
+    crst_search_out_t out;
+    cache_group_t *cg_ctx = NULL;
+    de_snapshot_t *snap = NULL;
+    hash_tbl_props_t* ds_dn = ds_glob_ctx->domainname_domainptr;
+    hash_tbl_props_t* ds_cg = ds_glob_ctx->CGname_CGptr;
+    hash_tbl_props_t* ds_ce = ds_glob_ctx->CEname_CEptr;
+    hash_tbl_props_t* ds_pp = ds_glob_ctx->POPname_POPptr;
+    uint64_t gen;
+    int32_t rc = 0;
+
+    memset(&out, 0, sizeof(crst_search_out_t));
+    ds_cont_read_lock(ds_dn);
+    ds_cont_read_lock(ds_cg);
+    ds_cont_read_lock(ds_ce);
+    ds_cont_read_lock(ds_pp);
+    /* sample the generation before reading, so that any update
+     * racing with the compile leaves the snapshot stale and gets it
+     * rebuilt again
+     */
+    gen = ds_cont_get_gen();
+    if (g_list_first(domain->cg_ptr_list) == NULL) {
+	rc = -E_CG_DOMAIN_BINDING_ABSENT;
+	goto unlock;
+    }
+    cg_ctx = (cache_group_t*)domain->cg_ptr_list->data;
+    out.ce_count = g_list_length(cg_ctx->ce_ptr_list);
+    if (!out.ce_count) {
+	rc = -E_CE_CG_BINDING_ABSENT;
+	goto unlock;
+    }
+    out.ce_attr = nkn_calloc_type(out.ce_count, sizeof(crst_ce_attr_t),
+				  mod_cr_ds);
+    if (!out.ce_attr) {
+	rc = -ENOMEM;
+	goto unlock;
+    }
+    out.ttl = domain->ttl;
+    out.in_addr_type = ce_addr_type_max;
+    rc = fill_search_out(cg_ctx, &out);
+    if (!rc) {
+	rc = de_snapshot_create(&out, domain->rp.type, gen, &snap);
+    }
+
+ unlock:
+    ds_cont_read_unlock(ds_pp);
+    ds_cont_read_unlock(ds_ce);
+    ds_cont_read_unlock(ds_cg);
+    ds_cont_read_unlock(ds_dn);
+
+    if (rc) {
+	AO_fetch_and_add1(&glob_crst_de_snap_build_err);
+	DBG_LOG(MSG, MOD_CRST, "unable to compile decision snapshot "
+		"for domain %s, using the slow path [err=%d]",
+		domain->name, rc);
+	/* an unpublishable domain is not retried until the store
+	 * changes; drop any stale snapshot so the slow path decides
+	 */
+	domain->de_snap_fail_gen = gen;
+	de_snapshot_publish(&domain->de_snap, NULL);
+    } else {
+	AO_fetch_and_add1(&glob_crst_de_snap_builds);
+	de_snapshot_publish(&domain->de_snap, snap);
+    }
+    if (out.ce_attr) free(out.ce_attr);
+    AO_store(&domain->de_snap_pending, 0);
+    ref->release_ref_cont(ref);
+}
+
+static void *ds_de_snap_builder(void *arg) {
+
+    ref_count_mem_t *ref = NULL;
+    struct timespec ts;
+
+    prctl(PR_SET_NAME, "cr-de-snap", 0, 0, 0);
+    while (1) {
+	pthread_mutex_lock(&ds_de_snap_lock);
+	while (g_queue_is_empty(&ds_de_snap_queue)) {
+	    clock_gettime(CLOCK_REALTIME, &ts);
+	    ts.tv_sec += DS_DE_SNAP_RECLAIM_INTERVAL;
+	    if (pthread_cond_timedwait(&ds_de_snap_cond, &ds_de_snap_lock,
+				       &ts) == ETIMEDOUT) {
+		break;
+	    }
+	}
+	ref = g_queue_pop_head(&ds_de_snap_queue);
+	pthread_mutex_unlock(&ds_de_snap_lock);
+
+	if (ref) {
+	    ds_de_snap_build(ref);
+	}
+	de_snapshot_reclaim();
+    }
+
+    return arg;
+}
+
 
 int32_t get_domain_lookup_resp(char const* dname, char const* qtype_str, 
 	char const* src_ip, char** response, uint32_t* response_len) {
@@ -1648,16 +1840,43 @@ int32_t get_domain_lookup_resp(char const* dname, char const* qtype_str,
     hash_tbl_props_t* ds_cg = ds_glob_ctx->CGname_CGptr;
     hash_tbl_props_t* ds_ce = ds_glob_ctx->CEname_CEptr;
     hash_tbl_props_t* ds_pp = ds_glob_ctx->POPname_POPptr;
+    domain_t* domain_ctx = NULL;
+    de_snapshot_t *snap = NULL;
+
     ds_cont_read_lock(ds_dn);
-    ds_cont_read_lock(ds_cg);
-    ds_cont_read_lock(ds_ce);
-    ds_cont_read_lock(ds_pp);
     lookup_dns(dname, src_ip, (void**)&ref);
     if (ref == NULL) {
 	rv = 2;
-	goto clean_return;
+	ds_cont_read_unlock(ds_dn);
+	return rv;
+    }
+    domain_ctx = ref->mem;
+
+    /* fast path, decide from the compiled snapshot without touching
+     * the CG/CE/POP containers. A stale snapshot is still used while
+     * its replacement is compiled in the background
+     */
+    snap = de_snapshot_acquire(&domain_ctx->de_snap);
+    if (!snap || snap->gen != ds_cont_get_gen()) {
+	ds_de_snap_schedule(ref);
+    }
+    if (snap) {
+	rv = de_snapshot_decide(snap, src_ip ? src_ip : "", qtype,
+				(uint8_t **)response, response_len);
+	de_snapshot_release(snap);
+	if (!rv) {
+	    AO_fetch_and_add1(&glob_crst_de_snap_hits);
+	    domain_ctx->stats.num_hits++;
+	    ds_cont_read_unlock(ds_dn);
+	    return rv;
+	}
+	rv = 0;
     }
-    domain_t* domain_ctx = ref->mem;
+    AO_fetch_and_add1(&glob_crst_de_snap_miss);
+
+    ds_cont_read_lock(ds_cg);
+    ds_cont_read_lock(ds_ce);
+    ds_cont_read_lock(ds_pp);
     if (searchCR_Store(dname, src_ip, qtype, 
 		       domain_ctx,
 		       response, response_len) < 0) {
@@ -1674,52 +1893,28 @@ clean_return:
 }
 
 
-static int32_t searchCR_Store(char const* dname, char const* src_ip,
-	      cache_entity_addr_type_t qtype, domain_t* domain_ctx, 
-	      char** result, uint32_t *result_size) {
-
-    int32_t rc = 0;
-    if (g_list_first(domain_ctx->cg_ptr_list) == NULL) {
-	glob_crst_lookup_err++;
-	rc = -E_CG_DOMAIN_BINDING_ABSENT;
-	DBG_LOG(ERROR, MOD_CRST, "Error no CG bound to domain %s "
-		"[err=%d]", domain_ctx->name, rc);
-	return -1;
-    }
+/** 
+ * fills the per cache entity attributes that the decision engines
+ * operate on from the CE's bound to a cache group. The address
+ * pointers reference the CE's and are valid only while the store
+ * containers are read locked
+ * 
+ * @param cg_ctx - cache group to read the CE's from
+ * @param out - search output with ce_attr sized for the CE list
+ * 
+ * @return 0 on success and a negative error code otherwise
+ */
+static int32_t fill_search_out(cache_group_t *cg_ctx,
+			       crst_search_out_t *out) {
 
-    crst_search_out_t* out = NULL;
-    cache_group_t* cg_ctx = (cache_group_t*)domain_ctx->cg_ptr_list->data;
+    GList *ce_list = cg_ctx->ce_ptr_list;
     uint32_t i = 0;
-    de_input_t di;
-    int32_t de_res = 0;
-    rrecord_msg_fmt_builder_t *rrb = NULL;
-
-    GList *ce_list = cg_ctx->ce_ptr_list, *first = NULL;
-    if (g_list_first(ce_list) == NULL) {
-	rc = -E_CE_CG_BINDING_ABSENT;
-	DBG_LOG(ERROR, MOD_CRST, "Error no CE bound to CG %s "
-		"[err=%d]", cg_ctx->name, rc);
-	goto clear_return;
-    }
-
-    /* fill 'out's' global fields */
-    out = nkn_malloc_type(1 * sizeof(crst_search_out_t), mod_cr_ds);
-    out->ce_count = g_list_length(ce_list);
-    out->ce_attr = nkn_malloc_type(out->ce_count * sizeof(crst_ce_attr_t),
-				   mod_cr_ds);
+    int32_t rc = 0;
 
-    out->ttl = domain_ctx->ttl;
-    out->in_addr_type = qtype; /* def */
-    if (src_ip) {
-	snprintf(out->resolv_addr, 32, "%s", src_ip);
-    } else {
-	out->resolv_addr[0] = '\0';
-    }
-    for (; i < out->ce_count; i++)
+    for (i = 0; i < out->ce_count; i++)
 	out->ce_attr[i].num_addr = 0;
 
     i = 0;
-
     do {
 
 	cache_entity_t* ce = (cache_entity_t*)ce_list->data;
@@ -1727,13 +1922,12 @@ static int32_t searchCR_Store(char const* dname, char const* src_ip,
 	    rc = -E_CE_POP_BINDING_ABSENT;
 	    DBG_LOG(ERROR, MOD_CRST, "Error CE %s to POP binding "
 		    "not available [err=%d]", ce->name, rc);
-	    goto clear_return;
+	    return rc;
 	}
 	memcpy(&out->ce_attr[i].stats, &ce->fb, sizeof(lf_stats_t));
 	memcpy(&out->ce_attr[i].loc_attr, &ce->pop->location,
 		sizeof(conjugate_graticule_t));
 	out->ce_attr[i].load_watermark = ce->load_watermark;
-	uint32_t j = 0;
 
 	if (ce->addr[ce_addr_type_ipv4][0] != '\0') {
 	    out->ce_attr[i].addr[out->ce_attr[i].num_addr] =
@@ -1764,6 +1958,55 @@ static int32_t searchCR_Store(char const* dname, char const* src_ip,
 	}
 	i++;
     } while ((ce_list = g_list_next(ce_list)) != NULL);
+
+    return rc;
+}
+
+static int32_t searchCR_Store(char const* dname, char const* src_ip,
+	      cache_entity_addr_type_t qtype, domain_t* domain_ctx, 
+	      char** result, uint32_t *result_size) {
+
+    int32_t rc = 0;
+    if (g_list_first(domain_ctx->cg_ptr_list) == NULL) {
+	glob_crst_lookup_err++;
+	rc = -E_CG_DOMAIN_BINDING_ABSENT;
+	DBG_LOG(ERROR, MOD_CRST, "Error no CG bound to domain %s "
+		"[err=%d]", domain_ctx->name, rc);
+	return -1;
+    }
+
+    crst_search_out_t* out = NULL;
+    cache_group_t* cg_ctx = (cache_group_t*)domain_ctx->cg_ptr_list->data;
+    uint32_t i = 0;
+    de_input_t di;
+    int32_t de_res = 0;
+    rrecord_msg_fmt_builder_t *rrb = NULL;
+
+    GList *ce_list = cg_ctx->ce_ptr_list, *first = NULL;
+    if (g_list_first(ce_list) == NULL) {
+	rc = -E_CE_CG_BINDING_ABSENT;
+	DBG_LOG(ERROR, MOD_CRST, "Error no CE bound to CG %s "
+		"[err=%d]", cg_ctx->name, rc);
+	goto clear_return;
+    }
+
+    /* fill 'out's' global fields */
+    out = nkn_malloc_type(1 * sizeof(crst_search_out_t), mod_cr_ds);
+    out->ce_count = g_list_length(ce_list);
+    out->ce_attr = nkn_malloc_type(out->ce_count * sizeof(crst_ce_attr_t),
+				   mod_cr_ds);
+
+    out->ttl = domain_ctx->ttl;
+    out->in_addr_type = qtype; /* def */
+    if (src_ip) {
+	snprintf(out->resolv_addr, 32, "%s", src_ip);
+    } else {
+	out->resolv_addr[0] = '\0';
+    }
+    rc = fill_search_out(cg_ctx, out);
+    if (rc) {
+	goto clear_return;
+    }
     de_res = 1;
     switch(domain_ctx->rp.type) {
 	case ROUTING_TYPE_STATIC:
@@ -24,6 +24,12 @@
 //static pthread_mutex_t hash_table_lock;
 uint64_t glob_ds_hash_table_mgmt_entries;
 
+/* bumped by the store writers on changes that alter a routing
+ * decision, consumers of compiled store state compare against it to
+ * detect staleness
+ */
+AO_t glob_ds_cont_gen = 1;
+
 int32_t ds_hash_table_mgmt_init(hash_tbl_props_t* htp){
     //    GHashTable *ds_hash_table;
     htp->htable = g_hash_table_new(g_str_hash, g_str_equal);
@@ -197,3 +203,13 @@ int32_t ds_cont_write_unlock(hash_tbl_props_t* ds_cn) {
     return pthread_rwlock_unlock(&ds_cn->lock);
 }
 
+void ds_cont_mark_updated(void) {
+
+    AO_fetch_and_add1(&glob_ds_cont_gen);
+}
+
+uint64_t ds_cont_get_gen(void) {
+
+    return AO_load(&glob_ds_cont_gen);
+}
+
@@ -0,0 +1,56 @@
+/*
+ * @file jpsd_epoch.c
+ * @brief
+ * jpsd_epoch.c - epoch based reclamation for lock free table readers
+ *
+ * Copyright (c) 2015, Juniper Networks, Inc.
+ * All rights reserved.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <atomic_ops.h>
+
+#include "jpsd_epoch.h"
+
+AO_t jpsd_epoch = 1;
+__thread jpsd_epoch_thr_t *jpsd_epoch_thr;
+
+static jpsd_epoch_thr_t epoch_thr[MAX_EPOCH_THREADS];
+static AO_t epoch_nthr;
+
+/*
+ * Slots are never given back, threads of jpsd are long lived
+ * (tdf-recv, epoll and diameter threads).
+ */
+jpsd_epoch_thr_t *jpsd_epoch_register(void)
+{
+	AO_t slot;
+
+	slot = AO_fetch_and_add1(&epoch_nthr);
+	assert(slot < MAX_EPOCH_THREADS);
+	jpsd_epoch_thr = &epoch_thr[slot];
+
+	return jpsd_epoch_thr;
+}
+
+int jpsd_epoch_safe(AO_t retire_epoch)
+{
+	AO_t nthr;
+	AO_t epoch;
+	AO_t i;
+
+	nthr = AO_load_acquire(&epoch_nthr);
+	if (nthr > MAX_EPOCH_THREADS)
+		nthr = MAX_EPOCH_THREADS;
+
+	for (i = 0; i < nthr; i++) {
+		epoch = AO_load_acquire(&epoch_thr[i].epoch);
+		if (epoch && epoch <= retire_epoch)
+			return 0;
+	}
+
+	return 1;
+}
@@ -0,0 +1,78 @@
+/*
+ * @file jpsd_epoch.h
+ * @brief
+ * jpsd_epoch.h - epoch based reclamation for lock free table readers
+ *
+ * Readers bracket a table walk with jpsd_epoch_enter()/jpsd_epoch_exit()
+ * and take no lock.  Writers serialize on their bucket lock, unlink an
+ * entry with JPSD_EPOCH_ASSIGN() and tag it with jpsd_epoch_retire().
+ * The entry may be reused once jpsd_epoch_safe() says every reader that
+ * could still see it has left its section.
+ *
+ * Copyright (c) 2015, Juniper Networks, Inc.
+ * All rights reserved.
+ *
+ */
+
+#ifndef _JPSD_EPOCH_H
+#define _JPSD_EPOCH_H
+
+#include <stdint.h>
+#include <atomic_ops.h>
+
+#define MAX_EPOCH_THREADS	256
+
+typedef struct jpsd_epoch_thr_s {
+	AO_t epoch;		/* 0 => not in a section */
+	int nest;		/* owner thread only */
+	char pad[64 - sizeof(AO_t) - sizeof(int)];
+} __attribute__((aligned(64))) jpsd_epoch_thr_t;
+
+extern AO_t jpsd_epoch;
+extern __thread jpsd_epoch_thr_t *jpsd_epoch_thr;
+
+jpsd_epoch_thr_t *jpsd_epoch_register(void);
+
+/* Readers: published pointer loads and stores */
+#define JPSD_EPOCH_DEREF(p) \
+	((__typeof__(p))AO_load_acquire((AO_t *)&(p)))
+#define JPSD_EPOCH_ASSIGN(p, v) \
+	AO_store_release((AO_t *)&(p), (AO_t)(v))
+
+static inline void jpsd_epoch_enter(void)
+{
+	jpsd_epoch_thr_t *thr = jpsd_epoch_thr;
+
+	if (thr == NULL)
+		thr = jpsd_epoch_register();
+	if (thr->nest++ == 0) {
+		AO_store(&thr->epoch, AO_load(&jpsd_epoch));
+		/* Publish before the first table load */
+		AO_nop_full();
+	}
+}
+
+static inline void jpsd_epoch_exit(void)
+{
+	jpsd_epoch_thr_t *thr = jpsd_epoch_thr;
+
+	if (--thr->nest == 0)
+		AO_store_release(&thr->epoch, 0);
+}
+
+/*
+ * jpsd_epoch_retire() - called after the entry is unlinked, returns the
+ *			 epoch to pass to jpsd_epoch_safe()
+ */
+static inline AO_t jpsd_epoch_retire(void)
+{
+	return AO_fetch_and_add1_full(&jpsd_epoch);
+}
+
+/*
+ * jpsd_epoch_safe() - no reader section started at or before the
+ *		       retire epoch is still running
+ */
+int jpsd_epoch_safe(AO_t retire_epoch);
+
+#endif // _JPSD_EPOCH_H
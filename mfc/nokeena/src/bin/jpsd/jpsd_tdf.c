@@ -46,9 +46,10 @@ int tdf_session_init_done;
 AO_t endtoend;
 
 tdf_recv_thread_t g_tdf_thrs[MAX_TDF_THREADS];
+static __thread int tdf_thr_id = -1;	/* tdf-recv thread number */
 
-pthread_mutex_t session_mutex[MAX_SESSION_HASH];
-TAILQ_HEAD(tdf_session_head_s, tdf_session_s) g_tdf_session[MAX_SESSION_HASH];
+pthread_mutex_t session_mutex[MAX_SESSION_HASH];	/* writers only */
+tdf_session_t *g_tdf_session[MAX_SESSION_HASH];
 
 tdf_session_t *gtdf_session;
 session_mgr_t session_mgr;
@@ -107,15 +108,20 @@ NKNCNT_DEF(dia_domain_incarn_err, uint64_t, "", "Request Domain Removed")
 
 NKNCNT_DEF(dia_ip_mem_err, uint64_t, "", "Mem failure for adding IP")
 
-static void *tdf_get_session(void)
+/*
+ * Free sessions: the global slot ring is shared by the tdf-recv threads,
+ * each keeps up to 2 * TDF_SESSION_BATCH sessions of its own and only
+ * takes session_mgr_mutex to move a batch.  A session is created and
+ * deleted by the thread owning its hash (ccr->thread_id).
+ */
+static int session_mgr_get(tdf_recv_thread_t *thr, int cnt)
 {
 	tdf_session_t *tdf_session;
 	int slot;
+	int i;
 
 	pthread_mutex_lock(&session_mgr_mutex);
-	if (session_mgr.total == 0) {
-		tdf_session = NULL;
-	} else {
+	for (i = 0; i < cnt && session_mgr.total; i++) {
 		slot = session_mgr.slot[session_mgr.head];
 		tdf_session = &gtdf_session[slot];
 		session_mgr.total--;
@@ -123,29 +129,105 @@ static void *tdf_get_session(void)
 		if (session_mgr.head == MAX_TDF_SESSION) {
 			session_mgr.head = 0;
 		}
+		tdf_session->free_next = thr->free_session;
+		thr->free_session = tdf_session;
+		thr->tot_free++;
+	}
+	pthread_mutex_unlock(&session_mgr_mutex);
+
+	return i;
+}
+
+static void session_mgr_put(tdf_recv_thread_t *thr, int cnt)
+{
+	tdf_session_t *tdf_session;
+	int i;
+
+	pthread_mutex_lock(&session_mgr_mutex);
+	for (i = 0; i < cnt && thr->free_session; i++) {
+		tdf_session = thr->free_session;
+		thr->free_session = tdf_session->free_next;
+		thr->tot_free--;
+		session_mgr.slot[session_mgr.tail] = tdf_session->slot;
+		session_mgr.total++;
+		session_mgr.tail++;
+		if (session_mgr.tail == MAX_TDF_SESSION) {
+			session_mgr.tail = 0;
+		}
 	}
 	pthread_mutex_unlock(&session_mgr_mutex);
 
+	return;
+}
+
+/*
+ * Retired sessions may still be walked by lookups of other threads,
+ * they become free once their retire epoch is safe.
+ */
+static void tdf_reclaim_sessions(tdf_recv_thread_t *thr)
+{
+	tdf_session_t *tdf_session;
+
+	while ((tdf_session = thr->retired_head) != NULL) {
+		if (!jpsd_epoch_safe(tdf_session->retire_epoch))
+			break;
+		thr->retired_head = tdf_session->free_next;
+		if (thr->retired_head == NULL)
+			thr->retired_tail = NULL;
+		tdf_session->free_next = thr->free_session;
+		thr->free_session = tdf_session;
+		thr->tot_free++;
+	}
+
+	return;
+}
+
+static void *tdf_get_session(int id)
+{
+	tdf_recv_thread_t *thr = &g_tdf_thrs[id];
+	tdf_session_t *tdf_session;
+
+	tdf_reclaim_sessions(thr);
+	if (thr->free_session == NULL)
+		session_mgr_get(thr, TDF_SESSION_BATCH);
+
+	tdf_session = thr->free_session;
+	if (tdf_session) {
+		thr->free_session = tdf_session->free_next;
+		thr->tot_free--;
+		tdf_session->free_next = NULL;
+		tdf_session->hash_next = NULL;
+	}
+
 	return tdf_session;
 }
 
-static void tdf_put_session(tdf_session_t *tdf_session)
+/*
+ * Called with tdf_session unlinked from g_tdf_session[]
+ */
+static void tdf_put_session(int id, tdf_session_t *tdf_session)
 {
-	int slot;
+	tdf_recv_thread_t *thr = &g_tdf_thrs[id];
 
 	if (tdf_session->del_list)
 		free(tdf_session->del_list);
 	if (tdf_session->add_list)
 		free(tdf_session->add_list);
-	slot = tdf_session->slot;
-	pthread_mutex_lock(&session_mgr_mutex);
-	session_mgr.slot[session_mgr.tail] = slot;
-	session_mgr.total++;
-	session_mgr.tail++;
-	if (session_mgr.tail == MAX_TDF_SESSION) {
-		session_mgr.tail = 0;
-	}
-	pthread_mutex_unlock(&session_mgr_mutex);
+	tdf_session->del_list = NULL;
+	tdf_session->add_list = NULL;
+
+	/* hash_next kept, lookups may still be walking it */
+	tdf_session->retire_epoch = jpsd_epoch_retire();
+	tdf_session->free_next = NULL;
+	if (thr->retired_tail)
+		thr->retired_tail->free_next = tdf_session;
+	else
+		thr->retired_head = tdf_session;
+	thr->retired_tail = tdf_session;
+
+	tdf_reclaim_sessions(thr);
+	if (thr->tot_free > 2 * TDF_SESSION_BATCH)
+		session_mgr_put(thr, TDF_SESSION_BATCH);
 
 	return;
 }
@@ -162,16 +244,22 @@ static void tdf_session_init(void)
 
 	for (i = 0; i < MAX_TDF_SESSION; i++) {
 		gtdf_session[i].slot = i;
-		tdf_put_session(&gtdf_session[i]);
+		session_mgr.slot[i] = i;
 	}
+	session_mgr.total = MAX_TDF_SESSION;
+	session_mgr.head = 0;
+	session_mgr.tail = 0;
 
 	for (i = 0; i < MAX_SESSION_HASH; i++) {
-		TAILQ_INIT(&g_tdf_session[i]);
+		g_tdf_session[i] = NULL;
+		pthread_mutex_init(&session_mutex[i], NULL);
 	}
 
 	for (i = 0; i < MAX_IP_HASH; i++) {
-		TAILQ_INIT(&g_ip_info_head[i]);
-		pthread_rwlock_init(&ip_info_rwlock[i], NULL);
+		g_ip_info_head[i] = NULL;
+	}
+	for (i = 0; i < MAX_IP_LOCKS; i++) {
+		pthread_mutex_init(&ip_info_mutex[i], NULL);
 	}
 
 	tdf_session_init_done = 1;
@@ -179,21 +267,27 @@ static void tdf_session_init(void)
 	return;
 }
 
+/*
+ * Lock free, for the tdf-recv thread owning the session hash only.
+ * That thread alone retires the sessions of the hash, so the returned
+ * session stays valid after the epoch section ends.  Other threads
+ * would need to hold their own section across the use of the result.
+ */
 static int tdf_session_lookup(char *session_id, uint32_t session_len,
 			int session_hash, tdf_session_t **tdf_session_hndl)
 {
-	struct tdf_session_head_s *tdf_session_head;
-	struct tdf_session_s *tdf_session, *tmp_tdf_session;
+	struct tdf_session_s *tdf_session;
 	int found = 0;
 	uint32_t hash = session_hash;
 
 	if (hash == 0)
 		hash = HASH(session_id, session_len, MAX_SESSION_HASH);
+	assert(tdf_thr_id == (int)(hash % tdf_recv_threads));
 
-	tdf_session_head = &g_tdf_session[hash];
-	pthread_mutex_lock(&session_mutex[hash]);
-	TAILQ_FOREACH_SAFE(tdf_session, tdf_session_head, session_entry, tmp_tdf_session) {
-		pthread_mutex_unlock(&session_mutex[hash]);
+	jpsd_epoch_enter();
+	for (tdf_session = JPSD_EPOCH_DEREF(g_tdf_session[hash]);
+	     tdf_session != NULL;
+	     tdf_session = JPSD_EPOCH_DEREF(tdf_session->hash_next)) {
 		if (tdf_session->session_len == session_len) {
 			if (memcmp(tdf_session->session_id,
 					session_id, session_len) == 0) {
@@ -203,24 +297,29 @@ static int tdf_session_lookup(char *session_id, uint32_t session_len,
 				break;
 			}
 		}
-		pthread_mutex_lock(&session_mutex[hash]);
 	}
-	pthread_mutex_unlock(&session_mutex[hash]);
+	jpsd_epoch_exit();
 
 	return found;
 }
 
 static void tdf_session_remove_entry(tdf_session_t *tdf_session, uint32_t hash)
 {
-	struct tdf_session_head_s *tdf_session_head;
+	tdf_session_t **prev;
 
 	if (hash == 0)
 		hash =  HASH(tdf_session->session_id,
 					tdf_session->session_len, MAX_SESSION_HASH);
 
-	tdf_session_head = &g_tdf_session[hash];
 	pthread_mutex_lock(&session_mutex[hash]);
-	TAILQ_REMOVE(tdf_session_head, tdf_session, session_entry);
+	for (prev = &g_tdf_session[hash]; *prev != NULL;
+	     prev = &(*prev)->hash_next) {
+		if (*prev == tdf_session) {
+			/* hash_next kept for lookups still on the session */
+			JPSD_EPOCH_ASSIGN(*prev, tdf_session->hash_next);
+			break;
+		}
+	}
 	pthread_mutex_unlock(&session_mutex[hash]);
 
 	return;
@@ -228,15 +327,14 @@ static void tdf_session_remove_entry(tdf_session_t *tdf_session, uint32_t hash)
 
 static void tdf_session_add_entry(tdf_session_t *tdf_session, uint32_t hash)
 {
-	struct tdf_session_head_s *tdf_session_head;
-
 	if (hash == 0)
 		hash =  HASH(tdf_session->session_id,
 					tdf_session->session_len, MAX_SESSION_HASH);
 
-	tdf_session_head = &g_tdf_session[hash];
 	pthread_mutex_lock(&session_mutex[hash]);
-	TAILQ_INSERT_TAIL(tdf_session_head, tdf_session, session_entry);
+	tdf_session->hash_next = g_tdf_session[hash];
+	/* Session fully set up before it is published */
+	JPSD_EPOCH_ASSIGN(g_tdf_session[hash], tdf_session);
 	pthread_mutex_unlock(&session_mutex[hash]);
 
 	return;
@@ -332,7 +430,7 @@ static int diameter_process_ccr_initial(diameter_peer_observer_t *po, ccr_t *ccr
 		goto err;
         }
 
-	tdf_session = tdf_get_session();
+	tdf_session = tdf_get_session(id);
 	if (tdf_session == NULL) {
 		glob_dia_req_session_err++;
 		result_code = DIAMETER_RC_OUT_OF_SPACE;
@@ -653,7 +751,7 @@ static int diameter_process_ccr_termination(
 
 	tdf_session_remove_entry(tdf_session, tdf_session->session_hash);
 	TAILQ_REMOVE(&g_tdf_thrs[tdf_session->thread_id].sq, tdf_session, queue_entry);
-	tdf_put_session(tdf_session);
+	tdf_put_session(tdf_session->thread_id, tdf_session);
 
 
 	return ret;
@@ -1135,19 +1233,23 @@ static int process_recv_data(struct recv_ctx_s *recv_ctx)
 	return DIAMETER_CB_OK;
 }
 
+/*
+ * Lock free from any thread, entries are never freed (ip_info_remove_entry()
+ * leaves the entry to the caller, who must wait for jpsd_epoch_safe()).
+ */
 static int ip_info_lookup(uint32_t ip, uint32_t ip_hash, ip_info_t **ip_info_hndl)
 {
-	struct ip_info_head_s *ip_info_head;
-	struct ip_info_s *ip_info, *tmp_ip_info;
+	struct ip_info_s *ip_info;
 	int found = 0;
 	uint32_t hash = ip_hash;
 
 	if (hash == 0)
 		hash = ip % MAX_IP_HASH;
 
-	ip_info_head = &g_ip_info_head[hash];
-	pthread_rwlock_rdlock(&ip_info_rwlock[hash]);
-	TAILQ_FOREACH_SAFE(ip_info, ip_info_head, entry, tmp_ip_info) {
+	jpsd_epoch_enter();
+	for (ip_info = JPSD_EPOCH_DEREF(g_ip_info_head[hash]);
+	     ip_info != NULL;
+	     ip_info = JPSD_EPOCH_DEREF(ip_info->next)) {
 		if (ip_info->ip == ip) {
 			found = 1;
 			if (ip_info_hndl) {
@@ -1156,39 +1258,54 @@ static int ip_info_lookup(uint32_t ip, uint32_t ip_hash, ip_info_t **ip_info_hnd
 			break;
 		}
 	}
-	pthread_rwlock_unlock(&ip_info_rwlock[hash]);
+	jpsd_epoch_exit();
 
 	return found;
 }
 
 static void ip_info_remove_entry(ip_info_t *ip_info, uint32_t hash)
 {
-	struct ip_info_head_s *ip_info_head;
+	ip_info_t **prev;
 
 	if (hash == 0)
 		hash =  ip_info->ip % MAX_IP_HASH;
 
-	ip_info_head = &g_ip_info_head[hash];
-	pthread_rwlock_wrlock(&ip_info_rwlock[hash]);
-	TAILQ_REMOVE(ip_info_head, ip_info, entry);
-	pthread_rwlock_unlock(&ip_info_rwlock[hash]);
+	pthread_mutex_lock(&ip_info_mutex[hash % MAX_IP_LOCKS]);
+	for (prev = &g_ip_info_head[hash]; *prev != NULL;
+	     prev = &(*prev)->next) {
+		if (*prev == ip_info) {
+			JPSD_EPOCH_ASSIGN(*prev, ip_info->next);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&ip_info_mutex[hash % MAX_IP_LOCKS]);
 
 	return;
 }
 
-static void ip_info_add_entry(ip_info_t *ip_info, uint32_t hash)
+/*
+ * Returns 0 if added, 1 if ip is already present (ip_info left alone)
+ */
+static int ip_info_add_entry(ip_info_t *ip_info, uint32_t hash)
 {
-	struct ip_info_head_s *ip_info_head;
+	ip_info_t *tmp_ip_info;
 
 	if (hash == 0)
 		hash =  ip_info->ip % MAX_IP_HASH;
 
-	ip_info_head = &g_ip_info_head[hash];
-	pthread_rwlock_wrlock(&ip_info_rwlock[hash]);
-	TAILQ_INSERT_TAIL(ip_info_head, ip_info, entry);
-	pthread_rwlock_unlock(&ip_info_rwlock[hash]);
+	pthread_mutex_lock(&ip_info_mutex[hash % MAX_IP_LOCKS]);
+	for (tmp_ip_info = g_ip_info_head[hash]; tmp_ip_info != NULL;
+	     tmp_ip_info = tmp_ip_info->next) {
+		if (tmp_ip_info->ip == ip_info->ip) {
+			pthread_mutex_unlock(&ip_info_mutex[hash % MAX_IP_LOCKS]);
+			return 1;
+		}
+	}
+	ip_info->next = g_ip_info_head[hash];
+	JPSD_EPOCH_ASSIGN(g_ip_info_head[hash], ip_info);
+	pthread_mutex_unlock(&ip_info_mutex[hash % MAX_IP_LOCKS]);
 
-	return;
+	return 0;
 }
 
 static int push_ip_list(int version, uint32_t *ip, int len)
@@ -1211,7 +1328,11 @@ static int push_ip_list(int version, uint32_t *ip, int len)
 			ip_info->first = version;
 			ip_info->latest = version;
 			ip_info->ip = ip[i];
-			ip_info_add_entry(ip_info, hash);
+			if (ip_info_add_entry(ip_info, hash)) {
+				/* Added meanwhile */
+				free(ip_info);
+				i--;
+			}
 		}
 	}
 
@@ -1650,6 +1771,7 @@ static void *tdf_recv(void *arg)
 
 	snprintf(name, 64, "tdf-recv-%lu", (unsigned long)ptdf_thr->num);
 	prctl(PR_SET_NAME, name, 0, 0, 0);
+	tdf_thr_id = ptdf_thr->num;
 
 	while (1) {
 		pthread_mutex_lock(&ptdf_thr->mutex);
@@ -18,6 +18,7 @@
 #include <sys/types.h>
 
 #include "queue.h"
+#include "jpsd_epoch.h"
 #include "nkn_memalloc.h"
 #include "nkn_stat.h"
 #include "nkn_debug.h"
@@ -40,6 +41,8 @@
 #define MAX_SESSION_HASH	1000
 #define MAX_SESSION_IP		32000
 #define MAX_IP_HASH		409600
+#define MAX_IP_LOCKS		1024	/* writer lock stripes of MAX_IP_HASH */
+#define TDF_SESSION_BATCH	32	/* per thread free session cache */
 
 typedef struct domain_rule_s {
         char name[64];
@@ -67,7 +70,7 @@ typedef struct ip_info_s {
 	int first;
 	int latest;
 	uint32_t ip;
-        TAILQ_ENTRY(ip_info_s) entry;
+	struct ip_info_s *next;		/* hash chain, jpsd_epoch.h */
 } ip_info_t;
 
 enum TDF_DOMAIN_STATE {
@@ -109,7 +112,9 @@ typedef struct tdf_session_s {
         domain_t *tdf_domain;
 	uint32_t ip_list[MAX_SESSION_IP];
 	uint32_t ref_ip_list[MAX_SESSION_IP];
-        TAILQ_ENTRY(tdf_session_s) session_entry;
+	struct tdf_session_s *hash_next;	/* hash chain, jpsd_epoch.h */
+	struct tdf_session_s *free_next;	/* free/retired, owner thread */
+	AO_t retire_epoch;
 	TAILQ_ENTRY(tdf_session_s) queue_entry;
 } tdf_session_t;
 
@@ -169,6 +174,10 @@ typedef struct tdf_threads {
 	uint32_t ip_list[MAX_SESSION_IP];
         TAILQ_HEAD(recv_queue, recv_ctx_s) rq;
 	TAILQ_HEAD(session_queue, tdf_session_s) sq;
+	int tot_free;			/* sessions, owner thread only */
+	tdf_session_t *free_session;
+	tdf_session_t *retired_head;
+	tdf_session_t *retired_tail;
 } tdf_recv_thread_t;
 
 domain_t *g_domain;
@@ -177,8 +186,8 @@ domain_rule_t *g_domain_rule;
 pthread_mutex_t domain_mutex[MAX_DOMAIN_HASH];
 TAILQ_HEAD(tdf_domain_head_s, domain_s) g_tdf_domain[MAX_DOMAIN_HASH];
 
-pthread_rwlock_t ip_info_rwlock[MAX_IP_HASH];
-TAILQ_HEAD(ip_info_head_s, ip_info_s) g_ip_info_head[MAX_IP_HASH];
+pthread_mutex_t ip_info_mutex[MAX_IP_LOCKS];
+ip_info_t *g_ip_info_head[MAX_IP_HASH];
 
 static inline uint32_t HASH(const char *name, unsigned int len, int max_hash)
 {
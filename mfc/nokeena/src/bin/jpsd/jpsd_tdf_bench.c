@@ -0,0 +1,287 @@
+/*
+ * @file jpsd_tdf_bench.c
+ * @brief
+ * jpsd_tdf_bench.c - TDF session lookups/second against the number of
+ * reader threads, bucket mutex per lookup (as before) against lock free
+ * lookups under jpsd_epoch.h.
+ *
+ * The session table is built as jpsd_tdf.c does: MAX_SESSION_HASH
+ * buckets, MAX_TDF_SESSION sessions.  One writer thread keeps removing
+ * and re-adding sessions (CCR-T/CCR-I) under the bucket lock while the
+ * readers look up random session ids.
+ *
+ * build: gcc -O2 -D_GNU_SOURCE -I. jpsd_tdf_bench.c jpsd_epoch.c \
+ *		-o jpsd_tdf_bench -lpthread
+ *
+ * usage: jpsd_tdf_bench [-t seconds_per_run] [-r max_reader_threads]
+ *        [-w writer_changes_per_sec]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <atomic_ops.h>
+
+#include "jpsd_epoch.h"
+
+#define MAX_TDF_SESSION		16000	/* as jpsd_tdf.h */
+#define MAX_SESSION_HASH	1000
+#define MAX_READERS		64
+
+typedef struct session_s {
+	char session_id[128];
+	uint32_t session_len;
+	struct session_s *hash_next;
+	struct session_s *free_next;
+	AO_t retire_epoch;
+	int linked;
+} session_t;
+
+static session_t sessions[MAX_TDF_SESSION];
+static session_t *bucket[MAX_SESSION_HASH];
+static pthread_mutex_t bucket_mutex[MAX_SESSION_HASH];
+
+static int use_epoch;
+static int writes_per_sec = 10000;
+static volatile int stop;
+static uint64_t lookups[MAX_READERS];
+static uint64_t misses[MAX_READERS];
+static uint64_t changes;
+
+/* as jpsd_tdf.h */
+static inline uint32_t HASH(const char *name, unsigned int len, int max_hash)
+{
+	unsigned int hash = 0;
+	unsigned int i = 0;
+
+	while (i < len) {
+		hash += name[i] | 0x20;
+		hash += (hash << 10);
+		hash ^= (hash >> 6);
+		i++;
+	}
+
+	hash += (hash << 3);
+	hash ^= (hash >> 11);
+	hash += (hash << 15);
+
+	return hash % max_hash;
+}
+
+static uint64_t mono_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int lookup(const char *id, uint32_t len, uint32_t hash)
+{
+	session_t *s;
+	int found = 0;
+
+	if (use_epoch) {
+		jpsd_epoch_enter();
+		for (s = JPSD_EPOCH_DEREF(bucket[hash]); s != NULL;
+		     s = JPSD_EPOCH_DEREF(s->hash_next)) {
+			if (s->session_len == len &&
+			    memcmp(s->session_id, id, len) == 0) {
+				found = 1;
+				break;
+			}
+		}
+		jpsd_epoch_exit();
+	} else {
+		pthread_mutex_lock(&bucket_mutex[hash]);
+		for (s = bucket[hash]; s != NULL; s = s->hash_next) {
+			if (s->session_len == len &&
+			    memcmp(s->session_id, id, len) == 0) {
+				found = 1;
+				break;
+			}
+		}
+		pthread_mutex_unlock(&bucket_mutex[hash]);
+	}
+
+	return found;
+}
+
+static void add(session_t *s)
+{
+	uint32_t hash = HASH(s->session_id, s->session_len, MAX_SESSION_HASH);
+
+	pthread_mutex_lock(&bucket_mutex[hash]);
+	s->hash_next = bucket[hash];
+	JPSD_EPOCH_ASSIGN(bucket[hash], s);
+	s->linked = 1;
+	pthread_mutex_unlock(&bucket_mutex[hash]);
+}
+
+static void del(session_t *s)
+{
+	uint32_t hash = HASH(s->session_id, s->session_len, MAX_SESSION_HASH);
+	session_t **prev;
+
+	pthread_mutex_lock(&bucket_mutex[hash]);
+	for (prev = &bucket[hash]; *prev != NULL; prev = &(*prev)->hash_next) {
+		if (*prev == s) {
+			JPSD_EPOCH_ASSIGN(*prev, s->hash_next);
+			break;
+		}
+	}
+	s->linked = 0;
+	pthread_mutex_unlock(&bucket_mutex[hash]);
+}
+
+static void *reader(void *arg)
+{
+	long n = (long)arg;
+	unsigned int seed = n + 1;
+	uint64_t cnt = 0, miss = 0;
+	session_t *s;
+	int i;
+
+	while (!stop) {
+		for (i = 0; i < 1024; i++) {
+			s = &sessions[rand_r(&seed) % MAX_TDF_SESSION];
+			if (!lookup(s->session_id, s->session_len,
+				    HASH(s->session_id, s->session_len,
+					 MAX_SESSION_HASH)))
+				miss++;
+		}
+		cnt += i;
+	}
+	lookups[n] = cnt;
+	misses[n] = miss;
+	return NULL;
+}
+
+/*
+ * CCR-T then CCR-I of a random session, the slot is reused once its
+ * retire epoch is safe (epoch mode) as tdf_put_session() does
+ */
+static void *writer(void *arg)
+{
+	session_t *retired_head = NULL, *retired_tail = NULL, *s;
+	unsigned int seed = 12345;
+	uint64_t start = mono_usec(), cnt = 0;
+
+	(void)arg;
+	while (!stop) {
+		if (writes_per_sec &&
+		    cnt * 1000000 / writes_per_sec > mono_usec() - start) {
+			usleep(100);
+			continue;
+		}
+		s = &sessions[rand_r(&seed) % MAX_TDF_SESSION];
+		if (!s->linked)
+			continue;
+		del(s);
+		s->retire_epoch = jpsd_epoch_retire();
+		s->free_next = NULL;
+		if (retired_tail)
+			retired_tail->free_next = s;
+		else
+			retired_head = s;
+		retired_tail = s;
+
+		while ((s = retired_head) != NULL &&
+		       (!use_epoch || jpsd_epoch_safe(s->retire_epoch))) {
+			retired_head = s->free_next;
+			if (retired_head == NULL)
+				retired_tail = NULL;
+			add(s);
+		}
+		cnt++;
+	}
+	while ((s = retired_head) != NULL) {
+		retired_head = s->free_next;
+		add(s);
+	}
+	changes = cnt;
+	return NULL;
+}
+
+static void run(int nreaders, int seconds)
+{
+	pthread_t rtid[MAX_READERS], wtid;
+	uint64_t usec, cnt = 0, miss = 0;
+	long i;
+
+	stop = 0;
+	pthread_create(&wtid, NULL, writer, NULL);
+	usec = mono_usec();
+	for (i = 0; i < nreaders; i++) {
+		pthread_create(&rtid[i], NULL, reader, (void *)i);
+	}
+	sleep(seconds);
+	stop = 1;
+	for (i = 0; i < nreaders; i++) {
+		pthread_join(rtid[i], NULL);
+		cnt += lookups[i];
+		miss += misses[i];
+	}
+	usec = mono_usec() - usec;
+	pthread_join(wtid, NULL);
+
+	printf("%-6s readers=%2d  %8.2f Mlookups/s  %6.2f M/s/thread  "
+	       "misses %.3f%%  changes %lu/s\n",
+	       use_epoch ? "epoch" : "mutex", nreaders, cnt / (double)usec,
+	       cnt / (double)usec / nreaders,
+	       cnt ? 100.0 * miss / cnt : 0.0,
+	       (unsigned long)(changes * 1000000 / usec));
+}
+
+int main(int argc, char **argv)
+{
+	int seconds = 2, max_readers, n, i, c;
+
+	max_readers = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+	while ((c = getopt(argc, argv, "t:r:w:")) != -1) {
+		switch (c) {
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		case 'r':
+			max_readers = atoi(optarg);
+			break;
+		case 'w':
+			writes_per_sec = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-t seconds_per_run] "
+				"[-r max_reader_threads] "
+				"[-w writer_changes_per_sec]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (max_readers < 1)
+		max_readers = 1;
+	if (max_readers > MAX_READERS)
+		max_readers = MAX_READERS;
+
+	for (i = 0; i < MAX_SESSION_HASH; i++) {
+		pthread_mutex_init(&bucket_mutex[i], NULL);
+	}
+	for (i = 0; i < MAX_TDF_SESSION; i++) {
+		sessions[i].session_len = snprintf(sessions[i].session_id,
+			sizeof(sessions[i].session_id),
+			"pgw.juniper.net;%u;%d", 1418000000 + i, i * 7);
+		add(&sessions[i]);
+	}
+
+	for (use_epoch = 0; use_epoch <= 1; use_epoch++) {
+		for (n = 1; n <= max_readers; n *= 2) {
+			run(n, seconds);
+			if (n < max_readers && n * 2 > max_readers)
+				run(max_readers, seconds);
+		}
+	}
+	return 0;
+}
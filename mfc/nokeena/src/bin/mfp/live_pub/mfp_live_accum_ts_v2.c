@@ -16,6 +16,10 @@
 #endif
 #include "nkn_assert.h"
 #define MAX_UDP_SIZE 4096 // 4Kbytes as max size
+/* formatter tasks of a session share a thread pool affinity key, so
+ * that they run in order even with several pool workers
+ */
+#define MFP_LIVE_TASK_AFFINITY(pub) ((uint32_t)((uintptr_t)(pub) >> 6) | 1)
 #define AUDIO_BUFF_DEPTH 15 //10 buffers at a time
 //#define MAX_AUDIO_BITRATE 100 //max audio bitrate in kbps
 
@@ -527,7 +531,8 @@ void handleTsEOS(void *ctx, uint32_t stream_id)
 	taskHandler tp_handler = (taskHandler)mfubox_ts;
 	thread_pool_task_t* t_task = 
 		newThreadPoolTask(tp_handler, ref_cont, NULL);
-	apple_fmtr_task_processor->add_work_item(apple_fmtr_task_processor, t_task); 
+	apple_fmtr_task_processor->add_work_item_affine(apple_fmtr_task_processor,
+		t_task, MFP_LIVE_TASK_AFFINITY(pub));
 	
     }
 
@@ -556,7 +561,8 @@ void handleTsEOS(void *ctx, uint32_t stream_id)
 #endif
 	    //mfpRtscheduleDelayedTask(15000, handler, (void*)task);
 	    thread_pool_task_t* t_task = newThreadPoolTask(handler, task, NULL);
-	    task_processor->add_work_item(task_processor, t_task); 
+	    task_processor->add_work_item_affine(task_processor, t_task,
+		    MFP_LIVE_TASK_AFFINITY(pub));
 	}
     }
     pub->sess_chunk_ctr++;
@@ -1466,7 +1472,9 @@ int32_t processData(int8_t* data,
 			    taskHandler tp_handler = (taskHandler)mfubox_ts;
 			    thread_pool_task_t	* t_task = 
 				newThreadPoolTask(tp_handler, ref_cont, NULL);
-   			    apple_fmtr_task_processor->add_work_item(apple_fmtr_task_processor, t_task); 			    
+			    apple_fmtr_task_processor->add_work_item_affine(
+				    apple_fmtr_task_processor, t_task,
+				    MFP_LIVE_TASK_AFFINITY(pub_ctx));
 			    accum->acc_ms_fmtr->seq_num++;
 			    accum->stats.tot_proc_ms_chunks = accum->acc_ms_fmtr->seq_num;
 			}
@@ -1540,7 +1548,8 @@ int32_t processData(int8_t* data,
 
 			    thread_pool_task_t* t_task = newThreadPoolTask(handler,
 									   task, NULL);
-			    task_processor->add_work_item(task_processor, t_task);
+			    task_processor->add_work_item_affine(task_processor,
+				    t_task, MFP_LIVE_TASK_AFFINITY(pctx_tmp));
 			    if (task_processor->get_queue_fill_len(task_processor) > 100)
 				DBG_MFPLOG (pub_ctx->name, MSG, MOD_MFPLIVE,
 					    "Task processor queue length: %d\n",
@@ -1622,7 +1631,9 @@ int32_t processData(int8_t* data,
 			taskHandler tp_handler = (taskHandler)mfubox_ts;
 			thread_pool_task_t* t_task = 
 				newThreadPoolTask(tp_handler, ref_cont, NULL);
-			apple_fmtr_task_processor->add_work_item(apple_fmtr_task_processor, t_task); 			
+			apple_fmtr_task_processor->add_work_item_affine(
+				apple_fmtr_task_processor, t_task,
+				MFP_LIVE_TASK_AFFINITY(pub_ctx));
 			/**
 			 * All network events for a particular session
 			 * (accum ctx) is guaranteed to be atomic; we
@@ -1644,7 +1655,8 @@ int32_t processData(int8_t* data,
 			
 			thread_pool_task_t* t_task = newThreadPoolTask(handler,
 								       task, NULL);
-			task_processor->add_work_item(task_processor, t_task); 
+			task_processor->add_work_item_affine(task_processor,
+				t_task, MFP_LIVE_TASK_AFFINITY(pctx_tmp));
 			if (task_processor->get_queue_fill_len(task_processor) > 100)
 			    DBG_MFPLOG (pub_ctx->name, MSG, MOD_MFPLIVE,
 					"Task processor queue length: %d\n",
@@ -3210,7 +3222,8 @@ void slHandleResync(uint32_t sess_id, uint32_t stream_id,
 	ser_task_t* task = create_ser_sync_fmtr_task(pub->sl_sync_ser,
 			data_id, stream_id, accum_seq_num, NULL, NULL); 
 	thread_pool_task_t* t_task = newThreadPoolTask(handler, task, NULL);
-	task_processor->add_work_item(task_processor, t_task); 
+	task_processor->add_work_item_affine(task_processor, t_task,
+		MFP_LIVE_TASK_AFFINITY(pub));
 
 }
 
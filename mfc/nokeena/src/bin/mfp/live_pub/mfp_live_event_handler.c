@@ -7,6 +7,47 @@ uint32_t glob_mfp_live_stream_timeout = 30;
 extern uint32_t glob_enable_stream_ha;
 
 #include <sys/time.h>
+#include <string.h>
+
+#include "nkn_stat.h"
+#include "mfp_limits.h"
+#include "mfp_live_ts_demux.h"
+
+/* datagrams read per recvmmsg; 1 falls back to recvfrom */
+uint32_t glob_mfp_live_recv_batch = 16;
+/* drop null packets (PID 0x1fff) before they reach the accumulator;
+ * batched path only, off by default as it changes the published
+ * stream
+ */
+uint32_t glob_mfp_live_strip_null_pkts = 0;
+
+#ifndef MAX_UDP_SIZE
+#define MAX_UDP_SIZE 4096 // 4Kbytes as max size
+#endif
+
+#define MFP_LIVE_RECV_BATCH_MAX (32)
+/* each batched slot takes a full datagram, same as the single recv
+ * path; jumbo or RTP wrapped feeds carry more than one network chunk
+ */
+#define MFP_LIVE_RECV_SLOT_SIZE MAX_UDP_SIZE
+/* the accumulator wraps its buffer once less than MAX_UDP_SIZE + 2
+ * network chunks are left; see processData
+ */
+#define MFP_LIVE_RECV_WRAP_RESERVE \
+    (MAX_UDP_SIZE + 2 * NUM_PKTS_IN_NETWORK_CHUNK * BYTES_IN_PACKET)
+
+NKNCNT_DEF(mfp_live_recv_calls, AO_t,\
+	"", "number of batched receive calls")
+NKNCNT_DEF(mfp_live_recv_dgrams, AO_t,\
+	"", "number of datagrams read by batched receive calls")
+NKNCNT_DEF(mfp_live_recv_trunc_drops, AO_t,\
+	"", "number of truncated datagrams dropped")
+NKNCNT_DEF(mfp_live_recv_sync_drops, AO_t,\
+	"", "number of datagrams dropped for TS sync byte errors")
+NKNCNT_DEF(mfp_live_recv_null_pkts, AO_t,\
+	"", "number of TS null packets stripped on ingest")
+NKNCNT_DEF(mfp_live_recv_moves, AO_t,\
+	"", "number of datagrams relocated in the accumulator buffer")
 
 
 static int32_t diffTimevalToMs(struct timeval const* from, 
@@ -15,27 +56,66 @@ static int32_t diffTimevalToMs(struct timeval const* from,
 #define TS_PKT_SIZE 188
 
 
-int8_t mfpLiveEpollinHandler(entity_context_t* ctx) 
+/* hands one received network chunk to the accumulator; returns -1
+ * if the stream had to be marked dead
+ */
+static int32_t mfpLiveDeliverChunk(entity_context_t* ctx,
+	mfp_publ_t* pub_ctx, sess_stream_id_t* id,
+	int8_t* buff, int32_t len)
 {
-
-    sess_stream_id_t* id = (sess_stream_id_t*)ctx->context_data; 
-    mfp_publ_t* pub_ctx = 
-	live_state_cont->get_ctx(live_state_cont,
-		id->sess_id);  
-    int8_t* buff = NULL;
-    uint32_t len_avl = 0;
     uint32_t stream_id = id->stream_id;
-    pub_ctx->accum_intf[stream_id]->get_data_buf(&buff, &len_avl, id); 
-    if (len_avl == 0) {
+
+    if (pub_ctx->accum_intf[stream_id]->data_in_handler(buff,
+		len, id) < 0) {
+	disp_mngr->self_unset_read(ctx);
 	pub_ctx->stream_parm[stream_id].stream_state = STRM_DEAD;
-	ctx->disp_mngr->self_del_all_event(ctx);
-	printf("Stream state dead FD : %d\n", ctx->fd);
+	DBG_MFPLOG(pub_ctx->name, ERROR, MOD_MFPLIVE, 
+		"Stream state dead FD : %d", ctx->fd);
 	return -1;
     }
-    if(len_avl<1316)
-	assert(0);
+    return 0;
+}
+
 
+/* batched path: checks the TS packets of a received chunk and strips
+ * null packets; returns 0 if the chunk (now *len bytes) is to be
+ * delivered, -1 if it has to be dropped
+ */
+static int32_t mfpLiveFilterChunk(mfp_publ_t* pub_ctx,
+	sess_stream_id_t* id, int8_t* buff, uint32_t* len)
+{
+    mfp_ts_scan_t scan;
+
+    if (mfp_ts_scan_pkts((uint8_t*)buff, *len, &scan) < 0) {
+	/* leave the chunk to the accumulator's own checks if it
+	 * is not a plain run of TS packets
+	 */
+	if (scan.bad_pkt >= 0) {
+	    AO_fetch_and_add1(&glob_mfp_live_recv_sync_drops);
+	    DBG_MFPLOG(pub_ctx->name, MSG, MOD_MFPLIVE,
+		       "sess %u strm %u: sync byte error in packet %d,"
+		       " dropping chunk", id->sess_id, id->stream_id,
+		       scan.bad_pkt);
+	    return -1;
+	}
+    } else if (glob_mfp_live_strip_null_pkts && scan.n_null) {
+	AO_fetch_and_add(&glob_mfp_live_recv_null_pkts, scan.n_null);
+	*len = mfp_ts_strip_null_pkts((uint8_t*)buff, &scan);
+	if (!*len)
+	    return -1;
+    }
+    return 0;
+}
+
+
+/* legacy single datagram receive; the chunk goes to the accumulator
+ * unchanged, which does its own sync recovery
+ */
+static int8_t mfpLiveRecvOne(entity_context_t* ctx, mfp_publ_t* pub_ctx,
+	sess_stream_id_t* id, int8_t* buff, uint32_t len_avl)
+{
     int32_t rc = 0;
+    uint32_t stream_id = id->stream_id, len;
     struct sockaddr_in from_addr;
     uint32_t addr_len = sizeof(struct sockaddr_in);
     rc = recvfrom(ctx->fd, buff, len_avl, 0,(struct sockaddr*)&from_addr,
@@ -57,28 +137,139 @@ int8_t mfpLiveEpollinHandler(entity_context_t* ctx)
 			//log the activity : note the event timestamp
 			id->last_seen_at.tv_sec = ctx->event_time.tv_sec;
 			id->last_seen_at.tv_usec = ctx->event_time.tv_usec;
-			struct timeval now1, now2;
-			gettimeofday(&now1, NULL);
-			//printf("--\r");
-			if (pub_ctx->accum_intf[stream_id]->data_in_handler(buff,
-						rc, id) < 0) {
-				disp_mngr->self_unset_read(ctx);
-				pub_ctx->stream_parm[stream_id].stream_state = STRM_DEAD;
-				DBG_MFPLOG(pub_ctx->name, ERROR, MOD_MFPLIVE, 
-						"Stream state dead FD : %d", ctx->fd);
+			len = rc;
+			if (mfpLiveDeliverChunk(ctx, pub_ctx, id, buff, len) < 0)
 				return -1;
-			}
-			gettimeofday(&now2, NULL);
-			int32_t tmp_pd_time = diffTimevalToMs(&now2, &now1); 
-			//if(tmp_pd_time > 10)
-			//printf("sess %u strm %u processdata %d\n", id->sess_id, id->stream_id, tmp_pd_time);
-			
 		}
 	}
     return 1;
 }
 
 
+/*
+ * batched receive: up to glob_mfp_live_recv_batch datagrams are read
+ * with one recvmmsg straight into consecutive MAX_UDP_SIZE slots of
+ * the accumulator buffer. The accumulator consumes them one
+ * chunk at a time as before; after each chunk the write position is
+ * queried again and the next chunk is moved to where the accumulator
+ * expects it. A slot holds a full datagram, so a feed of 7 packet
+ * datagrams is moved down on every chunk but the first of a batch
+ * (see mfp_live_recv_moves and the ts_ingest_bench report). The
+ * batch is clamped so that it ends before the accumulator's wrap
+ * point, so such moves are always downwards and never overlap the
+ * chunks still pending.
+ */
+static int8_t mfpLiveRecvBatch(entity_context_t* ctx, mfp_publ_t* pub_ctx,
+	sess_stream_id_t* id, int8_t* buff, uint32_t n_slots)
+{
+    struct mmsghdr msgs[MFP_LIVE_RECV_BATCH_MAX];
+    struct iovec iov[MFP_LIVE_RECV_BATCH_MAX];
+    struct sockaddr_in from_addr[MFP_LIVE_RECV_BATCH_MAX];
+    uint32_t stream_id = id->stream_id;
+    struct in_addr* src_addr =
+	&pub_ctx->stream_parm[stream_id].media_src.live_src.source_if;
+    int8_t* slot;
+    int8_t* wr_buff = NULL;
+    uint32_t len_avl = 0, len, i;
+    int32_t n_msgs;
+
+    memset(msgs, 0, n_slots * sizeof(struct mmsghdr));
+    for (i = 0; i < n_slots; i++) {
+	iov[i].iov_base = buff + i * MFP_LIVE_RECV_SLOT_SIZE;
+	iov[i].iov_len = MFP_LIVE_RECV_SLOT_SIZE;
+	msgs[i].msg_hdr.msg_iov = &iov[i];
+	msgs[i].msg_hdr.msg_iovlen = 1;
+	msgs[i].msg_hdr.msg_name = &from_addr[i];
+	msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    }
+
+    n_msgs = recvmmsg(ctx->fd, msgs, n_slots, MSG_DONTWAIT, NULL);
+    if (n_msgs < 0) {
+	if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+	    return 1;
+	ctx->disp_mngr->self_del_all_event(ctx);
+	pub_ctx->stream_parm[stream_id].stream_state = STRM_DEAD;
+	DBG_MFPLOG(pub_ctx->name, ERROR, MOD_MFPLIVE, 
+		   "Receive error : setting state dead FD : %d", ctx->fd);
+	return -1;
+    }
+    AO_fetch_and_add1(&glob_mfp_live_recv_calls);
+    AO_fetch_and_add(&glob_mfp_live_recv_dgrams, n_msgs);
+
+    for (i = 0; i < (uint32_t)n_msgs; i++) {
+	slot = (int8_t*)iov[i].iov_base;
+	len = msgs[i].msg_len;
+
+	if (src_addr->s_addr != 0 &&
+		src_addr->s_addr != from_addr[i].sin_addr.s_addr)
+	    continue;
+	if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+	    AO_fetch_and_add1(&glob_mfp_live_recv_trunc_drops);
+	    continue;
+	}
+	//log the activity : note the event timestamp
+	id->last_seen_at.tv_sec = ctx->event_time.tv_sec;
+	id->last_seen_at.tv_usec = ctx->event_time.tv_usec;
+
+	if (mfpLiveFilterChunk(pub_ctx, id, slot, &len) < 0)
+	    continue;
+
+	pub_ctx->accum_intf[stream_id]->get_data_buf(&wr_buff,
+		&len_avl, id);
+	if (len_avl < len) {
+	    pub_ctx->stream_parm[stream_id].stream_state = STRM_DEAD;
+	    ctx->disp_mngr->self_del_all_event(ctx);
+	    DBG_MFPLOG(pub_ctx->name, ERROR, MOD_MFPLIVE,
+		       "Stream state dead FD : %d", ctx->fd);
+	    return -1;
+	}
+	if (wr_buff != slot) {
+	    memmove(wr_buff, slot, len);
+	    AO_fetch_and_add1(&glob_mfp_live_recv_moves);
+	}
+	if (mfpLiveDeliverChunk(ctx, pub_ctx, id, wr_buff, len) < 0)
+	    return -1;
+    }
+    return 1;
+}
+
+
+int8_t mfpLiveEpollinHandler(entity_context_t* ctx) 
+{
+
+    sess_stream_id_t* id = (sess_stream_id_t*)ctx->context_data; 
+    mfp_publ_t* pub_ctx = 
+	live_state_cont->get_ctx(live_state_cont,
+		id->sess_id);  
+    int8_t* buff = NULL;
+    uint32_t len_avl = 0, n_slots;
+    uint32_t stream_id = id->stream_id;
+    pub_ctx->accum_intf[stream_id]->get_data_buf(&buff, &len_avl, id); 
+    if (len_avl == 0) {
+	pub_ctx->stream_parm[stream_id].stream_state = STRM_DEAD;
+	ctx->disp_mngr->self_del_all_event(ctx);
+	printf("Stream state dead FD : %d\n", ctx->fd);
+	return -1;
+    }
+    if(len_avl<1316)
+	assert(0);
+
+    /* number of slots that fit before the accumulator would wrap */
+    n_slots = 0;
+    if (len_avl > MFP_LIVE_RECV_WRAP_RESERVE)
+	n_slots = (len_avl - MFP_LIVE_RECV_WRAP_RESERVE) /
+	    MFP_LIVE_RECV_SLOT_SIZE;
+    if (n_slots > glob_mfp_live_recv_batch)
+	n_slots = glob_mfp_live_recv_batch;
+    if (n_slots > MFP_LIVE_RECV_BATCH_MAX)
+	n_slots = MFP_LIVE_RECV_BATCH_MAX;
+
+    if (n_slots <= 1)
+	return mfpLiveRecvOne(ctx, pub_ctx, id, buff, len_avl);
+    return mfpLiveRecvBatch(ctx, pub_ctx, id, buff, n_slots);
+}
+
+
 int8_t mfpLiveEpolloutHandler(entity_context_t* ctx) 
 {
 
@@ -124,6 +124,14 @@ extern uint32_t glob_anomaly_sample_duration_correction;
 extern uint32_t glob_slow_strm_HA_enable_flag;
 extern uint32_t glob_ignore_audio_pid;
 extern uint32_t glob_latm_audio_encapsulation_enabled;
+extern uint32_t glob_mfp_live_recv_batch;
+extern uint32_t glob_mfp_live_strip_null_pkts;
+extern uint32_t glob_mfp_live_udp_rcvbuf_mb;
+
+/* workers per formatter task pool; a session's tasks stay ordered on
+ * any number of workers, see MFP_LIVE_TASK_AFFINITY
+ */
+uint32_t glob_mfp_live_fmtr_task_threads = 1;
 
 #ifdef MFP_LIVE_ACCUMV2
 extern uint32_t glob_mfp_audio_buff_time ;
@@ -198,6 +206,14 @@ mfp_cfg_param_val_t filed_cfg [] = {
      &glob_ignore_audio_pid},
     {{"live.global.enable_latm_audio", MFP_INT_TYPE},
      &glob_latm_audio_encapsulation_enabled},
+    {{"live.global.udp_recv_batch", MFP_INT_TYPE},
+     &glob_mfp_live_recv_batch},
+    {{"live.global.strip_null_pkts", MFP_INT_TYPE},
+     &glob_mfp_live_strip_null_pkts},
+    {{"live.global.udp_rcvbuf_mb", MFP_INT_TYPE},
+     &glob_mfp_live_udp_rcvbuf_mb},
+    {{"live.global.fmtr_task_threads", MFP_INT_TYPE},
+     &glob_mfp_live_fmtr_task_threads},
     {{NULL, MFP_INT_TYPE}, NULL}
 };
 
@@ -567,10 +583,14 @@ int32_t main(int argc, char *argv[])
     scheduler_init(nkn_rtsched_threads);
 
     // init thread pool
-    task_processor = newMfpThreadPool(1, 10000);
+    if (glob_mfp_live_fmtr_task_threads == 0)
+	glob_mfp_live_fmtr_task_threads = 1;
+    task_processor = newMfpThreadPool(glob_mfp_live_fmtr_task_threads,
+				      10000);
     
 	// init thread pool
-	apple_fmtr_task_processor = newMfpThreadPool(1, 10000);
+	apple_fmtr_task_processor =
+		newMfpThreadPool(glob_mfp_live_fmtr_task_threads, 10000);
 
     // init event timer
     ev_timer = createEventTimer(event_timer_calloc_custom, et_thread_conf);
@@ -30,6 +30,11 @@
 #define UDP_BUFSIZE_SEC 2
 #define UDP_BUFSIZE_MB 1
 
+/* receive buffer per input socket; with batched reads the socket
+ * has to absorb a full batch worth of bursts per channel between
+ * two wakeups of the dispatcher thread
+ */
+uint32_t glob_mfp_live_udp_rcvbuf_mb = 8;
 uint32_t fruit_init_done = 0;
 extern uint64_t glob_mfp_max_sess_supported;
 extern file_pump_ctxt_t *file_pump_ctxt;
@@ -574,12 +579,20 @@ static int32_t initSessionPipeline(uint32_t sess_id)
 		}
 
 		est_sbuf_size = (UDP_BUFSIZE_MB * 1000000);
+		if (glob_mfp_live_udp_rcvbuf_mb > UDP_BUFSIZE_MB)
+		    est_sbuf_size = glob_mfp_live_udp_rcvbuf_mb * 1000000;
 		if (est_sbuf_size > sbuf_size) {
 		    new_sbuf_size = est_sbuf_size;
 		    DBG_MFPLOG(pub_ctx->name, MSG, MOD_MFPLIVE,
 			       "existing RCVBUF size: %d, estimated RCVBUF"
 			       " size: %d", sbuf_size, est_sbuf_size);
-		    if(setsockopt(fd, SOL_SOCKET, SO_RCVBUF,
+		    /* FORCE goes past net.core.rmem_max when we have
+		     * CAP_NET_ADMIN, otherwise the kernel clamps the
+		     * plain request to rmem_max
+		     */
+		    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE,
+				   &new_sbuf_size, sizeof(new_sbuf_size)) &&
+			setsockopt(fd, SOL_SOCKET, SO_RCVBUF,
 			      &new_sbuf_size, sizeof(new_sbuf_size))) {
 			DBG_MFPLOG(pub_ctx->name, SEVERE, MOD_MFPLIVE,
 				   "unable to set RCVBUF size to %d,"
@@ -0,0 +1,173 @@
+/**
+ * @file   mfp_live_ts_demux.c
+ * @date   Mon Oct 19 2026
+ *
+ * @brief  bulk TS header scan; the first 4 bytes of each packet
+ * (sync byte, flags + PID, continuity) are loaded as one little
+ * endian word, so
+ *     sync = w & 0xff
+ *     pid  = (w & 0x1f00) | ((w >> 16) & 0xff)
+ * which lets us check and extract several packets per vector op.
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "mfp_live_ts_demux.h"
+
+static inline uint32_t
+ts_hdr_word(const uint8_t *pkt)
+{
+    uint32_t w;
+
+    memcpy(&w, pkt, sizeof(w));
+    return w;
+}
+
+/* scalar tail/fallback; returns 0 on a bad sync byte */
+static inline int32_t
+ts_scan_one(const uint8_t *pkt, uint16_t *pid)
+{
+    *pid = ((pkt[1] & 0x1f) << 8) | pkt[2];
+    return (pkt[0] == MFP_TS_SYNC_BYTE);
+}
+
+#if defined(__SSE2__)
+/* scans 4 packets; returns the 4 bit mask of packets with a good
+ * sync byte and the number of null packets
+ */
+static inline uint32_t
+ts_scan_x4(const uint8_t *pkt, uint16_t *pid, uint32_t *n_null)
+{
+    __m128i w, ok, p, nul;
+
+    w = _mm_set_epi32(ts_hdr_word(pkt + 3 * MFP_TS_PKT_SIZE),
+		      ts_hdr_word(pkt + 2 * MFP_TS_PKT_SIZE),
+		      ts_hdr_word(pkt + MFP_TS_PKT_SIZE),
+		      ts_hdr_word(pkt));
+    ok = _mm_cmpeq_epi32(_mm_and_si128(w, _mm_set1_epi32(0xff)),
+			 _mm_set1_epi32(MFP_TS_SYNC_BYTE));
+    p = _mm_or_si128(_mm_and_si128(w, _mm_set1_epi32(0x1f00)),
+		     _mm_and_si128(_mm_srli_epi32(w, 16),
+				   _mm_set1_epi32(0xff)));
+    nul = _mm_cmpeq_epi32(p, _mm_set1_epi32(MFP_TS_NULL_PID));
+    *n_null += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(nul)));
+    /* PIDs are 13 bit, the signed saturation in the pack is a no-op */
+    _mm_storel_epi64((__m128i *)pid, _mm_packs_epi32(p, p));
+
+    return _mm_movemask_ps(_mm_castsi128_ps(ok));
+}
+#endif
+
+#if defined(__AVX2__)
+/* scans 8 packets with a single strided gather */
+static inline uint32_t
+ts_scan_x8(const uint8_t *pkt, uint16_t *pid, uint32_t *n_null)
+{
+    const __m256i idx = _mm256_setr_epi32(0, 1 * MFP_TS_PKT_SIZE,
+					  2 * MFP_TS_PKT_SIZE,
+					  3 * MFP_TS_PKT_SIZE,
+					  4 * MFP_TS_PKT_SIZE,
+					  5 * MFP_TS_PKT_SIZE,
+					  6 * MFP_TS_PKT_SIZE,
+					  7 * MFP_TS_PKT_SIZE);
+    __m256i w, ok, p, nul;
+
+    w = _mm256_i32gather_epi32((const int *)pkt, idx, 1);
+    ok = _mm256_cmpeq_epi32(_mm256_and_si256(w, _mm256_set1_epi32(0xff)),
+			    _mm256_set1_epi32(MFP_TS_SYNC_BYTE));
+    p = _mm256_or_si256(_mm256_and_si256(w, _mm256_set1_epi32(0x1f00)),
+			_mm256_and_si256(_mm256_srli_epi32(w, 16),
+					 _mm256_set1_epi32(0xff)));
+    nul = _mm256_cmpeq_epi32(p, _mm256_set1_epi32(MFP_TS_NULL_PID));
+    *n_null += __builtin_popcount(
+		_mm256_movemask_ps(_mm256_castsi256_ps(nul)));
+    _mm_storeu_si128((__m128i *)pid,
+		     _mm_packs_epi32(_mm256_castsi256_si128(p),
+				     _mm256_extracti128_si256(p, 1)));
+
+    return _mm256_movemask_ps(_mm256_castsi256_ps(ok));
+}
+#endif
+
+int32_t
+mfp_ts_scan_pkts(const uint8_t *data, uint32_t len,
+		 mfp_ts_scan_t *scan)
+{
+    uint32_t n_pkts, i = 0, ok;
+
+    n_pkts = len / MFP_TS_PKT_SIZE;
+    scan->n_pkts = 0;
+    scan->n_null = 0;
+    scan->bad_pkt = -1;
+    if (!n_pkts || (len % MFP_TS_PKT_SIZE) ||
+	n_pkts > MFP_TS_SCAN_MAX_PKTS) {
+	return -1;
+    }
+
+#if defined(__AVX2__)
+    for (; i + 8 <= n_pkts; i += 8) {
+	ok = ts_scan_x8(data + i * MFP_TS_PKT_SIZE, &scan->pid[i],
+			&scan->n_null);
+	if (ok != 0xff) {
+	    scan->bad_pkt = i + __builtin_ctz(~ok);
+	    scan->n_pkts = i;
+	    return -1;
+	}
+    }
+#endif
+#if defined(__SSE2__)
+    for (; i + 4 <= n_pkts; i += 4) {
+	ok = ts_scan_x4(data + i * MFP_TS_PKT_SIZE, &scan->pid[i],
+			&scan->n_null);
+	if (ok != 0xf) {
+	    scan->bad_pkt = i + __builtin_ctz(~ok);
+	    scan->n_pkts = i;
+	    return -1;
+	}
+    }
+#endif
+    for (; i < n_pkts; i++) {
+	if (!ts_scan_one(data + i * MFP_TS_PKT_SIZE, &scan->pid[i])) {
+	    scan->bad_pkt = i;
+	    scan->n_pkts = i;
+	    return -1;
+	}
+	if (scan->pid[i] == MFP_TS_NULL_PID) {
+	    scan->n_null++;
+	}
+    }
+    scan->n_pkts = n_pkts;
+
+    return 0;
+}
+
+uint32_t
+mfp_ts_strip_null_pkts(uint8_t *data, const mfp_ts_scan_t *scan)
+{
+    uint32_t i, wr = 0;
+
+    if (!scan->n_null) {
+	return scan->n_pkts * MFP_TS_PKT_SIZE;
+    }
+
+    for (i = 0; i < scan->n_pkts; i++) {
+	if (scan->pid[i] == MFP_TS_NULL_PID) {
+	    continue;
+	}
+	if (wr != i) {
+	    memcpy(data + wr * MFP_TS_PKT_SIZE,
+		   data + i * MFP_TS_PKT_SIZE, MFP_TS_PKT_SIZE);
+	}
+	wr++;
+    }
+
+    return wr * MFP_TS_PKT_SIZE;
+}
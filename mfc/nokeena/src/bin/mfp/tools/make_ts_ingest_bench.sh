@@ -0,0 +1 @@
+gcc -O2 -g -D_GNU_SOURCE -I../../../include/mfp ts_ingest_bench.c ../live_pub/mfp_live_ts_demux.c -o ts_ingest_bench -lpthread
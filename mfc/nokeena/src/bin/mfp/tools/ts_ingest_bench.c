@@ -0,0 +1,457 @@
+/*
+ * ts_ingest_bench: replays a TS file or a pcap capture of a UDP TS
+ * feed over loopback to K channel sockets and measures the CPU time
+ * the receiving thread spends per byte, for the legacy path (one
+ * recvfrom per datagram, per packet header parse) and the batched
+ * path (recvmmsg + bulk header scan/null packet strip as used by
+ * live_mfpd). The batched path uses full datagram slots and moves
+ * each chunk down to the end of the previous one, as live_mfpd does
+ * for the accumulator; the moves are reported. The result is
+ * reported as channels per core at the given per channel bitrate.
+ *
+ * usage: ts_ingest_bench -f <file.ts|file.pcap> [-c channels]
+ *        [-b bitrate_mbps] [-d duration_secs] [-m 0|1] [-B batch]
+ *        [-p base_port]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "mfp_live_ts_demux.h"
+
+#define CHUNK_SIZE (7 * MFP_TS_PKT_SIZE)
+/* MFP_LIVE_RECV_SLOT_SIZE of live_mfpd (MAX_UDP_SIZE) */
+#define SLOT_SIZE (4096)
+#define MAX_CHANNELS (1024)
+#define MAX_BATCH (32)
+#define PCAP_MAGIC (0xa1b2c3d4)
+#define PCAP_MAGIC_SWAPPED (0xd4c3b2a1)
+
+static uint8_t *chunks;
+static uint32_t *chunk_len;
+static uint32_t num_chunks;
+
+static uint32_t num_channels = 8;
+static uint32_t bitrate_mbps = 10;
+static uint32_t duration = 5;
+static uint32_t mode = 1;
+static uint32_t batch = 16;
+static uint16_t base_port = 30000;
+
+static volatile int32_t running = 1;
+static int32_t rx_fd[MAX_CHANNELS];
+
+static uint64_t tx_bytes, rx_bytes, rx_dgrams, rx_calls, rx_sync_err,
+    rx_null_pkts, rx_pid_sum, rx_moves, rx_move_bytes;
+static struct timeval rx_cpu;
+
+static void add_chunk(const uint8_t *data, uint32_t len)
+{
+    static uint32_t alloced;
+
+    if (num_chunks == alloced) {
+	alloced = alloced ? alloced * 2 : 4096;
+	chunks = realloc(chunks, (size_t)alloced * CHUNK_SIZE);
+	chunk_len = realloc(chunk_len, alloced * sizeof(uint32_t));
+	if (!chunks || !chunk_len) {
+	    perror("realloc");
+	    exit(1);
+	}
+    }
+    memcpy(chunks + (size_t)num_chunks * CHUNK_SIZE, data, len);
+    chunk_len[num_chunks++] = len;
+}
+
+static int32_t load_ts(const uint8_t *buf, size_t size)
+{
+    size_t pos = 0;
+
+    /* align to the first sync byte */
+    while (pos < size && buf[pos] != MFP_TS_SYNC_BYTE)
+	pos++;
+    while (pos + CHUNK_SIZE <= size) {
+	add_chunk(buf + pos, CHUNK_SIZE);
+	pos += CHUNK_SIZE;
+    }
+    return 0;
+}
+
+static uint32_t rd32(const uint8_t *p, int32_t swap)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return swap ? __builtin_bswap32(v) : v;
+}
+
+/* pulls the UDP payloads out of an ethernet (or linux cooked) pcap;
+ * payloads that are not a whole number of TS packets are skipped
+ */
+static int32_t load_pcap(const uint8_t *buf, size_t size)
+{
+    int32_t swap = (rd32(buf, 0) == PCAP_MAGIC_SWAPPED);
+    uint32_t linktype = rd32(buf + 20, swap);
+    size_t pos = 24;
+
+    while (pos + 16 <= size) {
+	uint32_t caplen = rd32(buf + pos + 8, swap);
+	const uint8_t *pkt = buf + pos + 16;
+	uint32_t off, ihl, ulen;
+	uint16_t etype;
+
+	pos += 16 + caplen;
+	if (pos > size)
+	    break;
+	if (linktype == 1) {		/* ethernet */
+	    off = 14;
+	    etype = (pkt[12] << 8) | pkt[13];
+	    if (etype == 0x8100) {	/* vlan */
+		off += 4;
+		etype = (pkt[16] << 8) | pkt[17];
+	    }
+	} else if (linktype == 113) {	/* linux cooked */
+	    off = 16;
+	    etype = (pkt[14] << 8) | pkt[15];
+	} else {
+	    fprintf(stderr, "unsupported pcap link type %u\n", linktype);
+	    return -1;
+	}
+	if (etype != 0x0800 || caplen < off + 28)
+	    continue;
+	ihl = (pkt[off] & 0x0f) * 4;
+	if (pkt[off + 9] != IPPROTO_UDP || caplen < off + ihl + 8)
+	    continue;
+	ulen = ((pkt[off + ihl + 4] << 8) | pkt[off + ihl + 5]) - 8;
+	if (ulen > caplen - off - ihl - 8)
+	    continue;
+	if (!ulen || ulen > CHUNK_SIZE || (ulen % MFP_TS_PKT_SIZE))
+	    continue;
+	add_chunk(pkt + off + ihl + 8, ulen);
+    }
+    return 0;
+}
+
+static int32_t load_input(const char *fname)
+{
+    FILE *fp;
+    uint8_t *buf;
+    long size;
+    int32_t rc;
+
+    fp = fopen(fname, "rb");
+    if (!fp) {
+	perror(fname);
+	return -1;
+    }
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    buf = malloc(size);
+    if (!buf || fread(buf, 1, size, fp) != (size_t)size) {
+	perror("read");
+	fclose(fp);
+	return -1;
+    }
+    fclose(fp);
+
+    if (size >= 24 && (rd32(buf, 0) == PCAP_MAGIC ||
+		       rd32(buf, 0) == PCAP_MAGIC_SWAPPED))
+	rc = load_pcap(buf, size);
+    else
+	rc = load_ts(buf, size);
+    free(buf);
+
+    if (rc == 0 && num_chunks == 0) {
+	fprintf(stderr, "no TS payload found in %s\n", fname);
+	return -1;
+    }
+    return rc;
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* paces every channel at bitrate_mbps, in 1ms ticks */
+static void *sender(void *arg)
+{
+    int32_t fds[MAX_CHANNELS];
+    uint32_t next[MAX_CHANNELS];
+    struct sockaddr_in to;
+    double start, budget_per_ms, credit = 0;
+    uint32_t i;
+
+    memset(&to, 0, sizeof(to));
+    to.sin_family = AF_INET;
+    to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    for (i = 0; i < num_channels; i++) {
+	fds[i] = socket(AF_INET, SOCK_DGRAM, 0);
+	to.sin_port = htons(base_port + i);
+	if (fds[i] < 0 ||
+	    connect(fds[i], (struct sockaddr *)&to, sizeof(to)) < 0) {
+	    perror("sender socket");
+	    exit(1);
+	}
+	/* stagger the channels over the input */
+	next[i] = (num_chunks / num_channels) * i;
+    }
+
+    budget_per_ms = bitrate_mbps * 1e6 / 8 / 1000;
+    start = now_sec();
+    while (running) {
+	double elapsed = now_sec() - start;
+
+	credit = elapsed * 1000 * budget_per_ms -
+	    (double)tx_bytes / num_channels;
+	while (credit > 0) {
+	    uint32_t len = 0;
+
+	    for (i = 0; i < num_channels; i++) {
+		len = chunk_len[next[i]];
+		if (send(fds[i], chunks + (size_t)next[i] * CHUNK_SIZE,
+			 len, 0) == (ssize_t)len)
+		    tx_bytes += len;
+		if (++next[i] == num_chunks)
+		    next[i] = 0;
+	    }
+	    credit -= len;
+	}
+	usleep(1000);
+    }
+    for (i = 0; i < num_channels; i++)
+	close(fds[i]);
+    return arg;
+}
+
+static void rx_legacy(int32_t fd, uint8_t *buf)
+{
+    struct sockaddr_in from;
+    socklen_t from_len;
+    ssize_t rc;
+    uint32_t i;
+
+    for (;;) {
+	from_len = sizeof(from);
+	rc = recvfrom(fd, buf, SLOT_SIZE, MSG_DONTWAIT,
+		      (struct sockaddr *)&from, &from_len);
+	rx_calls++;
+	if (rc <= 0)
+	    break;
+	rx_dgrams++;
+	rx_bytes += rc;
+	/* what processData does per packet before any timestamp work */
+	for (i = 0; i + MFP_TS_PKT_SIZE <= (uint32_t)rc;
+	     i += MFP_TS_PKT_SIZE) {
+	    uint16_t pid;
+
+	    if (buf[i] != MFP_TS_SYNC_BYTE) {
+		rx_sync_err++;
+		break;
+	    }
+	    pid = ((buf[i + 1] & 0x1f) << 8) | buf[i + 2];
+	    rx_pid_sum += pid;
+	}
+    }
+}
+
+static void rx_batched(int32_t fd, uint8_t *buf)
+{
+    struct mmsghdr msgs[MAX_BATCH];
+    struct iovec iov[MAX_BATCH];
+    struct sockaddr_in from[MAX_BATCH];
+    mfp_ts_scan_t scan;
+    uint8_t *wr;
+    int32_t n, i;
+    uint32_t j, len;
+
+    for (;;) {
+	memset(msgs, 0, batch * sizeof(struct mmsghdr));
+	for (j = 0; j < batch; j++) {
+	    iov[j].iov_base = buf + j * SLOT_SIZE;
+	    iov[j].iov_len = SLOT_SIZE;
+	    msgs[j].msg_hdr.msg_iov = &iov[j];
+	    msgs[j].msg_hdr.msg_iovlen = 1;
+	    msgs[j].msg_hdr.msg_name = &from[j];
+	    msgs[j].msg_hdr.msg_namelen = sizeof(from[j]);
+	}
+	n = recvmmsg(fd, msgs, batch, MSG_DONTWAIT, NULL);
+	rx_calls++;
+	if (n <= 0)
+	    break;
+	wr = buf;
+	for (i = 0; i < n; i++) {
+	    uint8_t *d = iov[i].iov_base;
+
+	    rx_dgrams++;
+	    len = msgs[i].msg_len;
+	    rx_bytes += len;
+	    if (mfp_ts_scan_pkts(d, len, &scan) < 0) {
+		rx_sync_err++;
+		continue;
+	    }
+	    rx_pid_sum += scan.pid[0];
+	    if (scan.n_null) {
+		rx_null_pkts += scan.n_null;
+		len = mfp_ts_strip_null_pkts(d, &scan);
+	    }
+	    /* the accumulator expects the chunk right after the last */
+	    if (wr != d) {
+		memmove(wr, d, len);
+		rx_moves++;
+		rx_move_bytes += len;
+	    }
+	    wr += len;
+	}
+	if ((uint32_t)n < batch)
+	    break;
+    }
+}
+
+static void *receiver(void *arg)
+{
+    struct epoll_event ev, evs[64];
+    struct rusage ru_start, ru_end;
+    uint8_t *buf;
+    int32_t ep, n, i;
+
+    buf = malloc(MAX_BATCH * SLOT_SIZE);
+    ep = epoll_create(MAX_CHANNELS);
+    for (i = 0; i < (int32_t)num_channels; i++) {
+	ev.events = EPOLLIN;
+	ev.data.fd = rx_fd[i];
+	epoll_ctl(ep, EPOLL_CTL_ADD, rx_fd[i], &ev);
+    }
+
+    getrusage(RUSAGE_THREAD, &ru_start);
+    while (running) {
+	n = epoll_wait(ep, evs, 64, 100);
+	for (i = 0; i < n; i++) {
+	    if (mode == 0)
+		rx_legacy(evs[i].data.fd, buf);
+	    else
+		rx_batched(evs[i].data.fd, buf);
+	}
+    }
+    getrusage(RUSAGE_THREAD, &ru_end);
+
+    timersub(&ru_end.ru_utime, &ru_start.ru_utime, &ru_end.ru_utime);
+    timersub(&ru_end.ru_stime, &ru_start.ru_stime, &ru_end.ru_stime);
+    timeradd(&ru_end.ru_utime, &ru_end.ru_stime, &rx_cpu);
+    close(ep);
+    free(buf);
+    return arg;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s -f <file.ts|file.pcap> [-c channels]"
+	    " [-b bitrate_mbps] [-d duration_secs] [-m 0(recvfrom)|"
+	    "1(recvmmsg)] [-B batch] [-p base_port]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *fname = NULL;
+    struct sockaddr_in addr;
+    pthread_t tx_thread, rx_thread;
+    double cpu, cpu_per_byte, ch_per_core;
+    int32_t opt, rcvbuf = 8 * 1000000;
+    uint32_t i;
+
+    while ((opt = getopt(argc, argv, "f:c:b:d:m:B:p:")) != -1) {
+	switch (opt) {
+	case 'f': fname = optarg; break;
+	case 'c': num_channels = atoi(optarg); break;
+	case 'b': bitrate_mbps = atoi(optarg); break;
+	case 'd': duration = atoi(optarg); break;
+	case 'm': mode = atoi(optarg); break;
+	case 'B': batch = atoi(optarg); break;
+	case 'p': base_port = atoi(optarg); break;
+	default: usage(argv[0]);
+	}
+    }
+    if (!fname || !num_channels || num_channels > MAX_CHANNELS ||
+	!batch || batch > MAX_BATCH || !bitrate_mbps)
+	usage(argv[0]);
+    if (load_input(fname) < 0)
+	return 1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    for (i = 0; i < num_channels; i++) {
+	rx_fd[i] = socket(AF_INET, SOCK_DGRAM, 0);
+	addr.sin_port = htons(base_port + i);
+	if (rx_fd[i] < 0 ||
+	    bind(rx_fd[i], (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+	    perror("bind");
+	    return 1;
+	}
+	if (setsockopt(rx_fd[i], SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf,
+		       sizeof(rcvbuf)))
+	    setsockopt(rx_fd[i], SOL_SOCKET, SO_RCVBUF, &rcvbuf,
+		       sizeof(rcvbuf));
+    }
+
+    printf("input %s: %u chunks, %u channels @ %u Mbps, mode %s",
+	   fname, num_chunks, num_channels, bitrate_mbps,
+	   mode ? "recvmmsg" : "recvfrom");
+    if (mode)
+	printf(" batch %u", batch);
+    printf("\n");
+
+    pthread_create(&rx_thread, NULL, receiver, NULL);
+    pthread_create(&tx_thread, NULL, sender, NULL);
+    sleep(duration);
+    running = 0;
+    pthread_join(tx_thread, NULL);
+    pthread_join(rx_thread, NULL);
+
+    cpu = rx_cpu.tv_sec + rx_cpu.tv_usec / 1e6;
+    cpu_per_byte = rx_bytes ? cpu / rx_bytes : 0;
+    ch_per_core = cpu_per_byte ?
+	1.0 / (cpu_per_byte * bitrate_mbps * 1e6 / 8) : 0;
+
+    printf("tx %llu bytes, rx %llu bytes (%.2f%% loss), %llu datagrams,"
+	   " %llu receive calls\n", (unsigned long long)tx_bytes,
+	   (unsigned long long)rx_bytes,
+	   tx_bytes ? 100.0 * (tx_bytes - rx_bytes) / tx_bytes : 0.0,
+	   (unsigned long long)rx_dgrams, (unsigned long long)rx_calls);
+    printf("sync errors %llu, null packets %llu\n",
+	   (unsigned long long)rx_sync_err,
+	   (unsigned long long)rx_null_pkts);
+    if (mode)
+	printf("accumulator moves %llu (%.1f%% of datagrams), %llu bytes\n",
+	       (unsigned long long)rx_moves,
+	       rx_dgrams ? 100.0 * rx_moves / rx_dgrams : 0.0,
+	       (unsigned long long)rx_move_bytes);
+    printf("receiver cpu %.3f s, %.1f ns/datagram, %.0f channels/core"
+	   " @ %u Mbps\n", cpu,
+	   rx_dgrams ? cpu * 1e9 / rx_dgrams : 0.0, ch_per_core,
+	   bitrate_mbps);
+
+    for (i = 0; i < num_channels; i++)
+	close(rx_fd[i]);
+    free(chunks);
+    free(chunk_len);
+    return 0;
+}
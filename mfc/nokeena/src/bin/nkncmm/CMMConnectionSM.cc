@@ -7,6 +7,7 @@
 #include <time.h>
 #include <uuid/uuid.h>
 #include <assert.h>
+#include <arpa/inet.h>
 
 #include <string>
 #include <ext/hash_map>
@@ -17,6 +18,7 @@ using namespace __gnu_cxx;
 #include "cmm_output_fqueue.h"
 #include "CMMConnectionSM.h"
 #include "CMMNodeStatus.h"
+#include "cmm_swim.h"
 
 struct CURLMsg null_CURLMsg;
 
@@ -25,6 +27,8 @@ extern CMMSharedMemoryMgr* CMMNodeLoadMetric;
 
 extern CMMNodeStatusCache* CMMNodeCache;
 
+extern cmm_swim_t* CMMSwim;
+
 ////////////////////////////////////////////////////////////////////////////////
 // Public functions
 ////////////////////////////////////////////////////////////////////////////////
@@ -59,6 +63,9 @@ CMMConnectionSM::CMMConnectionSM(CURLM* mch, const cmm_node_config_t* config,
 
     _nsName = std::string(ns_name, ns_name_strlen);
     _mch = mch;
+    _state = SM_INVALID; // Constructing
+    _swimMember = false;
+    _swimState = CMM_NODE_STATE_UNKNOWN;
     rv = SetConfig(config);
     if (rv) {
     	DBG("[%s] SetConfig() failed, rv=%d", config->node_handle, rv);
@@ -103,6 +110,8 @@ CMMConnectionSM::CMMConnectionSM(CURLM* mch, const cmm_node_config_t* config,
 	strncpy(_shm_loadmetric_data->u.loadmetric.node_handle,
 		_nodeHandle.c_str(), 
 		sizeof(_shm_loadmetric_data->u.loadmetric.node_handle)-1);
+    	_shm_loadmetric_data->u.loadmetric.node_state = _swimState;
+    	_shm_loadmetric_data->u.loadmetric.node_state_changes = 0;
     }
 
     ::g_active_SM++;
@@ -111,6 +120,10 @@ CMMConnectionSM::CMMConnectionSM(CURLM* mch, const cmm_node_config_t* config,
     } // End while
 
     // Error exit
+    if (_swimMember) {
+    	cmm_swim_remove_member(CMMSwim, &_swimAddr);
+	_swimMember = false;
+    }
     if (_shm_data) {
     	rv = CMMNodeInfo->CMMFreeShm(_shm_token);
 	if (rv) {
@@ -146,6 +159,9 @@ CMMConnectionSM::~CMMConnectionSM()
     }
 
     CURLfree();
+    if (_swimMember) {
+    	cmm_swim_remove_member(CMMSwim, &_swimAddr);
+    }
     if (_shm_data) {
     	rv = CMMNodeInfo->CMMFreeShm(_shm_token);
 	if (rv) {
@@ -327,6 +343,7 @@ CMMConnectionSM::SetConfig(const cmm_node_config_t* config,
 	}
 	_shm_data_offset = rv;
     }
+    SwimSetMember();
     return 0; // Success
 }
 
@@ -876,12 +893,13 @@ int CMMConnectionSM::DumpSMdata()
 
     rv = snprintf(_shm_data + _shm_data_offset, 
 		  _shm_datasize - _shm_data_offset, 
-    		  "%s=%s|%s=%ld|%s=%ld|%s=%ld|%s=%ld|%s=%ld|%s=%ld|"
+    		  "%s=%s|%s=%s|%s=%ld|%s=%ld|%s=%ld|%s=%ld|%s=%ld|%s=%ld|"
 		  "%s=%f|%s=%f|%s=%f|%s=%f|%s=%f|"
 		  "%s=%ld|"
 		  "%s=%ld|%s=%ld|%s=%ld|%s=%ld",
 		  CMM_NM_STATE, ((_state == SM_ONLINE) ? 
 		  	CMM_VA_STATE_ON : CMM_VA_STATE_OFF),
+		  CMM_NM_NODE_STATE, cmm_swim_state_str(_swimState),
 		  CMM_NM_OP_SUCCESS, _op_status_success,
 		  CMM_NM_OP_TIMEOUT, _op_status_timeout,
 		  CMM_NM_OP_OTHER, _op_status_other,
@@ -910,6 +928,83 @@ int CMMConnectionSM::DumpSMdata()
     return retval;
 }
 
+void CMMConnectionSM::SwimSetMember()
+{
+    struct sockaddr_in addr;
+    std::string host;
+    size_t pos;
+
+    if (!CMMSwim) {
+    	return;
+    }
+
+    // Node CMM listens on swim_port at the nvsd host IP address
+    pos = _nodeHostPort.rfind(':');
+    host = _nodeHostPort.substr(0, pos);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(::swim_port);
+    if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+	DBG("[%s:%s] Not an IPv4 address [%s], HTTP heartbeat only", 
+	    _nsName.c_str(), _nodeHandle.c_str(), host.c_str());
+	addr.sin_addr.s_addr = 0;
+    }
+
+    if (_swimMember) {
+    	if ((addr.sin_addr.s_addr == _swimAddr.sin_addr.s_addr) &&
+	    (addr.sin_port == _swimAddr.sin_port)) {
+	    return;
+	}
+	cmm_swim_remove_member(CMMSwim, &_swimAddr);
+	_swimMember = false;
+    }
+    if (!addr.sin_addr.s_addr || cmm_swim_add_member(CMMSwim, &addr)) {
+    	SwimNodeState(CMM_NODE_STATE_UNKNOWN);
+    	return;
+    }
+    _swimAddr = addr;
+    _swimMember = true;
+    SwimNodeState(cmm_swim_member_state(CMMSwim, &_swimAddr, 0));
+}
+
+void CMMConnectionSM::SwimNodeState(int state)
+{
+    int rv;
+
+    if (state == _swimState) {
+    	return;
+    }
+    _swimState = state;
+    if (_state == SM_INVALID) {
+    	return; // Constructor initializes shared memory
+    }
+    if (_shm_loadmetric_data) {
+    	_shm_loadmetric_data->u.loadmetric.node_state = state;
+    	_shm_loadmetric_data->u.loadmetric.node_state_changes++;
+    }
+
+    // Dead node goes offline now, HTTP heartbeat brings it back online
+    if ((state == CMM_NODE_STATE_DEAD) && (_state == SM_ONLINE)) {
+    	DBG("[%s:%s] Offline, gossip failure detector declared node dead", 
+	    _nsName.c_str(), _nodeHandle.c_str());
+    	rv = SendNodeStatus(0);
+	if (rv) {
+	    DBG("[%s:%s] SendNodeStatus() failed, rv=%d",
+	    	_nsName.c_str(), _nodeHandle.c_str(), rv);
+	}
+	_node_online_time = NULLtimespec;
+	_failedRequests = 0;
+	_state = SM_OFFLINE;
+	::g_swim_offline++;
+    }
+
+    rv = DumpSMdata();
+    if (rv) {
+    	DBG("[%s:%s] DumpSMdata() failed, rv=%d", 
+	    _nsName.c_str(), _nodeHandle.c_str(), rv);
+    }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Static functions
 ////////////////////////////////////////////////////////////////////////////////
@@ -1250,6 +1345,31 @@ CMMConnectionSM::HandleInternalCompletions()
     }
 }
 
+void
+CMMConnectionSM::HandleSwimEvents()
+{
+    cmm_swim_event_t ev;
+    CMMConnectionSMHash_t::iterator itr;
+    CMMConnectionSM* pConnSM;
+
+    if (!CMMSwim) {
+    	return;
+    }
+    while (!cmm_swim_get_event(CMMSwim, &ev)) {
+    	// Multiple SM(s) (namespaces) may monitor the same node
+	for (itr = _nodeHandleHash.begin(); itr != _nodeHandleHash.end(); 
+	     itr++) {
+	    pConnSM = itr->second;
+	    if (pConnSM->_swimMember && 
+	    	(pConnSM->_swimAddr.sin_addr.s_addr == 
+		 ev.addr.sin_addr.s_addr) &&
+	    	(pConnSM->_swimAddr.sin_port == ev.addr.sin_port)) {
+		pConnSM->SwimNodeState(ev.state);
+	    }
+	}
+    }
+}
+
 size_t 
 CMMConnectionSM::CURLWriteData(void* buffer, size_t size, size_t nmemb, 
 			       void *userp)
@@ -5,6 +5,7 @@
 #define CMMCONNECTIONSM_H
 
 #include <atomic_ops.h>
+#include <netinet/in.h>
 #include "curl/curl.h"
 #include "nkn_cmm_request.h"
 #include <string>
@@ -143,6 +144,9 @@ class CMMConnectionSM {
 
 	static void HandleInternalCompletions();
 
+	// Apply gossip failure detector state changes
+	static void HandleSwimEvents();
+
 	// CURL callback functions
 	static size_t CURLWriteData(void* buffer, size_t size, size_t nmemb, 
 				    void* userp);
@@ -177,6 +181,8 @@ class CMMConnectionSM {
 	int PerformActions(const CURLMsg* msg, bool realCURLcompletion);
 	int SendNodeStatus(int online);
 	int DumpSMdata();
+	void SwimSetMember();
+	void SwimNodeState(int state);
 
     private:
     	static CMMConnectionSMHash_t _nodeHandleHash;
@@ -245,6 +251,11 @@ class CMMConnectionSM {
 
 	// CURL request stats
 	CURLRequestStats _crs;
+
+	// Gossip failure detector data
+	bool _swimMember;
+	struct sockaddr_in _swimAddr;
+	int _swimState; // CMM_NODE_STATE_XXX
 };
 #endif /* CMMCONNECTIONSM_H */
 
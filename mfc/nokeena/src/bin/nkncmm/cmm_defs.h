@@ -72,6 +72,8 @@ extern long g_output_memq_stalls;
 extern long g_output_fq_retry_drops;
 extern long g_output_fq_err_drops;
 
+extern long g_swim_offline;
+
 /*
  * Global configuration data
  */
@@ -98,6 +100,8 @@ extern int send_config_interval_secs;
 extern int enable_connectionpool;
 extern int input_memq_limit;
 extern int output_memq_limit;
+extern int swim_port;
+extern int swim_period_msecs;
 
 #if 1
 #define DBG(_fmt, ...) { \
@@ -366,6 +366,20 @@ void cond_timedwait_input_fqueue(const struct timespec *ts)
     pthread_mutex_unlock(&input_requestq_mutex);
 }
 
+/*
+ *******************************************************************************
+ * wakeup_input_fqueue() - Wake the main loop waiting on the input FQueue
+ *******************************************************************************
+ */
+void wakeup_input_fqueue(void)
+{
+    pthread_mutex_lock(&input_requestq_mutex);
+    if (input_requestq_thread_wait) {
+    	pthread_cond_signal(&input_requestq_cv);
+    }
+    pthread_mutex_unlock(&input_requestq_mutex);
+}
+
 /*
  * End of cmm_input_fqueue.c
  */
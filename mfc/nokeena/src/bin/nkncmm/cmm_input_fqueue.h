@@ -52,6 +52,13 @@ void unlock_input_fqueue(void);
  */
 void cond_timedwait_input_fqueue(const struct timespec *ts);
 
+/*
+ *******************************************************************************
+ * wakeup_input_fqueue() - Wake the main loop waiting on the input FQueue
+ *******************************************************************************
+ */
+void wakeup_input_fqueue(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,993 @@
+/*
+ * cmm_swim.c - UDP gossip failure detector (SWIM)
+ */
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "cmm_defs.h"
+#include "cmm_misc.h"
+#include "cmm_swim.h"
+
+pthread_t swim_thread_id;
+
+#define SWIM_MAGIC		0x53574d31 // "SWM1"
+#define SWIM_VERSION		1
+
+#define SWIM_MSG_PING		1
+#define SWIM_MSG_PING_REQ	2
+#define SWIM_MSG_ACK		3
+
+#define SWIM_MAX_UPDATES	16
+#define SWIM_MAX_GOSSIP		128
+#define SWIM_MAX_RELAYS		64
+#define SWIM_MAX_ALIASES	8
+#define SWIM_MAX_EVENTS		256
+#define SWIM_MAX_INDIRECT	8
+
+/*
+ * Wire format, network byte order.  Addresses are the sockaddr_in
+ * ip/port as is.
+ */
+typedef struct swim_msg_hdr {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t type;
+    uint8_t nupdates;
+    uint8_t flags;
+    uint32_t seq;
+    uint32_t inc_hi;		// Sender incarnation
+    uint32_t inc_lo;
+    uint32_t to_ip;		// Receiver, as the sender knows it
+    uint16_t to_port;
+    uint16_t pad1;
+    uint32_t target_ip;		// PING_REQ: node to probe
+    uint16_t target_port;	// ACK: node that acked
+    uint16_t pad2;
+} swim_msg_hdr_t;
+
+typedef struct swim_msg_update {
+    uint32_t ip;
+    uint16_t port;
+    uint8_t state;
+    uint8_t pad;
+    uint32_t inc_hi;
+    uint32_t inc_lo;
+} swim_msg_update_t;
+
+#define SWIM_MAX_MSG (sizeof(swim_msg_hdr_t) + \
+		      (SWIM_MAX_UPDATES * sizeof(swim_msg_update_t)))
+
+typedef struct swim_member {
+    struct sockaddr_in addr;
+    int refcnt;
+    int state;
+    uint64_t incarnation;
+    int heard;			// Direct message received
+    int probe_turns;		// Dead member probe turns
+    int64_t suspect_at;
+} swim_member_t;
+
+typedef struct swim_gossip {
+    struct sockaddr_in addr;
+    int state;
+    uint64_t incarnation;
+    int transmits;
+} swim_gossip_t;
+
+typedef struct swim_relay {
+    uint32_t seq;
+    uint32_t origin_seq;
+    struct sockaddr_in origin;
+    struct sockaddr_in target;
+    int64_t expires;
+} swim_relay_t;
+
+struct cmm_swim {
+    cmm_swim_config_t cfg;
+    int fd;
+    pthread_mutex_t lock;
+    volatile int exit;
+    volatile int running;
+    unsigned int seed;
+    uint32_t seq;
+    uint64_t incarnation;
+    int refute_pending;
+
+    struct sockaddr_in alias[SWIM_MAX_ALIASES];
+    int naliases;
+
+    swim_member_t *members;
+    int nmembers;
+    int maxmembers;
+    int *order;			// Shuffled probe order
+    int order_len;
+    int order_pos;
+
+    // Outstanding probe
+    int probe_active;
+    struct sockaddr_in probe_target;
+    uint32_t probe_seq;
+    int64_t probe_sent;
+    int probe_indirect;
+    int64_t next_probe;
+
+    swim_gossip_t gossip[SWIM_MAX_GOSSIP];
+    int ngossip;
+
+    swim_relay_t relay[SWIM_MAX_RELAYS];
+    int relay_next;
+
+    cmm_swim_event_t events[SWIM_MAX_EVENTS];
+    int ev_head;
+    int ev_cnt;
+    uint32_t ev_queued;		// Total events queued
+    uint32_t ev_notified;
+
+    cmm_swim_stats_t stats;
+};
+
+static int64_t swim_now_msecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((int64_t)ts.tv_sec * MILLI_SECS_PER_SEC) +
+    	   (ts.tv_nsec / MICRO_SECS_PER_SEC);
+}
+
+static int swim_addr_eq(const struct sockaddr_in *a,
+			const struct sockaddr_in *b)
+{
+    return (a->sin_addr.s_addr == b->sin_addr.s_addr) &&
+    	   (a->sin_port == b->sin_port);
+}
+
+static void swim_set_addr(struct sockaddr_in *a, uint32_t ip, uint16_t port)
+{
+    memset(a, 0, sizeof(*a));
+    a->sin_family = AF_INET;
+    a->sin_addr.s_addr = ip;
+    a->sin_port = port;
+}
+
+static const char *swim_addr_str(const struct sockaddr_in *a, char *buf,
+				 int buflen)
+{
+    char ip[INET_ADDRSTRLEN];
+
+    inet_ntop(AF_INET, &a->sin_addr, ip, sizeof(ip));
+    snprintf(buf, buflen, "%s:%hu", ip, ntohs(a->sin_port));
+    return buf;
+}
+
+static swim_member_t *swim_lookup(cmm_swim_t *s, const struct sockaddr_in *a)
+{
+    int n;
+
+    for (n = 0; n < s->nmembers; n++) {
+    	if (swim_addr_eq(&s->members[n].addr, a)) {
+	    return &s->members[n];
+	}
+    }
+    return NULL;
+}
+
+static int swim_is_self(cmm_swim_t *s, const struct sockaddr_in *a)
+{
+    int n;
+
+    for (n = 0; n < s->naliases; n++) {
+    	if (swim_addr_eq(&s->alias[n], a)) {
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+static void swim_learn_alias(cmm_swim_t *s, const struct sockaddr_in *a)
+{
+    if (!a->sin_addr.s_addr || !a->sin_port || swim_is_self(s, a)) {
+    	return;
+    }
+    if (s->naliases < SWIM_MAX_ALIASES) {
+    	s->alias[s->naliases++] = *a;
+    }
+}
+
+/*
+ * Retransmit limit, gossip_mult * ceil(log2(N + 1))
+ */
+static int swim_retransmits(cmm_swim_t *s)
+{
+    int n = s->nmembers + 1;
+    int log2n = 0;
+
+    while ((1 << log2n) < n) {
+    	log2n++;
+    }
+    return s->cfg.gossip_mult * (log2n ? log2n : 1);
+}
+
+static void swim_gossip_add(cmm_swim_t *s, const struct sockaddr_in *a,
+			    int state, uint64_t incarnation)
+{
+    swim_gossip_t *g = NULL;
+    int n;
+
+    for (n = 0; n < s->ngossip; n++) {
+    	if (swim_addr_eq(&s->gossip[n].addr, a)) {
+	    g = &s->gossip[n];
+	    break;
+	}
+    }
+    if (!g) {
+    	if (s->ngossip < SWIM_MAX_GOSSIP) {
+	    g = &s->gossip[s->ngossip++];
+	} else {
+	    // Replace the most transmitted update
+	    g = &s->gossip[0];
+	    for (n = 1; n < s->ngossip; n++) {
+	    	if (s->gossip[n].transmits > g->transmits) {
+		    g = &s->gossip[n];
+		}
+	    }
+	}
+    }
+    g->addr = *a;
+    g->state = state;
+    g->incarnation = incarnation;
+    g->transmits = 0;
+}
+
+static void swim_queue_event(cmm_swim_t *s, swim_member_t *m)
+{
+    cmm_swim_event_t *ev;
+
+    if (!m->heard) {
+    	return; // Node does not run the detector (yet)
+    }
+    if (s->ev_cnt == SWIM_MAX_EVENTS) {
+    	// Drop oldest
+    	s->ev_head = (s->ev_head + 1) % SWIM_MAX_EVENTS;
+	s->ev_cnt--;
+	s->stats.event_drops++;
+    }
+    ev = &s->events[(s->ev_head + s->ev_cnt) % SWIM_MAX_EVENTS];
+    ev->addr = m->addr;
+    ev->state = m->state;
+    ev->incarnation = m->incarnation;
+    s->ev_cnt++;
+    s->ev_queued++;
+}
+
+static void swim_set_state(cmm_swim_t *s, swim_member_t *m, int state,
+			   uint64_t incarnation, int64_t now)
+{
+    char buf[64];
+
+    if (state == CMM_NODE_STATE_SUSPECT) {
+    	m->suspect_at = now;
+	s->stats.suspects++;
+    } else if (state == CMM_NODE_STATE_DEAD) {
+	s->stats.deads++;
+    } else if (m->state != CMM_NODE_STATE_ALIVE) {
+	s->stats.alives++;
+    }
+    if (state != m->state) {
+	DBG("[%s] %s => %s incarnation=%lu",
+	    swim_addr_str(&m->addr, buf, sizeof(buf)),
+	    cmm_swim_state_str(m->state), cmm_swim_state_str(state),
+	    incarnation);
+    }
+    m->state = state;
+    m->incarnation = incarnation;
+    m->probe_turns = 0;
+    swim_gossip_add(s, &m->addr, state, incarnation);
+    swim_queue_event(s, m);
+}
+
+/*
+ * Apply membership information about addr:
+ *   alive(i)   overrides alive/suspect/dead(j), i > j
+ *   suspect(i) overrides alive(j), i >= j and suspect(j), i > j
+ *   dead(i)    overrides alive/suspect(j), i >= j
+ */
+static void swim_apply(cmm_swim_t *s, const struct sockaddr_in *a, int state,
+		       uint64_t incarnation, int direct, int64_t now)
+{
+    swim_member_t *m;
+    int heard;
+
+    if (swim_is_self(s, a)) {
+    	if ((state != CMM_NODE_STATE_ALIVE) &&
+	    (incarnation >= s->incarnation)) {
+	    // Refute
+	    s->incarnation = incarnation + 1;
+	    swim_gossip_add(s, a, CMM_NODE_STATE_ALIVE, s->incarnation);
+	    s->refute_pending = 1;
+	    s->stats.refutes++;
+	}
+	return;
+    }
+
+    m = swim_lookup(s, a);
+    if (!m) {
+    	return; // Not monitored by this node
+    }
+    heard = m->heard;
+    if (direct) {
+    	m->heard = 1;
+    }
+
+    switch (state) {
+    case CMM_NODE_STATE_ALIVE:
+    	if ((incarnation > m->incarnation) ||
+	    (!heard && m->heard && (incarnation == m->incarnation))) {
+	    swim_set_state(s, m, state, incarnation, now);
+	}
+	break;
+    case CMM_NODE_STATE_SUSPECT:
+    	if (((m->state == CMM_NODE_STATE_ALIVE) &&
+	     (incarnation >= m->incarnation)) ||
+	    ((m->state == CMM_NODE_STATE_SUSPECT) &&
+	     (incarnation > m->incarnation))) {
+	    swim_set_state(s, m, state, incarnation, now);
+	}
+	break;
+    case CMM_NODE_STATE_DEAD:
+    	if ((m->state != CMM_NODE_STATE_DEAD) &&
+	    (incarnation >= m->incarnation)) {
+	    swim_set_state(s, m, state, incarnation, now);
+	}
+	break;
+    default:
+    	s->stats.bad_msgs++;
+    	break;
+    }
+}
+
+static void swim_put_update(swim_msg_update_t *u, const struct sockaddr_in *a,
+			    int state, uint64_t incarnation)
+{
+    u->ip = a->sin_addr.s_addr;
+    u->port = a->sin_port;
+    u->state = state;
+    u->pad = 0;
+    u->inc_hi = htonl((uint32_t)(incarnation >> 32));
+    u->inc_lo = htonl((uint32_t)incarnation);
+}
+
+/*
+ * Piggyback order: news about the receiver (so that it can refute),
+ * the caller's update, then the least transmitted gossip.
+ */
+static int swim_build_updates(cmm_swim_t *s, const struct sockaddr_in *to,
+			      const swim_gossip_t *extra,
+			      swim_msg_update_t *u)
+{
+    swim_member_t *m;
+    swim_gossip_t *g;
+    int limit = swim_retransmits(s);
+    int cnt = 0;
+    int n, best;
+    char picked[SWIM_MAX_GOSSIP];
+
+    m = swim_lookup(s, to);
+    if (m && (m->state != CMM_NODE_STATE_ALIVE)) {
+    	swim_put_update(&u[cnt++], &m->addr, m->state, m->incarnation);
+    }
+    if (extra) {
+    	swim_put_update(&u[cnt++], &extra->addr, extra->state,
+			extra->incarnation);
+    }
+
+    memset(picked, 0, s->ngossip);
+    while (cnt < SWIM_MAX_UPDATES) {
+    	best = -1;
+	for (n = 0; n < s->ngossip; n++) {
+	    if (!picked[n] && ((best < 0) ||
+	    	(s->gossip[n].transmits < s->gossip[best].transmits))) {
+	    	best = n;
+	    }
+	}
+	if (best < 0) {
+	    break;
+	}
+	picked[best] = 1;
+	g = &s->gossip[best];
+	swim_put_update(&u[cnt++], &g->addr, g->state, g->incarnation);
+	g->transmits++;
+    }
+
+    // Retire fully disseminated updates
+    for (n = 0; n < s->ngossip; ) {
+    	if (s->gossip[n].transmits >= limit) {
+	    s->gossip[n] = s->gossip[--s->ngossip];
+	} else {
+	    n++;
+	}
+    }
+    return cnt;
+}
+
+static void swim_send(cmm_swim_t *s, const struct sockaddr_in *to, int type,
+		      uint32_t seq, const struct sockaddr_in *target,
+		      const swim_gossip_t *extra)
+{
+    char buf[SWIM_MAX_MSG];
+    swim_msg_hdr_t *h = (swim_msg_hdr_t *)buf;
+    int nupdates;
+    int rv;
+
+    memset(h, 0, sizeof(*h));
+    h->magic = htonl(SWIM_MAGIC);
+    h->version = SWIM_VERSION;
+    h->type = type;
+    h->seq = htonl(seq);
+    h->inc_hi = htonl((uint32_t)(s->incarnation >> 32));
+    h->inc_lo = htonl((uint32_t)s->incarnation);
+    h->to_ip = to->sin_addr.s_addr;
+    h->to_port = to->sin_port;
+    if (target) {
+    	h->target_ip = target->sin_addr.s_addr;
+    	h->target_port = target->sin_port;
+    }
+    nupdates = swim_build_updates(s, to, extra,
+    				  (swim_msg_update_t *)(buf + sizeof(*h)));
+    h->nupdates = nupdates;
+
+    rv = sendto(s->fd, buf,
+    		sizeof(*h) + (nupdates * sizeof(swim_msg_update_t)),
+		MSG_DONTWAIT, (const struct sockaddr *)to, sizeof(*to));
+    if (rv < 0) {
+    	DBG("sendto() failed, errno=%d", errno);
+	return;
+    }
+    switch (type) {
+    case SWIM_MSG_PING:
+    	s->stats.pings_sent++;
+	break;
+    case SWIM_MSG_PING_REQ:
+    	s->stats.ping_reqs_sent++;
+	break;
+    case SWIM_MSG_ACK:
+    	s->stats.acks_sent++;
+	break;
+    }
+}
+
+static void swim_shuffle(cmm_swim_t *s)
+{
+    int n, j, t;
+
+    for (n = 0; n < s->nmembers; n++) {
+    	s->order[n] = n;
+    }
+    for (n = s->nmembers - 1; n > 0; n--) {
+    	j = rand_r(&s->seed) % (n + 1);
+	t = s->order[n];
+	s->order[n] = s->order[j];
+	s->order[j] = t;
+    }
+    s->order_len = s->nmembers;
+    s->order_pos = 0;
+}
+
+static swim_member_t *swim_next_target(cmm_swim_t *s)
+{
+    swim_member_t *m;
+    int tries;
+
+    for (tries = 0; tries < (2 * s->nmembers); tries++) {
+    	if (s->order_pos >= s->order_len) {
+	    swim_shuffle(s);
+	    if (!s->order_len) {
+	    	return NULL;
+	    }
+	}
+	m = &s->members[s->order[s->order_pos++]];
+	if ((m->state == CMM_NODE_STATE_DEAD) &&
+	    (m->probe_turns++ % s->cfg.dead_probe_periods)) {
+	    continue;
+	}
+	return m;
+    }
+    return NULL;
+}
+
+/*
+ * Up to k random alive members, other than exclude
+ */
+static int swim_pick_members(cmm_swim_t *s, const struct sockaddr_in *exclude,
+			     int k, int *cand)
+{
+    swim_member_t *m;
+    int ncand = 0;
+    int n, j, seen;
+
+    for (n = 0; (n < (4 * s->nmembers)) && (ncand < k); n++) {
+    	j = rand_r(&s->seed) % s->nmembers;
+	m = &s->members[j];
+	if ((m->state != CMM_NODE_STATE_ALIVE) || !m->heard ||
+	    (exclude && swim_addr_eq(&m->addr, exclude))) {
+	    continue;
+	}
+	for (seen = 0; seen < ncand; seen++) {
+	    if (cand[seen] == j) {
+	    	break;
+	    }
+	}
+	if (seen == ncand) {
+	    cand[ncand++] = j;
+	}
+    }
+    return ncand;
+}
+
+static void swim_send_ping_reqs(cmm_swim_t *s)
+{
+    int cand[SWIM_MAX_INDIRECT];
+    int ncand;
+    int n;
+
+    ncand = swim_pick_members(s, &s->probe_target, s->cfg.indirect_probes,
+			      cand);
+    for (n = 0; n < ncand; n++) {
+    	swim_send(s, &s->members[cand[n]].addr, SWIM_MSG_PING_REQ,
+		  s->probe_seq, &s->probe_target, NULL);
+    }
+}
+
+/*
+ * A suspicion of this node is refuted by gossip; push the new
+ * incarnation to k members right away rather than waiting for the
+ * next probes so that it wins the race with the suspicion timeout.
+ */
+static void swim_push_refute(cmm_swim_t *s)
+{
+    int cand[SWIM_MAX_INDIRECT];
+    int ncand;
+    int n;
+
+    s->refute_pending = 0;
+    ncand = swim_pick_members(s, NULL, s->cfg.indirect_probes, cand);
+    for (n = 0; n < ncand; n++) {
+    	swim_send(s, &s->members[cand[n]].addr, SWIM_MSG_PING, ++s->seq,
+		  NULL, NULL);
+    }
+}
+
+static void swim_recv_msg(cmm_swim_t *s, const char *buf, int len,
+			  const struct sockaddr_in *from, int64_t now)
+{
+    const swim_msg_hdr_t *h = (const swim_msg_hdr_t *)buf;
+    const swim_msg_update_t *u;
+    struct sockaddr_in to;
+    struct sockaddr_in target;
+    struct sockaddr_in a;
+    swim_relay_t *r;
+    swim_gossip_t g;
+    uint64_t incarnation;
+    uint32_t seq;
+    int n;
+
+    if ((len < (int)sizeof(*h)) || (ntohl(h->magic) != SWIM_MAGIC) ||
+    	(h->version != SWIM_VERSION) || (h->nupdates > SWIM_MAX_UPDATES) ||
+	(len < (int)(sizeof(*h) + (h->nupdates * sizeof(*u))))) {
+	s->stats.bad_msgs++;
+    	return;
+    }
+    seq = ntohl(h->seq);
+    incarnation = ((uint64_t)ntohl(h->inc_hi) << 32) | ntohl(h->inc_lo);
+    swim_set_addr(&to, h->to_ip, h->to_port);
+    swim_set_addr(&target, h->target_ip, h->target_port);
+
+    swim_learn_alias(s, &to);
+    swim_apply(s, from, CMM_NODE_STATE_ALIVE, incarnation, 1, now);
+
+    u = (const swim_msg_update_t *)(buf + sizeof(*h));
+    for (n = 0; n < h->nupdates; n++, u++) {
+    	swim_set_addr(&a, u->ip, u->port);
+	swim_apply(s, &a, u->state,
+		   ((uint64_t)ntohl(u->inc_hi) << 32) | ntohl(u->inc_lo),
+		   0, now);
+    }
+
+    switch (h->type) {
+    case SWIM_MSG_PING:
+	swim_send(s, from, SWIM_MSG_ACK, seq, NULL, NULL);
+    	break;
+
+    case SWIM_MSG_PING_REQ:
+    	r = &s->relay[s->relay_next];
+	s->relay_next = (s->relay_next + 1) % SWIM_MAX_RELAYS;
+	r->seq = ++s->seq;
+	r->origin_seq = seq;
+	r->origin = *from;
+	r->target = target;
+	r->expires = now + s->cfg.period_msecs;
+	swim_send(s, &target, SWIM_MSG_PING, r->seq, NULL, NULL);
+    	break;
+
+    case SWIM_MSG_ACK:
+    	s->stats.acks_recv++;
+    	if (s->probe_active && (seq == s->probe_seq)) {
+	    if (!swim_addr_eq(from, &s->probe_target)) {
+	    	s->stats.indirect_acks++;
+	    }
+	    s->probe_active = 0;
+	    break;
+	}
+	for (n = 0; n < SWIM_MAX_RELAYS; n++) {
+	    r = &s->relay[n];
+	    if (r->expires && (r->seq == seq) &&
+	    	swim_addr_eq(&r->target, from)) {
+		// Forward, with the target's incarnation
+		g.addr = *from;
+		g.state = CMM_NODE_STATE_ALIVE;
+		g.incarnation = incarnation;
+		g.transmits = 0;
+		if (now <= r->expires) {
+		    swim_send(s, &r->origin, SWIM_MSG_ACK, r->origin_seq,
+			      from, &g);
+		}
+		r->expires = 0;
+		break;
+	    }
+	}
+    	break;
+
+    default:
+	s->stats.bad_msgs++;
+    	break;
+    }
+
+    if (s->refute_pending) {
+    	swim_push_refute(s);
+    }
+}
+
+/*
+ * Run protocol timers, returns msecs until the next deadline
+ */
+static int swim_timers(cmm_swim_t *s, int64_t now)
+{
+    swim_member_t *m;
+    int64_t next;
+    int n;
+
+    if (s->probe_active) {
+    	if (now >= (s->probe_sent + s->cfg.period_msecs)) {
+	    s->probe_active = 0;
+	    s->stats.probe_timeouts++;
+	    m = swim_lookup(s, &s->probe_target);
+	    if (m && (m->state == CMM_NODE_STATE_ALIVE)) {
+	    	swim_set_state(s, m, CMM_NODE_STATE_SUSPECT, m->incarnation,
+			       now);
+		// Tell the suspect, a live node refutes at once
+		swim_send(s, &m->addr, SWIM_MSG_PING, ++s->seq, NULL, NULL);
+	    }
+	} else if (!s->probe_indirect &&
+		   (now >= (s->probe_sent + s->cfg.ack_timeout_msecs))) {
+	    s->probe_indirect = 1;
+	    swim_send_ping_reqs(s);
+	}
+    }
+
+    for (n = 0; n < s->nmembers; n++) {
+    	m = &s->members[n];
+	if ((m->state == CMM_NODE_STATE_SUSPECT) &&
+	    (now >= (m->suspect_at + s->cfg.suspect_timeout_msecs))) {
+	    swim_set_state(s, m, CMM_NODE_STATE_DEAD, m->incarnation, now);
+	}
+    }
+
+    if (now >= s->next_probe) {
+    	s->next_probe = now + s->cfg.period_msecs;
+	m = swim_next_target(s);
+	if (m) {
+	    s->probe_active = 1;
+	    s->probe_target = m->addr;
+	    s->probe_seq = ++s->seq;
+	    s->probe_sent = now;
+	    s->probe_indirect = 0;
+	    swim_send(s, &m->addr, SWIM_MSG_PING, s->probe_seq, NULL, NULL);
+	}
+    }
+
+    // Next deadline
+    next = s->next_probe;
+    if (s->probe_active) {
+    	if (!s->probe_indirect &&
+	    ((s->probe_sent + s->cfg.ack_timeout_msecs) < next)) {
+	    next = s->probe_sent + s->cfg.ack_timeout_msecs;
+	}
+	if ((s->probe_sent + s->cfg.period_msecs) < next) {
+	    next = s->probe_sent + s->cfg.period_msecs;
+	}
+    }
+    for (n = 0; n < s->nmembers; n++) {
+    	m = &s->members[n];
+	if ((m->state == CMM_NODE_STATE_SUSPECT) &&
+	    ((m->suspect_at + s->cfg.suspect_timeout_msecs) < next)) {
+	    next = m->suspect_at + s->cfg.suspect_timeout_msecs;
+	}
+    }
+    return (next > now) ? (int)(next - now) : 0;
+}
+
+/*
+ *******************************************************************************
+ * 		P U B L I C  F U N C T I O N S
+ *******************************************************************************
+ */
+void cmm_swim_default_config(cmm_swim_config_t *cfg, int port)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->bind_addr.sin_family = AF_INET;
+    cfg->bind_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    cfg->bind_addr.sin_port = htons(port);
+    cfg->period_msecs = 100;
+    cfg->ack_timeout_msecs = 40;
+    cfg->indirect_probes = 3;
+    cfg->suspect_timeout_msecs = 300;
+    cfg->dead_probe_periods = 10;
+    cfg->gossip_mult = 3;
+}
+
+cmm_swim_t *cmm_swim_create(const cmm_swim_config_t *cfg)
+{
+    cmm_swim_t *s;
+    struct timespec ts;
+    int on = 1;
+
+    s = (cmm_swim_t *)CMM_calloc(1, sizeof(cmm_swim_t));
+    if (!s) {
+    	DBG("CMM_calloc() failed, size=%ld", sizeof(cmm_swim_t));
+	return NULL;
+    }
+    s->cfg = *cfg;
+    if (s->cfg.period_msecs < 10) {
+    	s->cfg.period_msecs = 10;
+    }
+    if (s->cfg.ack_timeout_msecs >= s->cfg.period_msecs) {
+    	s->cfg.ack_timeout_msecs = s->cfg.period_msecs / 2;
+    }
+    if (s->cfg.indirect_probes > SWIM_MAX_INDIRECT) {
+    	s->cfg.indirect_probes = SWIM_MAX_INDIRECT;
+    }
+    if (s->cfg.dead_probe_periods < 1) {
+    	s->cfg.dead_probe_periods = 1;
+    }
+    if (s->cfg.gossip_mult < 1) {
+    	s->cfg.gossip_mult = 1;
+    }
+    pthread_mutex_init(&s->lock, NULL);
+
+    // Restarted node wins over its earlier incarnations
+    clock_gettime(CLOCK_REALTIME, &ts);
+    s->incarnation = ((uint64_t)ts.tv_sec * MILLI_SECS_PER_SEC) +
+    		     (ts.tv_nsec / MICRO_SECS_PER_SEC);
+    s->seed = (unsigned int)(ts.tv_nsec ^ getpid() ^
+    			     ntohs(cfg->bind_addr.sin_port));
+
+    s->fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (s->fd < 0) {
+    	DBG("socket() failed, errno=%d", errno);
+	CMM_free(s);
+	return NULL;
+    }
+    setsockopt(s->fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    fcntl(s->fd, F_SETFD, FD_CLOEXEC);
+    if (bind(s->fd, (const struct sockaddr *)&s->cfg.bind_addr,
+    	     sizeof(s->cfg.bind_addr))) {
+    	DBG("bind(port=%hu) failed, errno=%d",
+	    ntohs(s->cfg.bind_addr.sin_port), errno);
+	close(s->fd);
+	CMM_free(s);
+	return NULL;
+    }
+    swim_learn_alias(s, &s->cfg.bind_addr);
+    return s;
+}
+
+void cmm_swim_destroy(cmm_swim_t *s)
+{
+    s->exit = 1;
+    while (s->running) {
+    	usleep(1000);
+    }
+    close(s->fd);
+    if (s->members) {
+    	CMM_free(s->members);
+	CMM_free(s->order);
+    }
+    pthread_mutex_destroy(&s->lock);
+    CMM_free(s);
+}
+
+void *cmm_swim_handler(void *arg)
+{
+    cmm_swim_t *s = (cmm_swim_t *)arg;
+    char buf[SWIM_MAX_MSG];
+    struct sockaddr_in from;
+    socklen_t fromlen;
+    struct pollfd pfd;
+    int timeout_msecs;
+    int notify;
+    int rv;
+
+    s->running = 1;
+    pthread_mutex_lock(&s->lock);
+    s->next_probe = swim_now_msecs();
+    pthread_mutex_unlock(&s->lock);
+
+    while (!s->exit) {
+	pthread_mutex_lock(&s->lock);
+	timeout_msecs = swim_timers(s, swim_now_msecs());
+	notify = (s->ev_queued != s->ev_notified);
+	s->ev_notified = s->ev_queued;
+	pthread_mutex_unlock(&s->lock);
+
+	if (notify && s->cfg.notify) {
+	    (*s->cfg.notify)(s->cfg.notify_arg);
+	}
+
+	pfd.fd = s->fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	rv = poll(&pfd, 1, (timeout_msecs < 100) ? timeout_msecs : 100);
+	if (rv <= 0) {
+	    continue;
+	}
+
+	while (1) {
+	    fromlen = sizeof(from);
+	    rv = recvfrom(s->fd, buf, sizeof(buf), MSG_DONTWAIT,
+	    		  (struct sockaddr *)&from, &fromlen);
+	    if (rv < 0) {
+	    	break;
+	    }
+	    pthread_mutex_lock(&s->lock);
+	    if (s->cfg.loss_pct &&
+	    	((int)(rand_r(&s->seed) % 100) < s->cfg.loss_pct)) {
+		s->stats.lost_msgs++;
+	    } else {
+		swim_recv_msg(s, buf, rv, &from, swim_now_msecs());
+	    }
+	    pthread_mutex_unlock(&s->lock);
+	}
+    }
+    s->running = 0;
+    return NULL;
+}
+
+int cmm_swim_add_member(cmm_swim_t *s, const struct sockaddr_in *addr)
+{
+    swim_member_t *m;
+    swim_member_t *members;
+    int *order;
+    int max;
+
+    pthread_mutex_lock(&s->lock);
+    m = swim_lookup(s, addr);
+    if (m) {
+    	m->refcnt++;
+	pthread_mutex_unlock(&s->lock);
+	return 0;
+    }
+
+    if (s->nmembers == s->maxmembers) {
+    	max = s->maxmembers ? (2 * s->maxmembers) : 64;
+	members = (swim_member_t *)CMM_calloc(max, sizeof(swim_member_t));
+	order = (int *)CMM_calloc(max, sizeof(int));
+	if (!members || !order) {
+	    if (members) {
+	    	CMM_free(members);
+	    }
+	    if (order) {
+	    	CMM_free(order);
+	    }
+	    pthread_mutex_unlock(&s->lock);
+	    return 1;
+	}
+	if (s->members) {
+	    memcpy(members, s->members, s->nmembers * sizeof(swim_member_t));
+	    CMM_free(s->members);
+	    CMM_free(s->order);
+	}
+	s->members = members;
+	s->order = order;
+	s->maxmembers = max;
+    }
+    m = &s->members[s->nmembers++];
+    memset(m, 0, sizeof(*m));
+    m->addr = *addr;
+    m->addr.sin_family = AF_INET;
+    m->refcnt = 1;
+    m->state = CMM_NODE_STATE_ALIVE;
+    s->order_len = 0; // Reshuffle
+    pthread_mutex_unlock(&s->lock);
+    return 0;
+}
+
+int cmm_swim_remove_member(cmm_swim_t *s, const struct sockaddr_in *addr)
+{
+    swim_member_t *m;
+
+    pthread_mutex_lock(&s->lock);
+    m = swim_lookup(s, addr);
+    if (!m) {
+    	pthread_mutex_unlock(&s->lock);
+	return 1;
+    }
+    if (--m->refcnt == 0) {
+    	*m = s->members[--s->nmembers];
+	s->order_len = 0; // Reshuffle
+    }
+    pthread_mutex_unlock(&s->lock);
+    return 0;
+}
+
+int cmm_swim_member_state(cmm_swim_t *s, const struct sockaddr_in *addr,
+			  uint64_t *incarnation)
+{
+    swim_member_t *m;
+    int state = CMM_NODE_STATE_UNKNOWN;
+
+    pthread_mutex_lock(&s->lock);
+    m = swim_lookup(s, addr);
+    if (m && m->heard) {
+    	state = m->state;
+	if (incarnation) {
+	    *incarnation = m->incarnation;
+	}
+    }
+    pthread_mutex_unlock(&s->lock);
+    return state;
+}
+
+int cmm_swim_get_event(cmm_swim_t *s, cmm_swim_event_t *ev)
+{
+    int retval = 1;
+
+    pthread_mutex_lock(&s->lock);
+    if (s->ev_cnt) {
+    	*ev = s->events[s->ev_head];
+	s->ev_head = (s->ev_head + 1) % SWIM_MAX_EVENTS;
+	s->ev_cnt--;
+	retval = 0;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return retval;
+}
+
+void cmm_swim_get_stats(cmm_swim_t *s, cmm_swim_stats_t *st)
+{
+    pthread_mutex_lock(&s->lock);
+    *st = s->stats;
+    pthread_mutex_unlock(&s->lock);
+}
+
+const char *cmm_swim_state_str(int state)
+{
+    switch (state) {
+    case CMM_NODE_STATE_ALIVE:
+    	return "alive";
+    case CMM_NODE_STATE_SUSPECT:
+    	return "suspect";
+    case CMM_NODE_STATE_DEAD:
+    	return "dead";
+    default:
+    	return "unknown";
+    }
+}
+
+/*
+ * End of cmm_swim.c
+ */
@@ -0,0 +1,152 @@
+/*
+ * cmm_swim.h - UDP gossip failure detector (SWIM)
+ *
+ *	Each CMM probes the CMM of one monitored node per protocol period
+ *	with a UDP ping.  A missing ack is retried through up to k other
+ *	members (ping-req) before the node is suspected, and a suspicion
+ *	that is not refuted within the suspicion timeout declares the node
+ *	dead.  Membership updates ride piggyback on the probe traffic, a
+ *	node refutes a suspicion of itself by raising its incarnation.
+ *
+ *	State changes of members that were heard from are queued for the
+ *	main loop (cmm_swim_get_event()), the HTTP heartbeat keeps
+ *	supplying the load metric and the nvsd online status.
+ */
+
+#ifndef CMM_SWIM_H
+#define CMM_SWIM_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include "nkn_cmm_shm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct cmm_swim cmm_swim_t;
+
+typedef struct cmm_swim_config {
+    struct sockaddr_in bind_addr;
+    int period_msecs;		// Protocol period, one probe each
+    int ack_timeout_msecs;	// Direct ack wait before ping-req
+    int indirect_probes;	// Members asked to ping-req (k)
+    int suspect_timeout_msecs;	// Suspect => dead unless refuted
+    int dead_probe_periods;	// Probe dead members every n-th turn
+    int gossip_mult;		// Retransmits = gossip_mult * log2(N+1)
+    int loss_pct;		// Test only: drop received datagrams
+    void (*notify)(void *arg);	// Called when events are queued
+    void *notify_arg;
+} cmm_swim_config_t;
+
+typedef struct cmm_swim_event {
+    struct sockaddr_in addr;
+    int state;			// CMM_NODE_STATE_XXX
+    uint64_t incarnation;
+} cmm_swim_event_t;
+
+typedef struct cmm_swim_stats {
+    long pings_sent;
+    long ping_reqs_sent;
+    long acks_sent;
+    long acks_recv;
+    long indirect_acks;
+    long probe_timeouts;
+    long suspects;
+    long deads;
+    long alives;
+    long refutes;
+    long bad_msgs;
+    long lost_msgs;
+    long event_drops;
+} cmm_swim_stats_t;
+
+extern pthread_t swim_thread_id;
+
+/*
+ *******************************************************************************
+ * cmm_swim_default_config() - Default configuration, INADDR_ANY:port
+ *******************************************************************************
+ */
+void cmm_swim_default_config(cmm_swim_config_t *cfg, int port);
+
+/*
+ *******************************************************************************
+ * cmm_swim_create() - Bind the UDP socket and create an instance
+ *	Returns: !=0 => Success
+ *******************************************************************************
+ */
+cmm_swim_t *cmm_swim_create(const cmm_swim_config_t *cfg);
+
+/*
+ *******************************************************************************
+ * cmm_swim_destroy() - Stop the thread handler (if any) and free instance
+ *******************************************************************************
+ */
+void cmm_swim_destroy(cmm_swim_t *s);
+
+/*
+ *******************************************************************************
+ * cmm_swim_handler() - Thread handler, arg is the cmm_swim_t
+ *******************************************************************************
+ */
+void *cmm_swim_handler(void *arg);
+
+/*
+ *******************************************************************************
+ * cmm_swim_add_member() - Monitor ip:port, reference counted
+ *	Returns: 0 => Success
+ *******************************************************************************
+ */
+int cmm_swim_add_member(cmm_swim_t *s, const struct sockaddr_in *addr);
+
+/*
+ *******************************************************************************
+ * cmm_swim_remove_member() - Drop a reference from cmm_swim_add_member()
+ *	Returns: 0 => Success
+ *******************************************************************************
+ */
+int cmm_swim_remove_member(cmm_swim_t *s, const struct sockaddr_in *addr);
+
+/*
+ *******************************************************************************
+ * cmm_swim_member_state() - Current view of a member
+ *	Returns: CMM_NODE_STATE_XXX, CMM_NODE_STATE_UNKNOWN if not a member
+ *		 or never heard from
+ *******************************************************************************
+ */
+int cmm_swim_member_state(cmm_swim_t *s, const struct sockaddr_in *addr,
+			  uint64_t *incarnation);
+
+/*
+ *******************************************************************************
+ * cmm_swim_get_event() - Dequeue the next member state change
+ *	Returns: 0 => Event returned
+ *******************************************************************************
+ */
+int cmm_swim_get_event(cmm_swim_t *s, cmm_swim_event_t *ev);
+
+/*
+ *******************************************************************************
+ * cmm_swim_get_stats() - Copy out counters
+ *******************************************************************************
+ */
+void cmm_swim_get_stats(cmm_swim_t *s, cmm_swim_stats_t *st);
+
+/*
+ *******************************************************************************
+ * cmm_swim_state_str() - CMM_NODE_STATE_XXX as string
+ *******************************************************************************
+ */
+const char *cmm_swim_state_str(int state);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CMM_SWIM_H */
+
+/*
+ * End of cmm_swim.h
+ */
@@ -0,0 +1,280 @@
+/*
+ * cmm_swim_test.c - Loopback test of the gossip failure detector
+ *
+ *	Runs N detector instances on 127.0.0.1, each monitoring all the
+ *	others, and reports:
+ *	  - false positives: suspect/dead events while every instance is
+ *	    up, with -l percent of the received datagrams dropped
+ *	  - detection: time until every other instance declared a stopped
+ *	    instance dead
+ *	  - recovery: time until every other instance sees it alive again
+ *	    after a restart on the same port
+ *
+ *	build:
+ *	  gcc -O2 -D_GNU_SOURCE -I. -I../../include -o cmm_swim_test \
+ *		cmm_swim_test.c cmm_swim.c -lpthread
+ *
+ *	usage: cmm_swim_test [-n instances] [-t seconds] [-l loss_pct]
+ *		[-p base_port] [-v]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "cmm_defs.h"
+#include "cmm_swim.h"
+
+#define MAX_INSTANCES 64
+
+/* nkn_cmm.cc and cmm_misc.c data used by cmm_swim.c */
+int cmm_debug_output = 0;
+FILE *cmm_debug_output_file = NULL;
+int cmm_debug_memlog = 0;
+int cmm_memlog_size_bytes = 0;
+int cmm_memlog_bytes_used = 0;
+char *cmm_memlog = NULL;
+pthread_mutex_t cmm_memlog_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t cmm_fd_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void *CMM_calloc(size_t nmemb, size_t size)
+{
+    return calloc(nmemb, size);
+}
+
+void CMM_free(void *ptr)
+{
+    free(ptr);
+}
+
+typedef struct instance {
+    cmm_swim_t *s;
+    pthread_t tid;
+    struct sockaddr_in addr;
+} instance_t;
+
+static instance_t inst[MAX_INSTANCES];
+static int ninst = 8;
+static int loss_pct;
+static int base_port = 17000;
+
+static int64_t now_msecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((int64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+static void sleep_msecs(int msecs)
+{
+    usleep(msecs * 1000);
+}
+
+static int start_instance(int n)
+{
+    cmm_swim_config_t cfg;
+    int j;
+
+    cmm_swim_default_config(&cfg, base_port + n);
+    cfg.bind_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    cfg.loss_pct = loss_pct;
+    inst[n].addr = cfg.bind_addr;
+    inst[n].s = cmm_swim_create(&cfg);
+    if (!inst[n].s) {
+    	fprintf(stderr, "cmm_swim_create(port=%d) failed\n", base_port + n);
+	return 1;
+    }
+    for (j = 0; j < ninst; j++) {
+    	if (j != n) {
+	    cmm_swim_add_member(inst[n].s, &inst[j].addr);
+	}
+    }
+    pthread_create(&inst[n].tid, NULL, cmm_swim_handler, inst[n].s);
+    return 0;
+}
+
+static void stop_instance(int n)
+{
+    cmm_swim_destroy(inst[n].s);
+    pthread_join(inst[n].tid, NULL);
+    inst[n].s = NULL;
+}
+
+static int addr_to_instance(const struct sockaddr_in *a)
+{
+    return ntohs(a->sin_port) - base_port;
+}
+
+/*
+ * Drain events of all running instances, count them by state
+ */
+static void count_events(int *cnt)
+{
+    cmm_swim_event_t ev;
+    int n;
+
+    for (n = 0; n < ninst; n++) {
+	while (inst[n].s && !cmm_swim_get_event(inst[n].s, &ev)) {
+	    cnt[ev.state]++;
+	}
+    }
+}
+
+/*
+ * Drain events of all running instances, note when each one last
+ * reported victim entering state
+ */
+static void drain_events(int victim, int state, int64_t *seen)
+{
+    cmm_swim_event_t ev;
+    int n;
+
+    for (n = 0; n < ninst; n++) {
+	while (inst[n].s && !cmm_swim_get_event(inst[n].s, &ev)) {
+	    if (addr_to_instance(&ev.addr) != victim) {
+	    	continue;
+	    }
+	    if (ev.state == state) {
+		if (!seen[n]) {
+		    seen[n] = now_msecs();
+		}
+	    } else {
+	    	seen[n] = 0; // Left the state again
+	    }
+	}
+    }
+}
+
+static void wait_all(int victim, int state, int64_t t0, const char *what)
+{
+    int64_t seen[MAX_INSTANCES];
+    int64_t min = 0, max = 0, sum = 0;
+    int n, done;
+
+    memset(seen, 0, sizeof(seen));
+    while (now_msecs() - t0 < 10000) {
+    	drain_events(victim, state, seen);
+	for (n = 0, done = 0; n < ninst; n++) {
+	    if ((n == victim) || seen[n]) {
+	    	done++;
+	    }
+	}
+	if (done == ninst) {
+	    break;
+	}
+	sleep_msecs(2);
+    }
+    for (n = 0, done = 0; n < ninst; n++) {
+    	if ((n == victim) || !seen[n]) {
+	    continue;
+	}
+	if (!done++ || (seen[n] - t0 < min)) {
+	    min = seen[n] - t0;
+	}
+	if (seen[n] - t0 > max) {
+	    max = seen[n] - t0;
+	}
+	sum += seen[n] - t0;
+    }
+    printf("  %-9s %d/%d instances, min %4ld avg %4ld max %4ld msecs\n",
+	   what, done, ninst - 1, (long)min, done ? (long)(sum / done) : 0,
+	   (long)max);
+}
+
+int main(int argc, char **argv)
+{
+    cmm_swim_stats_t st;
+    long acks = 0, pings = 0, indirect = 0, lost = 0;
+    int64_t t0;
+    int seconds = 10;
+    int cnt[CMM_NODE_STATE_DEAD + 1];
+    int n, c;
+
+    while ((c = getopt(argc, argv, "n:t:l:p:v")) != -1) {
+    	switch (c) {
+	case 'n':
+	    ninst = atoi(optarg);
+	    break;
+	case 't':
+	    seconds = atoi(optarg);
+	    break;
+	case 'l':
+	    loss_pct = atoi(optarg);
+	    break;
+	case 'p':
+	    base_port = atoi(optarg);
+	    break;
+	case 'v':
+	    cmm_debug_output = 1;
+	    break;
+	default:
+	    fprintf(stderr, "usage: %s [-n instances] [-t seconds] "
+	    	    "[-l loss_pct] [-p base_port] [-v]\n", argv[0]);
+	    return 1;
+	}
+    }
+    if ((ninst < 2) || (ninst > MAX_INSTANCES)) {
+    	fprintf(stderr, "instances: 2..%d\n", MAX_INSTANCES);
+	return 1;
+    }
+
+    for (n = 0; n < ninst; n++) {
+    	memset(&inst[n].addr, 0, sizeof(inst[n].addr));
+	inst[n].addr.sin_family = AF_INET;
+	inst[n].addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	inst[n].addr.sin_port = htons(base_port + n);
+    }
+    for (n = 0; n < ninst; n++) {
+    	if (start_instance(n)) {
+	    return 1;
+	}
+    }
+    printf("%d instances, %d%% datagram loss\n", ninst, loss_pct);
+
+    // Steady state, all up
+    sleep_msecs(500);
+    memset(cnt, 0, sizeof(cnt));
+    count_events(cnt); // Initial alive events
+    memset(cnt, 0, sizeof(cnt));
+    t0 = now_msecs();
+    while (now_msecs() - t0 < (seconds * 1000)) {
+    	sleep_msecs(10);
+	count_events(cnt);
+    }
+    for (n = 0; n < ninst; n++) {
+    	cmm_swim_get_stats(inst[n].s, &st);
+	pings += st.pings_sent;
+	acks += st.acks_recv;
+	indirect += st.indirect_acks;
+	lost += st.lost_msgs;
+    }
+    printf("  steady    %d secs: %ld pings, %ld acks (%ld indirect), "
+	   "%ld dropped, %d suspect, %d dead (false positives)\n",
+	   seconds, pings, acks, indirect, lost,
+	   cnt[CMM_NODE_STATE_SUSPECT], cnt[CMM_NODE_STATE_DEAD]);
+
+    // Stop instance 0
+    stop_instance(0);
+    t0 = now_msecs();
+    wait_all(0, CMM_NODE_STATE_DEAD, t0, "dead");
+
+    // Restart it
+    t0 = now_msecs();
+    if (start_instance(0)) {
+    	return 1;
+    }
+    wait_all(0, CMM_NODE_STATE_ALIVE, t0, "alive");
+
+    for (n = 0; n < ninst; n++) {
+    	stop_instance(n);
+    }
+    return cnt[CMM_NODE_STATE_DEAD] ? 2 : 0;
+}
+
+/*
+ * End of cmm_swim_test.c
+ */
@@ -17,6 +17,7 @@
 
 #include "curl/curl.h"
 
+#include "nkn_defs.h"
 #include "nkn_common_config.h"
 
 #include "nkn_mgmt_agent.h"
@@ -29,6 +30,7 @@
 #include "cmm_output_fqueue.h"
 #include "cmm_timer.h"
 #include "cmm_misc.h"
+#include "cmm_swim.h"
 #include "CMMNewDelete.h"
 #include "CMMConnectionSM.h"
 #include "CMMSharedMemoryMgr.h"
@@ -88,6 +90,8 @@ long g_output_memq_stalls;
 long g_output_fq_retry_drops;
 long g_output_fq_err_drops;
 
+long g_swim_offline;
+
 /*
  * Global configuration data
  *
@@ -96,6 +100,8 @@ long g_output_fq_err_drops;
  *   nodeonline_interval_msecs - Online interval before declaring node online
  *   stale_sm_timeout_msecs - Delete SM if update interval exceeded
  *   send_config_interval_secs - Periodic send config (CMM->NVSD) interval
+ *   swim_port - Gossip failure detector UDP port, 0 => disabled
+ *   swim_period_msecs - Gossip failure detector protocol period
  */
 int cmm_debug_output = 0;
 FILE *cmm_debug_output_file = NULL;
@@ -106,6 +112,8 @@ int enable_connectionpool = 0;
 int input_memq_limit = 8192;
 int output_memq_limit = 8192;
 int use_fastmem_alloc = 1;
+int swim_port = 0;
+int swim_period_msecs = 100;
 
 /* Global runtime data */
 int (*add_SM)(CURLM* mch, const cmm_node_config_t* config, 
@@ -119,6 +127,8 @@ CMMSharedMemoryMgr* CMMNodeLoadMetric = NULL;
 
 CMMNodeStatusCache* CMMNodeCache = NULL;
 
+cmm_swim_t* CMMSwim = NULL;
+
 static int do_not_create_daemon = 0;
 
 /* Memory based logging */
@@ -204,6 +214,21 @@ void dump_stats()
     DBG("g_output_memq_stalls=%ld", g_output_memq_stalls);
     DBG("g_output_fq_retry_drops=%ld", g_output_fq_retry_drops);
     DBG("g_output_fq_err_drops=%ld", g_output_fq_err_drops);
+
+    DBG("g_swim_offline=%ld", g_swim_offline);
+    if (CMMSwim) {
+    	cmm_swim_stats_t st;
+
+	cmm_swim_get_stats(CMMSwim, &st);
+	DBG("swim pings_sent=%ld ping_reqs_sent=%ld acks_sent=%ld "
+	    "acks_recv=%ld indirect_acks=%ld probe_timeouts=%ld",
+	    st.pings_sent, st.ping_reqs_sent, st.acks_sent, st.acks_recv,
+	    st.indirect_acks, st.probe_timeouts);
+	DBG("swim suspects=%ld deads=%ld alives=%ld refutes=%ld "
+	    "bad_msgs=%ld event_drops=%ld",
+	    st.suspects, st.deads, st.alives, st.refutes, st.bad_msgs,
+	    st.event_drops);
+    }
 }
 
 /*
@@ -300,7 +325,7 @@ void termination_handler(int nSignum)
  */
 void print_usage(char *cpProgName)
 {
-    fprintf(stdout, "usage : %s [-C-D-I:-O:-a:-b:-i:-r:-d:-n:-p:-s:-v-x-h]\n", 
+    fprintf(stdout, "usage : %s [-C-D-I:-O:-a:-b:-i:-r:-d:-g:-G:-n:-p:-s:-v-x-h]\n", 
     	    cpProgName);
     fprintf(stdout, "\t -C : Enable connection pool\n");
     fprintf(stdout, "\t -D : Do not create daemon process \n");
@@ -318,6 +343,10 @@ void print_usage(char *cpProgName)
     	enqueue_retries);
     fprintf(stdout, "\t -d : Output queue retry delay in secs (default: %d)\n", 
     	enqueue_retry_interval_secs);
+    fprintf(stdout, "\t -g : Gossip failure detector UDP port, 0 => disabled "
+	    "(default: %d)\n", swim_port);
+    fprintf(stdout, "\t -G : Gossip failure detector period in msecs "
+	    "(default: %d)\n", swim_period_msecs);
     fprintf(stdout, "\t -m : Enable memory based logging\n");
     fprintf(stdout, "\t -n : Node online interval in msecs (default: %ld)\n", 
     	nodeonline_interval_msecs);
@@ -345,7 +374,7 @@ int getoptions(int argc, char *argv[])
     output_queue_filename = NODESTATUS_QUEUE_FILE;
 
     /* Using getopt get the parameters */
-    while ((chTemp = getopt(argc, argv, "CDI:O:a:b:i:r:d:mn:p:s:vxh")) != -1) {
+    while ((chTemp = getopt(argc, argv, "CDI:O:a:b:i:r:d:g:G:mn:p:s:vxh")) != -1) {
     	switch (chTemp) {
 	case 'a':
 	    input_memq_limit = atoi(optarg);
@@ -374,6 +403,12 @@ int getoptions(int argc, char *argv[])
 	case 'd':
 	    enqueue_retry_interval_secs = atoi(optarg);
 	    break;
+	case 'g':
+	    swim_port = atoi(optarg);
+	    break;
+	case 'G':
+	    swim_period_msecs = atoi(optarg);
+	    break;
 	case 'm':
 	    cmm_debug_memlog = 1;
 	    break;
@@ -433,6 +468,17 @@ void daemonize(void)
 #endif
 }
 
+/*
+ *******************************************************************************
+ * swim_notify() - Gossip failure detector has node state changes
+ *******************************************************************************
+ */
+static void swim_notify(void *arg)
+{
+    UNUSED_ARGUMENT(arg);
+    wakeup_input_fqueue();
+}
+
 /*
  *******************************************************************************
  * main_event_loop() - Dispatch loop for input fqueue and CURL requests
@@ -498,6 +544,7 @@ int main_event_loop(void)
 #else
     handle_fqueue_requests(mch, 1, 128);
 #endif
+    CMMConnectionSM::HandleSwimEvents();
     scheduled_requests = CMMConnectionSM::ScheduleCurlRequests(mch, 
     						pending_request, 
 						pending_request_deadline);
@@ -785,6 +832,29 @@ int main(int argc, char *argv[])
 	break;
     }
 
+    // Start the gossip failure detector, HTTP heartbeats only without it
+    if (swim_port) {
+    	cmm_swim_config_t swim_cfg;
+
+	cmm_swim_default_config(&swim_cfg, swim_port);
+	swim_cfg.period_msecs = swim_period_msecs;
+	swim_cfg.ack_timeout_msecs = (swim_period_msecs * 2) / 5;
+	swim_cfg.suspect_timeout_msecs = swim_period_msecs * 3;
+	swim_cfg.notify = swim_notify;
+
+	CMMSwim = cmm_swim_create(&swim_cfg);
+	if (!CMMSwim) {
+	    DBG("cmm_swim_create(port=%d) failed, gossip failure "
+	    	"detector disabled", swim_port);
+	} else if ((rv = pthread_create(&swim_thread_id, &attr,
+				        cmm_swim_handler, CMMSwim))) {
+	    DBG("pthread_create() failed, rv=%d, gossip failure "
+	    	"detector disabled", rv);
+	    cmm_swim_destroy(CMMSwim);
+	    CMMSwim = NULL;
+	}
+    }
+
     rv = main_event_loop();
     if (rv) {
 	DBG("main_event_loop() failed, rv=%d", rv);
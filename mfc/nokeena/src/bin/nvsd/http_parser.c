@@ -180,21 +180,15 @@ http_method_types_t http_allowed_methods;
 // Under known header condition,
 // if single word in this header line, this line is ignored.
 // if value does not exist in this header line, this line is ignored.
+// hid is the id of the header name of this line from http_hdr_lookup(),
+// -1 if it is not a known header.
 static inline int
-add_if_match(mime_header_t * hdr, http_header_id id,
+add_if_match(mime_header_t * hdr, int hid, http_header_id id,
 			const char * p, int * hit)
 {
     const char * p_end;
 
-    const char * tp;
-    tp = nkn_find_hdrname_end(p);
-    if ((tp-p+1) != http_known_headers[id].namelen) {
-	return 0;
-    }
-
-    if (nkn_strcmp_incase(p,
-			http_known_headers[id].name,
-			http_known_headers[id].namelen)==0){
+    if (hid == (int)id) {
 	    int check = 0;
 	    p = nkn_skip_colon_check(p+http_known_headers[id].namelen, &check);
 	    if(!check)
@@ -1294,6 +1288,8 @@ HTTP_PARSE_STATUS http_parse_header(http_cb_t * phttp)
 	int len;
 	int nl;
 	mime_header_descriptor_t *kh = http_known_headers;
+	const char *hname_end;
+	int hid;
 	int hit, ret;
 	int parse_error = 0;
 	int hdr_len = 0;
@@ -1309,28 +1305,19 @@ HTTP_PARSE_STATUS http_parse_header(http_cb_t * phttp)
 	//
 	// search for the end of HTTP GET request
 	// \r\n\r\n could be in the middle of HTTP GET request when content-length exists
+	// Disallow request with embedded NULL(s):
+	// if we see \0 before \r\n\r\n, it is bad request.
 	//
         len=phttp->cb_totlen;
-        p=phttp->cb_buf;
-	while(len>=2) {
-		if (len>=4) {
-			if( *p=='\r' && *(p+1)=='\n' && *(p+2)=='\r' && *(p+3)=='\n') {
-				p+=4;
-				goto complete;
-			}
-		}
-		if (*p == '\n' && *(p+1) == '\n') { 
-			p+=2;
-			goto complete;
-		}
-		// Disallow request with embedded NULL(s)
-		if (*p == 0) {
-			// If we see \0 before \r\n\r\n, it is bad request.
-			parse_error = 1;
-		}
-		len--;
-		p++;
+	p=nkn_find_hdrblock_end(phttp->cb_buf, len, &parse_error);
+	if (p) {
+		goto complete;
+	}
+	if (len <= 0) {
+		return HPS_NEED_MORE_DATA;
 	}
+        p=phttp->cb_buf+len-1;
+	len=1;
 
         if (phttp->cb_totlen >= MAX_HTTP_HEADER_SIZE - 10) {
 		phttp->http_hdr_len = phttp->cb_totlen;
@@ -1426,6 +1413,11 @@ complete:
 		if(*p=='\n') { p++; break; }
 		if(*p=='\r' || *(p+1)=='\n') { p+=2; break; }
 
+		// Resolve the known header name once for this line,
+		// add_if_match() below only compares ids.
+		hname_end = nkn_find_hdrname_end(p);
+		hid = http_hdr_lookup(p, hname_end-p+1);
+
 		//
 		// take the first four bytes as signature
 		// It is case insensitive comparision
@@ -1616,22 +1608,22 @@ complete:
 				p_end = nkn_find_digit_end(p);
 				add_known_header(hdr, MIME_HDR_CONTENT_LENGTH, p,
 							p_end-p+1);
-                        } else if(add_if_match(hdr, MIME_HDR_CONTENT_TYPE, 
+                        } else if(add_if_match(hdr, hid, MIME_HDR_CONTENT_TYPE, 
 						p, &hit)) {
-                        } else if(add_if_match(hdr, MIME_HDR_CONTENT_BASE,
+                        } else if(add_if_match(hdr, hid, MIME_HDR_CONTENT_BASE,
 						p, &hit)) {
-			} else if(add_if_match(hdr, MIME_HDR_CONTENT_DISPOSITION,
+			} else if(add_if_match(hdr, hid, MIME_HDR_CONTENT_DISPOSITION,
 						p, &hit)) {
-			} else if(add_if_match(hdr, MIME_HDR_CONTENT_ENCODING,
+			} else if(add_if_match(hdr, hid, MIME_HDR_CONTENT_ENCODING,
 						p, &hit)) {
 				get_encoding_type(phttp, MIME_HDR_CONTENT_ENCODING, p);
-			} else if(add_if_match(hdr, MIME_HDR_CONTENT_LANGUAGE,
+			} else if(add_if_match(hdr, hid, MIME_HDR_CONTENT_LANGUAGE,
 						p, &hit)) {
-			} else if(add_if_match(hdr, MIME_HDR_CONTENT_LOCATION,
+			} else if(add_if_match(hdr, hid, MIME_HDR_CONTENT_LOCATION,
 						p, &hit)) {
-			} else if(add_if_match(hdr, MIME_HDR_CONTENT_MD5,
+			} else if(add_if_match(hdr, hid, MIME_HDR_CONTENT_MD5,
 						p, &hit)) {
-			} else if(add_if_match(hdr, MIME_HDR_CONTENT_RANGE,
+			} else if(add_if_match(hdr, hid, MIME_HDR_CONTENT_RANGE,
 						p, &hit)) {
 			}
                         break;
@@ -1748,23 +1740,23 @@ complete:
 		case sig_accept_language:
 		case sig_accept_ranges:
 #endif
-                        if(add_if_match(hdr, MIME_HDR_ACCEPT, 
+                        if(add_if_match(hdr, hid, MIME_HDR_ACCEPT, 
 						p, &hit)) {
-			} else if(add_if_match(hdr, MIME_HDR_ACCEPT_CHARSET,
+			} else if(add_if_match(hdr, hid, MIME_HDR_ACCEPT_CHARSET,
 						p, &hit)) {
-			} else if(add_if_match(hdr, MIME_HDR_ACCEPT_ENCODING,
+			} else if(add_if_match(hdr, hid, MIME_HDR_ACCEPT_ENCODING,
 						p, &hit)) {
 				get_encoding_type(phttp, MIME_HDR_ACCEPT_ENCODING, p);
 				glob_accept_encoding++;
-			} else if(add_if_match(hdr, MIME_HDR_ACCEPT_LANGUAGE,
+			} else if(add_if_match(hdr, hid, MIME_HDR_ACCEPT_LANGUAGE,
 						p, &hit)) {
-			} else if(add_if_match(hdr, MIME_HDR_ACCEPT_RANGES,
+			} else if(add_if_match(hdr, hid, MIME_HDR_ACCEPT_RANGES,
 						p, &hit)) {
 			}
 			break;
 
 		case sig_allow:
-                        if(add_if_match(hdr, MIME_HDR_ALLOW, 
+                        if(add_if_match(hdr, hid, MIME_HDR_ALLOW, 
 					p, &hit)) {
 			}
 			break;
@@ -1773,15 +1765,15 @@ complete:
 #ifdef COMMENT
 		case sig_authorization:
 #endif
-                        if(add_if_match(hdr, MIME_HDR_AUTHENTICATION_INFO,
+                        if(add_if_match(hdr, hid, MIME_HDR_AUTHENTICATION_INFO,
 					p, &hit)) {
-			} else if(add_if_match(hdr, MIME_HDR_AUTHORIZATION,
+			} else if(add_if_match(hdr, hid, MIME_HDR_AUTHORIZATION,
 					p, &hit)) {
 			}
 			break;
 
 		case sig_cache_control:
-                        if(add_if_match(hdr, MIME_HDR_CACHE_CONTROL,
+                        if(add_if_match(hdr, hid, MIME_HDR_CACHE_CONTROL,
 					p, &hit)) {
 			}
 			break;
@@ -1795,7 +1787,7 @@ complete:
 			break;
 
 		case sig_expect:
-                        if(add_if_match(hdr, MIME_HDR_EXPECT,
+                        if(add_if_match(hdr, hid, MIME_HDR_EXPECT,
                                        p, &hit) == -2) {
                             phttp->respcode = 417 ;
                             if (pbak) { free(pbak); }
@@ -1804,7 +1796,7 @@ complete:
 			break;
 
 		case sig_expires:
-                        if(add_if_match(hdr, MIME_HDR_EXPIRES,
+                        if(add_if_match(hdr, hid, MIME_HDR_EXPIRES,
 					p, &hit)) {
 			}
 			break;
@@ -1822,39 +1814,39 @@ complete:
 #ifdef COMMENT
 		case sig_if_modified_since:
 #endif
-                        if(add_if_match(hdr, MIME_HDR_IF_MATCH,
+                        if(add_if_match(hdr, hid, MIME_HDR_IF_MATCH,
 					p, &hit)) {
-			} else if(add_if_match(hdr, MIME_HDR_IF_MODIFIED_SINCE,
+			} else if(add_if_match(hdr, hid, MIME_HDR_IF_MODIFIED_SINCE,
 					p, &hit)) {
 			}
 			break;
 
 		case sig_if_none_match:
-                        if(add_if_match(hdr, MIME_HDR_IF_NONE_MATCH,
+                        if(add_if_match(hdr, hid, MIME_HDR_IF_NONE_MATCH,
 					p, &hit)) {
 			}
 			break;
 
 		case sig_if_range:
-                        if(add_if_match(hdr, MIME_HDR_IF_RANGE,
+                        if(add_if_match(hdr, hid, MIME_HDR_IF_RANGE,
 					p, &hit)) {
 			}
 			break;
 
 		case sig_if_unmodfied_since:
-                        if(add_if_match(hdr, MIME_HDR_IF_UNMODIFIED_SINCE,
+                        if(add_if_match(hdr, hid, MIME_HDR_IF_UNMODIFIED_SINCE,
 					p, &hit)) {
 			}
 			break;
 
 		case sig_keep_alive:
-                        if(add_if_match(hdr, MIME_HDR_KEEP_ALIVE,
+                        if(add_if_match(hdr, hid, MIME_HDR_KEEP_ALIVE,
 					p, &hit)) {
 			}
 			break;
 
 		case sig_last_modified:
-                        if(add_if_match(hdr, MIME_HDR_LAST_MODIFIED,
+                        if(add_if_match(hdr, hid, MIME_HDR_LAST_MODIFIED,
 					p, &hit)) {
 			}
 			break;
@@ -1864,25 +1856,25 @@ complete:
 			break;
 
 		case sig_location:
-                        if(add_if_match(hdr, MIME_HDR_LOCATION,
+                        if(add_if_match(hdr, hid, MIME_HDR_LOCATION,
 					p, &hit)) {
 			}
 			break;
 
 		case sig_max_forwards:
-                        if(add_if_match(hdr, MIME_HDR_MAX_FORWARDS,
+                        if(add_if_match(hdr, hid, MIME_HDR_MAX_FORWARDS,
 					p, &hit)) {
 			}
 			break;
 
 		case sig_mime_version:
-                        if(add_if_match(hdr, MIME_HDR_MIME_VERSION,
+                        if(add_if_match(hdr, hid, MIME_HDR_MIME_VERSION,
 					p, &hit)) {
 			}
 			break;
 
 		case sig_pragma:
-                        if(add_if_match(hdr, MIME_HDR_PRAGMA,
+                        if(add_if_match(hdr, hid, MIME_HDR_PRAGMA,
 					p, &hit)) {
 			}
 			break;
@@ -1893,12 +1885,12 @@ complete:
 		case sig_proxy_authorization:
 		case sig_proxy_connection:
 #endif
-                        if(add_if_match(hdr, MIME_HDR_PROXY_AUTHENTICATE,
+                        if(add_if_match(hdr, hid, MIME_HDR_PROXY_AUTHENTICATE,
 					p, &hit)) {
-			} else if(add_if_match(hdr, 
+			} else if(add_if_match(hdr, hid, 
 					MIME_HDR_PROXY_AUTHENTICATION_INFO,
 					p, &hit)) {
-			} else if(add_if_match(hdr, MIME_HDR_PROXY_AUTHORIZATION,
+			} else if(add_if_match(hdr, hid, MIME_HDR_PROXY_AUTHORIZATION,
 					p, &hit)) {
 			} else if(nkn_strcmp_incase(p,
                                 kh[MIME_HDR_PROXY_CONNECTION].name,
@@ -1926,45 +1918,45 @@ complete:
                         }
                         break;
 		case sig_public:
-                        if(add_if_match(hdr, MIME_HDR_PUBLIC, 
+                        if(add_if_match(hdr, hid, MIME_HDR_PUBLIC, 
 					p, &hit)) {
 			}
 			break;
 
 		case sig_request_range:
-                        if(add_if_match(hdr, MIME_HDR_REQUEST_RANGE,
+                        if(add_if_match(hdr, hid, MIME_HDR_REQUEST_RANGE,
 					p, &hit)) {
 			}
 			break;
 
 		case sig_referer:
-                        if(add_if_match(hdr, MIME_HDR_REFERER,
+                        if(add_if_match(hdr, hid, MIME_HDR_REFERER,
 					p, &hit)) {
 			}
 			break;
 
 		case sig_retry_after:
-                        if(add_if_match(hdr, MIME_HDR_RETRY_AFTER,
+                        if(add_if_match(hdr, hid, MIME_HDR_RETRY_AFTER,
 					p, &hit)) {
 			}
 			break;
 
 		case sig_server:
-                        if(add_if_match(hdr, MIME_HDR_SERVER,
+                        if(add_if_match(hdr, hid, MIME_HDR_SERVER,
 					p, &hit)) {
 			}
 			break;
 
 		case sig_set_cookie:
-                        if(add_if_match(hdr, MIME_HDR_SET_COOKIE,
+                        if(add_if_match(hdr, hid, MIME_HDR_SET_COOKIE,
 					p, &hit)) {
-			} else if(add_if_match(hdr, MIME_HDR_SET_COOKIE2,
+			} else if(add_if_match(hdr, hid, MIME_HDR_SET_COOKIE2,
 					p, &hit)) {
 			}
 			break;
 
 		case sig_trailer:
-                        if(add_if_match(hdr, MIME_HDR_TRAILER,
+                        if(add_if_match(hdr, hid, MIME_HDR_TRAILER,
 					p, &hit)) {
 			}
 			break;
@@ -1972,17 +1964,11 @@ complete:
 		case sig_upgrade:
 			{
 				const char *p_start = p;
-				const char *tp;
 				int check;
 
 				http_header_id id = MIME_HDR_UPGRADE;
 
-				tp = nkn_find_hdrname_end(p_start);
-				if ((tp-p_start+1) != http_known_headers[id].namelen) break;
-
-				if (nkn_strcmp_incase(p_start,
-					    http_known_headers[id].name,
-					    http_known_headers[id].namelen)==0) {
+				if (hid == (int)id) {
 					p_start = nkn_skip_colon_check(p_start+http_known_headers[id].namelen, &check);
 					if (!check) break;
 					p_end = nkn_find_hdrvalue_end(p_start);
@@ -2000,7 +1986,7 @@ complete:
 			break;
 
 		case sig_user_agent:
-                        if(add_if_match(hdr, MIME_HDR_USER_AGENT,
+                        if(add_if_match(hdr, hid, MIME_HDR_USER_AGENT,
 					p, &hit)) {
 			}
 			break;
@@ -2011,7 +1997,7 @@ complete:
 			break;
 
 		case sig_warning:
-                        if(add_if_match(hdr, MIME_HDR_WARNING,
+                        if(add_if_match(hdr, hid, MIME_HDR_WARNING,
 					p, &hit)) {
 			}
 			break;
@@ -2019,17 +2005,11 @@ complete:
 		case sig_www_authenticate:
 			{
 				const char *p_start = p;
-				const char *tp;
 				int check;
 
 				http_header_id id = MIME_HDR_WWW_AUTHENTICATE;
 
-				tp = nkn_find_hdrname_end(p_start);
-				if ((tp-p_start+1) != http_known_headers[id].namelen) break;
-
-				if (nkn_strcmp_incase(p_start,
-					    http_known_headers[id].name,
-					    http_known_headers[id].namelen)==0) {
+				if (hid == (int)id) {
 					p_start = nkn_skip_colon_check(p_start+http_known_headers[id].namelen, &check);
 					if (!check) break;
 					p_end = nkn_find_hdrvalue_end(p_start);
@@ -2053,7 +2033,7 @@ complete:
 		case sig_x_accel:
 			switch(*(unsigned int *)(p+8) | 0x20202020) {
 			case sig_cache_control:
-				if(add_if_match(hdr, MIME_HDR_X_ACCEL_CACHE_CONTROL,
+				if(add_if_match(hdr, hid, MIME_HDR_X_ACCEL_CACHE_CONTROL,
 							p, &hit)) {
 				}
 				break;
@@ -2074,14 +2054,14 @@ complete:
 
                         switch(*(unsigned int *)p | 0x20200020) { // to match "X-NK" case insensitive.
                             case sig_internal:
-                                  ret = add_if_match(hdr, MIME_HDR_X_INTERNAL, p, &hit);
+                                  ret = add_if_match(hdr, hid, MIME_HDR_X_INTERNAL, p, &hit);
                                   if ( ret == -3) { /* This is a prefetch request */
                                       SET_HTTP_FLAG(phttp, HRF_CLIENT_INTERNAL);
                                   } else if ( ret == -4) { /* This is a crawl request */
                                       SET_CRAWL_REQ(phttp);
-                                  } else if (add_if_match(hdr, 
+                                  } else if (add_if_match(hdr, hid, 
 				  	MIME_HDR_X_NKN_CLUSTER_TPROXY, p, &hit)) {
-				  } else if (add_if_match(hdr, 
+				  } else if (add_if_match(hdr, hid, 
 				  	MIME_HDR_X_NKN_CL7_PROXY, p, &hit)) {
                                   }  
                                   break; 
@@ -2094,11 +2074,11 @@ complete:
 
 		if (!hit) {
 			// Check for < 4 byte headers
-			if(add_if_match(hdr, MIME_HDR_AGE,
+			if(add_if_match(hdr, hid, MIME_HDR_AGE,
 					p, &hit)) {
-			} else if(add_if_match(hdr, MIME_HDR_TE,
+			} else if(add_if_match(hdr, hid, MIME_HDR_TE,
 					p, &hit)) {
-			} else if(add_if_match(hdr, MIME_HDR_VIA,
+			} else if(add_if_match(hdr, hid, MIME_HDR_VIA,
 					p, &hit)) {
 			} else {
 				// Unknown header
@@ -0,0 +1,488 @@
+/*
+ * http_parser_bench.c - Request header tokenizing, requests/second on one
+ *	core: the byte loops and add_if_match() candidate chains that
+ *	http_parse_header() used before against the SSE2 scanners of
+ *	parser_utils.h and the http_hdr_lookup() perfect hash.
+ *
+ *	Each request goes through what http_parse_header() does before it
+ *	stores a header: find the end of the header block (and embedded
+ *	NULs), then for every line resolve the name to a known header id,
+ *	find the value and skip to the next line.  The old name resolution
+ *	tries the known headers sharing the line's 4 byte signature, as the
+ *	sig_ switch does, then Age/TE/Via; each try finds the name end
+ *	again and compares it with nkn_strcmp_incase().
+ *
+ *	The corpus is a captured request stream (-f, requests back to back,
+ *	each ending with an empty line), or a built-in browser/CDN mix.
+ *
+ *	build:
+ *	  cc -O2 -D_GNU_SOURCE -o http_parser_bench http_parser_bench.c
+ *
+ *	usage: http_parser_bench [-f corpus] [-t seconds_per_run]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "parser_utils.h"
+
+/* http_data.c http_known_headers[] names, in MIME_HDR_ order */
+static const char *known_names[] = {
+    "Accept", "Accept-Charset", "Accept-Encoding", "Accept-Language",
+    "Accept-Ranges", "Age", "Allow", "Authorization", "Cache-Control",
+    "Connection", "Content-Base", "Content-Disposition", "Content-Encoding",
+    "Content-Language", "Content-Length", "Content-Location", "Content-MD5",
+    "Content-Range", "Content-Type", "Te", "Transfer-Encoding", "Trailer",
+    "Cookie", "Cookie2", "Date", "ETag", "Expires", "From", "Host",
+    "If-Match", "If-Modified-Since", "If-None-Match", "If-Range",
+    "If-Unmodfied-Since", "Last-Modified", "Link", "Location",
+    "Max-Forwards", "Mime-Version", "Pragma", "Proxy-Authenticate",
+    "Proxy-Authentication-Info", "Proxy-Authorization", "Proxy-Connection",
+    "Public", "Range", "Request-Range", "Referer", "Retry-After", "Server",
+    "Set-Cookie", "Set-Cookie2", "Upgrade", "User-Agent", "Vary", "Via",
+    "Expect", "Warning", "WWW-Authenticate", "Authentication-Info",
+    "Keep-Alive", "X-NKN-Uri", "X-NKN-Method", "X-NKN-Query",
+    "X-NKN-Response-String", "X-NKN-Remapped-Uri", "X-NKN-Decoded-Uri",
+    "X-NKN-Seek-Uri", "X-NKN-FP-svrhost", "X-NKN-FP-svrport",
+    "X-NKN-Client-Host", "X-NKN-Req-Dest-IP", "X-NKN-Req-Dest-Port",
+    "X-NKN-Abs-Url-Host", "X-NKN-Request-Line", "X-NKN-Req-Real-Dest-IP",
+    "X-NKN-Req-Real-Dest-Port", "X-NKN-Req-Real-Src-IP",
+    "X-NKN-Req-Real-Src-Port", "X-NKN-Origin-Svr", "X-NKN-Cache-Policy",
+    "X-NKN-Cache-Name", "X-Accel-Cache-Control", "X-Location",
+    "X-Redirect-Host", "X-Redirect-Port", "X-Redirect-Uri",
+    "X-NKN-CL7-Cachekey-Host", "X-NKN-CL7-Origin-Host", "X-NKN-CL7-Proxy",
+    "X-NKN-CL7-Status", "X-NKN-Internal", "X-NKN-PE-Host",
+    "X-NKN-Cluster-Tproxy", "X-NKN-Origin-IP", "X-NKN-MD5-Checksum",
+    "X-NKN-Cache-Index", "X-NKN-Uncompressed-Length", "X-NKN-User-Agent",
+};
+#define NKNOWN	(int)(sizeof(known_names) / sizeof(known_names[0]))
+static int known_len[NKNOWN];
+
+/*
+ * Old: byte loops and nkn_strcmp_incase() (nkn_util.c)
+ */
+static int old_strcmp_incase(const char *p1, const char *p2, int n)
+{
+    if (!p1 || !p2 || n == 0) return 1;
+    while (n) {
+	if (*p1 == 0 || *p2 == 0) return 1;
+	if ((*p1 | 0x20) != (*p2 | 0x20)) return 1;
+	p1++;
+	p2++;
+	n--;
+    }
+    return 0;
+}
+
+static const char *old_find_hdrblock_end(const char *p, int len, int *nul)
+{
+    *nul = 0;
+    while (len >= 2) {
+	if (len >= 4 && p[0] == '\r' && p[1] == '\n' && p[2] == '\r' &&
+	    p[3] == '\n')
+	    return p + 4;
+	if (p[0] == '\n' && p[1] == '\n')
+	    return p + 2;
+	if (*p == 0)
+	    *nul = 1;
+	len--;
+	p++;
+    }
+    return NULL;
+}
+
+static const char *old_find_hdrname_end(const char *p)
+{
+    while (*p != ':') {
+	if (*p == ' ')
+	    return p - 1;
+	if (*p == '\n')
+	    return p;
+	p++;
+    }
+    return p - 1;
+}
+
+static const char *old_find_hdrvalue_end(const char *p)
+{
+    const char *ps = p;
+
+    while (*p != '\n') {
+	while (*p != '\n')
+	    p++;
+	if (*(p + 1) == ' ' || *(p + 1) == '\t')
+	    p++;
+    }
+    if (ps == p)
+	return ps;
+    if (*(p - 1) == '\r') {
+	if (ps == p - 1)
+	    return p - 1;
+	return p - 2;
+    }
+    return p - 1;
+}
+
+static const char *old_skip_to_nextline(const char *p)
+{
+    while (*p != '\n') {
+	while (*p != '\n') {
+	    if (*p == 0)
+		return NULL;
+	    p++;
+	}
+	if (*(p + 1) == ' ' || *(p + 1) == '\t')
+	    p++;
+    }
+    return p + 1;
+}
+
+/* Known headers per 4 byte signature, the sig_ switch cases */
+#define SIG_HASH	256
+static int sig_chain[SIG_HASH][16];
+static uint32_t sig_val[SIG_HASH];
+static int sig_cnt[SIG_HASH];
+static int short_chain[3];
+
+static uint32_t sig4(const char *p)
+{
+    uint32_t w;
+
+    memcpy(&w, p, 4);
+    return w | 0x20202020;
+}
+
+static int old_add_if_match(int id, const char *p)
+{
+    const char *tp = old_find_hdrname_end(p);
+    int check;
+
+    if (tp - p + 1 != known_len[id])
+	return 0;
+    if (old_strcmp_incase(p, known_names[id], known_len[id]))
+	return 0;
+    p = nkn_skip_colon_check(p + known_len[id], &check);
+    if (!check)
+	return 0;
+    return old_find_hdrvalue_end(p) != NULL;
+}
+
+static int old_parse(const char *buf, int len)
+{
+    const char *p, *tp;
+    uint32_t sig;
+    int nul, i, h, hit, n = 0, check;
+
+    if (!old_find_hdrblock_end(buf, len, &nul) || nul)
+	return -1;
+    p = old_skip_to_nextline(buf);
+    while (p) {
+	p = nkn_skip_space(p);
+	if (*p == '\n' || *p == '\r')
+	    break;
+	hit = 0;
+	sig = sig4(p);
+	h = (sig * 0x9e3779b1U) >> 24;
+	while (sig_cnt[h] && sig_val[h] != sig)
+	    h = (h + 1) & (SIG_HASH - 1);
+	for (i = 0; i < sig_cnt[h] && !hit; i++)
+	    hit = old_add_if_match(sig_chain[h][i], p);
+	for (i = 0; i < 3 && !hit; i++)
+	    hit = old_add_if_match(short_chain[i], p);
+	if (!hit) {
+	    tp = old_find_hdrname_end(p);
+	    if (*tp != '\n')
+		tp++;
+	    tp = nkn_skip_colon_check(tp, &check);
+	    old_find_hdrvalue_end(tp);
+	}
+	n += hit;
+	p = old_skip_to_nextline(p);
+    }
+    return n;
+}
+
+/*
+ * New: parser_utils.h scanners and the http_header.h perfect hash
+ */
+#define HTTP_HDR_PHASH_BITS	9
+#define HTTP_HDR_PHASH_SIZE	(1 << HTTP_HDR_PHASH_BITS)
+#define HTTP_HDR_PHASH_MUL1	0x46bf2191U
+#define HTTP_HDR_PHASH_MUL2	0xb9bde45fU
+#define HTTP_HDR_PHASH_MUL3	0x9e3779b1U
+
+static unsigned char http_hdr_phash_tbl[HTTP_HDR_PHASH_SIZE];
+
+static inline uint32_t http_hdr_phash(const char *name, int len)
+{
+    uint32_t first, last;
+
+    if (len >= 4) {
+	memcpy(&first, name, 4);
+	memcpy(&last, name + len - 4, 4);
+    } else {
+	first = 0;
+	memcpy(&first, name, len);
+	last = first;
+    }
+    first |= 0x20202020;
+    last |= 0x20202020;
+    return ((first * HTTP_HDR_PHASH_MUL1) ^ (last * HTTP_HDR_PHASH_MUL2) ^
+	    ((uint32_t)len * HTTP_HDR_PHASH_MUL3)) >> (32 - HTTP_HDR_PHASH_BITS);
+}
+
+static inline int http_hdr_lookup(const char *name, int len)
+{
+    int slot;
+
+    if (len <= 0)
+	return -1;
+    slot = http_hdr_phash_tbl[http_hdr_phash(name, len)];
+    if (!slot)
+	return -1;
+    if (known_len[slot - 1] != len ||
+	strncasecmp(name, known_names[slot - 1], len))
+	return -1;
+    return slot - 1;
+}
+
+static int new_parse(const char *buf, int len)
+{
+    const char *p, *tp;
+    int nul, hid, n = 0, check;
+
+    if (!nkn_find_hdrblock_end(buf, len, &nul) || nul)
+	return -1;
+    p = nkn_skip_to_nextline(buf);
+    while (p) {
+	p = nkn_skip_space(p);
+	if (*p == '\n' || *p == '\r')
+	    break;
+	tp = nkn_find_hdrname_end(p);
+	hid = http_hdr_lookup(p, tp - p + 1);
+	if (hid >= 0) {
+	    tp = nkn_skip_colon_check(p + known_len[hid], &check);
+	    if (check && nkn_find_hdrvalue_end(tp))
+		n++;
+	} else {
+	    tp = nkn_find_hdrname_end(p);
+	    if (*tp != '\n')
+		tp++;
+	    tp = nkn_skip_colon_check(tp, &check);
+	    nkn_find_hdrvalue_end(tp);
+	}
+	p = nkn_skip_to_nextline(p);
+    }
+    return n;
+}
+
+static const char *builtin_corpus[] = {
+    "GET /videos/2014/promo/hd/seg-00042.ts HTTP/1.1\r\n"
+    "Host: cdn.example.net\r\n"
+    "User-Agent: Mozilla/5.0 (Windows NT 6.1; WOW64) AppleWebKit/537.36 "
+    "(KHTML, like Gecko) Chrome/39.0.2171.95 Safari/537.36\r\n"
+    "Accept: */*\r\n"
+    "Accept-Encoding: gzip, deflate, sdch\r\n"
+    "Accept-Language: en-US,en;q=0.8\r\n"
+    "Referer: http://www.example.net/watch?v=8a7f3b\r\n"
+    "Cookie: uid=8f14e45fceea167a5a36dedd4bea2543; sess=c9f0f895fb98ab91;"
+    " pref=hd%3D1%26vol%3D80\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n",
+
+    "GET /images/logo_2x.png HTTP/1.1\r\n"
+    "Host: static.example.com\r\n"
+    "Connection: keep-alive\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "Accept: image/webp,*/*;q=0.8\r\n"
+    "If-None-Match: \"5d8c72a5edda8d6a:0\"\r\n"
+    "If-Modified-Since: Tue, 09 Dec 2014 18:21:07 GMT\r\n"
+    "User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10_10_1) "
+    "AppleWebKit/600.2.5 (KHTML, like Gecko) Version/8.0.2 Safari/600.2.5\r\n"
+    "Accept-Language: en-us\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "\r\n",
+
+    "GET /vod/movie_1080p.mp4 HTTP/1.1\r\n"
+    "Host: vod.example.org\r\n"
+    "Range: bytes=1048576-2097151\r\n"
+    "User-Agent: AppleCoreMedia/1.0.0.12B440 (iPhone; U; CPU OS 8_1_2 "
+    "like Mac OS X; en_us)\r\n"
+    "Accept: */*\r\n"
+    "X-Playback-Session-Id: 3C9F1E5A-7A2B-4E8E-9B1D-2F6C0A4D8E11\r\n"
+    "Accept-Encoding: identity\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n",
+
+    "GET /api/v1/manifest.m3u8?token=ab12cd34&exp=1419000000 HTTP/1.1\r\n"
+    "Host: live.example.tv\r\n"
+    "X-Forwarded-For: 203.0.113.7, 198.51.100.23\r\n"
+    "Via: 1.1 edge-proxy-03 (squid/3.4.9)\r\n"
+    "X-Real-IP: 203.0.113.7\r\n"
+    "User-Agent: curl/7.38.0\r\n"
+    "Accept: */*\r\n"
+    "Pragma: no-cache\r\n"
+    "\r\n",
+};
+#define NBUILTIN	(int)(sizeof(builtin_corpus) / sizeof(builtin_corpus[0]))
+
+typedef struct req {
+    char *buf;
+    int len;
+} req_t;
+
+static req_t *reqs;
+static int nreqs;
+
+static void add_req(const char *p, int len)
+{
+    reqs = realloc(reqs, (nreqs + 1) * sizeof(req_t));
+    /* cb_buf is NUL terminated and has room behind the request */
+    reqs[nreqs].buf = calloc(1, len + 64);
+    memcpy(reqs[nreqs].buf, p, len);
+    reqs[nreqs].len = len;
+    nreqs++;
+}
+
+static void load_corpus(const char *path)
+{
+    FILE *fp;
+    char *data, *p, *pe, *end;
+    long sz;
+    int nul;
+
+    fp = fopen(path, "r");
+    if (!fp) {
+	perror(path);
+	exit(1);
+    }
+    fseek(fp, 0, SEEK_END);
+    sz = ftell(fp);
+    rewind(fp);
+    data = malloc(sz + 1);
+    if (fread(data, 1, sz, fp) != (size_t)sz) {
+	perror(path);
+	exit(1);
+    }
+    data[sz] = 0;
+    fclose(fp);
+
+    p = data;
+    pe = data + sz;
+    while (p < pe) {
+	end = (char *)old_find_hdrblock_end(p, pe - p, &nul);
+	if (!end)
+	    break;
+	add_req(p, end - p);
+	p = end;
+	while (p < pe && (*p == '\r' || *p == '\n'))
+	    p++;
+    }
+    free(data);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(const char *name, int (*parse)(const char *, int),
+		double seconds)
+{
+    double start, elapsed;
+    unsigned long cnt = 0;
+    long hits = 0;
+    int i;
+
+    start = now();
+    do {
+	for (i = 0; i < nreqs; i++)
+	    hits += parse(reqs[i].buf, reqs[i].len);
+	cnt += nreqs;
+	elapsed = now() - start;
+    } while (elapsed < seconds);
+
+    printf("%-4s %8lu requests  %6.2f secs  %10.0f requests/s/core  "
+	   "%.1f known headers/request\n", name, cnt, elapsed, cnt / elapsed,
+	   (double)hits / cnt);
+}
+
+int main(int argc, char **argv)
+{
+    const char *corpus = NULL;
+    double seconds = 2;
+    uint32_t sig;
+    int i, h, c;
+
+    while ((c = getopt(argc, argv, "f:t:")) != -1) {
+	switch (c) {
+	case 'f':
+	    corpus = optarg;
+	    break;
+	case 't':
+	    seconds = atof(optarg);
+	    break;
+	default:
+	    fprintf(stderr, "usage: %s [-f corpus] [-t seconds_per_run]\n",
+		    argv[0]);
+	    return 1;
+	}
+    }
+
+    for (i = 0; i < NKNOWN; i++) {
+	known_len[i] = strlen(known_names[i]);
+	h = http_hdr_phash(known_names[i], known_len[i]);
+	if (http_hdr_phash_tbl[h]) {
+	    fprintf(stderr, "perfect hash collision: %s %s\n",
+		    known_names[i], known_names[http_hdr_phash_tbl[h] - 1]);
+	    return 1;
+	}
+	http_hdr_phash_tbl[h] = i + 1;
+
+	if (known_len[i] < 4) {
+	    if (!strcmp(known_names[i], "Age"))
+		short_chain[0] = i;
+	    else if (!strcmp(known_names[i], "Te"))
+		short_chain[1] = i;
+	    else
+		short_chain[2] = i;
+	    continue;
+	}
+	sig = sig4(known_names[i]);
+	h = (sig * 0x9e3779b1U) >> 24;
+	while (sig_cnt[h] && sig_val[h] != sig)
+	    h = (h + 1) & (SIG_HASH - 1);
+	sig_val[h] = sig;
+	sig_chain[h][sig_cnt[h]++] = i;
+    }
+
+    if (corpus) {
+	load_corpus(corpus);
+    } else {
+	for (i = 0; i < NBUILTIN; i++)
+	    add_req(builtin_corpus[i], strlen(builtin_corpus[i]));
+    }
+    if (!nreqs) {
+	fprintf(stderr, "no requests in corpus\n");
+	return 1;
+    }
+    for (i = 0; i < nreqs; i++) {
+	if (old_parse(reqs[i].buf, reqs[i].len) !=
+	    new_parse(reqs[i].buf, reqs[i].len)) {
+	    fprintf(stderr, "request %d: old and new disagree\n", i);
+	    return 1;
+	}
+    }
+
+    printf("%d requests in corpus, %d known headers\n", nreqs, NKNOWN);
+    run("old", old_parse, seconds);
+    run("new", new_parse, seconds);
+    return 0;
+}
@@ -283,59 +283,22 @@ static void http_add_via_and_date_header(http_cb_t * phttp, mime_header_t * p_re
 	}
 }
 
-static void http_buildup_resp_header(http_cb_t * phttp, mime_header_t * p_response_hdr)
-{
-
-#define OUTBUF(_data, _datalen, _bytesused) { \
-    if (((_datalen)+(_bytesused)) >= phttp->resp_buflen) { \
-    	tmp_resp_buf = phttp->resp_buf; \
-    	tmp_resp_buflen = phttp->resp_buflen; \
-	phttp->resp_buflen = \
-		MAX(phttp->resp_buflen*2, (_datalen)+(_bytesused)+1); \
-	phttp->resp_buf = \
-		nkn_realloc_type(phttp->resp_buf, phttp->resp_buflen, \
-				 mod_http_respbuf); \
-	if (phttp->resp_buf) { \
-	    memcpy((void *)&phttp->resp_buf[(_bytesused)], \
-	    	   (_data), (_datalen)); \
-	    (_bytesused) += (_datalen); \
-	} else { \
-	    phttp->resp_buf  = tmp_resp_buf; \
-	    phttp->resp_buflen = tmp_resp_buflen; \
-	} \
-    } else { \
-    	memcpy((void *)&phttp->resp_buf[(_bytesused)], (_data), (_datalen)); \
-	(_bytesused) += (_datalen); \
-    } \
-}
-
+/*
+ * Reason phrase of phttp->respcode, also counts the response.
+ * response_str (MAX_RESP_STR_SIZE) holds the phrase of response codes
+ * passed through from the origin.  NULL if there is none.
+ */
 #define MAX_RESP_STR_SIZE 100
-	char response_str[MAX_RESP_STR_SIZE];
+static const char *
+http_resp_codestr(http_cb_t * phttp, mime_header_t * p_response_hdr,
+		  char *response_str)
+{
         const char * codestr;
-        char * p;
-	int len;
- 	const char *name;
-	int namelen;
 	const char *val;
 	int vallen;
-	const char *data;
-	int datalen;
 	int hdrcnt;
 	u_int32_t attr;
-	int n, nth;
-	int rv;
 	const namespace_config_t *nsc = phttp->nsconf;
-	//int modify_date;
-
-	int bytesused;
-	char *tmp_resp_buf;
-    	int tmp_resp_buflen;
-	int conn_hdr_found;
-
-        if( phttp->res_hdlen ) {
-                // already filled in
-                return;
-        }
 
 	// choice supported response code
         switch(phttp->respcode) {
@@ -433,7 +396,7 @@ static void http_buildup_resp_header(http_cb_t * phttp, mime_header_t * p_respon
 			if (get_known_header(p_response_hdr, MIME_HDR_X_NKN_RESPONSE_STR, 
 				&val, &vallen, &attr, &hdrcnt)) {
 				// Not found.
-				return;
+				return NULL;
 			}
 			if (vallen > MAX_RESP_STR_SIZE - 1) {
 				vallen = MAX_RESP_STR_SIZE - 1;
@@ -443,6 +406,66 @@ static void http_buildup_resp_header(http_cb_t * phttp, mime_header_t * p_respon
 			codestr = &response_str[0];
 			break;
         }
+	return codestr;
+}
+
+static void http_buildup_resp_header(http_cb_t * phttp, mime_header_t * p_response_hdr)
+{
+
+#define OUTBUF(_data, _datalen, _bytesused) { \
+    if (((_datalen)+(_bytesused)) >= phttp->resp_buflen) { \
+    	tmp_resp_buf = phttp->resp_buf; \
+    	tmp_resp_buflen = phttp->resp_buflen; \
+	phttp->resp_buflen = \
+		MAX(phttp->resp_buflen*2, (_datalen)+(_bytesused)+1); \
+	phttp->resp_buf = \
+		nkn_realloc_type(phttp->resp_buf, phttp->resp_buflen, \
+				 mod_http_respbuf); \
+	if (phttp->resp_buf) { \
+	    memcpy((void *)&phttp->resp_buf[(_bytesused)], \
+	    	   (_data), (_datalen)); \
+	    (_bytesused) += (_datalen); \
+	} else { \
+	    phttp->resp_buf  = tmp_resp_buf; \
+	    phttp->resp_buflen = tmp_resp_buflen; \
+	} \
+    } else { \
+    	memcpy((void *)&phttp->resp_buf[(_bytesused)], (_data), (_datalen)); \
+	(_bytesused) += (_datalen); \
+    } \
+}
+
+	char response_str[MAX_RESP_STR_SIZE];
+        const char * codestr;
+        char * p;
+	int len;
+ 	const char *name;
+	int namelen;
+	const char *val;
+	int vallen;
+	const char *data;
+	int datalen;
+	int hdrcnt;
+	u_int32_t attr;
+	int n, nth;
+	int rv;
+	const namespace_config_t *nsc = phttp->nsconf;
+	//int modify_date;
+
+	int bytesused;
+	char *tmp_resp_buf;
+    	int tmp_resp_buflen;
+	int conn_hdr_found;
+
+        if( phttp->res_hdlen ) {
+                // already filled in
+                return;
+        }
+
+	codestr = http_resp_codestr(phttp, p_response_hdr, response_str);
+	if (!codestr) {
+		return;
+	}
         // Adding common HTTP response headers
 
 #if 0
@@ -681,7 +704,427 @@ static void http_buildup_resp_header(http_cb_t * phttp, mime_header_t * p_respon
 	return;
 
 #undef OUTBUF
-#undef MAX_RESP_STR_SIZE
+}
+
+/*
+ * Response header templates.
+ *
+ * A cache hit builds its response from phttp->attr.  The end to end
+ * headers of the object only change with the attributes, so they are
+ * serialized once into a template kept in a per thread cache, keyed by
+ * the attribute buffer and the object version.  At send time only the
+ * status line, Content-Length, Content-Range, Via, Age, Date, Connection
+ * and the namespace configured headers are formatted around it.
+ * Responses the template can not express (policy engine, header deletes,
+ * modify-date, cookies, SSP, chunked, multipart, seek, trace, response
+ * headers in the access log) take the mime_header_t path.
+ */
+#define HTTP_RESP_TMPL_CACHE	256	/* per thread, direct mapped */
+
+typedef struct http_resp_tmpl {
+	const nkn_attr_t *attr;		/* key */
+	nkn_objv_t obj_version;
+	time_t cache_reval_time;
+	uint64_t content_length;
+	uint32_t blob_attrsize;
+	uint8_t na_entries;
+
+	uint8_t usable;
+	uint8_t has_date;
+	uint8_t has_content_range;
+	int has_content_length;
+	off_t cl;			/* cooked Content-Length */
+	char *buf;			/* hdrs, via lines, age lines, via list */
+	int hdrs_len;
+	int via_lines_len;
+	int age_lines_len;
+	int via_list_len;
+} http_resp_tmpl_t;
+
+static __thread http_resp_tmpl_t *t_resp_tmpl;
+
+NKNCNT_DEF(http_resp_tmpl_hit, uint64_t, "", "Response from header template")
+NKNCNT_DEF(http_resp_tmpl_build, uint64_t, "", "Header templates built")
+
+static int
+http_resp_tmpl_lines(const mime_header_t *hdr, int token, const char *name,
+		     int namelen, char *out)
+{
+	const char *data;
+	int datalen;
+	u_int32_t attr;
+	int nth, len = 0;
+
+	for (nth = 0; !get_nth_known_header(hdr, token, nth, &data, &datalen,
+					    &attr); nth++) {
+		if (out) {
+			memcpy(out + len, name, namelen);
+			memcpy(out + len + namelen, ": ", 2);
+			memcpy(out + len + namelen + 2, data, datalen);
+			memcpy(out + len + namelen + 2 + datalen, "\r\n", 2);
+		}
+		len += namelen + 2 + datalen + 2;
+	}
+	return len;
+}
+
+/*
+ * Serialize the headers of attr into rt, as http_buildup_resp_header()
+ * would for a 200 without the per response headers.  Sized by a first
+ * pass with out == NULL.
+ */
+static int
+http_resp_tmpl_fill(http_resp_tmpl_t *rt, const mime_header_t *hdr, char *out)
+{
+	const char *name, *data;
+	int namelen, datalen;
+	u_int32_t attr;
+	int n, nth, len = 0;
+
+	for (n = 0; n < MIME_HDR_MAX_DEFS; n++) {
+		if (!hdr->known_header_map[n]) {
+			continue;
+		}
+		switch(n) {
+		case MIME_HDR_CONNECTION:
+		case MIME_HDR_TRAILER:
+		case MIME_HDR_CONTENT_LENGTH:
+		case MIME_HDR_VIA:
+		case MIME_HDR_AGE:
+			continue;
+		case MIME_HDR_TRANSFER_ENCODING:
+			break;
+		case MIME_HDR_X_ACCEL_CACHE_CONTROL:
+			rt->usable = 0;
+			continue;
+		case MIME_HDR_DATE:
+			rt->has_date = 1;
+			break;
+		case MIME_HDR_CONTENT_RANGE:
+			rt->has_content_range = 1;
+			break;
+		default:
+			if (http_end2end_header[n] == 0) {
+				continue;
+			}
+			break;
+		}
+		len += http_resp_tmpl_lines(hdr, n, http_known_headers[n].name,
+					    http_known_headers[n].namelen,
+					    out ? out + len : NULL);
+	}
+
+	for (nth = 0; !get_nth_unknown_header(hdr, nth, &name, &namelen,
+					      &data, &datalen, &attr); nth++) {
+		if (out) {
+			memcpy(out + len, name, namelen);
+			memcpy(out + len + namelen, ": ", 2);
+			memcpy(out + len + namelen + 2, data, datalen);
+			memcpy(out + len + namelen + 2 + datalen, "\r\n", 2);
+		}
+		len += namelen + 2 + datalen + 2;
+	}
+	return len;
+}
+
+static int
+http_resp_tmpl_init(http_resp_tmpl_t *rt, const nkn_attr_t *attr)
+{
+	mime_header_t *hdr;
+	const cooked_data_types_t *pckd;
+	mime_hdr_datatype_t dtype;
+	int dlen, num_via, via_bytes, len;
+	char *p;
+
+	if (rt->buf) {
+		free(rt->buf);
+	}
+	memset(rt, 0, sizeof(*rt));
+
+	hdr = (mime_header_t *)nkn_malloc_type(sizeof(mime_header_t),
+					       mod_http_mime_header_t);
+	if (!hdr) {
+		return 1;
+	}
+	init_http_header(hdr, 0, 0);
+	if (nkn_attr2http_header(attr, 1, hdr)) {
+		goto out;
+	}
+
+	rt->usable = 1;
+	if (!get_cooked_known_header_data(hdr, MIME_HDR_CONTENT_LENGTH,
+					  &pckd, &dlen, &dtype)) {
+		rt->has_content_length = 1;
+		if (dtype != DT_SIZE) {
+			rt->usable = 0;
+		}
+		rt->cl = pckd->u.dt_size.ll;
+	}
+	if (!is_known_header_present(hdr, MIME_HDR_CONTENT_TYPE)) {
+		// NFS origins fill it in from the URI
+		rt->usable = 0;
+	}
+
+	count_known_header_values(hdr, MIME_HDR_VIA, &num_via, &via_bytes);
+	rt->hdrs_len = http_resp_tmpl_fill(rt, hdr, NULL);
+	rt->via_lines_len = http_resp_tmpl_lines(hdr, MIME_HDR_VIA,
+			http_known_headers[MIME_HDR_VIA].name,
+			http_known_headers[MIME_HDR_VIA].namelen, NULL);
+	rt->age_lines_len = http_resp_tmpl_lines(hdr, MIME_HDR_AGE,
+			http_known_headers[MIME_HDR_AGE].name,
+			http_known_headers[MIME_HDR_AGE].namelen, NULL);
+	len = rt->hdrs_len + rt->via_lines_len + rt->age_lines_len +
+		via_bytes + num_via + 1;
+	rt->buf = (char *)nkn_malloc_type(len, mod_http_resp_tmpl);
+	if (!rt->buf) {
+		rt->usable = 0;
+		goto out;
+	}
+
+	p = rt->buf;
+	http_resp_tmpl_fill(rt, hdr, p);
+	p += rt->hdrs_len;
+	http_resp_tmpl_lines(hdr, MIME_HDR_VIA,
+			http_known_headers[MIME_HDR_VIA].name,
+			http_known_headers[MIME_HDR_VIA].namelen, p);
+	p += rt->via_lines_len;
+	http_resp_tmpl_lines(hdr, MIME_HDR_AGE,
+			http_known_headers[MIME_HDR_AGE].name,
+			http_known_headers[MIME_HDR_AGE].namelen, p);
+	p += rt->age_lines_len;
+	if (concatenate_known_header_values(hdr, MIME_HDR_VIA, p,
+					    via_bytes + num_via + 1)) {
+		rt->via_list_len = strlen(p);
+	}
+	glob_http_resp_tmpl_build++;
+
+out:
+	rt->attr = attr;
+	rt->obj_version = attr->obj_version;
+	rt->cache_reval_time = attr->cache_reval_time;
+	rt->content_length = attr->content_length;
+	rt->blob_attrsize = attr->blob_attrsize;
+	rt->na_entries = attr->na_entries;
+	shutdown_http_header(hdr);
+	free(hdr);
+	return 0;
+}
+
+static http_resp_tmpl_t *
+http_resp_tmpl_get(const nkn_attr_t *attr)
+{
+	http_resp_tmpl_t *rt;
+	uintptr_t h = (uintptr_t)attr;
+
+	if (!t_resp_tmpl) {
+		t_resp_tmpl = (http_resp_tmpl_t *)nkn_calloc_type(
+				HTTP_RESP_TMPL_CACHE, sizeof(http_resp_tmpl_t),
+				mod_http_resp_tmpl);
+		if (!t_resp_tmpl) {
+			return NULL;
+		}
+	}
+	rt = &t_resp_tmpl[((h >> 9) ^ (h >> 17)) & (HTTP_RESP_TMPL_CACHE - 1)];
+	if (rt->attr != attr ||
+	    memcmp(&rt->obj_version, &attr->obj_version,
+		   sizeof(nkn_objv_t)) ||
+	    rt->cache_reval_time != attr->cache_reval_time ||
+	    rt->content_length != attr->content_length ||
+	    rt->blob_attrsize != attr->blob_attrsize ||
+	    rt->na_entries != attr->na_entries) {
+		if (http_resp_tmpl_init(rt, attr)) {
+			return NULL;
+		}
+	}
+	return rt->usable ? rt : NULL;
+}
+
+/*
+ * Build a 200/206 cache hit response around the object's template.
+ * Returns 1 if phttp->resp_buf was built, 0 to take the mime_header_t path.
+ */
+static int
+http_build_res_from_tmpl(http_cb_t * phttp, int status_code)
+{
+	const namespace_config_t *nsc = phttp->nsconf;
+	http_resp_tmpl_t *rt;
+	char response_str[MAX_RESP_STR_SIZE];
+	char status[160], cl[96], cr[128], age[64], mfc_via[256];
+	const char *codestr, *datestr = NULL, *conn;
+	const char *name, *val;
+	int namelen, vallen;
+	int status_len, cl_len, cr_len = 0, age_len = 0, mfc_via_len = 0;
+	int datestr_len = 0, conn_len, via_len = 0;
+	int conn_hdr_found = 0;
+	int len, n;
+	off_t start = 0, stop = 0;
+	time_t current_age;
+	char *p;
+
+	if ((status_code != 200 && status_code != 206) ||
+	    CHECK_HTTP_FLAG(phttp, HRF_SSP_CONFIGURED | HRF_CACHE_COOKIE |
+			    HRF_TRACE_REQUEST | HRF_TRANSCODE_CHUNKED |
+			    HRF_MULTIPART_RESPONSE | HRF_MULTI_BYTE_RANGE |
+			    HRF_BYTE_SEEK) ||
+	    CHECK_HTTP_FLAG2(phttp, HRF2_EXPIRED_OBJ_DEL)) {
+		return 0;
+	}
+	if (nsc && nsc->http_config &&
+	    (nsc->http_config->policy_engine_config.policy_file ||
+	     nsc->http_config->policies.modify_date_header ||
+	     nsc->http_config->num_delete_response_headers)) {
+		return 0;
+	}
+	if (nsc && nsc->acclog_config->al_resp_header_configured) {
+		return 0;
+	}
+	rt = http_resp_tmpl_get(phttp->attr);
+	if (!rt || (status_code == 206 && rt->has_content_range)) {
+		return 0;
+	}
+
+	if (phttp->p_resp_hdr) {
+		shutdown_http_header(phttp->p_resp_hdr);
+		free(phttp->p_resp_hdr);
+		phttp->p_resp_hdr = NULL;
+	}
+
+	phttp->respcode = status_code;
+	if (status_code == 206) {
+		phttp->subcode = 0;
+	}
+	codestr = http_resp_codestr(phttp, NULL, response_str);
+
+	// setup_http_build_200()/setup_http_build_206()
+	if (rt->has_content_length) {
+		phttp->content_length = rt->cl;
+	}
+	cl_len = 0;
+	if (status_code == 200) {
+		glob_http_tot_content_length++;
+		if (rt->has_content_length) {
+			cl_len = snprintf(cl, sizeof(cl),
+					  "Content-Length: %ld\r\n",
+					  phttp->content_length);
+		}
+	} else {
+		glob_http_tot_byte_range++;
+		if (CHECK_HTTP_FLAG(phttp, HRF_BYTE_RANGE)) {
+			start = phttp->brstart;
+			stop = phttp->brstop;
+		}
+		cr_len = snprintf(cr, sizeof(cr),
+				  "Content-Range: bytes %ld-%ld/%ld\r\n",
+				  start, stop, phttp->content_length);
+		cl_len = snprintf(cl, sizeof(cl), "Content-Length: %ld\r\n",
+				  stop - start + 1);
+	}
+	if (CHECK_HTTP_FLAG(phttp, HRF_CONNECTION_KEEP_ALIVE)) {
+		conn = "Connection: Keep-Alive\r\n";
+	} else {
+		conn = "Connection: Close\r\n";
+	}
+	conn_len = strlen(conn);
+
+	// http_add_via_and_date_header()
+	if (!(nsc && nkn_http_is_transparent_proxy(nsc))) {
+		mfc_via_len = snprintf(mfc_via, sizeof(mfc_via), "%s %s:%hu",
+				(CHECK_HTTP_RESPONSE_FLAG(phttp, HRF_HTTP_10)
+					? "1.0" : "1.1"),
+				myhostname, phttp->remote_port);
+		via_len = 5 + rt->via_list_len + (rt->via_list_len ? 1 : 0) +
+			mfc_via_len + 2;
+	} else {
+		via_len = rt->via_lines_len;
+	}
+	current_age = nkn_cur_ts - phttp->obj_create;
+	if (current_age < 0 || current_age >= 0x7fffffff) {
+		current_age = 0x80000000;
+	}
+	if (current_age > 0) {
+		age_len = snprintf(age, sizeof(age), "Age: %ld\r\n",
+				   current_age);
+	}
+	if (!rt->has_date) {
+		datestr = nkn_get_datestr(&datestr_len);
+	}
+
+	status_len = snprintf(status, sizeof(status), "HTTP/1.1 %d %s",
+			      phttp->respcode, codestr);
+	if (phttp->subcode) {
+		status_len += snprintf(status + status_len,
+				       sizeof(status) - status_len, " %d",
+				       phttp->subcode);
+	}
+	status_len += snprintf(status + status_len,
+			       sizeof(status) - status_len, "\r\n");
+
+	len = status_len + rt->hdrs_len + cl_len + cr_len + via_len +
+		rt->age_lines_len + age_len +
+		(rt->has_date ? 0 : 6 + datestr_len + 2) + conn_len;
+	for (n = 0; !get_nth_add_response_hdr(nsc, n, &name, &namelen,
+					      &val, &vallen); n++) {
+		len += namelen + 2 + vallen + 2;
+	}
+	len += 2 + 1;
+
+	len = MAX(phttp->cb_max_buf_size, len);
+	phttp->resp_buf = (char *)nkn_malloc_type(len, mod_http_respbuf);
+	if (!phttp->resp_buf) {
+		return 1;
+	}
+	phttp->resp_buflen = len;
+	p = phttp->resp_buf;
+
+#define TOUT(_data, _len) { memcpy(p, (_data), (_len)); p += (_len); }
+	TOUT(status, status_len);
+	TOUT(rt->buf, rt->hdrs_len);
+	TOUT(cl, cl_len);
+	TOUT(cr, cr_len);
+	if (mfc_via_len) {
+		TOUT("Via: ", 5);
+		TOUT(rt->buf + rt->hdrs_len + rt->via_lines_len +
+		     rt->age_lines_len, rt->via_list_len);
+		if (rt->via_list_len) {
+			TOUT(",", 1);
+		}
+		TOUT(mfc_via, mfc_via_len);
+		TOUT("\r\n", 2);
+	} else {
+		TOUT(rt->buf + rt->hdrs_len, rt->via_lines_len);
+	}
+	// origin Age lines, then ours, as add_known_header() leaves them
+	TOUT(rt->buf + rt->hdrs_len + rt->via_lines_len, rt->age_lines_len);
+	TOUT(age, age_len);
+	if (!rt->has_date) {
+		TOUT("Date: ", 6);
+		TOUT(datestr, datestr_len);
+		TOUT("\r\n", 2);
+	}
+	TOUT(conn, conn_len);
+	for (n = 0; !get_nth_add_response_hdr(nsc, n, &name, &namelen,
+					      &val, &vallen); n++) {
+		// bug 5226, see http_buildup_resp_header()
+		if (conn_hdr_found == 0 && strcasecmp(name, "connection") == 0) {
+			conn_hdr_found = 1;
+			if (strcasecmp(val, "close") == 0) {
+				CLEAR_HTTP_FLAG(phttp, HRF_CONNECTION_KEEP_ALIVE);
+			}
+		}
+		TOUT(name, namelen);
+		TOUT(": ", 2);
+		if (val && vallen) {
+			TOUT(val, vallen);
+		}
+		TOUT("\r\n", 2);
+	}
+	TOUT("\r\n", 2);
+#undef TOUT
+	*p = '\0';
+	phttp->res_hdlen = p - phttp->resp_buf;
+	glob_http_resp_tmpl_hit++;
+
+	return 1;
 }
 
 static
@@ -968,6 +1411,9 @@ int http_build_res_common(http_cb_t * phttp, int status_code, int errcode, mime_
 	}
 	else if(phttp->attr && !errcode) {
 		// case 2
+		if (http_build_res_from_tmpl(phttp, status_code)) {
+			goto hdr_size_counters;
+		}
 		presponse_hdr_from = 2;
 		if (phttp->p_resp_hdr) {
 			shutdown_http_header(phttp->p_resp_hdr);
@@ -1174,6 +1620,7 @@ int http_build_res_common(http_cb_t * phttp, int status_code, int errcode, mime_
 		}
 	}
 
+hdr_size_counters:
 	/*
 	 * Update counters with header size.
 	 */
@@ -66,11 +66,15 @@ NKNCNT_DEF(err_bad_timer_entry_1, uint64_t, "", "num of bad entries inserted in
 NKNCNT_DEF(err_bad_timer_entry_2, uint64_t, "", "num of bad entries inserted in timer slots, not in Q case");
 NKNCNT_DEF(err_bad_timer_entry_3, uint64_t, "", "num of bad entries inserted in timer slots, not in Q case");
 NKNCNT_DEF(sbq_items_processed, uint64_t, "", "num of bad entries inserted in timer slots, not in Q case");
+NKNCNT_DEF(socket_tw_req, uint64_t, "", "num of timer wheel re-link requests from other threads");
+NKNCNT_DEF(sbq_req, uint64_t, "", "num of pacing wheel requests from other threads");
+NKNCNT_DEF(socket_tw_relink, uint64_t, "", "num of timer wheel entries moved to a later slot");
 extern uint16_t glob_tot_svr_sockets;
 extern uint16_t glob_tot_svr_sockets_ipv6;
 
 int epoll_wait_timeout = 1; // 1 second
 AO_t next_epthr = 0;
+__thread int nm_thr_num = -1;
 network_mgr_t * gnm = NULL;	// global network manager array
 extern pthread_key_t namespace_key;
 extern volatile sig_atomic_t srv_shutdown;
@@ -155,14 +159,20 @@ void NM_init()
 
 		SET_NM_THR_MAX_FDS(pnmthr);
 
-		// Each active fd will be in time out list.
-		// Timeout is separated into groups.
-		// If timed out, the whole group will time out.
-		for(j=0; j<MAX_TOQ_SLOT; j++) {
-			LIST_INIT( &pnmthr->toq_head[j] );
+		// Each active fd will be in the timer wheel of its thread.
+		for(j=0; j<NM_TW_L0_SIZE; j++) {
+			LIST_INIT( &pnmthr->tw.l0[j] );
 		}
-		LIST_INIT( &pnmthr->sbq_head[0] );
-		LIST_INIT( &pnmthr->sbq_head[1] );
+		for(j=0; j<NM_TW_LN_SIZE; j++) {
+			LIST_INIT( &pnmthr->tw.ln[0][j] );
+			LIST_INIT( &pnmthr->tw.ln[1][j] );
+		}
+		pnmthr->tw.cur_tick = NM_tw_now_msecs() / NM_TW_TICK_MSECS;
+		// Paced fds wait in the pacing wheel of their thread.
+		for(j=0; j<NM_SBQ_SLOTS; j++) {
+			LIST_INIT( &pnmthr->sbq[j] );
+		}
+		pnmthr->sbq_cur_tick = NM_tw_now_msecs() / NM_SBQ_TICK_MSECS;
 		pnmthr->cur_sbq = 0;
 
 
@@ -224,146 +234,439 @@ void NM_reinit_callback()
 }
 
 
-/* Maximum entries to be processed in a single call to
- * NM_timer_for_sbq. This ensures, we are not spending
- * too much time in this function at a time.
- * The rest of the entries will be processed in the
- * subsequent iteration of the NM loop.
+net_fd_handle_t NM_fd_to_fhandle(int fd)
+{
+	net_fd_handle_t fdh;
+
+	fdh.incarn = gnm[fd].incarn;
+	fdh.fd = fd;
+	return fdh;
+}
+
+
+void dbg_dump_fds_in_epoll(void)
+{
+	int i;
+	for(i=0;i<MAX_GNM;i++) {
+		if(NM_CHECK_FLAG(&gnm[i], NMF_IN_EPOLL))
+			printf("%d\n", i);
+	}
+}
+
+
+/* one timeout slot is 2 seconds 
+ * Since there is a check of 10 seconds as the min http timeout,
+ * the diff time if < 10 seconds will create issue. 
+ * Now keeping the threshold to 10 prohibts the api to provide 
+ * timeouts less than 10 seconds.
+ * */
+void NM_change_socket_timeout_time (network_mgr_t * pnm, int next_timeout_slot)
+{
+	if(pnm->f_timeout == NULL) {
+		return;
+	}
+
+	pnm->last_active = nkn_cur_ts;
+	
+	next_timeout_slot = (next_timeout_slot > 5 ? next_timeout_slot : 5);
+	NM_tw_arm(pnm, next_timeout_slot * NM_TOQ_SLOT_MSECS);
+}
+
+/*
+ * Timer wheel functions.
+ * All of them run in the network thread which owns the wheel.
+ */
+static void NM_tw_link(nm_timer_wheel_t * tw, network_mgr_t * pnm, uint64_t tick)
+{
+	struct nm_timeout_queue * slot;
+	uint64_t delta;
+
+	if (tick < tw->cur_tick) {
+		tick = tw->cur_tick;
+	}
+	delta = tick - tw->cur_tick;
+	if (delta < NM_TW_L0_SIZE) {
+		slot = &tw->l0[tick & (NM_TW_L0_SIZE - 1)];
+	}
+	else if (delta < (NM_TW_L0_SIZE << NM_TW_LN_BITS)) {
+		slot = &tw->ln[0][(tick >> NM_TW_L0_BITS) & (NM_TW_LN_SIZE - 1)];
+	}
+	else {
+		if (delta >= NM_TW_MAX_TICKS) {
+			// Fires early and gets moved again
+			tick = tw->cur_tick + NM_TW_MAX_TICKS - 1;
+		}
+		slot = &tw->ln[1][(tick >> (NM_TW_L0_BITS + NM_TW_LN_BITS)) &
+				  (NM_TW_LN_SIZE - 1)];
+	}
+	pnm->tw_expire = tick;
+	LIST_INSERT_HEAD(slot, pnm, toq_entries);
+}
+
+/*
+ * Give up the entry.  If the timeout was re-armed meanwhile by another
+ * thread, which may have seen tw_thr still set and skipped the request,
+ * route it again.
+ */
+static void NM_tw_release(network_mgr_t * pnm)
+{
+	AO_store(&pnm->tw_thr, 0);
+	AO_nop_full();
+	if (NM_CHECK_FLAG(pnm, NMF_IN_TIMEOUTQ)) {
+		NM_tw_request(pnm->pthr, pnm);
+	}
+}
+
+/*
+ * The entry is unlinked and owned by this thread, link it at its
+ * deadline or drop it.
  */
-#define SBQ_PROCESS_ITEMS_MAX 500
+static void NM_tw_place(struct nm_threads * pnmthr, network_mgr_t * pnm)
+{
+	uint64_t tick;
+
+	while (1) {
+		if (!NM_CHECK_FLAG(pnm, NMF_IN_TIMEOUTQ) || (pnm->pthr != pnmthr)) {
+			NM_tw_release(pnm);
+			return;
+		}
+		tick = NM_TW_MSECS_TO_TICK(pnm->tw_deadline);
+		NM_tw_link(&pnmthr->tw, pnm, tick);
+		/* Pairs with NM_tw_arm(): a deadline moved before the
+		 * slot just picked is either seen here or requested.
+		 */
+		AO_nop_full();
+		if (NM_TW_MSECS_TO_TICK(pnm->tw_deadline) >= tick) {
+			return;
+		}
+		LIST_REMOVE(pnm, toq_entries);
+	}
+}
+
+static void NM_tw_run_requests(struct nm_threads * pnmthr)
+{
+	network_mgr_t * pnm, * next;
+	struct nm_threads * owner;
+	AO_t head;
+
+	do {
+		head = AO_load(&pnmthr->tw_req_head);
+	} while (head && !AO_compare_and_swap_full(&pnmthr->tw_req_head, head, 0));
+
+	for (pnm = (network_mgr_t *)head; pnm; pnm = next) {
+		next = pnm->tw_req_next;
+		AO_store(&pnm->tw_req, 0);
+		AO_nop_full();
+		glob_socket_tw_req++;
+
+		owner = (struct nm_threads *)AO_load(&pnm->tw_thr);
+		if (owner == pnmthr) {
+			LIST_REMOVE(pnm, toq_entries);
+			NM_tw_place(pnmthr, pnm);
+		}
+		else if (owner) {
+			// Still linked in another wheel, its thread hands it over
+			NM_tw_request(owner, pnm);
+		}
+		else if (pnm->pthr != pnmthr) {
+			if (NM_CHECK_FLAG(pnm, NMF_IN_TIMEOUTQ)) {
+				NM_tw_request(pnm->pthr, pnm);
+			}
+		}
+		else if (AO_compare_and_swap_full(&pnm->tw_thr, 0, (AO_t)pnmthr)) {
+			NM_tw_place(pnmthr, pnm);
+		}
+		else {
+			NM_tw_request(pnm->pthr, pnm);
+		}
+	}
+}
 
 /*
- * This function will be called within network thread.
- * So we will not run into the timer runs out of time problem
- * and distribute the load into different CPU cores.
+ * The slot of the entry fired.  Timeout entries are not unlinked when
+ * the socket is active, closed or moved, that is sorted out here.
+ * The entry stays owned by this thread while it is unlinked, so a
+ * timeout armed meanwhile only stores its deadline and the entry is
+ * linked again at the end without a request.
  */
-static void NM_timer_for_sbq(struct nm_threads * pnmthr)
+static void NM_tw_expire(struct nm_threads * pnmthr, network_mgr_t * pnm, uint64_t now_tick)
 {
-	network_mgr_t * pnm;
-	con_t * httpcon;
-	int cur_sbq, other_sbq;
-	int sbq_processed = 0; /* In this call, process a maximum of 500 entries */
-	int sbq_max_to_be_processed;
+	double timediff;
 
+	if (!NM_CHECK_FLAG(pnm, NMF_IN_TIMEOUTQ) || (pnm->pthr != pnmthr)) {
+		NM_tw_release(pnm);
+		return;
+	}
+	if (NM_TW_MSECS_TO_TICK(pnm->tw_deadline) > now_tick) {
+		glob_socket_tw_relink++;
+		NM_tw_place(pnmthr, pnm);
+		return;
+	}
 
-	NKN_MUTEX_LOCKSTAT(&pnmthr->nm_mutex, &nm_lockstat[pnmthr->num]);
 	/*
-	 * cleanup the SBQ if there are data in the queue.
+	 * The wheel is per thread, the socket is not: f_timeout() and
+	 * NM_close_socket() run under pnm->mutex like every other user of
+	 * the socket.  Only due entries get here.
 	 */
-	cur_sbq = (pnmthr->cur_sbq==0) ? 1 : 0; //pick up the other queue
-	if( pnmthr->cleanup_sbq == 1 ) {
-		// Because we need to swap the SBQ, let's clean up the current sbq now.
-		sbq_max_to_be_processed = 0x7FFFFFFF;
+	pthread_mutex_lock(&pnm->mutex);
+	NM_TRACE_LOCK(pnm, LT_NETWORK);
+	if (NM_CHECK_FLAG(pnm, NMF_IN_USE) && NM_CHECK_FLAG(pnm, NMF_IN_TIMEOUTQ) &&
+	    (NM_TW_MSECS_TO_TICK(pnm->tw_deadline) <= now_tick)) {
+		if (pnm->f_timeout == NULL) {
+			/* 
+			 * BUG 4704: TBD: I have no idea why (pnm->f_timeout==NULL) is TRUE
+			 * Add protection code to avoid crash.
+			 */
+			glob_err_timeout_f_timeout_NULL++;
+			DBG_LOG(ERROR, MOD_NETWORK, "(f_timeout==NULL) for fd=%d", pnm->fd);
+			NM_UNSET_FLAG(pnm, NMF_IN_TIMEOUTQ);
+		}
+		else {
+			NM_UNSET_FLAG(pnm, NMF_IN_TIMEOUTQ);
+			timediff = difftime(nkn_cur_ts, pnm->last_active);
+			if (pnm->f_timeout(pnm->fd, pnm->private_data, timediff) == TRUE) {
+				glob_socket_tot_timeout++;
+				NM_close_socket(pnm->fd);
+			}
+			else {
+				/*
+				 * Application does not want to timeout socket.
+				 */
+				NM_set_socket_active(pnm);
+			}
+		}
 	}
-	else {
-		// Don't block epollout event, let's only process up to 500 sockets
-		// from SBQ
-		sbq_max_to_be_processed = SBQ_PROCESS_ITEMS_MAX;
+	NM_TRACE_UNLOCK(pnm, LT_NETWORK);
+	pthread_mutex_unlock(&pnm->mutex);
+
+	// Re-armed, closed or moved: link it again or give it up
+	NM_tw_place(pnmthr, pnm);
+}
+
+static void NM_tw_cascade(nm_timer_wheel_t * tw, struct nm_timeout_queue * slot)
+{
+	network_mgr_t * pnm;
+
+	while ( !LIST_EMPTY(slot) ) {
+		pnm = LIST_FIRST(slot);
+		LIST_REMOVE(pnm, toq_entries);
+		NM_tw_link(tw, pnm, pnm->tw_expire);
 	}
-	while( !LIST_EMPTY(&pnmthr->sbq_head[cur_sbq]) )
-	{
-		/*
-		 * Get the first entry in the queue, and
-		 * send data out or post a new scheduler task.
-		 */
-		pnm = LIST_FIRST(&pnmthr->sbq_head[cur_sbq]);
-		NKN_MUTEX_UNLOCKSTAT(&pnmthr->nm_mutex);
+}
 
-		pthread_mutex_lock(&pnm->mutex);
-		NM_TRACE_LOCK(pnm, LT_NETWORK);
-		httpcon = (con_t *)(pnm->private_data);
-		if( NM_CHECK_FLAG(pnm, NMF_IN_USE) ) {
-			NKN_MUTEX_LOCKSTAT(&pnm->pthr->nm_mutex, &nm_lockstat[pnmthr->num]);
-		    	if( NM_CHECK_FLAG(pnm, NMF_IN_SBQ) ) {
-				LIST_REMOVE( pnm, sbq_entries);
-				NM_UNSET_FLAG( pnm, NMF_IN_SBQ );
+/*
+ * Called by the network thread between two epoll_wait() calls.
+ * Links the entries other threads asked for, then expires all the
+ * ticks up to now.
+ */
+static void NM_tw_run(struct nm_threads * pnmthr)
+{
+	nm_timer_wheel_t * tw = &pnmthr->tw;
+	struct nm_timeout_queue expired;
+	network_mgr_t * pnm;
+	uint64_t now_tick;
+	int idx, l1;
+
+	if (AO_load(&pnmthr->tw_req_head)) {
+		NM_tw_run_requests(pnmthr);
+	}
+
+	now_tick = NM_tw_now_msecs() / NM_TW_TICK_MSECS;
+	while (tw->cur_tick <= now_tick) {
+		idx = tw->cur_tick & (NM_TW_L0_SIZE - 1);
+		if (idx == 0) {
+			l1 = (tw->cur_tick >> NM_TW_L0_BITS) & (NM_TW_LN_SIZE - 1);
+			if (l1 == 0) {
+				NM_tw_cascade(tw, &tw->ln[1][(tw->cur_tick >>
+					(NM_TW_L0_BITS + NM_TW_LN_BITS)) &
+					(NM_TW_LN_SIZE - 1)]);
 			}
-			NKN_MUTEX_UNLOCKSTAT(&pnm->pthr->nm_mutex);
-                        /*
-                        * PR-769965
-                        * The problem was that we were calling http_try_to_send_data(),
-                        * and inside that we were also adding to sbq.
-                        * The sbq could kick off the same second and send again
-                        * Avoiding all this, by just adding to another sbq if this pnm
-                        * was active the same second.
-                        * We only send data once a second and dont burst during the start.
-                        */
-                        if (nkn_cur_ts != httpcon->nkn_cur_ts) {
-                                http_try_to_sendout_data(httpcon);
-                        } else {
-                                other_sbq = (cur_sbq==0) ? 1 : 0;
-                                NKN_MUTEX_LOCKSTAT(&pnm->pthr->nm_mutex, &nm_lockstat[pnmthr->num]);
-                                LIST_INSERT_HEAD( &(pnm->pthr->sbq_head[other_sbq]), pnm, sbq_entries);
-                                NM_SET_FLAG(pnm, NMF_IN_SBQ);
-                                NKN_MUTEX_UNLOCKSTAT(&pnm->pthr->nm_mutex);
-                        }
+			NM_tw_cascade(tw, &tw->ln[0][l1]);
+		}
+
+		/* Entries re-linked while expiring go to later ticks */
+		LIST_INIT(&expired);
+		while ( !LIST_EMPTY(&tw->l0[idx]) ) {
+			pnm = LIST_FIRST(&tw->l0[idx]);
+			LIST_REMOVE(pnm, toq_entries);
+			LIST_INSERT_HEAD(&expired, pnm, toq_entries);
 		}
-		NM_TRACE_UNLOCK(pnm, LT_NETWORK);
-		pthread_mutex_unlock(&pnm->mutex);
+		tw->cur_tick++;
 
-		NKN_MUTEX_LOCKSTAT(&pnmthr->nm_mutex, &nm_lockstat[pnmthr->num]);
-		// Get the lock back for this while loop
-		sbq_processed++ ;
-		glob_sbq_items_processed ++ ;
-		if(sbq_processed > sbq_max_to_be_processed) {
-			break;
+		while ( !LIST_EMPTY(&expired) ) {
+			pnm = LIST_FIRST(&expired);
+			LIST_REMOVE(pnm, toq_entries);
+			NM_tw_expire(pnmthr, pnm, now_tick);
 		}
 	}
-	if (pnmthr->cleanup_sbq) {
-		pnmthr->cur_sbq = (pnmthr->cur_sbq==0) ? 1 : 0; //swap the sbq
-		pnmthr->cleanup_sbq = 0;
+}
+
+/*
+ * Pacing wheel functions.
+ * All of them run in the network thread which owns the wheel.
+ */
+static void NM_sbq_link(struct nm_threads * pnmthr, network_mgr_t * pnm, uint64_t tick)
+{
+	if (tick < pnmthr->sbq_cur_tick) {
+		tick = pnmthr->sbq_cur_tick;
+	}
+	else if (tick - pnmthr->sbq_cur_tick >= NM_SBQ_SLOTS) {
+		// Fires early and gets moved again
+		tick = pnmthr->sbq_cur_tick + NM_SBQ_SLOTS - 1;
 	}
-	NKN_MUTEX_UNLOCKSTAT(&pnmthr->nm_mutex);
+	pnm->sbq_expire = tick;
+	LIST_INSERT_HEAD(&pnmthr->sbq[tick & (NM_SBQ_SLOTS - 1)], pnm, sbq_entries);
+	pnmthr->cur_sbq++;
 }
 
+static void NM_sbq_unlink(struct nm_threads * pnmthr, network_mgr_t * pnm)
+{
+	LIST_REMOVE(pnm, sbq_entries);
+	pnmthr->cur_sbq--;
+}
 
+static void NM_sbq_release(network_mgr_t * pnm)
+{
+	AO_store(&pnm->sbq_thr, 0);
+	AO_nop_full();
+	if (NM_CHECK_FLAG(pnm, NMF_IN_SBQ)) {
+		NM_sbq_request(pnm->pthr, pnm);
+	}
+}
 
-net_fd_handle_t NM_fd_to_fhandle(int fd)
+/*
+ * The entry is unlinked and owned by this thread, link it at its
+ * deadline or drop it.
+ */
+static void NM_sbq_place(struct nm_threads * pnmthr, network_mgr_t * pnm)
 {
-	net_fd_handle_t fdh;
+	uint64_t tick;
 
-	fdh.incarn = gnm[fd].incarn;
-	fdh.fd = fd;
-	return fdh;
+	while (1) {
+		if (!NM_CHECK_FLAG(pnm, NMF_IN_SBQ) || (pnm->pthr != pnmthr)) {
+			NM_sbq_release(pnm);
+			return;
+		}
+		tick = NM_SBQ_MSECS_TO_TICK(pnm->sbq_deadline);
+		NM_sbq_link(pnmthr, pnm, tick);
+		/* Pairs with NM_sbq_add(), see NM_tw_place() */
+		AO_nop_full();
+		if (NM_SBQ_MSECS_TO_TICK(pnm->sbq_deadline) >= tick) {
+			return;
+		}
+		NM_sbq_unlink(pnmthr, pnm);
+	}
 }
 
-
-void dbg_dump_fds_in_epoll(void)
+static void NM_sbq_run_requests(struct nm_threads * pnmthr)
 {
-	int i;
-	for(i=0;i<MAX_GNM;i++) {
-		if(NM_CHECK_FLAG(&gnm[i], NMF_IN_EPOLL))
-			printf("%d\n", i);
+	network_mgr_t * pnm, * next;
+	struct nm_threads * owner;
+	AO_t head;
+
+	do {
+		head = AO_load(&pnmthr->sbq_req_head);
+	} while (head && !AO_compare_and_swap_full(&pnmthr->sbq_req_head, head, 0));
+
+	for (pnm = (network_mgr_t *)head; pnm; pnm = next) {
+		next = pnm->sbq_req_next;
+		AO_store(&pnm->sbq_req, 0);
+		AO_nop_full();
+		glob_sbq_req++;
+
+		owner = (struct nm_threads *)AO_load(&pnm->sbq_thr);
+		if (owner == pnmthr) {
+			NM_sbq_unlink(pnmthr, pnm);
+			NM_sbq_place(pnmthr, pnm);
+		}
+		else if (owner) {
+			// Still linked in another wheel, its thread hands it over
+			NM_sbq_request(owner, pnm);
+		}
+		else if (pnm->pthr != pnmthr) {
+			if (NM_CHECK_FLAG(pnm, NMF_IN_SBQ)) {
+				NM_sbq_request(pnm->pthr, pnm);
+			}
+		}
+		else if (AO_compare_and_swap_full(&pnm->sbq_thr, 0, (AO_t)pnmthr)) {
+			NM_sbq_place(pnmthr, pnm);
+		}
+		else {
+			NM_sbq_request(pnm->pthr, pnm);
+		}
 	}
 }
 
+/*
+ * The slot of the entry fired.  Send the next window of data if the
+ * connection is still waiting for it.  The entry stays owned (but not
+ * linked) meanwhile, so that NM_sbq_add() from the send path only has
+ * to store the new deadline.
+ */
+static void NM_sbq_expire(struct nm_threads * pnmthr, network_mgr_t * pnm, uint64_t now_tick)
+{
+	con_t * httpcon;
 
-/* one timeout slot is 5 seconds 
- * Since there is a check of 10 seconds as the min http timeout,
- * the diff time if < 10 seconds will create issue. 
- * Now keeping the threshold to 10 prohibts the api to provide 
- * timeouts less than 10 seconds.
- * */
-void NM_change_socket_timeout_time (network_mgr_t * pnm, int next_timeout_slot)
+	if (!NM_CHECK_FLAG(pnm, NMF_IN_SBQ) || (pnm->pthr != pnmthr) ||
+	    (NM_SBQ_MSECS_TO_TICK(pnm->sbq_deadline) > now_tick)) {
+		NM_sbq_place(pnmthr, pnm);
+		return;
+	}
+
+	pnm->sbq_expire = now_tick;
+	pthread_mutex_lock(&pnm->mutex);
+	NM_TRACE_LOCK(pnm, LT_NETWORK);
+	if (NM_CHECK_FLAG(pnm, NMF_IN_USE) && NM_CHECK_FLAG(pnm, NMF_IN_SBQ) &&
+	    (NM_SBQ_MSECS_TO_TICK(pnm->sbq_deadline) <= now_tick)) {
+		NM_UNSET_FLAG(pnm, NMF_IN_SBQ);
+		httpcon = (con_t *)(pnm->private_data);
+		http_try_to_sendout_data(httpcon);
+		glob_sbq_items_processed++;
+	}
+	NM_TRACE_UNLOCK(pnm, LT_NETWORK);
+	pthread_mutex_unlock(&pnm->mutex);
+	NM_sbq_place(pnmthr, pnm);
+}
+
+/*
+ * This function will be called within network thread.
+ * Links the entries other threads asked for, then sends out the
+ * connections whose send window has opened.
+ */
+static void NM_sbq_run(struct nm_threads * pnmthr)
 {
-	int slot;
+	struct nm_sess_bw_queue expired;
+	network_mgr_t * pnm;
+	uint64_t now_tick;
+	int idx;
 
-	if(pnm->f_timeout == NULL) {
+	if (AO_load(&pnmthr->sbq_req_head)) {
+		NM_sbq_run_requests(pnmthr);
+	}
+
+	now_tick = NM_tw_now_msecs() / NM_SBQ_TICK_MSECS;
+	if (pnmthr->cur_sbq == 0) {
+		pnmthr->sbq_cur_tick = now_tick + 1;
 		return;
 	}
+	while (pnmthr->sbq_cur_tick <= now_tick) {
+		idx = pnmthr->sbq_cur_tick & (NM_SBQ_SLOTS - 1);
+
+		/* Entries re-linked while sending go to later ticks */
+		LIST_INIT(&expired);
+		while ( !LIST_EMPTY(&pnmthr->sbq[idx]) ) {
+			pnm = LIST_FIRST(&pnmthr->sbq[idx]);
+			NM_sbq_unlink(pnmthr, pnm);
+			LIST_INSERT_HEAD(&expired, pnm, sbq_entries);
+		}
+		pnmthr->sbq_cur_tick++;
 
-	pnm->last_active = nkn_cur_ts;
-	
-	// Timeout Queue operation
-	NKN_MUTEX_LOCKSTAT(&pnm->pthr->nm_mutex, &nm_lockstat[pnm->pthr->num]);
-	if (NM_CHECK_FLAG(pnm, NMF_IN_TIMEOUTQ)) {
-		LIST_REMOVE(pnm, toq_entries);
+		while ( !LIST_EMPTY(&expired) ) {
+			pnm = LIST_FIRST(&expired);
+			LIST_REMOVE(pnm, sbq_entries);
+			NM_sbq_expire(pnmthr, pnm, now_tick);
+		}
 	}
-	next_timeout_slot = (next_timeout_slot > 5 ? next_timeout_slot : 5);
-	slot = (pnm->pthr->cur_toq + next_timeout_slot) % MAX_TOQ_SLOT;
-	LIST_INSERT_HEAD(&(pnm->pthr->toq_head[slot]), pnm, toq_entries);
-	NM_SET_FLAG(pnm, NMF_IN_TIMEOUTQ);
-	NKN_MUTEX_UNLOCKSTAT(&pnm->pthr->nm_mutex);
 }
 
 /*
@@ -486,8 +789,12 @@ static void * NM_main_loop( void * arg )
 	snprintf(name, 64, "nvsd-net-%lu", pnmthr->num);
 	prctl(PR_SET_NAME, name, 0, 0, 0);
 
-	// cpu = nkn_choose_cpu( pnmthr->num );
-	cpu = pnmthr->num;
+	nm_thr_num = pnmthr->num;
+	if (nm_cpu_steer) {
+		cpu = nkn_choose_cpu( pnmthr->num );
+	} else {
+		cpu = pnmthr->num;
+	}
 
 	pthread_setspecific(namespace_key, (void *)((pnmthr->num) + 1));
 
@@ -518,7 +825,8 @@ static void * NM_main_loop( void * arg )
 		check_out_cp_queue(pnmthr->num);
 		check_out_tmrq(pnmthr->num);
 
-		NM_timer_for_sbq(pnmthr);
+		NM_sbq_run(pnmthr);
+		NM_tw_run(pnmthr);
 
 		if(srv_shutdown == 1) break; // we are shutting down
 		res =  epoll_wait(pnmthr->epfd, pnmthr->events, pnmthr->max_fds, epoll_wait_timeout);
@@ -4530,6 +4530,7 @@ int http_send_response(con_t *con)
 {
         int ret, cplen;
 	int update_nkn_cur_ts = 0;
+	int pace_div = nkn_timer_interval * NM_SBQ_SLICES_PER_SEC;
         long len;
         char * p;
         int i;
@@ -4668,13 +4669,24 @@ int http_send_response(con_t *con)
 	 * 1. if fast start is configured, we will do fast start logic.
 	 * 2. otherwise calculate based on min_afr.
 	 * 3. all result should not exceed MBR.
+	 * Each result is the share of one NM_SBQ_SLICE_MSECS time slice,
+	 * the connection waits in the pacing wheel for the next one.
+	 * When the kernel paces the socket at MBR, send whatever the
+	 * socket takes and skip the per slice calculation.
 	 */
-	if(con->max_send_size == 0) {
+	if (con_update_pacing(con)) {
+		con->nkn_cur_ts = nkn_cur_ts;
+		con->pace_msecs = NM_tw_now_msecs();
+		con->max_send_size = CON_PACED_SEND_SIZE;
+		con->bandwidth_send_size = CON_PACED_SEND_SIZE;
+	}
+	else if(con->max_send_size == 0) {
 		uint64_t mbr_size;
 
 		update_nkn_cur_ts = 1;
 		// Mark the time of this max_send_size calculation
 		con->nkn_cur_ts = nkn_cur_ts;
+		con->pace_msecs = NM_tw_now_msecs();
 
 		/*
 		 * When faststart buffer is configured in SSP or network.
@@ -4682,7 +4694,7 @@ int http_send_response(con_t *con)
 		if(con->max_faststart_buf) {
 			/* if fast start is configured, we set the fast start here. */
 			if(con->max_client_bw) {
-				mbr_size = con->max_client_bw/nkn_timer_interval;
+				mbr_size = con->max_client_bw/pace_div;
 				con->max_send_size = (con->max_faststart_buf > mbr_size) ?
 							mbr_size : con->max_faststart_buf;
 			}
@@ -4703,7 +4715,7 @@ int http_send_response(con_t *con)
 			 * Then when min_afr is configured in SSP or network,
 			 * calculate con->max_send_size based on min_afr.
 			 */
-                        con->max_send_size = con->min_afr * 1.2 / nkn_timer_interval;
+                        con->max_send_size = con->min_afr * 1.2 / pace_div;
 			con->bandwidth_send_size = con->max_send_size;
                 }
 		else  {
@@ -4718,9 +4730,9 @@ int http_send_response(con_t *con)
 				return SOCKET_CLOSED;
 			}
 			con->bandwidth_send_size = (con->pns->if_bandwidth)/
-					(nkn_timer_interval);// * con->pns->tot_sessions);
+					(pace_div);// * con->pns->tot_sessions);
 			con->max_send_size = (con->pns->if_bandwidth + con->pns->if_credit)/
-					(nkn_timer_interval);// * con->pns->tot_sessions);
+					(pace_div);// * con->pns->tot_sessions);
 		}
 
 out:
@@ -4729,7 +4741,7 @@ out:
 		 * Limit session bandwidth only when it is configured.
 		 */
 		if(con->max_bandwidth) {
-			mbr_size = con->max_bandwidth/nkn_timer_interval;
+			mbr_size = con->max_bandwidth/pace_div;
 			con->max_send_size = (con->max_send_size > mbr_size) ?
 				mbr_size : con->max_send_size;
 		}
@@ -4761,7 +4773,8 @@ done_with_max_send_size_cal:
 		goto TransactionDone;
 	}
 		
-	if (nkn_resource_pool_enable) {
+	if (nkn_resource_pool_enable &&
+	    !CHECK_CON_FLAG(con, CONF_KERNEL_PACED)) {
 		uint64_t rp_available;
 		rp_available = nvsd_rp_bw_query_available_bw(con->http.nsconf->rp_index);
 		if(rp_available != (uint64_t)-1) {
@@ -4945,14 +4958,15 @@ done_with_max_send_size_cal:
 		 */
                 if (!CHECK_HTTP_FLAG(&con->http, HRF_SUPPRESS_SEND_DATA) &&
 		    (con->max_send_size==0)) {
-			if (con->nkn_cur_ts == nkn_cur_ts) {
-                        	// Wait for next second to send out more data 
+			if (NM_tw_now_msecs() <
+			    con->pace_msecs + NM_SBQ_SLICE_MSECS) {
+                        	// Wait for next time slice to send out more data 
 				if (CHECK_HTTP_FLAG(&con->http, HRF_TRACE_REQUEST)) {
 					DBG_TRACE("AFR: time=%s size=%ld", nkn_get_datestr(NULL), con->max_send_size);
 				}
                         	return SOCKET_TIMER_EVENT;
 			}
-			// We cannot send out the whole max_send_size data within this second.
+			// We cannot send out the whole max_send_size data within this slice.
 			// Update the counter
 			glob_afr_miss_due_network++;
 			// return here to calculate con->max_send_size again.
@@ -42,7 +42,17 @@
 
 #define MAX_BATCH_FD 64000
 
+/*
+ * proxyd sends up to PXY_FD_BATCH_MAX fds per datagram.
+ * This has to be in sync with bin/proxyd/pxy_server.h
+ */
+#define PXY_FD_BATCH_MAX 32
+/* datagrams read per wakeup */
+#define MAX_RECV_BATCH 64
+
 NKNCNT_DEF(l4_proxy_fd, AO_t, "", "Number of connections through acceptor")
+NKNCNT_DEF(l4_proxy_fd_batches, AO_t, "", "Number of fd batches through acceptor")
+NKNCNT_DEF(l4_proxy_fd_err, AO_t, "", "Number of bad fd batches through acceptor")
 static int domain_fd;
 static int active_intf;
 pthread_t acceptor_thread;
@@ -141,17 +151,20 @@ static int open_sock_dgram(const char *path)
 	return 0;
 }
 
-static int receive_fd(struct fd_struct* ptr)
+/*
+ * Read one datagram of proxyd: n fd_structs and n fds.
+ * Returns the number of fds, 0 when nothing is queued, -1 on error.
+ */
+static int receive_fds(struct fd_struct* ptr, int *connfd)
 {
 	struct msghdr msg;
   	struct iovec iov;
-  	int rv;
-  	int connfd = -1;
-  	char ccmsg[CMSG_SPACE(sizeof(connfd))];
+  	int rv, n, nfd, i;
+  	char ccmsg[CMSG_SPACE(sizeof(int) * PXY_FD_BATCH_MAX)];
   	struct cmsghdr *cmsg;
 
   	iov.iov_base = ptr;
-  	iov.iov_len = sizeof(struct fd_struct);
+  	iov.iov_len = sizeof(struct fd_struct) * PXY_FD_BATCH_MAX;
 
   	msg.msg_name = 0;
   	msg.msg_namelen = 0;
@@ -159,26 +172,44 @@ static int receive_fd(struct fd_struct* ptr)
   	msg.msg_iovlen = 1;
   	msg.msg_control = ccmsg;
   	msg.msg_controllen = sizeof(ccmsg); 
+  	msg.msg_flags = 0;
 
-  	rv = recvmsg(domain_fd, &msg, 0);
+  	rv = recvmsg(domain_fd, &msg, MSG_DONTWAIT);
   	if (rv == -1)
 	{
+		if (errno == EAGAIN) {
+			return 0;
+		}
 		DBG_LOG(MSG, MOD_NETWORK,
 			"Failure in recvmsg in acceptor");
     		return -1;
   	}
 
   	cmsg = CMSG_FIRSTHDR(&msg);
-  	if (!cmsg->cmsg_type == SCM_RIGHTS)
+  	if (!cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+	    cmsg->cmsg_type != SCM_RIGHTS)
 	{
 		DBG_LOG(MSG, MOD_NETWORK,
 			"got control message of unknown type in acceptor:%d",
-			cmsg->cmsg_type);
+			cmsg ? cmsg->cmsg_type : -1);
     		return -1;
   	}
 
-        DBG_LOG(MSG, MOD_NETWORK, "Succefully recved fd: %d\n", *(int*)CMSG_DATA(cmsg)) ;
-  	return *(int*)CMSG_DATA(cmsg);
+	nfd = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+	memcpy(connfd, CMSG_DATA(cmsg), nfd * sizeof(int));
+	n = rv / sizeof(struct fd_struct);
+	if (n != nfd || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+		DBG_LOG(MSG, MOD_NETWORK,
+			"acceptor: %d fd_structs for %d fds, flags 0x%x",
+			n, nfd, msg.msg_flags);
+		for (i = 0; i < nfd; i++) {
+			close(connfd[i]);
+		}
+		return -1;
+	}
+
+        DBG_LOG(MSG, MOD_NETWORK, "Succefully recved %d fds, first fd: %d\n", nfd, connfd[0]) ;
+  	return nfd;
 }
 
 
@@ -188,9 +219,11 @@ void *acceptor(void *arg)
 {
 	UNUSED_ARGUMENT(arg);
 	int count=0;
-	int connfd = 0, epollfd, timeout;
+	int epollfd, timeout;
+	int n, i, dgram;
+	int connfd[PXY_FD_BATCH_MAX];
 	struct epoll_event ev, events[MAX_BATCH_FD];
-	struct fd_struct local_fd_struct;
+	struct fd_struct local_fd_struct[PXY_FD_BATCH_MAX];
 
 	epollfd = epoll_create(1); //single unix domain fd
         if (epollfd < 0) {
@@ -218,17 +251,28 @@ void *acceptor(void *arg)
 			//Nothing came for 3secs
 			continue;
 		}
-		connfd = receive_fd(&local_fd_struct);
-		if(connfd==-1)
-		{
-			DBG_LOG(SEVERE, MOD_NETWORK, 
-				"Failure in receive_fd in acceptor");
-			continue;
+		/* Drain what proxyd has queued, a batch of fds per datagram */
+		for (dgram = 0; dgram < MAX_RECV_BATCH; dgram++) {
+			n = receive_fds(local_fd_struct, connfd);
+			if (n == 0) {
+				break;
+			}
+			if (n == -1) {
+				AO_fetch_and_add1(&glob_l4_proxy_fd_err);
+				DBG_LOG(SEVERE, MOD_NETWORK, 
+					"Failure in receive_fd in acceptor");
+				continue;
+			}
+			AO_fetch_and_add1(&glob_l4_proxy_fd_batches);
+			AO_fetch_and_add(&glob_l4_proxy_fd, n);
+			for (i = 0; i < n; i++) {
+				l4proxy_epollin(connfd[i],
+					local_fd_struct[i].listen_fd,
+					active_intf, 
+					(void*)&local_fd_struct[i].client_addr,
+					local_fd_struct[i].accepted_thr_num);
+			}
 		}
-		AO_fetch_and_add1(&glob_l4_proxy_fd);
-		l4proxy_epollin(connfd, local_fd_struct.listen_fd, active_intf, 
-				(void*)&local_fd_struct.client_addr,
-                                local_fd_struct.accepted_thr_num);
 	}
 }
 
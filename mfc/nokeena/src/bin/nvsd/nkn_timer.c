@@ -76,7 +76,6 @@ static void * logcleanup_func(void *arg)
 static void * timer_func(void * arg)
 {
 	static int count1sec=0;
-	static int count2sec=0;
 	static int count5sec=0;
 	int usecs, i;
 	struct timeval tv1, tv2;
@@ -114,9 +113,6 @@ static void * timer_func(void * arg)
 		/*
 		 * This block Functions are called once every 1 second.
 		 */
-		for(i=0;i<NM_tot_threads;i++) {
-			g_NM_thrs[i].cleanup_sbq=1;
-		}
 		for(i=0;i<MAX_NKN_INTERFACE;i++) {
             pns = &interface[i];
             if(pns->if_bandwidth > pns->if_totbytes_sent) {
@@ -131,16 +127,6 @@ static void * timer_func(void * arg)
 		server_timer_1sec();
 		nkn_update_combined_stats();
 		glob_shm_loop_created = max_shm_loop_created;
-		/*
-		 * This block Functions are called once every 2 seconds.
-		 */
-		/* ------------------------------------------------------ */
-		count2sec++;
-		if(count2sec >= 2) {
-			count2sec=0;
-			NM_timer();
-		}
-
 		/*
 		 * This block Functions are called once every 5 seconds.
 		 */
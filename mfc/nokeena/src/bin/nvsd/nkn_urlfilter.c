@@ -1,12 +1,11 @@
 /*
  * nkn_urlfilter.c -- URL Filter interface
  */
-#include <ctype.h>
 #include <string.h>
 
 #include "nkn_defs.h"
 #include "nkn_debug.h"
-#include "uf_utils.h"
+#include "nkn_uf_match.h"
 #include "nkn_urlfilter.h"
 
 namespace_uf_reject_t url_filter_lookup(const url_filter_config_t *cf,
@@ -19,13 +18,8 @@ namespace_uf_reject_t url_filter_lookup(const url_filter_config_t *cf,
     int urilen;
     u_int32_t attrs;
     int hdrcnt;
-    const char *key;
-    char *pkey;
-    int n;
-    nkn_trie_node_t pnd;
+    long n;
     const char *p;
-    int keylen;
-    int removed_slashes;
 
     if (get_known_header(hdr, MIME_HDR_X_NKN_DECODED_URI,
                          &uri, &urilen, &attrs, &hdrcnt)) {
@@ -35,7 +29,7 @@ namespace_uf_reject_t url_filter_lookup(const url_filter_config_t *cf,
         }
     }
 
-    if (!cf->uf_trie) {
+    if (!cf->uf_trie || !cf->uf_trie->match) {
 	/* Set default to accept */
 	ret = NS_UF_REJECT_NOACTION;
 	goto uri_size_check;
@@ -52,43 +46,34 @@ namespace_uf_reject_t url_filter_lookup(const url_filter_config_t *cf,
     	hostlen -= 3;
     }
 
-    // trie key: <HOSTNAME>/<URI absolute path> 
-    //   where HOSTNAME is upper case and URI contains no %XX encoding
+    // key: <HOSTNAME>/<URI absolute path> 
+    //   where HOSTNAME is matched case insensitive and URI contains no
+    //   %XX encoding, no key is built, see nkn_uf_match.h
 
-    key = alloca(hostlen + urilen + 1);
-    pkey = (char *)key;
-
-    for (n = 0; n < hostlen; n++) {
-	*(pkey++) = toupper(host[n]);
-    }
-    memcpy(pkey, uri, urilen);
-    ((char *)key)[hostlen + urilen] = '\0';
-
-    keylen = hostlen + urilen;
-    removed_slashes = CompressURLSlashes((char *)key, &keylen);
-   
-    n = nkn_trie_prefix_match(cf->uf_trie->trie, (char *)key, &pnd);
+    n = uf_match_lookup(cf->uf_trie->match, host, hostlen, uri, urilen);
     if (n) {
  	if (cf->uf_is_black_list) {
 	    ret = cf->uf_reject_action;
 	    DBG_LOG(MSG, MOD_URL_FILTER,
-		    "Black list: REJECT act=%d n=%d val=%ld key: \"%s\"", 
-		    ret, n, (long)pnd, key);
+		    "Black list: REJECT act=%d entry=%ld key: \"%.*s%.*s\"", 
+		    ret, n, hostlen, host, urilen, uri);
 	} else {
 	    ret = NS_UF_REJECT_NOACTION;
 	    DBG_LOG(MSG, MOD_URL_FILTER,
-		    "White list: ALLOW act=%d n=%d val=%ld key: \"%s\"",
-		    ret, n, (long)pnd, key);
+		    "White list: ALLOW act=%d entry=%ld key: \"%.*s%.*s\"",
+		    ret, n, hostlen, host, urilen, uri);
 	}
     } else {
  	if (cf->uf_is_black_list) {
 	    ret = NS_UF_REJECT_NOACTION;
 	    DBG_LOG(MSG, MOD_URL_FILTER,
-		    "Black list: ALLOW act=%d n=%d key: \"%s\"", ret, n, key);
+		    "Black list: ALLOW act=%d key: \"%.*s%.*s\"",
+		    ret, hostlen, host, urilen, uri);
 	} else {
 	    ret = cf->uf_reject_action;
 	    DBG_LOG(MSG, MOD_URL_FILTER,
-		    "White list: REJECT act=%d n=%d key: \"%s\"", ret, n, key);
+		    "White list: REJECT act=%d key: \"%.*s%.*s\"",
+		    ret, hostlen, host, urilen, uri);
 	}
     }
 
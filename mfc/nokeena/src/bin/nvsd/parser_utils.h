@@ -13,6 +13,10 @@
 #define _PARSER_UTILS_H
 
 #include <ctype.h>
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #ifndef ST_STRLEN
 #define ST_STRLEN(static_string) (sizeof(static_string) - 1)
@@ -114,11 +118,70 @@ nkn_find_digit_end(const char *p)
     return p - 1;
 }
 
+#ifdef __SSE2__
+/*
+ * SSE2 scanners.  Loads are 16 byte aligned so they never cross into an
+ * unmapped page, the bytes before p in the first block are masked off.
+ * Like the byte loops they replace, they rely on the byte being present
+ * (callers have a complete header terminated by '\n').
+ */
+static inline const char *
+nkn_sse2_find_lf(const char *p)
+{
+    const __m128i lf = _mm_set1_epi8('\n');
+    const char *pa = (const char *)((uintptr_t)p & ~(uintptr_t)15);
+    unsigned int mask;
+
+    mask = _mm_movemask_epi8(_mm_cmpeq_epi8(
+		_mm_load_si128((const __m128i *)pa), lf));
+    mask &= ~0U << (p - pa);
+    while (!mask) {
+	pa += 16;
+	mask = _mm_movemask_epi8(_mm_cmpeq_epi8(
+		    _mm_load_si128((const __m128i *)pa), lf));
+    }
+    return pa + __builtin_ctz(mask);
+}
+
+/* First ':', ' ' or '\n' */
+static inline const char *
+nkn_sse2_find_name_delim(const char *p)
+{
+    const __m128i colon = _mm_set1_epi8(':');
+    const __m128i sp = _mm_set1_epi8(' ');
+    const __m128i lf = _mm_set1_epi8('\n');
+    const char *pa = (const char *)((uintptr_t)p & ~(uintptr_t)15);
+    __m128i v;
+    unsigned int mask;
+
+    v = _mm_load_si128((const __m128i *)pa);
+    mask = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(
+		_mm_cmpeq_epi8(v, colon), _mm_cmpeq_epi8(v, sp)),
+		_mm_cmpeq_epi8(v, lf)));
+    mask &= ~0U << (p - pa);
+    while (!mask) {
+	pa += 16;
+	v = _mm_load_si128((const __m128i *)pa);
+	mask = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(
+		    _mm_cmpeq_epi8(v, colon), _mm_cmpeq_epi8(v, sp)),
+		    _mm_cmpeq_epi8(v, lf)));
+    }
+    return pa + __builtin_ctz(mask);
+}
+#endif
+
 // caller should skip name leading space.
 // trailing space is NOT part of name
 static inline const char *
 nkn_find_hdrname_end(const char *p)
 {
+#ifdef __SSE2__
+    p = nkn_sse2_find_name_delim(p);
+    if (*p == '\n') {
+	return p;		// didn't find ':' before '\n'
+    }
+    return p - 1;		// before ' ' or ':' (case: only :)
+#else
     const char *ps = p;
     while (*p != ':') {
 	if (*p == ' ') {
@@ -133,6 +196,7 @@ nkn_find_hdrname_end(const char *p)
     if (ps == p)
 	return p;		// case: only :
     return p;
+#endif
 }
 
 // caller should skip value leading space.
@@ -146,9 +210,13 @@ nkn_find_hdrvalue_end(const char *p)
 	 * BZ 3354, 3360
 	 */
 	while (*p != '\n') {
+#ifdef __SSE2__
+		p = nkn_sse2_find_lf(p);
+#else
 		while (*p != '\n') {
 			p++;
 		}
+#endif
 		if ( *(p+1) == ' ' || *(p+1) == '\t' )
 			p++;
 	}
@@ -164,6 +232,69 @@ nkn_find_hdrvalue_end(const char *p)
 	return p - 1;		// case: aaa\n
 }
 
+/*
+ * Find the end of a header block in p[0..len-1]: the first "\r\n\r\n" or
+ * "\n\n".  Returns a pointer just past it, NULL if it is not there yet.
+ * *nul_seen is set if a '\0' comes before the end (before the last byte
+ * when it is not found).  '\n' and '\0' are found in one pass, every
+ * terminator has its first '\n' at p or p+1 and only those are checked.
+ */
+static inline const char *
+nkn_find_hdrblock_end(const char *p, int len, int *nul_seen)
+{
+    const char *pe = p + len;
+    const char *q = p;
+#ifdef __SSE2__
+    int i;
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i nul = _mm_setzero_si128();
+    __m128i v;
+    unsigned int mask;
+#endif
+
+    *nul_seen = 0;
+    if (len < 2)
+	return NULL;
+#ifdef __SSE2__
+    for (; q + 16 <= pe; q += 16) {
+	v = _mm_loadu_si128((const __m128i *)q);
+	mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, lf),
+					      _mm_cmpeq_epi8(v, nul)));
+	while (mask) {
+	    i = __builtin_ctz(mask);
+	    mask &= mask - 1;
+	    if (q[i] == '\0') {
+		if (q + i < pe - 1)
+		    *nul_seen = 1;
+		continue;
+	    }
+	    // "\r\n\r\n" starting one byte back
+	    if (q + i > p && q + i + 2 < pe && q[i - 1] == '\r' &&
+		q[i + 1] == '\r' && q[i + 2] == '\n')
+		return q + i + 3;
+	    // "\n\n"
+	    if (q + i + 1 < pe && q[i + 1] == '\n')
+		return q + i + 2;
+	}
+    }
+#endif
+    for (; q < pe; q++) {
+	if (*q == '\0') {
+	    if (q < pe - 1)
+		*nul_seen = 1;
+	    continue;
+	}
+	if (*q != '\n')
+	    continue;
+	if (q > p && q + 2 < pe && q[-1] == '\r' &&
+	    q[1] == '\r' && q[2] == '\n')
+	    return q + 3;
+	if (q + 1 < pe && q[1] == '\n')
+	    return q + 2;
+    }
+    return NULL;
+}
+
 // Skips SP  0x20 ref:RFC (HTTP/RTSP)
 static inline const char *
 nkn_skip_SP(const char *p)
@@ -20,8 +20,16 @@
 #define __USE_MISC
 #endif
 #include <netinet/tcp.h>
+#include <linux/filter.h>
 #include <openssl/md5.h>
 
+#ifndef SO_MAX_PACING_RATE
+#define SO_MAX_PACING_RATE	47
+#endif
+#ifndef TCP_NOTSENT_LOWAT
+#define TCP_NOTSENT_LOWAT	25
+#endif
+
 #include "nkn_http.h"
 #include "nvsd_mgmt.h"
 #include "nkn_debug.h"
@@ -56,6 +64,22 @@
 #define SO_REUSEPORT 15
 #endif
 
+#ifndef SO_INCOMING_CPU
+#define SO_INCOMING_CPU 49
+#endif
+
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+#define SO_ATTACH_REUSEPORT_CBPF 51
+#endif
+
+#ifndef SKF_AD_CPU
+#define SKF_AD_CPU 36
+#endif
+
+#ifndef BPF_MOD
+#define BPF_MOD 0x90
+#endif
+
 #ifndef IP_INDEV
 #define IP_INDEV 125
 #endif
@@ -85,6 +109,7 @@ char **http_listen_intfname;
 int http_listen_intfcnt = 0;
 int max_dns_pend_q = 5000;
 int nkn_http_ipv6_enable = 0;
+int nkn_kernel_pacing_enable = 1;
 // Local interface IP hash table data
 hash_entry_t hash_local_ip[128];
 static pthread_mutex_t hash_local_ip_lock[128];
@@ -99,11 +124,16 @@ typedef struct date_str {
 	char date[128];
 } date_str_t;
 
-static date_str_t cur_datestr_array[2];
-static volatile int cur_datestr_idx = 1;
+/*
+ * Date: string of nkn_cur_ts, formatted at most once a second by each
+ * thread that asks for it.
+ */
+static __thread date_str_t t_datestr;
+static __thread time_t t_datestr_ts = -1;
 
 extern int glob_tot_get_in_this_second;
 extern int nkn_timer_interval;
+extern int nkn_resource_pool_enable;
 extern nkn_lockstat_t epolllockstat[MAX_EPOLL_THREADS];
 extern int dynamic_uri_enable;
 
@@ -188,10 +218,15 @@ NKNCNT_DEF(tot_bytes_recv, uint64_t, "Bytes", "Total received bytes from socket"
 NKNCNT_DEF(tot_bytes_tobesent, AO_t, "Bytes", "Total Bytes received from CM and wait socket for sending")
 NKNCNT_DEF(warn_failed_sendout, AO_t, "Bytes", "Total Bytes failed to send out")
 NKNCNT_DEF(accept_queue_100, uint64_t, "", "times of accept queue when larger than 100")
+NKNCNT_DEF(accept_cpu_local, uint64_t, "", "accepted sockets received on the CPU of the network thread")
+NKNCNT_DEF(accept_cpu_remote, uint64_t, "", "accepted sockets received on another CPU")
 NKNCNT_DEF(err_pipeline_req, uint64_t, "", "num of pipeline request")
 NKNCNT_DEF(warn_socket_no_recv_data, uint64_t, "", "num of sockets closed without any data received")
 NKNCNT_DEF(warn_socket_no_send_data, uint64_t, "", "num of sockets closed without any data sent")
 NKNCNT_DEF(overflow_socket_due_afr, uint64_t, "", "num of sockets closed due to AFR limit")
+NKNCNT_DEF(tot_kernel_paced_conns, AO_t, "", "num of sockets paced by the kernel")
+NKNCNT_DEF(kernel_pacing_updates, AO_t, "", "num of socket pacing rate updates")
+NKNCNT_DEF(kernel_pacing_fallback, AO_t, "", "num of times a socket fell back to sbq pacing")
 NKNCNT_DEF(err_taskid_not_match, uint64_t, "", "Scheduler returned id does not match")
 NKNCNT_DEF(err_cptr_already_freed, uint64_t, "", "Scheduler returned task with already freed cptr")
 NKNCNT_DEF(err_timeout_with_task, AO_t, "", "Connection timed out but a task is being hold by scheduler")
@@ -1227,11 +1262,17 @@ http_try_to_sendout_data(con_t *con)
                 * Due to Bandwidth limitation
                  * Additional check to see, if we used the timeslot wisely.
                  * We should be sending atleast MBR for a single timeslot, if not
-                 * fetch more data and send it, as below
+                 * fetch more data and send it, as below.
+                 * max_send_size is a per slice quota, so compare it with the
+                 * MBR share of one slice.
                 */
                 if ( con->max_bandwidth == 0 ||
-			(con->max_send_size < con->max_bandwidth) || (con->max_faststart_buf > 0)) {
+			CHECK_CON_FLAG(con, CONF_KERNEL_PACED) ||
+			(con->max_send_size < con->max_bandwidth /
+			 (nkn_timer_interval * NM_SBQ_SLICES_PER_SEC)) ||
+			(con->max_faststart_buf > 0)) {
                     // Otherwise session bandwidth feature is not enabled
+                    // or the kernel paces this socket
                     NM_del_event_epoll(con->fd);
                     if (nkn_post_sched_task_again(con) == FALSE) {
                         DBG_LOG(MSG, MOD_HTTP, "Post sched task again call to BM failed");
@@ -1242,24 +1283,13 @@ http_try_to_sendout_data(con_t *con)
 		// Otherwise when session bandwidth is configured, follow through the next case
 	case SOCKET_TIMER_EVENT:
 		/*
-		 * AFR case, wait for next second time slot to send next data.
+		 * AFR case, wait for next time slice to send next data.
 		 */
 		NM_del_event_epoll(con->fd);
-		{
-			// put it into time wait queue
-			struct network_mgr * pnm;
-
-			// If session bandwidth feature is enabled,
-			// we will count on timer to post next sched task
-			pnm=&gnm[con->fd];
-			NKN_MUTEX_LOCKSTAT(&pnm->pthr->nm_mutex, &nm_lockstat[pnm->pthr->num]);
-			if (NM_CHECK_FLAG(pnm, NMF_IN_SBQ) ) {
-				LIST_REMOVE(pnm, sbq_entries);
-			}
-			LIST_INSERT_HEAD( &(pnm->pthr->sbq_head[pnm->pthr->cur_sbq]), pnm, sbq_entries);
-			NM_SET_FLAG(pnm, NMF_IN_SBQ);
-			NKN_MUTEX_UNLOCKSTAT(&pnm->pthr->nm_mutex);
-		}
+
+		// If session bandwidth feature is enabled,
+		// we will count on the pacing wheel to post next sched task
+		NM_sbq_add(&gnm[con->fd], con->pace_msecs + NM_SBQ_SLICE_MSECS);
 		break;
         case SOCKET_CLOSED:
 		/*
@@ -2976,19 +3006,8 @@ tmrq_add_event(int fd, tmrq_event_type_t type)
 
 void server_timer_1sec(void)
 {
-	int next_datestr_idx;
-	date_str_t *next;
-
-	if (cur_datestr_idx) {
-		next_datestr_idx = 0;
-	} else {
-		next_datestr_idx = 1;
-	}
-	next = &cur_datestr_array[next_datestr_idx];
 	time(&nkn_cur_ts);
 	glob_nkn_cur_ts = nkn_cur_ts;
-	mk_rfc1123_time(&nkn_cur_ts, next->date, sizeof(cur_datestr_array[0].date), &next->length);
-	cur_datestr_idx = next_datestr_idx;
 
 	// For HTTP GET attack counters
 	glob_tot_get_in_this_second=0;
@@ -2996,12 +3015,18 @@ void server_timer_1sec(void)
 
 inline char *nkn_get_datestr(int *datestr_len)
 {
-	date_str_t *cur = &cur_datestr_array[cur_datestr_idx];
+	time_t now = nkn_cur_ts;
+
+	if (now != t_datestr_ts) {
+		mk_rfc1123_time(&now, t_datestr.date, sizeof(t_datestr.date),
+				&t_datestr.length);
+		t_datestr_ts = now;
+	}
 	if (datestr_len) {
-		*datestr_len = cur->length;
+		*datestr_len = t_datestr.length;
 	}
 
-	return cur->date;
+	return t_datestr.date;
 }
 
 /*
@@ -3745,12 +3770,7 @@ int reset_http_cb(con_t * con)
 	 * So I move to here.
 	 */
 	pnm = &gnm[con->fd];
-	NKN_MUTEX_LOCKSTAT(&pnm->pthr->nm_mutex, &nm_lockstat[pnm->pthr->num]);
-	if (NM_CHECK_FLAG(pnm, NMF_IN_SBQ) ) {
-               	LIST_REMOVE(pnm, sbq_entries);
-		NM_UNSET_FLAG(pnm, NMF_IN_SBQ);
-	}
-	NKN_MUTEX_UNLOCKSTAT(&pnm->pthr->nm_mutex);
+	NM_UNSET_FLAG(pnm, NMF_IN_SBQ);
 
 	/* Requirement 2.1 - 34. 
 	 * Reduce session count for this namespace.
@@ -3994,6 +4014,95 @@ void con_set_afr(con_t *con, uint64_t afr)
 	/* calculate accumulated max_allowed_bw */
 }
 
+/*
+ * Hand the session bandwidth (MBR, or 1.2 * AFR) of this connection to
+ * the kernel with SO_MAX_PACING_RATE, so that data leaves the socket
+ * evenly paced instead of in one burst per second through the sbq.
+ * The per session share of the namespace resource pool caps the rate;
+ * a resource pool rebalance is picked up here on the next send.
+ *
+ * return TRUE when the kernel paces this connection.
+ */
+int con_update_pacing(con_t *con)
+{
+	uint64_t rate = 0;
+	uint64_t share, diff;
+	unsigned int sk_rate;
+	int lowat;
+
+	if (nkn_kernel_pacing_enable && con->max_bandwidth &&
+	    (con->max_faststart_buf == 0)) {
+		rate = con->max_bandwidth;
+		if (nkn_resource_pool_enable && con->http.nsconf) {
+			share = nvsd_rp_bw_query_pace_rate(con->http.nsconf->rp_index);
+			if (share && (share < rate)) {
+				rate = share;
+			}
+		}
+	}
+
+	if (rate == 0) {
+		if (CHECK_CON_FLAG(con, CONF_KERNEL_PACED)) {
+			// Back to user space pacing, recalculate max_send_size
+			sk_rate = ~0U;
+			setsockopt(con->fd, SOL_SOCKET, SO_MAX_PACING_RATE,
+				   &sk_rate, sizeof(sk_rate));
+			UNSET_CON_FLAG(con, CONF_KERNEL_PACED);
+			con->paced_rate = 0;
+			con->max_send_size = 0;
+			con->bandwidth_send_size = 0;
+		}
+		return FALSE;
+	}
+
+	/* Only tell the kernel when the rate moves by more than 1/16 */
+	if (CHECK_CON_FLAG(con, CONF_KERNEL_PACED)) {
+		diff = (rate > con->paced_rate) ?
+			rate - con->paced_rate : con->paced_rate - rate;
+		if (diff <= (con->paced_rate >> 4)) {
+			return TRUE;
+		}
+	}
+
+	sk_rate = (rate >= ~0U) ? ~0U - 1 : (unsigned int)rate;
+	if (setsockopt(con->fd, SOL_SOCKET, SO_MAX_PACING_RATE,
+		       &sk_rate, sizeof(sk_rate)) != 0) {
+		if (errno == ENOPROTOOPT) {
+			DBG_LOG(WARNING, MOD_NETWORK,
+				"SO_MAX_PACING_RATE not supported, "
+				"session bandwidth paced by sbq");
+			nkn_kernel_pacing_enable = 0;
+		}
+		glob_kernel_pacing_fallback++;
+		if (CHECK_CON_FLAG(con, CONF_KERNEL_PACED)) {
+			UNSET_CON_FLAG(con, CONF_KERNEL_PACED);
+			con->paced_rate = 0;
+			con->max_send_size = 0;
+			con->bandwidth_send_size = 0;
+		}
+		return FALSE;
+	}
+
+	/*
+	 * Keep about 250 msec of data unsent in the socket, so that
+	 * EPOLLOUT wakes us up before the pacer runs dry.
+	 */
+	lowat = (int)((rate / 4 < 16 * 1024) ? 16 * 1024 :
+		      (rate / 4 > 1024 * 1024) ? 1024 * 1024 : rate / 4);
+	setsockopt(con->fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+		   &lowat, sizeof(lowat));
+
+	if (!CHECK_CON_FLAG(con, CONF_KERNEL_PACED)) {
+		SET_CON_FLAG(con, CONF_KERNEL_PACED);
+		AO_fetch_and_add1(&glob_tot_kernel_paced_conns);
+	}
+	con->paced_rate = rate;
+	AO_fetch_and_add1(&glob_kernel_pacing_updates);
+	DBG_LOG(MSG, MOD_NETWORK, "con=%p fd=%d paced at %lu Bytes/sec",
+		con, con->fd, rate);
+	return TRUE;
+}
+
 void init_conn(int svrfd, int sockfd, nkn_interface_t * pns, nkn_interface_t * ppns, struct sockaddr_storage * addr, int thr_num)
 {
     con_t *con;
@@ -4324,6 +4433,69 @@ int cache_index_md5tostr(unsigned char md5[], char md5str[], int len) {
  * we need to provde epollin/epollout/epollerr/epollhup functions
  */
 
+/*
+ * nm_cpu_steer: listen socket k of a port belongs to network thread k,
+ * which is pinned to CPU k % glob_num_of_processor.  The kernel should
+ * pick the listen socket of the CPU which received the SYN, so that the
+ * connection is served on the CPU (and NUMA node) of its NIC queue.
+ */
+extern int glob_num_of_processor;
+
+static void http_listen_set_cpu(int listenfd, int k)
+{
+	int cpu;
+
+	if (nm_cpu_steer != NM_CPU_STEER_INCOMING_CPU) {
+		return;
+	}
+	cpu = k % glob_num_of_processor;
+	if (setsockopt(listenfd, SOL_SOCKET, SO_INCOMING_CPU,
+		       &cpu, sizeof(cpu)) < 0) {
+		DBG_LOG(WARNING, MOD_HTTP,
+			"Failed to set SO_INCOMING_CPU %d on fd %d. errno = %d",
+			cpu, listenfd, errno);
+	}
+}
+
+/*
+ * Select the listen socket with "rx cpu % n".  The reuseport group
+ * indexes its sockets in bind() order, which is the network thread order
+ * as long as none of them failed.  Attaching to one socket is enough.
+ */
+static void http_listen_attach_cbpf(int listenfd, int n)
+{
+	struct sock_filter code[] = {
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_CPU),
+		BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, n),
+		BPF_STMT(BPF_RET | BPF_A, 0),
+	};
+	struct sock_fprog prog;
+
+	prog.len = sizeof(code) / sizeof(code[0]);
+	prog.filter = code;
+	if (setsockopt(listenfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+		       &prog, sizeof(prog)) < 0) {
+		DBG_LOG(WARNING, MOD_HTTP,
+			"Failed to attach reuseport BPF on fd %d. errno = %d",
+			listenfd, errno);
+	}
+}
+
+static void http_accept_cpu_check(int clifd)
+{
+	int cpu;
+	socklen_t len = sizeof(cpu);
+
+	if (getsockopt(clifd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) < 0) {
+		return;
+	}
+	if (cpu == nm_thr_num % glob_num_of_processor) {
+		glob_accept_cpu_local++;
+	} else {
+		glob_accept_cpu_remote++;
+	}
+}
+
 static int httpsvr_epollin(int sockfd, void * private_data)
 {
 	int clifd;
@@ -4354,6 +4526,9 @@ static int httpsvr_epollin(int sockfd, void * private_data)
 		return TRUE;
 	}
 	nkn_mark_fd(clifd, NETWORK_FD);
+	if (nm_cpu_steer) {
+		http_accept_cpu_check(clifd);
+	}
 
     if (NKN_IF_ALIAS == pns->if_type) {
         if (getsockopt(clifd, SOL_IP, IP_INDEV, if_name, &if_len) < 0) {
@@ -4548,8 +4723,8 @@ int http_if4_finit(nkn_interface_t *pns, int alias /* 0 = alias unlocked, 1 = lo
 
 int http_if4_init(nkn_interface_t *pns) {
     struct sockaddr_in srv;
-    int ret, val, j, k;
-    int listenfd;
+    int ret, val, j, k, n;
+    int listenfd, firstfd;
     network_mgr_t *pnm = NULL;
     char name[64];
 
@@ -4568,6 +4743,8 @@ int http_if4_init(nkn_interface_t *pns) {
         if (0 == nkn_http_serverport[j]) {
             continue;
         }
+	n = 0;
+	firstfd = -1;
 	for (k = 0; k < NM_tot_threads; k++) {
 	    if ((listenfd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
 		DBG_LOG(SEVERE, MOD_HTTP, "Failed to create IPv4 socket. errno = %d", errno);
@@ -4595,6 +4772,7 @@ int http_if4_init(nkn_interface_t *pns) {
 		nkn_close_fd(listenfd, NETWORK_FD);
 		continue;
 	    }
+	    http_listen_set_cpu(listenfd, k);
 
 	    memset(&srv, 0, sizeof(srv));
 	    srv.sin_family = AF_INET;
@@ -4620,6 +4798,11 @@ int http_if4_init(nkn_interface_t *pns) {
 	    pns->port[j] = nkn_http_serverport[j];
 	    pns->listenfd[j][k] = listenfd;
 
+	    if (nm_cpu_steer) {
+		// register_NM_socket() puts it on network thread k
+		gnm[listenfd].accepted_thr_num = k;
+		NM_SET_FLAG(&gnm[listenfd], NMF_STEER_LISTEN);
+	    }
 	    if (register_NM_socket(listenfd, 
 		pns,
 		httpsvr_epollin,
@@ -4640,6 +4823,13 @@ int http_if4_init(nkn_interface_t *pns) {
 	    gnm[listenfd].accepted_thr_num = gnm[listenfd].pthr->num;
 	    glob_tot_svr_sockets++;
 	    AO_store(&pns->if_listening, 1);
+	    if (firstfd == -1) {
+		firstfd = listenfd;
+	    }
+	    n++;
+	}
+	if ((nm_cpu_steer == NM_CPU_STEER_BPF) && (firstfd != -1)) {
+	    http_listen_attach_cbpf(firstfd, n);
 	}
     }
 
@@ -20,6 +20,7 @@ extern int DM_cleanup(void);
 extern void exit_counters(void);
 extern void nkn_unload_netstack(void);
 extern void virt_cache_server_exit(void);
+extern int DM2_shutdown(void);
 int server_exit(void);
 /*
  * All exit functions should go here.
@@ -41,6 +42,7 @@ int server_exit(void)
 	exit_counters();
 
         virt_cache_server_exit();
+	DM2_shutdown();
 	nvsd_mgmt_deinit();
 	if(net_use_nkn_stack) nkn_unload_netstack();    // Initialize the user space net stack
 	log_thread_end();
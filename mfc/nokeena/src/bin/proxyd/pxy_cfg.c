@@ -23,6 +23,11 @@
 #include "nkn_cfg_params.h"
 
 int use_client_ip=0;
+extern int pxy_tunnel_splice;
+extern int pxy_tunnel_pipe_pool_max;
+extern int pxy_tunnel_splice_max_pipes;
+extern int pxy_fd_batch_max;
+extern int pxy_fd_batch_usec;
 
 
 ////////////////////////////////////////////////////////////////////////
@@ -46,6 +51,11 @@ static struct nkncfg_def {
 } cfgdef[] = 
 {
 //    { "use_client_ip", TYPE_INT, &use_client_ip, NULL }, 
+    { "tunnel_splice.enable", TYPE_INT, &pxy_tunnel_splice, NULL },
+    { "tunnel_splice.pipe_pool", TYPE_INT, &pxy_tunnel_pipe_pool_max, NULL },
+    { "tunnel_splice.max_pipes", TYPE_INT, &pxy_tunnel_splice_max_pipes, NULL },
+    { "fd_handoff.batch_max", TYPE_INT, &pxy_fd_batch_max, NULL },
+    { "fd_handoff.batch_usec", TYPE_INT, &pxy_fd_batch_usec, NULL },
 
     { NULL,          TYPE_INT,    NULL,                NULL   }
 };
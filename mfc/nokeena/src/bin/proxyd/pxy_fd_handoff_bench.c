@@ -0,0 +1,319 @@
+/*
+ * pxy_fd_handoff_bench: accepted connections/second that proxyd hands to
+ * nvsd over the unix datagram socket, one fd per sendmsg() (as before)
+ * against batches of up to PXY_FD_BATCH_MAX fds per datagram.
+ *
+ * Client threads open and close loopback connections as fast as they
+ * can.  The proxy thread accepts them the way pxy_httpsvr_epollin()
+ * does and hands every fd over; the acceptor thread receives them the
+ * way bin/nvsd/nkn_recvfd.c does and closes them.  Reported are the fds
+ * received per second, the datagrams used and the average wait of an fd
+ * in a batch.
+ *
+ * build: gcc -O2 -D_GNU_SOURCE pxy_fd_handoff_bench.c \
+ *		-o pxy_fd_handoff_bench -lpthread
+ *
+ * usage: pxy_fd_handoff_bench [-t seconds_per_run] [-c client_threads]
+ *        [-u batch_usec]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define PXY_FD_BATCH_MAX	32	// as pxy_server.h
+#define MAX_RECV_BATCH		64	// as nkn_recvfd.c
+#define MAX_CLIENTS		16
+
+/* as pxy_server.h */
+struct fd_struct {
+	int listen_fd;
+	int32_t accepted_thr_num;
+	struct sockaddr_in client_addr;
+	struct sockaddr_in dst_addr;
+};
+
+typedef struct fd_batch {
+	int cnt;
+	uint64_t first_ts;
+	int cli_fd[PXY_FD_BATCH_MAX];
+	struct fd_struct fds[PXY_FD_BATCH_MAX];
+} fd_batch_t;
+
+static struct sockaddr_in lsn_addr;
+static int lsn_fd;
+static int unix_fd[2];		// [0] proxyd, [1] nvsd
+static int batch_max;
+static int batch_usec = 200;
+static volatile int stop;
+static volatile int stop_acceptor;	// after the proxy, which may block
+static volatile uint64_t received;
+static uint64_t datagrams;
+static uint64_t wait_usec, waited;
+
+static uint64_t mono_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void *client(void *arg)
+{
+	struct linger lg = { 1, 0 };	// reset, no TIME_WAIT port use
+	struct timeval tv = { 0, 100000 };
+	int fd;
+
+	(void)arg;
+	while (!stop) {
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd < 0) {
+			usleep(100);
+			continue;
+		}
+		setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+		connect(fd, (struct sockaddr *)&lsn_addr, sizeof(lsn_addr));
+		close(fd);
+	}
+	return NULL;
+}
+
+/* pxy_transfer_fd_to_nvsd() */
+static void flush(fd_batch_t *b)
+{
+	char ccmsg[CMSG_SPACE(sizeof(int) * PXY_FD_BATCH_MAX)];
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec vec;
+	uint64_t now;
+	int i, fdlen;
+
+	if (b->cnt == 0) {
+		return;
+	}
+	fdlen = sizeof(int) * b->cnt;
+	memset(ccmsg, 0, sizeof(ccmsg));
+	memset(&msg, 0, sizeof(msg));
+	vec.iov_base = b->fds;
+	vec.iov_len = sizeof(struct fd_struct) * b->cnt;
+	msg.msg_iov = &vec;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ccmsg;
+	msg.msg_controllen = CMSG_SPACE(fdlen);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(fdlen);
+	memcpy(CMSG_DATA(cmsg), b->cli_fd, fdlen);
+
+	if (sendmsg(unix_fd[0], &msg, 0) == -1) {
+		perror("sendmsg");
+		exit(1);
+	}
+	now = mono_usec();
+	wait_usec += (now - b->first_ts) * b->cnt;
+	waited += b->cnt;
+	for (i = 0; i < b->cnt; i++) {
+		close(b->cli_fd[i]);
+	}
+	b->cnt = 0;
+}
+
+/* pxy_httpsvr_epollin() */
+static void *proxy(void *arg)
+{
+	struct epoll_event ev;
+	struct sockaddr_in s_addr, d_addr;
+	socklen_t len;
+	fd_batch_t b;
+	int epfd, fd;
+
+	(void)arg;
+	epfd = epoll_create(1);
+	ev.events = EPOLLIN;
+	ev.data.fd = lsn_fd;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, lsn_fd, &ev);
+	b.cnt = 0;
+
+	while (!stop) {
+		if (epoll_wait(epfd, &ev, 1, 100) <= 0) {
+			continue;
+		}
+		while (1) {
+			len = sizeof(s_addr);
+			fd = accept(lsn_fd, (struct sockaddr *)&s_addr, &len);
+			if (fd == -1) {
+				flush(&b);
+				break;
+			}
+			len = sizeof(d_addr);
+			getsockname(fd, (struct sockaddr *)&d_addr, &len);
+
+			if (b.cnt == 0) {
+				b.first_ts = mono_usec();
+			}
+			b.fds[b.cnt].listen_fd = lsn_fd;
+			b.fds[b.cnt].accepted_thr_num = 0;
+			b.fds[b.cnt].client_addr = s_addr;
+			b.fds[b.cnt].dst_addr = d_addr;
+			b.cli_fd[b.cnt++] = fd;
+			if (b.cnt >= batch_max ||
+			    mono_usec() - b.first_ts >= (uint64_t)batch_usec) {
+				flush(&b);
+			}
+		}
+	}
+	close(epfd);
+	return NULL;
+}
+
+/* acceptor() of nkn_recvfd.c */
+static void *acceptor(void *arg)
+{
+	char ccmsg[CMSG_SPACE(sizeof(int) * PXY_FD_BATCH_MAX)];
+	struct fd_struct fds[PXY_FD_BATCH_MAX];
+	struct epoll_event ev;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	uint64_t cnt = 0;
+	int epfd, rv, nfd, i, dgram, fd;
+
+	(void)arg;
+	epfd = epoll_create(1);
+	ev.events = EPOLLIN;
+	ev.data.fd = unix_fd[1];
+	epoll_ctl(epfd, EPOLL_CTL_ADD, unix_fd[1], &ev);
+
+	while (!stop_acceptor) {
+		if (epoll_wait(epfd, &ev, 1, 100) <= 0) {
+			continue;
+		}
+		/* one datagram a wakeup before, drained now */
+		for (dgram = 0; dgram < (batch_max > 1 ? MAX_RECV_BATCH : 1);
+		     dgram++) {
+			memset(&msg, 0, sizeof(msg));
+			iov.iov_base = fds;
+			iov.iov_len = sizeof(fds);
+			msg.msg_iov = &iov;
+			msg.msg_iovlen = 1;
+			msg.msg_control = ccmsg;
+			msg.msg_controllen = sizeof(ccmsg);
+			rv = recvmsg(unix_fd[1], &msg, MSG_DONTWAIT);
+			if (rv == -1) {
+				break;
+			}
+			cmsg = CMSG_FIRSTHDR(&msg);
+			if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS) {
+				continue;
+			}
+			nfd = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			for (i = 0; i < nfd; i++) {
+				memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int),
+				       sizeof(int));
+				close(fd);
+			}
+			cnt += nfd;
+			datagrams++;
+		}
+		received = cnt;
+	}
+	close(epfd);
+	return NULL;
+}
+
+static void run(int nclients, int batch, int seconds)
+{
+	pthread_t ctid[MAX_CLIENTS], ptid, atid;
+	uint64_t start, usec, cnt;
+	int i;
+
+	batch_max = batch;
+	stop = stop_acceptor = 0;
+	received = datagrams = wait_usec = waited = 0;
+	pthread_create(&ptid, NULL, proxy, NULL);
+	pthread_create(&atid, NULL, acceptor, NULL);
+	for (i = 0; i < nclients; i++) {
+		pthread_create(&ctid[i], NULL, client, NULL);
+	}
+
+	start = mono_usec();
+	sleep(seconds);
+	cnt = received;
+	usec = mono_usec() - start;
+	stop = 1;
+	for (i = 0; i < nclients; i++) {
+		pthread_join(ctid[i], NULL);
+	}
+	pthread_join(ptid, NULL);
+	stop_acceptor = 1;
+	pthread_join(atid, NULL);
+
+	printf("batch=%2d  %9.0f conn/s  %6.1f fds/datagram  "
+	       "wait %6.1f usec\n", batch, cnt * 1e6 / usec,
+	       datagrams ? (double)cnt / datagrams : 0.0,
+	       waited ? (double)wait_usec / waited : 0.0);
+}
+
+int main(int argc, char **argv)
+{
+	socklen_t len = sizeof(lsn_addr);
+	int seconds = 3, nclients = 4, c, on = 1;
+
+	while ((c = getopt(argc, argv, "t:c:u:")) != -1) {
+		switch (c) {
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		case 'c':
+			nclients = atoi(optarg);
+			if (nclients > MAX_CLIENTS) {
+				nclients = MAX_CLIENTS;
+			}
+			break;
+		case 'u':
+			batch_usec = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-t seconds_per_run] "
+				"[-c client_threads] [-u batch_usec]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+
+	lsn_fd = socket(AF_INET, SOCK_STREAM, 0);
+	setsockopt(lsn_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	memset(&lsn_addr, 0, sizeof(lsn_addr));
+	lsn_addr.sin_family = AF_INET;
+	lsn_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(lsn_fd, (struct sockaddr *)&lsn_addr, sizeof(lsn_addr)) < 0 ||
+	    listen(lsn_fd, 10000) < 0 ||
+	    getsockname(lsn_fd, (struct sockaddr *)&lsn_addr, &len) < 0) {
+		perror("listen");
+		return 1;
+	}
+	fcntl(lsn_fd, F_SETFL, O_RDWR | O_NONBLOCK);
+	if (socketpair(AF_UNIX, SOCK_DGRAM, 0, unix_fd) < 0) {
+		perror("socketpair");
+		return 1;
+	}
+
+	run(nclients, 1, seconds);
+	run(nclients, PXY_FD_BATCH_MAX, seconds);
+	return 0;
+}
@@ -37,6 +37,7 @@
 NKNCNT_DEF(pxy_tot_blocked_sockets, AO_t, "", "Total blocked socket")
 NKNCNT_DEF(pxy_tot_cacheable_sockets, AO_t, "", "Total cacheable socket")
 NKNCNT_DEF(pxy_tot_tunnel_sockets, AO_t, "", "Total proxy socket")
+NKNCNT_DEF(pxy_tot_fd_batches, AO_t, "", "Total fd batches sent to nvsd")
 
 int           http_idle_timeout = 60;
 int           http_listen_intfcnt = 0;
@@ -65,72 +66,136 @@ pxy_open_unix_fd (const char * path)
   	return (unix_socket_fd == -1) ? 0 : 1;
 }
 
+/*
+ * Accepted fds for nvsd are handed over in batches: one datagram carries
+ * up to fd_handoff.batch_max fd_structs in its data and the fds in a
+ * single SCM_RIGHTS message.  A batch is sent when it is full, when
+ * accept() runs dry or when its first fd has waited fd_handoff.batch_usec,
+ * so a connection storm costs one sendmsg() and one nvsd wakeup per batch
+ * while a lone connection is not held back.
+ */
+int pxy_fd_batch_max = PXY_FD_BATCH_MAX;
+int pxy_fd_batch_usec = 200;
+
+typedef struct pxy_fd_batch {
+	int		cnt;
+	uint64_t	first_ts;	// usec, when fd[0] was queued
+	int		cli_fd[PXY_FD_BATCH_MAX];
+	struct fd_struct fds[PXY_FD_BATCH_MAX];
+} pxy_fd_batch_t;
+
+static uint64_t pxy_mono_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 static int 
-pxy_transfer_fd_to_nvsd (int cli_fd, void * private_data,
-		int svr_fd, 
-		struct sockaddr_in * p_s_addr, socklen_t s_addrlen,
-		struct sockaddr_in * p_d_addr, socklen_t d_addrlen)
+pxy_transfer_fd_to_nvsd (pxy_fd_batch_t * batch)
 {
-	struct fd_struct local_fd_struct;
 	struct msghdr msg;
   	struct cmsghdr *cmsg;
   	struct iovec vec; //in-band-data 
-	int fd; 
-	struct fd_struct * ptr;
-  	char ccmsg[CMSG_SPACE(sizeof(fd))] = {0,};
+  	char ccmsg[CMSG_SPACE(sizeof(int) * PXY_FD_BATCH_MAX)];
         int  sendlen = 0;
+	int  fdlen, i;
 
 
-       /*
-        * Before transfering the fd to nvsd, check whether nvsd is 
-        * in fine condition.
-        */
-
-	local_fd_struct.listen_fd = svr_fd;
-	memcpy(&local_fd_struct.dst_addr, p_d_addr, d_addrlen);
-	memcpy(&local_fd_struct.client_addr, p_s_addr, s_addrlen);
-        local_fd_struct.accepted_thr_num = gnm[svr_fd].accepted_thr_num ;
-
-        DBG_LOG(MSG, MOD_PROXYD, "got a connection on listenfd=%d and client fd=%d\n", svr_fd, cli_fd);
-
-	fd = cli_fd;
-	ptr = &local_fd_struct;
+	fdlen = sizeof(int) * batch->cnt;
+	memset(ccmsg, 0, sizeof(ccmsg));
   
   	msg.msg_name = (struct sockaddr*)&unix_socket_name;
   	msg.msg_namelen = sizeof(unix_socket_name);
 
-  	vec.iov_base = ptr;
-  	vec.iov_len = sizeof(struct fd_struct);
+  	vec.iov_base = batch->fds;
+  	vec.iov_len = sizeof(struct fd_struct) * batch->cnt;
   	msg.msg_iov = &vec;
   	msg.msg_iovlen = 1;
 
   	msg.msg_control = ccmsg;
-       /* Since we are sending only one fd at a time now, msg_controllen is same as
-        * length of single ancilliary object
+       /* One ancillary object holding all fds, in the order of the
+        * fd_structs.
         */
-        msg.msg_controllen = CMSG_LEN(sizeof(fd));
+        msg.msg_controllen = CMSG_SPACE(fdlen);
 
   	cmsg = CMSG_FIRSTHDR(&msg);
   	cmsg->cmsg_level = SOL_SOCKET;//out-of-band data
   	cmsg->cmsg_type = SCM_RIGHTS;
-  	cmsg->cmsg_len = CMSG_LEN(sizeof(fd));
-  	*(int*)CMSG_DATA(cmsg) = fd;
+  	cmsg->cmsg_len = CMSG_LEN(fdlen);
+  	memcpy(CMSG_DATA(cmsg), batch->cli_fd, fdlen);
 
   	msg.msg_flags = 0;
 
   	if ((sendlen = sendmsg(unix_socket_fd, &msg, 0)) != -1) {
-		close(fd);
+		for (i = 0; i < batch->cnt; i++) {
+			close(batch->cli_fd[i]);
+		}
+		AO_fetch_and_add1(&glob_pxy_tot_fd_batches);
                 DBG_LOG(MSG, MOD_PROXYD, 
-                        "Fwding fd '%d' to nvsd success. send length: %d\n",
-                        fd, sendlen) ;
+                        "Fwding %d fds to nvsd success. send length: %d\n",
+                        batch->cnt, sendlen) ;
 		return TRUE;
 	}
 
-        DBG_LOG(MSG, MOD_PROXYD, "Fwding fd '%d' to nvsd failed. Error:%s\n",
-                     fd, strerror(errno)) ;
+        DBG_LOG(MSG, MOD_PROXYD, "Fwding %d fds to nvsd failed. Error:%s\n",
+                     batch->cnt, strerror(errno)) ;
   	return FALSE;
 }
 
+/*
+ * Send the batch.  If nvsd can not take it, the fds are tunnelled.
+ */
+static void
+pxy_flush_fd_batch (pxy_fd_batch_t * batch, void * private_data)
+{
+	struct fd_struct * pfd;
+	int i;
+
+	if (batch->cnt == 0) {
+		return;
+	}
+	if (pxy_transfer_fd_to_nvsd(batch) == FALSE) {
+		for (i = 0; i < batch->cnt; i++) {
+			pfd = &batch->fds[i];
+			AO_fetch_and_add1( &glob_pxy_tot_tunnel_sockets );
+			pxy_proxy_this_fd(batch->cli_fd[i], private_data,
+					pfd->listen_fd,
+					&pfd->client_addr, sizeof(struct sockaddr_in),
+					&pfd->dst_addr, sizeof(struct sockaddr_in));
+		}
+	}
+	batch->cnt = 0;
+}
+
+static void
+pxy_queue_fd_to_nvsd (pxy_fd_batch_t * batch, int cli_fd, void * private_data,
+		int svr_fd, 
+		struct sockaddr_in * p_s_addr, socklen_t s_addrlen,
+		struct sockaddr_in * p_d_addr, socklen_t d_addrlen)
+{
+	struct fd_struct * pfd;
+
+        DBG_LOG(MSG, MOD_PROXYD, "got a connection on listenfd=%d and client fd=%d\n", svr_fd, cli_fd);
+
+	if (batch->cnt == 0) {
+		batch->first_ts = pxy_mono_usec();
+	}
+	pfd = &batch->fds[batch->cnt];
+	memset(pfd, 0, sizeof(*pfd));
+	pfd->listen_fd = svr_fd;
+	memcpy(&pfd->dst_addr, p_d_addr, d_addrlen);
+	memcpy(&pfd->client_addr, p_s_addr, s_addrlen);
+        pfd->accepted_thr_num = gnm[svr_fd].accepted_thr_num ;
+	batch->cli_fd[batch->cnt++] = cli_fd;
+
+	if ((batch->cnt >= pxy_fd_batch_max) || (batch->cnt >= PXY_FD_BATCH_MAX) ||
+	    (pxy_mono_usec() - batch->first_ts >= (uint64_t)pxy_fd_batch_usec)) {
+		pxy_flush_fd_batch(batch, private_data);
+	}
+}
+
 static void 
 pxy_close_unix_fd (void)
 {
@@ -158,15 +223,18 @@ pxy_httpsvr_epollin (int sockfd, void * private_data)
 	struct sockaddr_in d_addr;
 	socklen_t d_addrlen;
 	l4proxy_action ipact;
-	int ret;
+	pxy_fd_batch_t batch;
 
 
+	batch.cnt = 0;
+
 	/* always returns TRUE for this case */
 	for(cnt=0; ; cnt++) {
 
 		s_addrlen=sizeof(struct sockaddr_in);
 		clifd = accept(sockfd, (struct sockaddr *)&s_addr, &s_addrlen);
 		if (clifd == -1) {
+			pxy_flush_fd_batch(&batch, private_data);
 			return TRUE;
 		}
 		d_addrlen=sizeof(struct sockaddr_in);
@@ -175,6 +243,7 @@ pxy_httpsvr_epollin (int sockfd, void * private_data)
                 if (getsockname(clifd, (struct sockaddr *) &d_addr, &d_addrlen) == -1) {
 			printf("errno=%d\n", errno);
 			close(clifd);
+			pxy_flush_fd_batch(&batch, private_data);
                         return TRUE;
                 }
 
@@ -191,13 +260,11 @@ pxy_httpsvr_epollin (int sockfd, void * private_data)
 
 		case L4PROXY_ACTION_WHITE:
 			AO_fetch_and_add1( &glob_pxy_tot_cacheable_sockets );
-			ret = pxy_transfer_fd_to_nvsd(clifd, private_data, 
+			// Tunnelled by the flush if nvsd does not take it.
+			pxy_queue_fd_to_nvsd(&batch, clifd, private_data, 
 					sockfd, &s_addr, s_addrlen, &d_addr, d_addrlen);
-			if (ret) {
-				break;
-			}
+			break;
 
-			// Others. Fall through the Tunnel code path.
 		case L4PROXY_ACTION_TUNNEL:
 		default:
 			AO_fetch_and_add1( &glob_pxy_tot_tunnel_sockets );
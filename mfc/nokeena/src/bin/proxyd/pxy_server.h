@@ -30,6 +30,7 @@
 #define CONF_CANCELD		0x0000000000000004
 #define CONF_SYN_SENT		0x0000000000000040
 #define CONF_TASK_TIMEOUT	0x0000000000000200
+#define CONF_SPLICE		0x0000000000000400 /* Holds a pipe, data is spliced */
 
 #define CON_MAGIC_FREE          0x123456789deadbee
 #define CON_MAGIC_USED          0x1111111111111111
@@ -46,6 +47,12 @@
  */
 #define PXY_CLIENT_FD_FWD_PATH "/config/nkn/.proxyd"
 
+/*
+ * Most fds handed to nvsd in one datagram, one fd_struct each.
+ * This has to be in sync with bin/nvsd/nkn_recvfd.c
+ */
+#define PXY_FD_BATCH_MAX	32
+
 /*
  * con_t NM_func_timer event types
  */
@@ -69,6 +76,10 @@ typedef struct struct_con_t{
         int32_t 	cb_totlen;      // last data byte in cb_buf
         int32_t 	cb_offsetlen;   // first data byte in cb_buf
 
+	/* splice path, valid when CONF_SPLICE is set */
+	int32_t		pipe_fd[2];	// from this fd to peer_fd
+	int32_t		pipe_len;	// bytes in the pipe, not yet sent
+
 	time_t   	nkn_cur_ts;	// The time to calculate max_send_size
 
 	/* server information */
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -35,6 +36,15 @@ NKNCNT_DEF(pxy_tot_size_from_l4proxy,    AO_t, "", "size delivered to client")
 
 NKNCNT_DEF(pxy_cur_open_sockets, AO_t, "", "cur open socket")
 
+NKNCNT_DEF(pxy_tot_splice_cons,      AO_t, "", "connections forwarded with splice")
+NKNCNT_DEF(pxy_tot_size_spliced,     AO_t, "", "size forwarded to peer fd with splice")
+NKNCNT_DEF(pxy_tot_pipe_pool_hit,    AO_t, "", "pipe taken from the pool")
+NKNCNT_DEF(pxy_tot_pipe_created,     AO_t, "", "pipe created")
+NKNCNT_DEF(pxy_tot_pipe_create_err,  AO_t, "", "pipe create failed, copy used")
+NKNCNT_DEF(pxy_tot_pipe_limit,       AO_t, "", "pipe limit reached, copy used")
+NKNCNT_DEF(pxy_cur_pipes,            AO_t, "", "cur pipes, in use and pooled")
+NKNCNT_DEF(pxy_cur_pooled_pipes,     AO_t, "", "cur pipes in the pool")
+
 static pthread_mutex_t pxy_tr_socket_mutex = PTHREAD_MUTEX_INITIALIZER;
 extern network_mgr_t * gnm;
 extern int http_idle_timeout;
@@ -42,18 +52,154 @@ extern int use_client_ip;
 void close_conn(int fd);
 
 
+/* ***************************************************
+ * Splice forwarding.
+ *
+ * With tunnel_splice.enable set, a connection moves its data with
+ * splice(fd -> pipe -> peer_fd) instead of recv()/send() through
+ * cb_buf, so tunnelled bytes are never copied to user space.
+ * Each side of a tunnel holds the pipe of its own direction.
+ * A pipe that is empty when its tunnel closes goes back to a pool
+ * and is reused by the next tunnel.
+ *
+ * Pipes share the MAX_GNM fd limit with the sockets, so at most
+ * tunnel_splice.max_pipes pipes exist at a time; connections above
+ * that, or when pipe2() fails, use the copy path.
+ * *************************************************** */
+
+int pxy_tunnel_splice = 1;
+int pxy_tunnel_pipe_pool_max = 1024;
+int pxy_tunnel_splice_max_pipes = MAX_GNM / 4;	// 2 fds per pipe
+
+#define PXY_SPLICE_CHUNK	(64 * 1024)	// default pipe capacity
+
+static pthread_mutex_t pxy_pipe_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int (* pxy_pipe_pool)[2] = NULL;
+static int pxy_pipe_pool_cnt = 0;
+static int pxy_pipe_cnt = 0;		// in use and pooled
+
+static int pxy_tunnel_get_pipe(con_t * con)
+{
+	int pfd[2];
+
+	pthread_mutex_lock(&pxy_pipe_mutex);
+	if (pxy_pipe_pool_cnt) {
+		pxy_pipe_pool_cnt--;
+		pfd[0] = pxy_pipe_pool[pxy_pipe_pool_cnt][0];
+		pfd[1] = pxy_pipe_pool[pxy_pipe_pool_cnt][1];
+		glob_pxy_cur_pooled_pipes = pxy_pipe_pool_cnt;
+		pthread_mutex_unlock(&pxy_pipe_mutex);
+		glob_pxy_tot_pipe_pool_hit++;
+	} else {
+		if (pxy_pipe_cnt >= pxy_tunnel_splice_max_pipes) {
+			pthread_mutex_unlock(&pxy_pipe_mutex);
+			glob_pxy_tot_pipe_limit++;
+			return FALSE;
+		}
+		pxy_pipe_cnt++;
+		glob_pxy_cur_pipes = pxy_pipe_cnt;
+		pthread_mutex_unlock(&pxy_pipe_mutex);
+
+		if (pipe2(pfd, O_NONBLOCK | O_CLOEXEC) < 0) {
+			DBG_LOG(MSG, MOD_PROXYD, "pipe2() failed, errno=%d", errno);
+			glob_pxy_tot_pipe_create_err++;
+			pthread_mutex_lock(&pxy_pipe_mutex);
+			pxy_pipe_cnt--;
+			glob_pxy_cur_pipes = pxy_pipe_cnt;
+			pthread_mutex_unlock(&pxy_pipe_mutex);
+			return FALSE;
+		}
+		glob_pxy_tot_pipe_created++;
+	}
+
+	con->pipe_fd[0] = pfd[0];
+	con->pipe_fd[1] = pfd[1];
+	con->pipe_len = 0;
+	SET_CON_FLAG(con, CONF_SPLICE);
+	glob_pxy_tot_splice_cons++;
+	return TRUE;
+}
+
+/*
+ * Called before the con_t is freed.
+ * A pipe that still holds data is closed, not pooled.
+ */
+static void pxy_tunnel_put_pipe(con_t * con)
+{
+	if (!con || !CHECK_CON_FLAG(con, CONF_SPLICE)) {
+		return;
+	}
+	UNSET_CON_FLAG(con, CONF_SPLICE);
+
+	pthread_mutex_lock(&pxy_pipe_mutex);
+	if (con->pipe_len == 0 && pxy_pipe_pool == NULL &&
+	    pxy_tunnel_pipe_pool_max > 0) {
+		pxy_pipe_pool = calloc(pxy_tunnel_pipe_pool_max,
+				       sizeof(pxy_pipe_pool[0]));
+	}
+	if (con->pipe_len == 0 && pxy_pipe_pool &&
+	    pxy_pipe_pool_cnt < pxy_tunnel_pipe_pool_max) {
+		pxy_pipe_pool[pxy_pipe_pool_cnt][0] = con->pipe_fd[0];
+		pxy_pipe_pool[pxy_pipe_pool_cnt][1] = con->pipe_fd[1];
+		pxy_pipe_pool_cnt++;
+		glob_pxy_cur_pooled_pipes = pxy_pipe_pool_cnt;
+		pthread_mutex_unlock(&pxy_pipe_mutex);
+		return;
+	}
+	pxy_pipe_cnt--;
+	glob_pxy_cur_pipes = pxy_pipe_cnt;
+	pthread_mutex_unlock(&pxy_pipe_mutex);
+
+	close(con->pipe_fd[0]);
+	close(con->pipe_fd[1]);
+}
+
+/*
+ * Move the data held in the pipe to peer_fd.
+ */
+static int splice_data_to_peer(con_t * con)
+{
+	int ret;
+
+	while (con->pipe_len) {
+		ret = splice(con->pipe_fd[0], NULL, con->peer_fd, NULL,
+			     con->pipe_len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (ret == -1) {
+			if (errno == EAGAIN) {
+				pxy_NM_add_event_epollout(con->peer_fd);
+				pxy_NM_del_event_epoll(con->fd);
+				return TRUE;
+			}
+			return FALSE;
+		}
+		con->pipe_len -= ret;
+		glob_pxy_tot_size_spliced += ret;
+		if (CHECK_CON_FLAG(con, CONF_CLIENT_SIDE)) {
+			glob_pxy_tot_size_from_l4proxy += ret;
+		} else {
+			glob_pxy_tot_size_to_origin_svr += ret;
+		}
+	}
+
+	pxy_NM_add_event_epollin(con->fd);
+	pxy_NM_add_event_epollin(con->peer_fd);
+	return TRUE;
+}
+
 /*
  *
  */
 static int forward_data_to_peer(con_t * con)
 {
-	con_t * peer_con;
 	int ret, len;
 	char * p;
 
-	peer_con = gnm[con->peer_fd].private_data;
 	pxy_NM_set_socket_active(&gnm[con->fd]);
 
+	if (CHECK_CON_FLAG(con, CONF_SPLICE)) {
+		return splice_data_to_peer(con);
+	}
+
 	len = con->cb_totlen - con->cb_offsetlen;
 	while(len) {
 
@@ -80,6 +226,7 @@ static int forward_data_to_peer(con_t * con)
 	}
 
 	pxy_NM_add_event_epollin(con->fd);
+	pxy_NM_add_event_epollin(con->peer_fd);
 	con->cb_offsetlen = 0;
 	con->cb_totlen = 0;
 	return TRUE;
@@ -96,14 +243,38 @@ static int pxy_http_epollin(int fd, void * private_data)
 	int rlen;
 	int ret;
 
-	rlen = MAX_CB_BUF - con->cb_totlen;
-	ret = recv(fd, &con->cb_buf[con->cb_totlen], rlen, 0);
-	if(ret <= 0) {
-                DBG_LOG(MSG, MOD_PROXYD, "[closing fd:%d]recv returned %d." , fd, ret) ;
-                close_conn(fd);
-		return TRUE;
+	/*
+	 * The pipe is taken on the first read, once both sockets are
+	 * connected, and only while nothing is left in cb_buf.
+	 */
+	if (pxy_tunnel_splice && !CHECK_CON_FLAG(con, CONF_SPLICE) &&
+	    con->cb_totlen == 0) {
+		pxy_tunnel_get_pipe(con);
+	}
+
+	if (CHECK_CON_FLAG(con, CONF_SPLICE)) {
+		ret = splice(fd, NULL, con->pipe_fd[1], NULL,
+			     PXY_SPLICE_CHUNK - con->pipe_len,
+			     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (ret == -1 && errno == EAGAIN) {
+			return TRUE;
+		}
+		if(ret <= 0) {
+			DBG_LOG(MSG, MOD_PROXYD, "[closing fd:%d]splice returned %d." , fd, ret) ;
+			close_conn(fd);
+			return TRUE;
+		}
+		con->pipe_len += ret;
+	} else {
+		rlen = MAX_CB_BUF - con->cb_totlen;
+		ret = recv(fd, &con->cb_buf[con->cb_totlen], rlen, 0);
+		if(ret <= 0) {
+			DBG_LOG(MSG, MOD_PROXYD, "[closing fd:%d]recv returned %d." , fd, ret) ;
+			close_conn(fd);
+			return TRUE;
+		}
+		con->cb_totlen += ret;
 	}
-	con->cb_totlen += ret;
 
         if (CHECK_CON_FLAG(con, CONF_CLIENT_SIDE)) {
             glob_pxy_tot_size_from_client += ret;
@@ -122,6 +293,7 @@ static int pxy_http_epollin(int fd, void * private_data)
 static int pxy_http_epollout(int fd, void * private_data)
 {
 	con_t * con = (con_t *)private_data;
+	con_t * peer_con;
 	int ret;
 	int retlen;
 
@@ -151,8 +323,14 @@ static int pxy_http_epollout(int fd, void * private_data)
 		}
 	}
 	else {
-		/* Resent data */
-		forward_data_to_peer(con);
+		/*
+		 * Resent data. The data waiting for this fd is held by the
+		 * peer, whose socket was taken out of epoll on EAGAIN.
+		 */
+		peer_con = gnm[con->peer_fd].private_data;
+		if (peer_con) {
+			forward_data_to_peer(peer_con);
+		}
 	}
 
 	return TRUE;
@@ -199,6 +377,9 @@ void close_conn(int fd)
 
 	DBG_LOG(MSG, MOD_PROXYD, "fd=%d peer_fd=%d", fd, peer_fd);
 
+	pxy_tunnel_put_pipe(con);
+	pxy_tunnel_put_pipe((con_t *)gnm[peer_fd].private_data);
+
 	pxy_NM_close_socket(fd);
 	pxy_NM_close_socket(peer_fd);
 
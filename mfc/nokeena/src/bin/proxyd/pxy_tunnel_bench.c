@@ -0,0 +1,357 @@
+/*
+ * pxy_tunnel_bench: loopback throughput of the proxyd tunnel forwarding,
+ * recv()/send() through a MAX_CB_BUF user buffer (copy) against
+ * splice() through a per tunnel pipe, with 1, 100 and 10000 concurrent
+ * tunnels.
+ *
+ * Each tunnel is  src -> a ==proxy==> b -> sink  over 127.0.0.1.  One
+ * thread runs the proxy epoll loop the way pxy_tunnel.c does: on EAGAIN
+ * the reading side leaves epoll and the peer waits for EPOLLOUT.  A
+ * second thread fills the sources and drains the sinks.  Reported are
+ * the bytes received by the sinks per second and the CPU time the proxy
+ * thread spent per MB forwarded.
+ *
+ * 10000 tunnels need 40000 sockets and 20000 pipe fds; the bench raises
+ * RLIMIT_NOFILE and skips the runs that do not fit.
+ *
+ * build: gcc -O2 -D_GNU_SOURCE pxy_tunnel_bench.c \
+ *		-o pxy_tunnel_bench -lpthread
+ *
+ * usage: pxy_tunnel_bench [-t seconds_per_run] [-n tunnels]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define MAX_CB_BUF	4096		// as pxy_server.h
+#define SPLICE_CHUNK	(64 * 1024)	// as pxy_tunnel.c
+#define DRIVER_BUF	(64 * 1024)
+#define MAX_EVENTS	1024
+
+typedef struct tun {
+	int src, a, b, sink;
+	int pfd[2];
+	int pipe_len;
+	int cb_totlen;
+	int cb_offsetlen;
+	char *cb_buf;
+} tun_t;
+
+static tun_t *tuns;
+static int ntuns;
+static int use_splice;
+static volatile int stop;
+static volatile uint64_t sink_bytes;
+static uint64_t proxy_cpu_nsec;
+
+static uint64_t ts_nsec(clockid_t clk)
+{
+	struct timespec ts;
+
+	clock_gettime(clk, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void set_events(int epfd, int fd, uint32_t ev, uint64_t data)
+{
+	struct epoll_event e;
+
+	memset(&e, 0, sizeof(e));
+	e.events = ev;
+	e.data.u64 = data;
+	epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &e);
+}
+
+static void add_fd(int epfd, int fd, uint32_t ev, uint64_t data)
+{
+	struct epoll_event e;
+
+	memset(&e, 0, sizeof(e));
+	e.events = ev;
+	e.data.u64 = data;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &e) < 0) {
+		perror("epoll_ctl");
+		exit(1);
+	}
+}
+
+/* forward_data_to_peer(), both paths */
+static void flush(int epfd, tun_t *t, uint64_t id)
+{
+	int ret;
+
+	while (use_splice ? t->pipe_len : t->cb_totlen - t->cb_offsetlen) {
+		if (use_splice) {
+			ret = splice(t->pfd[0], NULL, t->b, NULL, t->pipe_len,
+				     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		} else {
+			ret = send(t->b, &t->cb_buf[t->cb_offsetlen],
+				   t->cb_totlen - t->cb_offsetlen, 0);
+		}
+		if (ret == -1) {
+			if (errno == EAGAIN) {
+				set_events(epfd, t->b, EPOLLOUT, id << 1 | 1);
+				set_events(epfd, t->a, 0, id << 1);
+				return;
+			}
+			perror("forward");
+			exit(1);
+		}
+		if (use_splice) {
+			t->pipe_len -= ret;
+		} else {
+			t->cb_offsetlen += ret;
+		}
+	}
+	t->cb_offsetlen = t->cb_totlen = 0;
+	set_events(epfd, t->a, EPOLLIN, id << 1);
+	set_events(epfd, t->b, 0, id << 1 | 1);
+}
+
+static void *proxy(void *arg)
+{
+	struct epoll_event ev[MAX_EVENTS];
+	uint64_t start, id;
+	int epfd, n, i, ret;
+	tun_t *t;
+
+	(void)arg;
+	epfd = epoll_create(1);
+	for (i = 0; i < ntuns; i++) {
+		add_fd(epfd, tuns[i].a, EPOLLIN, (uint64_t)i << 1);
+		add_fd(epfd, tuns[i].b, 0, (uint64_t)i << 1 | 1);
+	}
+
+	start = ts_nsec(CLOCK_THREAD_CPUTIME_ID);
+	while (!stop) {
+		n = epoll_wait(epfd, ev, MAX_EVENTS, 100);
+		for (i = 0; i < n; i++) {
+			id = ev[i].data.u64 >> 1;
+			t = &tuns[id];
+			if (ev[i].data.u64 & 1) {
+				flush(epfd, t, id);
+				continue;
+			}
+			if (use_splice) {
+				ret = splice(t->a, NULL, t->pfd[1], NULL,
+					     SPLICE_CHUNK - t->pipe_len,
+					     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			} else {
+				ret = recv(t->a, &t->cb_buf[t->cb_totlen],
+					   MAX_CB_BUF - t->cb_totlen, 0);
+			}
+			if (ret <= 0) {
+				continue;
+			}
+			if (use_splice) {
+				t->pipe_len += ret;
+			} else {
+				t->cb_totlen += ret;
+			}
+			flush(epfd, t, id);
+		}
+	}
+	proxy_cpu_nsec = ts_nsec(CLOCK_THREAD_CPUTIME_ID) - start;
+	close(epfd);
+	return NULL;
+}
+
+/* fills the sources, drains the sinks */
+static void *driver(void *arg)
+{
+	struct epoll_event ev[MAX_EVENTS];
+	static char buf[DRIVER_BUF];
+	uint64_t bytes = 0;
+	int epfd, n, i, ret;
+	tun_t *t;
+
+	(void)arg;
+	memset(buf, 'x', sizeof(buf));
+	epfd = epoll_create(1);
+	for (i = 0; i < ntuns; i++) {
+		add_fd(epfd, tuns[i].src, EPOLLOUT, (uint64_t)i << 1);
+		add_fd(epfd, tuns[i].sink, EPOLLIN, (uint64_t)i << 1 | 1);
+	}
+
+	while (!stop) {
+		n = epoll_wait(epfd, ev, MAX_EVENTS, 100);
+		for (i = 0; i < n; i++) {
+			t = &tuns[ev[i].data.u64 >> 1];
+			if (ev[i].data.u64 & 1) {
+				ret = recv(t->sink, buf, sizeof(buf), 0);
+				if (ret > 0) {
+					bytes += ret;
+				}
+			} else {
+				send(t->src, buf, sizeof(buf), 0);
+			}
+		}
+		sink_bytes = bytes;
+	}
+	close(epfd);
+	return NULL;
+}
+
+static int nonblock(int fd)
+{
+	int on = 1;
+
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	return fcntl(fd, F_SETFL, O_RDWR | O_NONBLOCK);
+}
+
+static int connect_pair(int lfd, struct sockaddr_in *addr, int *c, int *s)
+{
+	*c = socket(AF_INET, SOCK_STREAM, 0);
+	if (*c < 0 ||
+	    connect(*c, (struct sockaddr *)addr, sizeof(*addr)) < 0) {
+		return -1;
+	}
+	*s = accept(lfd, NULL, NULL);
+	if (*s < 0) {
+		return -1;
+	}
+	nonblock(*c);
+	nonblock(*s);
+	return 0;
+}
+
+static int setup(int n)
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	int lfd, i;
+
+	lfd = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(lfd, 1024) < 0 ||
+	    getsockname(lfd, (struct sockaddr *)&addr, &len) < 0) {
+		perror("listen");
+		exit(1);
+	}
+
+	tuns = calloc(n, sizeof(tun_t));
+	for (i = 0; i < n; i++) {
+		if (connect_pair(lfd, &addr, &tuns[i].src, &tuns[i].a) ||
+		    connect_pair(lfd, &addr, &tuns[i].b, &tuns[i].sink)) {
+			perror("connect");
+			exit(1);
+		}
+		if (use_splice) {
+			if (pipe2(tuns[i].pfd, O_NONBLOCK | O_CLOEXEC) < 0) {
+				perror("pipe2");
+				exit(1);
+			}
+		} else {
+			tuns[i].cb_buf = malloc(MAX_CB_BUF);
+		}
+	}
+	close(lfd);
+	ntuns = n;
+	return 0;
+}
+
+static void teardown(void)
+{
+	int i;
+
+	for (i = 0; i < ntuns; i++) {
+		close(tuns[i].src);
+		close(tuns[i].a);
+		close(tuns[i].b);
+		close(tuns[i].sink);
+		if (use_splice) {
+			close(tuns[i].pfd[0]);
+			close(tuns[i].pfd[1]);
+		}
+		free(tuns[i].cb_buf);
+	}
+	free(tuns);
+	ntuns = 0;
+}
+
+static void run(int n, int splice_mode, int seconds)
+{
+	pthread_t ptid, dtid;
+	uint64_t start, nsec, bytes;
+	double mb;
+
+	use_splice = splice_mode;
+	stop = 0;
+	sink_bytes = 0;
+	setup(n);
+	pthread_create(&ptid, NULL, proxy, NULL);
+	pthread_create(&dtid, NULL, driver, NULL);
+
+	start = ts_nsec(CLOCK_MONOTONIC);
+	sleep(seconds);
+	bytes = sink_bytes;
+	nsec = ts_nsec(CLOCK_MONOTONIC) - start;
+	stop = 1;
+	pthread_join(ptid, NULL);
+	pthread_join(dtid, NULL);
+	teardown();
+
+	mb = bytes / 1048576.0;
+	printf("%-6s tunnels=%5d  %8.1f MB/s  proxy cpu %6.1f usec/MB\n",
+	       splice_mode ? "splice" : "copy", n, mb * 1e9 / nsec,
+	       mb > 0 ? proxy_cpu_nsec / 1000.0 / mb : 0.0);
+}
+
+int main(int argc, char **argv)
+{
+	static const int tunnels[] = { 1, 100, 10000 };
+	struct rlimit rlim;
+	int seconds = 3, only = 0, i, c;
+
+	while ((c = getopt(argc, argv, "t:n:")) != -1) {
+		switch (c) {
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		case 'n':
+			only = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-t seconds_per_run] "
+				"[-n tunnels]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	getrlimit(RLIMIT_NOFILE, &rlim);
+	rlim.rlim_cur = rlim.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &rlim);
+
+	for (i = 0; i < (int)(sizeof(tunnels) / sizeof(tunnels[0])); i++) {
+		c = only ? only : tunnels[i];
+		/* 4 sockets and 2 pipe fds a tunnel, plus some spare */
+		if ((uint64_t)c * 6 + 64 > rlim.rlim_cur) {
+			printf("tunnels=%d skipped, RLIMIT_NOFILE %lu\n", c,
+			       (unsigned long)rlim.rlim_cur);
+		} else {
+			run(c, 0, seconds);
+			run(c, 1, seconds);
+		}
+		if (only) {
+			break;
+		}
+	}
+	return 0;
+}
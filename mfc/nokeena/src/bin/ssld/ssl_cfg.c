@@ -19,6 +19,8 @@
 #include "nkn_defs.h"
 #include "ssl_defs.h"
 #include "ssl_interface.h"
+#include "ssl_sess_cache.h"
+#include "ssl_hs_pool.h"
 
 int use_client_ip = 0;
 
@@ -60,6 +62,10 @@ static struct nkncfg_def {
     { "ssl.enable_cllient_authentication",  TYPE_INT,  &client_auth, "1"},
     { "ssl.use_ciphers",  TYPE_STRING,  &ciphers, NULL},
     { "ssl.enable_DH_file",  TYPE_STRING,  &dhfile, NULL},
+    { "ssl.session_cache_size",  TYPE_INT,  &ssl_sess_cache_size, "20480"},
+    { "ssl.session_timeout",  TYPE_INT,  &ssl_sess_timeout, "300"},
+    { "ssl.ticket_key_rotate_secs",  TYPE_INT,  &ssl_ticket_key_rotate_secs, "3600"},
+    { "ssl.handshake_threads",  TYPE_INT,  &ssl_handshake_threads, "2"},
 #ifdef HTTP2_SUPPORT
     { "ssl.enable_spdy",  TYPE_INT,  &enable_spdy, "0"},
     { "ssl.enable_http2",  TYPE_INT,  &enable_http2, "0"},
@@ -0,0 +1,227 @@
+/*
+ * ssl_hs_pool.c -- TLS handshake offload worker pool
+ */
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/queue.h>
+#include <sys/prctl.h>
+#include <sys/epoll.h>
+
+#include "ssl_defs.h"
+#include "nkn_debug.h"
+#include "nkn_stat.h"
+#include "ssl_server.h"
+#include "ssl_network.h"
+#include "ssl_hs_pool.h"
+
+NKNCNT_DEF(tot_handshake_queued, AO_t, "", "Total handshake steps queued to handshake threads")
+NKNCNT_DEF(cur_handshake_queue_depth, AO_t, "", "Handshake steps waiting for a handshake thread")
+NKNCNT_DEF(max_handshake_queue_depth, AO_t, "", "Largest handshake queue depth seen")
+NKNCNT_DEF(tot_handshake_queue_usec, AO_t, "", "Total usec handshake steps waited in the queue")
+NKNCNT_DEF(max_handshake_queue_usec, AO_t, "", "Longest usec a handshake step waited in the queue")
+
+#define SSL_HS_MAX_THREADS	32
+#define SSL_HS_MAX_ASYNC_FDS	4
+#define SSL_HS_ASYNC_EVENTS	16
+
+int ssl_handshake_threads = 2;
+
+static TAILQ_HEAD(, ssl_con_t) hs_queue = TAILQ_HEAD_INITIALIZER(hs_queue);
+static pthread_mutex_t hs_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t hs_queue_cond = PTHREAD_COND_INITIALIZER;
+static int hs_pool_started = 0;
+static int hs_async_epfd = -1;
+
+/* the maximum is updated by every handshake thread */
+static void ssl_hs_update_max(volatile AO_t * max, AO_t val)
+{
+	AO_t old;
+
+	do {
+		old = *max;
+		if (val <= old) {
+			return;
+		}
+	} while (!AO_compare_and_swap(max, old, val));
+}
+
+static void * ssl_hs_worker(void * arg)
+{
+	ssl_con_t * ssl_con;
+	uint64_t waited;
+
+	UNUSED_ARGUMENT(arg);
+	prctl(PR_SET_NAME, "ssld-handshake", 0, 0, 0);
+
+	while (1) {
+		pthread_mutex_lock(&hs_queue_lock);
+		while (TAILQ_EMPTY(&hs_queue)) {
+			pthread_cond_wait(&hs_queue_cond, &hs_queue_lock);
+		}
+		ssl_con = TAILQ_FIRST(&hs_queue);
+		TAILQ_REMOVE(&hs_queue, ssl_con, hs_entry);
+		glob_cur_handshake_queue_depth--;
+		pthread_mutex_unlock(&hs_queue_lock);
+
+		waited = ssl_hs_now_usec() - ssl_con->hs_enq_usec;
+		AO_fetch_and_add(&glob_tot_handshake_queue_usec, waited);
+		ssl_hs_update_max(&glob_max_handshake_queue_usec, waited);
+
+		ssl_accept_offloaded(ssl_con);
+	}
+
+	return NULL;
+}
+
+#ifdef SSL_MODE_ASYNC
+static int ssl_hs_async_fds(SSL * ssl, OSSL_ASYNC_FD * fds, size_t * numfds)
+{
+	*numfds = 0;
+	if (!SSL_get_all_async_fds(ssl, NULL, numfds) || *numfds == 0 ||
+	    *numfds > SSL_HS_MAX_ASYNC_FDS ||
+	    !SSL_get_all_async_fds(ssl, fds, numfds)) {
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Puts handshakes parked by ssl_hs_pool_wait_async() back on the queue
+ * once their engine signals one of the wait fds.
+ */
+static void * ssl_hs_async_waiter(void * arg)
+{
+	struct epoll_event ev[SSL_HS_ASYNC_EVENTS];
+	OSSL_ASYNC_FD fds[SSL_HS_MAX_ASYNC_FDS];
+	ssl_con_t * ssl_con;
+	size_t numfds, j;
+	int n, i, k;
+
+	UNUSED_ARGUMENT(arg);
+	prctl(PR_SET_NAME, "ssld-hs-async", 0, 0, 0);
+
+	while (1) {
+		n = epoll_wait(hs_async_epfd, ev, SSL_HS_ASYNC_EVENTS, -1);
+		for (i = 0; i < n; i++) {
+			ssl_con = ev[i].data.ptr;
+			/* several wait fds of one handshake may fire at once */
+			for (k = 0; k < i; k++) {
+				if (ev[k].data.ptr == ssl_con) {
+					break;
+				}
+			}
+			if (k < i) {
+				continue;
+			}
+			if (ssl_hs_async_fds(ssl_con->ssl, fds, &numfds) == 0) {
+				for (j = 0; j < numfds; j++) {
+					epoll_ctl(hs_async_epfd, EPOLL_CTL_DEL,
+						  fds[j], NULL);
+				}
+			}
+			ssl_hs_pool_enqueue(ssl_con);
+		}
+	}
+
+	return NULL;
+}
+#endif
+
+int ssl_hs_pool_wait_async(ssl_con_t * ssl_con)
+{
+#ifdef SSL_MODE_ASYNC
+	OSSL_ASYNC_FD fds[SSL_HS_MAX_ASYNC_FDS];
+	struct epoll_event ev;
+	size_t numfds, i;
+
+	if (hs_async_epfd < 0 ||
+	    ssl_hs_async_fds(ssl_con->ssl, fds, &numfds) != 0) {
+		return -1;
+	}
+	ev.events = EPOLLIN | EPOLLONESHOT;
+	ev.data.ptr = ssl_con;
+	for (i = 0; i < numfds; i++) {
+		if (epoll_ctl(hs_async_epfd, EPOLL_CTL_ADD, fds[i], &ev) &&
+		    (errno != EEXIST ||
+		     epoll_ctl(hs_async_epfd, EPOLL_CTL_MOD, fds[i], &ev))) {
+			while (i-- > 0) {
+				epoll_ctl(hs_async_epfd, EPOLL_CTL_DEL, fds[i], NULL);
+			}
+			return -1;
+		}
+	}
+	return 0;
+#else
+	UNUSED_ARGUMENT(ssl_con);
+	return -1;
+#endif
+}
+
+void ssl_hs_pool_init(void)
+{
+	pthread_t tid;
+	int i;
+
+	if (ssl_handshake_threads <= 0) {
+		DBG_LOG(MSG, MOD_SSL, "handshakes run on the network threads");
+		return;
+	}
+	if (ssl_handshake_threads > SSL_HS_MAX_THREADS) {
+		ssl_handshake_threads = SSL_HS_MAX_THREADS;
+	}
+
+	for (i = 0; i < ssl_handshake_threads; i++) {
+		if (pthread_create(&tid, NULL, ssl_hs_worker, NULL)) {
+			DBG_LOG(SEVERE, MOD_SSL,
+				"Failed to create handshake thread, errno=%d", errno);
+			break;
+		}
+		pthread_detach(tid);
+	}
+	/* any running thread drains the queue */
+	hs_pool_started = (i > 0);
+	DBG_LOG(MSG, MOD_SSL, "%d handshake threads", i);
+
+#ifdef SSL_MODE_ASYNC
+	if (hs_pool_started) {
+		hs_async_epfd = epoll_create1(EPOLL_CLOEXEC);
+		if (hs_async_epfd < 0 ||
+		    pthread_create(&tid, NULL, ssl_hs_async_waiter, NULL)) {
+			DBG_LOG(SEVERE, MOD_SSL,
+				"Failed to start async handshake waiter, errno=%d",
+				errno);
+			if (hs_async_epfd >= 0) {
+				close(hs_async_epfd);
+				hs_async_epfd = -1;
+			}
+		} else {
+			pthread_detach(tid);
+		}
+	}
+#endif
+}
+
+int ssl_hs_pool_enabled(void)
+{
+	return hs_pool_started;
+}
+
+void ssl_hs_pool_enqueue(ssl_con_t * ssl_con)
+{
+	ssl_con->hs_enq_usec = ssl_hs_now_usec();
+	AO_fetch_and_add1(&glob_tot_handshake_queued);
+
+	pthread_mutex_lock(&hs_queue_lock);
+	TAILQ_INSERT_TAIL(&hs_queue, ssl_con, hs_entry);
+	glob_cur_handshake_queue_depth++;
+	if (glob_cur_handshake_queue_depth > glob_max_handshake_queue_depth) {
+		glob_max_handshake_queue_depth = glob_cur_handshake_queue_depth;
+	}
+	pthread_cond_signal(&hs_queue_cond);
+	pthread_mutex_unlock(&hs_queue_lock);
+}
@@ -0,0 +1,48 @@
+/*
+ * ssl_hs_pool.h -- TLS handshake offload worker pool
+ *
+ * SSL_accept() runs the private key operations of a handshake, which
+ * would otherwise stall every established connection of the network
+ * thread. With ssl.handshake_threads > 0 the network thread takes the
+ * socket out of epoll and queues the connection; a handshake thread runs
+ * the SSL_accept() step and hands the connection back by re-arming epoll
+ * under the socket's gnm mutex, like any network callback.
+ *
+ * Only the steps that use the private key are queued; the others are
+ * cheap and run on the network thread. A step paused by an async engine
+ * is parked until the engine signals its wait fd, so no thread blocks
+ * on it.
+ */
+#ifndef SSL_HS_POOL_H
+#define SSL_HS_POOL_H
+
+#include <time.h>
+#include "ssl_server.h"
+
+extern int ssl_handshake_threads;	// config, 0: handshakes inline
+
+static inline uint64_t ssl_hs_now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void ssl_hs_pool_init(void);
+int ssl_hs_pool_enabled(void);
+
+/* caller holds gnm[ssl_con->fd].mutex and has removed fd from epoll */
+void ssl_hs_pool_enqueue(ssl_con_t * ssl_con);
+
+/*
+ * Handshake thread: the SSL_accept() step returned SSL_ERROR_WANT_ASYNC.
+ * Returns 0 if the connection was parked and will be queued again, -1 if
+ * it could not be (the step then fails).
+ */
+int ssl_hs_pool_wait_async(ssl_con_t * ssl_con);
+
+/* ssl_server.c: run one SSL_accept() step on a handshake thread */
+void ssl_accept_offloaded(ssl_con_t * ssl_con);
+
+#endif /* SSL_HS_POOL_H */
@@ -22,6 +22,8 @@
 #include "nkn_assert.h"
 #include "ssl_defs.h"
 #include "ssld_mgmt.h"
+#include "ssl_sess_cache.h"
+#include "ssl_hs_pool.h"
 
 #ifdef HTTP2_SUPPORT
 #include "proto_http/proto_http.h"
@@ -286,6 +288,7 @@ static int server_init(void)
 	 * 	      Within this module, order might be important too.
 	 */
 	server_timer_init();	// Initialize timer thread
+	ssl_hs_pool_init();	// Handshake offload threads
 
 	/*
 	 * Catalog 5: External services
@@ -407,6 +410,9 @@ int main(int argc, char **argv)
 	/* Read configuration from nkn.conf.default file */
 	read_ssl_cfg(configfile);
 
+	/* before mgmtd hands us the certificates */
+	ssl_sess_cache_init();
+
 	/*  ---- mgmtd init */
 	ssld_mgmt_thrd_init();
 
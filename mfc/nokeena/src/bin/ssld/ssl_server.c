@@ -31,6 +31,8 @@
 #include "ssld_mgmt.h"
 #include "openssl/ssl.h"
 #include "nkn_ssl.h"
+#include "ssl_sess_cache.h"
+#include "ssl_hs_pool.h"
 
 #ifdef HTTP2_SUPPORT
 #include "server_common.h"
@@ -51,6 +53,12 @@ NKNCNT_DEF(tot_size_http_sent, AO_t, "" , "total bytes sent to nvsd")
 NKNCNT_DEF(tot_size_http_received, AO_t, "", "total bytes received from http")
 NKNCNT_DEF(tot_handshake_failure, AO_t, "", "Total handshake failure cases")
 NKNCNT_DEF(tot_handshake_done, AO_t, "", "Total handshake Success cases")
+NKNCNT_DEF(tot_handshake_usec, AO_t, "", "Total usec from ClientHello to handshake done")
+NKNCNT_DEF(handshake_lt_1ms, AO_t, "", "Handshakes done within 1 msec")
+NKNCNT_DEF(handshake_lt_10ms, AO_t, "", "Handshakes done within 10 msec")
+NKNCNT_DEF(handshake_lt_100ms, AO_t, "", "Handshakes done within 100 msec")
+NKNCNT_DEF(handshake_ge_100ms, AO_t, "", "Handshakes taking 100 msec or more")
+NKNCNT_DEF(tot_handshake_async_wait, AO_t, "", "Total handshake steps paused on an async engine")
 NKNCNT_DEF(tot_http_setup_err_cnt, AO_t, "", "Total HTTP setup erroro")
 NKNCNT_DEF(tot_cert_setup_err_cnt, AO_t, "", "Total Certificate CTX setup erroro")
 NKNCNT_DEF(tot_ssl_con_malloc_cnt, AO_t, "", "Total SSL_con malloc count")
@@ -93,7 +101,6 @@ SSL_CTX *ssl_vh_ctx[NKN_MAX_SSL_HOST] ;
 BIO *bio_err=0;
 static const char *pass;
 
-static int s_server_session_id_context = 1;
 const char * http_server_ip="127.0.0.1";
 int http_server_port=80;
 static int init_start = 0;
@@ -108,6 +115,7 @@ void ssl_interface_deinit(void);
 
 void nkn_setup_interface_parameter(int i);
 int ssl_accept(ssl_con_t * ssl_con);
+static int ssl_accept_done(ssl_con_t * ssl_con, int r_code);
 
 int ssl_exit_err(const char * string);
 SSL_CTX * ssl_initialize_ctx(const  char * certfile, const char *keyfile, const char *password);
@@ -219,6 +227,8 @@ static int ssl_servername_cb(SSL *s, int *ad, void *arg)
 
 				if(pctx != NULL) {
 					SSL_set_SSL_CTX(s, pctx);
+					if (ssl_sess_cache_bind_vhost(s) != 0)
+						return SSL_TLSEXT_ERR_ALERT_FATAL;
 					return SSL_TLSEXT_ERR_OK;
 				} 
 			}
@@ -231,6 +241,8 @@ static int ssl_servername_cb(SSL *s, int *ad, void *arg)
 	if(pctx != NULL) {
 		DBG_LOG(MSG, MOD_SSL, "Using Wildcard virtualhost\n");
 		SSL_set_SSL_CTX(s, pctx);
+		if (ssl_sess_cache_bind_vhost(s) != 0)
+			return SSL_TLSEXT_ERR_ALERT_FATAL;
 		return SSL_TLSEXT_ERR_OK;
 	}	
 
@@ -633,13 +645,48 @@ static ssl_con_t * create_new_svr_con(int cli_fd)
 	return http_con;
 }
 
+/*
+ * The SSL_accept() steps that use the private key: reading the
+ * ClientHello (the server flight is signed) and reading the
+ * ClientKeyExchange (RSA key transport is decrypted). Only those are
+ * worth a handshake thread.
+ */
+static int ssl_accept_key_step(SSL * ssl)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	switch (SSL_get_state(ssl)) {
+	case TLS_ST_BEFORE:
+	case TLS_ST_SW_SRVR_DONE:
+	case TLS_ST_SR_CERT:
+		return 1;
+	default:
+		return 0;
+	}
+#else
+	switch (SSL_state(ssl)) {
+	case SSL_ST_BEFORE | SSL_ST_ACCEPT:
+	case SSL_ST_ACCEPT:
+	case SSL3_ST_SR_CLNT_HELLO_A:
+	case SSL3_ST_SR_CLNT_HELLO_B:
+	case SSL3_ST_SR_CLNT_HELLO_C:
+	case SSL3_ST_SW_KEY_EXCH_A:
+	case SSL3_ST_SR_KEY_EXCH_A:
+	case SSL3_ST_SR_KEY_EXCH_B:
+		return 1;
+	default:
+		return 0;
+	}
+#endif
+}
+
 int ssl_accept(ssl_con_t * ssl_con)
 {
         int r_code;
+#ifdef HTTP2_SUPPORT
 	int ret= 0 ;
+#endif
         unsigned long es;
         //struct epoll_event ev;
-	ssl_con_t * http_con;
 	SSL_CTX *pctx_def = NULL;
 	SSL_CTX *pctx = NULL;
 	
@@ -647,6 +694,7 @@ int ssl_accept(ssl_con_t * ssl_con)
 
         if (ssl_con->ssl == NULL)
         {
+		ssl_con->hs_start_usec = ssl_hs_now_usec();
 		pctx = ssl_get_valid_vhost();
 		if(!pctx) {
 			DBG_LOG(WARNING, MOD_SSL, "No valid Virtual Host Config fd=%d", ssl_con->fd);
@@ -716,7 +764,82 @@ int ssl_accept(ssl_con_t * ssl_con)
 	}
 #endif
 
+	if (ssl_hs_pool_enabled() && ssl_accept_key_step(ssl_con->ssl)) {
+		/* nothing on this socket runs until the handshake thread
+		 * re-arms epoll; the timeout handler leaves it alone too */
+		NM_del_event_epoll(ssl_con->fd);
+		SET_CON_FLAG(ssl_con, CONF_SSL_ACCEPT | CONF_SSL_HS_QUEUED);
+		ssl_con->hs_incarn = gnm[ssl_con->fd].incarn;
+		ssl_hs_pool_enqueue(ssl_con);
+		return FALSE;
+	}
+
         r_code = SSL_accept(ssl_con->ssl);
+	return ssl_accept_done(ssl_con, r_code);
+}
+
+void ssl_accept_offloaded(ssl_con_t * ssl_con)
+{
+	int fd = ssl_con->fd;
+	unsigned int incarn = ssl_con->hs_incarn;
+	network_mgr_t * pnm = &gnm[fd];
+	int r_code;
+
+	r_code = SSL_accept(ssl_con->ssl);
+#ifdef SSL_MODE_ASYNC
+	if (r_code <= 0 &&
+	    SSL_get_error(ssl_con->ssl, r_code) == SSL_ERROR_WANT_ASYNC) {
+		/* queued again once the engine is done */
+		AO_fetch_and_add1(&glob_tot_handshake_async_wait);
+		if (ssl_hs_pool_wait_async(ssl_con) == 0) {
+			return;
+		}
+	}
+#endif
+
+	pthread_mutex_lock(&pnm->mutex);
+	if (pnm->incarn != incarn || pnm->private_data != ssl_con) {
+		/*
+		 * Cannot happen, nobody closes a queued connection. The fd
+		 * is no longer ours, so release only what the handshake
+		 * holds.
+		 */
+		DBG_LOG(SEVERE, MOD_SSL, "fd=%d closed during handshake", fd);
+		pthread_mutex_unlock(&pnm->mutex);
+		SSL_free(ssl_con->ssl);
+		AO_fetch_and_sub1(&glob_tot_ssl_ctx_cnt);
+		AO_fetch_and_sub1(&glob_cur_open_ssl_sockets);
+		free(ssl_con);
+		AO_fetch_and_sub1(&glob_tot_ssl_con_malloc_cnt);
+		return;
+	}
+	UNSET_CON_FLAG(ssl_con, CONF_SSL_HS_QUEUED);
+	NM_set_socket_active(pnm);
+	ssl_accept_done(ssl_con, r_code);
+	pthread_mutex_unlock(&pnm->mutex);
+}
+
+static void ssl_handshake_latency(ssl_con_t * ssl_con)
+{
+	uint64_t usec = ssl_hs_now_usec() - ssl_con->hs_start_usec;
+
+	AO_fetch_and_add(&glob_tot_handshake_usec, usec);
+	if (usec < 1000) {
+		AO_fetch_and_add1(&glob_handshake_lt_1ms);
+	} else if (usec < 10000) {
+		AO_fetch_and_add1(&glob_handshake_lt_10ms);
+	} else if (usec < 100000) {
+		AO_fetch_and_add1(&glob_handshake_lt_100ms);
+	} else {
+		AO_fetch_and_add1(&glob_handshake_ge_100ms);
+	}
+}
+
+static int ssl_accept_done(ssl_con_t * ssl_con, int r_code)
+{
+	int ret = 0;
+	ssl_con_t * http_con;
+
         if (r_code == 1) {
 #ifdef HTTP2_SUPPORT
 		ret = setup_http2_con(ssl_con);
@@ -757,6 +880,7 @@ int ssl_accept(ssl_con_t * ssl_con)
 		 */
 		SET_CON_FLAG(ssl_con, CONF_SSL_READY);
 		AO_fetch_and_add1(&glob_tot_handshake_done);
+		ssl_handshake_latency(ssl_con);
 
                 return TRUE;
         }
@@ -1335,9 +1459,18 @@ SSL_CTX * ssl_server_init(const char *cert_name, const char *key_name, const cha
 
 	SSL_CTX_set_tmp_rsa_callback(ssl_ctx, tmp_rsa_cb);
 
-	SSL_CTX_set_session_id_context(ssl_ctx,
-		(void*)&s_server_session_id_context,
-		sizeof(s_server_session_id_context)); 
+	/* also sets the session id context, one per virtual host */
+	if (ssl_sess_cache_setup_ctx(ssl_ctx, servername, cert_name) != 0) {
+		DBG_LOG(MSG, MOD_SSL, "Couldn't set session id context");
+		SSL_CTX_free(ssl_ctx);
+		return NULL;
+	}
+#ifdef SSL_MODE_ASYNC
+	if (ssl_handshake_threads > 0) {
+		/* lets an async engine pause the private key operation */
+		SSL_CTX_set_mode(ssl_ctx, SSL_MODE_ASYNC);
+	}
+#endif
    
 	/* 2. Set our cipher list */
 	if(ciphers && (ciphers[0]!=0)){
@@ -1457,6 +1590,12 @@ static int ssl_epollout(int fd, void *private_data)
 	DBG_LOG(MSG, MOD_SSL, "fd=%d called", fd);
 	UNUSED_ARGUMENT(fd);
 
+	if (CHECK_CON_FLAG(ssl_con, CONF_SSL_ACCEPT)) {
+		/* handshake wanted to write */
+		ssl_accept(ssl_con);
+		return TRUE;
+	}
+
 	http_con = (ssl_con_t *)gnm[ssl_con->peer_fd].private_data;
 	if (forward_response_to_ssl(http_con) == FALSE) {
 		close_conn(fd);
@@ -1491,6 +1630,10 @@ static int ssl_timeout(int fd, void * private_data, double timeout)
 	unsigned int incarn;
 	DBG_LOG(MSG, MOD_SSL, "fd=%d called", fd);
 	UNUSED_ARGUMENT(timeout);
+	if (CHECK_CON_FLAG(ssl_con, CONF_SSL_HS_QUEUED)) {
+		/* a handshake thread owns it, keep it */
+		return FALSE;
+	}
 	AO_fetch_and_add1(&glob_tot_ssl_timeout);
 	if (gnm[fd].peer_fd > 0 ) {
 		network_mgr_t *pnm = &gnm[ssl_con->peer_fd];
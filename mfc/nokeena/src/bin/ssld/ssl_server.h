@@ -47,6 +47,7 @@
 #define CONF_SSL_CONNECT	0x0000000000008000 
 #define CPF_USE_KA_SOCKET	0x0000000000010000
 #define CPF_IS_IPV6		0x0000000000020000
+#define CONF_SSL_HS_QUEUED	0x0000000000080000	// owned by a handshake thread
 
 #ifdef HTTP2_SUPPORT
 #define CONF_SPDY3_1		0x0000000000100000
@@ -150,6 +151,12 @@ typedef struct ssl_con_t{
 	ip_addr_t 	remote_src_ipv4v6;
 	uint16_t	remote_src_port;
 
+	/* handshake offload, see ssl_hs_pool.h */
+	TAILQ_ENTRY(ssl_con_t) hs_entry;
+	uint32_t	hs_incarn;
+	uint64_t	hs_start_usec;
+	uint64_t	hs_enq_usec;
+
 #ifdef HTTP2_SUPPORT
 	ng_proto_ctx_t ctx;
 #endif /* HTTP2_SUPPORT */
@@ -0,0 +1,706 @@
+/*
+ * ssl_sess_cache.c -- Shared TLS session cache and rotating ticket keys
+ *
+ * The segment holds
+ *  - a set associative session id cache (SSL_SCACHE_WAYS entries per
+ *    bucket) that replaces the per SSL_CTX OpenSSL cache, so that a
+ *    session created on one network thread / ssld instance resumes on
+ *    any other one.
+ *  - the session ticket master keys, one per rotation epoch
+ *    (time / ssl.ticket_key_rotate_secs). Tickets are issued with the
+ *    current key; tickets of the previous epoch are still accepted and
+ *    renewed, so a ticket stays valid for one to two rotation periods.
+ *
+ * Sessions never cross virtual hosts. Every virtual host SSL_CTX gets
+ * a tag derived from its host and certificate names, which is also its
+ * session id context. Cache entries are keyed by tag and session id,
+ * and the ticket key name, AES and HMAC keys of a virtual host are
+ * derived from the master keys and its tag. OpenSSL 1.0.x looks a
+ * session up before the SNI callback has picked the virtual host, so
+ * ssl_sess_cache_bind_vhost() checks a resumed session once it has.
+ *
+ * All locks are process shared robust mutexes. Writers clear the
+ * entry's valid field before filling it in and set it last, so an
+ * entry torn by a crashed writer is never used.
+ */
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+#include "ssl_defs.h"
+#include "nkn_debug.h"
+#include "nkn_stat.h"
+#include "ssl_sess_cache.h"
+#include "openssl/rand.h"
+#include "openssl/evp.h"
+#include "openssl/hmac.h"
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include "openssl/core_names.h"
+#endif
+
+NKNCNT_DEF(ssl_scache_hits, AO_t, "", "Shared session cache hits")
+NKNCNT_DEF(ssl_scache_misses, AO_t, "", "Shared session cache misses")
+NKNCNT_DEF(ssl_scache_stores, AO_t, "", "Sessions stored in the shared cache")
+NKNCNT_DEF(ssl_scache_evictions, AO_t, "", "Live sessions evicted from the shared cache")
+NKNCNT_DEF(ssl_scache_too_big, AO_t, "", "Sessions too large for the shared cache")
+NKNCNT_DEF(ssl_ticket_issued, AO_t, "", "Session tickets issued")
+NKNCNT_DEF(ssl_ticket_resumed, AO_t, "", "Session tickets accepted with the current key")
+NKNCNT_DEF(ssl_ticket_renewed, AO_t, "", "Session tickets accepted with the previous key and renewed")
+NKNCNT_DEF(ssl_ticket_unknown_key, AO_t, "", "Session tickets with an expired or unknown key")
+NKNCNT_DEF(ssl_ticket_key_rotations, AO_t, "", "Session ticket keys generated")
+NKNCNT_DEF(ssl_sess_vhost_mismatch, AO_t, "", "Resumed sessions refused for another virtual host")
+
+#define SSL_SCACHE_MAGIC	0x7373646361636865ULL
+#define SSL_SCACHE_VERSION	2
+#define SSL_SCACHE_WAYS		4
+#define SSL_SCACHE_LOCKS	64
+#define SSL_SCACHE_MAX_ID	SSL_MAX_SSL_SESSION_ID_LENGTH
+#define SSL_SCACHE_MAX_DER	1024
+#define SSL_SCACHE_ATTACH_WAIT	20	// x 100 msec
+
+#define SSL_TKEY_NAME_LEN	16
+#define SSL_TKEY_KEY_LEN	32
+#define SSL_VHOST_TAG_LEN	SSL_MAX_SID_CTX_LENGTH
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+#define SSL_SCACHE_CONST const
+#else
+#define SSL_SCACHE_CONST
+#endif
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+typedef EVP_MAC_CTX ssl_ticket_mac_ctx_t;
+#else
+typedef HMAC_CTX ssl_ticket_mac_ctx_t;
+#endif
+
+typedef struct ssl_scache_ent {
+	time_t		valid_until;	// 0: free or being written
+	uint32_t	id_len;
+	uint32_t	der_len;
+	unsigned char	tag[SSL_VHOST_TAG_LEN];
+	unsigned char	id[SSL_SCACHE_MAX_ID];
+	unsigned char	der[SSL_SCACHE_MAX_DER];
+} ssl_scache_ent_t;
+
+typedef struct ssl_tkey {
+	int64_t		epoch;		// -1: not set or being written
+	unsigned char	name[SSL_TKEY_NAME_LEN];
+	unsigned char	aes_key[SSL_TKEY_KEY_LEN];
+	unsigned char	hmac_key[SSL_TKEY_KEY_LEN];
+} ssl_tkey_t;
+
+typedef struct ssl_scache_hdr {
+	uint64_t	magic;		// set last by the creator
+	uint32_t	version;
+	uint32_t	n_buckets;
+	pthread_mutex_t	tkey_lock;
+	ssl_tkey_t	tkey[2];	// indexed by epoch & 1
+	pthread_mutex_t	lock[SSL_SCACHE_LOCKS];
+	ssl_scache_ent_t ent[0];	// n_buckets * SSL_SCACHE_WAYS
+} ssl_scache_hdr_t;
+
+int ssl_sess_cache_size = 20480;
+int ssl_sess_timeout = 300;
+int ssl_ticket_key_rotate_secs = 3600;
+
+static ssl_scache_hdr_t *scache = NULL;
+static int ssl_vhost_tag_idx = -1;
+static pthread_once_t ssl_vhost_tag_once = PTHREAD_ONCE_INIT;
+
+static size_t ssl_scache_seg_size(uint32_t n_buckets)
+{
+	return sizeof(ssl_scache_hdr_t) +
+		(size_t)n_buckets * SSL_SCACHE_WAYS * sizeof(ssl_scache_ent_t);
+}
+
+static void ssl_scache_mutex_init(pthread_mutex_t *m)
+{
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	pthread_mutex_init(m, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+static void ssl_scache_lock(pthread_mutex_t *m)
+{
+	if (pthread_mutex_lock(m) == EOWNERDEAD) {
+		/* the owner died; whatever it was writing is still marked
+		 * invalid, so the protected data is consistent */
+		pthread_mutex_consistent(m);
+	}
+}
+
+static uint32_t ssl_scache_hash(uint32_t h, const unsigned char *id,
+				unsigned int len)
+{
+	unsigned int i;
+
+	for (i = 0; i < len; i++) {
+		h ^= id[i];
+		h *= 16777619U;
+	}
+	return h;
+}
+
+static ssl_scache_ent_t *ssl_scache_bucket(const unsigned char *tag,
+					   const unsigned char *id,
+					   unsigned int id_len,
+					   pthread_mutex_t **lock)
+{
+	uint32_t b;
+
+	b = ssl_scache_hash(2166136261U, tag, SSL_VHOST_TAG_LEN);
+	b = ssl_scache_hash(b, id, id_len) % scache->n_buckets;
+
+	*lock = &scache->lock[b % SSL_SCACHE_LOCKS];
+	return &scache->ent[b * SSL_SCACHE_WAYS];
+}
+
+/*
+ * Create the segment, or attach to the one another ssld set up.
+ * Returns NULL if the existing segment cannot be used.
+ */
+static ssl_scache_hdr_t *ssl_scache_attach(uint32_t n_buckets)
+{
+	ssl_scache_hdr_t *hdr;
+	struct shmid_ds ds;
+	int shmid, i, retried = 0;
+
+again:
+	shmid = shmget(NKN_SSL_SCACHE_SHMKEY, ssl_scache_seg_size(n_buckets),
+		       IPC_CREAT | IPC_EXCL | 0600);
+	if (shmid >= 0) {
+		hdr = shmat(shmid, NULL, 0);
+		if (hdr == (void *)-1) {
+			DBG_LOG(SEVERE, MOD_SSL, "shmat session cache failed, errno=%d", errno);
+			return NULL;
+		}
+		/* shmget zero fills the segment */
+		hdr->version = SSL_SCACHE_VERSION;
+		hdr->n_buckets = n_buckets;
+		ssl_scache_mutex_init(&hdr->tkey_lock);
+		hdr->tkey[0].epoch = -1;
+		hdr->tkey[1].epoch = -1;
+		for (i = 0; i < SSL_SCACHE_LOCKS; i++) {
+			ssl_scache_mutex_init(&hdr->lock[i]);
+		}
+		__sync_synchronize();
+		hdr->magic = SSL_SCACHE_MAGIC;
+		DBG_LOG(MSG, MOD_SSL, "session cache created, %u entries",
+			n_buckets * SSL_SCACHE_WAYS);
+		return hdr;
+	}
+	if (errno != EEXIST) {
+		DBG_LOG(SEVERE, MOD_SSL, "shmget session cache failed, errno=%d", errno);
+		return NULL;
+	}
+
+	shmid = shmget(NKN_SSL_SCACHE_SHMKEY, 0, 0600);
+	if (shmid < 0 || shmctl(shmid, IPC_STAT, &ds) < 0) {
+		DBG_LOG(SEVERE, MOD_SSL, "session cache attach failed, errno=%d", errno);
+		return NULL;
+	}
+	hdr = shmat(shmid, NULL, 0);
+	if (hdr == (void *)-1) {
+		DBG_LOG(SEVERE, MOD_SSL, "shmat session cache failed, errno=%d", errno);
+		return NULL;
+	}
+	for (i = 0; i < SSL_SCACHE_ATTACH_WAIT &&
+		    hdr->magic != SSL_SCACHE_MAGIC; i++) {
+		usleep(100 * 1000);
+	}
+	if (hdr->magic == SSL_SCACHE_MAGIC &&
+	    hdr->version == SSL_SCACHE_VERSION &&
+	    ds.shm_segsz >= ssl_scache_seg_size(hdr->n_buckets)) {
+		/* the geometry of the running segment wins over the config */
+		if (hdr->n_buckets != n_buckets) {
+			DBG_LOG(WARNING, MOD_SSL, "session cache has %u entries,"
+				" configured %u", hdr->n_buckets * SSL_SCACHE_WAYS,
+				n_buckets * SSL_SCACHE_WAYS);
+		}
+		return hdr;
+	}
+
+	/* left over from an older ssld or from a creator that died
+	 * before finishing the set up; replace it once */
+	shmdt(hdr);
+	if (retried++ || shmctl(shmid, IPC_RMID, NULL) < 0) {
+		DBG_LOG(SEVERE, MOD_SSL, "unusable session cache segment");
+		return NULL;
+	}
+	goto again;
+}
+
+void ssl_sess_cache_init(void)
+{
+	uint32_t n_buckets = 0;
+
+	if (ssl_sess_cache_size > 0) {
+		n_buckets = (ssl_sess_cache_size + SSL_SCACHE_WAYS - 1) /
+			SSL_SCACHE_WAYS;
+	}
+	if (n_buckets == 0 && ssl_ticket_key_rotate_secs <= 0) {
+		return;
+	}
+
+	scache = ssl_scache_attach(n_buckets);
+	if (scache == NULL) {
+		DBG_LOG(SEVERE, MOD_SSL, "shared session cache disabled, "
+			"falling back to per context caches");
+	}
+}
+
+/* ***************************************************
+ * Virtual host tags
+ * *************************************************** */
+
+static void ssl_vhost_tag_free(void *parent, void *ptr, CRYPTO_EX_DATA *ad,
+			       int idx, long argl, void *argp)
+{
+	UNUSED_ARGUMENT(parent);
+	UNUSED_ARGUMENT(ad);
+	UNUSED_ARGUMENT(idx);
+	UNUSED_ARGUMENT(argl);
+	UNUSED_ARGUMENT(argp);
+	free(ptr);
+}
+
+static void ssl_vhost_tag_idx_init(void)
+{
+	ssl_vhost_tag_idx = SSL_CTX_get_ex_new_index(0, NULL, NULL, NULL,
+						     ssl_vhost_tag_free);
+}
+
+/* The tag of the virtual host 'ssl' is on right now, NULL if unknown. */
+static const unsigned char *ssl_vhost_tag(const SSL *ssl)
+{
+	if (ssl_vhost_tag_idx < 0) {
+		return NULL;
+	}
+	return SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), ssl_vhost_tag_idx);
+}
+
+static const unsigned char *ssl_sess_id_context(const SSL_SESSION *sess,
+						unsigned int *len)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	return SSL_SESSION_get0_id_context(sess, len);
+#else
+	*len = sess->sid_ctx_length;
+	return sess->sid_ctx;
+#endif
+}
+
+/* The tag a session was issued for, NULL if it carries none. */
+static const unsigned char *ssl_sess_tag(const SSL_SESSION *sess)
+{
+	const unsigned char *sid_ctx;
+	unsigned int len;
+
+	sid_ctx = ssl_sess_id_context(sess, &len);
+	return len == SSL_VHOST_TAG_LEN ? sid_ctx : NULL;
+}
+
+int ssl_sess_cache_bind_vhost(SSL *ssl)
+{
+	const unsigned char *tag, *sess_tag;
+	SSL_SESSION *sess;
+
+	tag = ssl_vhost_tag(ssl);
+	sess = SSL_get_session(ssl);
+	if (tag == NULL || sess == NULL) {
+		return 0;
+	}
+	if (!SSL_session_reused(ssl)) {
+		/* a new session belongs to the virtual host SNI picked,
+		 * not to the context the handshake started on */
+		return SSL_SESSION_set1_id_context(sess, tag,
+						   SSL_VHOST_TAG_LEN) == 1 ? 0 : -1;
+	}
+	sess_tag = ssl_sess_tag(sess);
+	if (sess_tag == NULL || memcmp(sess_tag, tag, SSL_VHOST_TAG_LEN)) {
+		AO_fetch_and_add1(&glob_ssl_sess_vhost_mismatch);
+		return -1;
+	}
+	return 0;
+}
+
+/* ***************************************************
+ * Session id cache
+ * *************************************************** */
+
+static int ssl_scache_new_cb(SSL *ssl, SSL_SESSION *sess)
+{
+	unsigned char der[SSL_SCACHE_MAX_DER], *p;
+	const unsigned char *id, *tag;
+	unsigned int id_len;
+	ssl_scache_ent_t *ent, *victim = NULL;
+	pthread_mutex_t *lock;
+	time_t now;
+	int der_len, i;
+
+	UNUSED_ARGUMENT(ssl);
+	id = SSL_SESSION_get_id(sess, &id_len);
+	tag = ssl_sess_tag(sess);
+	if (id_len == 0 || id_len > SSL_SCACHE_MAX_ID || tag == NULL) {
+		return 0;
+	}
+	der_len = i2d_SSL_SESSION(sess, NULL);
+	if (der_len <= 0 || der_len > SSL_SCACHE_MAX_DER) {
+		AO_fetch_and_add1(&glob_ssl_scache_too_big);
+		return 0;
+	}
+	p = der;
+	i2d_SSL_SESSION(sess, &p);
+	now = time(NULL);
+
+	ent = ssl_scache_bucket(tag, id, id_len, &lock);
+	ssl_scache_lock(lock);
+	for (i = 0; i < SSL_SCACHE_WAYS; i++) {
+		if (ent[i].valid_until > now && ent[i].id_len == id_len &&
+		    memcmp(ent[i].id, id, id_len) == 0 &&
+		    memcmp(ent[i].tag, tag, SSL_VHOST_TAG_LEN) == 0) {
+			victim = &ent[i];
+			break;
+		}
+		if (victim == NULL ||
+		    ent[i].valid_until < victim->valid_until) {
+			victim = &ent[i];
+		}
+	}
+	if (victim->valid_until > now && i == SSL_SCACHE_WAYS) {
+		AO_fetch_and_add1(&glob_ssl_scache_evictions);
+	}
+	victim->valid_until = 0;
+	__sync_synchronize();
+	victim->id_len = id_len;
+	memcpy(victim->tag, tag, SSL_VHOST_TAG_LEN);
+	memcpy(victim->id, id, id_len);
+	victim->der_len = der_len;
+	memcpy(victim->der, der, der_len);
+	__sync_synchronize();
+	victim->valid_until = now + SSL_SESSION_get_timeout(sess);
+	pthread_mutex_unlock(lock);
+
+	AO_fetch_and_add1(&glob_ssl_scache_stores);
+	/* the cache keeps its own copy, OpenSSL keeps the reference */
+	return 0;
+}
+
+static SSL_SESSION *ssl_scache_get_cb(SSL *ssl, SSL_SCACHE_CONST unsigned char *id,
+				      int id_len, int *copy)
+{
+	unsigned char der[SSL_SCACHE_MAX_DER];
+	const unsigned char *p, *tag;
+	ssl_scache_ent_t *ent;
+	pthread_mutex_t *lock;
+	time_t now;
+	int der_len = 0, i;
+
+	*copy = 0;
+	tag = ssl_vhost_tag(ssl);
+	if (id_len <= 0 || id_len > SSL_SCACHE_MAX_ID || tag == NULL) {
+		AO_fetch_and_add1(&glob_ssl_scache_misses);
+		return NULL;
+	}
+	now = time(NULL);
+
+	/* only sessions of the virtual host the handshake is on */
+	ent = ssl_scache_bucket(tag, id, id_len, &lock);
+	ssl_scache_lock(lock);
+	for (i = 0; i < SSL_SCACHE_WAYS; i++) {
+		if (ent[i].valid_until > now &&
+		    ent[i].id_len == (uint32_t)id_len &&
+		    memcmp(ent[i].id, id, id_len) == 0 &&
+		    memcmp(ent[i].tag, tag, SSL_VHOST_TAG_LEN) == 0) {
+			der_len = ent[i].der_len;
+			memcpy(der, ent[i].der, der_len);
+			break;
+		}
+	}
+	pthread_mutex_unlock(lock);
+
+	if (der_len == 0) {
+		AO_fetch_and_add1(&glob_ssl_scache_misses);
+		return NULL;
+	}
+	AO_fetch_and_add1(&glob_ssl_scache_hits);
+	p = der;
+	return d2i_SSL_SESSION(NULL, &p, der_len);
+}
+
+static void ssl_scache_remove_cb(SSL_CTX *ctx, SSL_SESSION *sess)
+{
+	const unsigned char *id, *tag;
+	unsigned int id_len;
+	ssl_scache_ent_t *ent;
+	pthread_mutex_t *lock;
+	int i;
+
+	UNUSED_ARGUMENT(ctx);
+	id = SSL_SESSION_get_id(sess, &id_len);
+	tag = ssl_sess_tag(sess);
+	if (id_len == 0 || id_len > SSL_SCACHE_MAX_ID || tag == NULL) {
+		return;
+	}
+
+	ent = ssl_scache_bucket(tag, id, id_len, &lock);
+	ssl_scache_lock(lock);
+	for (i = 0; i < SSL_SCACHE_WAYS; i++) {
+		if (ent[i].id_len == id_len &&
+		    memcmp(ent[i].id, id, id_len) == 0 &&
+		    memcmp(ent[i].tag, tag, SSL_VHOST_TAG_LEN) == 0) {
+			ent[i].valid_until = 0;
+		}
+	}
+	pthread_mutex_unlock(lock);
+}
+
+/* ***************************************************
+ * Session ticket keys
+ * *************************************************** */
+
+/* Copies out the key for 'epoch', generating it on first use. */
+static int ssl_tkey_current(int64_t epoch, ssl_tkey_t *key)
+{
+	ssl_tkey_t *slot = &scache->tkey[epoch & 1];
+	int ret = 0;
+
+	ssl_scache_lock(&scache->tkey_lock);
+	/* a slot ahead of us means another ssld's clock is ahead; use
+	 * its key rather than going back */
+	if (slot->epoch < epoch) {
+		slot->epoch = -1;
+		__sync_synchronize();
+		if (RAND_bytes(slot->name, sizeof(slot->name)) <= 0 ||
+		    RAND_bytes(slot->aes_key, sizeof(slot->aes_key)) <= 0 ||
+		    RAND_bytes(slot->hmac_key, sizeof(slot->hmac_key)) <= 0) {
+			ret = -1;
+		} else {
+			__sync_synchronize();
+			slot->epoch = epoch;
+			AO_fetch_and_add1(&glob_ssl_ticket_key_rotations);
+		}
+	}
+	if (ret == 0) {
+		memcpy(key, slot, sizeof(*key));
+	}
+	pthread_mutex_unlock(&scache->tkey_lock);
+	return ret;
+}
+
+/*
+ * The keys of one virtual host are HMAC-SHA256(master key, tag), so
+ * a ticket issued for one virtual host names no key on another one.
+ */
+static int ssl_tkey_vhost(const ssl_tkey_t *master, const unsigned char *tag,
+			  ssl_tkey_t *key)
+{
+	unsigned char md[EVP_MAX_MD_SIZE];
+	unsigned int len;
+
+	key->epoch = master->epoch;
+	if (HMAC(EVP_sha256(), master->name, sizeof(master->name),
+		 tag, SSL_VHOST_TAG_LEN, md, &len) == NULL ||
+	    HMAC(EVP_sha256(), master->aes_key, sizeof(master->aes_key),
+		 tag, SSL_VHOST_TAG_LEN, key->aes_key, &len) == NULL ||
+	    HMAC(EVP_sha256(), master->hmac_key, sizeof(master->hmac_key),
+		 tag, SSL_VHOST_TAG_LEN, key->hmac_key, &len) == NULL) {
+		return -1;
+	}
+	memcpy(key->name, md, sizeof(key->name));
+	return 0;
+}
+
+/* Finds the current or previous epoch's key of a virtual host by name. */
+static int ssl_tkey_lookup(const unsigned char *name, int64_t epoch,
+			   const unsigned char *tag, ssl_tkey_t *key)
+{
+	ssl_tkey_t master[2];
+	int i;
+
+	ssl_scache_lock(&scache->tkey_lock);
+	memcpy(master, scache->tkey, sizeof(master));
+	pthread_mutex_unlock(&scache->tkey_lock);
+
+	for (i = 0; i < 2; i++) {
+		if (master[i].epoch >= epoch - 1 &&
+		    ssl_tkey_vhost(&master[i], tag, key) == 0 &&
+		    memcmp(key->name, name, SSL_TKEY_NAME_LEN) == 0) {
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Common part of the ticket key callbacks: picks the key and sets up
+ * the cipher. Returns as the OpenSSL callback does; on 1 or 2 'key'
+ * holds the HMAC key to use.
+ */
+static int ssl_ticket_key(SSL *ssl, unsigned char *key_name,
+			  unsigned char *iv, EVP_CIPHER_CTX *ectx, int enc,
+			  ssl_tkey_t *key)
+{
+	const unsigned char *tag;
+	ssl_tkey_t master;
+	int64_t epoch;
+
+	tag = ssl_vhost_tag(ssl);
+	if (tag == NULL) {
+		return enc ? -1 : 0;
+	}
+	epoch = time(NULL) / ssl_ticket_key_rotate_secs;
+
+	if (enc) {
+		if (ssl_tkey_current(epoch, &master) != 0 ||
+		    ssl_tkey_vhost(&master, tag, key) != 0 ||
+		    RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) <= 0) {
+			return -1;
+		}
+		memcpy(key_name, key->name, SSL_TKEY_NAME_LEN);
+		if (!EVP_EncryptInit_ex(ectx, EVP_aes_256_cbc(), NULL,
+					key->aes_key, iv)) {
+			return -1;
+		}
+		AO_fetch_and_add1(&glob_ssl_ticket_issued);
+		return 1;
+	}
+
+	if (ssl_tkey_lookup(key_name, epoch, tag, key) != 0) {
+		/* full handshake, a new ticket is issued */
+		AO_fetch_and_add1(&glob_ssl_ticket_unknown_key);
+		return 0;
+	}
+	if (!EVP_DecryptInit_ex(ectx, EVP_aes_256_cbc(), NULL,
+				key->aes_key, iv)) {
+		return -1;
+	}
+	if (key->epoch < epoch) {
+		AO_fetch_and_add1(&glob_ssl_ticket_renewed);
+		return 2;
+	}
+	AO_fetch_and_add1(&glob_ssl_ticket_resumed);
+	return 1;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+static int ssl_ticket_key_cb(SSL *ssl, unsigned char *key_name,
+			     unsigned char *iv, EVP_CIPHER_CTX *ectx,
+			     ssl_ticket_mac_ctx_t *mctx, int enc)
+{
+	OSSL_PARAM params[3];
+	ssl_tkey_t key;
+	int ret;
+
+	ret = ssl_ticket_key(ssl, key_name, iv, ectx, enc, &key);
+	if (ret <= 0) {
+		return ret;
+	}
+	params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY,
+						      key.hmac_key,
+						      sizeof(key.hmac_key));
+	params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST,
+						     (char *)"SHA256", 0);
+	params[2] = OSSL_PARAM_construct_end();
+	if (!EVP_MAC_CTX_set_params(mctx, params)) {
+		return -1;
+	}
+	return ret;
+}
+#else
+static int ssl_ticket_key_cb(SSL *ssl, unsigned char *key_name,
+			     unsigned char *iv, EVP_CIPHER_CTX *ectx,
+			     ssl_ticket_mac_ctx_t *mctx, int enc)
+{
+	ssl_tkey_t key;
+	int ret;
+
+	ret = ssl_ticket_key(ssl, key_name, iv, ectx, enc, &key);
+	if (ret <= 0) {
+		return ret;
+	}
+	HMAC_Init_ex(mctx, key.hmac_key, sizeof(key.hmac_key),
+		     EVP_sha256(), NULL);
+	return ret;
+}
+#endif
+
+/*
+ * The tag is SHA-256 over the virtual host and certificate names, so it
+ * is the same in every ssld instance and across restarts.
+ */
+int ssl_sess_cache_setup_ctx(SSL_CTX *ctx, const char *vhost,
+			     const char *cert)
+{
+	unsigned char *tag;
+	EVP_MD_CTX *mdctx;
+	int ok;
+
+	pthread_once(&ssl_vhost_tag_once, ssl_vhost_tag_idx_init);
+	if (ssl_vhost_tag_idx < 0) {
+		return -1;
+	}
+	tag = malloc(EVP_MAX_MD_SIZE);
+	if (tag == NULL) {
+		return -1;
+	}
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	mdctx = EVP_MD_CTX_new();
+#else
+	mdctx = EVP_MD_CTX_create();
+#endif
+	ok = mdctx != NULL &&
+	     EVP_DigestInit_ex(mdctx, EVP_sha256(), NULL) &&
+	     EVP_DigestUpdate(mdctx, "ssld:", 5) &&
+	     EVP_DigestUpdate(mdctx, vhost ? vhost : "", strlen(vhost ? vhost : "") + 1) &&
+	     EVP_DigestUpdate(mdctx, cert ? cert : "", strlen(cert ? cert : "")) &&
+	     EVP_DigestFinal_ex(mdctx, tag, NULL);
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	EVP_MD_CTX_free(mdctx);
+#else
+	if (mdctx) {
+		EVP_MD_CTX_destroy(mdctx);
+	}
+#endif
+	if (!ok ||
+	    !SSL_CTX_set_session_id_context(ctx, tag, SSL_VHOST_TAG_LEN) ||
+	    !SSL_CTX_set_ex_data(ctx, ssl_vhost_tag_idx, tag)) {
+		free(tag);
+		return -1;
+	}
+
+	if (ssl_sess_timeout > 0) {
+		SSL_CTX_set_timeout(ctx, ssl_sess_timeout);
+	}
+	if (scache == NULL) {
+		return 0;
+	}
+
+	if (scache->n_buckets) {
+		SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER |
+					       SSL_SESS_CACHE_NO_INTERNAL);
+		SSL_CTX_sess_set_new_cb(ctx, ssl_scache_new_cb);
+		SSL_CTX_sess_set_get_cb(ctx, ssl_scache_get_cb);
+		SSL_CTX_sess_set_remove_cb(ctx, ssl_scache_remove_cb);
+	}
+	if (ssl_ticket_key_rotate_secs > 0) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+		SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, ssl_ticket_key_cb);
+#else
+		SSL_CTX_set_tlsext_ticket_key_cb(ctx, ssl_ticket_key_cb);
+#endif
+	}
+	return 0;
+}
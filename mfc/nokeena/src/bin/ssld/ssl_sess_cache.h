@@ -0,0 +1,41 @@
+/*
+ * ssl_sess_cache.h -- Shared TLS session resumption state
+ *
+ * Session ids and ticket keys live in a SysV shared memory segment so
+ * that a client resumes on any network thread, on any ssld instance
+ * and across an ssld restart, but only on the virtual host that issued
+ * the session.
+ */
+#ifndef SSL_SESS_CACHE_H
+#define SSL_SESS_CACHE_H
+
+#include "ssl_defs.h"
+
+/* config, see ssl_cfg.c */
+extern int ssl_sess_cache_size;		// entries, 0: per SSL_CTX cache only
+extern int ssl_sess_timeout;		// seconds
+extern int ssl_ticket_key_rotate_secs;	// 0: per SSL_CTX ticket keys only
+
+/*
+ * Attach (or create) the shared segment. Must be called after the
+ * configuration has been read and before the first SSL_CTX is set up.
+ * On failure ssld keeps the OpenSSL per SSL_CTX caches.
+ */
+void ssl_sess_cache_init(void);
+
+/*
+ * Tag a virtual host SSL_CTX (also its session id context) and install
+ * the shared session cache and ticket key callbacks on it.
+ * Returns 0 on success, -1 if the context could not be tagged.
+ */
+int ssl_sess_cache_setup_ctx(SSL_CTX *ctx, const char *vhost,
+			     const char *cert);
+
+/*
+ * Call from the SNI callback after switching the SSL_CTX: moves a new
+ * session to the chosen virtual host, refuses a resumed one issued for
+ * another. Returns 0, or -1 if the handshake must be aborted.
+ */
+int ssl_sess_cache_bind_vhost(SSL *ssl);
+
+#endif /* SSL_SESS_CACHE_H */
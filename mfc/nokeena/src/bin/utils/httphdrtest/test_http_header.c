@@ -10,6 +10,7 @@
 #include <strings.h>
 #include <string.h>
 #include <alloca.h>
+#include <time.h>
 #include "http_header.h"
 #include "nkn_memalloc.h"
 
@@ -30,6 +31,7 @@ typedef struct hdrval {
 
 //void nkn_errorlog(char * fmt, ...);
 hdrname_t *known_headers_to_buffer(int map, int *bufsize);
+int test_15(void);
 int test_11(void);
 int test_10(void);
 int test_10a(void);
@@ -132,6 +134,199 @@ void log_debug_msg(int dlevel, uint64_t dmodule, const char * fmt, ...)
 {
 }
 
+static void test_15_verify(const mime_header_t *src, const mime_header_t *dst)
+{
+    int rv;
+    int n, nth;
+    const char *data, *data2;
+    int datalen, datalen2;
+    const char *name, *name2;
+    int namelen, namelen2;
+    uint32_t attrs;
+
+    for (n = 0; n < MIME_HDR_MAX_DEFS; n++) {
+	assert(!src->known_header_map[n] == !dst->known_header_map[n]);
+	for (nth = 0; ; nth++) {
+	    rv = get_nth_known_header(src, n, nth, &data, &datalen, &attrs);
+	    if (rv) {
+		rv = get_nth_known_header(dst, n, nth, &data2, &datalen2,
+					  &attrs);
+		assert(rv);
+		break;
+	    }
+	    rv = get_nth_known_header(dst, n, nth, &data2, &datalen2, &attrs);
+	    assert(rv == 0);
+	    assert(datalen == datalen2);
+	    assert(memcmp(data, data2, datalen) == 0);
+	}
+    }
+    assert(src->cnt_unknown_headers == dst->cnt_unknown_headers);
+    for (nth = 0; nth < src->cnt_unknown_headers; nth++) {
+	rv = get_nth_unknown_header(src, nth, &name, &namelen, 
+				    &data, &datalen, &attrs);
+	assert(rv == 0);
+	rv = get_nth_unknown_header(dst, nth, &name2, &namelen2, 
+				    &data2, &datalen2, &attrs);
+	assert(rv == 0);
+	assert(namelen == namelen2);
+	assert(memcmp(name, name2, namelen) == 0);
+	assert(datalen == datalen2);
+	assert(memcmp(data, data2, datalen) == 0);
+    }
+}
+
+int test_15(void)
+{
+    mime_header_t hd;
+    mime_header_t deserialized_hd;
+    int rv;
+    int n;
+    int serialbuf_size;
+    int compactbuf_size;
+    char *serialbuf;
+    char *compactbuf;
+    char extbuf[4096];
+    const char *data;
+    int datalen;
+    uint32_t attrs;
+    int hcnt;
+    char name[64], val[64];
+    int namelen, vallen;
+    struct timespec t0, t1;
+    double legacy_ns, compact_ns;
+    const int loops = 200000;
+    const char *resp =
+	"Date: Tue, 14 Oct 2014 10:11:12 GMT\r\n"
+	"Server: Apache/2.2.15 (CentOS)\r\n"
+	"Last-Modified: Mon, 13 Oct 2014 09:00:00 GMT\r\n"
+	"ETag: \"1a2b3c-4d5e-6f7a8b9c\"\r\n"
+	"Accept-Ranges: bytes\r\n"
+	"Content-Length: 123456\r\n"
+	"Cache-Control: max-age=3600\r\n"
+	"Cache-Control: public\r\n"
+	"Expires: Tue, 14 Oct 2014 11:11:12 GMT\r\n"
+	"Content-Type: video/mp4\r\n";
+
+    rv = init_http_header(&hd, resp, strlen(resp));
+    assert(rv == 0);
+    add_known_header(&hd, MIME_HDR_DATE, resp + 6, 29);
+    add_known_header(&hd, MIME_HDR_SERVER, "Apache/2.2.15 (CentOS)", 22);
+    add_known_header(&hd, MIME_HDR_LAST_MODIFIED, 
+		     "Mon, 13 Oct 2014 09:00:00 GMT", 29);
+    add_known_header(&hd, MIME_HDR_ETAG, "\"1a2b3c-4d5e-6f7a8b9c\"", 22);
+    add_known_header(&hd, MIME_HDR_ACCEPT_RANGES, "bytes", 5);
+    add_known_header(&hd, MIME_HDR_CONTENT_LENGTH, "123456", 6);
+    add_known_header(&hd, MIME_HDR_CACHE_CONTROL, "max-age=3600", 12);
+    add_known_header(&hd, MIME_HDR_CACHE_CONTROL, "public", 6);
+    add_known_header(&hd, MIME_HDR_EXPIRES, 
+		     "Tue, 14 Oct 2014 11:11:12 GMT", 29);
+    add_known_header(&hd, MIME_HDR_CONTENT_TYPE, "video/mp4", 9);
+    add_unknown_header(&hd, "X-Cache", 7, "MISS from origin", 16);
+    add_unknown_header(&hd, "Access-Control-Allow-Origin", 27, "*", 1);
+    add_unknown_header(&hd, "X-Custom-Trace", 14, "a=1;b=2", 7);
+    for (n = 0; n < 8; n++) {
+	namelen = snprintf(name, sizeof(name), "x-unk-%d", n);
+	vallen = snprintf(val, sizeof(val), "unk-val-%d", n);
+	rv = add_unknown_header(&hd, name, namelen, val, vallen);
+	assert(rv == 0);
+    }
+
+    serialbuf_size = mime_hdr_serialize_datasize(&hd, 0, 0, 0);
+    assert(serialbuf_size > 0);
+    serialbuf = alloca(serialbuf_size);
+    rv = mime_hdr_serialize(&hd, serialbuf, serialbuf_size);
+    assert(rv == 0);
+
+    compactbuf_size = mime_hdr_serialize_compact_datasize(&hd);
+    assert(compactbuf_size > 0);
+    assert(compactbuf_size < serialbuf_size);
+    compactbuf = alloca(compactbuf_size);
+    rv = mime_hdr_serialize_compact(&hd, compactbuf, compactbuf_size);
+    assert(rv == 0);
+    rv = mime_hdr_serialize_compact(&hd, compactbuf, compactbuf_size - 1);
+    assert(rv != 0);
+
+    // Reference, heap copy and extdata copy
+    rv = init_http_header(&deserialized_hd, 0, 0);
+    assert(rv == 0);
+    rv = mime_hdr_deserialize(compactbuf, compactbuf_size, &deserialized_hd,
+			      (char *)1, 0);
+    assert(rv == 0);
+    test_15_verify(&hd, &deserialized_hd);
+    rv = get_known_header(&deserialized_hd, MIME_HDR_CACHE_CONTROL, 
+			  &data, &datalen, &attrs, &hcnt);
+    assert(rv == 0);
+    assert(hcnt == 2);
+    assert(data >= compactbuf && data < compactbuf + compactbuf_size);
+    rv = shutdown_http_header(&deserialized_hd);
+    assert(rv == 0);
+
+    rv = init_http_header(&deserialized_hd, 0, 0);
+    assert(rv == 0);
+    rv = mime_hdr_deserialize(compactbuf, compactbuf_size, &deserialized_hd,
+			      0, 0);
+    assert(rv == 0);
+    test_15_verify(&hd, &deserialized_hd);
+    rv = shutdown_http_header(&deserialized_hd);
+    assert(rv == 0);
+
+    rv = init_http_header(&deserialized_hd, 0, 0);
+    assert(rv == 0);
+    rv = mime_hdr_deserialize(compactbuf, compactbuf_size, &deserialized_hd,
+			      extbuf, sizeof(extbuf));
+    assert(rv == 0);
+    test_15_verify(&hd, &deserialized_hd);
+    rv = shutdown_http_header(&deserialized_hd);
+    assert(rv == 0);
+
+    // Truncated or corrupt input is rejected
+    rv = init_http_header(&deserialized_hd, 0, 0);
+    assert(rv == 0);
+    rv = mime_hdr_deserialize(compactbuf, compactbuf_size - 1, 
+			      &deserialized_hd, (char *)1, 0);
+    assert(rv != 0);
+    rv = shutdown_http_header(&deserialized_hd);
+    assert(rv == 0);
+
+    // Namevalue headers need the serial_mime_header_t format
+    add_namevalue_header(&hd, "nv", 2, "1", 1, 0);
+    assert(mime_hdr_serialize_compact_datasize(&hd) == 0);
+
+    // Deserialize cost, serial_mime_header_t vs compact
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (n = 0; n < loops; n++) {
+	init_http_header(&deserialized_hd, 0, 0);
+	rv = mime_hdr_deserialize(serialbuf, serialbuf_size, &deserialized_hd,
+				  (char *)1, 0);
+	get_known_header(&deserialized_hd, MIME_HDR_CONTENT_LENGTH, 
+			 &data, &datalen, &attrs, &hcnt);
+	shutdown_http_header(&deserialized_hd);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    legacy_ns = ((t1.tv_sec - t0.tv_sec) * 1e9 + 
+		 (t1.tv_nsec - t0.tv_nsec)) / loops;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (n = 0; n < loops; n++) {
+	init_http_header(&deserialized_hd, 0, 0);
+	rv = mime_hdr_deserialize(compactbuf, compactbuf_size, 
+				  &deserialized_hd, (char *)1, 0);
+	get_known_header(&deserialized_hd, MIME_HDR_CONTENT_LENGTH, 
+			 &data, &datalen, &attrs, &hcnt);
+	shutdown_http_header(&deserialized_hd);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    compact_ns = ((t1.tv_sec - t0.tv_sec) * 1e9 + 
+		  (t1.tv_nsec - t0.tv_nsec)) / loops;
+
+    printf("test_15: serial %d bytes %.0f ns, compact %d bytes %.0f ns\n",
+	   serialbuf_size, legacy_ns, compactbuf_size, compact_ns);
+
+    rv = shutdown_http_header(&hd);
+    assert(rv == 0);
+    return 0;
+}
+
 int test_14(void)
 {
     int n;
@@ -2153,6 +2348,14 @@ main (int argc, char **argv)
     rv = test_14();
     assert(rv == 0);
 
+    /*
+     ***************************************************************************
+     * test_15 -- Compact serialization
+     ***************************************************************************
+     */
+    rv = test_15();
+    assert(rv == 0);
+
     rv = shutdown_http_headers();
     assert(rv == 0);
     printf("\nSuccess...\n");
@@ -32,9 +32,13 @@
 #define GET_SCRIPT_NAME_ASSET_MAP "get-asset-map"
 #define GET_ASSET_MAP_QS_KEY "key="
 #define GET_ASSET_MAP_QS_KEY_STRLEN 4
+#define GET_ASSET_MAP_QS_SINCE "since="
+#define GET_ASSET_MAP_QS_SINCE_STRLEN 6
 
 #define HTTP_GET_ASSET_SERVER_IP "127.0.0.1"
 #define HTTP_GET_ASSET_SERVER_PORT 8888
+#define HTTP_GET_ASSET_H_HEADER "X-OCRP-H" // <seqno>:<version> of the map
+#define HTTP_GET_ASSET_H_HEADER_STRLEN 8
 
 #endif /* _OCRP_CGI_PARAMS_H_ */
 /*
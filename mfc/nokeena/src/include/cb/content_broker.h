@@ -10,6 +10,10 @@
 
 #define CB_TRIE_CKP_1 "/nkn/cb/CB_TRIE_CKP-1.data"
 #define CB_TRIE_CKP_2 "/nkn/cb/CB_TRIE_CKP-2.data"
+#define CB_TRIE_SNAP "/nkn/cb/CB_TRIE_SNAP.data"
+#define CB_TRIE_GROUP_COMMIT_MSECS 100
+
+#define CB_ASSET_MAP_JOURNAL_ENTRIES (64 * 1024) // get-asset-map deltas
 
 typedef struct OCRP_fh_user_data { // fh_user_data_t overlay
     union {
@@ -0,0 +1,135 @@
+/**
+ * @file   de_snapshot.h
+ * @date   Mon Oct 19 2026
+ *
+ * @brief  precompiled, immutable decision tables for the content
+ * router decision engines. A snapshot is compiled from the same
+ * crst_search_out_t that the decision engines consume, by a
+ * background thread, and published into a domain with a single
+ * atomic pointer swap. The data plane then decides with a table
+ * lookup and without holding any of the store locks.
+ *
+ */
+#ifndef _DE_SNAPSHOT_
+#define _DE_SNAPSHOT_
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "de_intf.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if 0 //keeps emacs happy
+}
+#endif
+
+/* the ranked candidate list is packed into a 64 bit word, hence
+ * the limits on candidate count and rank depth
+ */
+#define DE_SNAP_MAX_CE 255
+#define DE_SNAP_MAX_RANK 4
+
+/* client prefix (/24) memo table; must be a power of 2 */
+#define DE_SNAP_PREFIX_SLOTS 8192
+#define DE_SNAP_PREFIX_PROBE 8
+
+typedef struct tag_de_snap_rec {
+    uint8_t *buf;
+    uint32_t len;
+} de_snap_rec_t;
+
+typedef struct tag_de_snap_ce {
+    conjugate_graticule_t loc;
+    double load;		/**< cpu load normalized against the
+				 * most loaded candidate
+				 */
+    de_snap_rec_t rec[ce_addr_type_max + 1];	/**< pre-built
+						 * responses per
+						 * query type; the
+						 * ce_addr_type_max
+						 * slot carries all
+						 * records
+						 */
+} de_snap_ce_t;
+
+typedef struct tag_de_snapshot {
+    uint64_t gen;		/**< store generation compiled from */
+    routing_type_t type;
+    uint32_t num_ce;		/**< usable candidates only */
+    de_snap_ce_t *ce;
+    AO_t rr_cursor;
+    AO_t *prefix_tbl;		/**< packed client prefix -> ranked
+				 * candidate list, insert only
+				 */
+    AO_t readers;
+    uint64_t retire_epoch;	/**< reclaim epoch at unpublish */
+    struct tag_de_snapshot *next_retired;
+} de_snapshot_t;
+
+/**
+ * compiles a decision snapshot from a filled search output. Only
+ * candidates that the decision engines would consider (not down or
+ * unreachable and under their load watermark) are retained, load feedback is normalized and the resource record
+ * responses for each candidate are built up front
+ *
+ * @param di [in] - the search output as filled for the decision
+ * engines
+ * @param type [in] - routing type of the domain
+ * @param gen [in] - store generation the input was read at
+ * @param out [out] - the compiled snapshot
+ *
+ * @return 0 on success, -E2BIG if the candidate set cannot be
+ * packed and -errno on other errors
+ */
+int32_t de_snapshot_create(const crst_search_out_t *di,
+			   routing_type_t type, uint64_t gen,
+			   de_snapshot_t **out);
+
+void de_snapshot_destroy(de_snapshot_t *snap);
+
+/**
+ * lock free decision against a published snapshot; the result
+ * buffer is allocated and needs to be freed by the caller, same as
+ * with the decide interface of the decision engines
+ *
+ * @return 0 on success, non zero if no candidate could be picked
+ */
+int32_t de_snapshot_decide(de_snapshot_t *snap,
+			   const char *client_addr,
+			   cache_entity_addr_type_t qtype,
+			   uint8_t **result, uint32_t *result_len);
+
+/**
+ * returns the snapshot published in 'slot' with a reader hold or
+ * NULL if nothing is published yet. Every successful acquire must
+ * be paired with a de_snapshot_release
+ */
+de_snapshot_t *de_snapshot_acquire(AO_t *slot);
+
+void de_snapshot_release(de_snapshot_t *snap);
+
+/**
+ * atomically replaces the snapshot in 'slot' with 'snap' (which can
+ * be NULL) and retires the previous one
+ */
+void de_snapshot_publish(AO_t *slot, de_snapshot_t *snap);
+
+/**
+ * frees retired snapshots that no reader can reach anymore and that
+ * have no readers, then advances the reclaim epoch; called
+ * periodically from the snapshot builder. A snapshot is freed at the
+ * earliest on the second call after it was retired
+ *
+ * @return number of snapshots freed
+ */
+uint32_t de_snapshot_reclaim(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //_DE_SNAPSHOT_
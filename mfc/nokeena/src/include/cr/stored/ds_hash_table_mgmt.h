@@ -70,6 +70,15 @@ int32_t ds_cont_write_unlock(hash_tbl_props_t* ds_con);
 int32_t ds_cont_read_lock(hash_tbl_props_t* ds_con);
 int32_t ds_cont_read_unlock(hash_tbl_props_t* ds_con);
 
+/* store generation; advances on CE/CG/POP/domain changes that alter
+ * a routing decision (membership, addresses, location, TTL, routing
+ * policy) and on LF feedback that changes a CE status or moves its
+ * load by more than DS_LF_LOAD_GEN_DELTA. Writers mark the update
+ * before dropping the container write lock
+ */
+void ds_cont_mark_updated(void);
+uint64_t ds_cont_get_gen(void);
+
 #ifdef __cplusplus
 }
 #endif
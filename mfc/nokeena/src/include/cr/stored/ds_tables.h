@@ -72,6 +72,9 @@ typedef struct domain_list{
     GList* cg_ptr_list;
     void *de_state;
     const de_intf_t *de_cb;
+    AO_t de_snap;		/* published de_snapshot_t */
+    AO_t de_snap_pending;	/* queued for a snapshot rebuild */
+    uint64_t de_snap_fail_gen;	/* store gen of last failed compile */
     uint32_t ttl;
     domain_stats_t stats;
 }domain_t;
@@ -123,6 +126,7 @@ typedef struct cache_entity{
     lfc_attr_t lf_attr;
     obj_lf_client_t *lfc;
     lf_stats_t fb;
+    double fb_gen_load;		/* load at the last generation bump */
 } cache_entity_t; 
 
 
@@ -7,6 +7,9 @@
 #ifndef _HTTP_HEADER_H
 #define _HTTP_HEADER_H
 
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
 #include "http_def.h"
 #include "mime_header.h"
 
@@ -25,6 +28,65 @@
  */
 extern mime_header_descriptor_t http_known_headers[MIME_HDR_MAX_DEFS];
 
+/*
+ ***************************************
+ * Known HTTP header name perfect hash *
+ ***************************************
+ * Keyed on the name length and the lower cased first and last four
+ * bytes of the name.  http_hdr_phash_tbl[] holds (id + 1) per slot and
+ * is filled from http_known_headers[] by mime_hdr_startup(), which
+ * asserts that the multipliers below give no collisions.  If a new
+ * known header makes it fire, pick new multipliers.
+ */
+#define HTTP_HDR_PHASH_BITS	9
+#define HTTP_HDR_PHASH_SIZE	(1 << HTTP_HDR_PHASH_BITS)
+#define HTTP_HDR_PHASH_MUL1	0x46bf2191U
+#define HTTP_HDR_PHASH_MUL2	0xb9bde45fU
+#define HTTP_HDR_PHASH_MUL3	0x9e3779b1U
+
+extern unsigned char http_hdr_phash_tbl[HTTP_HDR_PHASH_SIZE];
+
+static inline uint32_t
+http_hdr_phash(const char *name, int len)
+{
+    uint32_t first, last;
+
+    if (len >= 4) {
+	memcpy(&first, name, 4);
+	memcpy(&last, name + len - 4, 4);
+    } else {
+	first = 0;
+	memcpy(&first, name, len);
+	last = first;
+    }
+    first |= 0x20202020;
+    last |= 0x20202020;
+
+    return ((first * HTTP_HDR_PHASH_MUL1) ^ (last * HTTP_HDR_PHASH_MUL2) ^
+	    ((uint32_t)len * HTTP_HDR_PHASH_MUL3)) >> (32 - HTTP_HDR_PHASH_BITS);
+}
+
+/*
+ * Return the http_header_id of the known header name[0..len-1]
+ * (case insensitive), -1 if it is not a known header.
+ */
+static inline int
+http_hdr_lookup(const char *name, int len)
+{
+    int slot;
+    const mime_header_descriptor_t *hd;
+
+    if (len <= 0)
+	return -1;
+    slot = http_hdr_phash_tbl[http_hdr_phash(name, len)];
+    if (!slot)
+	return -1;
+    hd = &http_known_headers[slot - 1];
+    if (hd->namelen != len || strncasecmp(name, hd->name, len))
+	return -1;
+    return slot - 1;
+}
+
 /*
  *******************************
  * HTTP End to end header list *
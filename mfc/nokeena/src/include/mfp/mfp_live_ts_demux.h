@@ -0,0 +1,62 @@
+/**
+ * @file   mfp_live_ts_demux.h
+ * @date   Mon Oct 19 2026
+ *
+ * @brief  bulk transport stream header scan for the live ingest
+ * path. Validates the sync bytes and extracts the PID of every TS
+ * packet in a network chunk several packets at a time (SSE2, and
+ * AVX2 gathers when built for it) so that a chunk can be accepted,
+ * dropped or compacted before it is handed to the accumulator.
+ *
+ */
+#ifndef MFP_LIVE_TS_DEMUX_H
+#define MFP_LIVE_TS_DEMUX_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MFP_TS_PKT_SIZE (188)
+#define MFP_TS_SYNC_BYTE (0x47)
+#define MFP_TS_NULL_PID (0x1FFF)
+
+/* a network chunk is at most MAX_UDP_SIZE bytes, i.e 21 packets;
+ * keep some room for jumbo frames
+ */
+#define MFP_TS_SCAN_MAX_PKTS (64)
+
+typedef struct mfp_ts_scan_tt {
+    uint32_t n_pkts;		/**< number of packets scanned */
+    uint32_t n_null;		/**< packets with the null PID */
+    int32_t bad_pkt;		/**< index of the first packet with a
+				 * bad sync byte, -1 if none
+				 */
+    uint16_t pid[MFP_TS_SCAN_MAX_PKTS];
+} mfp_ts_scan_t;
+
+/**
+ * scans the headers of the TS packets in 'data'
+ * @param data [in] - start of the chunk, 188 byte aligned
+ * @param len [in] - length of the chunk
+ * @param scan [out] - per packet PIDs and the scan summary
+ * @return 0 if every packet carries a sync byte, -1 if a bad sync
+ * byte was found (scan->bad_pkt) or 'len' is not a whole number of
+ * packets
+ */
+int32_t mfp_ts_scan_pkts(const uint8_t *data, uint32_t len,
+			 mfp_ts_scan_t *scan);
+
+/**
+ * compacts a scanned chunk in place, removing the null packets
+ * @return the new length of the chunk
+ */
+uint32_t mfp_ts_strip_null_pkts(uint8_t *data,
+				const mfp_ts_scan_t *scan);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //MFP_LIVE_TS_DEMUX_H
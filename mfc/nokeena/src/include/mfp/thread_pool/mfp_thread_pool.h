@@ -16,6 +16,16 @@ extern "C" {
 	typedef void* (*tp_malloc_fptr)(uint32_t num);
 	typedef void* (*tp_calloc_fptr)(uint32_t num, uint32_t size);
 
+	/* tasks submitted without an affinity key can run on any worker */
+#define MFP_TP_NO_AFFINITY (0)
+
+	/* affinity keys are tracked in a fixed table; keys that collide
+	   are serialized against each other, which is safe but slower */
+#define MFP_TP_AFFINITY_SLOTS (1024)
+
+	/* log2 microsecond buckets, the last one is open ended */
+#define MFP_TP_HIST_BUCKETS (20)
+
 	/*
 	   struct thread_pool_task encapsulates
 	   - Procedure to handle this task (task_handler)
@@ -35,40 +45,96 @@ extern "C" {
 		TAILQ_ENTRY(thread_pool_task) queue_ctxt;
 		deleteTaskArg delete_task_arg;
 		deleteThreadPoolTask delete_thread_pool_task;
+		uint32_t affinity;
+		uint64_t enq_time_us;
 	} thread_pool_task_t;
 	thread_pool_task_t* newThreadPoolTask(taskHandler,
 			void*, deleteTaskArg);
 
 
+	/*
+	   struct mfp_tp_worker is one worker of the pool with
+	   - its own work item queue and lock
+	   - a condition variable it sleeps on when there is nothing to
+	   run or steal, and a generation count bumped on every post so
+	   that no wakeup is lost
+	   - queue wait and run time histograms (only written by the
+	   worker itself)
+	 */
+	struct mfp_thread_pool;
+	typedef struct mfp_tp_worker {
+
+		TAILQ_HEAD(, thread_pool_task) work_item_queue;
+		uint32_t queue_len;
+		pthread_mutex_t lock;
+		pthread_cond_t task_posted;
+		uint32_t post_gen;
+		int32_t idle;
+		uint32_t idx;
+		pthread_t thread;
+		struct mfp_thread_pool* pool;
+
+		uint64_t tasks_run;
+		uint64_t tasks_stolen;
+		uint64_t wait_hist[MFP_TP_HIST_BUCKETS];
+		uint64_t run_hist[MFP_TP_HIST_BUCKETS];
+	} mfp_tp_worker_t;
+
+	typedef struct mfp_thread_pool_stats {
+
+		uint64_t tasks_run;
+		uint64_t tasks_stolen;
+		uint64_t producer_waits;
+		uint64_t wait_hist[MFP_TP_HIST_BUCKETS];
+		uint64_t run_hist[MFP_TP_HIST_BUCKETS];
+	} mfp_thread_pool_stats_t;
+
+
 	/*
 	   struct mfp_thread_pool encapsulates,
-	   - Work Item Queue
-	   - Worker thread array
-	   - Pool Lock
-	   - Condition variables to signal the availability and completion
-	   - Interfaces to add work item and delete the thread_pool
+	   - Per worker work item queues; a task with an affinity key is
+	   always queued on the key's home worker, so that a session's
+	   tasks stay cache warm on one core. Idle workers steal from
+	   the other queues. Tasks sharing an affinity key never run
+	   concurrently and run in the order they were added, whichever
+	   worker picks them up
+	   - Pool Lock and condition to block producers when the pool
+	   holds max_work_queue_len tasks
+	   - Interfaces to add work items and delete the thread_pool
 	 */
 
-	struct mfp_thread_pool;
 	typedef void (*threadPoolIntf)(struct mfp_thread_pool*);
 	typedef void (*addWorkItem)(struct mfp_thread_pool*,
 			thread_pool_task_t*);
+	typedef void (*addWorkItemAffine)(struct mfp_thread_pool*,
+			thread_pool_task_t*, uint32_t affinity);
+	typedef void (*addWorkItems)(struct mfp_thread_pool*,
+			thread_pool_task_t**, uint32_t num_items,
+			uint32_t affinity);
 	typedef uint32_t (*getQueueFillLen)(struct mfp_thread_pool*);
+	typedef void (*getThreadPoolStats)(struct mfp_thread_pool*,
+			mfp_thread_pool_stats_t*);
 
 	typedef struct mfp_thread_pool {
 
-		TAILQ_HEAD(, thread_pool_task) work_item_queue;
+		mfp_tp_worker_t* workers;
+		uint32_t num_worker_threads;
 		uint32_t max_work_queue_len;
 		uint32_t queue_fill_len;
-		pthread_t* worker_threads;
-		uint32_t num_worker_threads;
+		uint32_t rr_next;
+		uint32_t num_idle;
+		uint32_t producers_waiting;
+		uint64_t producer_waits;
+		uint8_t affinity_busy[MFP_TP_AFFINITY_SLOTS];
 
 		pthread_mutex_t thread_pool_lock;
-		pthread_cond_t task_posted;
 		pthread_cond_t task_taken;
 
 		addWorkItem add_work_item;
+		addWorkItemAffine add_work_item_affine;
+		addWorkItems add_work_items;
 		getQueueFillLen get_queue_fill_len;
+		getThreadPoolStats get_stats;
 		threadPoolIntf delete_thread_pool;
 
 	} mfp_thread_pool_t;
@@ -85,4 +151,3 @@ extern "C" {
 #endif
 
 #endif
-
@@ -154,6 +154,41 @@ typedef struct serial_mime_header {
     /* 3) External data */
 } serial_mime_header_t;
 
+/*
+ * Compact serialization, used for the mime header stored in object
+ * attributes.  Values are stored once, back to back, and the deserialized
+ * mime_header_t references them in place (ext_data), so a read costs one
+ * heap element per value instead of a copy of the whole heap.
+ *
+ * Each entry is
+ *	uint8_t tag;		// < CMH_TAG_INTERNED: known header id
+ *				// CMH_TAG_INTERNED + n: interned unknown name n
+ *				// CMH_TAG_LITERAL: unknown, name follows
+ *	[uint8_t namelen; char name[namelen];]	// CMH_TAG_LITERAL only
+ *	uint16_t vallen; char val[vallen];
+ * in host byte order, unaligned.  Known header ids and the interned name
+ * table are part of the on disk format, only append to them.
+ * mime_hdr_deserialize() accepts both formats.
+ *
+ * Object attributes are only written in this format when
+ * glob_mime_hdr_attr_compact is set (http.attr_compact_headers, default off);
+ * builds without this reader can not load them.
+ */
+#define COMPACT_MIME_HEADER_MAGIC 0x20140a11
+#define COMPACT_MIME_HEADER_ENCODING 1
+
+#define CMH_TAG_INTERNED	0x80
+#define CMH_TAG_LITERAL		0xff
+
+typedef struct compact_mime_header {
+    int32_t magic;
+    int32_t total_size;		/* including this header */
+    uint8_t encoding;		/* COMPACT_MIME_HEADER_ENCODING */
+    uint8_t protocol;
+    uint16_t cnt_entries;
+    /* entries */
+} compact_mime_header_t;
+
 
 /* mime module init */
 void MIME_init(void);
@@ -434,6 +469,15 @@ int mime_hdr_deserialize(const char *inbuf, int inbuf_size,
 			 mime_header_t * hd, const char *extdata,
 			 int extdatasz);
 
+// Write object attribute headers in the compact format, default off
+extern int glob_mime_hdr_attr_compact;
+
+// Return 0 if hd can not be expressed in the compact format
+int mime_hdr_serialize_compact_datasize(const mime_header_t * hd);
+
+int mime_hdr_serialize_compact(const mime_header_t * hd, char *outbuf,
+			       int outbuf_size);
+
 int mime_hdr_get_cache_index(const mime_header_t *hd,
                                  const char **data, int *datalen, u_int32_t *attributes,
                                  int *header_cnt);
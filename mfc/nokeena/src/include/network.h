@@ -62,7 +62,7 @@ typedef int (* NM_func_timeout)(int sockfd, void * data, double timeout);
 typedef int (* NM_func_timer)(int sockfd, void * data, net_timer_type_t type);
 
 #define NMF_IN_USE	0x0000000000000001
-#define NMF_IN_TIMEOUTQ 0x0000000000000002	// In Timeout Queue
+#define NMF_IN_TIMEOUTQ 0x0000000000000002	// Timeout armed (timer wheel)
 #define NMF_IN_EPOLL	0x0000000000000004	// added in Epoll
 #define NMF_IN_SBQ 	0x0000000000000008	// In Session Bandwidth Queue
 #define NMF_USE_LICENSE	0x0000000000000010	// Use License
@@ -73,10 +73,40 @@ typedef int (* NM_func_timer)(int sockfd, void * data, net_timer_type_t type);
 #define NMF_TIMEOUTQ_LOOP 0x0000000000000200	// TIMEOUT Q loop
 #define NMF_IS_IPV6	 0x0000000000000400	// FD is of the type IPv6
 #define NMF_SUSPENDED	 0x0000000000000800	// Epoll events suspeneded
+#define NMF_STEER_LISTEN 0x0000000000001000	// nm_cpu_steer listen socket
 
 #define NMF_HAVE_LOCK	0x1000000000000000	// Mark state of LOCK
 
-#define MAX_TOQ_SLOT 	300			// Timeout Queue slot
+/*
+ * Connection timeouts are kept in a per network thread hierarchical
+ * timer wheel of NM_TW_TICK_MSECS ticks.  Level 0 covers 25.6 seconds,
+ * each of the two upper levels 64 times the level below (29 hours).
+ */
+#define NM_TW_TICK_MSECS	100
+#define NM_TW_L0_BITS		8
+#define NM_TW_LN_BITS		6
+#define NM_TW_L0_SIZE		(1 << NM_TW_L0_BITS)
+#define NM_TW_LN_SIZE		(1 << NM_TW_LN_BITS)
+#define NM_TW_LEVELS		3
+#define NM_TW_MAX_TICKS		(1ULL << (NM_TW_L0_BITS + 2 * NM_TW_LN_BITS))
+#define NM_TW_MSECS_TO_TICK(_msecs) \
+	(((_msecs) + NM_TW_TICK_MSECS - 1) / NM_TW_TICK_MSECS)
+
+#define NM_TOQ_SLOT_MSECS	2000	// NM_change_socket_timeout_time() unit
+#define NM_MIN_TIMEOUT_MSECS	6000
+#define NM_MAX_TIMEOUT_MSECS	596000
+
+/*
+ * Paced (session bandwidth) connections wait for their next send window
+ * in a per network thread wheel of NM_SBQ_TICK_MSECS slots.  A send
+ * window is NM_SBQ_SLICE_MSECS long and carries that share of the rate.
+ */
+#define NM_SBQ_TICK_MSECS	10
+#define NM_SBQ_SLOTS		256	// 2.56 seconds
+#define NM_SBQ_SLICE_MSECS	100
+#define NM_SBQ_SLICES_PER_SEC	(1000 / NM_SBQ_SLICE_MSECS)
+#define NM_SBQ_MSECS_TO_TICK(_msecs) \
+	(((_msecs) + NM_SBQ_TICK_MSECS - 1) / NM_SBQ_TICK_MSECS)
 
 struct nm_threads ;
 #ifdef SOCKFD_TRACE
@@ -90,10 +120,24 @@ typedef struct network_mgr {
 	int32_t accepted_thr_num;
 	struct nm_threads * pthr;	// which thread this nm is running on
 
-	/* Timer */
+	/* Timer
+	 * toq_entries and tw_expire belong to the network thread in
+	 * tw_thr, other threads only set tw_deadline, see NM_tw_arm().
+	 * Same for sbq_entries, sbq_expire and sbq_thr, see NM_sbq_add().
+	 */
 	time_t          last_active;    // Last active time
-	LIST_ENTRY(network_mgr) toq_entries;	// In Timeout queue
-	LIST_ENTRY(network_mgr) sbq_entries;	// For session bandwidth queue
+	uint64_t	tw_deadline;	// msecs, timeout is due
+	uint64_t	tw_expire;	// wheel tick the entry is linked at
+	AO_t		tw_thr;		// struct nm_threads * of the wheel
+	AO_t		tw_req;		// pending in a tw_req_head list
+	struct network_mgr * tw_req_next;
+	LIST_ENTRY(network_mgr) toq_entries;	// In timer wheel slot
+	LIST_ENTRY(network_mgr) sbq_entries;	// In pacing wheel slot
+	uint64_t	sbq_deadline;	// msecs, next send window starts
+	uint64_t	sbq_expire;	// pacing wheel tick the entry is linked at
+	AO_t		sbq_thr;	// struct nm_threads * of the pacing wheel
+	AO_t		sbq_req;	// pending in a sbq_req_head list
+	struct network_mgr * sbq_req_next;
 
         /* Mutex to pretec this epoll group */
         pthread_mutex_t mutex;		// Mutex to protect this structure only.
@@ -106,7 +150,7 @@ typedef struct network_mgr {
 	NM_func f_epollhup;
 	NM_func_timeout f_timeout;
 	NM_func_timer f_timer;
-	int timeout_slot;		// each slot is 5 seconds
+	int timeout_msecs;
 #ifdef SOCKFD_TRACE
 	struct nm_trace * p_trace;
 #endif
@@ -119,10 +163,16 @@ typedef struct network_mgr {
 LIST_HEAD(nm_timeout_queue, network_mgr);
 LIST_HEAD(nm_sess_bw_queue, network_mgr);
 
+typedef struct nm_timer_wheel {
+	uint64_t cur_tick;		// next tick to expire
+	struct nm_timeout_queue l0[NM_TW_L0_SIZE];
+	struct nm_timeout_queue ln[NM_TW_LEVELS - 1][NM_TW_LN_SIZE];
+} nm_timer_wheel_t;
+
 /*
  * This structure is defined for each running epoll thread.
  * Each network epoll thread owns one structure.
- * Any operation on timeout and bandwidth queues should get table mutex first.
+ * The timer and pacing wheels are only touched by the thread itself.
  */
 typedef struct nm_threads {
         pthread_t pid;          // thread id
@@ -135,21 +185,19 @@ typedef struct nm_threads {
         int epfd;
 
 
-        // fd timeout slots.
-        int cur_toq;
-        struct nm_timeout_queue toq_head[MAX_TOQ_SLOT];
+        // fd timeouts, only this thread touches the wheel.
+        // Other threads push entries to re-link on tw_req_head.
+        nm_timer_wheel_t tw;
+        AO_t tw_req_head;
 
-	// fd session bandwidth queue
-	/* 
-	 * we provided two sbq queue for swap purpose to break a loop 
-	 * Sometime in timeout session, we could insert itself back to
-	 * the sbq.
-	 */
-	int cleanup_sbq;	// flag time to clean up the SB Queue
-	int cur_sbq;
-        struct nm_sess_bw_queue sbq_head[2];
+	// paced fd, only this thread touches the pacing wheel.
+	// Other threads push entries to link on sbq_req_head.
+	uint64_t sbq_cur_tick;	// next pacing tick to expire
+	int cur_sbq;		// entries in the pacing wheel
+	struct nm_sess_bw_queue sbq[NM_SBQ_SLOTS];
+	AO_t sbq_req_head;
 
-	pthread_mutex_t nm_mutex; 	// protect nm_timeout_queue and nm_sess_bw_queue
+	pthread_mutex_t nm_mutex; 	// protect max_fds
 
         // events used for this epoll thread
         struct epoll_event *events;
@@ -268,6 +316,16 @@ dbg_nm_lock_trace(network_mgr_t * pnm, int lock, int file, int event)
 #define LB_ROUNDROBIN	1
 #define LB_STICK	2	/* 1 network thread bound to 1 network port */
 
+/*
+ * nm_cpu_steer: pin network thread N to CPU N and keep every connection
+ * on the thread whose listen socket accepted it.  The kernel picks that
+ * listen socket, out of the SO_REUSEPORT group of one socket per thread,
+ * by the CPU which received the SYN.
+ */
+#define NM_CPU_STEER_OFF	0
+#define NM_CPU_STEER_INCOMING_CPU 1	/* SO_INCOMING_CPU on listen sockets */
+#define NM_CPU_STEER_BPF	2	/* reuseport BPF: socket = rx cpu % N */
+
 #define USE_LICENSE_FALSE	0
 #define USE_LICENSE_TRUE	1
 #define USE_LICENSE_ALWAYS_TRUE	2
@@ -423,6 +481,7 @@ extern struct nm_threads g_NM_thrs[MAX_EPOLL_THREADS];
 extern nkn_lockstat_t nm_lockstat[MAX_EPOLL_THREADS];
 
 extern AO_t next_epthr;
+extern __thread int nm_thr_num;	/* -1 if not a network thread */
 extern AO_t glob_socket_accumulate_tot;
 extern AO_t glob_socket_accumulate_tot_ipv6;
 extern AO_t glob_cur_open_all_sockets;
@@ -450,26 +509,110 @@ extern int (* so_shutdown)(int s, int how);
 
 #define F_FILE_ID	LT_NETWORK
 
+/*
+ * Timer wheel, see NM_tw_run() in network.c.
+ *
+ * Only the network thread in pnm->tw_thr links or unlinks an entry.
+ * Arming a timeout stores the deadline; when the entry already sits in
+ * its thread's wheel at or before the deadline that is all, the owner
+ * moves it when the slot fires.  Otherwise the entry is pushed on the
+ * owner's lock free request list.  No lock is shared between threads.
+ */
+static inline uint64_t
+NM_tw_now_msecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 static inline void
-NM_set_socket_active(network_mgr_t *pnm)
+NM_tw_request(struct nm_threads *pnmthr, network_mgr_t *pnm)
 {
-	int slot;
+	AO_t head;
 
-	if (pnm->f_timeout == NULL) {
+	/* Already queued: whoever pops it routes it by its current state */
+	if (!AO_compare_and_swap_full(&pnm->tw_req, 0, 1)) {
 		return;
 	}
+	do {
+		head = AO_load(&pnmthr->tw_req_head);
+		pnm->tw_req_next = (network_mgr_t *)head;
+	} while (!AO_compare_and_swap_full(&pnmthr->tw_req_head, head,
+					   (AO_t)pnm));
+}
 
-	pnm->last_active = nkn_cur_ts;
+/*
+ * Caller should get the pnm mutex before calling this function
+ */
+static inline void
+NM_tw_arm(network_mgr_t *pnm, int timeout_msecs)
+{
+	struct nm_threads *owner;
+	uint64_t deadline = NM_tw_now_msecs() + timeout_msecs;
 
-	// Timeout Queue operation
-	NKN_MUTEX_LOCKSTAT(&pnm->pthr->nm_mutex, &nm_lockstat[pnm->pthr->num]);
-	if (NM_CHECK_FLAG(pnm, NMF_IN_TIMEOUTQ)) {
-		LIST_REMOVE(pnm, toq_entries);
-	}
-	slot = (pnm->pthr->cur_toq + pnm->timeout_slot) % MAX_TOQ_SLOT;
-	LIST_INSERT_HEAD(&(pnm->pthr->toq_head[slot]), pnm, toq_entries);
+	pnm->tw_deadline = deadline;
 	NM_SET_FLAG(pnm, NMF_IN_TIMEOUTQ);
-	NKN_MUTEX_UNLOCKSTAT(&pnm->pthr->nm_mutex);
+	AO_nop_full();
+	owner = (struct nm_threads *)AO_load(&pnm->tw_thr);
+	if ((owner == pnm->pthr) &&
+	    (pnm->tw_expire <= NM_TW_MSECS_TO_TICK(deadline))) {
+		return;
+	}
+	NM_tw_request(owner ? owner : pnm->pthr, pnm);
+}
+
+/*
+ * Pacing wheel, see NM_sbq_run() in network.c.  Same rules as the timer
+ * wheel: only the network thread in pnm->sbq_thr links or unlinks an
+ * entry, everybody else goes through the owner's request list.
+ */
+static inline void
+NM_sbq_request(struct nm_threads *pnmthr, network_mgr_t *pnm)
+{
+	AO_t head;
+
+	if (!AO_compare_and_swap_full(&pnm->sbq_req, 0, 1)) {
+		return;
+	}
+	do {
+		head = AO_load(&pnmthr->sbq_req_head);
+		pnm->sbq_req_next = (network_mgr_t *)head;
+	} while (!AO_compare_and_swap_full(&pnmthr->sbq_req_head, head,
+					   (AO_t)pnm));
+}
+
+/*
+ * Send more data when the window starting at deadline (msecs) opens.
+ * Caller should get the pnm mutex before calling this function.
+ * NM_UNSET_FLAG(pnm, NMF_IN_SBQ) takes it out again.
+ */
+static inline void
+NM_sbq_add(network_mgr_t *pnm, uint64_t deadline)
+{
+	struct nm_threads *owner;
+
+	pnm->sbq_deadline = deadline;
+	NM_SET_FLAG(pnm, NMF_IN_SBQ);
+	AO_nop_full();
+	owner = (struct nm_threads *)AO_load(&pnm->sbq_thr);
+	if ((owner == pnm->pthr) &&
+	    (pnm->sbq_expire <= NM_SBQ_MSECS_TO_TICK(deadline))) {
+		return;
+	}
+	NM_sbq_request(owner ? owner : pnm->pthr, pnm);
+}
+
+static inline void
+NM_set_socket_active(network_mgr_t *pnm)
+{
+	if (pnm->f_timeout == NULL) {
+		return;
+	}
+
+	pnm->last_active = nkn_cur_ts;
+	NM_tw_arm(pnm, pnm->timeout_msecs);
 
 	return;
 }
@@ -487,7 +630,7 @@ register_NM_socket(int fd, void * private_data, NM_func f_epollin,
 		   NM_func f_epollhup,
 		   NM_func_timer f_timer,
 		   NM_func_timeout f_timeout,
-		   int timeout,	// in seconds, timeout func callbacked at [timeout, timeout+5) seconds
+		   int timeout,	// in seconds, min 6, max 596
 		   int useLicense,
 		   int has_locked)
 {
@@ -513,7 +656,16 @@ register_NM_socket(int fd, void * private_data, NM_func f_epollin,
 		num=pnm->accepted_thr_num;
 	}
 #endif // 0
-	if (nm_lb_policy == LB_FD) {
+	if (nm_cpu_steer && (nm_thr_num >= 0) &&
+	    !NM_CHECK_FLAG(pnm, NMF_IS_IPV6)) {
+		// Stay on the thread (CPU) which accepted it.  IPv6 has one
+		// listen socket per port, so it is still spread out below.
+		num = nm_thr_num;
+	} else if (nm_cpu_steer && NM_CHECK_FLAG(pnm, NMF_STEER_LISTEN)) {
+		// Listen socket, accepted_thr_num set by http_if4_init()
+		num = pnm->accepted_thr_num % NM_tot_threads;
+		NM_UNSET_FLAG(pnm, NMF_STEER_LISTEN);
+	} else if (nm_lb_policy == LB_FD) {
 		num = fd % NM_tot_threads;	// Stick to the same network thread.
 	} else {
 		num = AO_fetch_and_add1(&next_epthr) % NM_tot_threads;
@@ -549,10 +701,11 @@ register_NM_socket(int fd, void * private_data, NM_func f_epollin,
 	pnm->f_epollhup = f_epollhup;
 	pnm->f_timer = f_timer;
 	pnm->f_timeout = f_timeout;
-	timeout = (timeout / 2) + 1;	// timeout callback at [timeout, timeout+2] seconds
-	if(timeout < 3) timeout = 3;	// min timeout is 6 seconds.
-	if(timeout > MAX_TOQ_SLOT) timeout = MAX_TOQ_SLOT-2;	// -2 to avoid insert the same slot of itself
-	pnm->timeout_slot = timeout; // timeout_slot is [3, MAX_TOQ_SLOT]
+	pnm->timeout_msecs = timeout * 1000;
+	if(pnm->timeout_msecs < NM_MIN_TIMEOUT_MSECS)
+		pnm->timeout_msecs = NM_MIN_TIMEOUT_MSECS;
+	if(pnm->timeout_msecs > NM_MAX_TIMEOUT_MSECS)
+		pnm->timeout_msecs = NM_MAX_TIMEOUT_MSECS;
 	pnm->pthr = &g_NM_thrs[num];
 	NM_SET_FLAG(pnm, NMF_IN_USE);
 
@@ -569,18 +722,9 @@ register_NM_socket(int fd, void * private_data, NM_func f_epollin,
 		NM_UNSET_FLAG(pnm, NMF_NO_FD_UNEPOLL);
 	}
 	else {
-	    // Remove from Timeout Queue as pnm->pthr could be changed
-	    // If pnm->pthr is changed, it would not be removed from
-	    //    existing timeout Q.
-	    if (pnm->pthr && nm_lb_policy == LB_ROUNDROBIN) {
-		NKN_MUTEX_LOCKSTAT(&pnm->pthr->nm_mutex, &nm_lockstat[pnm->pthr->num]);
-		if (NM_CHECK_FLAG(pnm, NMF_IN_TIMEOUTQ)) {
-			LIST_REMOVE(pnm, toq_entries);
-			NM_UNSET_FLAG(pnm, NMF_IN_TIMEOUTQ);
-		}
-		NKN_MUTEX_UNLOCKSTAT(&pnm->pthr->nm_mutex);
-	    }
-
+	    // If pnm->pthr changed, the old thread drops its timer wheel
+	    // entry and hands it over when NM_set_socket_active() below
+	    // re-arms the timeout.
 #if 0
 	   // pick up an epoll thread.
 	   if((nm_lb_policy==LB_ROUNDROBIN) || (f_timeout==NULL)) {
@@ -824,15 +968,10 @@ int_NM_close_socket(int fd, int reset_close)
 	pnm = &gnm[fd];
 	if( NM_CHECK_FLAG(pnm, NMF_IN_USE) ) {
 
-		// Cleanup all queues
-		NKN_MUTEX_LOCKSTAT(&pnm->pthr->nm_mutex, &nm_lockstat[pnm->pthr->num]);
-		if (NM_CHECK_FLAG(pnm, NMF_IN_TIMEOUTQ)) {
-			LIST_REMOVE(pnm, toq_entries);
-		}
-		if(NM_CHECK_FLAG(pnm, NMF_IN_SBQ) ) {
-			LIST_REMOVE(pnm, sbq_entries);
-		}
-		NKN_MUTEX_UNLOCKSTAT(&pnm->pthr->nm_mutex);
+		// Cleanup all queues, the timer and pacing wheel entries are
+		// dropped by their network thread once the flags are cleared.
+		NM_UNSET_FLAG(pnm, NMF_IN_TIMEOUTQ);
+		NM_UNSET_FLAG(pnm, NMF_IN_SBQ);
 
 		DBG_LOG(MSG, MOD_NETWORK, "close(fd=%d)", fd);
 		if( NM_CHECK_FLAG(pnm, NMF_USE_LICENSE) ) {
@@ -913,15 +1052,10 @@ unregister_NM_socket(int fd, int remove_fd_from_epoll)
 	DBG_LOG(MSG, MOD_NETWORK, "fd=%d (%d), type=%d", fd, gnm[fd].fd, gnm[fd].fd_type);
         if( NM_CHECK_FLAG(pnm, NMF_IN_USE) ) {
 
-		// Cleanup all queues
-		NKN_MUTEX_LOCKSTAT(&pnm->pthr->nm_mutex, &nm_lockstat[pnm->pthr->num]);
-                if (NM_CHECK_FLAG(pnm, NMF_IN_TIMEOUTQ)) {
-                        LIST_REMOVE(pnm, toq_entries);
-                }
-		if(NM_CHECK_FLAG(pnm, NMF_IN_SBQ) ) {
-			LIST_REMOVE(pnm, sbq_entries);
-		}
-		NKN_MUTEX_UNLOCKSTAT(&pnm->pthr->nm_mutex);
+		// Cleanup all queues, the timer and pacing wheel entries are
+		// dropped by their network thread once the flags are cleared.
+		NM_UNSET_FLAG(pnm, NMF_IN_TIMEOUTQ);
+		NM_UNSET_FLAG(pnm, NMF_IN_SBQ);
 
 		// close(fd)
 		if( NM_CHECK_FLAG(pnm, NMF_USE_LICENSE) ) {
@@ -984,15 +1118,10 @@ suspend_NM_socket(int fd)
 
 		NM_del_event_epoll(fd);
 
-		// Cleanup all queues
-		NKN_MUTEX_LOCKSTAT(&pnm->pthr->nm_mutex, &nm_lockstat[pnm->pthr->num]);
-                if (NM_CHECK_FLAG(pnm, NMF_IN_TIMEOUTQ)) {
-                        LIST_REMOVE(pnm, toq_entries);
-                }
-		if(NM_CHECK_FLAG(pnm, NMF_IN_SBQ) ) {
-			LIST_REMOVE(pnm, sbq_entries);
-		}
-		NKN_MUTEX_UNLOCKSTAT(&pnm->pthr->nm_mutex);
+		// Cleanup all queues, the timer and pacing wheel entries are
+		// dropped by their network thread once the flags are cleared.
+		NM_UNSET_FLAG(pnm, NMF_IN_TIMEOUTQ);
+		NM_UNSET_FLAG(pnm, NMF_IN_SBQ);
 
 		pnm->flag = flag;
 		NM_SET_FLAG(pnm, NMF_SUSPENDED);
@@ -1043,173 +1172,12 @@ resume_NM_socket(int fd)
 	return TRUE;
 }
 
-/*
- * timer functions
- * timer function will be called once every 5 seconds
- */
-
-static inline void
-NM_timer(void)
-{
-	network_mgr_t * pnm;
-	struct nm_threads * pnmthr;
-	int i;
-	double timediff;
-	int timeout_toq;
-	uint32_t incarn;
-
-	for(i=0; i<NM_tot_threads; i++)
-	{
-	    pnmthr=&g_NM_thrs[i];
-
-	    /*
-	     * pnmthr->nm_mutex is used to protect toq_head queue.
-	     * however f_timeout may try to get this mutex lock.
-	     * to avoid this deadlock, NM_timer needs to release this mutex.
-	     */
-	    NKN_MUTEX_LOCKSTAT(&pnmthr->nm_mutex, &nm_lockstat[i]);
-
-	    /* Timeout_toq is to be removed */
-	    timeout_toq = (pnmthr->cur_toq + 1 ) % MAX_TOQ_SLOT; 
-
-	    // This NM should be timed out
-	    while( !LIST_EMPTY(&pnmthr->toq_head[timeout_toq]) ) {
-		pnm = LIST_FIRST(&pnmthr->toq_head[timeout_toq] );
-		LIST_FIRST(&pnmthr->toq_head[timeout_toq] ) = LIST_NEXT(pnm, toq_entries);
-		LIST_REMOVE(pnm, toq_entries);
-		NM_UNSET_FLAG(pnm, NMF_IN_TIMEOUTQ);
-		incarn = pnm->incarn;	// Store incarn
-		NKN_MUTEX_UNLOCKSTAT(&pnmthr->nm_mutex); 
-
-		/*
-		 * Special case:
-		 * After getting this mutex lock, this pnm may move to another timeout queue.
-		 * then we should not call timeout() 
-		 */
-		pthread_mutex_lock(&pnm->mutex);
-		NM_TRACE_LOCK(pnm, LT_NETWORK);
-
-		/* While waiting for lock, socket could be closed and fd removed
-		 * from timer Q. Check if fd is still in timer Q. Also check if the
-		 * incarns match.
-		 * BZ 7296
-		 */
-		if( NM_CHECK_FLAG(pnm, NMF_IN_USE) && (incarn != pnm->incarn) ) {
-			glob_err_bad_timer_entry_3++;
-			NM_TRACE_UNLOCK(pnm, LT_NETWORK);
-			pthread_mutex_unlock(&pnm->mutex);
-
-			NKN_MUTEX_LOCKSTAT(&pnmthr->nm_mutex, &nm_lockstat[i]);
-			continue;
-		}
-#if 0
-		if (!NM_CHECK_FLAG(pnm, NMF_IN_TIMEOUTQ)) {
-			glob_err_bad_timer_entry_2++;
-			/* if the same pnm remains in timeout Q with this flag delete it from
-			 * from Q
-			 */
-			if (NM_CHECK_FLAG(pnm, NMF_TIMEOUTQ_LOOP)) {
-				NM_UNSET_FLAG(pnm, NMF_TIMEOUTQ_LOOP);
-		        /*bug 8177*/
-       			if (pnm->f_timeout == NULL) {
-                		glob_err_bad_timer_entry_4++;
-                		DBG_LOG(ERROR, MOD_NETWORK, "pnm timer entry fd=%d, timeout flag not set", pnm->fd);
-                		//NKN_MUTEX_LOCKSTAT(&pnm->pthr->nm_mutex, &nm_lockstat[i]);
-                		//LIST_REMOVE(pnm, toq_entries);
-				//NKN_MUTEX_UNLOCKSTAT(&pnm->pthr->nm_mutex);
-				NM_TRACE_UNLOCK(pnm, LT_NETWORK);
-				pthread_mutex_unlock(&pnm->mutex);
-				NKN_MUTEX_LOCKSTAT(&pnmthr->nm_mutex, &nm_lockstat[i]);
-				continue;
-			}
-			else {
-				NM_SET_FLAG(pnm, NMF_TIMEOUTQ_LOOP);
-				NM_TRACE_UNLOCK(pnm, LT_NETWORK);
-				pthread_mutex_unlock(&pnm->mutex);
-
-				NKN_MUTEX_LOCKSTAT(&pnmthr->nm_mutex, &nm_lockstat[i]);
-				continue;
-			}
-		}
-               
-#endif
-		/* 
-		 * BUG 4704: TBD: I have no idea why (pnm->f_timeout==NULL) is TRUE
-		 * Add protection code to avoid crash.
-		 */
-		if( NM_CHECK_FLAG(pnm, NMF_IN_USE)) {
-			if(pnm->f_timeout == NULL) {
-				glob_err_timeout_f_timeout_NULL++;
-				DBG_LOG(ERROR, MOD_NETWORK, "(f_timeout==NULL) for fd=%d", pnm->fd);
-			}
-			else {
-			timediff = difftime(nkn_cur_ts, pnm->last_active);
-			if(timediff>=4/*http_idle_timeout*/) {
-				if(pnm->f_timeout(pnm->fd, pnm->private_data, timediff) == TRUE) {
-					glob_socket_tot_timeout++;
-					NM_close_socket(pnm->fd);
-				}
-				else {
-					/*
-					 * Application does not want to timeout socket.
-					 */
-					NM_set_socket_active(pnm);
-				}
-			}
-			else {
-				/*
-				 * This issue should be solved in bug 2369
-				 * TBD: Here could be memory leak
-				 *      first of all, don't understand why this happens.
-				 *      with this checkin, this bug should be fixed.
-				 *      I still leave here for debug purpose only.
-				 */
-				glob_err_bad_timer_entry++;
-				DBG_LOG(ERROR, MOD_NETWORK, "Bad timer entry fd=%d", pnm->fd);
-				//NKN_MUTEX_LOCKSTAT(&pnm->pthr->nm_mutex, &nm_lockstat[i]);
-				//LIST_REMOVE(pnm, toq_entries);
-				//NM_UNSET_FLAG(pnm, NMF_IN_TIMEOUTQ);
-				//NKN_MUTEX_UNLOCKSTAT(&pnm->pthr->nm_mutex);
-			}
-			}
-		} else {
-			/* Bug 7296 : If gnm is free'd by some thread , but not yet
-			 * removed from toq (why ? bug), then timer thread may end up in infinite
-			 * while loop, since it may be accessing wrong memory location
-			 * (already free'd one) . So adding this else part to handle such cases
-			 * If pnm flag is not valid , remove the entry from toq to avoid infinite loop
-			 */
-				glob_err_bad_timer_entry_1++;
-				DBG_LOG(ERROR, MOD_NETWORK, "Invalid gnm ,Bad timer entry fd=%d", pnm->fd);
-				//NKN_MUTEX_LOCKSTAT(&pnm->pthr->nm_mutex, &nm_lockstat[i]);
-				//LIST_REMOVE(pnm, toq_entries);
-				//NM_UNSET_FLAG(pnm, NMF_IN_TIMEOUTQ);
-				//NKN_MUTEX_UNLOCKSTAT(&pnm->pthr->nm_mutex);
-
-		}
-		NM_TRACE_UNLOCK(pnm, LT_NETWORK);
-		pthread_mutex_unlock(&pnm->mutex);
-
-		NKN_MUTEX_LOCKSTAT(&pnmthr->nm_mutex, &nm_lockstat[i]); 
-	     }
-
-	     /* 
-	      * change to next slot
-	      * switch to next Time out queue for next adding.
-	      */
-	     pnmthr->cur_toq = timeout_toq;
-	     NKN_MUTEX_UNLOCKSTAT(&pnmthr->nm_mutex);
-	}
-
-	return;
-}
-
 #undef F_FILE_ID
 
 /*
  * Before calling any following functions, caller should get the gnm.mutex locker first
  */
-void NM_change_socket_timeout_time (network_mgr_t * pnm, int next_timeout_slot); // one slot = 5seconds
+void NM_change_socket_timeout_time (network_mgr_t * pnm, int next_timeout_slot); // one slot = 2 seconds
 net_fd_handle_t NM_fd_to_fhandle(int fd);
 
 /*
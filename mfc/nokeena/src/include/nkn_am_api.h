@@ -197,6 +197,7 @@ typedef struct AM_analytics_obj {
 #define AM_FLAG_PUSH_INGEST_DEL     0x00001000
 #define AM_FLAG_SET_INGEST_RETRY    0x00002000
 #define AM_FLAG_SET_INGEST_COMPLETE 0x00004000
+#define AM_FLAG_TINYLFU_ADMIT       0x00008000
     uint16_t	flags;
     nkn_provider_type_t next_provider_id;
     am_object_data_t *in_object_data;
@@ -255,6 +256,7 @@ void AM_cleanup_xfer_client_data(nkn_provider_type_t ptype,
 			    am_xfer_data_t *am_xfer_data);
 void AM_ingest_wakeup(void);
 int  AM_delete_obj(nkn_cod_t in_cod, char *uri);
+int  AM_evict_obj(char *uri, nkn_provider_type_t ptype);
 int  AM_delete_push_ingest(nkn_cod_t in_cod, void *attr_buf);
 void AM_set_ingest_error(nkn_cod_t in_cod, int flags);
 void AM_set_dont_ingest(nkn_cod_t in_cod);
@@ -37,6 +37,7 @@ extern int l4proxy_enabled ;
 extern int adnsd_enabled ;
 extern int NM_tot_threads ;
 extern int nm_lb_policy;
+extern int nm_cpu_steer;
 extern int om_cache_no_cache_obj ;
 extern const char * om_oomgr_queuefile ;
 extern int om_oomgr_queue_retries ;
@@ -93,6 +94,7 @@ extern const char * node_status_queuefile;
 extern int node_status_queue_maxsize;
 extern int debug_fd_trace;
 extern int nm_hdl_send_and_receive;
+extern int nkn_kernel_pacing_enable;
 extern unsigned nkn_am_memory_limit;
 extern int pe_url_category_lookup;
 extern int pe_ucflt_failover_bypass_enable;
@@ -188,12 +190,19 @@ extern int cl7pxyns_origin_request_orig_conn_values_read_timeout;
 extern int cl7pxyns_origin_request_orig_conn_values_read_retry_delay;
 
 extern int glob_dm2_num_preread_disk_threads;
+extern int glob_dm2_preread_q_max;
 extern int glob_dm2_throttle_writes;
 extern int glob_dm2_small_write_enable;
 extern int glob_dm2_small_write_min_size;
+extern int glob_dm2_md_batch_msecs;
+extern int glob_dm2_md_batch_bytes;
+
+extern int glob_mime_hdr_attr_compact;
 
 extern unsigned long glob_am_bytes_based_hotness_threshold;
 extern int glob_am_bytes_based_hotness;
+extern int glob_am_admit_tinylfu;
+extern int glob_am_admit_sketch_width;
 
 /* PUSH Ingest config variables */
 extern int glob_am_push_ingest_enabled;
@@ -201,6 +210,11 @@ extern int glob_mm_push_ingest_buffer_ratio;
 extern int glob_mm_push_entry_info_check_tmout;
 extern int glob_mm_push_ingest_parallel_ingest_restrict;
 
+/* Batched promotion config variables */
+extern int glob_mm_promote_batch_size;
+extern int glob_mm_promote_batch_msecs;
+extern int glob_mm_promote_max_disk_mb_per_sec;
+
 ////////////////////////////////////////////////////////////////////////////////
 // End CL7 Proxy namespace configurable options
 ////////////////////////////////////////////////////////////////////////////////
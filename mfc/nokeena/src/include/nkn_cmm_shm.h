@@ -63,6 +63,8 @@ typedef struct cmm_shm_hdr {
 #define CMM_VA_STATE_ON "on"
 #define CMM_VA_STATE_OFF "off"
 
+#define CMM_NM_NODE_STATE "node-state" // Gossip detector, see node_state
+
 #define CMM_NM_OP_SUCCESS "op-success"
 #define CMM_NM_OP_TIMEOUT "op-timeout"
 #define CMM_NM_OP_OTHER "op-other"
@@ -97,7 +99,7 @@ typedef struct cmm_shm_hdr {
 #define CMM_LD_SHM_SIZE (4 * 1024 * 1024) // max (8192-1), supports CMM_SHM max
 
 #define CMM_LD_SHM_MAGICNO CMM_LD_SHM_KEY
-#define CMM_LD_SHM_VERSION 3
+#define CMM_LD_SHM_VERSION 4
 
 #define CMM_LD_SEGMENT_SIZE 512
 #define CMM_LD_MAX_HDR_SIZE CMM_LD_SEGMENT_SIZE
@@ -110,7 +112,16 @@ typedef uint64_t node_load_metric_t;
 
 #define SIZEOF_NODE_HANDLE 128
 #define SIZEOF_PAD (CMM_LD_SEGMENT_SIZE - sizeof(node_load_metric_t) - \
-		    sizeof(uint64_t) - SIZEOF_NODE_HANDLE - sizeof(uint64_t))
+		    sizeof(uint64_t) - SIZEOF_NODE_HANDLE - sizeof(uint64_t) - \
+		    sizeof(uint32_t) - sizeof(uint32_t))
+
+/*
+ * node_state, gossip failure detector view of the node
+ */
+#define CMM_NODE_STATE_UNKNOWN 0 // Detector disabled or node not heard from
+#define CMM_NODE_STATE_ALIVE 1
+#define CMM_NODE_STATE_SUSPECT 2
+#define CMM_NODE_STATE_DEAD 3
 
 typedef struct cmm_loadmetric_entry {
     union {
@@ -119,6 +130,8 @@ typedef struct cmm_loadmetric_entry {
 	    uint64_t incarnation;
 	    char node_handle[SIZEOF_NODE_HANDLE];
 	    uint64_t version;
+	    uint32_t node_state;
+	    uint32_t node_state_changes;
 	    char pad[SIZEOF_PAD];
 	} loadmetric;
     	char data[CMM_LD_SEGMENT_SIZE];
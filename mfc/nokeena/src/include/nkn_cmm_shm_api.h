@@ -70,6 +70,20 @@ int
 cmm_shm_chan_getdata_ptr(cmm_shm_chan_t *chan, void **data, int *datalen,
 			 uint64_t *version);
 
+/*
+ * Get the gossip failure detector state (CMM_NODE_STATE_XXX) of the node.
+ *
+ *  Input:
+ *	changes - optional, count of state changes
+ *
+ *  Returns: 
+ *	0  => Success
+ *	!0 => Failure
+ */
+int
+cmm_shm_chan_get_node_state(cmm_shm_chan_t *chan, int *state, 
+			    uint32_t *changes);
+
 #endif /* _NKN_CMM_SHM_API_H */
 
 /*
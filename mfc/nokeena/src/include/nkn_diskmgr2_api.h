@@ -58,6 +58,7 @@
 
 
 #define DM2_BITMAP_FNAME	"freeblks"
+#define DM2_PREREAD_MANIFEST_FNAME	"preread.manifest"
 #define DM2_BITMAP_MAGIC	0xFEEDCAFE
 #define DM2_BITMAP_VERSION	2
 #define DM2_BITMAP_HEADER_SZ	4096
@@ -147,6 +147,7 @@ typedef struct container_disk_header {
 #define DM2_CONT_NEW_SPACE_NEW_DISK 3
 
 struct dm2_cache_info;
+struct dm2_md_batch;
 typedef struct container_runtime_header {
     pthread_rwlock_t	  crh_rwlock;	   // control access to container file
     void		  *crh_barrier;    // Don't move.
@@ -162,10 +163,13 @@ typedef struct container_runtime_header {
     uint32_t		  crh_blksz;	   // Copy from bitmap header
     int32_t		  crh_blk_allocs;  // Init to value, then use up
     dm2_disk_block_t	  crh_open_dblk;   // present if DM_DB_ACTIVE flag set
+    struct dm2_md_batch	  *crh_md_batch;   // queued extent/attr writes
+    off_t		  crh_md_attr_end; // attr file end incl. queued writes
     int16_t		  crh_cont_mem_sz; // sizeof(dm2_container_t)
     int8_t		  crh_created;
     int8_t		  crh_new_space;
     int8_t		  crh_run;	   // num of continuous blocks
+    int8_t		  crh_md_flushing; // detached batch being written
 } container_runtime_header_t;
 
 #define DM2_MAX_SZ_CONT_DISK_HEAD_T	(2*1024)
@@ -249,6 +253,9 @@ typedef struct dm2_container_head {
 #define c_created	rh.crh_created
 #define c_new_space	rh.crh_new_space
 #define c_run		rh.crh_run
+#define c_md_batch	rh.crh_md_batch
+#define c_md_attr_end	rh.crh_md_attr_end
+#define c_md_flushing	rh.crh_md_flushing
 
 #define DM2_URI_NOT_LOCKED 0
 #define DM2_URI_RLOCKED 1
@@ -48,6 +48,7 @@
  */
 #define DM2_EXT_FLAG_INUSE	0x1
 #define DM2_EXT_FLAG_CHKSUM	0x2
+#define DM2_EXT_FLAG_CRC32C	0x4	// ext_v2_checksum[] are CRC32C
 
 #define DM2_EXT_RDSZ_MULTIPLIER 1024
 #define DM2_EXT_INIT_CONT_OFF	(uint32_t)(-1)
@@ -149,6 +150,17 @@ typedef struct DM2_disk_extent_v2 {
 
 /* Disk extent flags */
 #define DM2_DISK_EXT_FLAG_CHKSUM	0x1
+/*
+ * V2 extent whose dext_ext_checksum[] are CRC32C instead of XOR sums.
+ * Set without DM2_DISK_EXT_FLAG_CHKSUM, so older releases treat such
+ * an extent as not checksummed rather than as corrupt.
+ */
+#define DM2_DISK_EXT_FLAG_CRC32C	0x2
+
+#define DM2_DEXT_TO_EXT_FLAGS(dext_flags)				\
+    ((((dext_flags) & (DM2_DISK_EXT_FLAG_CHKSUM |				\
+		       DM2_DISK_EXT_FLAG_CRC32C)) ? DM2_EXT_FLAG_CHKSUM : 0) | \
+     (((dext_flags) & DM2_DISK_EXT_FLAG_CRC32C) ? DM2_EXT_FLAG_CRC32C : 0))
 
 DM2_extent_t *dm2_find_extent_by_offset(GList *in_ext_list,
 		const off_t uri_offset, const off_t len, off_t *tot_len,
@@ -28,6 +28,7 @@ OBJ_TYPE(mod_http_ipstr)
 OBJ_TYPE(mod_http_mime_header_t)
 OBJ_TYPE(mod_http_uri_token_t)
 OBJ_TYPE(mod_http_hit_history_t)
+OBJ_TYPE(mod_http_resp_tmpl)
 
 OBJ_TYPE(mod_httphdrs_serialbuf)
 
@@ -56,6 +57,7 @@ OBJ_TYPE(mod_mm_promote_cfg_t)
 OBJ_TYPE(mod_mm_promote_uri_strdup)
 OBJ_TYPE(mod_mm_move_mgr_thrd_t)
 OBJ_TYPE(mod_mm_delete_t)
+OBJ_TYPE(mod_mm_promote_batch_t)
 
 OBJ_TYPE(mod_am_promote_thr_am_obj_t)
 OBJ_TYPE(mod_am_tbl_create_am_obj)
@@ -76,6 +78,7 @@ OBJ_TYPE(mod_am_strdup7)
 OBJ_TYPE(mod_am_strdup8)
 OBJ_TYPE(mod_am_test)
 OBJ_TYPE(mod_am_object_data)
+OBJ_TYPE(mod_am_admit_sketch)
 
 OBJ_TYPE(mod_nfs_server_map_cfg_file)
 OBJ_TYPE(mod_nfs_filestr)
@@ -148,6 +151,7 @@ OBJ_TYPE(mod_dm2_pthread_cond_t)
 OBJ_TYPE(mod_dm2_posix_memalign)
 OBJ_TYPE(mod_dm2_preread_cont_name)
 OBJ_TYPE(mod_dm2_preread_arg_t)
+OBJ_TYPE(mod_dm2_md_batch_t)
 OBJ_TYPE(mod_dm2_preread_hash)
 OBJ_TYPE(mod_dm2_uri_lock_t)
 OBJ_TYPE(mod_dm2_disk_slot_t)
@@ -817,6 +821,8 @@ OBJ_TYPE(mod_dns_parser_buf)
 OBJ_TYPE(mod_dns_parser_token_data)
 OBJ_TYPE(mod_cr_ds)
 OBJ_TYPE(mod_ds_hash_table_mgmt_add)
+OBJ_TYPE(mod_cr_de_snapshot)
+OBJ_TYPE(mod_cr_de_snapshot_resp)
 /* Compression specific */
 OBJ_TYPE(mod_ns_compress_config_t)
 OBJ_TYPE(mod_compress_msg_t)
@@ -847,6 +853,7 @@ OBJ_TYPE(mod_uf_body)
 
 /* URL Filter data */
 OBJ_TYPE(mod_uf_trie)
+OBJ_TYPE(mod_uf_match)
 
 /* NFQUEUE/DPI */
 OBJ_TYPE(mod_nf_dpi_xfer_t)
@@ -1109,7 +1109,7 @@ typedef enum {
 typedef struct url_filter_trie {
 	AO_t 	   refcnt;
 	uint64_t   magicno;
-    	nkn_trie_t *trie;
+	struct uf_match *match;	// compiled list, see nkn_uf_match.h
 } url_filter_trie_t;
 
 #define UF_TRIE_DATA_MAGIC 0x201404301234abcd
@@ -110,4 +110,5 @@ typedef struct nkn_shmdef {
 #define NKN_OOM_SHMKEY	5681
 #define NKN_SSL_SHMKEY  5682
 #define NKN_CB_SHMKEY  	5683
+#define NKN_SSL_SCACHE_SHMKEY	5684
 #endif // __NKN_STAT__H
@@ -0,0 +1,55 @@
+/*
+ *******************************************************************************
+ * nkn_uf_match.h -- Compiled URL filter list
+ *
+ *	The URL filter list (uf_fmt_url_bin.h) is compiled at load time
+ *	into one read only block:
+ *	  - a blocked Bloom filter on the host, so that a miss costs one
+ *	    cache line
+ *	  - an open addressed host table
+ *	  - per host, the paths sorted with a link to the longest path of
+ *	    the same host that is a prefix of it
+ *	Lookups do not allocate and give the same longest prefix result as
+ *	the Patricia tree on the "<HOSTNAME>/<URI absolute path>" key.
+ *******************************************************************************
+ */
+#ifndef _NKN_UF_MATCH_H
+#define _NKN_UF_MATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct uf_match uf_match_t;
+
+/*
+ * uf_match_compile() - Compile the mmap'ed binary URL filter list
+ *	Returns: != 0 => Success, otherwise *err is set (8 => the list
+ *	holds a duplicate entry)
+ */
+uf_match_t *uf_match_compile(const char *addr, size_t size, int *err);
+
+/*
+ * uf_match_destroy() - Free a compiled list
+ */
+void uf_match_destroy(uf_match_t *m);
+
+/*
+ * uf_match_lookup() - Longest prefix match of host + abs path
+ *	host is matched case insensitive with any ":80" already stripped,
+ *	redundant slashes in path are ignored.
+ *	Returns: 0 => No match, otherwise the entry number in the list
+ */
+long uf_match_lookup(const uf_match_t *m, const char *host, int hostlen,
+		     const char *path, int pathlen);
+
+/*
+ * uf_match_entries(), uf_match_memsize() - Unique entries and bytes used
+ */
+uint32_t uf_match_entries(const uf_match_t *m);
+size_t uf_match_memsize(const uf_match_t *m);
+
+#endif  /* _NKN_UF_MATCH_H */
+
+/*
+ * End of nkn_uf_match.h
+ */
@@ -137,6 +137,17 @@ unsigned int do_csum32_iterate_aligned(const unsigned char *buff, int len,
  */
 unsigned int do_csum32_iterate_aligned_v3(const unsigned char *buff, int len,
 					  unsigned int old_checksum);
+/*
+ * CRC32C, SSE4.2 crc32 instruction when the CPU has it, table driven
+ * otherwise.  Iterate like do_csum32_iterate_aligned(), starting with 0.
+ * Any alignment and length.  do_crc32c_iterate_sw() always uses the
+ * tables.
+ */
+unsigned int do_crc32c_iterate(const unsigned char *buff, int len,
+			       unsigned int old_crc);
+unsigned int do_crc32c_iterate_sw(const unsigned char *buff, int len,
+				  unsigned int old_crc);
+int do_crc32c_hw_available(void);
 
 /*
  * Use to get transaction id which is not the same as pid or pthread_id
@@ -127,6 +127,15 @@ nvsd_rp_bw_update_send(int rp_index, uint64_t byte_sent);
 uint64_t
 nvsd_rp_bw_query_available_bw(int rp_index);
 
+/*
+ *      function : nvsd_rp_bw_query_pace_rate()
+ *      purpose : per client session share of the pool bandwidth,
+ *		  used as the kernel pacing rate of a session.
+ *      returns : Bytes/sec, 0 when not known.
+ */
+uint64_t
+nvsd_rp_bw_query_pace_rate(int rp_index);
+
 //Generic ones
 void
 nvsd_rp_cleanup_used(rp_type_en resource_type);
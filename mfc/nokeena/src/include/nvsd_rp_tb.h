@@ -0,0 +1,107 @@
+/*
+ *
+ * Filename:  nvsd_rp_tb.h
+ *
+ * Per network thread token buckets for resource pool bandwidth.
+ *
+ * Each network thread keeps one local bucket per resource pool and
+ * borrows tokens from the pool's shared BW used counter in batches.
+ * A send is charged against the local bucket and only touches the
+ * shared counter when the bucket runs dry, so the pool cache line is
+ * written once per batch instead of once per send.
+ *
+ * The pool limit still holds: a refill never keeps more tokens than
+ * the pool has left, a send the pool cannot cover is not charged (as
+ * nvsd_rp_alloc_resource() refuses it), and the tokens of a thread are
+ * dropped when the 1 second timer starts a new epoch.
+ *
+ */
+#ifndef NVSD_RP_TB__H
+#define NVSD_RP_TB__H
+#include <stdint.h>
+#include <atomic_ops.h>
+
+/* refill batch bounds, Bytes */
+#define RP_TB_MIN_BATCH		(4 * 1024)
+#define RP_TB_MAX_BATCH		(1024 * 1024)
+
+/* threads with their own buckets, others charge the pool directly */
+#define RP_TB_MAX_THREADS	64
+
+typedef struct rp_tb_st {
+	uint64_t	tokens;		// borrowed from the pool, not yet spent
+	AO_t		epoch;		// pool epoch the tokens belong to
+} rp_tb_t;
+
+/*
+ * Split the pool max so that all threads together hold at most 1/8 of
+ * it in their local buckets.
+ */
+static inline uint64_t
+rp_tb_batch(uint64_t max, int nthreads)
+{
+    uint64_t batch;
+
+    batch = max / (8 * (uint64_t)(nthreads > 0 ? nthreads : 1));
+    if (batch < RP_TB_MIN_BATCH)
+	return RP_TB_MIN_BATCH;
+    if (batch > RP_TB_MAX_BATCH)
+	return RP_TB_MAX_BATCH;
+    return batch;
+}
+
+/*
+ * Charge bytes already written to the socket.  When the pool cannot
+ * cover the part of the send beyond the local tokens, the whole borrow
+ * is handed back and those bytes are not charged, like a failed
+ * nvsd_rp_alloc_resource(); otherwise only the spare part of the batch
+ * above the pool max is handed back.
+ */
+static inline void
+rp_tb_charge(AO_t *used, uint64_t max, AO_t epoch, rp_tb_t *tb,
+	     uint64_t bytes, int nthreads)
+{
+    uint64_t need, borrow, spare, over, old_used;
+
+    if (tb->epoch != epoch) {
+	tb->tokens = 0;
+	tb->epoch = epoch;
+    }
+    if (tb->tokens >= bytes) {
+	tb->tokens -= bytes;
+	return;
+    }
+
+    need = bytes - tb->tokens;
+    spare = rp_tb_batch(max, nthreads);
+    borrow = need + spare;
+    old_used = AO_fetch_and_add(used, borrow);
+    if (old_used + borrow > max) {
+	over = old_used + borrow - max;
+	if (over > spare) {
+	    AO_fetch_and_add(used, -borrow);
+	    tb->tokens = 0;
+	    return;
+	}
+	AO_fetch_and_add(used, -over);
+	spare -= over;
+    }
+    tb->tokens = spare;
+}
+
+/*
+ * Bytes this thread may still send in the current epoch: its own
+ * tokens plus what is left in the pool.
+ */
+static inline uint64_t
+rp_tb_available(uint64_t used, uint64_t max, AO_t epoch, const rp_tb_t *tb)
+{
+    uint64_t avail;
+
+    avail = (max > used) ? max - used : 0;
+    if (tb->epoch == epoch)
+	avail += tb->tokens;
+    return avail;
+}
+
+#endif /* NVSD_RP_TB__H */
@@ -91,6 +91,24 @@
  *
  *     2) File1 becomes the CurrentCkpt and File2 becomes ShadowCkpt.
  *        The CurrentTrie and ShadowTrie are initialized from the CurrentCkpt.
+ *
+ * Snapshot mode (ptrie_recover_from_snapshot()):
+ *   Replaces the checkpoint files for large tries.  The persistent state is
+ *   a sorted snapshot file plus an append only delta log.
+ *
+ *   Readers search the mapped snapshot in place, CurrentTrie and ShadowTrie
+ *   only hold the delta since the snapshot (deleted keys as tombstones).
+ *   Recovery maps the snapshot and replays the delta log, the cost no
+ *   longer scales with the number of keys.
+ *
+ *   end_xaction appends the transaction log to the delta log with a single
+ *   write.  With group_commit_msecs the fsync is left to a log sync thread
+ *   which covers all commits of the interval, ptrie_sync() waits for it.
+ *   Without it each commit does one fdatasync().
+ *
+ *   Once compact_log_records are logged a compaction thread freezes the
+ *   delta (new log segment) and merges the snapshot with the frozen log
+ *   segments into a new snapshot while readers and transactions continue.
  */
 
 #define PTRIE_INTF_VERSION 1
@@ -154,6 +172,58 @@ int
 ptrie_recover_from_ckpt(ptrie_context_t *ctx,
 			const char *ckp_file1, const char *ckp_file2);
 
+typedef struct ptrie_snap_config {
+    int group_commit_msecs; // 0 => fdatasync() log at each commit
+    long compact_log_records; // 0 => PTRIE_DEF_COMPACT_LOG_RECORDS
+    char pad[64];
+} ptrie_snap_config_t;
+
+#define PTRIE_DEF_COMPACT_LOG_RECORDS (256 * 1024)
+
+/*
+ * ptrie_recover_from_snapshot() - Recover Trie from snapshot and delta log
+ *
+ *  - snap_file, snapshot file name, the delta log segments are named
+ *    <snap_file>.log.<generation>.
+ *  - ckp_file{1,2}, optional ptrie_recover_from_ckpt() files, imported
+ *    into the initial snapshot when snap_file does not exist.
+ *  - NULL cfg uses the defaults.
+ *
+ * Return:
+ *  ==0, Success
+ *  !=0, Error
+ */
+int 
+ptrie_recover_from_snapshot(ptrie_context_t *ctx, const char *snap_file,
+			    const char *ckp_file1, const char *ckp_file2,
+			    const ptrie_snap_config_t *cfg);
+
+/*
+ * ptrie_sync() - Update side, wait until all commits are on stable storage
+ *
+ * Only required in snapshot mode with group_commit_msecs.
+ *
+ * Return:
+ *  ==0, Success
+ *  !=0, Error
+ */
+int
+ptrie_sync(ptrie_context_t *ctx);
+
+/*
+ * ptrie_compact() - Update side, request a snapshot compaction
+ *
+ * Assumptions:
+ *  1) Update side interface, snapshot mode.
+ *  2) Not executed under ptrie_{begin,end}_xaction()
+ *
+ * Return:
+ *  ==0, Success, compaction done if wait != 0
+ *  !=0, Error
+ */
+int
+ptrie_compact(ptrie_context_t *ctx, int wait);
+
 /*
  * ptrie_prefix_match() - Reader side prefix match, return app_data_t
  *
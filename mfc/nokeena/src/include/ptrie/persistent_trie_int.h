@@ -7,6 +7,8 @@
 
 #include <sys/types.h>
 #include <sys/param.h>
+#include <stdint.h>
+#include <pthread.h>
 #include "atomic_ops.h"
 #include "cprops/collection.h"
 #include "cprops/trie.h"
@@ -105,6 +107,12 @@ typedef struct ckpt_file_data {
 typedef struct trie_data {
     AO_t refcnt;
     cp_trie *trie;
+
+    /* Snapshot mode, layers below trie (DH_MAGICNO_FREE nodes hide keys) */
+    cp_trie *frozen; // Delta under compaction, read only
+    struct ptrie_snap *snap; // Mapped snapshot, read only
+    int reset; // trie hides frozen and snap
+    int frozen_reset; // frozen hides snap
 } trie_data_t;
 
 /*
@@ -132,6 +140,99 @@ typedef struct trie_xaction_log {
 #define MAX_CKPT_FILESIZE (META_HDRSIZE + \
 				(MAX_TRIE_ENTRIES * sizeof(file_node_data_t)))
 
+/*
+ * Snapshot file definitions (ptrie_recover_from_snapshot())
+ *
+ * File layout:
+ *  snap_header_t offset=0
+ *  snap_entry_t[entries] offset=DEV_BSIZE, sorted by key (strcmp)
+ *  '\0' terminated keys offset=keys_foff
+ *
+ * A snapshot is written to <name>.tmp and renamed, it is never modified
+ * once mapped.  Lookups binary search the entries in place, prefix_ix
+ * links an entry to the entry of its longest proper prefix.
+ */
+typedef struct snap_header {
+    union {
+    	struct snap_hdrdata {
+	    int version;
+	    int pad1;
+	    long magicno;
+	    long seqno; // Last log commit included
+	    long log_gen; // First log segment not included
+	    struct timespec ts;
+	    long entries;
+	    off_t keys_foff;
+	    off_t filesize;
+	    fh_user_data_t ud;
+	} hdr;
+	char raw_hdr[512];
+    } u;
+} snap_header_t;
+
+#define SH_VERSION 	0x10000000 // 32 bits
+#define SH_MAGICNO 	0x1301201212340003
+
+typedef struct snap_entry { // 144 bytes
+    off_t key_off; // Relative to keys_foff
+    int key_strlen;
+    int prefix_ix; // -1 => none
+    app_data_t ad;
+} snap_entry_t;
+
+typedef struct ptrie_snap {
+    int fd;
+    char *map;
+    size_t mapsize;
+    const snap_header_t *hdr;
+    const snap_entry_t *en;
+    const char *keys;
+} ptrie_snap_t;
+
+/*
+ * Delta log definitions (snapshot mode)
+ *
+ * Segment <name>.log.<gen> layout:
+ *  log_seg_header_t offset=0
+ *  log_rec_t ... log_commit_t, one group per committed transaction
+ *
+ * Groups are only appended.  A transaction is committed once its 
+ * log_commit_t is intact, recovery truncates a torn last group.
+ */
+typedef struct log_seg_header {
+    int version;
+    int pad1;
+    long magicno;
+    long gen;
+    char pad2[488];
+} log_seg_header_t;
+
+#define LS_VERSION 	0x10000000 // 32 bits
+#define LS_MAGICNO 	0x1301201212340004
+
+typedef struct log_rec {
+    int magicno;
+    short type; // ptrie_xaction_type_t
+    short key_strlen;
+    app_data_t ad;
+    char key[0]; // '\0' terminated, record padded to 8 bytes
+} log_rec_t;
+
+#define LR_MAGICNO 		0x13012012
+#define LR_MAGICNO_COMMIT 	0x13012013
+
+#define LOG_REC_SIZE(_key_strlen) \
+	((sizeof(log_rec_t) + (_key_strlen) + 1 + 7) & ~7UL)
+
+typedef struct log_commit {
+    int magicno;
+    int records;
+    long seqno;
+    uint64_t csum; // FNV-1a of the group log_rec_t(s)
+    struct timespec ts;
+    fh_user_data_t ud;
+} log_commit_t;
+
 /* 
  * Persistent Trie memory context definitions
  */
@@ -155,6 +256,41 @@ typedef struct ptrie_context {
 
     void (*copy_app_data)(const app_data_t *src, app_data_t *dest);
     void (*destruct_app_data)(app_data_t *d);
+
+    /* Snapshot mode, ptrie_recover_from_snapshot() */
+    int snap_mode;
+    int group_commit_msecs;
+    long compact_log_records;
+    char *snap_name;
+    ptrie_snap_t *snap; // Latest installed snapshot
+    fh_user_data_t snap_ud; // Last commit
+
+    long log_gen; // Live log segment
+    int log_fd;
+    off_t log_off; // End of last commit
+    long log_seqno; // Last commit
+    long log_records; // Records in the live segment
+    char *log_buf;
+    size_t log_bufsize;
+
+    pthread_mutex_t snap_mutex; // Held by xactions and layer switches
+    pthread_cond_t snap_cond;
+    int snap_shutdown;
+    int compact_request;
+    int compact_running;
+    long compactions; // Finished, failed included
+    long compact_errors;
+    pthread_t compact_tid;
+
+    pthread_mutex_t sync_mutex;
+    pthread_cond_t sync_cond;
+    long written_seqno;
+    long synced_seqno;
+    int sync_now;
+    int sync_busy;
+    int sync_error;
+    long log_syncs;
+    pthread_t sync_tid;
 } ptrie_context_t;
 
 typedef enum ptrie_log_level {
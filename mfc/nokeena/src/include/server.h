@@ -63,6 +63,7 @@
 #define CONF_UCFLT_TASK		0x0000000008000000
 #define CONF_CI_FETCH_END_OFF   0x0000000010000000
 #define CONF_CI_USE_END_OFF   0x0000000020000000
+#define CONF_KERNEL_PACED	0x0000000040000000
 
 #define CON_MAGIC_FREE          0x123456789deadbee
 #define CON_MAGIC_USED          0x1111111111111111
@@ -125,10 +126,12 @@ typedef struct struct_con_t{
 	uint64_t min_afr;               // Assured Flow Rate: Bytes/sec
 	uint64_t max_client_bw;         // Detected client (ISP) Bandwidth: Bytes/sec
 	uint64_t max_allowed_bw;        // Allowed Session Bandwidth (Data Center): Bytes/sec
-	uint64_t max_send_size;         // Max Sent Size in this second
+	uint64_t max_send_size;         // Max Sent Size in this time slice
 	uint64_t bandwidth_send_size;   // AFR, allowed bandwidth send
 	uint64_t max_faststart_buf;	// Initial Buffer Size for Fast Start (Bytes)
 	time_t   nkn_cur_ts;		// The time to calculate max_send_size
+	uint64_t pace_msecs;		// Same in msecs, starts the time slice
+	uint64_t paced_rate;		// Rate handed to the kernel: Bytes/sec
 
 	/* IP TOS setting */
 	int32_t		ip_tos;
@@ -246,6 +249,12 @@ void* remove_hmoq_item(int num);
  * afr unit is: Bytes/sec
  */
 void con_set_afr(con_t *con, uint64_t afr);
+/*
+ * max_send_size of a connection paced by the kernel, large enough that
+ * it never runs out and the connection never enters the sbq.
+ */
+#define CON_PACED_SEND_SIZE	(1ULL << 40)
+int con_update_pacing(con_t *con);
 
 /*
  * Local interface IP address
@@ -0,0 +1,517 @@
+/**
+ * @file   de_snapshot.c
+ * @date   Mon Oct 19 2026
+ *
+ * @brief  implements the precompiled decision tables used by the
+ * round robin and geo/load decision engines
+ *
+ * A packed prefix table entry has the following layout
+ * bit 63        - valid
+ * bits 39 - 62  - client /24 network
+ * bits 36 - 38  - number of candidates tied for the best score
+ * bits 32 - 35  - number of ranked candidates
+ * bits 0 - 31   - ranked candidate indices, best first, 8 bits each
+ * The entry is published with a single CAS, so a reader either sees
+ * an empty slot or the complete ranked list.
+ *
+ * Reclaim
+ * A reader announces itself in the counter of the current reclaim
+ * epoch for the short window in which it loads the published pointer
+ * and takes its hold on the snapshot. A snapshot retired in epoch E
+ * is freed only once the epoch has moved past E, the window counter
+ * of E has drained and the snapshot has no holds left. The epoch is
+ * advanced only when the counter of the previous epoch is idle, so
+ * at most two epochs have readers in the window at any time and two
+ * counters (by epoch parity) suffice.
+ */
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "de_snapshot.h"
+#include "nkn_geodb.h"
+#include "cr_common_intf.h"
+
+//extern
+extern obj_store_t *store_list[];
+
+#define DE_SNAP_ENT_VALID (1ULL << 63)
+#define DE_SNAP_ENT_PREFIX_SHIFT 39
+#define DE_SNAP_ENT_TIES_SHIFT 36
+#define DE_SNAP_ENT_COUNT_SHIFT 32
+
+/* retired snapshots, only touched by the publisher and the
+ * reclaimer
+ */
+static pthread_mutex_t de_snap_retire_lock = PTHREAD_MUTEX_INITIALIZER;
+static de_snapshot_t *de_snap_retire_list = NULL;
+static AO_t de_snap_epoch = 1;
+static AO_t de_snap_epoch_readers[2];
+
+/* COUNTERS */
+AO_t glob_de_snap_prefix_hit;
+AO_t glob_de_snap_prefix_miss;
+AO_t glob_de_snap_prefix_tbl_full;
+AO_t glob_de_snap_retired;
+AO_t glob_de_snap_freed;
+
+static int32_t de_snap_usable(const de_cache_attr_t *ca);
+static int32_t de_snap_build_rec(const de_cache_attr_t *ca,
+				 uint32_t ttl, int32_t type,
+				 de_snap_rec_t *rec);
+static uint32_t de_snap_rank(const de_snapshot_t *snap,
+			     const char *client_addr,
+			     uint8_t *ranked, uint32_t *num_best);
+static uint32_t de_snap_prefix_lookup(de_snapshot_t *snap,
+				      const char *client_addr,
+				      uint8_t *ranked, uint32_t *num_best);
+
+/**
+ * same candidate filter as the decision engines (see de_geo_lf.c
+ * and de_rr.c), so that a snapshot decides like the live engine
+ */
+static int32_t
+de_snap_usable(const de_cache_attr_t *ca)
+{
+    return !(ca->stats.status == LF_UNREACHABLE ||
+	     ca->stats.status == CACHE_DOWN ||
+	     ca->stats.cpu_load > ca->load_watermark);
+}
+
+static int32_t
+de_snap_build_rec(const de_cache_attr_t *ca, uint32_t ttl,
+		  int32_t type, de_snap_rec_t *rec)
+{
+    rrecord_msg_fmt_builder_t *rrb = NULL;
+    uint32_t j, rlen = 0, num_rr = 0;
+    int32_t err = 0;
+
+    rec->buf = NULL;
+    rec->len = 0;
+
+    for (j = 0; j < ca->num_addr; j++) {
+	if (type != ce_addr_type_max && ca->addr_type[j] !=
+	    (uint32_t)type) {
+	    continue;
+	}
+	rlen += rrecord_msg_fmt_builder_compute_record_size(
+						    *ca->addr_len[j]);
+	num_rr++;
+	/* a typed query is answered with a single record */
+	if (type != ce_addr_type_max) {
+	    break;
+	}
+    }
+
+    /* candidate does not carry this address type, the query falls
+     * back to the CNAME of last resort same as with the decision
+     * engines
+     */
+    if (!num_rr) {
+	return 0;
+    }
+
+    err = rrecord_msg_fmt_builder_create(rlen, &rrb);
+    if (err) {
+	goto error;
+    }
+    err = rrb->add_hdr(rrb, num_rr, ttl);
+    if (err) {
+	goto error;
+    }
+    for (j = 0; j < ca->num_addr; j++) {
+	if (type != ce_addr_type_max && ca->addr_type[j] !=
+	    (uint32_t)type) {
+	    continue;
+	}
+	err = rrb->add_record(rrb, ca->addr_type[j],
+			      (const uint8_t *)ca->addr[j],
+			      *ca->addr_len[j]);
+	if (err) {
+	    goto error;
+	}
+	if (type != ce_addr_type_max) {
+	    break;
+	}
+    }
+    err = rrb->get_buf(rrb, &rec->buf, &rec->len);
+
+ error:
+    if (rrb) rrb->delete(rrb);
+    return err;
+}
+
+int32_t
+de_snapshot_create(const crst_search_out_t *di, routing_type_t type,
+		   uint64_t gen, de_snapshot_t **out)
+{
+    de_snapshot_t *snap = NULL;
+    const de_cache_attr_t *ca = NULL;
+    double load_max = 0;
+    uint32_t i, n = 0;
+    int32_t t, err = 0;
+
+    if (!di || !out) {
+	return -EINVAL;
+    }
+    if (di->ce_count > DE_SNAP_MAX_CE) {
+	return -E2BIG;
+    }
+
+    snap = (de_snapshot_t *)
+	nkn_calloc_type(1, sizeof(de_snapshot_t), mod_cr_de_snapshot);
+    if (!snap) {
+	err = -ENOMEM;
+	goto error;
+    }
+    snap->gen = gen;
+    snap->type = type;
+    if (di->ce_count) {
+	snap->ce = (de_snap_ce_t *)
+	    nkn_calloc_type(di->ce_count, sizeof(de_snap_ce_t),
+			    mod_cr_de_snapshot);
+	if (!snap->ce) {
+	    err = -ENOMEM;
+	    goto error;
+	}
+    }
+    if (type == ROUTING_TYPE_GEOLOAD) {
+	snap->prefix_tbl = (AO_t *)
+	    nkn_calloc_type(DE_SNAP_PREFIX_SLOTS, sizeof(AO_t),
+			    mod_cr_de_snapshot);
+	if (!snap->prefix_tbl) {
+	    err = -ENOMEM;
+	    goto error;
+	}
+    }
+
+    for (i = 0; i < di->ce_count; i++) {
+	ca = &di->ce_attr[i];
+	if (!de_snap_usable(ca)) {
+	    continue;
+	}
+	if (load_max < ca->stats.cpu_load) {
+	    load_max = ca->stats.cpu_load;
+	}
+    }
+    if (!load_max) load_max = 1;
+
+    for (i = 0; i < di->ce_count; i++) {
+	de_snap_ce_t *sc = NULL;
+
+	ca = &di->ce_attr[i];
+	if (!de_snap_usable(ca)) {
+	    continue;
+	}
+	sc = &snap->ce[n];
+	sc->loc = ca->loc_attr;
+	sc->load = ca->stats.cpu_load / load_max;
+	for (t = ce_addr_type_none; t <= ce_addr_type_max; t++) {
+	    err = de_snap_build_rec(ca, di->ttl, t, &sc->rec[t]);
+	    if (err) {
+		/* let destroy free the records of this CE too */
+		snap->num_ce = n + 1;
+		goto error;
+	    }
+	}
+	n++;
+    }
+    snap->num_ce = n;
+
+    *out = snap;
+    return 0;
+
+ error:
+    if (snap) de_snapshot_destroy(snap);
+    return err;
+}
+
+void
+de_snapshot_destroy(de_snapshot_t *snap)
+{
+    uint32_t i;
+    int32_t t;
+
+    if (!snap) {
+	return;
+    }
+    if (snap->ce) {
+	for (i = 0; i < snap->num_ce; i++) {
+	    for (t = ce_addr_type_none; t <= ce_addr_type_max; t++) {
+		if (snap->ce[i].rec[t].buf) free(snap->ce[i].rec[t].buf);
+	    }
+	}
+	free(snap->ce);
+    }
+    if (snap->prefix_tbl) free(snap->prefix_tbl);
+    free(snap);
+}
+
+/**
+ * ranks the usable candidates for a client using the same weighted
+ * distance/load score as the geo/load decision engine. If the
+ * client location is unknown the candidates are ranked on load alone.
+ * 'num_best' is set to the number of leading candidates that share
+ * the best score
+ */
+static uint32_t
+de_snap_rank(const de_snapshot_t *snap, const char *client_addr,
+	     uint8_t *ranked, uint32_t *num_best)
+{
+    conjugate_graticule_t client_location;
+    double score[DE_SNAP_MAX_RANK], dist, dis_max = 0, s;
+    double w1 = 0.5, w2 = 0.5;
+    obj_store_t *h_geodb = store_list[CRST_STORE_TYPE_GEO];
+    char resp[1024];
+    uint32_t resp_len = 1024;
+    uint32_t i, j, num_ranked = 0;
+    uint8_t have_loc = 0;
+
+    if (h_geodb && client_addr[0] != '\0' &&
+	!h_geodb->read(h_geodb, (char *)client_addr, strlen(client_addr),
+		       resp, &resp_len)) {
+	geo_ip_t *geo = (geo_ip_t *)resp;
+	client_location.latitude = geo->ginf.latitude;
+	client_location.longitude = geo->ginf.longitude;
+	have_loc = 1;
+	for (i = 0; i < snap->num_ce; i++) {
+	    dist = compute_geo_distance(&snap->ce[i].loc, &client_location);
+	    if (dis_max < dist) dis_max = dist;
+	}
+    }
+    if (!dis_max) dis_max = 1;
+
+    /* insertion into a short sorted list, the candidate count is
+     * small and this only runs on a prefix table miss
+     */
+    for (i = 0; i < snap->num_ce; i++) {
+	s = w2 * snap->ce[i].load;
+	if (have_loc) {
+	    s += w1 * (compute_geo_distance(&snap->ce[i].loc,
+					    &client_location) / dis_max);
+	}
+	for (j = num_ranked; j > 0 && score[j - 1] > s; j--) {
+	    if (j < DE_SNAP_MAX_RANK) {
+		score[j] = score[j - 1];
+		ranked[j] = ranked[j - 1];
+	    }
+	}
+	if (j < DE_SNAP_MAX_RANK) {
+	    score[j] = s;
+	    ranked[j] = (uint8_t)i;
+	    if (num_ranked < DE_SNAP_MAX_RANK) num_ranked++;
+	}
+    }
+
+    *num_best = num_ranked ? 1 : 0;
+    while (*num_best < num_ranked && score[*num_best] == score[0]) {
+	(*num_best)++;
+    }
+
+    return num_ranked;
+}
+
+static uint32_t
+de_snap_prefix_lookup(de_snapshot_t *snap, const char *client_addr,
+		      uint8_t *ranked, uint32_t *num_best)
+{
+    struct in_addr in;
+    AO_t *slot = NULL;
+    uint64_t prefix, ent, tag;
+    uint32_t h, i, j, num_ranked;
+
+    /* only IPv4 clients are memoized, everything else is ranked on
+     * every query, still without any locks
+     */
+    if (inet_pton(AF_INET, client_addr, &in) != 1) {
+	return de_snap_rank(snap, client_addr, ranked, num_best);
+    }
+    prefix = ntohl(in.s_addr) >> 8;
+    tag = DE_SNAP_ENT_VALID | (prefix << DE_SNAP_ENT_PREFIX_SHIFT);
+
+    h = (uint32_t)(prefix * 2654435761U);
+    for (i = 0; i < DE_SNAP_PREFIX_PROBE; i++) {
+	slot = &snap->prefix_tbl[(h + i) & (DE_SNAP_PREFIX_SLOTS - 1)];
+	ent = AO_load(slot);
+	if (!ent) {
+	    break;
+	}
+	if ((ent & ~((1ULL << DE_SNAP_ENT_PREFIX_SHIFT) - 1)) == tag) {
+	    num_ranked = (ent >> DE_SNAP_ENT_COUNT_SHIFT) & 0xf;
+	    *num_best = (ent >> DE_SNAP_ENT_TIES_SHIFT) & 0x7;
+	    for (j = 0; j < num_ranked; j++) {
+		ranked[j] = (ent >> (j * 8)) & 0xff;
+	    }
+	    AO_fetch_and_add1(&glob_de_snap_prefix_hit);
+	    return num_ranked;
+	}
+    }
+
+    AO_fetch_and_add1(&glob_de_snap_prefix_miss);
+    num_ranked = de_snap_rank(snap, client_addr, ranked, num_best);
+    if (i == DE_SNAP_PREFIX_PROBE) {
+	AO_fetch_and_add1(&glob_de_snap_prefix_tbl_full);
+	return num_ranked;
+    }
+
+    ent = tag | ((uint64_t)*num_best << DE_SNAP_ENT_TIES_SHIFT) |
+	((uint64_t)num_ranked << DE_SNAP_ENT_COUNT_SHIFT);
+    for (j = 0; j < num_ranked; j++) {
+	ent |= (uint64_t)ranked[j] << (j * 8);
+    }
+    /* losing the race for this slot is harmless, we already have
+     * our answer and the prefix gets memoized on a later miss
+     */
+    AO_compare_and_swap(slot, 0, ent);
+
+    return num_ranked;
+}
+
+int32_t
+de_snapshot_decide(de_snapshot_t *snap, const char *client_addr,
+		   cache_entity_addr_type_t qtype,
+		   uint8_t **result, uint32_t *result_len)
+{
+    uint8_t ranked[DE_SNAP_MAX_RANK];
+    const de_snap_rec_t *rec = NULL;
+    uint32_t idx, num_best = 0;
+    uint8_t *buf = NULL;
+
+    if (!snap || !snap->num_ce || qtype > ce_addr_type_max) {
+	return -1;
+    }
+
+    switch (snap->type) {
+	case ROUTING_TYPE_RR:
+	    idx = AO_fetch_and_add1(&snap->rr_cursor) % snap->num_ce;
+	    break;
+	case ROUTING_TYPE_GEOLOAD:
+	    if (!de_snap_prefix_lookup(snap, client_addr, ranked,
+				       &num_best)) {
+		return -1;
+	    }
+	    /* spread a prefix over the candidates tied for the best
+	     * score instead of pinning it to the first one
+	     */
+	    idx = ranked[0];
+	    if (num_best > 1) {
+		idx = ranked[AO_fetch_and_add1(&snap->rr_cursor) % num_best];
+	    }
+	    break;
+	default:
+	    return -1;
+    }
+
+    rec = &snap->ce[idx].rec[qtype];
+    if (!rec->buf) {
+	return -1;
+    }
+    buf = (uint8_t *)nkn_malloc_type(rec->len,
+					 mod_cr_de_snapshot_resp);
+    if (!buf) {
+	return -ENOMEM;
+    }
+    memcpy(buf, rec->buf, rec->len);
+    *result = buf;
+    *result_len = rec->len;
+
+    return 0;
+}
+
+de_snapshot_t *
+de_snapshot_acquire(AO_t *slot)
+{
+    de_snapshot_t *snap = NULL;
+    AO_t epoch;
+
+    /* enter the window of the current epoch; if the epoch moved
+     * while announcing, the reclaimer may not have seen us, retry
+     */
+    while (1) {
+	epoch = AO_load_full(&de_snap_epoch);
+	AO_fetch_and_add1_full(&de_snap_epoch_readers[epoch & 1]);
+	if (AO_load_full(&de_snap_epoch) == epoch) {
+	    break;
+	}
+	AO_fetch_and_sub1_full(&de_snap_epoch_readers[epoch & 1]);
+    }
+
+    snap = (de_snapshot_t *)AO_load_full(slot);
+    if (snap) {
+	AO_fetch_and_add1_full(&snap->readers);
+    }
+    AO_fetch_and_sub1_full(&de_snap_epoch_readers[epoch & 1]);
+
+    return snap;
+}
+
+void
+de_snapshot_release(de_snapshot_t *snap)
+{
+    if (snap) {
+	AO_fetch_and_sub1_full(&snap->readers);
+    }
+}
+
+void
+de_snapshot_publish(AO_t *slot, de_snapshot_t *snap)
+{
+    de_snapshot_t *old = NULL;
+
+    do {
+	old = (de_snapshot_t *)AO_load(slot);
+    } while (!AO_compare_and_swap_full(slot, (AO_t)old, (AO_t)snap));
+
+    if (old) {
+	/* sampled after the swap; readers entering a later epoch
+	 * can no longer load 'old'
+	 */
+	old->retire_epoch = AO_load_full(&de_snap_epoch);
+	pthread_mutex_lock(&de_snap_retire_lock);
+	old->next_retired = de_snap_retire_list;
+	de_snap_retire_list = old;
+	pthread_mutex_unlock(&de_snap_retire_lock);
+	AO_fetch_and_add1(&glob_de_snap_retired);
+    }
+}
+
+uint32_t
+de_snapshot_reclaim(void)
+{
+    de_snapshot_t *snap = NULL, **prev = NULL, *free_list = NULL;
+    uint32_t num_freed = 0;
+    AO_t epoch;
+
+    pthread_mutex_lock(&de_snap_retire_lock);
+    epoch = AO_load_full(&de_snap_epoch);
+    /* readers still in the window of the previous epoch may hold a
+     * pointer to anything retired up to it, try again later
+     */
+    if (AO_load_full(&de_snap_epoch_readers[(epoch - 1) & 1])) {
+	pthread_mutex_unlock(&de_snap_retire_lock);
+	return 0;
+    }
+    prev = &de_snap_retire_list;
+    while ((snap = *prev) != NULL) {
+	if (snap->retire_epoch < epoch &&
+	    AO_load_full(&snap->readers) == 0) {
+	    *prev = snap->next_retired;
+	    snap->next_retired = free_list;
+	    free_list = snap;
+	} else {
+	    prev = &snap->next_retired;
+	}
+    }
+    AO_fetch_and_add1_full(&de_snap_epoch);
+    pthread_mutex_unlock(&de_snap_retire_lock);
+
+    while ((snap = free_list) != NULL) {
+	free_list = snap->next_retired;
+	de_snapshot_destroy(snap);
+	num_freed++;
+    }
+    AO_fetch_and_add(&glob_de_snap_freed, num_freed);
+
+    return num_freed;
+}
@@ -1,25 +1,53 @@
 #include "thread_pool/mfp_thread_pool.h"
 #include <sys/prctl.h>
+#include <string.h>
+#include <time.h>
 static void* workerThreadMain(void*);
 
 
 static void deleteMfpThreadPool(mfp_thread_pool_t*);
 static void addWorkItemToPool(mfp_thread_pool_t*, thread_pool_task_t*);
+static void addAffineWorkItemToPool(mfp_thread_pool_t*, thread_pool_task_t*,
+		uint32_t);
+static void addWorkItemsToPool(mfp_thread_pool_t*, thread_pool_task_t**,
+		uint32_t, uint32_t);
 static uint32_t getTPQueueFillLen(mfp_thread_pool_t*);
+static void getTPStats(mfp_thread_pool_t*, mfp_thread_pool_stats_t*);
 
 static void deleteMfpThreadPoolTask(thread_pool_task_t*);
 
+static void reserveQueueSlots(mfp_thread_pool_t*, uint32_t);
+static void postToWorker(mfp_thread_pool_t*, mfp_tp_worker_t*,
+		thread_pool_task_t**, uint32_t);
+static thread_pool_task_t* takeFromWorker(mfp_thread_pool_t*,
+		mfp_tp_worker_t*);
+static thread_pool_task_t* stealWorkItem(mfp_tp_worker_t*);
+static void signalWorker(mfp_tp_worker_t*);
+static void taskTaken(mfp_thread_pool_t*);
+static uint64_t tpNowUs(void);
+static void tpHistAdd(uint64_t* hist, uint64_t us);
+
 
 /* These functions encapsulate the delete and unlock functions.
 Reason: pthread_cleanup_push requires void fn(void*) type    */
 static void mfpDeleteTaskTP(void* arg);
 static void mfpTPUnlockMutex(void* arg);
 
+/* how far down a queue we look for a task whose affinity key is not
+   already running elsewhere */
+#define MFP_TP_SCAN_DEPTH (16)
+/* idle workers re-check the other queues for work to steal this often,
+   in case a post to a busy worker raced with them going idle */
+#define MFP_TP_IDLE_WAIT_MS (20)
+
+#define TP_READ(x) (*(volatile __typeof__(x)*)&(x))
+#define TP_AFFINITY_SLOT(a) ((a) % MFP_TP_AFFINITY_SLOTS)
+
 tp_thread_conf_fptr tp_thread_conf_hdlr = NULL;
 
-static void* tp_malloc(uint32_t num); 
+static void* tp_malloc(uint32_t num);
 
-static void* tp_calloc(uint32_t num, uint32_t size); 
+static void* tp_calloc(uint32_t num, uint32_t size);
 
 tp_malloc_fptr tp_malloc_hdlr = tp_malloc;
 tp_calloc_fptr tp_calloc_hdlr = tp_calloc;
@@ -36,7 +64,7 @@ void initThreadPoolLib(tp_malloc_fptr malloc_hdlr, tp_calloc_fptr calloc_hdlr,
 }
 
 
-mfp_thread_pool_t* newMfpThreadPool(uint32_t num_worker_threads, 
+mfp_thread_pool_t* newMfpThreadPool(uint32_t num_worker_threads,
 		uint32_t max_work_queue_len) {
 
 	if ((num_worker_threads == 0) || (max_work_queue_len == 0))
@@ -45,30 +73,37 @@ mfp_thread_pool_t* newMfpThreadPool(uint32_t num_worker_threads,
 		tp_calloc_hdlr(1, sizeof(mfp_thread_pool_t));
 	if (thread_pool == NULL)
 		return NULL;
-	thread_pool->worker_threads = NULL;
 	thread_pool->num_worker_threads = num_worker_threads;
 	thread_pool->max_work_queue_len = max_work_queue_len;
 	thread_pool->queue_fill_len = 0;
-	thread_pool->worker_threads =
-		tp_calloc_hdlr(num_worker_threads, sizeof(pthread_t));
-	if (thread_pool->worker_threads == NULL) {
+	thread_pool->workers =
+		tp_calloc_hdlr(num_worker_threads, sizeof(mfp_tp_worker_t));
+	if (thread_pool->workers == NULL) {
 		free(thread_pool);
 		return NULL;
 	}
 	pthread_mutex_init(&thread_pool->thread_pool_lock, NULL);
-	pthread_cond_init(&thread_pool->task_posted, NULL);
 	pthread_cond_init(&thread_pool->task_taken, NULL);
 
-	TAILQ_INIT(&thread_pool->work_item_queue);
-
 	thread_pool->add_work_item = addWorkItemToPool;
+	thread_pool->add_work_item_affine = addAffineWorkItemToPool;
+	thread_pool->add_work_items = addWorkItemsToPool;
 	thread_pool->get_queue_fill_len = getTPQueueFillLen;
+	thread_pool->get_stats = getTPStats;
 	thread_pool->delete_thread_pool = deleteMfpThreadPool;
 
 	uint32_t i = 0;
-	for (; i < num_worker_threads; i++)
-		pthread_create(thread_pool->worker_threads + i, NULL,
-				workerThreadMain, (void*)thread_pool);
+	for (; i < num_worker_threads; i++) {
+		mfp_tp_worker_t* worker = &thread_pool->workers[i];
+		TAILQ_INIT(&worker->work_item_queue);
+		pthread_mutex_init(&worker->lock, NULL);
+		pthread_cond_init(&worker->task_posted, NULL);
+		worker->idx = i;
+		worker->pool = thread_pool;
+	}
+	for (i = 0; i < num_worker_threads; i++)
+		pthread_create(&thread_pool->workers[i].thread, NULL,
+				workerThreadMain, (void*)&thread_pool->workers[i]);
 	return thread_pool;
 }
 
@@ -77,40 +112,32 @@ static void deleteMfpThreadPool(mfp_thread_pool_t* thread_pool) {
 
 	int32_t actual_thread_state;
 	uint32_t i = 0;
-	pthread_mutex_lock(&thread_pool->thread_pool_lock);
 	pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, &actual_thread_state);
-	pthread_cleanup_push(mfpTPUnlockMutex,
-			(void*)&thread_pool->thread_pool_lock);
 
 	for (; i < thread_pool->num_worker_threads; i++)
-		pthread_cancel(thread_pool->worker_threads[i]);
+		pthread_cancel(thread_pool->workers[i].thread);
+	for (i = 0; i < thread_pool->num_worker_threads; i++)
+		pthread_join(thread_pool->workers[i].thread, NULL);
 
 	thread_pool_task_t* work_item = NULL;
-	/*TAILQ_FOREACH(work_item, &thread_pool->work_item_queue, queue_ctxt) {
-
-	  TAILQ_REMOVE(&thread_pool->work_item_queue,
-	  work_item, queue_ctxt);
-	  work_item->delete_thread_pool_task(work_item);
-	  printf("deleting from queue\n");
-	  }*/
-	while (1) {
-		work_item = TAILQ_FIRST(&thread_pool->work_item_queue);
-		if (work_item == NULL)
-			break;
-		TAILQ_REMOVE(&thread_pool->work_item_queue,
-				work_item, queue_ctxt);
-		work_item->delete_thread_pool_task(work_item);
+	for (i = 0; i < thread_pool->num_worker_threads; i++) {
+		mfp_tp_worker_t* worker = &thread_pool->workers[i];
+		while (1) {
+			work_item = TAILQ_FIRST(&worker->work_item_queue);
+			if (work_item == NULL)
+				break;
+			TAILQ_REMOVE(&worker->work_item_queue,
+					work_item, queue_ctxt);
+			work_item->delete_thread_pool_task(work_item);
+		}
+		pthread_mutex_destroy(&worker->lock);
+		pthread_cond_destroy(&worker->task_posted);
 	}
-	pthread_cleanup_pop(1);
-
-	for (i = 0; i < thread_pool->num_worker_threads; i++)
-		pthread_join(thread_pool->worker_threads[i], NULL);
 
 	pthread_mutex_destroy(&thread_pool->thread_pool_lock);
-	pthread_cond_destroy(&thread_pool->task_posted);
 	pthread_cond_destroy(&thread_pool->task_taken);
 
-	free(thread_pool->worker_threads);
+	free(thread_pool->workers);
 	free(thread_pool);
 	pthread_setcanceltype(actual_thread_state, NULL);
 }
@@ -119,61 +146,289 @@ static void deleteMfpThreadPool(mfp_thread_pool_t* thread_pool) {
 void addWorkItemToPool(mfp_thread_pool_t* thread_pool,
 		thread_pool_task_t* work_item) {
 
+	addWorkItemsToPool(thread_pool, &work_item, 1, MFP_TP_NO_AFFINITY);
+}
+
+
+static void addAffineWorkItemToPool(mfp_thread_pool_t* thread_pool,
+		thread_pool_task_t* work_item, uint32_t affinity) {
+
+	addWorkItemsToPool(thread_pool, &work_item, 1, affinity);
+}
+
+
+/*
+   queues a batch of work items with one queue lock round trip; all
+   the items go to the same worker: the home worker of 'affinity', or
+   the next worker in round robin order for MFP_TP_NO_AFFINITY
+ */
+static void addWorkItemsToPool(mfp_thread_pool_t* thread_pool,
+		thread_pool_task_t** work_items, uint32_t num_items,
+		uint32_t affinity) {
+
 	int32_t actual_thread_state;
-	pthread_mutex_lock(&thread_pool->thread_pool_lock);
-	pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, &actual_thread_state);
-	pthread_cleanup_push(mfpTPUnlockMutex,
-			&thread_pool->thread_pool_lock);
+	mfp_tp_worker_t* worker;
+	uint64_t now;
+	uint32_t i;
 
-	while (thread_pool->queue_fill_len == thread_pool->max_work_queue_len)
-		//cond_wait is a cancellation point
-		pthread_cond_wait(&thread_pool->task_taken,
-				&thread_pool->thread_pool_lock);
+	if (num_items == 0)
+		return;
+	pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, &actual_thread_state);
+	reserveQueueSlots(thread_pool, num_items);
 
-	TAILQ_INSERT_TAIL(&thread_pool->work_item_queue, work_item, queue_ctxt);
-	thread_pool->queue_fill_len++;
-	pthread_cond_signal(&thread_pool->task_posted);
+	now = tpNowUs();
+	for (i = 0; i < num_items; i++) {
+		work_items[i]->affinity = affinity;
+		work_items[i]->enq_time_us = now;
+	}
+	if (affinity == MFP_TP_NO_AFFINITY)
+		worker = &thread_pool->workers[
+			__sync_fetch_and_add(&thread_pool->rr_next, 1) %
+			thread_pool->num_worker_threads];
+	else
+		worker = &thread_pool->workers[TP_AFFINITY_SLOT(affinity) %
+			thread_pool->num_worker_threads];
+	postToWorker(thread_pool, worker, work_items, num_items);
 	pthread_setcanceltype(actual_thread_state, NULL);
-	pthread_cleanup_pop(1);
 }
 
 
 static uint32_t getTPQueueFillLen(mfp_thread_pool_t* thread_pool) {
 
-	return thread_pool->queue_fill_len;
+	return TP_READ(thread_pool->queue_fill_len);
 }
 
 
-static void* workerThreadMain(void* arg) {
+static void getTPStats(mfp_thread_pool_t* thread_pool,
+		mfp_thread_pool_stats_t* stats) {
 
-	if (tp_thread_conf_hdlr != NULL)
-		tp_thread_conf_hdlr(tp_thr_count);
-	tp_thr_count++;
-	mfp_thread_pool_t* thread_pool = (mfp_thread_pool_t*)arg;
-	prctl(PR_SET_NAME, "mfp-tpool-worker", 0, 0, 0);	
+	uint32_t i, j;
+
+	memset(stats, 0, sizeof(mfp_thread_pool_stats_t));
+	stats->producer_waits = thread_pool->producer_waits;
+	for (i = 0; i < thread_pool->num_worker_threads; i++) {
+		mfp_tp_worker_t* worker = &thread_pool->workers[i];
+		stats->tasks_run += worker->tasks_run;
+		stats->tasks_stolen += worker->tasks_stolen;
+		for (j = 0; j < MFP_TP_HIST_BUCKETS; j++) {
+			stats->wait_hist[j] += worker->wait_hist[j];
+			stats->run_hist[j] += worker->run_hist[j];
+		}
+	}
+}
+
+
+/*
+   blocks the producer while the pool is full; a batch larger than the
+   pool limit is let in once the pool has drained completely
+ */
+static void reserveQueueSlots(mfp_thread_pool_t* thread_pool,
+		uint32_t num_items) {
 
+	uint32_t fill;
 	while (1) {
-		pthread_mutex_lock(&thread_pool->thread_pool_lock); 
-		pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
-		thread_pool_task_t* work_item = NULL;
+		fill = TP_READ(thread_pool->queue_fill_len);
+		if ((fill == 0) ||
+				(fill + num_items <= thread_pool->max_work_queue_len)) {
+			if (__sync_bool_compare_and_swap(&thread_pool->queue_fill_len,
+						fill, fill + num_items))
+				return;
+			continue;
+		}
+
+		pthread_mutex_lock(&thread_pool->thread_pool_lock);
 		pthread_cleanup_push(mfpTPUnlockMutex,
-				(void *)&thread_pool->thread_pool_lock);
-
-		while (TAILQ_EMPTY(&thread_pool->work_item_queue))
+				&thread_pool->thread_pool_lock);
+		__sync_fetch_and_add(&thread_pool->producers_waiting, 1);
+		thread_pool->producer_waits++;
+		while (1) {
+			fill = TP_READ(thread_pool->queue_fill_len);
+			if ((fill == 0) ||
+					(fill + num_items <= thread_pool->max_work_queue_len))
+				break;
 			//cond_wait is a cancellation point
-			pthread_cond_wait(&thread_pool->task_posted,
+			pthread_cond_wait(&thread_pool->task_taken,
 					&thread_pool->thread_pool_lock);
-		work_item = TAILQ_FIRST(&thread_pool->work_item_queue);
-		TAILQ_REMOVE(&thread_pool->work_item_queue,
-				work_item, queue_ctxt);
-		thread_pool->queue_fill_len--;
-		pthread_cond_signal(&thread_pool->task_taken);
+		}
+		__sync_fetch_and_sub(&thread_pool->producers_waiting, 1);
 		pthread_cleanup_pop(1);
+	}
+}
+
+
+static void taskTaken(mfp_thread_pool_t* thread_pool) {
+
+	__sync_fetch_and_sub(&thread_pool->queue_fill_len, 1);
+	if (TP_READ(thread_pool->producers_waiting)) {
+		pthread_mutex_lock(&thread_pool->thread_pool_lock);
+		pthread_cond_broadcast(&thread_pool->task_taken);
+		pthread_mutex_unlock(&thread_pool->thread_pool_lock);
+	}
+}
+
+
+static void postToWorker(mfp_thread_pool_t* thread_pool,
+		mfp_tp_worker_t* worker, thread_pool_task_t** work_items,
+		uint32_t num_items) {
+
+	int32_t was_idle;
+	uint32_t i;
+
+	pthread_mutex_lock(&worker->lock);
+	for (i = 0; i < num_items; i++)
+		TAILQ_INSERT_TAIL(&worker->work_item_queue, work_items[i],
+				queue_ctxt);
+	worker->queue_len += num_items;
+	worker->post_gen++;
+	was_idle = worker->idle;
+	pthread_cond_signal(&worker->task_posted);
+	pthread_mutex_unlock(&worker->lock);
+
+	/* the home worker is busy, let an idle one come and steal */
+	if (!was_idle && TP_READ(thread_pool->num_idle)) {
+		for (i = 0; i < thread_pool->num_worker_threads; i++) {
+			if (TP_READ(thread_pool->workers[i].idle)) {
+				signalWorker(&thread_pool->workers[i]);
+				break;
+			}
+		}
+	}
+}
+
+
+static void signalWorker(mfp_tp_worker_t* worker) {
+
+	pthread_mutex_lock(&worker->lock);
+	worker->post_gen++;
+	pthread_cond_signal(&worker->task_posted);
+	pthread_mutex_unlock(&worker->lock);
+}
+
+
+/*
+   takes the oldest task in the worker queue that may run now. A task
+   with an affinity key may run only if no task of the same key slot is
+   running; once a slot has been found busy in this scan, later tasks of
+   that slot are passed over too, so that a key's tasks never overtake
+   each other
+ */
+static thread_pool_task_t* takeFromWorker(mfp_thread_pool_t* thread_pool,
+		mfp_tp_worker_t* worker) {
+
+	thread_pool_task_t* work_item = NULL;
+	uint32_t busy_slots[MFP_TP_SCAN_DEPTH];
+	uint32_t num_busy = 0, depth = 0, slot, i;
+
+	if (TP_READ(worker->queue_len) == 0)
+		return NULL;
+	pthread_mutex_lock(&worker->lock);
+	TAILQ_FOREACH(work_item, &worker->work_item_queue, queue_ctxt) {
+		if (depth++ == MFP_TP_SCAN_DEPTH) {
+			work_item = NULL;
+			break;
+		}
+		if (work_item->affinity == MFP_TP_NO_AFFINITY)
+			break;
+		slot = TP_AFFINITY_SLOT(work_item->affinity);
+		for (i = 0; i < num_busy; i++)
+			if (busy_slots[i] == slot)
+				break;
+		if ((i == num_busy) && __sync_bool_compare_and_swap(
+					&thread_pool->affinity_busy[slot], 0, 1))
+			break;
+		if (i == num_busy)
+			busy_slots[num_busy++] = slot;
+	}
+	if (work_item != NULL) {
+		TAILQ_REMOVE(&worker->work_item_queue, work_item, queue_ctxt);
+		worker->queue_len--;
+	}
+	pthread_mutex_unlock(&worker->lock);
+	return work_item;
+}
+
+
+static thread_pool_task_t* stealWorkItem(mfp_tp_worker_t* self) {
+
+	mfp_thread_pool_t* thread_pool = self->pool;
+	thread_pool_task_t* work_item = NULL;
+	uint32_t i, victim;
+
+	for (i = 1; i < thread_pool->num_worker_threads; i++) {
+		victim = (self->idx + i) % thread_pool->num_worker_threads;
+		work_item = takeFromWorker(thread_pool,
+				&thread_pool->workers[victim]);
+		if (work_item != NULL) {
+			self->tasks_stolen++;
+			break;
+		}
+	}
+	return work_item;
+}
+
+
+static void* workerThreadMain(void* arg) {
+
+	mfp_tp_worker_t* self = (mfp_tp_worker_t*)arg;
+	mfp_thread_pool_t* thread_pool = self->pool;
+	if (tp_thread_conf_hdlr != NULL)
+		tp_thread_conf_hdlr(__sync_fetch_and_add(&tp_thr_count, 1));
+	else
+		__sync_fetch_and_add(&tp_thr_count, 1);
+	prctl(PR_SET_NAME, "mfp-tpool-worker", 0, 0, 0);
+
+	while (1) {
+		pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
+		uint32_t seen_gen = TP_READ(self->post_gen);
+		__sync_synchronize();
+		thread_pool_task_t* work_item = takeFromWorker(thread_pool, self);
+		if (work_item == NULL)
+			work_item = stealWorkItem(self);
+
+		if (work_item == NULL) {
+			pthread_mutex_lock(&self->lock);
+			pthread_cleanup_push(mfpTPUnlockMutex, (void *)&self->lock);
+			if (self->post_gen == seen_gen) {
+				struct timespec abstime;
+				clock_gettime(CLOCK_REALTIME, &abstime);
+				abstime.tv_nsec += MFP_TP_IDLE_WAIT_MS * 1000000L;
+				if (abstime.tv_nsec >= 1000000000L) {
+					abstime.tv_sec++;
+					abstime.tv_nsec -= 1000000000L;
+				}
+				self->idle = 1;
+				__sync_fetch_and_add(&thread_pool->num_idle, 1);
+				//cond_wait is a cancellation point
+				pthread_cond_timedwait(&self->task_posted, &self->lock,
+						&abstime);
+				__sync_fetch_and_sub(&thread_pool->num_idle, 1);
+				self->idle = 0;
+			}
+			pthread_cleanup_pop(1);
+			continue;
+		}
+		taskTaken(thread_pool);
+
+		uint32_t affinity = work_item->affinity;
+		uint64_t start = tpNowUs();
+		tpHistAdd(self->wait_hist, start - work_item->enq_time_us);
 
 		pthread_cleanup_push(mfpDeleteTaskTP, work_item);
 		pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
 		work_item->task_handler(work_item->arg);
+		pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
 		pthread_cleanup_pop(1);
+
+		tpHistAdd(self->run_hist, tpNowUs() - start);
+		self->tasks_run++;
+		if (affinity != MFP_TP_NO_AFFINITY) {
+			uint32_t slot = TP_AFFINITY_SLOT(affinity);
+			uint32_t home = slot % thread_pool->num_worker_threads;
+			__sync_lock_release(&thread_pool->affinity_busy[slot]);
+			/* the home worker may be sleeping on tasks of this key */
+			if (home != self->idx)
+				signalWorker(&thread_pool->workers[home]);
+		}
 	}
 	return NULL;
 }
@@ -202,6 +457,25 @@ static void deleteMfpThreadPoolTask(thread_pool_task_t* work_item) {
 }
 
 
+static uint64_t tpNowUs(void) {
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+
+static void tpHistAdd(uint64_t* hist, uint64_t us) {
+
+	uint32_t bucket = 0;
+	while ((us > 1) && (bucket < MFP_TP_HIST_BUCKETS - 1)) {
+		us >>= 1;
+		bucket++;
+	}
+	hist[bucket]++;
+}
+
+
 static void mfpTPUnlockMutex(void* arg) {
 
 	pthread_mutex_unlock((pthread_mutex_t*)arg);
@@ -226,4 +500,3 @@ static void* tp_calloc(uint32_t num, uint32_t size) {
 
 	return calloc(num, size);
 }
-
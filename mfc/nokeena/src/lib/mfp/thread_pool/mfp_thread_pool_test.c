@@ -3,14 +3,28 @@
 #include <string.h>
 #include <unistd.h>
 #include <signal.h>
+#include <time.h>
 
 #include "mfp_thread_pool.h"
 
 #define THREADPOOL_USER_ALLOC
 
+/*
+ * usage:
+ *   mfp_thread_pool_test
+ *	smoke test, 200 sleeping tasks on 10 workers
+ *   mfp_thread_pool_test <workers> <producers> <tasks/producer>
+ *	<sessions> <task_work_us> [batch]
+ *	contention benchmark; producers post short tasks for 'sessions'
+ *	sessions with session affinity (in batches of 'batch'), checks
+ *	that every session's tasks ran in order and prints the
+ *	throughput and the queue wait / run time histograms
+ */
+
 static void taskArgCleaner(void*);
 static void* newTaskArg(uint32_t);
 static void testTaskHandler(void* arg);
+static int32_t runContentionBench(int32_t argc, char* argv[]);
 
 // Global variables
 mfp_thread_pool_t* thread_pool = NULL;
@@ -24,15 +38,18 @@ static void exitClean(int signal_num) {
 
 
 
-int main() {
+int main(int argc, char* argv[]) {
 
 	struct sigaction action_cleanup;
 	memset(&action_cleanup, 0, sizeof(struct sigaction));
-	action_cleanup.sa_handler = exitClean; 
+	action_cleanup.sa_handler = exitClean;
 	action_cleanup.sa_flags = 0;
 	sigaction(SIGINT, &action_cleanup, NULL);
 	sigaction(SIGTERM, &action_cleanup, NULL);
 
+	if (argc > 1)
+		return runContentionBench(argc, argv);
+
 	thread_pool = newMfpThreadPool(10, 1000);//10 threads 1000 tasks
 
 	uint32_t i = 0;
@@ -72,6 +89,182 @@ static void testTaskHandler(void* arg) {
 }
 
 
+/* contention benchmark */
+
+typedef struct bench_session {
+	uint32_t next_seq;	/* only touched by the session's tasks */
+	uint32_t order_errors;
+	uint32_t running;
+	uint32_t overlap_errors;
+} bench_session_t;
+
+typedef struct bench_task_arg {
+	bench_session_t* sess;
+	uint32_t seq;
+} bench_task_arg_t;
+
+typedef struct bench_producer {
+	pthread_t thread;
+	uint32_t id;
+} bench_producer_t;
+
+static uint32_t bench_num_producers, bench_tasks_per_producer;
+static uint32_t bench_num_sessions, bench_work_us, bench_batch = 1;
+static bench_session_t* bench_sessions;
+static uint32_t* bench_session_seq;
+static pthread_mutex_t* bench_session_lock;
+static uint64_t bench_done;
+
+static uint64_t benchNowUs(void) {
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+
+static void benchTaskHandler(void* arg) {
+
+	bench_task_arg_t* task_arg = (bench_task_arg_t*)arg;
+	bench_session_t* sess = task_arg->sess;
+	uint64_t end;
+
+	if (__sync_fetch_and_add(&sess->running, 1) != 0)
+		sess->overlap_errors++;
+	if (task_arg->seq != sess->next_seq)
+		sess->order_errors++;
+	sess->next_seq = task_arg->seq + 1;
+
+	end = benchNowUs() + bench_work_us;
+	while (benchNowUs() < end)
+		;
+	__sync_fetch_and_sub(&sess->running, 1);
+	__sync_fetch_and_add(&bench_done, 1);
+}
+
+
+static void* benchProducer(void* arg) {
+
+	bench_producer_t* prod = (bench_producer_t*)arg;
+	thread_pool_task_t* batch[64];
+	uint32_t i, j, sess_idx, n;
+
+	for (i = 0; i < bench_tasks_per_producer; i += n) {
+		sess_idx = (prod->id + i * 7) % bench_num_sessions;
+		n = bench_batch;
+		if (n > bench_tasks_per_producer - i)
+			n = bench_tasks_per_producer - i;
+		/* sequence numbers are handed out and posted under the
+		   session lock so that the post order is the sequence order */
+		pthread_mutex_lock(&bench_session_lock[sess_idx]);
+		for (j = 0; j < n; j++) {
+			bench_task_arg_t* task_arg =
+				malloc(sizeof(bench_task_arg_t));
+			task_arg->sess = &bench_sessions[sess_idx];
+			task_arg->seq = bench_session_seq[sess_idx]++;
+			batch[j] = newThreadPoolTask(benchTaskHandler,
+					task_arg, free);
+		}
+		if (n == 1)
+			thread_pool->add_work_item_affine(thread_pool, batch[0],
+					sess_idx + 1);
+		else
+			thread_pool->add_work_items(thread_pool, batch, n,
+					sess_idx + 1);
+		pthread_mutex_unlock(&bench_session_lock[sess_idx]);
+	}
+	return NULL;
+}
+
+
+static void benchPrintHist(const char* name, const uint64_t* hist) {
+
+	uint32_t i;
+	printf("%s (us):\n", name);
+	for (i = 0; i < MFP_TP_HIST_BUCKETS; i++) {
+		if (hist[i] == 0)
+			continue;
+		if (i == MFP_TP_HIST_BUCKETS - 1)
+			printf("  >= %8u : %llu\n", 1U << i,
+					(unsigned long long)hist[i]);
+		else
+			printf("  < %9u : %llu\n", 1U << (i + 1),
+					(unsigned long long)hist[i]);
+	}
+}
+
+
+static int32_t runContentionBench(int32_t argc, char* argv[]) {
+
+	mfp_thread_pool_stats_t stats;
+	bench_producer_t* prods;
+	uint32_t num_workers, i, order_errors = 0, overlap_errors = 0;
+	uint64_t total, start, elapsed;
+
+	if (argc < 6) {
+		printf("usage: %s <workers> <producers> <tasks/producer>"
+				" <sessions> <task_work_us> [batch]\n", argv[0]);
+		return 1;
+	}
+	num_workers = atoi(argv[1]);
+	bench_num_producers = atoi(argv[2]);
+	bench_tasks_per_producer = atoi(argv[3]);
+	bench_num_sessions = atoi(argv[4]);
+	bench_work_us = atoi(argv[5]);
+	if (argc > 6)
+		bench_batch = atoi(argv[6]);
+	if (!num_workers || !bench_num_producers || !bench_num_sessions ||
+			!bench_batch || bench_batch > 64) {
+		printf("invalid arguments\n");
+		return 1;
+	}
+
+	bench_sessions = calloc(bench_num_sessions, sizeof(bench_session_t));
+	bench_session_seq = calloc(bench_num_sessions, sizeof(uint32_t));
+	bench_session_lock = calloc(bench_num_sessions,
+			sizeof(pthread_mutex_t));
+	prods = calloc(bench_num_producers, sizeof(bench_producer_t));
+	for (i = 0; i < bench_num_sessions; i++)
+		pthread_mutex_init(&bench_session_lock[i], NULL);
+
+	thread_pool = newMfpThreadPool(num_workers, 10000);
+	total = (uint64_t)bench_num_producers * bench_tasks_per_producer;
+
+	start = benchNowUs();
+	for (i = 0; i < bench_num_producers; i++) {
+		prods[i].id = i;
+		pthread_create(&prods[i].thread, NULL, benchProducer, &prods[i]);
+	}
+	for (i = 0; i < bench_num_producers; i++)
+		pthread_join(prods[i].thread, NULL);
+	while (__sync_fetch_and_add(&bench_done, 0) < total)
+		usleep(100);
+	elapsed = benchNowUs() - start;
+
+	for (i = 0; i < bench_num_sessions; i++) {
+		order_errors += bench_sessions[i].order_errors;
+		overlap_errors += bench_sessions[i].overlap_errors;
+	}
+	thread_pool->get_stats(thread_pool, &stats);
+
+	printf("%u workers, %u producers, %llu tasks, %u sessions,"
+			" %u us/task, batch %u\n", num_workers,
+			bench_num_producers, (unsigned long long)total,
+			bench_num_sessions, bench_work_us, bench_batch);
+	printf("elapsed %.3f s, %.0f tasks/s, stolen %llu, producer waits"
+			" %llu\n", elapsed / 1e6, total * 1e6 / elapsed,
+			(unsigned long long)stats.tasks_stolen,
+			(unsigned long long)stats.producer_waits);
+	printf("session order errors %u, overlap errors %u\n",
+			order_errors, overlap_errors);
+	benchPrintHist("queue wait", stats.wait_hist);
+	benchPrintHist("run time", stats.run_hist);
+
+	thread_pool->delete_thread_pool(thread_pool);
+	return (order_errors || overlap_errors) ? 1 : 0;
+}
+
+
 void* threadpool_calloc_custom(int32_t num, int32_t size) {
 
 	return calloc(num, size);
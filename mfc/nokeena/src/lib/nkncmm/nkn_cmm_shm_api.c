@@ -155,6 +155,25 @@ cmm_shm_chan_getdata_ptr(cmm_shm_chan_t *chan, void **data, int *datalen,
     return 0;
 }
 
+int
+cmm_shm_chan_get_node_state(cmm_shm_chan_t *chan, int *state, 
+			    uint32_t *changes)
+{
+    cmm_loadmetric_entry_t *lmp;
+
+    if (cmm_shm_is_chan_invalid(chan)) {
+    	return 1;
+    }
+    lmp = (cmm_loadmetric_entry_t *)CMM_SEG_PTR(CMM_HDR, chan->u.chan.index);
+
+    *state = lmp->u.loadmetric.node_state;
+    if (changes) {
+    	*changes = lmp->u.loadmetric.node_state_changes;
+    }
+
+    return 0;
+}
+
 /*
  * End of nkn_cmm_shm_api.c
  */
@@ -228,6 +228,15 @@ s_am_is_ingest_worthy(AM_obj_t *objp, nkn_provider_type_t dst_ptype)
 	return 0;
     }
 
+    /* The tier is full, admit only if the object is requested more
+     * often than the objects the tier is evicting.
+     */
+    if(glob_am_admit_tinylfu) {
+	if(nkn_am_admit_check(objp, dst_ptype) == 0)
+	    return 0;
+	goto failed;
+    }
+
     h1 = am_decode_hotness(&objp->hotness);
     h2 = am_decode_hotness(&pstat.hotness_threshold);
     /* If the disk hotness is 0, just ingest the object if the % filled
@@ -337,6 +346,12 @@ s_nkn_am_update_hits(am_xfer_data_t *am_xfer_data)
 	goto cleanup;
     }
 
+    /* Every request counts for admission, even the ones which are
+     * not cacheable or tracked in the AM table.
+     */
+    if(!(am_xfer_data->flags & AM_FLAG_SET_INGEST_COMPLETE))
+	nkn_am_admit_record(pk->name, pk->key_len, num_hits);
+
     if((pk->provider_id && ((pk->provider_id < NKN_MM_max_pci_providers &&
 	    ((glob_am_tbl_total_cnt - glob_am_origin_entry_total_cnt) >=
 	     (nkn_am_max_prov_entries))))) ||
@@ -572,6 +587,9 @@ skip_provider_update:;
 	if(am_xfer_data->client_flags & AM_CIM_INGEST)
 	    cim_ingest = 1;
 	objp->flags &= ~(AM_FLAG_INGEST_ERROR | AM_FLAG_INGEST_SKIP);
+	if((objp->flags & AM_FLAG_TINYLFU_ADMIT) && pk->provider_id &&
+		pk->provider_id < NKN_MM_max_pci_providers)
+	    glob_am_admit_post_hit_cnt += num_hits;
 	if((cim_ingest && !objp->hotness) || (!cim_ingest)) {
 	    objp->num_hits += num_hits;
 	    objp->hotness = am_update_hotness(&objp->hotness, num_hits,
@@ -716,11 +734,13 @@ cleanup:;
 }
 
 static void
-s_nkn_am_delete_obj(nkn_cod_t in_cod)
+s_nkn_am_delete_obj(nkn_cod_t in_cod, nkn_provider_type_t evict_ptype)
 {
     AM_pk_t  pk;
 
     pk.name = (char *)nkn_cod_get_cnp(in_cod);
+    if(evict_ptype && pk.name)
+	nkn_am_admit_set_victim(evict_ptype, pk.name, strlen(pk.name));
     nkn_cod_close(in_cod, NKN_COD_AM_MGR);
     nkn_am_tbl_delete_entry(&pk);
 }
@@ -815,7 +835,8 @@ retry_again:;
 		    s_nkn_am_update_hits(am_xfer_data);
 		} else if(am_xfer_data->flags & AM_FLAG_DEL_ENTRY) {
 		    am_xfer_data->flags &= ~AM_FLAG_DEL_ENTRY;
-		    s_nkn_am_delete_obj(am_xfer_data->in_cod);
+		    s_nkn_am_delete_obj(am_xfer_data->in_cod,
+					am_xfer_data->provider_id);
 		} else if(am_xfer_data->flags & AM_FLAG_SET_INGEST_ERROR) {
 		    am_xfer_data->flags &= ~AM_FLAG_SET_INGEST_ERROR;
 		    s_nkn_am_set_ingest_error(am_xfer_data->in_cod,
@@ -1238,6 +1259,7 @@ AM_init()
 
     nkn_am_list_init();
     nkn_am_tbl_init();
+    nkn_am_admit_init();
     nkn_am_ingest_init();
 }
 
@@ -1302,8 +1324,8 @@ AM_delete_push_ingest(nkn_cod_t in_cod, void *attr_buf)
     return 0;
 }
 
-int
-AM_delete_obj(nkn_cod_t in_cod, char *uri)
+static int
+s_am_queue_delete(nkn_cod_t in_cod, char *uri, nkn_provider_type_t evict_ptype)
 {
     am_xfer_data_t *am_xfer_data;
 
@@ -1325,6 +1347,7 @@ AM_delete_obj(nkn_cod_t in_cod, char *uri)
     }
 
     AO_fetch_and_add1(&nkn_am_xfer_data_in_use[glob_sched_num_core_threads]);
+    am_xfer_data->provider_id = evict_ptype;
     am_xfer_data->flags |= AM_FLAG_DEL_ENTRY;
     NKN_MUTEX_LOCK(&nkn_am_xfer_lock[glob_sched_num_core_threads]);
     TAILQ_INSERT_TAIL(&nkn_am_xfer_list[glob_sched_num_core_threads],
@@ -1334,6 +1357,22 @@ AM_delete_obj(nkn_cod_t in_cod, char *uri)
     return 0;
 }
 
+int
+AM_delete_obj(nkn_cod_t in_cod, char *uri)
+{
+    return s_am_queue_delete(in_cod, uri, Unknown_provider);
+}
+
+/*
+ * Same as AM_delete_obj(), called by the disk tiers when the object is
+ * evicted from ptype.  Feeds the admission filter with the victim.
+ */
+int
+AM_evict_obj(char *uri, nkn_provider_type_t ptype)
+{
+    return s_am_queue_delete(NKN_COD_NULL, uri, ptype);
+}
+
 void
 AM_change_obj_provider(nkn_cod_t in_cod, nkn_provider_type_t dst_ptype)
 {
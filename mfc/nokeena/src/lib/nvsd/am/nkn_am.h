@@ -68,4 +68,12 @@ void nkn_am_tbl_age_out_entry(nkn_provider_type_t ptype);
 void nkn_am_tbl_add_entry(AM_obj_t *objp);
 AM_obj_t * nkn_am_list_get_hp_ingest_entry(AM_pk_t *pk);
 
+/* TinyLFU admission filter */
+extern uint64_t glob_am_admit_post_hit_cnt;
+void nkn_am_admit_init(void);
+void nkn_am_admit_record(const char *name, int len, int num_hits);
+void nkn_am_admit_set_victim(nkn_provider_type_t ptype, const char *name,
+			     int len);
+int nkn_am_admit_check(AM_obj_t *objp, nkn_provider_type_t dst_ptype);
+
 #endif /* _NKN_AM_H */
@@ -0,0 +1,270 @@
+/*
+ * (C) Copyright 2010 Juniper Networks, Inc
+ *
+ * This file contains the frequency based (TinyLFU) admission filter of
+ * the Analytics Manager.
+ *
+ * Every requested URI is counted in a count-min sketch of 4 bit
+ * saturating counters, fronted by a doorkeeper bitmap which absorbs the
+ * first request of an URI so that one hit wonders never reach the
+ * sketch.  After 10 * width recorded requests all counters are halved
+ * and the doorkeeper is cleared, so the estimates follow the recent
+ * popularity rather than the all time popularity.
+ *
+ * When a disk tier evicts, the estimate of the victim is remembered for
+ * that tier.  A candidate is admitted to a full tier only when its own
+ * estimate is higher than that of the object it is going to displace.
+ *
+ * All the routines are called from the AM thread only, no locks.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "nkn_assert.h"
+#include "nkn_am_api.h"
+#include "nkn_am.h"
+#include "nkn_debug.h"
+
+#define AM_ADMIT_SKETCH_ROWS	4
+#define AM_ADMIT_COUNTER_MAX	15
+#define AM_ADMIT_SAMPLE_MUL	10
+#define AM_ADMIT_MIN_WIDTH	1024
+
+/* Counters per sketch row, rounded up to a power of 2 */
+int glob_am_admit_tinylfu = 1;
+int glob_am_admit_sketch_width = 1 << 20;
+
+uint64_t glob_am_admit_record_cnt;
+uint64_t glob_am_admit_reset_cnt;
+uint64_t glob_am_admit_victim_cnt;
+uint64_t glob_am_admit_cnt;
+uint64_t glob_am_admit_reject_cnt;
+uint64_t glob_am_admit_post_hit_cnt;
+
+static uint8_t	*am_admit_sketch[AM_ADMIT_SKETCH_ROWS];	/* 2 counters/byte */
+static uint64_t	*am_admit_door;
+static uint32_t	am_admit_mask;
+static uint64_t	am_admit_samples;
+static uint64_t	am_admit_sample_max;
+static uint8_t	am_admit_victim_freq[NKN_MM_MAX_CACHE_PROVIDERS];
+
+/*
+ * 64 bit FNV-1a.  The row indexes are derived from the two halves
+ * (h1 + i * h2), so the name is walked only once per operation.
+ */
+static inline uint64_t
+s_am_admit_hash(const char *name, int len)
+{
+    const unsigned char *p = (const unsigned char *)name;
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    while (len-- > 0) {
+	h ^= *p++;
+	h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static inline uint32_t
+s_am_admit_idx(uint64_t h, int row)
+{
+    uint32_t h1 = (uint32_t)h, h2 = (uint32_t)(h >> 32) | 1;
+
+    return (h1 + row * h2) & am_admit_mask;
+}
+
+static inline int
+s_am_admit_counter(int row, uint32_t idx)
+{
+    return (am_admit_sketch[row][idx >> 1] >> ((idx & 1) << 2)) & 0xf;
+}
+
+static inline void
+s_am_admit_counter_inc(int row, uint32_t idx)
+{
+    am_admit_sketch[row][idx >> 1] += (uint8_t)(1 << ((idx & 1) << 2));
+}
+
+/* Doorkeeper: two bits of a bitmap the size of one sketch row */
+static inline int
+s_am_admit_door_test(uint64_t h)
+{
+    uint32_t b1 = s_am_admit_idx(h, AM_ADMIT_SKETCH_ROWS);
+    uint32_t b2 = s_am_admit_idx(h, AM_ADMIT_SKETCH_ROWS + 1);
+
+    return ((am_admit_door[b1 >> 6] >> (b1 & 63)) & 1) &&
+	   ((am_admit_door[b2 >> 6] >> (b2 & 63)) & 1);
+}
+
+static inline void
+s_am_admit_door_set(uint64_t h)
+{
+    uint32_t b1 = s_am_admit_idx(h, AM_ADMIT_SKETCH_ROWS);
+    uint32_t b2 = s_am_admit_idx(h, AM_ADMIT_SKETCH_ROWS + 1);
+
+    am_admit_door[b1 >> 6] |= 1ULL << (b1 & 63);
+    am_admit_door[b2 >> 6] |= 1ULL << (b2 & 63);
+}
+
+static int
+s_am_admit_estimate(uint64_t h)
+{
+    int row, c, min = AM_ADMIT_COUNTER_MAX;
+
+    for (row = 0; row < AM_ADMIT_SKETCH_ROWS; row++) {
+	c = s_am_admit_counter(row, s_am_admit_idx(h, row));
+	if (c < min)
+	    min = c;
+    }
+    return min + s_am_admit_door_test(h);
+}
+
+/*
+ * Halve every counter (both nibbles of a byte at once), clear the
+ * doorkeeper and halve the remembered victim estimates so that they
+ * stay comparable with the candidate estimates.
+ */
+static void
+s_am_admit_reset(void)
+{
+    uint64_t *w;
+    uint32_t i, nwords = (am_admit_mask + 1) / 16;
+    int row;
+
+    for (row = 0; row < AM_ADMIT_SKETCH_ROWS; row++) {
+	w = (uint64_t *)am_admit_sketch[row];
+	for (i = 0; i < nwords; i++)
+	    w[i] = (w[i] >> 1) & 0x7777777777777777ULL;
+    }
+    memset(am_admit_door, 0, (am_admit_mask + 1) / 8);
+    for (i = 0; i < NKN_MM_MAX_CACHE_PROVIDERS; i++)
+	am_admit_victim_freq[i] >>= 1;
+    am_admit_samples = 0;
+    glob_am_admit_reset_cnt++;
+}
+
+/*
+ * Count num_hits requests for the URI.  Conservative update: only the
+ * rows holding the current minimum are incremented.
+ */
+void
+nkn_am_admit_record(const char *name, int len, int num_hits)
+{
+    uint64_t h;
+    uint32_t idx[AM_ADMIT_SKETCH_ROWS];
+    int row, c, min;
+
+    if (!am_admit_door || num_hits <= 0)
+	return;
+
+    h = s_am_admit_hash(name, len);
+    if (num_hits > AM_ADMIT_COUNTER_MAX)
+	num_hits = AM_ADMIT_COUNTER_MAX;
+
+    glob_am_admit_record_cnt++;
+    if (!s_am_admit_door_test(h)) {
+	s_am_admit_door_set(h);
+	num_hits--;
+    }
+
+    while (num_hits-- > 0) {
+	min = AM_ADMIT_COUNTER_MAX;
+	for (row = 0; row < AM_ADMIT_SKETCH_ROWS; row++) {
+	    idx[row] = s_am_admit_idx(h, row);
+	    c = s_am_admit_counter(row, idx[row]);
+	    if (c < min)
+		min = c;
+	}
+	if (min == AM_ADMIT_COUNTER_MAX)
+	    break;
+	for (row = 0; row < AM_ADMIT_SKETCH_ROWS; row++) {
+	    if (s_am_admit_counter(row, idx[row]) == min)
+		s_am_admit_counter_inc(row, idx[row]);
+	}
+    }
+
+    if (++am_admit_samples >= am_admit_sample_max)
+	s_am_admit_reset();
+}
+
+/*
+ * The URI has been evicted from ptype, remember how popular it was.
+ */
+void
+nkn_am_admit_set_victim(nkn_provider_type_t ptype, const char *name, int len)
+{
+    if (!am_admit_door || ptype <= Unknown_provider ||
+	    ptype >= NKN_MM_MAX_CACHE_PROVIDERS)
+	return;
+
+    am_admit_victim_freq[ptype] =
+		s_am_admit_estimate(s_am_admit_hash(name, len));
+    glob_am_admit_victim_cnt++;
+}
+
+/*
+ * Returns 0 if the object should be admitted to dst_ptype, -1 if not.
+ */
+int
+nkn_am_admit_check(AM_obj_t *objp, nkn_provider_type_t dst_ptype)
+{
+    int freq;
+
+    if (!am_admit_door || dst_ptype <= Unknown_provider ||
+	    dst_ptype >= NKN_MM_MAX_CACHE_PROVIDERS)
+	return 0;
+
+    freq = s_am_admit_estimate(s_am_admit_hash(objp->pk.name,
+					       objp->pk.key_len));
+    if (freq > am_admit_victim_freq[dst_ptype]) {
+	objp->flags |= AM_FLAG_TINYLFU_ADMIT;
+	glob_am_admit_cnt++;
+	return 0;
+    }
+
+    DBG_LOG(MSG3, MOD_AM, "[URI=%s] admission rejected, freq %d victim %d",
+	    objp->pk.name, freq, am_admit_victim_freq[dst_ptype]);
+    glob_am_admit_reject_cnt++;
+    return -1;
+}
+
+void
+nkn_am_admit_init(void)
+{
+    uint32_t width = AM_ADMIT_MIN_WIDTH;
+    int row;
+
+    if (!glob_am_admit_tinylfu)
+	return;
+
+    while (width < (uint32_t)glob_am_admit_sketch_width && width < (1U << 30))
+	width <<= 1;
+
+    for (row = 0; row < AM_ADMIT_SKETCH_ROWS; row++) {
+	am_admit_sketch[row] = nkn_calloc_type(1, width / 2,
+					       mod_am_admit_sketch);
+	if (!am_admit_sketch[row])
+	    goto nomem;
+    }
+    am_admit_door = nkn_calloc_type(1, width / 8, mod_am_admit_sketch);
+    if (!am_admit_door)
+	goto nomem;
+
+    am_admit_mask = width - 1;
+    am_admit_sample_max = (uint64_t)AM_ADMIT_SAMPLE_MUL * width;
+    DBG_LOG(MSG, MOD_AM, "TinyLFU admission sketch %u counters x %d rows",
+	    width, AM_ADMIT_SKETCH_ROWS);
+    return;
+
+nomem:
+    DBG_LOG(SEVERE, MOD_AM, "TinyLFU admission sketch not allocated, "
+	    "admission filter disabled");
+    for (row = 0; row < AM_ADMIT_SKETCH_ROWS; row++) {
+	free(am_admit_sketch[row]);
+	am_admit_sketch[row] = NULL;
+    }
+    am_admit_door = NULL;
+}
@@ -345,6 +345,8 @@ STATIC hash_table_def_t ht_cache_control_vals = {
     0
 };
 
+unsigned char http_hdr_phash_tbl[HTTP_HDR_PHASH_SIZE];
+
 STATIC hash_entry_t hash_known_headers_http[128];
 STATIC hash_entry_t hash_known_headers_rtsp[128];
 
@@ -737,6 +739,7 @@ STATIC int cache_control_data_init(void)
 STATIC int known_headers_data_init(void)
 {
     int n;
+    int slot;
     int prot;
     int max_hdrs;
     mime_header_descriptor_t *hd;
@@ -769,6 +772,24 @@ STATIC int known_headers_data_init(void)
 	}
 	NKN_ASSERT(rv == 0);
     }
+
+    /*
+     * HTTP perfect hash, see http_hdr_lookup()
+     */
+    if (MIME_HDR_MAX_DEFS >= 255) {
+	assert(!"MIME_HDR_MAX_DEFS >= 255, widen http_hdr_phash_tbl");
+    }
+    memset(http_hdr_phash_tbl, 0, sizeof(http_hdr_phash_tbl));
+    for (n = 0; n < MIME_HDR_MAX_DEFS; n++) {
+	hd = &http_known_headers[n];
+	assert(hd->id == n && hd->namelen == (int) strlen(hd->name));
+	slot = http_hdr_phash(hd->name, hd->namelen);
+	if (http_hdr_phash_tbl[slot]) {
+	    assert(!"http_hdr_phash() collision, "
+		   "adjust HTTP_HDR_PHASH_MUL1/MUL2/MUL3");
+	}
+	http_hdr_phash_tbl[slot] = n + 1;
+    }
     return 0;
 }
 
@@ -48,6 +48,9 @@ static int log_enabled = 1;	// Primarily used to disable from nknfqueue
 void disable_http_headers_log(void);
 static version_counter_t obj_ver_counter;
 
+/* Store attribute headers as compact_mime_header_t, see mime_header.h */
+int glob_mime_hdr_attr_compact = 0;
+
 #define DBG(_fmt, ...) if (log_enabled) DBG_LOG(MSG, MOD_HTTPHDRS, _fmt, __VA_ARGS__)
 
 
@@ -203,6 +206,14 @@ int mime_hdr_strtohdr(mime_protocol_t protocol, const char *name, int len,
 {
     int rv;
 
+    if (protocol == MIME_PROT_HTTP) {
+	rv = http_hdr_lookup(name, len);
+	if (rv < 0) {
+	    return 1;		// Not found
+	}
+	*data_enum = rv;
+	return 0;
+    }
     rv = (*ht_known_headers[protocol].
 	  lookup_func) (&ht_known_headers[protocol], name, len, data_enum);
     return rv;
@@ -1501,12 +1512,431 @@ exit:
     return rv;
 }
 
+/*
+ *******************************************************************************
+ * Compact serialization -- see compact_mime_header_t
+ *******************************************************************************
+ */
+
+/*
+ * Unknown response header names common enough to be stored as one byte.
+ * Part of the on disk format: append only, never reorder.
+ */
+static const struct cmh_intern {
+    const char *name;
+    int namelen;
+} cmh_interned[] = {
+#define CMH_INTERN(_s) { _s, sizeof(_s) - 1 }
+    CMH_INTERN("X-Cache"),
+    CMH_INTERN("X-Cache-Lookup"),
+    CMH_INTERN("X-Cache-Hits"),
+    CMH_INTERN("X-Served-By"),
+    CMH_INTERN("X-Powered-By"),
+    CMH_INTERN("X-AspNet-Version"),
+    CMH_INTERN("X-Varnish"),
+    CMH_INTERN("X-Amz-Cf-Id"),
+    CMH_INTERN("X-Amz-Request-Id"),
+    CMH_INTERN("X-Amz-Id-2"),
+    CMH_INTERN("X-Request-Id"),
+    CMH_INTERN("X-Timer"),
+    CMH_INTERN("X-UA-Compatible"),
+    CMH_INTERN("X-Content-Type-Options"),
+    CMH_INTERN("X-Frame-Options"),
+    CMH_INTERN("X-XSS-Protection"),
+    CMH_INTERN("P3P"),
+    CMH_INTERN("Access-Control-Allow-Origin"),
+    CMH_INTERN("Access-Control-Allow-Methods"),
+    CMH_INTERN("Access-Control-Allow-Headers"),
+    CMH_INTERN("Access-Control-Allow-Credentials"),
+    CMH_INTERN("Access-Control-Expose-Headers"),
+    CMH_INTERN("Access-Control-Max-Age"),
+    CMH_INTERN("Timing-Allow-Origin"),
+    CMH_INTERN("Strict-Transport-Security"),
+    CMH_INTERN("Content-Security-Policy"),
+    CMH_INTERN("Alt-Svc"),
+    CMH_INTERN("Server-Timing"),
+    CMH_INTERN("X-Akamai-Transformed"),
+    CMH_INTERN("X-Edge-Location"),
+    CMH_INTERN("X-Backend"),
+    CMH_INTERN("X-Origin-Date"),
+#undef CMH_INTERN
+};
+#define CMH_NUM_INTERNED (int)(sizeof(cmh_interned) / sizeof(cmh_interned[0]))
+
+/* Known header tokens, interned names and the literal tag share one byte */
+typedef char cmh_assert_known_tags[(MIME_HDR_MAX_DEFS < CMH_TAG_INTERNED) ?
+				   1 : -1];
+typedef char cmh_assert_interned_tags[(sizeof(cmh_interned) /
+	sizeof(cmh_interned[0]) < CMH_TAG_LITERAL - CMH_TAG_INTERNED) ? 1 : -1];
+
+static int cmh_intern_lookup(const char *name, int namelen)
+{
+    int n;
+
+    for (n = 0; n < CMH_NUM_INTERNED; n++) {
+	if (cmh_interned[n].namelen == namelen &&
+	    !memcmp(cmh_interned[n].name, name, namelen)) {
+	    return n;
+	}
+    }
+    return -1;
+}
+
+/*
+ * Walk hd, calling emit() for each value; known headers in id order with
+ * their values in list order, then unknown headers in list order.
+ * name is NULL for known headers.
+ *   Return 0 => Success, else the first nonzero emit() return
+ */
+static int cmh_walk(const mime_header_t * hd,
+		    int (*emit)(void *arg, int token, const char *name,
+				int namelen, const char *val, int vallen),
+		    void *arg)
+{
+    int rv;
+    int n;
+    dataddr_t hdptr;
+    heap_data_t *pheap_data;
+    const char *name;
+    const char *val;
+
+    for (n = 0; n < MIME_HDR_MAX_DEFS; n++) {
+	for (hdptr = hd->known_header_map[n]; hdptr;
+	     hdptr = pheap_data->u.v.value_next) {
+	    pheap_data = OFF2PTR(hd, hdptr);
+	    val = pheap_data->flags & F_VALUE_HEAPDATA_REF ?
+		OFF2CHAR_PTR(hd, pheap_data->u.v.value) :
+		EXT_OFF2CHAR_PTR(hd, pheap_data->u.v.value);
+	    rv = (*emit)(arg, n, 0, 0, val, pheap_data->u.v.value_len);
+	    if (rv) {
+		return rv;
+	    }
+	}
+    }
+
+    for (hdptr = hd->unknown_header_head; hdptr;
+	 hdptr = pheap_data->u.nv.next) {
+	pheap_data = OFF2PTR(hd, hdptr);
+	name = pheap_data->flags & F_NAME_HEAPDATA_REF ?
+	    OFF2CHAR_PTR(hd, pheap_data->u.nv.name) :
+	    EXT_OFF2CHAR_PTR(hd, pheap_data->u.nv.name);
+	val = pheap_data->flags & F_VALUE_HEAPDATA_REF ?
+	    OFF2CHAR_PTR(hd, pheap_data->u.nv.value) :
+	    EXT_OFF2CHAR_PTR(hd, pheap_data->u.nv.value);
+	rv = (*emit)(arg, -1, name, pheap_data->u.nv.name_len,
+		     val, pheap_data->u.nv.value_len);
+	if (rv) {
+	    return rv;
+	}
+    }
+    return 0;
+}
+
+typedef struct cmh_out {
+    char *p;			/* NULL => size only */
+    int size;
+    int entries;
+} cmh_out_t;
+
+static int cmh_emit(void *arg, int token, const char *name, int namelen,
+		    const char *val, int vallen)
+{
+    cmh_out_t *out = (cmh_out_t *)arg;
+    uint16_t len16;
+    int intern = -1;
+    int entsize;
+
+    if ((vallen < 0) || (vallen > 0xffff) ||
+	(out->entries == 0xffff)) {
+	return 1;
+    }
+    entsize = 1 + sizeof(len16) + vallen;
+    if (token < 0) {
+	intern = cmh_intern_lookup(name, namelen);
+	if (intern < 0) {
+	    if ((namelen <= 0) || (namelen > 0xff)) {
+		return 2;
+	    }
+	    entsize += 1 + namelen;
+	}
+    }
+
+    if (out->p) {
+	if (token >= 0) {
+	    *out->p++ = (char)token;
+	} else if (intern >= 0) {
+	    *out->p++ = (char)(CMH_TAG_INTERNED + intern);
+	} else {
+	    *out->p++ = (char)CMH_TAG_LITERAL;
+	    *out->p++ = (char)namelen;
+	    memcpy(out->p, name, namelen);
+	    out->p += namelen;
+	}
+	len16 = (uint16_t)vallen;
+	memcpy(out->p, &len16, sizeof(len16));
+	out->p += sizeof(len16);
+	memcpy(out->p, val, vallen);
+	out->p += vallen;
+    }
+    out->size += entsize;
+    out->entries++;
+    return 0;
+}
+
+/*
+ *******************************************************************************
+ * mime_hdr_serialize_compact_datasize() -- Determine compact serialization
+ *   size in bytes.
+ *
+ *   Return !=0 => Success, 0 => hd needs mime_hdr_serialize()
+ *******************************************************************************
+ */
+int mime_hdr_serialize_compact_datasize(const mime_header_t * hd)
+{
+    cmh_out_t out;
+
+    if ((hd->protocol != MIME_PROT_HTTP) ||
+	hd->cnt_namevalue_headers || hd->cnt_querystring_headers) {
+	return 0;
+    }
+    out.p = 0;
+    out.size = sizeof(compact_mime_header_t);
+    out.entries = 0;
+    if (cmh_walk(hd, cmh_emit, &out)) {
+	return 0;
+    }
+    return out.size;
+}
+
+/*
+ *******************************************************************************
+ * mime_hdr_serialize_compact() -- Serialize http_header into given buffer
+ *   in the compact format.
+ *
+ *   Return 0 => Success
+ *******************************************************************************
+ */
+int mime_hdr_serialize_compact(const mime_header_t * hd, char *outbuf,
+			       int outbuf_size)
+{
+    compact_mime_header_t *pchdr;
+    cmh_out_t out;
+    int req_bufsize;
+
+    req_bufsize = mime_hdr_serialize_compact_datasize(hd);
+    if (!outbuf || !req_bufsize || (outbuf_size < req_bufsize)) {
+	DBG("Invalid parameters outbuf=%p outbuf_size=%d "
+	    "req bufsize=%d",
+	    outbuf, outbuf_size, req_bufsize);
+	return 1;
+    }
+
+    out.p = outbuf + sizeof(compact_mime_header_t);
+    out.size = sizeof(compact_mime_header_t);
+    out.entries = 0;
+    if (cmh_walk(hd, cmh_emit, &out) || (out.size != req_bufsize)) {
+	DBG("cmh_walk() failed, size=%d req_bufsize=%d",
+	    out.size, req_bufsize);
+	return 2;
+    }
+
+    pchdr = (compact_mime_header_t *) outbuf;
+    pchdr->magic = COMPACT_MIME_HEADER_MAGIC;
+    pchdr->total_size = req_bufsize;
+    pchdr->encoding = COMPACT_MIME_HEADER_ENCODING;
+    pchdr->protocol = hd->protocol;
+    pchdr->cnt_entries = out.entries;
+    return 0;
+}
+
+/*
+ *******************************************************************************
+ * mime_hdr_deserialize_compact() -- Deserialize compact buffer into 
+ *   http_header, extdata as mime_hdr_deserialize().
+ *   Values and literal names are referenced from the buffer, not parsed,
+ *   and the heap elements are built in place.
+ *
+ *   Return 0 => Success
+ *******************************************************************************
+ */
+static int mime_hdr_deserialize_compact(const char *inbuf, int inbuf_size,
+					mime_header_t * hd,
+					const char *extdatabuf,
+					int extdatabufsz)
+{
+    int rv;
+    compact_mime_header_t chdr;
+    const char *p;
+    const char *p_end;
+    const char *name;
+    int namelen;
+    uint16_t vallen;
+    int tag;
+    int n;
+    int last_token = -1;
+    dataddr_t last_value = 0;
+    dataddr_t last_unknown = 0;
+    dataddr_t hdptr;
+    dataddr_t data_hdptr;
+    dataddr_t val_offset;
+    dataddr_t name_offset;
+    u_int64_t val_flags;
+    heap_data_t *pheap_data;
+
+    if (inbuf_size < (int) sizeof(compact_mime_header_t)) {
+	DBG("inbuf_size(%d) < sizeof(compact_mime_header_t)(%ld)",
+	    inbuf_size, sizeof(compact_mime_header_t));
+	return 2;
+    }
+    memcpy((void *) &chdr, (void *) inbuf, sizeof(compact_mime_header_t));
+    if (chdr.encoding != COMPACT_MIME_HEADER_ENCODING) {
+	DBG("chdr.encoding(%d) != COMPACT_MIME_HEADER_ENCODING(%d)",
+	    chdr.encoding, COMPACT_MIME_HEADER_ENCODING);
+	return 4;
+    }
+    if ((chdr.total_size < (int) sizeof(compact_mime_header_t)) ||
+	(chdr.total_size > inbuf_size)) {
+	DBG("chdr.total_size(%d) > inbuf_size(%d)",
+	    chdr.total_size, inbuf_size);
+	return 6;
+    }
+    if (hd->cnt_known_headers || hd->cnt_unknown_headers) {
+	DBG("hd not empty, known=%d unknown=%d",
+	    hd->cnt_known_headers, hd->cnt_unknown_headers);
+	return 10;
+    }
+
+    /* Values are referenced in place when they are in ext_data */
+    if (extdatabuf == (char *)1) {
+	hd->ext_data = inbuf;
+	hd->ext_data_size = chdr.total_size;
+    } else if (extdatabuf && (extdatabufsz >= chdr.total_size)) {
+	memcpy((char *)extdatabuf, inbuf, chdr.total_size);
+	hd->ext_data = extdatabuf;
+	hd->ext_data_size = chdr.total_size;
+	inbuf = extdatabuf;
+    } else {
+	hd->ext_data = 0;
+	hd->ext_data_size = 0;
+    }
+
+    p = inbuf + sizeof(compact_mime_header_t);
+    p_end = inbuf + chdr.total_size;
+    for (n = 0; n < chdr.cnt_entries; n++) {
+	if (p + 1 + sizeof(vallen) > p_end) {
+	    break;
+	}
+	tag = (unsigned char)*p++;
+	if (tag == CMH_TAG_LITERAL) {
+	    namelen = (unsigned char)*p++;
+	    name = p;
+	    p += namelen;
+	} else if (tag >= CMH_TAG_INTERNED) {
+	    if (tag - CMH_TAG_INTERNED >= CMH_NUM_INTERNED) {
+		break;
+	    }
+	    name = cmh_interned[tag - CMH_TAG_INTERNED].name;
+	    namelen = cmh_interned[tag - CMH_TAG_INTERNED].namelen;
+	} else {
+	    /* Known header values are grouped, in ascending id order */
+	    if ((tag >= MIME_HDR_MAX_DEFS) || (tag < last_token) ||
+		((tag != last_token) && hd->known_header_map[tag])) {
+		break;
+	    }
+	    name = 0;
+	    namelen = 0;
+	}
+	if (p + sizeof(vallen) > p_end) {
+	    break;
+	}
+	memcpy(&vallen, p, sizeof(vallen));
+	p += sizeof(vallen);
+	if (p + vallen > p_end) {
+	    break;
+	}
+
+	/*
+	 * Build the heap elements directly, appending to the value and
+	 * unknown header lists without walking them.
+	 * Note: heap_ext may move on allocation, hold offsets only.
+	 */
+	hdptr = get_heap_element(hd, name ? F_NAME_VALUE_DATA : F_VALUE_DATA,
+				 0);
+	if (!hdptr) {
+	    DBG("get_heap_element() failed, tag=%d", tag);
+	    return 8;
+	}
+	if (hd->ext_data) {
+	    val_offset = MK_POFFSET(p - hd->ext_data);
+	    val_flags = 0;
+	} else {
+	    rv = compute_data_offset(hd, p, vallen, &val_offset,
+				     &data_hdptr, 0);
+	    if (rv) {
+		DBG("compute_data_offset() failed, rv=%d", rv);
+		return 8;
+	    }
+	    val_flags = F_VALUE_HEAPDATA_REF;
+	}
+	if (name) {
+	    if (hd->ext_data && (tag == CMH_TAG_LITERAL)) {
+		name_offset = MK_POFFSET(name - hd->ext_data);
+		data_hdptr = 0;
+	    } else {
+		rv = compute_data_offset(hd, name, namelen, &name_offset,
+					 &data_hdptr, 0);
+		if (rv) {
+		    DBG("compute_data_offset() failed, rv=%d", rv);
+		    return 8;
+		}
+	    }
+	    pheap_data = OFF2PTR(hd, hdptr);
+	    pheap_data->flags |= val_flags |
+		(data_hdptr ? F_NAME_HEAPDATA_REF : 0);
+	    pheap_data->u.nv.name = name_offset;
+	    pheap_data->u.nv.name_len = namelen;
+	    pheap_data->u.nv.value = val_offset;
+	    pheap_data->u.nv.value_len = vallen;
+	    if (last_unknown) {
+		OFF2PTR(hd, last_unknown)->u.nv.next = hdptr;
+	    } else {
+		hd->unknown_header_head = hdptr;
+	    }
+	    last_unknown = hdptr;
+	    hd->cnt_unknown_headers++;
+	} else {
+	    pheap_data = OFF2PTR(hd, hdptr);
+	    pheap_data->flags |= val_flags;
+	    pheap_data->u.v.value = val_offset;
+	    pheap_data->u.v.value_len = vallen;
+	    if (tag == last_token) {
+		OFF2PTR(hd, last_value)->u.v.value_next = hdptr;
+		OFF2PTR(hd, hd->known_header_map[tag])->u.v.hdrcnt++;
+	    } else {
+		pheap_data->u.v.hdrcnt = 1;
+		hd->known_header_map[tag] = hdptr;
+		hd->cnt_known_headers++;
+		last_token = tag;
+	    }
+	    last_value = hdptr;
+	}
+	p += vallen;
+    }
+    if ((n != chdr.cnt_entries) || (p != p_end)) {
+	DBG("Bad entry %d of %d, offset %ld of %d", n, chdr.cnt_entries,
+	    p - inbuf, chdr.total_size);
+	return 5;
+    }
+    return 0;
+}
+
 /*
  *******************************************************************************
  * mime_hdr_deserialize() -- Deserialize buffer into http_header and given 
  *   extdata.
  *   If (extdata == 0) place it in the local heap
  *   If (extdata == 1) use extdata directly from the serialized buffer
+ *   inbuf may be a serial_mime_header_t or a compact_mime_header_t buffer.
  *
  *   Return 0 => Success
  *******************************************************************************
@@ -1517,6 +1947,7 @@ int mime_hdr_deserialize(const char *inbuf, int inbuf_size,
 {
     int rv = 0;
     serial_mime_header_t shdr;
+    int32_t magic;
     int data_totalsize;
     dataddr_t hpd;
     dataddr_t *sparse_known_header_map;
@@ -1532,6 +1963,15 @@ int mime_hdr_deserialize(const char *inbuf, int inbuf_size,
 	    break;
 	}
 
+	if (inbuf_size >= (int) sizeof(magic)) {
+	    memcpy((void *) &magic, (void *) inbuf, sizeof(magic));
+	    if (magic == COMPACT_MIME_HEADER_MAGIC) {
+		rv = mime_hdr_deserialize_compact(inbuf, inbuf_size, hd,
+						  extdatabuf, extdatabufsz);
+		break;
+	    }
+	}
+
 	if (inbuf_size < (int) sizeof(serial_mime_header_t)) {
 	    DBG("inbuf_size(%d) < sizeof(serial_mime_header_t)(%ld)",
 		inbuf_size, sizeof(serial_mime_header_t));
@@ -2671,35 +3111,38 @@ int int_mime_header2nkn_attr(const mime_header_t * hdr, int only_end2end_hdrs,
     int thdr_init = 0;
     char *serialbuf_malloc = 0;
     char *serialbuf_malloc_2 = 0;
+    const mime_header_t *shdr = hdr;
+    int compact;
 
-    serialbufsz = mime_hdr_serialize_datasize(hdr, 0, 0, 0);
-    if (!serialbufsz) {
-	DBG("mime_hdr_serialize_datasize() failed, hdr=%p", hdr);
-	rv = 1;
-	goto exit;
-    }
+    if (only_end2end_hdrs) {
+     	// Create temp mime_header_t, remove hop2hop hdrs
+	serialbufsz = mime_hdr_serialize_datasize(hdr, 0, 0, 0);
+	if (!serialbufsz) {
+	    DBG("mime_hdr_serialize_datasize() failed, hdr=%p", hdr);
+	    rv = 1;
+	    goto exit;
+	}
 
-    if (serialbufsz <= MAX_ALLOCA) {
-    	serialbuf = alloca(serialbufsz);
-    } else {
-    	serialbuf_malloc = nkn_malloc_type(serialbufsz, mod_httphdrs_serialbuf);
-	if (!serialbuf_malloc) {
-	    DBG("nkn_malloc_type() failed, size=%d", serialbufsz);
-	    rv = 2;
+	if (serialbufsz <= MAX_ALLOCA) {
+	    serialbuf = alloca(serialbufsz);
+	} else {
+	    serialbuf_malloc = 
+	    	nkn_malloc_type(serialbufsz, mod_httphdrs_serialbuf);
+	    if (!serialbuf_malloc) {
+		DBG("nkn_malloc_type() failed, size=%d", serialbufsz);
+		rv = 2;
+		goto exit;
+	    }
+	    serialbuf = serialbuf_malloc;
+	}
+	rv = mime_hdr_serialize(hdr, serialbuf, serialbufsz);
+	if (rv) {
+	    DBG("mime_hdr_serialize() failed, rv=%d "
+		"serialbufsz=%d", rv, serialbufsz);
+	    rv = 3;
 	    goto exit;
 	}
-	serialbuf = serialbuf_malloc;
-    }
-    rv = mime_hdr_serialize(hdr, serialbuf, serialbufsz);
-    if (rv) {
-	DBG("mime_hdr_serialize() failed, rv=%d "
-	    "serialbufsz=%d", rv, serialbufsz);
-	rv = 3;
-	goto exit;
-    }
 
-    if (only_end2end_hdrs) {
-     	// Create temp mime_header_t, remove hop2hop hdrs and serialize
     	mime_hdr_init(&thdr, hdr->protocol, 0, 0);
 	thdr_init = 1;
 
@@ -2711,33 +3154,47 @@ int int_mime_header2nkn_attr(const mime_header_t * hdr, int only_end2end_hdrs,
 	    goto exit;
 	}
     	mime_hdr_remove_hop2hophdrs(&thdr);
+	shdr = &thdr;
+    }
 
-    	serialbufsz = mime_hdr_serialize_datasize(&thdr, 0, 0, 0);
+    /* 
+     * Stored in the compact format when enabled, unless shdr can not be
+     * expressed in it
+     */
+    serialbufsz = glob_mime_hdr_attr_compact ?
+    	mime_hdr_serialize_compact_datasize(shdr) : 0;
+    compact = (serialbufsz != 0);
+    if (!compact) {
+    	serialbufsz = mime_hdr_serialize_datasize(shdr, 0, 0, 0);
 	if (!serialbufsz) {
 	    DBG("mime_hdr_serialize_datasize() failed, hdr=%p", hdr);
 	    rv = 5;
 	    goto exit;
 	}
+    }
 
-    	if (serialbufsz <= MAX_ALLOCA) {
-	    serialbuf = alloca(serialbufsz);
-	} else {
-	    serialbuf_malloc_2 = 
-	    	nkn_malloc_type(serialbufsz, mod_httphdrs_serialbuf);
-	    if (!serialbuf_malloc_2) {
-	    	DBG("nkn_malloc_type() failed, size=%d", serialbufsz);
-	    	rv = 6;
-	    	goto exit;
-	    }
-	    serialbuf = serialbuf_malloc_2;
-	}
-    	rv = mime_hdr_serialize(&thdr, serialbuf, serialbufsz);
-    	if (rv) {
-	    DBG("mime_hdr_serialize() failed, rv=%d "
-	    	"serialbufsz=%d", rv, serialbufsz);
-	    rv = 7;
+    if (serialbufsz <= MAX_ALLOCA) {
+	serialbuf = alloca(serialbufsz);
+    } else {
+	serialbuf_malloc_2 = 
+	    nkn_malloc_type(serialbufsz, mod_httphdrs_serialbuf);
+	if (!serialbuf_malloc_2) {
+	    DBG("nkn_malloc_type() failed, size=%d", serialbufsz);
+	    rv = 6;
 	    goto exit;
-    	}
+	}
+	serialbuf = serialbuf_malloc_2;
+    }
+    if (compact) {
+    	rv = mime_hdr_serialize_compact(shdr, serialbuf, serialbufsz);
+    } else {
+    	rv = mime_hdr_serialize(shdr, serialbuf, serialbufsz);
+    }
+    if (rv) {
+	DBG("mime_hdr_serialize() failed, rv=%d compact=%d "
+	    "serialbufsz=%d", rv, compact, serialbufsz);
+	rv = 7;
+	goto exit;
     }
 
     if (!nkn_attr) {
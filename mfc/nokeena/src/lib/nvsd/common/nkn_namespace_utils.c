@@ -24,6 +24,7 @@
 #include "nvsd_mgmt_namespace.h"
 #include "nkn_hash.h"
 #include "nkn_cfg_params.h"
+#include "nkn_uf_match.h"
 
 static const char *pre_html_body = 
 	"<!DOCTYPE HTML PUBLIC \"-//IETF//DTD HTML 2.0//EN\">"
@@ -3280,15 +3281,6 @@ void delete_non2xx_cache_config_t(unsuccess_response_cache_cfg_t *cpcfg)
     free(cpcfg);
 }
 
-static void *uf_trie_copy(nkn_trie_node_t nd)
-{
-    return nd;
-}
-
-static void uf_trie_destruct(nkn_trie_node_t nd)
-{
-}
-
 void *new_url_filter_trie(const char *fname, const char *namespace, int *err)
 {
     int ret = 0;
@@ -3297,10 +3289,7 @@ void *new_url_filter_trie(const char *fname, const char *namespace, int *err)
     int fd = -1;
     int rv;
     struct stat sb;
-    nkn_trie_t *ptrie = 0;
-    long nkn_trie_node_data = 1 + 1; // Allow for header
-    bin_uf_fmt_url_hdr_t *uf_hdr;
-    bin_uf_fmt_url_rec_t *uf_rec;
+    uf_match_t *match = 0;
 
     url_filter_trie_t *uf_trie_data = 0;
 
@@ -3331,62 +3320,21 @@ void *new_url_filter_trie(const char *fname, const char *namespace, int *err)
 	break;
     }
 
-    ptrie = nkn_trie_create(uf_trie_copy, uf_trie_destruct);
-    if (!ptrie) {
-    	DBG_LOG(MSG, MOD_NAMESPACE, 
-		"Namespace=%s URL Filter nkn_trie_create() failed",
-		namespace);
-	ret = 4;
-	break;
-    }
-
-    uf_hdr = (bin_uf_fmt_url_hdr_t *) addr;
-
-    if (uf_hdr->magicno != BIN_UF_FMT_URL_MAGIC) {
-    	DBG_LOG(MSG, MOD_NAMESPACE,
-		"Namespace=%s URL Filter bin file bad magicno, "
-		"expected=%ld given=%ld",
-		namespace, BIN_UF_FMT_URL_MAGIC, uf_hdr->magicno);
-	ret = 5;
-	break;
-    }
-
-    if (uf_hdr->version_maj != BIN_UF_FMT_URL_VERS_MAJ) {
+    /*
+     * Compile the list into a read only lookup block, the bin file
+     * is not referenced once this returns.
+     */
+    match = uf_match_compile(addr, size, &ret);
+    if (!match) {
     	DBG_LOG(MSG, MOD_NAMESPACE,
-		"Namespace=%s URL Filter bin file bad version major, "
-		"expected=%d given=%d",
-		namespace, BIN_UF_FMT_URL_VERS_MAJ, uf_hdr->version_maj);
-	ret = 6;
+		"Namespace=%s URL Filter compile of %s failed, rv=%d%s",
+		namespace, fname, ret,
+		(ret == 8) ? " (duplicate entry)" : "");
 	break;
     }
-
-    if (uf_hdr->version_min != BIN_UF_FMT_URL_VERS_MIN) {
-    	DBG_LOG(MSG, MOD_NAMESPACE, 
-		"Namespace=%s URL Filter bin file bad version minor, "
-		"expected=%d given=%d",
-		namespace, BIN_UF_FMT_URL_VERS_MIN, uf_hdr->version_min);
-	ret = 7;
-	break;
-    }
-
-    uf_rec = UF_URL_FIRST_RECORD(uf_hdr);
-
-    while (1) {
-    	if (!uf_rec->sizeof_data) {
-	    break;
-	}
-	// Note: nkn_trie_node_data == Entry line number in uf.txt
-    	rv = nkn_trie_add(ptrie, uf_rec->data, 
-			  (nkn_trie_node_t)(nkn_trie_node_data++));
-	if (rv) {
-	    DBG_LOG(MSG, MOD_NAMESPACE,
-		    "Namespace=%s URL Filter trie add failed, "
-		    "rv=%d key=%s", namespace, rv, uf_rec->data);
-	    ret = 8;
-	    break;
-	}
-	uf_rec = UF_URL_NXT_RECORD(uf_rec);
-    }
+    DBG_LOG(MSG, MOD_NAMESPACE,
+	    "Namespace=%s URL Filter %u entries, %ld bytes",
+	    namespace, uf_match_entries(match), (long)uf_match_memsize(match));
 
     break;
 
@@ -3406,16 +3354,16 @@ void *new_url_filter_trie(const char *fname, const char *namespace, int *err)
 				       mod_uf_trie);
 	if (uf_trie_data) {
 	    uf_trie_data->magicno = UF_TRIE_DATA_MAGIC;
-	    uf_trie_data->trie = ptrie;
+	    uf_trie_data->match = match;
 	    AO_fetch_and_add1(&uf_trie_data->refcnt);
 	} else {
 	    ret = 9;
-	    nkn_trie_destroy(ptrie);
-	    ptrie = 0;
+	    uf_match_destroy(match);
+	    match = 0;
 	}
     } else {
-    	nkn_trie_destroy(ptrie);
-    	ptrie = 0;
+    	uf_match_destroy(match);
+    	match = 0;
     }
 
     *err = ret;
@@ -3441,8 +3389,8 @@ void delete_url_filter_trie(void *arg)
     if (uf_trie && (uf_trie->magicno == UF_TRIE_DATA_MAGIC)) {
     	old_refcnt = AO_fetch_and_sub1(&uf_trie->refcnt);
 	if (old_refcnt == 1) {
-	    nkn_trie_destroy(uf_trie->trie);
-	    uf_trie->trie = 0;
+	    uf_match_destroy(uf_trie->match);
+	    uf_trie->match = 0;
 	    uf_trie->magicno = ~UF_TRIE_DATA_MAGIC;
 
 	    free(uf_trie);
@@ -0,0 +1,451 @@
+/*
+ *******************************************************************************
+ * nkn_uf_match.c -- Compiled URL filter list
+ *******************************************************************************
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <alloca.h>
+
+#include "nkn_memalloc.h"
+#include "uf_utils.h"
+#include "uf_fmt_url_bin.h"
+#include "nkn_uf_match.h"
+
+#define UF_MATCH_MAGIC		0x20261019abcd1234ULL
+
+/* Bloom filter: 512 bit blocks, 10 bits and 4 probes per host */
+#define UF_BLOOM_BLOCK_WORDS	8
+#define UF_BLOOM_BITS_PER_HOST	10
+#define UF_BLOOM_PROBES		4
+
+typedef struct uf_match_host {
+    uint32_t name_off;		// host (upper case) in the string pool
+    uint32_t name_len;
+    uint32_t first;		// first entry, entries sorted by path
+    uint32_t count;
+} uf_match_host_t;
+
+typedef struct uf_match_ent {
+    uint32_t path_off;
+    uint32_t path_len;
+    int32_t parent;		// longest entry that is a prefix, -1 none
+    uint32_t line;		// entry number in the list
+} uf_match_ent_t;
+
+struct uf_match {
+    uint64_t magicno;
+    uint32_t bloom_mask;	// blocks - 1
+    uint32_t htab_mask;		// slots - 1
+    uint32_t nhosts;
+    uint32_t nents;
+    size_t size;
+    const uint64_t *bloom;
+    const uint64_t *htab;	// (hash >> 32) << 32 | (host index + 1)
+    const uf_match_host_t *hosts;
+    const uf_match_ent_t *ents;
+    const char *pool;
+};
+
+/* entry as found in the list file, used while compiling */
+typedef struct uf_src_ent {
+    const char *key;
+    uint32_t hostlen;
+    uint32_t keylen;
+    uint32_t line;
+} uf_src_ent_t;
+
+static inline unsigned char uf_upper(unsigned char c)
+{
+    return c - (((unsigned)(c - 'a') < 26) << 5);
+}
+
+static inline uint64_t uf_host_hash(const char *host, int hostlen)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    int n;
+
+    for (n = 0; n < hostlen; n++) {
+	h = (h ^ uf_upper(host[n])) * 0x100000001b3ULL;
+    }
+    return h ^ (h >> 29);
+}
+
+static inline const uint64_t *uf_bloom_block(const uf_match_t *m, uint64_t h)
+{
+    return &m->bloom[(h & m->bloom_mask) * UF_BLOOM_BLOCK_WORDS];
+}
+
+/* 9 bits per probe, independent of the block and host table bits */
+static inline uint64_t uf_bloom_bits(uint64_t h)
+{
+    return (h * 0x9e3779b97f4a7c15ULL) >> 28;
+}
+
+static inline int uf_bloom_test(const uf_match_t *m, uint64_t h)
+{
+    const uint64_t *blk = uf_bloom_block(m, h);
+    uint64_t bits = uf_bloom_bits(h);
+    int n;
+
+    for (n = 0; n < UF_BLOOM_PROBES; n++, bits >>= 9) {
+	if (!(blk[(bits >> 6) & 7] & (1ULL << (bits & 63)))) {
+	    return 0;
+	}
+    }
+    return 1;
+}
+
+static void uf_bloom_add(uf_match_t *m, uint64_t h)
+{
+    uint64_t *blk = (uint64_t *)uf_bloom_block(m, h);
+    uint64_t bits = uf_bloom_bits(h);
+    int n;
+
+    for (n = 0; n < UF_BLOOM_PROBES; n++, bits >>= 9) {
+	blk[(bits >> 6) & 7] |= (1ULL << (bits & 63));
+    }
+}
+
+static inline uint32_t uf_htab_slot(const uf_match_t *m, uint64_t h)
+{
+    return (uint32_t)(h >> 16) & m->htab_mask;
+}
+
+/* compare two byte strings, a shorter prefix sorts first */
+static inline int uf_strcmp(const char *a, uint32_t alen,
+			    const char *b, uint32_t blen)
+{
+    int rv;
+
+    rv = memcmp(a, b, (alen < blen) ? alen : blen);
+    if (rv) {
+	return rv;
+    }
+    return (alen > blen) - (alen < blen);
+}
+
+static int uf_src_ent_cmp(const void *a, const void *b)
+{
+    const uf_src_ent_t *ea = (const uf_src_ent_t *)a;
+    const uf_src_ent_t *eb = (const uf_src_ent_t *)b;
+    int rv;
+
+    rv = uf_strcmp(ea->key, ea->hostlen, eb->key, eb->hostlen);
+    if (!rv) {
+	rv = uf_strcmp(ea->key + ea->hostlen, ea->keylen - ea->hostlen,
+		       eb->key + eb->hostlen, eb->keylen - eb->hostlen);
+    }
+    if (!rv) {
+	rv = (ea->line > eb->line) - (ea->line < eb->line);
+    }
+    return rv;
+}
+
+static uint32_t uf_pow2(uint64_t n)
+{
+    uint32_t p = 1;
+
+    while (p < n) {
+	p <<= 1;
+    }
+    return p;
+}
+
+uf_match_t *uf_match_compile(const char *addr, size_t size, int *err)
+{
+    const bin_uf_fmt_url_hdr_t *uf_hdr = (const bin_uf_fmt_url_hdr_t *)addr;
+    const bin_uf_fmt_url_rec_t *uf_rec;
+    const char *end = addr + size;
+    uf_src_ent_t *src = 0;
+    int32_t *stack = 0;
+    uf_match_t *m = 0;
+    uf_match_host_t *hosts;
+    uf_match_ent_t *ents;
+    uint64_t *htab;
+    char *pool;
+    uint32_t nsrc, nhosts, nents, npool, nbloom, nhtab;
+    uint32_t i, j, line, top, slot;
+    const char *p;
+    uint64_t h;
+    size_t off;
+
+    *err = 0;
+    if (size < sizeof(*uf_hdr) || uf_hdr->magicno != BIN_UF_FMT_URL_MAGIC) {
+	*err = 5;
+	return 0;
+    }
+    if (uf_hdr->version_maj != BIN_UF_FMT_URL_VERS_MAJ) {
+	*err = 6;
+	return 0;
+    }
+    if (uf_hdr->version_min != BIN_UF_FMT_URL_VERS_MIN) {
+	*err = 7;
+	return 0;
+    }
+
+    /* Pass 1: count the records */
+    nsrc = 0;
+    uf_rec = UF_URL_FIRST_RECORD(uf_hdr);
+    while (((const char *)uf_rec + sizeof(*uf_rec)) <= end) {
+	if (!uf_rec->sizeof_data) {
+	    break;
+	}
+	if ((uf_rec->data + uf_rec->sizeof_data) > end) {
+	    *err = 8;
+	    return 0;
+	}
+	nsrc++;
+	uf_rec = UF_URL_NXT_RECORD(uf_rec);
+    }
+
+    src = nkn_malloc_type((nsrc ? nsrc : 1) * sizeof(uf_src_ent_t),
+			  mod_uf_match);
+    stack = nkn_malloc_type((nsrc ? nsrc : 1) * sizeof(int32_t),
+			    mod_uf_match);
+    if (!src || !stack) {
+	*err = 9;
+	goto out;
+    }
+
+    /* Pass 2: split <HOSTNAME>/<path>, line numbers as the trie used */
+    line = 2;
+    uf_rec = UF_URL_FIRST_RECORD(uf_hdr);
+    for (i = 0; i < nsrc; i++) {
+	src[i].key = uf_rec->data;
+	src[i].keylen = strnlen(uf_rec->data, uf_rec->sizeof_data);
+	p = memchr(uf_rec->data, '/', src[i].keylen);
+	src[i].hostlen = p ? (uint32_t)(p - uf_rec->data) : src[i].keylen;
+	src[i].line = line++;
+	uf_rec = UF_URL_NXT_RECORD(uf_rec);
+    }
+    qsort(src, nsrc, sizeof(uf_src_ent_t), uf_src_ent_cmp);
+
+    /* Size the block, a duplicate entry fails the load as with the trie */
+    nhosts = nents = npool = 0;
+    for (i = 0; i < nsrc; i++) {
+	if (i && !uf_strcmp(src[i].key, src[i].keylen,
+			    src[i-1].key, src[i-1].keylen)) {
+	    *err = 8;
+	    goto out;
+	}
+	if (!i || uf_strcmp(src[i].key, src[i].hostlen,
+			    src[i-1].key, src[i-1].hostlen)) {
+	    nhosts++;
+	    npool += src[i].hostlen;
+	}
+	nents++;
+	npool += src[i].keylen - src[i].hostlen;
+    }
+    nbloom = uf_pow2(((uint64_t)nhosts * UF_BLOOM_BITS_PER_HOST + 511) / 512);
+    nhtab = uf_pow2((uint64_t)nhosts * 2 + 1);
+
+    off = sizeof(uf_match_t);
+    off = (off + 63) & ~(size_t)63;
+    size = off + (size_t)nbloom * UF_BLOOM_BLOCK_WORDS * sizeof(uint64_t) +
+	   (size_t)nhtab * sizeof(uint64_t) +
+	   (size_t)nhosts * sizeof(uf_match_host_t) +
+	   (size_t)nents * sizeof(uf_match_ent_t) + npool;
+    if (nkn_posix_memalign_type((void **)&m, 64, size, mod_uf_match) || !m) {
+	m = 0;
+	*err = 9;
+	goto out;
+    }
+    memset(m, 0, size);
+    m->magicno = UF_MATCH_MAGIC;
+    m->size = size;
+    m->bloom_mask = nbloom - 1;
+    m->htab_mask = nhtab - 1;
+    m->nhosts = nhosts;
+    m->nents = nents;
+    m->bloom = (const uint64_t *)((char *)m + off);
+    htab = (uint64_t *)(m->bloom + (size_t)nbloom * UF_BLOOM_BLOCK_WORDS);
+    m->htab = htab;
+    hosts = (uf_match_host_t *)(htab + nhtab);
+    m->hosts = hosts;
+    ents = (uf_match_ent_t *)(hosts + nhosts);
+    m->ents = ents;
+    pool = (char *)(ents + nents);
+    m->pool = pool;
+
+    /* Pass 3: fill in hosts, entries and their prefix links */
+    nhosts = nents = npool = top = 0;
+    for (i = 0; i < nsrc; i++) {
+	if (!i || uf_strcmp(src[i].key, src[i].hostlen,
+			    src[i-1].key, src[i-1].hostlen)) {
+	    hosts[nhosts].name_off = npool;
+	    hosts[nhosts].name_len = src[i].hostlen;
+	    hosts[nhosts].first = nents;
+	    memcpy(&pool[npool], src[i].key, src[i].hostlen);
+	    npool += src[i].hostlen;
+	    h = uf_host_hash(src[i].key, src[i].hostlen);
+	    uf_bloom_add(m, h);
+	    slot = uf_htab_slot(m, h);
+	    while (htab[slot]) {
+		slot = (slot + 1) & m->htab_mask;
+	    }
+	    htab[slot] = ((h >> 32) << 32) | (nhosts + 1);
+	    nhosts++;
+	    top = 0;
+	}
+	hosts[nhosts-1].count++;
+
+	ents[nents].path_off = npool;
+	ents[nents].path_len = src[i].keylen - src[i].hostlen;
+	ents[nents].line = src[i].line;
+	memcpy(&pool[npool], src[i].key + src[i].hostlen,
+	       ents[nents].path_len);
+	npool += ents[nents].path_len;
+
+	/* sorted order: the prefixes of an entry are on the stack */
+	while (top) {
+	    j = stack[top-1];
+	    if ((ents[j].path_len < ents[nents].path_len) &&
+		!memcmp(&pool[ents[j].path_off], &pool[ents[nents].path_off],
+			ents[j].path_len)) {
+		break;
+	    }
+	    top--;
+	}
+	ents[nents].parent = top ? stack[top-1] : -1;
+	stack[top++] = nents;
+	nents++;
+    }
+
+out:
+    free(stack);
+    free(src);
+    return m;
+}
+
+void uf_match_destroy(uf_match_t *m)
+{
+    if (m && (m->magicno == UF_MATCH_MAGIC)) {
+	m->magicno = ~UF_MATCH_MAGIC;
+	free(m);
+    }
+}
+
+static const uf_match_host_t *uf_match_host(const uf_match_t *m,
+					    const char *host, int hostlen)
+{
+    const uf_match_host_t *hp;
+    uint64_t h, e;
+    uint32_t slot;
+    int n;
+
+    h = uf_host_hash(host, hostlen);
+    if (!uf_bloom_test(m, h)) {
+	return 0;
+    }
+    for (slot = uf_htab_slot(m, h); (e = m->htab[slot]) != 0;
+	 slot = (slot + 1) & m->htab_mask) {
+	if ((e >> 32) != (h >> 32)) {
+	    continue;
+	}
+	hp = &m->hosts[(uint32_t)e - 1];
+	if (hp->name_len != (uint32_t)hostlen) {
+	    continue;
+	}
+	for (n = 0; n < hostlen; n++) {
+	    if (uf_upper(host[n]) != (unsigned char)m->pool[hp->name_off + n]) {
+		break;
+	    }
+	}
+	if (n == hostlen) {
+	    return hp;
+	}
+    }
+    return 0;
+}
+
+long uf_match_lookup(const uf_match_t *m, const char *host, int hostlen,
+		     const char *path, int pathlen)
+{
+    const uf_match_host_t *hp;
+    const uf_match_ent_t *e;
+    char *buf;
+    int32_t lo, hi, mid, k;
+    uint32_t lcp, len;
+    int n, lead, klen;
+
+    if (!m || (m->magicno != UF_MATCH_MAGIC)) {
+	return 0;
+    }
+    hp = uf_match_host(m, host, hostlen);
+    if (!hp) {
+	return 0;
+    }
+
+    if (pathlen > 1 && memmem(path, pathlen, "//", 2)) {
+	/*
+	 * Rare, apply CompressURLSlashes() on a copy.  It looks back up
+	 * to 6 bytes from a "//" to leave "http://" and "https://" alone,
+	 * so lead the copy with the tail of the host, as the path has it
+	 * in the "<HOSTNAME>/<path>" key.
+	 */
+	lead = (hostlen < 6) ? hostlen : 6;
+	buf = alloca(lead + pathlen + 1);
+	for (n = 0; n < lead; n++) {
+	    buf[n] = uf_upper(host[hostlen - lead + n]);
+	}
+	memcpy(&buf[lead], path, pathlen);
+	buf[lead + pathlen] = '\0';
+	klen = lead + pathlen;
+	CompressURLSlashes(buf, &klen);
+	path = &buf[lead];
+	pathlen = klen - lead;
+    }
+
+    /* Greatest entry <= path */
+    lo = hp->first;
+    hi = hp->first + hp->count - 1;
+    k = -1;
+    while (lo <= hi) {
+	mid = lo + ((hi - lo) >> 1);
+	e = &m->ents[mid];
+	if (uf_strcmp(&m->pool[e->path_off], e->path_len,
+		      path, pathlen) <= 0) {
+	    k = mid;
+	    lo = mid + 1;
+	} else {
+	    hi = mid - 1;
+	}
+    }
+    if (k < 0) {
+	return 0;
+    }
+
+    /*
+     * Either that entry is a prefix of path, or the longest match is
+     * its longest prefix within the common part.
+     */
+    e = &m->ents[k];
+    len = (e->path_len < (uint32_t)pathlen) ? e->path_len : (uint32_t)pathlen;
+    for (lcp = 0; lcp < len; lcp++) {
+	if (m->pool[e->path_off + lcp] != path[lcp]) {
+	    break;
+	}
+    }
+    while (e->path_len > lcp) {
+	if (e->parent < 0) {
+	    return 0;
+	}
+	e = &m->ents[e->parent];
+    }
+    return e->line;
+}
+
+uint32_t uf_match_entries(const uf_match_t *m)
+{
+    return m ? m->nents : 0;
+}
+
+size_t uf_match_memsize(const uf_match_t *m)
+{
+    return m ? m->size : 0;
+}
+
+/*
+ * End of nkn_uf_match.c
+ */
@@ -0,0 +1,323 @@
+/*
+ *******************************************************************************
+ * nkn_uf_match_bench.c -- URL filter lookup benchmark
+ *
+ *	Builds a synthetic URL filter list (default 1M entries) in the
+ *	binary list format and compares lookup ns/op and memory of the
+ *	Patricia tree (nkn_trie.c, as url_filter_lookup() used it) with
+ *	the compiled list (nkn_uf_match.c).  Most lookups miss, as they
+ *	do in production.
+ *
+ *	build:
+ *	  gcc -O2 -D_GNU_SOURCE -I../../../include -o nkn_uf_match_bench \
+ *		nkn_uf_match_bench.c nkn_uf_match.c nkn_trie.c -lcprops
+ *
+ *	usage: nkn_uf_match_bench [-n entries] [-l lookups] [-h hit_pct]
+ *		[-T (compiled list only)]
+ *******************************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <alloca.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "nkn_memalloc.h"
+#include "nkn_trie.h"
+#include "uf_utils.h"
+#include "uf_fmt_url_bin.h"
+#include "nkn_uf_match.h"
+
+#define PATHS_PER_HOST	4
+#define MAX_KEY		256
+#define NUM_REQS	65536	// distinct requests, replayed
+
+/* nvsd memory allocator, plain libc here */
+void *nkn_malloc_type(size_t size, nkn_obj_type_t type)
+{
+    (void)type;
+    return malloc(size);
+}
+
+int nkn_posix_memalign_type(void **r, size_t align, size_t size,
+			    nkn_obj_type_t type)
+{
+    (void)type;
+    return posix_memalign(r, align, size);
+}
+
+static size_t heap_in_use(void)
+{
+#if defined(__GLIBC__) && ((__GLIBC__ > 2) || (__GLIBC_MINOR__ >= 33))
+    return mallinfo2().uordblks;
+#else
+    return (size_t)mallinfo().uordblks;
+#endif
+}
+
+static uint64_t now_nsec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void gen_host(char *buf, unsigned id)
+{
+    static const char *tld[] = { "COM", "NET", "ORG", "CO.UK", "DE" };
+
+    sprintf(buf, "WWW.SITE%u-%x.%s", id, (id * 2654435761u) >> 20,
+	    tld[id % 5]);
+}
+
+static void gen_path(char *buf, unsigned id, unsigned n)
+{
+    switch (n % PATHS_PER_HOST) {
+    case 0:
+	strcpy(buf, "/");
+	break;
+    case 1:
+	sprintf(buf, "/ads/%u/", id % 977);
+	break;
+    case 2:
+	sprintf(buf, "/media/video%u.flv", id % 7919);
+	break;
+    default:
+	sprintf(buf, "/cgi-bin/track%u?id=%u", n, id);
+	break;
+    }
+}
+
+/* list file image as written by the URL filter map tool */
+static char *gen_list(unsigned entries, size_t *size)
+{
+    bin_uf_fmt_url_hdr_t *hdr;
+    bin_uf_fmt_url_rec_t *rec;
+    char host[MAX_KEY], path[MAX_KEY];
+    size_t off, max;
+    unsigned i, len;
+    char *buf;
+
+    max = sizeof(*hdr) + (size_t)entries * (sizeof(*rec) + MAX_KEY) +
+	  sizeof(*rec);
+    buf = malloc(max);
+    if (!buf) {
+	return 0;
+    }
+    hdr = (bin_uf_fmt_url_hdr_t *)buf;
+    hdr->magicno = BIN_UF_FMT_URL_MAGIC;
+    hdr->version_maj = BIN_UF_FMT_URL_VERS_MAJ;
+    hdr->version_min = BIN_UF_FMT_URL_VERS_MIN;
+    hdr->options = BIN_UF_FMT_URL_OPT_LE;
+    off = sizeof(*hdr);
+
+    for (i = 0; i < entries; i++) {
+	gen_host(host, i / PATHS_PER_HOST);
+	gen_path(path, i / PATHS_PER_HOST, i);
+	rec = (bin_uf_fmt_url_rec_t *)(buf + off);
+	rec->flags = 0;
+	len = sprintf(rec->data, "%s%s", host, path);
+	rec->sizeof_data = len + 1;
+	off += sizeof(*rec) + len;
+    }
+    rec = (bin_uf_fmt_url_rec_t *)(buf + off);
+    memset(rec, 0, sizeof(*rec));
+    *size = off + sizeof(*rec);
+    return buf;
+}
+
+static void *trie_copy(nkn_trie_node_t nd)
+{
+    return nd;
+}
+
+static void trie_destruct(nkn_trie_node_t nd)
+{
+    (void)nd;
+}
+
+static nkn_trie_t build_trie(const char *addr, size_t *mem)
+{
+    bin_uf_fmt_url_rec_t *rec;
+    long line = 2;
+    size_t before;
+    nkn_trie_t t;
+
+    before = heap_in_use();
+    t = nkn_trie_create(trie_copy, trie_destruct);
+    rec = UF_URL_FIRST_RECORD(addr);
+    while (rec->sizeof_data) {
+	nkn_trie_add(t, rec->data, (nkn_trie_node_t)line++);
+	rec = UF_URL_NXT_RECORD(rec);
+    }
+    *mem = heap_in_use() - before;
+    return t;
+}
+
+/* url_filter_lookup() before the compiled list */
+static long trie_lookup(nkn_trie_t t, const char *host, int hostlen,
+			const char *uri, int urilen)
+{
+    nkn_trie_node_t pnd;
+    char *key, *pkey;
+    int n, keylen;
+
+    key = alloca(hostlen + urilen + 1);
+    pkey = key;
+    for (n = 0; n < hostlen; n++) {
+	*(pkey++) = toupper(host[n]);
+    }
+    memcpy(pkey, uri, urilen);
+    key[hostlen + urilen] = '\0';
+    keylen = hostlen + urilen;
+    CompressURLSlashes(key, &keylen);
+    return nkn_trie_prefix_match(t, key, &pnd) ? (long)pnd : 0;
+}
+
+typedef struct req {
+    char host[64];
+    char uri[64];
+    int hostlen;
+    int urilen;
+} req_t;
+
+static req_t *gen_reqs(unsigned entries, unsigned hit_pct)
+{
+    unsigned nreq = NUM_REQS;
+    req_t *r;
+    unsigned i, id, hosts;
+    char *p;
+
+    hosts = (entries + PATHS_PER_HOST - 1) / PATHS_PER_HOST;
+    r = malloc((size_t)nreq * sizeof(req_t));
+    if (!r) {
+	return 0;
+    }
+    srandom(1);
+    for (i = 0; i < nreq; i++) {
+	id = random() % hosts;
+	if ((unsigned)(random() % 100) < hit_pct) {
+	    gen_host(r[i].host, id);
+	    /* request hosts are mostly lower case */
+	    for (p = r[i].host; *p; p++) {
+		*p = tolower(*p);
+	    }
+	    gen_path(r[i].uri, id, random());
+	    strcat(r[i].uri, "x/index.html");
+	} else {
+	    sprintf(r[i].host, "cdn%u.miss-%x.example.net", id,
+		    (unsigned)random());
+	    sprintf(r[i].uri, "/content/%u/segment%u.ts", id,
+		    (unsigned)random() % 1000);
+	}
+	r[i].hostlen = strlen(r[i].host);
+	r[i].urilen = strlen(r[i].uri);
+    }
+    return r;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned entries = 1000000, nreq = 2000000, hit_pct = 5;
+    int skip_trie = 0;
+    uf_match_t *m;
+    nkn_trie_t t = 0;
+    size_t size, trie_mem = 0;
+    uint64_t start, t_ns = 0, m_ns;
+    unsigned i, t_hits = 0, m_hits = 0, diff = 0;
+    long a, b;
+    char *list;
+    req_t *r, *q;
+    int c, err;
+
+    while ((c = getopt(argc, argv, "n:l:h:T")) != -1) {
+	switch (c) {
+	case 'n':
+	    entries = atoi(optarg);
+	    break;
+	case 'l':
+	    nreq = atoi(optarg);
+	    break;
+	case 'h':
+	    hit_pct = atoi(optarg);
+	    break;
+	case 'T':
+	    skip_trie = 1;
+	    break;
+	default:
+	    fprintf(stderr, "usage: %s [-n entries] [-l lookups] "
+		    "[-h hit_pct] [-T]\n", argv[0]);
+	    return 1;
+	}
+    }
+
+    list = gen_list(entries, &size);
+    r = gen_reqs(entries, hit_pct);
+    if (!list || !r) {
+	fprintf(stderr, "out of memory\n");
+	return 1;
+    }
+
+    start = now_nsec();
+    m = uf_match_compile(list, size, &err);
+    if (!m) {
+	fprintf(stderr, "uf_match_compile() failed, err=%d\n", err);
+	return 1;
+    }
+    printf("compiled: %u entries, %.1f MB, built in %.2f s\n",
+	   uf_match_entries(m), uf_match_memsize(m) / 1048576.0,
+	   (now_nsec() - start) / 1e9);
+
+    if (!skip_trie) {
+	start = now_nsec();
+	t = build_trie(list, &trie_mem);
+	printf("trie:     %u entries, %.1f MB, built in %.2f s\n",
+	       entries, trie_mem / 1048576.0, (now_nsec() - start) / 1e9);
+
+	start = now_nsec();
+	for (i = 0; i < nreq; i++) {
+	    q = &r[i % NUM_REQS];
+	    t_hits += (trie_lookup(t, q->host, q->hostlen,
+				   q->uri, q->urilen) != 0);
+	}
+	t_ns = now_nsec() - start;
+    }
+
+    start = now_nsec();
+    for (i = 0; i < nreq; i++) {
+	q = &r[i % NUM_REQS];
+	m_hits += (uf_match_lookup(m, q->host, q->hostlen,
+				   q->uri, q->urilen) != 0);
+    }
+    m_ns = now_nsec() - start;
+
+    printf("%u lookups, %u%% hosts in the list\n", nreq, hit_pct);
+    if (!skip_trie) {
+	for (i = 0; i < nreq; i++) {
+	    q = &r[i % NUM_REQS];
+	    a = trie_lookup(t, q->host, q->hostlen, q->uri, q->urilen);
+	    b = uf_match_lookup(m, q->host, q->hostlen, q->uri, q->urilen);
+	    diff += ((a != 0) != (b != 0));
+	}
+	printf("trie:     %7.1f ns/op (hits %u)\n", (double)t_ns / nreq,
+	       t_hits);
+    }
+    printf("compiled: %7.1f ns/op (hits %u, mismatches %u)\n",
+	   (double)m_ns / nreq, m_hits, diff);
+
+    if (t) {
+	nkn_trie_destroy(t);
+    }
+    uf_match_destroy(m);
+    free(r);
+    free(list);
+    return diff != 0;
+}
+
+/*
+ * End of nkn_uf_match_bench.c
+ */
@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <errno.h>
 #include <assert.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
@@ -318,3 +319,240 @@ do_csum32_iterate_aligned_v3(const unsigned char *buff,
     }
     return result;
 }       /* do_csum32_iterate_aligned_v3 */
+
+/*
+ * CRC32C (Castagnoli, reflected polynomial 0x82f63b78).
+ *
+ * Unlike the XOR sums above, a CRC catches swapped, duplicated and
+ * zeroed words.  On CPUs with SSE4.2 the crc32 instruction is used,
+ * three streams at a time so its 3 cycle latency is hidden; the
+ * streams are folded back together with the "append N zero bytes"
+ * operators in crc32c_long/crc32c_short.  Otherwise a slicing-by-8
+ * table is used.  Both return the same values, iterate the same way
+ * as do_csum32_iterate_aligned() (start with 0, feed the previous
+ * result back in) and take any alignment and length.
+ */
+#define CRC32C_POLY	0x82f63b78
+#define CRC32C_LONG	8192
+#define CRC32C_SHORT	256
+
+static uint32_t crc32c_table[8][256];
+static uint32_t crc32c_long[4][256];
+static uint32_t crc32c_short[4][256];
+static int crc32c_have_hw;
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+static uint32_t
+crc32c_gf2_times(const uint32_t *mat,
+		 uint32_t	vec)
+{
+    uint32_t sum = 0;
+
+    for (; vec; vec >>= 1, mat++) {
+	if (vec & 1)
+	    sum ^= *mat;
+    }
+    return sum;
+}	/* crc32c_gf2_times */
+
+static void
+crc32c_gf2_square(uint32_t	 *square,
+		  const uint32_t *mat)
+{
+    int n;
+
+    for (n = 0; n < 32; n++)
+	square[n] = crc32c_gf2_times(mat, mat[n]);
+}	/* crc32c_gf2_square */
+
+/*
+ * Build the tables which advance a crc over 'len' zero bytes
+ */
+static void
+crc32c_zeros(uint32_t zeros[4][256],
+	     size_t   len)
+{
+    uint32_t even[32], odd[32], *op;
+    uint32_t row = 1;
+    int n;
+
+    odd[0] = CRC32C_POLY;		// operator for one zero bit
+    for (n = 1; n < 32; n++) {
+	odd[n] = row;
+	row <<= 1;
+    }
+    crc32c_gf2_square(even, odd);	// 2 zero bits
+    crc32c_gf2_square(odd, even);	// 4 zero bits
+
+    /* Square up to 8 zero bits (one byte) and on, applying len's bits */
+    op = NULL;
+    for (;;) {
+	crc32c_gf2_square(even, odd);
+	len >>= 1;
+	if (len == 0) {
+	    op = even;
+	    break;
+	}
+	crc32c_gf2_square(odd, even);
+	len >>= 1;
+	if (len == 0) {
+	    op = odd;
+	    break;
+	}
+    }
+    for (n = 0; n < 256; n++) {
+	zeros[0][n] = crc32c_gf2_times(op, n);
+	zeros[1][n] = crc32c_gf2_times(op, n << 8);
+	zeros[2][n] = crc32c_gf2_times(op, n << 16);
+	zeros[3][n] = crc32c_gf2_times(op, (uint32_t)n << 24);
+    }
+}	/* crc32c_zeros */
+
+static inline uint32_t
+crc32c_shift(uint32_t zeros[4][256],
+	     uint32_t crc)
+{
+    return zeros[0][crc & 0xff] ^ zeros[1][(crc >> 8) & 0xff] ^
+	zeros[2][(crc >> 16) & 0xff] ^ zeros[3][crc >> 24];
+}	/* crc32c_shift */
+
+static void
+crc32c_init(void)
+{
+    uint32_t crc;
+    int n, k;
+
+    for (n = 0; n < 256; n++) {
+	crc = n;
+	for (k = 0; k < 8; k++)
+	    crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+	crc32c_table[0][n] = crc;
+    }
+    for (n = 0; n < 256; n++) {
+	crc = crc32c_table[0][n];
+	for (k = 1; k < 8; k++) {
+	    crc = crc32c_table[0][crc & 0xff] ^ (crc >> 8);
+	    crc32c_table[k][n] = crc;
+	}
+    }
+#if defined(__x86_64__)
+    {
+	uint32_t eax = 1, ebx, ecx, edx;
+
+	__asm__("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+	crc32c_have_hw = (ecx >> 20) & 1;	// SSE4.2
+    }
+#endif
+    if (crc32c_have_hw) {
+	crc32c_zeros(crc32c_long, CRC32C_LONG);
+	crc32c_zeros(crc32c_short, CRC32C_SHORT);
+    }
+}	/* crc32c_init */
+
+unsigned int
+do_crc32c_iterate_sw(const unsigned char *buff,
+		     int		 len,
+		     unsigned int	 old_crc)
+{
+    uint64_t crc = old_crc ^ 0xffffffff;
+    uint64_t word;
+
+    pthread_once(&crc32c_once, crc32c_init);
+    while (len > 0 && ((uintptr_t)buff & 0x7)) {
+	crc = crc32c_table[0][(crc ^ *buff++) & 0xff] ^ (crc >> 8);
+	len--;
+    }
+    for (; len >= 8; len -= 8, buff += 8) {
+	word = crc ^ *(const uint64_t *)buff;
+	crc = crc32c_table[7][word & 0xff] ^
+	    crc32c_table[6][(word >> 8) & 0xff] ^
+	    crc32c_table[5][(word >> 16) & 0xff] ^
+	    crc32c_table[4][(word >> 24) & 0xff] ^
+	    crc32c_table[3][(word >> 32) & 0xff] ^
+	    crc32c_table[2][(word >> 40) & 0xff] ^
+	    crc32c_table[1][(word >> 48) & 0xff] ^
+	    crc32c_table[0][word >> 56];
+    }
+    while (len-- > 0)
+	crc = crc32c_table[0][(crc ^ *buff++) & 0xff] ^ (crc >> 8);
+    return (unsigned int)crc ^ 0xffffffff;
+}	/* do_crc32c_iterate_sw */
+
+#if defined(__x86_64__)
+#define CRC32C_HW_Q(crc, p) \
+    __asm__("crc32q %1, %0" : "+r"(crc) : "rm"(*(const uint64_t *)(p)))
+#define CRC32C_HW_B(crc, p) \
+    __asm__("crc32b %1, %0" : "+r"(crc) : "rm"(*(const uint8_t *)(p)))
+
+static unsigned int
+do_crc32c_iterate_hw(const unsigned char *buff,
+		     int		 len,
+		     unsigned int	 old_crc)
+{
+    uint64_t crc0 = old_crc ^ 0xffffffff, crc1, crc2;
+    uint32_t crc32;
+    const unsigned char *end;
+
+    while (len > 0 && ((uintptr_t)buff & 0x7)) {
+	crc32 = crc0;
+	CRC32C_HW_B(crc32, buff);
+	crc0 = crc32;
+	buff++;
+	len--;
+    }
+    while (len >= CRC32C_LONG * 3) {
+	crc1 = crc2 = 0;
+	end = buff + CRC32C_LONG;
+	do {
+	    CRC32C_HW_Q(crc0, buff);
+	    CRC32C_HW_Q(crc1, buff + CRC32C_LONG);
+	    CRC32C_HW_Q(crc2, buff + CRC32C_LONG * 2);
+	    buff += 8;
+	} while (buff < end);
+	crc0 = crc32c_shift(crc32c_long, crc0) ^ crc1;
+	crc0 = crc32c_shift(crc32c_long, crc0) ^ crc2;
+	buff += CRC32C_LONG * 2;
+	len -= CRC32C_LONG * 3;
+    }
+    while (len >= CRC32C_SHORT * 3) {
+	crc1 = crc2 = 0;
+	end = buff + CRC32C_SHORT;
+	do {
+	    CRC32C_HW_Q(crc0, buff);
+	    CRC32C_HW_Q(crc1, buff + CRC32C_SHORT);
+	    CRC32C_HW_Q(crc2, buff + CRC32C_SHORT * 2);
+	    buff += 8;
+	} while (buff < end);
+	crc0 = crc32c_shift(crc32c_short, crc0) ^ crc1;
+	crc0 = crc32c_shift(crc32c_short, crc0) ^ crc2;
+	buff += CRC32C_SHORT * 2;
+	len -= CRC32C_SHORT * 3;
+    }
+    for (; len >= 8; len -= 8, buff += 8)
+	CRC32C_HW_Q(crc0, buff);
+    crc32 = crc0;
+    for (; len > 0; len--, buff++)
+	CRC32C_HW_B(crc32, buff);
+    return crc32 ^ 0xffffffff;
+}	/* do_crc32c_iterate_hw */
+#endif
+
+unsigned int
+do_crc32c_iterate(const unsigned char *buff,
+		  int		      len,
+		  unsigned int	      old_crc)
+{
+    pthread_once(&crc32c_once, crc32c_init);
+#if defined(__x86_64__)
+    if (likely(crc32c_have_hw))
+	return do_crc32c_iterate_hw(buff, len, old_crc);
+#endif
+    return do_crc32c_iterate_sw(buff, len, old_crc);
+}	/* do_crc32c_iterate */
+
+int
+do_crc32c_hw_available(void)
+{
+    pthread_once(&crc32c_once, crc32c_init);
+    return crc32c_have_hw;
+}	/* do_crc32c_hw_available */
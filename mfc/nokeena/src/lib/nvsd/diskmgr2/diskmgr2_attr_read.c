@@ -129,6 +129,7 @@ dm2_read_single_attr(MM_get_resp_t		*get,
     seek_uri_basename =
 	dm2_uri_basename((char *)nkn_cod_get_cnp(get->in_uol.cod));
 
+    dm2_md_batch_flush_cont(cont);
     if ((ret = dm2_open_attrpath(attr_pathname)) < 0) {
 	DBG_DM2S("Failed to open attribute file (%s): %d",
 		 attr_pathname, errno);
@@ -498,6 +499,7 @@ dm2_read_attr_file(dm2_container_t	*cont,
 	}
     }
     DM2_GET_ATTRPATH(cont, attrpath);
+    dm2_md_batch_flush_cont(cont);
     ct->ct_dm2_attrfile_open_cnt++;
     if ((ret = dm2_open_attrpath(attrpath)) < 0) {
 	DBG_DM2S("[cache_type=%s] Failed to open attribute file (%s): %d",
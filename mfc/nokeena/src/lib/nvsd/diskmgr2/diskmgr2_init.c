@@ -324,6 +324,7 @@ dm2_insert_cache_list(const char		*mountpt,
     dm2_ci_dev_rwlock_init(cache_info);
     snprintf(mutex_name, 40, "%s.ci_dm2_delete_mutex", cache_info->mgmt_name);;
     NKN_MUTEX_INITR(&cache_info->ci_dm2_delete_mutex, NULL, mutex_name);
+    dm2_md_batch_init_ci(cache_info);
     cache_type->ct_num++;
     dm2_ct_info_list_rwlock_wlock(cache_type);
     cache_type->ct_del_info_list =
@@ -747,6 +748,10 @@ dm2_register_cache_type_counters(int num_cache_types)
 	nkn_mon_add("dm2_preread_duplicate_skip_cnt", tier_name,
 		    &ct->ct_dm2_preread_duplicate_skip_cnt,
 		    sizeof(ct->ct_dm2_preread_duplicate_skip_cnt));
+	// seconds from preread start to the tier being fully in service
+	nkn_mon_add("dm2_preread_secs", tier_name,
+		    &ct->ct_dm2_preread_secs,
+		    sizeof(ct->ct_dm2_preread_secs));
 	nkn_mon_add(DM2_PREREAD_STAT_OPT_CNT_MON, tier_name,
 		    &ct->ct_dm2_stat_opt_not_found,
 		    sizeof(ct->ct_dm2_stat_opt_not_found));
@@ -1319,6 +1324,7 @@ DM2_init(void)
 
     dm2_start_reading_caches(num_cache_types);
     dm2_spawn_dm2_evict_thread();
+    dm2_spawn_md_batch_thread();
     return 0;
 }	/* DM2_init */
 
@@ -599,6 +599,22 @@ dm2_conthead_rwlock_runlock(dm2_container_head_t *ch,
     assert(*cont_head_locked == DM2_CONT_HEAD_RLOCKED);
 
     NKN_MUTEX_LOCKR(&ct->ct_dm2_conthead_hash_table_mutex);
+    dm2_conthead_rwlock_runlock_unsafe(ch, cont_head_locked);
+    NKN_MUTEX_UNLOCKR(&ct->ct_dm2_conthead_hash_table_mutex);
+
+    if (unlikely(dm2_show_locks))
+	DBG_DM2S("[pth=%ld/%ld] RW-RUNLOCK cont_head: %s",
+		 pthread_self(), gettid(), ch->ch_uri_dir);
+}	/* dm2_conthead_rwlock_runlock */
+
+
+void
+dm2_conthead_rwlock_runlock_unsafe(dm2_container_head_t *ch,
+				   int                  *cont_head_locked)
+{
+    int macro_ret;
+
+    assert(*cont_head_locked == DM2_CONT_HEAD_RLOCKED);
     assert(ch->ch_rwlock_nreaders > 0);
     assert(ch->ch_rwlock_wowner == 0);
     assert(ch->ch_rwlock_nwriters == 0);
@@ -614,12 +630,7 @@ dm2_conthead_rwlock_runlock(dm2_container_head_t *ch,
     }
 
     *cont_head_locked = DM2_CONT_HEAD_UNLOCKED;
-    NKN_MUTEX_UNLOCKR(&ct->ct_dm2_conthead_hash_table_mutex);
-
-    if (unlikely(dm2_show_locks))
-	DBG_DM2S("[pth=%ld/%ld] RW-RUNLOCK cont_head: %s",
-		 pthread_self(), gettid(), ch->ch_uri_dir);
-}	/* dm2_conthead_rwlock_runlock */
+}	/* dm2_conthead_rwlock_runlock_unsafe */
 
 
 void
@@ -106,6 +106,9 @@ int dm2_conthead_rwlock_rlock(dm2_container_head_t *cont_head,
 void dm2_conthead_rwlock_runlock(dm2_container_head_t *cont_head,
 			         dm2_cache_type_t *ct,
 			         int *cont_head_locked);
+/* WARNING: no hash table mutex called */
+void dm2_conthead_rwlock_runlock_unsafe(dm2_container_head_t *cont_head,
+					int *cont_head_locked);
 void dm2_conthead_rwlock_runlock_wlock(dm2_container_head_t *cont_head,
 				       dm2_cache_type_t *ct,
 				       int *cont_head_locked);
@@ -0,0 +1,584 @@
+/*
+ *	COPYRIGHT: Juniper Networks
+ *
+ * Group commit of DM2 disk extent and attribute writes.
+ *
+ * Each PUT of a small object writes one 512B disk extent into the container
+ * file and one attribute slot into the attribute file, each through its own
+ * O_DIRECT pwrite.  With batching enabled (dm2.md_batch_msecs > 0), these
+ * writes are copied into a per-container batch hung off the disk.  The
+ * batch is written when the disk has dm2.md_batch_bytes queued or when the
+ * oldest write has waited dm2.md_batch_msecs.  Writes to adjacent slots of
+ * the same file go out as one aligned pwritev().
+ *
+ * Crash consistency is the same as before:
+ *	- Raw data is still written synchronously before its extent is queued,
+ *	  so an on-disk extent never points at unwritten data.
+ *	- The container file of a batch is written before its attribute file,
+ *	  same as the extent before attribute order of dm2_write_content().
+ *	  If the container write fails, the attributes are not written.
+ *	- A crash loses at most the queued writes: those objects are not found
+ *	  at the next preread, as if the crash had happened before their PUT.
+ *	- If a write can not be queued for lack of memory, the container's
+ *	  queue is flushed and the write is done directly instead.
+ *
+ * Every other read or write of a container or attribute file first calls
+ * dm2_md_batch_flush_cont(), so nobody sees the file without the queued
+ * writes and in-place updates (stampout, hotness update) are not undone
+ * by a later flush.  It only waits when that container has writes queued
+ * or being written (c_md_flushing), never for the rest of the disk.  The
+ * batches of one container are written one at a time, in queue order.
+ *
+ * Lock order: container locks -> ci_md_flush_mutex -> ci_md_batch_mutex.
+ * Flushing never takes a container lock.
+ *
+ * Non-obvious coding conventions:
+ *	- All functions should begin with dm2_
+ *	- All functions have a name comment at the end of the function.
+ *	- All log messages use special logging macros
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/uio.h>
+#include <sys/prctl.h>
+
+#include "nkn_defs.h"
+#include "nkn_diskmgr2_local.h"
+#include "nkn_diskmgr2_disk_api.h"
+#include "nkn_debug.h"
+#include "nkn_assert.h"
+#include "diskmgr2_common.h"
+
+#define DM2_MD_BATCH_MAX_DISKS	256
+#define DM2_MD_BATCH_MAX_IOV	64	// coalesced writes per pwritev
+
+/* One queued write, DEV_BSIZE aligned */
+typedef struct dm2_md_seg {
+    struct dm2_md_seg	*ms_next;	// sorted by ms_off
+    off_t		ms_off;
+    int			ms_len;
+    char		*ms_buf;
+} dm2_md_seg_t;
+
+/* Queued writes of one container */
+typedef struct dm2_md_batch {
+    struct dm2_md_batch	*mb_next;	// ci_md_batch_head list
+    dm2_container_t	*mb_cont;
+    dm2_md_seg_t	*mb_segs[DM2_MD_NFILES];
+    uint64_t		mb_bytes;
+} dm2_md_batch_t;
+
+/* 0 disables batching: every extent/attribute write is a direct pwrite */
+int glob_dm2_md_batch_msecs = 10;
+int glob_dm2_md_batch_bytes = 256 * 1024;
+
+static dm2_cache_info_t *dm2_md_batch_cis[DM2_MD_BATCH_MAX_DISKS];
+static AO_t dm2_md_batch_ncis;
+static pthread_t dm2_md_batch_thread;
+static pthread_mutex_t dm2_md_batch_cond_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dm2_md_batch_cond = PTHREAD_COND_INITIALIZER;
+
+extern int glob_cachemgr_init_done;
+
+uint64_t glob_dm2_md_batch_queue_cnt,
+    glob_dm2_md_batch_overlap_cnt,
+    glob_dm2_md_batch_flush_cnt,
+    glob_dm2_md_batch_flush_size_cnt,
+    glob_dm2_md_batch_flush_inline_cnt,
+    glob_dm2_md_batch_flush_cont_cnt,
+    glob_dm2_md_batch_write_cnt,
+    glob_dm2_md_batch_write_bytes,
+    glob_dm2_md_batch_write_err,
+    glob_dm2_md_batch_open_err,
+    glob_dm2_md_batch_alloc_err;
+
+
+static uint64_t
+dm2_md_batch_now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}	/* dm2_md_batch_now_ms */
+
+
+void
+dm2_md_batch_init_ci(dm2_cache_info_t *ci)
+{
+    AO_t slot;
+    int ret;
+
+    ret = pthread_mutex_init(&ci->ci_md_batch_mutex, NULL);
+    assert(ret == 0);
+    ret = pthread_mutex_init(&ci->ci_md_flush_mutex, NULL);
+    assert(ret == 0);
+    ret = pthread_cond_init(&ci->ci_md_flush_cond, NULL);
+    assert(ret == 0);
+    ci->ci_md_batch_head = NULL;
+    ci->ci_md_batch_bytes = 0;
+
+    slot = AO_fetch_and_add1(&dm2_md_batch_ncis);
+    if (slot >= DM2_MD_BATCH_MAX_DISKS) {
+	/* Only the time threshold is lost; size and readers still flush */
+	DBG_DM2S("[name=%s] Too many disks for metadata batch thread",
+		 ci->mgmt_name);
+	return;
+    }
+    dm2_md_batch_cis[slot] = ci;
+}	/* dm2_md_batch_init_ci */
+
+
+static void
+dm2_md_batch_free(dm2_md_batch_t *b)
+{
+    dm2_md_seg_t *seg;
+    int f;
+
+    for (f = 0; f < DM2_MD_NFILES; f++) {
+	while ((seg = b->mb_segs[f]) != NULL) {
+	    b->mb_segs[f] = seg->ms_next;
+	    dm2_free(seg->ms_buf, seg->ms_len, DEV_BSIZE);
+	    dm2_free(seg, sizeof(*seg), DM2_NO_ALIGN);
+	}
+    }
+    dm2_free(b, sizeof(*b), DM2_NO_ALIGN);
+}	/* dm2_md_batch_free */
+
+
+/*
+ * Write the queued segments of one file, adjacent segments in one pwritev.
+ */
+static int
+dm2_md_batch_write_file(dm2_cache_info_t *ci,
+			int		 fd,
+			dm2_md_seg_t	 *seg,
+			const char	 *path)
+{
+    struct iovec iov[DM2_MD_BATCH_MAX_IOV];
+    off_t	 off;
+    ssize_t	 nbytes, len;
+    int		 niov, ret = 0;
+
+    while (seg) {
+	off = seg->ms_off;
+	len = 0;
+	niov = 0;
+	do {
+	    iov[niov].iov_base = seg->ms_buf;
+	    iov[niov].iov_len = seg->ms_len;
+	    len += seg->ms_len;
+	    niov++;
+	    seg = seg->ms_next;
+	} while (seg && seg->ms_off == off + len &&
+		 niov < DM2_MD_BATCH_MAX_IOV);
+
+	nbytes = pwritev(fd, iov, niov, off);
+	glob_dm2_md_batch_write_cnt++;
+	ci->ci_dm2_md_batch_write_cnt++;
+	if (nbytes != len) {
+	    ret = (nbytes == -1) ? -errno : -EIO;
+	    DBG_DM2S("IO ERROR:[name=%s] [file=%s] Batched metadata write "
+		     "@ %ld: expected=%ld got=%ld errno=%d",
+		     ci->mgmt_name, path, off, len, nbytes, -ret);
+	    NKN_ASSERT(ret != -EBADF);
+	    glob_dm2_md_batch_write_err++;
+	    ci->ci_dm2_md_batch_write_err++;
+	    return ret;
+	}
+	glob_dm2_md_batch_write_bytes += len;
+    }
+    return ret;
+}	/* dm2_md_batch_write_file */
+
+
+/*
+ * Container file first, then the attribute file.  Called with
+ * ci_md_flush_mutex held.
+ */
+static void
+dm2_md_batch_write(dm2_md_batch_t *b)
+{
+    dm2_container_t  *cont = b->mb_cont;
+    dm2_cache_info_t *ci = cont->c_dev_ci;
+    char	     *contpath, *attrpath;
+    int		     fd, ret = 0;
+
+    if (b->mb_segs[DM2_MD_CONT]) {
+	DM2_GET_CONTPATH(cont, contpath);
+	if ((fd = dm2_open(contpath, O_WRONLY, 0)) == -1) {
+	    ret = -errno;
+	    NKN_ASSERT(ret != -EMFILE);
+	    DBG_DM2S("[name=%s] Container open failed (%s): %d",
+		     ci->mgmt_name, contpath, ret);
+	    glob_dm2_md_batch_open_err++;
+	    goto attr_err;
+	}
+	nkn_mark_fd(fd, DM2_FD);
+	ret = dm2_md_batch_write_file(ci, fd, b->mb_segs[DM2_MD_CONT],
+				      contpath);
+	nkn_close_fd(fd, DM2_FD);
+	if (ret < 0)
+	    goto attr_err;
+    }
+
+    if (b->mb_segs[DM2_MD_ATTR]) {
+	DM2_GET_ATTRPATH(cont, attrpath);
+	if ((ret = dm2_open_attrpath(attrpath)) < 0) {
+	    DBG_DM2S("[name=%s] Failed to open attribute file (%s): %d",
+		     ci->mgmt_name, attrpath, ret);
+	    glob_dm2_md_batch_open_err++;
+	    goto attr_err;
+	}
+	fd = ret;
+	ret = dm2_md_batch_write_file(ci, fd, b->mb_segs[DM2_MD_ATTR],
+				      attrpath);
+	glob_dm2_attr_close_cnt++;
+	nkn_close_fd(fd, DM2_FD);
+	if (ret < 0)
+	    goto attr_err;
+    }
+    return;
+
+ attr_err:
+    /*
+     * The attribute file may be shorter than the queued end now; let the
+     * next append find the end with lseek() again.
+     */
+    pthread_mutex_lock(&ci->ci_md_batch_mutex);
+    cont->c_md_attr_end = 0;
+    pthread_mutex_unlock(&ci->ci_md_batch_mutex);
+}	/* dm2_md_batch_write */
+
+
+/*
+ * Write through when a write can not be queued.  The queued writes of the
+ * container go first, so that a later flush can not undo this one.
+ */
+static int
+dm2_md_batch_write_direct(dm2_container_t *cont,
+			  int		  file,
+			  const void	  *buf,
+			  int		  len,
+			  off_t		  off)
+{
+    dm2_cache_info_t *ci = cont->c_dev_ci;
+    char	     *path;
+    ssize_t	     nbytes;
+    int		     fd, ret = 0;
+
+    dm2_md_batch_flush_cont(cont);
+    if (file == DM2_MD_CONT) {
+	DM2_GET_CONTPATH(cont, path);
+	if ((fd = dm2_open(path, O_WRONLY, 0)) == -1) {
+	    ret = -errno;
+	    NKN_ASSERT(ret != -EMFILE);
+	    DBG_DM2S("[name=%s] Container open failed (%s): %d",
+		     ci->mgmt_name, path, ret);
+	    glob_dm2_md_batch_open_err++;
+	    return ret;
+	}
+    } else {
+	DM2_GET_ATTRPATH(cont, path);
+	if ((fd = dm2_open_attrpath(path)) < 0) {
+	    DBG_DM2S("[name=%s] Failed to open attribute file (%s): %d",
+		     ci->mgmt_name, path, fd);
+	    glob_dm2_md_batch_open_err++;
+	    return fd;
+	}
+    }
+    nkn_mark_fd(fd, DM2_FD);
+
+    nbytes = pwrite(fd, buf, len, off);
+    if (nbytes != len) {
+	ret = (nbytes == -1) ? -errno : -EIO;
+	DBG_DM2S("IO ERROR:[name=%s] [file=%s] Direct metadata write "
+		 "@ %ld: expected=%d got=%ld errno=%d",
+		 ci->mgmt_name, path, off, len, nbytes, -ret);
+	NKN_ASSERT(ret != -EBADF);
+	glob_dm2_md_batch_write_err++;
+	ci->ci_dm2_md_batch_write_err++;
+    } else if (file == DM2_MD_ATTR) {
+	pthread_mutex_lock(&ci->ci_md_batch_mutex);
+	if (off + len > cont->c_md_attr_end)
+	    cont->c_md_attr_end = off + len;
+	pthread_mutex_unlock(&ci->ci_md_batch_mutex);
+    }
+    if (file == DM2_MD_ATTR)
+	glob_dm2_attr_close_cnt++;
+    nkn_close_fd(fd, DM2_FD);
+    return ret;
+}	/* dm2_md_batch_write_direct */
+
+
+/*
+ * Queue one metadata write.  'buf' is copied; 'off' and 'len' must be
+ * DEV_BSIZE multiples.  A write inside an already queued segment updates
+ * it in place (extent appends, extra slots of a grown chunk).  Without
+ * memory for the queue the write is done directly, so the only errors
+ * returned are I/O errors.
+ */
+int
+dm2_md_batch_queue(dm2_container_t *cont,
+		   int		   file,
+		   const void	   *buf,
+		   int		   len,
+		   off_t	   off)
+{
+    dm2_cache_info_t *ci = cont->c_dev_ci;
+    dm2_md_batch_t   *b;
+    dm2_md_seg_t     *seg = NULL, **prev, *cur;
+    int		     kick = 0, overlap = 0;
+
+    NKN_ASSERT((off % DEV_BSIZE) == 0 && (len % DEV_BSIZE) == 0);
+ again:
+    if (seg == NULL) {
+	seg = dm2_calloc(1, sizeof(*seg), mod_dm2_md_batch_t);
+	if (seg == NULL)
+	    goto nomem;
+	if (dm2_posix_memalign((void *)&seg->ms_buf, DEV_BSIZE, len,
+			       mod_dm2_md_batch_t)) {
+	    dm2_free(seg, sizeof(*seg), DM2_NO_ALIGN);
+	    goto nomem;
+	}
+	seg->ms_off = off;
+	seg->ms_len = len;
+	memcpy(seg->ms_buf, buf, len);
+    }
+
+    pthread_mutex_lock(&ci->ci_md_batch_mutex);
+    if ((b = cont->c_md_batch) == NULL) {
+	b = dm2_calloc(1, sizeof(*b), mod_dm2_md_batch_t);
+	if (b == NULL) {
+	    pthread_mutex_unlock(&ci->ci_md_batch_mutex);
+	    dm2_free(seg->ms_buf, len, DEV_BSIZE);
+	    dm2_free(seg, sizeof(*seg), DM2_NO_ALIGN);
+	    goto nomem;
+	}
+	b->mb_cont = cont;
+	b->mb_next = ci->ci_md_batch_head;
+	ci->ci_md_batch_head = b;
+	cont->c_md_batch = b;
+    }
+
+    for (prev = &b->mb_segs[file]; (cur = *prev) != NULL;
+	 prev = &cur->ms_next) {
+	if (cur->ms_off + cur->ms_len <= off)
+	    continue;
+	if (cur->ms_off <= off && off + len <= cur->ms_off + cur->ms_len) {
+	    /* Inside a queued write: update it */
+	    memcpy(cur->ms_buf + (off - cur->ms_off), buf, len);
+	    pthread_mutex_unlock(&ci->ci_md_batch_mutex);
+	    dm2_free(seg->ms_buf, len, DEV_BSIZE);
+	    dm2_free(seg, sizeof(*seg), DM2_NO_ALIGN);
+	    glob_dm2_md_batch_queue_cnt++;
+	    return 0;
+	}
+	if (cur->ms_off < off + len)
+	    overlap = 1;
+	break;
+    }
+    if (overlap) {
+	/* Not expected: write out what is queued and start over */
+	pthread_mutex_unlock(&ci->ci_md_batch_mutex);
+	glob_dm2_md_batch_overlap_cnt++;
+	dm2_md_batch_flush_cont(cont);
+	overlap = 0;
+	goto again;
+    }
+    seg->ms_next = cur;
+    *prev = seg;
+    b->mb_bytes += len;
+    if (file == DM2_MD_ATTR && off + len > cont->c_md_attr_end)
+	cont->c_md_attr_end = off + len;
+
+    if (ci->ci_md_batch_bytes == 0)
+	ci->ci_md_batch_first_ms = dm2_md_batch_now_ms();
+    ci->ci_md_batch_bytes += len;
+    ci->ci_dm2_md_batch_queue_cnt++;
+    if (ci->ci_md_batch_bytes >= (uint64_t)glob_dm2_md_batch_bytes * 4)
+	kick = 2;
+    else if (ci->ci_md_batch_bytes >= (uint64_t)glob_dm2_md_batch_bytes)
+	kick = 1;
+    pthread_mutex_unlock(&ci->ci_md_batch_mutex);
+    glob_dm2_md_batch_queue_cnt++;
+
+    if (kick == 2) {
+	/* Flusher is behind the disk: push back on the PUT threads */
+	glob_dm2_md_batch_flush_inline_cnt++;
+	dm2_md_batch_flush_ci(ci);
+    } else if (kick == 1) {
+	pthread_mutex_lock(&dm2_md_batch_cond_mutex);
+	pthread_cond_signal(&dm2_md_batch_cond);
+	pthread_mutex_unlock(&dm2_md_batch_cond_mutex);
+    }
+    return 0;
+
+ nomem:
+    DBG_DM2S("[name=%s] Metadata batch allocation failed: %d, writing "
+	     "directly", ci->mgmt_name, len);
+    glob_dm2_md_batch_alloc_err++;
+    return dm2_md_batch_write_direct(cont, file, buf, len, off);
+}	/* dm2_md_batch_queue */
+
+
+/*
+ * Write one detached batch and let waiters of its container go on.
+ */
+static void
+dm2_md_batch_write_detached(dm2_md_batch_t *b)
+{
+    dm2_container_t  *cont = b->mb_cont;
+    dm2_cache_info_t *ci = cont->c_dev_ci;
+
+    dm2_md_batch_write(b);
+    dm2_md_batch_free(b);
+    pthread_mutex_lock(&ci->ci_md_batch_mutex);
+    cont->c_md_flushing = 0;
+    pthread_cond_broadcast(&ci->ci_md_flush_cond);
+    pthread_mutex_unlock(&ci->ci_md_batch_mutex);
+}	/* dm2_md_batch_write_detached */
+
+
+/*
+ * Write out every queued write of this disk.  A container whose previous
+ * batch is still being written by dm2_md_batch_flush_cont() keeps its
+ * writes queued for the next pass, so its batches stay in order.
+ */
+void
+dm2_md_batch_flush_ci(dm2_cache_info_t *ci)
+{
+    dm2_md_batch_t *head = NULL, **tail = &head, *b, **prev;
+
+    pthread_mutex_lock(&ci->ci_md_flush_mutex);
+    pthread_mutex_lock(&ci->ci_md_batch_mutex);
+    prev = &ci->ci_md_batch_head;
+    while ((b = *prev) != NULL) {
+	if (b->mb_cont->c_md_flushing) {
+	    prev = &b->mb_next;
+	    continue;
+	}
+	*prev = b->mb_next;
+	ci->ci_md_batch_bytes -= b->mb_bytes;
+	b->mb_cont->c_md_batch = NULL;
+	b->mb_cont->c_md_flushing = 1;
+	b->mb_next = NULL;
+	*tail = b;
+	tail = &b->mb_next;
+    }
+    pthread_mutex_unlock(&ci->ci_md_batch_mutex);
+
+    if (head) {
+	glob_dm2_md_batch_flush_cnt++;
+	ci->ci_dm2_md_batch_flush_cnt++;
+    }
+    while ((b = head) != NULL) {
+	head = b->mb_next;
+	dm2_md_batch_write_detached(b);
+    }
+    pthread_mutex_unlock(&ci->ci_md_flush_mutex);
+}	/* dm2_md_batch_flush_ci */
+
+
+/*
+ * Called before any other access to the container or attribute file of
+ * 'cont'.  On return, nothing queued for 'cont' is still in memory only.
+ */
+void
+dm2_md_batch_flush_cont(dm2_container_t *cont)
+{
+    dm2_cache_info_t *ci = cont->c_dev_ci;
+    dm2_md_batch_t   *b, **prev;
+
+    pthread_mutex_lock(&ci->ci_md_batch_mutex);
+    /* Wait only for a batch of this container already being written */
+    while (cont->c_md_flushing)
+	pthread_cond_wait(&ci->ci_md_flush_cond, &ci->ci_md_batch_mutex);
+    if ((b = cont->c_md_batch) != NULL) {
+	for (prev = &ci->ci_md_batch_head; *prev != b;
+	     prev = &(*prev)->mb_next)
+	    ;
+	*prev = b->mb_next;
+	ci->ci_md_batch_bytes -= b->mb_bytes;
+	cont->c_md_batch = NULL;
+	cont->c_md_flushing = 1;
+    }
+    pthread_mutex_unlock(&ci->ci_md_batch_mutex);
+
+    if (b) {
+	glob_dm2_md_batch_flush_cont_cnt++;
+	dm2_md_batch_write_detached(b);
+    }
+}	/* dm2_md_batch_flush_cont */
+
+
+static void *
+dm2_md_batch_thread_fn(void *arg)
+{
+    dm2_cache_info_t *ci;
+    struct timespec  ts;
+    uint64_t	     now, first, bytes;
+    AO_t	     i, n;
+    int		     msecs;
+
+    (void)arg;
+    prctl(PR_SET_NAME, "nvsd-dm2-md-batch", 0, 0, 0);
+
+    while (!glob_cachemgr_init_done) {
+	sleep(1);
+    }
+    while (1) {
+	msecs = glob_dm2_md_batch_msecs;
+	/* Check twice per period so no write waits much over 'msecs' */
+	clock_gettime(CLOCK_REALTIME, &ts);
+	if (msecs <= 0)		// batching off: only drain what is left
+	    ts.tv_nsec += 1000 * 1000000L;
+	else
+	    ts.tv_nsec += (msecs > 1 ? msecs / 2 : 1) * 1000000L;
+	ts.tv_sec += ts.tv_nsec / 1000000000L;
+	ts.tv_nsec %= 1000000000L;
+	pthread_mutex_lock(&dm2_md_batch_cond_mutex);
+	pthread_cond_timedwait(&dm2_md_batch_cond, &dm2_md_batch_cond_mutex,
+			       &ts);
+	pthread_mutex_unlock(&dm2_md_batch_cond_mutex);
+
+	now = dm2_md_batch_now_ms();
+	n = AO_load(&dm2_md_batch_ncis);
+	if (n > DM2_MD_BATCH_MAX_DISKS)
+	    n = DM2_MD_BATCH_MAX_DISKS;
+	for (i = 0; i < n; i++) {
+	    if ((ci = dm2_md_batch_cis[i]) == NULL)
+		continue;
+	    pthread_mutex_lock(&ci->ci_md_batch_mutex);
+	    bytes = ci->ci_md_batch_bytes;
+	    first = ci->ci_md_batch_first_ms;
+	    pthread_mutex_unlock(&ci->ci_md_batch_mutex);
+	    if (bytes == 0)
+		continue;
+	    /* Batching turned off at runtime flushes everything */
+	    if (bytes >= (uint64_t)glob_dm2_md_batch_bytes)
+		glob_dm2_md_batch_flush_size_cnt++;
+	    else if (msecs > 0 && now - first < (uint64_t)msecs)
+		continue;
+	    dm2_md_batch_flush_ci(ci);
+	}
+    }
+    return NULL;
+}	/* dm2_md_batch_thread_fn */
+
+
+void
+dm2_spawn_md_batch_thread(void)
+{
+    DBG_DM2W("Starting metadata batch thread: %d msecs, %d bytes",
+	     glob_dm2_md_batch_msecs, glob_dm2_md_batch_bytes);
+    pthread_create(&dm2_md_batch_thread, NULL, dm2_md_batch_thread_fn, NULL);
+}	/* dm2_spawn_md_batch_thread */
@@ -765,6 +765,8 @@ dm2_mgmt_cache_disable(dm2_cache_info_t	*ci)
 	    DBG_DM2A("Cache disable: %s start", ci->mgmt_name);
 	    ct->ct_dm2_cache_disabling = 1;
 	    dm2_ct_rwlock_wlock(ct);
+	    /* Queued extent/attribute writes go out before the disk goes */
+	    dm2_md_batch_flush_ci(ci);
 	    ret = dm2_mgmt_remove_disk(ci->mgmt_name);
 	    ci->state_overall = DM2_MGMT_STATE_CACHEABLE;
 	    /* Next time the disk is enabled, it needs to be read again */
@@ -30,6 +30,10 @@
 #define MAX_NS (MAX_URI_HDR_SIZE + DM2_MAX_MOUNTPT)
 
 int glob_dm2_num_preread_disk_threads = 3;
+int glob_dm2_preread_q_max = 8192;	// queued containers per disk
+uint64_t glob_dm2_preread_manifest_read_cnt;
+uint64_t glob_dm2_preread_manifest_write_cnt;
+uint64_t glob_dm2_preread_manifest_invalid_cnt;
 extern int glob_cachemgr_init_done;
 
 pthread_key_t g_dm2_preread_key;
@@ -330,6 +334,29 @@ dm2_preread_get_container(const char	    *fpath,
 }   /* dm2_preread_get_container */
 
 
+/*
+ * Keep at most glob_dm2_preread_q_max containers queued per disk, so
+ * the producer does not run ahead of the worker threads by the whole
+ * disk.  Returns non-zero if preread of this disk should stop.
+ */
+static int
+dm2_preread_q_throttle(dm2_cache_info_t *ci)
+{
+    struct timespec ts;
+
+    ts.tv_sec = 0;
+    ts.tv_nsec = 10 * 1000 * 1000;
+    while (glob_dm2_preread_q_max > 0 &&
+	   AO_load(&ci->ci_dm2_preread_q_depth) >=
+	   (AO_t)glob_dm2_preread_q_max) {
+	if (dm2_stop_preread || ci->ci_preread_errno || ci->ci_disabling ||
+	    ci->state_overall != DM2_MGMT_STATE_CACHE_RUNNING)
+	    return 1;
+	nanosleep(&ts, NULL);
+    }
+    return 0;
+}   /* dm2_preread_q_throttle */
+
 static int
 dm2_preread_inode(const char        *fpath,
 		  const struct stat *sb __attribute((unused)),
@@ -367,6 +394,7 @@ dm2_preread_inode(const char        *fpath,
     pr_entry->ci = ci;
     dm2_preread_cont_push_tail(pr_q, pr_entry);
     AO_fetch_and_add1(&ci->ci_dm2_preread_q_depth);
+    dm2_preread_q_throttle(ci);
     return 0;
 
 error_exit:
@@ -405,6 +433,233 @@ dm2_preread_get_top_dir(char *top_dir,
 }	/* dm2_preread_get_top_dir */
 
 
+/*
+ * Preread manifest
+ *
+ * At a clean shutdown every disk whose preread completed gets
+ * DM2_PREREAD_MANIFEST_FNAME at its mount point: a header, the name of
+ * each of its containers as dm2_preread_get_container() builds it, one
+ * per line, and an END line with the count.  The next preread queues
+ * those names instead of walking the file system.
+ *
+ * The manifest is removed as soon as it is read, so a later unclean
+ * stop falls back to the walk, and it is ignored unless it is strictly
+ * newer than the free block bitmap.  A manifest which is cut short is used
+ * and then followed by a walk; the preread hash drops the duplicates.
+ */
+#define DM2_PREREAD_MANIFEST_MAGIC	"DM2PRM1"
+
+typedef struct dm2_pr_manifest_arg {
+    dm2_cache_type_t *ct;
+    dm2_cache_info_t *ci;
+    FILE	     *fp;
+    uint64_t	     cnt;
+    int		     busy;
+} dm2_pr_manifest_arg_t;
+
+static void
+dm2_preread_manifest_name(char		   *path,
+			  dm2_cache_info_t *ci,
+			  const char	   *suffix)
+{
+    snprintf(path, PATH_MAX, "%s/%s%s", ci->ci_mountpt,
+	     DM2_PREREAD_MANIFEST_FNAME, suffix);
+}   /* dm2_preread_manifest_name */
+
+static void
+dm2_preread_manifest_cont(gpointer key,
+			  gpointer value,
+			  gpointer userdata)
+{
+    dm2_container_head_t  *ch = (dm2_container_head_t *)value;
+    dm2_pr_manifest_arg_t *arg = (dm2_pr_manifest_arg_t *)userdata;
+    dm2_container_t	  *cont;
+    GList		  *cl;
+    int			  cont_head_locked = DM2_CONT_HEAD_UNLOCKED;
+
+    UNUSED_ARGUMENT(key);
+    if (arg->busy)
+	return;
+    /* Called with the hash table mutex held, so take the read lock
+     * without waiting.  Someone is changing the container list: give up
+     * on this disk */
+    if (dm2_conthead_rwlock_rlock_unsafe(ch, arg->ct, &cont_head_locked,
+					 0)) {
+	arg->busy = 1;
+	return;
+    }
+    for (cl = ch->ch_cont_list; cl; cl = cl->next) {
+	cont = (dm2_container_t *)cl->data;
+	if (cont->c_dev_ci != arg->ci)
+	    continue;
+	fprintf(arg->fp, "%s/%s\n", ch->ch_uri_dir, NKN_CONTAINER_NAME);
+	arg->cnt++;
+    }
+    dm2_conthead_rwlock_runlock_unsafe(ch, &cont_head_locked);
+}   /* dm2_preread_manifest_cont */
+
+static void
+dm2_preread_write_manifest(dm2_cache_type_t *ct,
+			   dm2_cache_info_t *ci)
+{
+    char		  path[PATH_MAX], tmp_path[PATH_MAX];
+    dm2_pr_manifest_arg_t arg;
+    int			  macro_ret, err;
+
+    dm2_preread_manifest_name(path, ci, "");
+    dm2_preread_manifest_name(tmp_path, ci, ".tmp");
+
+    memset(&arg, 0, sizeof(arg));
+    arg.ct = ct;
+    arg.ci = ci;
+    if ((arg.fp = fopen(tmp_path, "w")) == NULL) {
+	DBG_DM2S("[mgmt=%s] Unable to create preread manifest %s: %d",
+		 ci->mgmt_name, tmp_path, errno);
+	return;
+    }
+    fprintf(arg.fp, "%s %s\n", DM2_PREREAD_MANIFEST_MAGIC, ci->mgmt_name);
+
+    NKN_MUTEX_LOCKR(&ct->ct_dm2_conthead_hash_table_mutex);
+    g_hash_table_foreach(ct->ct_dm2_conthead_hash_table,
+			 dm2_preread_manifest_cont, &arg);
+    NKN_MUTEX_UNLOCKR(&ct->ct_dm2_conthead_hash_table_mutex);
+
+    fprintf(arg.fp, "END %lu\n", arg.cnt);
+    err = ferror(arg.fp);
+    if (fflush(arg.fp) || fsync(fileno(arg.fp)))
+	err = 1;
+    fclose(arg.fp);
+    if (err || arg.busy || rename(tmp_path, path)) {
+	DBG_DM2S("[mgmt=%s] Preread manifest not written: err=%d busy=%d",
+		 ci->mgmt_name, err, arg.busy);
+	unlink(tmp_path);
+	return;
+    }
+    glob_dm2_preread_manifest_write_cnt++;
+    DBG_DM2W("[mgmt=%s] Preread manifest written: %lu containers",
+	     ci->mgmt_name, arg.cnt);
+}   /* dm2_preread_write_manifest */
+
+/*
+ * Called at clean shutdown
+ */
+void
+dm2_preread_write_manifests(void)
+{
+    dm2_cache_type_t *ct;
+    dm2_cache_info_t *ci;
+    GList	     *ci_obj;
+    int		     ptype_idx;
+
+    for (ptype_idx = 0; ptype_idx < glob_dm2_num_cache_types; ptype_idx++) {
+	ct = &g_cache2_types[ptype_idx];
+	dm2_ct_info_list_rwlock_rlock(ct);
+	for (ci_obj = ct->ct_info_list; ci_obj; ci_obj = ci_obj->next) {
+	    ci = (dm2_cache_info_t *)ci_obj->data;
+	    /* Only a clean preread put every container in the dictionary */
+	    if (ci->state_overall != DM2_MGMT_STATE_CACHE_RUNNING ||
+		ci->ci_disabling || !ci->ci_preread_stat_opt)
+		continue;
+	    dm2_preread_write_manifest(ct, ci);
+	}
+	dm2_ct_info_list_rwlock_runlock(ct);
+    }
+}   /* dm2_preread_write_manifests */
+
+void
+dm2_preread_remove_manifest(dm2_cache_info_t *ci)
+{
+    char path[PATH_MAX];
+
+    dm2_preread_manifest_name(path, ci, "");
+    unlink(path);
+}   /* dm2_preread_remove_manifest */
+
+/*
+ * Queue the containers listed in the manifest.  Returns 1 if the
+ * manifest was complete, so no directory walk is needed.
+ */
+static int
+dm2_preread_manifest_ci(dm2_cache_info_t *ci)
+{
+    char	    path[PATH_MAX], line[MAX_URI_SIZE + 16];
+    char	    magic[16], mgmt_name[DM2_MAX_MGMTNAME];
+    struct stat	    msb, bsb;
+    dm2_prq_entry_t *pr_entry;
+    FILE	    *fp;
+    uint64_t	    cnt = 0, end_cnt;
+    int		    len, done = 0;
+
+    dm2_preread_manifest_name(path, ci, "");
+    if ((fp = fopen(path, "r")) == NULL)
+	return 0;
+    /* One shot: whatever happens from here on, walk the next time */
+    unlink(path);
+
+    /* Equal times are stale: the bitmap may be from the same clock tick */
+    if (fstat(fileno(fp), &msb) || stat(ci->bm.bm_fname, &bsb) ||
+	bsb.st_mtim.tv_sec > msb.st_mtim.tv_sec ||
+	(bsb.st_mtim.tv_sec == msb.st_mtim.tv_sec &&
+	 bsb.st_mtim.tv_nsec >= msb.st_mtim.tv_nsec)) {
+	DBG_DM2W("[mgmt=%s] Preread manifest is stale", ci->mgmt_name);
+	goto invalid;
+    }
+    if (fgets(line, sizeof(line), fp) == NULL ||
+	sscanf(line, "%15s %15s", magic, mgmt_name) != 2 ||
+	strcmp(magic, DM2_PREREAD_MANIFEST_MAGIC) ||
+	strcmp(mgmt_name, ci->mgmt_name)) {
+	DBG_DM2W("[mgmt=%s] Preread manifest has a bad header", ci->mgmt_name);
+	goto invalid;
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+	if (sscanf(line, "END %lu", &end_cnt) == 1) {
+	    done = (end_cnt == cnt);
+	    break;
+	}
+	len = strlen(line);
+	if (len > 0 && line[len-1] == '\n')
+	    line[--len] = '\0';
+	if (line[0] != '/' || len >= MAX_URI_SIZE)
+	    break;
+	if (dm2_stop_preread || ci->ci_preread_errno || ci->ci_disabling ||
+	    ci->state_overall != DM2_MGMT_STATE_CACHE_RUNNING) {
+	    done = 1;	// stopping anyway, don't walk
+	    break;
+	}
+	pr_entry = dm2_calloc(1, sizeof(dm2_prq_entry_t),
+			      mod_dm2_preread_cont_name);
+	if (pr_entry == NULL) {
+	    ci->ci_preread_errno = -ENOMEM;
+	    done = 1;
+	    break;
+	}
+	memcpy(pr_entry->cont, line, len + 1);
+	pr_entry->ci = ci;
+	dm2_preread_cont_push_tail(&ci->ci_preread_arg.pr_q, pr_entry);
+	AO_fetch_and_add1(&ci->ci_dm2_preread_q_depth);
+	cnt++;
+	dm2_preread_q_throttle(ci);
+    }
+    fclose(fp);
+    if (!done) {
+	DBG_DM2W("[mgmt=%s] Preread manifest incomplete after %lu entries",
+		 ci->mgmt_name, cnt);
+	glob_dm2_preread_manifest_invalid_cnt++;
+	return 0;
+    }
+    ci->ci_preread_manifest = 1;
+    glob_dm2_preread_manifest_read_cnt++;
+    DBG_DM2W("[mgmt=%s] Preread from manifest: %lu containers",
+	     ci->mgmt_name, cnt);
+    return 1;
+
+ invalid:
+    fclose(fp);
+    glob_dm2_preread_manifest_invalid_cnt++;
+    return 0;
+}   /* dm2_preread_manifest_ci */
+
 void
 dm2_preread_ci(dm2_cache_info_t *ci)
 {
@@ -414,6 +669,10 @@ dm2_preread_ci(dm2_cache_info_t *ci)
 
     DBG_DM2W("Preread processing start: %s", ci->mgmt_name);
 
+    ci->ci_preread_manifest = 0;
+    if (dm2_preread_manifest_ci(ci))
+	goto end_ci;
+
     /* There could be multiple directory entries which match
      * the namespace:uuid string.  Only read in active namespaces */
     if ((dirp = opendir(ci->ci_mountpt)) == NULL) {
@@ -438,7 +697,9 @@ dm2_preread_ci(dm2_cache_info_t *ci)
 	    break;
 
 	if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, "..") ||
-	    !strcmp(ent->d_name, DM2_BITMAP_FNAME))
+	    !strcmp(ent->d_name, DM2_BITMAP_FNAME) ||
+	    !strncmp(ent->d_name, DM2_PREREAD_MANIFEST_FNAME,
+		     strlen(DM2_PREREAD_MANIFEST_FNAME)))
 	    continue;
 
 	/* . .. freeblks lost+found are all present */
@@ -569,6 +830,7 @@ dm2_preread_main_thread(void *arg)
     pthread_attr_t	 attr;
     int			 i, num_threads = 0;
     int			 ret = 0, stacksize = 4*1024*1024;
+    time_t		 start_ts;
 
     /* Make a note that preread threads are active. We should
      * not be starting another set of preread threads */
@@ -584,6 +846,7 @@ dm2_preread_main_thread(void *arg)
     while (!glob_cachemgr_init_done) {
 	sleep(1);
     }
+    start_ts = nkn_cur_ts;
 
     /* create a queue for the worker threads to pick up the
      * container file to be read */
@@ -663,6 +926,7 @@ dm2_preread_main_thread(void *arg)
 	free_active_uid_list(ns_list);
 #endif
     if (!ci->ci_disabling) {
+	ci->ci_preread_secs = nkn_cur_ts - start_ts;
 	ci->ci_preread_done = 1;
 	AO_fetch_and_add1(&ct->ct_num_caches_preread_done);
     }
@@ -755,6 +1019,8 @@ dm2_start_reading_caches(int num_cache_types)
 		ci = (dm2_cache_info_t *)ci_obj->data;
 		if (ci->state_overall != DM2_MGMT_STATE_CACHE_RUNNING)
 		    continue;
+		/* The cache changes unseen by preread from here on */
+		dm2_preread_remove_manifest(ci);
 		ci->ci_preread_done = 1;
 		AO_fetch_and_add1(&ct->ct_num_caches_preread_done);
 	    }
@@ -0,0 +1,505 @@
+/*
+ * dm2_md_batch_bench.c - Small object ingest: extent and attribute writes
+ *	one pwrite each (as dm2_write_disk_extent()/dm2_write_attr()) against
+ *	the group commit of diskmgr2_md_batch.c.
+ *
+ *	Each object is one O_DIRECT data write to a sparse "raw" file, one
+ *	512B disk extent into its container file and one attribute slot into
+ *	its attribute file.  Objects go round robin over -c container
+ *	directories.  Container and attribute files grow in chunks the way
+ *	dm2_grow_container_size()/dm2_grow_attribute_size() do.
+ *
+ *	In batch mode, metadata writes are queued per container, sorted by
+ *	offset, and a flusher thread writes them (container file first) with
+ *	one pwritev per run of adjacent slots when -b bytes are queued or the
+ *	oldest write is -m msecs old.
+ *
+ *	Run it on a loopback device or on a sparse file backed filesystem:
+ *	  truncate -s 4G /tmp/dm2.img && mkfs.ext4 -F /tmp/dm2.img
+ *	  mount -o loop /tmp/dm2.img /mnt/dm2
+ *
+ *	build:
+ *	  cc -O2 -D_GNU_SOURCE -o dm2_md_batch_bench dm2_md_batch_bench.c \
+ *		-lpthread -lrt
+ *
+ *	usage: dm2_md_batch_bench [-d dir] [-n objects] [-c containers]
+ *		[-s object_size] [-m msecs] [-b bytes] [-M direct|batch]
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <assert.h>
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+
+#define DEV_BSIZE		512
+#define DM2_DISK_EXT_SIZE	DEV_BSIZE
+#define DM2_ATTR_TOT_DISK_SIZE	(4*1024 + DEV_BSIZE)
+#define DM2_MD_CONT		0
+#define DM2_MD_ATTR		1
+#define DM2_MD_NFILES		2
+#define DM2_MD_BATCH_MAX_IOV	64	// as diskmgr2_md_batch.c
+
+static const char *dir = ".";
+static long nobjs = 20000;
+static int ncont = 64;
+static int obj_size = 32 * 1024;
+static int batch_msecs = 10;
+static int batch_bytes = 256 * 1024;
+static int o_direct = O_DIRECT;
+
+typedef struct seg {
+    struct seg	*next;
+    off_t	off;
+    int		len;
+    char	*buf;
+} seg_t;
+
+typedef struct cont {
+    char	path[DM2_MD_NFILES][PATH_MAX];
+    int		fd[DM2_MD_NFILES];
+    off_t	cont_sz;		// container file end (c_cont_sz)
+    off_t	attr_end;		// attribute file end (c_md_attr_end)
+    off_t	ext_slots[64];		// free slots of the last grown chunk
+    int		next_ext, n_ext;
+    off_t	attr_slots[16];
+    int		next_attr, n_attr;
+    seg_t	*segs[DM2_MD_NFILES];
+} cont_t;
+
+static cont_t *conts;
+static pthread_mutex_t batch_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t flush_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t batch_cond = PTHREAD_COND_INITIALIZER;
+static uint64_t batch_queued, batch_first_ms;
+static volatile int stop;
+static uint64_t md_syscalls, md_bytes, flushes;
+
+static uint64_t
+now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static double
+now_secs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+static void *
+xalign(int len)
+{
+    void *p;
+
+    if (posix_memalign(&p, DEV_BSIZE, len))
+	abort();
+    memset(p, 0, len);
+    return p;
+}
+
+/* as dm2_grow_container_size() for a disk */
+static int
+grow_container_size(off_t cont_sz)
+{
+    if (cont_sz == 8*1024)
+	return 4*1024;
+    if (cont_sz == 12*1024)
+	return 8*1024;
+    if (cont_sz == 20*1024)
+	return 16*1024;
+    if (cont_sz >= 36*1024)
+	return 32*1024;
+    return 512;
+}
+
+/* as dm2_grow_attribute_size() */
+static int
+grow_attribute_chunks(off_t seek_off)
+{
+    if (seek_off == 0)
+	return 2;
+    if (seek_off == 2*DM2_ATTR_TOT_DISK_SIZE)
+	return 4;
+    if (seek_off == 6*DM2_ATTR_TOT_DISK_SIZE)
+	return 8;
+    if (seek_off >= 14*DM2_ATTR_TOT_DISK_SIZE)
+	return 16;
+    return 1;
+}
+
+static void
+md_pwritev(int fd, struct iovec *iov, int niov, off_t off, ssize_t len)
+{
+    ssize_t nbytes;
+
+    nbytes = pwritev(fd, iov, niov, off);
+    if (nbytes != len) {
+	fprintf(stderr, "pwritev @ %ld: %zd/%zd: %s\n", (long)off, nbytes, len,
+		strerror(errno));
+	exit(1);
+    }
+    md_syscalls++;
+    md_bytes += len;
+}
+
+/* as dm2_md_batch_write_file() */
+static void
+write_segs(int fd, seg_t *seg)
+{
+    struct iovec iov[DM2_MD_BATCH_MAX_IOV];
+    off_t off;
+    ssize_t len;
+    int niov;
+
+    while (seg) {
+	off = seg->off;
+	len = 0;
+	niov = 0;
+	do {
+	    iov[niov].iov_base = seg->buf;
+	    iov[niov].iov_len = seg->len;
+	    len += seg->len;
+	    niov++;
+	    seg = seg->next;
+	} while (seg && seg->off == off + len && niov < DM2_MD_BATCH_MAX_IOV);
+	md_pwritev(fd, iov, niov, off, len);
+    }
+}
+
+static void
+flush_all(void)
+{
+    seg_t *segs[ncont][DM2_MD_NFILES], *seg, *next;
+    int i, f, any = 0;
+
+    pthread_mutex_lock(&flush_mutex);
+    pthread_mutex_lock(&batch_mutex);
+    for (i = 0; i < ncont; i++) {
+	for (f = 0; f < DM2_MD_NFILES; f++) {
+	    segs[i][f] = conts[i].segs[f];
+	    conts[i].segs[f] = NULL;
+	    any |= segs[i][f] != NULL;
+	}
+    }
+    batch_queued = 0;
+    pthread_mutex_unlock(&batch_mutex);
+
+    for (i = 0; i < ncont; i++) {
+	/* Container file first */
+	for (f = 0; f < DM2_MD_NFILES; f++) {
+	    write_segs(conts[i].fd[f], segs[i][f]);
+	    for (seg = segs[i][f]; seg; seg = next) {
+		next = seg->next;
+		free(seg->buf);
+		free(seg);
+	    }
+	}
+    }
+    if (any)
+	flushes++;
+    pthread_mutex_unlock(&flush_mutex);
+}
+
+/* as dm2_md_batch_queue() */
+static void
+md_queue(cont_t *c, int file, const void *buf, int len, off_t off)
+{
+    seg_t *seg, **prev, *cur;
+    int kick = 0;
+
+    seg = calloc(1, sizeof(*seg));
+    seg->buf = xalign(len);
+    seg->off = off;
+    seg->len = len;
+    memcpy(seg->buf, buf, len);
+
+    pthread_mutex_lock(&batch_mutex);
+    for (prev = &c->segs[file]; (cur = *prev) != NULL; prev = &cur->next) {
+	if (cur->off + cur->len <= off)
+	    continue;
+	if (cur->off <= off && off + len <= cur->off + cur->len) {
+	    memcpy(cur->buf + (off - cur->off), buf, len);
+	    pthread_mutex_unlock(&batch_mutex);
+	    free(seg->buf);
+	    free(seg);
+	    return;
+	}
+	assert(cur->off >= off + len);
+	break;
+    }
+    seg->next = cur;
+    *prev = seg;
+    if (batch_queued == 0)
+	batch_first_ms = now_ms();
+    batch_queued += len;
+    if (batch_queued >= (uint64_t)batch_bytes * 4)
+	kick = 2;
+    else if (batch_queued >= (uint64_t)batch_bytes)
+	kick = 1;
+    pthread_mutex_unlock(&batch_mutex);
+
+    if (kick == 2) {
+	flush_all();
+    } else if (kick == 1) {
+	pthread_cond_signal(&batch_cond);
+    }
+}
+
+static void *
+flusher(void *arg)
+{
+    struct timespec ts;
+    uint64_t queued, first;
+
+    (void)arg;
+    while (!stop) {
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_nsec += (batch_msecs > 1 ? batch_msecs / 2 : 1) * 1000000L;
+	ts.tv_sec += ts.tv_nsec / 1000000000L;
+	ts.tv_nsec %= 1000000000L;
+	pthread_mutex_lock(&batch_mutex);
+	pthread_cond_timedwait(&batch_cond, &batch_mutex, &ts);
+	queued = batch_queued;
+	first = batch_first_ms;
+	pthread_mutex_unlock(&batch_mutex);
+	if (queued == 0)
+	    continue;
+	if (queued < (uint64_t)batch_bytes &&
+	    now_ms() - first < (uint64_t)batch_msecs)
+	    continue;
+	flush_all();
+    }
+    return NULL;
+}
+
+static void
+md_write(int batched, cont_t *c, int file, void *buf, int len, off_t off)
+{
+    struct iovec iov;
+
+    if (batched) {
+	md_queue(c, file, buf, len, off);
+    } else {
+	iov.iov_base = buf;
+	iov.iov_len = len;
+	md_pwritev(c->fd[file], &iov, 1, off, len);
+    }
+}
+
+static void
+open_files(const char *mode)
+{
+    char path[PATH_MAX];
+    char *hdr;
+    int i, f;
+
+    hdr = xalign(8*1024);
+    for (i = 0; i < ncont; i++) {
+	cont_t *c = &conts[i];
+
+	memset(c, 0, sizeof(*c));
+	snprintf(path, sizeof(path), "%s/bench_%s_%d", dir, mode, i);
+	mkdir(path, 0755);
+	snprintf(c->path[DM2_MD_CONT], PATH_MAX, "%s/bench_%s_%d/container",
+		 dir, mode, i);
+	snprintf(c->path[DM2_MD_ATTR], PATH_MAX,
+		 "%s/bench_%s_%d/attributes-2", dir, mode, i);
+	for (f = 0; f < DM2_MD_NFILES; f++) {
+	    unlink(c->path[f]);
+	    c->fd[f] = open(c->path[f], O_RDWR | O_CREAT | o_direct, 0644);
+	    if (c->fd[f] == -1) {
+		perror(c->path[f]);
+		exit(1);
+	    }
+	}
+	/* Container header, written when the container is created */
+	if (pwrite(c->fd[DM2_MD_CONT], hdr, 8*1024, 0) != 8*1024) {
+	    perror("container header");
+	    exit(1);
+	}
+	c->cont_sz = 8*1024;
+    }
+    free(hdr);
+}
+
+static void
+close_files(const char *mode)
+{
+    char path[PATH_MAX];
+    int i, f;
+
+    for (i = 0; i < ncont; i++) {
+	for (f = 0; f < DM2_MD_NFILES; f++) {
+	    close(conts[i].fd[f]);
+	    unlink(conts[i].path[f]);
+	}
+	snprintf(path, sizeof(path), "%s/bench_%s_%d", dir, mode, i);
+	rmdir(path);
+    }
+}
+
+static void
+run(const char *mode)
+{
+    char raw_path[PATH_MAX];
+    char *data, *ext, *attr;
+    pthread_t tid;
+    double t0, t;
+    off_t loff, raw_off = 0;
+    long n;
+    int batched = !strcmp(mode, "batch");
+    int raw_fd, write_len, chunks, i;
+    cont_t *c;
+
+    open_files(mode);
+    snprintf(raw_path, sizeof(raw_path), "%s/bench_%s_raw", dir, mode);
+    raw_fd = open(raw_path, O_RDWR | O_CREAT | o_direct, 0644);
+    if (raw_fd == -1 ||
+	ftruncate(raw_fd, (off_t)nobjs * obj_size) != 0) {	// sparse
+	perror(raw_path);
+	exit(1);
+    }
+    data = xalign(obj_size);
+    ext = xalign(32*1024);
+    attr = xalign(16 * DM2_ATTR_TOT_DISK_SIZE);
+    md_syscalls = md_bytes = flushes = 0;
+    stop = 0;
+    if (batched)
+	pthread_create(&tid, NULL, flusher, NULL);
+
+    t0 = now_secs();
+    for (n = 0; n < nobjs; n++) {
+	c = &conts[n % ncont];
+
+	/* Raw data first, synchronously, as dm2_write_content() */
+	memset(data, n, 64);
+	if (pwrite(raw_fd, data, obj_size, raw_off) != obj_size) {
+	    perror("raw write");
+	    exit(1);
+	}
+	raw_off += obj_size;
+
+	/* Disk extent, as dm2_write_disk_extent() */
+	memset(ext, 0, DM2_DISK_EXT_SIZE);
+	memcpy(ext, &n, sizeof(n));
+	if (c->next_ext < c->n_ext) {
+	    loff = c->ext_slots[c->next_ext++];
+	    write_len = DM2_DISK_EXT_SIZE;
+	} else {
+	    loff = c->cont_sz;
+	    write_len = grow_container_size(c->cont_sz);
+	    memset(ext + DM2_DISK_EXT_SIZE, 0, write_len - DM2_DISK_EXT_SIZE);
+	    c->n_ext = 0;
+	    c->next_ext = 0;
+	    for (i = DM2_DISK_EXT_SIZE; i < write_len; i += DM2_DISK_EXT_SIZE)
+		c->ext_slots[c->n_ext++] = loff + i;
+	    c->cont_sz += write_len;
+	}
+	md_write(batched, c, DM2_MD_CONT, ext, write_len, loff);
+
+	/* Attribute, as dm2_write_attr() */
+	memcpy(attr, &n, sizeof(n));
+	if (c->next_attr < c->n_attr) {
+	    loff = c->attr_slots[c->next_attr++];
+	    write_len = DM2_ATTR_TOT_DISK_SIZE;
+	} else {
+	    loff = c->attr_end;
+	    chunks = grow_attribute_chunks(loff);
+	    write_len = chunks * DM2_ATTR_TOT_DISK_SIZE;
+	    c->n_attr = 0;
+	    c->next_attr = 0;
+	    for (i = 1; i < chunks; i++)
+		c->attr_slots[c->n_attr++] = loff + i * DM2_ATTR_TOT_DISK_SIZE;
+	    c->attr_end += write_len;
+	}
+	md_write(batched, c, DM2_MD_ATTR, attr, write_len, loff);
+    }
+    if (batched) {
+	stop = 1;
+	pthread_cond_signal(&batch_cond);
+	pthread_join(tid, NULL);
+	flush_all();
+    }
+    t = now_secs() - t0;
+
+    printf("%-6s %8ld objs %7.2f secs %9.0f objs/s  md writes %8lu "
+	   "(%.3f/obj, %6.1f KB avg)  flushes %lu\n",
+	   mode, nobjs, t, nobjs / t, (unsigned long)md_syscalls,
+	   (double)md_syscalls / nobjs,
+	   md_syscalls ? md_bytes / 1024.0 / md_syscalls : 0.0,
+	   (unsigned long)flushes);
+
+    close(raw_fd);
+    unlink(raw_path);
+    close_files(mode);
+    free(data);
+    free(ext);
+    free(attr);
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *only = 0;
+    int c;
+
+    while ((c = getopt(argc, argv, "d:n:c:s:m:b:M:")) != -1) {
+	switch (c) {
+	case 'd':
+	    dir = optarg;
+	    break;
+	case 'n':
+	    nobjs = atol(optarg);
+	    break;
+	case 'c':
+	    ncont = atoi(optarg);
+	    break;
+	case 's':
+	    obj_size = atoi(optarg) & ~(DEV_BSIZE - 1);
+	    break;
+	case 'm':
+	    batch_msecs = atoi(optarg);
+	    break;
+	case 'b':
+	    batch_bytes = atoi(optarg);
+	    break;
+	case 'M':
+	    only = optarg;
+	    break;
+	default:
+	    fprintf(stderr, "usage: %s [-d dir] [-n objects] [-c containers] "
+		    "[-s object_size] [-m msecs] [-b bytes] "
+		    "[-M direct|batch]\n", argv[0]);
+	    return 1;
+	}
+    }
+    if (ncont < 1 || obj_size < DEV_BSIZE)
+	return 1;
+    conts = calloc(ncont, sizeof(*conts));
+
+    if (!only || !strcmp(only, "direct"))
+	run("direct");
+    if (!only || !strcmp(only, "batch"))
+	run("batch");
+    return 0;
+}
+
+/*
+ * End of dm2_md_batch_bench.c
+ */
@@ -1412,6 +1412,7 @@ dm2_read_cont_extents_all_uris2(dm2_container_head_t	*cont_head,
 	    goto free_stoken;
 	}
     }
+    dm2_md_batch_flush_cont(cont);
     cfd = dm2_open(cont_pathname, O_RDWR | O_CREAT, 0644);
     if (cfd == -1) {
 	ret = -errno;
@@ -1605,8 +1606,8 @@ dm2_read_cont_extents_all_uris2(dm2_container_head_t	*cont_head,
 		ext->ext_start_sector = dext_v2->dext_start_sector;
 		ext->ext_cont_off = secnum;
 		ext->ext_flags |= DM2_EXT_FLAG_INUSE;
-		ext->ext_flags |= (dext_v2->dext_header.dext_flags & DM2_DISK_EXT_FLAG_CHKSUM) ?
-		    DM2_EXT_FLAG_CHKSUM : 0;
+		ext->ext_flags |=
+		    DM2_DEXT_TO_EXT_FLAGS(dext_v2->dext_header.dext_flags);
 		ext->ext_read_size = disk_block_size / (8 * DM2_EXT_RDSZ_MULTIPLIER);
 	    }
 	    /*
@@ -2254,6 +2255,7 @@ dm2_stampout_attr(DM2_uri_t *uri_head)
 	return 0;
     }
     loff = uri_head->uri_at_off * DEV_BSIZE;
+    dm2_md_batch_flush_cont(cont);
     if ((ret = dm2_open_attrpath(attrpath)) < 0) {
 	DBG_DM2S("[name=%s] Failed to open attribute file (%s): %d",
 		 cont->c_dev_ci->mgmt_name, attrpath, ret);
@@ -2464,6 +2466,7 @@ dm2_stampout_extents(DM2_uri_t *uri_head)
     int  cfd, ret = 0;
 
     DM2_GET_CONTPATH(cont, cont_pathname);
+    dm2_md_batch_flush_cont(cont);
 
     cfd = dm2_open(cont_pathname, O_RDWR | O_CREAT, 0644);
     if (cfd == -1) {
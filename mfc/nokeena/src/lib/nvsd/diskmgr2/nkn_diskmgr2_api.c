@@ -92,6 +92,7 @@ int dm2_show_locks = 0;
 int dm2_verify_attr_on_update = 1;
 int dm2_perform_put_chksum = 1;
 int dm2_perform_get_chksum = 1;
+int dm2_put_chksum_crc32c = 1;		// new extents use CRC32C
 int dm2_assert_for_disk_inconsistency = 1;
 int glob_dm2_throttle_writes = 0;
 int glob_dm2_small_write_enable;
@@ -702,6 +703,10 @@ dm2_register_disk_counters(dm2_cache_info_t *ci,
 		sizeof(ci->ci_dm2_preread_q_depth));
     nkn_mon_add(DM2_PREREAD_DONE_MON, ci->mgmt_name,
 		&ci->ci_preread_done, sizeof(ci->ci_preread_done));
+    nkn_mon_add("dm2_preread_manifest", ci->mgmt_name,
+		&ci->ci_preread_manifest, sizeof(ci->ci_preread_manifest));
+    nkn_mon_add("dm2_preread_secs", ci->mgmt_name,
+		&ci->ci_preread_secs, sizeof(ci->ci_preread_secs));
     snprintf(buf, sizeof(buf), "disk.%s.preread.queue_depth",
 	     ci->mgmt_name);
     nkn_mon_add(buf, "dictionary", &ci->ci_dm2_preread_q_depth,
@@ -2743,6 +2748,21 @@ dm2_find_free_block(MM_put_data_t    *put,
     return ret;
 }	/* dm2_find_free_block */
 
+/*
+ * Checksum of one piece of a 1/8 block chunk for a V2 extent.  New
+ * extents use CRC32C; extents written before it keep the XOR sum.
+ */
+static inline uint32_t
+dm2_ext_csum32(int	    crc32c,
+	       const void   *buf,
+	       int	    len,
+	       uint32_t	    old_checksum)
+{
+    if (crc32c)
+	return do_crc32c_iterate(buf, len, old_checksum);
+    return do_csum32_iterate_aligned(buf, len, old_checksum);
+}	/* dm2_ext_csum32 */
+
 static void
 dm2_modify_disk_extent(const MM_put_data_t       *put,
 		       const DM2_uri_t		 *uri_head,
@@ -2764,7 +2784,10 @@ dm2_modify_disk_extent(const MM_put_data_t       *put,
     dext_v2 = (DM2_disk_extent_v2_t *)dext_in;
     if (dm2_perform_put_chksum) {
 	/* Technically 0 is a valid checksum */
-	dext_v2->dext_header.dext_flags |= DM2_DISK_EXT_FLAG_CHKSUM;
+	if (old_ext->ext_flags & DM2_EXT_FLAG_CRC32C)
+	    dext_v2->dext_header.dext_flags |= DM2_DISK_EXT_FLAG_CRC32C;
+	else
+	    dext_v2->dext_header.dext_flags |= DM2_DISK_EXT_FLAG_CHKSUM;
 	for (i = 0; i < 8; i++)
 	    dext_v2->dext_ext_checksum[i] =old_ext->ext_csum.ext_v2_checksum[i];
 	for (i = csum_idx; i < (csum_idx + num_idx); i++)
@@ -2811,6 +2834,7 @@ dm2_create_disk_extent(const MM_put_data_t	 *put,
 		       const off_t		 put_offset,
 		       const off_t		 partial_length,
 		       const uint32_t		 *ext_v2_checksum,
+		       const int		 crc32c,
 		       const nkn_provider_type_t ptype,
 		       void			 *dext_in)
 {
@@ -2827,7 +2851,10 @@ dm2_create_disk_extent(const MM_put_data_t	 *put,
     dext_v2 = (DM2_disk_extent_v2_t *)dext_in;
     if (dm2_perform_put_chksum) {
 	/* Technically 0 is a valid checksum */
-	dext_v2->dext_header.dext_flags |= DM2_DISK_EXT_FLAG_CHKSUM;
+	if (crc32c)
+	    dext_v2->dext_header.dext_flags |= DM2_DISK_EXT_FLAG_CRC32C;
+	else
+	    dext_v2->dext_header.dext_flags |= DM2_DISK_EXT_FLAG_CHKSUM;
 	for (i = 0; i < 8; i++)
 	    dext_v2->dext_ext_checksum[i] = ext_v2_checksum[i];
     }
@@ -3166,21 +3193,25 @@ dm2_write_disk_extent(DM2_uri_t		*uri_head,
     char	    *name = cont->c_dev_ci->mgmt_name;
     char	    *contpath;
     off_t	    loff;
-    int		    write_len, nbytes, cfd, new_extent = 1;
+    int		    write_len, nbytes, cfd = -1, new_extent = 1;
     int		    ret = 0, appending = 0;
 
     NKN_ASSERT(cont->c_rwlock.__data.__writer == gettid());
     DM2_GET_CONTPATH(cont, contpath);
 
-    if ((cfd = dm2_open(contpath, O_WRONLY, 0)) == -1) {
-	ret = -errno;
-	NKN_ASSERT(ret != -EMFILE);
-	DBG_DM2S("Container open failed (%s): %d", contpath, ret);
-	glob_dm2_container_open_err++;
-	goto error_unlock;
+    if (!dm2_md_batch_enabled()) {
+	/* Batching may just have been turned off */
+	dm2_md_batch_flush_cont(cont);
+	if ((cfd = dm2_open(contpath, O_WRONLY, 0)) == -1) {
+	    ret = -errno;
+	    NKN_ASSERT(ret != -EMFILE);
+	    DBG_DM2S("Container open failed (%s): %d", contpath, ret);
+	    glob_dm2_container_open_err++;
+	    goto error_unlock;
+	}
+	nkn_mark_fd(cfd, DM2_FD);
+	glob_dm2_container_open_cnt++;
     }
-    nkn_mark_fd(cfd, DM2_FD);
-    glob_dm2_container_open_cnt++;
 
     if (ext->ext_cont_off == DM2_EXT_INIT_CONT_OFF) {
 	if ((loff = dm2_ext_slot_pop_head(cont)) == -1) {
@@ -3203,7 +3234,16 @@ dm2_write_disk_extent(DM2_uri_t		*uri_head,
 	write_len = DM2_DISK_EXT_SIZE;
     }
     glob_dm2_container_write_cnt++;
-    nbytes = pwrite(cfd, dext, write_len, loff);
+    if (cfd == -1) {
+	/* Batched: written by dm2_md_batch_flush_*() */
+	if ((ret = dm2_md_batch_queue(cont, DM2_MD_CONT, dext, write_len,
+				      loff)) < 0) {
+	    glob_dm2_container_write_err++;
+	    goto error_unlock;
+	}
+	nbytes = write_len;
+    } else
+	nbytes = pwrite(cfd, dext, write_len, loff);
     if (nbytes != write_len) {
 	ret = -errno;
 	DBG_DM2S("IO ERROR:[name=%s] [contname=%s] Incomplete extent "
@@ -3248,12 +3288,28 @@ dm2_delete_disk_extent(DM2_uri_t    *uri_head,
     DM2_disk_extent_header_t *dhdr = (DM2_disk_extent_header_t *)dext;
     char	    *name = cont->c_dev_ci->mgmt_name;
     char	    *contpath;
-    int		    nbytes, cfd, ret = 0;
+    int		    nbytes, cfd = -1, ret = 0;
 
     NKN_ASSERT(cont->c_rwlock.__data.__writer == gettid());
 
     DM2_GET_CONTPATH(cont, contpath);
 
+    if (dm2_md_batch_enabled()) {
+	/* Lands on the queued extent write, if it is still queued */
+	glob_dm2_container_write_cnt++;
+	dhdr->dext_magic = DM2_DISK_EXT_DONE;	// Indicate DONE
+	ret = dm2_md_batch_queue(cont, DM2_MD_CONT, dext, DM2_DISK_EXT_SIZE,
+				 (off_t)ext->ext_cont_off * DM2_DISK_EXT_SIZE);
+	if (ret < 0) {
+	    glob_dm2_container_write_err++;
+	    goto error_unlock;
+	}
+	glob_dm2_container_write_bytes += DM2_DISK_EXT_SIZE;
+	AO_fetch_and_sub1(&cont->c_good_ext_cnt);
+	goto error_unlock;
+    }
+
+    dm2_md_batch_flush_cont(cont);
     if ((cfd = dm2_open(contpath, O_WRONLY, 0)) == -1) {
 	ret = -errno;
 	NKN_ASSERT(ret != -EMFILE);
@@ -3322,8 +3378,7 @@ dm2_create_mem_extent(const void *dext_in,
     ext->ext_start_sector = dext_v2->dext_start_sector;
     ext->ext_start_attr = 0;	// XXXmiken: not done yet
     ext->ext_flags |= DM2_EXT_FLAG_INUSE;
-    ext->ext_flags |= (dext_v2->dext_header.dext_flags &
-		       DM2_DISK_EXT_FLAG_CHKSUM) ? DM2_EXT_FLAG_CHKSUM : 0;
+    ext->ext_flags |= DM2_DEXT_TO_EXT_FLAGS(dext_v2->dext_header.dext_flags);
     ext->ext_cont_off = DM2_EXT_INIT_CONT_OFF;
     ext->ext_version = DM2_DISK_EXT_VERSION_V2;
 
@@ -3349,8 +3404,7 @@ dm2_modify_mem_extent(const void *dext_in,
     ext->ext_start_sector = dext_v2->dext_start_sector;
     ext->ext_start_attr = 0;	// XXXmiken: not done yet
     ext->ext_flags |= DM2_EXT_FLAG_INUSE;
-    ext->ext_flags |= (dext_v2->dext_header.dext_flags &
-		       DM2_DISK_EXT_FLAG_CHKSUM) ? DM2_EXT_FLAG_CHKSUM : 0;
+    ext->ext_flags |= DM2_DEXT_TO_EXT_FLAGS(dext_v2->dext_header.dext_flags);
 
     *ext_ret = ext;
     return;
@@ -3415,7 +3469,7 @@ dm2_write_attr(DM2_uri_t     *uh,
     struct iovec	 iov[2];
     int			 afd = -1, nbytes = 0, ret = 0, appending = 0;
     int			 mutex_locked = 0, write_len, i, num_chunks;
-    int			 alloc_bytes = 0;
+    int			 alloc_bytes = 0, batched;
 
     at_len = uh->uri_at_len;
     at_off = uh->uri_at_off;
@@ -3461,6 +3515,9 @@ dm2_write_attr(DM2_uri_t     *uh,
     dm2_attr_mutex_lock(cont);
     mutex_locked = 1;
     DM2_GET_ATTRPATH(cont, attr_pathname);
+    batched = dm2_md_batch_enabled();
+    if (!batched)
+	dm2_md_batch_flush_cont(cont);	// Batching may just have been turned off
 
     if ((ret = dm2_open_attrpath(attr_pathname)) < 0) {
 	DBG_DM2S("[name=%s] Failed to create attribute file (%s): %d",
@@ -3496,6 +3553,9 @@ dm2_write_attr(DM2_uri_t     *uh,
 	    }
 	    assert(seek_off == new_seek_off);
 	}
+	/* Queued appends are not in the file yet */
+	if (batched && cont->c_md_attr_end > seek_off)
+	    seek_off = cont->c_md_attr_end;
 	appending = 1;
     } else {
 #ifdef SLOT_DEBUG
@@ -3539,10 +3599,23 @@ dm2_write_attr(DM2_uri_t     *uh,
 	    dead_dad->dat_version = DM2_ATTR_VERSION;
 	    bufptr += DM2_ATTR_TOT_DISK_SIZE;
 	}
+    } else {
+	write_len = DM2_ATTR_TOT_DISK_SIZE;
+    }
+    if (batched) {
+	/* Written by dm2_md_batch_flush_*(), container file first */
+	if (!appending)
+	    memcpy(((char *)dad)+DEV_BSIZE, put->attr, DM2_MAX_ATTR_DISK_SIZE);
+	nbytes = write_len;
+	if ((ret = dm2_md_batch_queue(cont, DM2_MD_ATTR, dad, write_len,
+				      seek_off)) < 0) {
+	    errno = -ret;
+	    nbytes = -1;
+	}
+    } else if (appending) {
 	nbytes = write(afd, dad, write_len);
     } else {
 	/* This skips the above bcopy */
-	write_len = DM2_ATTR_TOT_DISK_SIZE;
 	iov[0].iov_base = dad;
 	iov[0].iov_len = DEV_BSIZE;
 	iov[1].iov_base = put->attr;
@@ -3758,7 +3831,7 @@ dm2_write_content(MM_put_data_t	   *put,
     int			nbytes, ret, ret2, i, vec, nvecs, raw_fd = -1;
     int			chk_idx = 0, chk_len = 0, block_size;
     int			chk_size, chk_iov_len, calc_chk_size, chk_base;
-    int			num_csum = 0;
+    int			num_csum = 0, crc32c;
     uint64_t		uri_resv_len, uri_content_len;
 
     dev_ci = uri_head->uri_container->c_dev_ci;
@@ -3874,7 +3947,11 @@ dm2_write_content(MM_put_data_t	   *put,
     myiov[nvecs-1].iov_len += (write_length - partial_len);
     useful_len = partial_len;
 
-    /* Calculate checksum */
+    /* Calculate checksum.  An append keeps the type the extent has. */
+    if (append_ext)
+	crc32c = (append_ext->ext_flags & DM2_EXT_FLAG_CRC32C) != 0;
+    else
+	crc32c = dm2_put_chksum_crc32c;
     if (dm2_perform_put_chksum) {
 	chk_size = (block_size / DM2_SMALL_READ_DIV);
 	if (append_ext)
@@ -3893,9 +3970,8 @@ dm2_write_content(MM_put_data_t	   *put,
 		    calc_chk_size = chk_iov_len;
 		chk_base_addr = (char *)myiov[0].iov_base + chk_base;
 		ext_v2_checksum[chk_idx] =
-		    do_csum32_iterate_aligned((void *)chk_base_addr,
-					      calc_chk_size,
-					      ext_v2_checksum[chk_idx]);
+		    dm2_ext_csum32(crc32c, chk_base_addr, calc_chk_size,
+				   ext_v2_checksum[chk_idx]);
 		chk_iov_len -= calc_chk_size;
 		chk_base += calc_chk_size;
 		chk_len += calc_chk_size;
@@ -3909,9 +3985,8 @@ dm2_write_content(MM_put_data_t	   *put,
 	    for (i = 0; i <= nvecs-1; i++) {
 		NKN_ASSERT(((uint64_t)myiov[i].iov_len & (512-1)) == 0);
 		ext_v2_checksum[chk_idx] =
-		    do_csum32_iterate_aligned(myiov[i].iov_base,
-					      myiov[i].iov_len,
-					      ext_v2_checksum[chk_idx]);
+		    dm2_ext_csum32(crc32c, myiov[i].iov_base,
+				   myiov[i].iov_len, ext_v2_checksum[chk_idx]);
 		chk_len += myiov[i].iov_len;
 		if (chk_len >= chk_size) {
 		    chk_idx++;
@@ -3957,7 +4032,7 @@ dm2_write_content(MM_put_data_t	   *put,
     if (!append_ext) {
 	/* Update disk extents */
 	dm2_create_disk_extent(put, uri_head, raw_offset, *put_offset,
-			       partial_len, ext_v2_checksum,
+			       partial_len, ext_v2_checksum, crc32c,
 			       ct->ct_ptype, dext);
 	/*
 	 * Failure to create memory extents will mean we can't access the data.
@@ -5554,6 +5629,7 @@ dm2_verify_checksum(MM_get_resp_t *get,
     char	    *uri = ext->ext_uri_head->uri_name;
     int		    j, chk_idx = 0, read_length = 0;
     int		    proc_len = 0, count;
+    int		    crc32c = (ext->ext_flags & DM2_EXT_FLAG_CRC32C) != 0;
 
     if ((ext->ext_flags & DM2_EXT_FLAG_CHKSUM) == 0) {
 	DBG_DM2S("Checksum NOT PRESENT");
@@ -5610,8 +5686,8 @@ dm2_verify_checksum(MM_get_resp_t *get,
 	    count = 0;
 	    for (j = idx; j < idx + num_pages; j++) {
 		uol_length = ROUNDUP_PWR2(bmap[j].data_len,CHKSUM_ROUNDOFF_LEN);
-		checksum32 =
-		  do_csum32_iterate_aligned(bmap[j].cp, uol_length, checksum32);
+		checksum32 = dm2_ext_csum32(crc32c, bmap[j].cp, uol_length,
+					    checksum32);
 		proc_len += uol_length;
 		count++;
 		if (proc_len == read_length)
@@ -6522,6 +6598,7 @@ dm2_container_attrfile_remove(dm2_container_t *free_cont)
 
     DM2_GET_CONTPATH(free_cont, contpath);
     DM2_GET_ATTRPATH(free_cont, attrpath);
+    dm2_md_batch_flush_cont(free_cont);
 
     /*
      * Should we ignore ENOENT?  Since attribute files are created after
@@ -6567,6 +6644,9 @@ dm2_container_destroy(dm2_container_t  *free_cont,
 		 ct->ct_name, free_cont->c_uri_dir);
     }
     assert(free_cont->c_magicnum != NKN_CONTAINER_MAGIC_FREE);
+    /* No queued write may outlive the container */
+    if (free_cont->c_dev_ci)
+	dm2_md_batch_flush_cont(free_cont);
 
     /* clear the attr/ext slot queues */
     while (1) {
@@ -6932,8 +7012,13 @@ dm2_do_delete(MM_delete_resp_t *delete,
 
 	if (!local_delete) {
 	    /* Delete AM entry, only if the DELETE is from external source
-	     * or eviction */
-	    if ((ret = AM_delete_obj(NKN_COD_NULL, del_uri_name)) < 0) {
+	     * or eviction.  The evicted object also tells the AM admission
+	     * filter how popular the objects leaving this tier are. */
+	    if (evict_flag && uh == del_uh)
+		ret = AM_evict_obj(del_uri_name, ct->ct_ptype);
+	    else
+		ret = AM_delete_obj(NKN_COD_NULL, del_uri_name);
+	    if (ret < 0) {
 		/* This object isn't necessarily in AM, so we can't print
 		 * an error all the time */
 		DBG_DM2W("[cache_type=%s] AM Delete failed for %s: %d",
@@ -7390,6 +7475,21 @@ DM2_delete(MM_delete_resp_t *delete)
 int
 DM2_shutdown(void)
 {
+    dm2_cache_type_t *ct;
+    GList	     *ci_obj;
+    int		     ptype_idx;
+
+    /* Nothing queued by the metadata batching may be lost */
+    for (ptype_idx = 0; ptype_idx < glob_dm2_num_cache_types; ptype_idx++) {
+	ct = &g_cache2_types[ptype_idx];
+	dm2_ct_info_list_rwlock_rlock(ct);
+	for (ci_obj = ct->ct_info_list; ci_obj; ci_obj = ci_obj->next)
+	    dm2_md_batch_flush_ci((dm2_cache_info_t *)ci_obj->data);
+	dm2_ct_info_list_rwlock_runlock(ct);
+    }
+
+    /* Let the next start skip the directory walk */
+    dm2_preread_write_manifests();
     return 0;
 }
 
@@ -8227,6 +8327,8 @@ DM2_attribute_update(MM_update_attr_t *update_attr)
 	cont = uri_head->uri_container;
 	ci = cont->c_dev_ci;
 	DM2_GET_ATTRPATH(cont, attrpath);
+	/* Read-modify-write below must not be undone by a batched write */
+	dm2_md_batch_flush_cont(cont);
 	if ((ret = dm2_open_attrpath(attrpath)) < 0) {
 	    DBG_DM2S("[cache_type=%s] Failed to open attribute file (%s): %d",
 		     ct->ct_name, attrpath, errno);
@@ -9224,8 +9326,9 @@ dm2_update_tier_preread_state(dm2_cache_type_t *ct)
 	ct->ct_tier_preread_done = 1;
 	dm2_set_glob_preread_state(ct->ct_ptype, 1);
 	dm2_cleanup_preread_hash(ct);
+	ct->ct_dm2_preread_secs = nkn_cur_ts - ct->ct_dm2_preread_start_ts;
 	DBG_DM2S("[cache_type=%s] Preread complete in %ld seconds",
-		 ct->ct_name, (nkn_cur_ts - ct->ct_dm2_preread_start_ts));
+		 ct->ct_name, ct->ct_dm2_preread_secs);
     }
 
     /* If all the active disks had their 'preread'
@@ -256,6 +256,7 @@ typedef struct dm2_cache_type {
     uint64_t	     ct_dm2_preread_hash_insert_cnt;
     uint64_t	     ct_dm2_preread_hash_free_cnt;
     uint64_t	     ct_dm2_preread_start_ts;
+    uint64_t	     ct_dm2_preread_secs;	// time to full service
     NCHashTable	     *ct_dm2_preread_hash;
     nkn_mutex_t      ct_dm2_preread_mutex;
 
@@ -346,6 +347,8 @@ typedef struct dm2_cache_info {
     int32_t		ci_preread_stat_opt; // boolean
     int32_t		ci_preread_stat_cnt;
     int32_t		ci_preread_thread_active;
+    int32_t		ci_preread_manifest;	// boolean: no dir walk
+    uint64_t		ci_preread_secs;	// last preread took
 
     uint8_t		ci_disabling;
     uint8_t		ci_updating;
@@ -448,6 +451,17 @@ typedef struct dm2_cache_info {
     uint64_t	ci_soft_rejects;
     uint64_t	ci_hard_rejects;
 
+    /* Metadata group commit: see diskmgr2_md_batch.c */
+    pthread_mutex_t	ci_md_batch_mutex;	// batch list + fields below
+    pthread_mutex_t	ci_md_flush_mutex;	// one whole disk flush at a time
+    pthread_cond_t	ci_md_flush_cond;	// a c_md_flushing was cleared
+    struct dm2_md_batch	*ci_md_batch_head;	// containers with queued writes
+    uint64_t		ci_md_batch_bytes;	// queued bytes
+    uint64_t		ci_md_batch_first_ms;	// when first write was queued
+    uint64_t		ci_dm2_md_batch_queue_cnt;
+    uint64_t		ci_dm2_md_batch_flush_cnt;
+    uint64_t		ci_dm2_md_batch_write_cnt;
+    uint64_t		ci_dm2_md_batch_write_err;
 } dm2_cache_info_t;
 
 typedef struct dm2_prq_entry_s {
@@ -691,9 +705,14 @@ extern uint64_t glob_dm2_init_done;
 
 extern int dm2_perform_get_chksum;
 extern int dm2_perform_put_chksum;
+extern int dm2_put_chksum_crc32c;
 extern int dm2_print_mem;
 extern int dm2_assert_for_disk_inconsistency;
 extern int dm2_stop_preread;
+extern int glob_dm2_preread_q_max;
+extern uint64_t glob_dm2_preread_manifest_read_cnt;
+extern uint64_t glob_dm2_preread_manifest_write_cnt;
+extern uint64_t glob_dm2_preread_manifest_invalid_cnt;
 extern nkn_provider_type_t glob_dm2_lowest_tier_ptype;
 
 /* Prototypes */
@@ -708,9 +727,25 @@ void dm2_cleanup_preread_hash(dm2_cache_type_t *ct);
 void* dm2_preread_main_thread(void *arg);
 void* dm2_preread_worker_thread(void *arg);
 void dm2_preread_ci(dm2_cache_info_t *ci);
+void dm2_preread_write_manifests(void);
+void dm2_preread_remove_manifest(dm2_cache_info_t *ci);
 void dm2_preread_q_lock_init(dm2_preread_q_t *pr_q);
 int dm2_check_meta_fs_space(dm2_cache_info_t  *ci);
 void dm2_container_attrfile_remove(dm2_container_t *free_cont);
+
+/* diskmgr2_md_batch.c */
+#define DM2_MD_CONT	0	// container file: disk extents
+#define DM2_MD_ATTR	1	// attribute file
+#define DM2_MD_NFILES	2
+extern int glob_dm2_md_batch_msecs;
+extern int glob_dm2_md_batch_bytes;
+void dm2_md_batch_init_ci(dm2_cache_info_t *ci);
+void dm2_spawn_md_batch_thread(void);
+int dm2_md_batch_queue(dm2_container_t *cont, int file, const void *buf,
+		       int len, off_t off);
+void dm2_md_batch_flush_cont(dm2_container_t *cont);
+void dm2_md_batch_flush_ci(dm2_cache_info_t *ci);
+#define dm2_md_batch_enabled()	(glob_dm2_md_batch_msecs > 0)
 int DM2_type_delete(MM_delete_resp_t *delete, dm2_cache_type_t *ct,
 		    dm2_cache_info_t **ci);
 int dm2_cache_array_map_ret_idx(nkn_provider_type_t ptype);
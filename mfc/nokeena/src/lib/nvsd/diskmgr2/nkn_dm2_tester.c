@@ -10,6 +10,7 @@
 #include <sys/types.h>
 #include <sys/param.h>
 #include <unistd.h>
+#include <time.h>
 #include <glib.h>
 #include "nkn_am_api.h"
 #include "nkn_diskmgr2_local.h"
@@ -27,6 +28,8 @@
 
 #define DM2_UNIT_TEST_URI_TBL_SIZE 1000000
 #define DM2_TEST_BLK_LEN (2 * 1024 * 1024)
+#define DM2_TEST_CHKSUM_ITER 512
+#define DM2_TEST_CHKSUM_DIV 8		// DM2_SMALL_READ_DIV
 
 #define DM2_TEST_URI_SIZE 256
 typedef struct dm2_test_file_s {
@@ -544,6 +547,75 @@ s_unit_test_init(int num_threads)
     return;
 }
 
+/*
+ * Checksum throughput over 2MiB blocks: the XOR sum which old V2
+ * extents carry against the CRC32C new extents carry, hardware and
+ * table driven.  Each block is summed as dm2_verify_checksum() does it,
+ * 1/8 block at a time, one 32KiB buffer after the other.
+ */
+typedef unsigned int (*dm2_test_csum_fn_t)(const unsigned char *, int,
+					   unsigned int);
+
+static unsigned int
+s_csum_xor32(const unsigned char *buf, int len, unsigned int old_checksum)
+{
+    return do_csum32_iterate_aligned(buf, len, old_checksum);
+}
+
+static double
+s_chksum_bench_one(const unsigned char *blk, dm2_test_csum_fn_t fn,
+		   uint32_t *sums)
+{
+    struct timespec start, end;
+    int chk_size = DM2_TEST_BLK_LEN / DM2_TEST_CHKSUM_DIV;
+    int iter, chk, off;
+    double nsec;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (iter = 0; iter < DM2_TEST_CHKSUM_ITER; iter++) {
+	for (chk = 0; chk < DM2_TEST_CHKSUM_DIV; chk++) {
+	    sums[chk] = 0;
+	    for (off = 0; off < chk_size; off += CM_MEM_PAGE_SIZE)
+		sums[chk] = fn(blk + chk * chk_size + off, CM_MEM_PAGE_SIZE,
+			       sums[chk]);
+	}
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    nsec = (end.tv_sec - start.tv_sec) * 1e9 +
+	(end.tv_nsec - start.tv_nsec);
+    /* GB/s */
+    return (double)DM2_TEST_CHKSUM_ITER * DM2_TEST_BLK_LEN / nsec;
+}
+
+static void
+s_run_checksum_bench(void)
+{
+    unsigned char *blk;
+    uint32_t xor_sums[DM2_TEST_CHKSUM_DIV], crc_sums[DM2_TEST_CHKSUM_DIV];
+    uint32_t sw_sums[DM2_TEST_CHKSUM_DIV];
+    double xor_gbs, crc_gbs, sw_gbs;
+    unsigned int seed = 1;
+    int i;
+
+    if (posix_memalign((void **)&blk, 4096, DM2_TEST_BLK_LEN)) {
+	DBG_DM2S("DM2 checksum bench: no memory");
+	return;
+    }
+    for (i = 0; i < DM2_TEST_BLK_LEN; i++)
+	blk[i] = rand_r(&seed);
+
+    xor_gbs = s_chksum_bench_one(blk, s_csum_xor32, xor_sums);
+    crc_gbs = s_chksum_bench_one(blk, do_crc32c_iterate, crc_sums);
+    sw_gbs = s_chksum_bench_one(blk, do_crc32c_iterate_sw, sw_sums);
+    DBG_DM2S("DM2 checksum bench (%d x %d bytes): xor32 %.2f GB/s, "
+	     "crc32c %.2f GB/s (%s), crc32c table %.2f GB/s",
+	     DM2_TEST_CHKSUM_ITER, DM2_TEST_BLK_LEN, xor_gbs, crc_gbs,
+	     do_crc32c_hw_available() ? "sse4.2" : "table", sw_gbs);
+    if (memcmp(crc_sums, sw_sums, sizeof(crc_sums)))
+	DBG_DM2S("DM2 checksum bench: crc32c hw/table results differ");
+    free(blk);
+}
+
 void
 DM2_unit_test_start(int num_threads, char *cached_filenames,
 		    char *new_full_put_filenames,
@@ -555,6 +627,8 @@ DM2_unit_test_start(int num_threads, char *cached_filenames,
     /* Init this only once */
     s_unit_test_init(num_threads);
 
+    s_run_checksum_bench();
+
     ret = s_read_cached_uri_file(cached_filenames);
     if(ret < 0) {
 	return;
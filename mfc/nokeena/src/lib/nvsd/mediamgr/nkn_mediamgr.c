@@ -277,6 +277,9 @@ s_mm_promote_complete(nkn_cod_t cod, char *uri, nkn_provider_type_t src_ptype,
 		      int64_t mmoffset, time_t obj_starttime,
 		      time_t block_starttime, time_t clientupdatetime,
 		      time_t expiry);
+static void s_mm_promote_batch_init(void);
+static void *s_mm_promote_batch_thread(void *dummy_var);
+static pthread_t mm_promote_batch_thread;
 
 AO_t mm_glob_bytes_used_in_put[NKN_MM_MAX_CACHE_PROVIDERS];
 int mm_glob_max_bytes_per_tier[NKN_MM_MAX_CACHE_PROVIDERS];
@@ -638,6 +641,16 @@ MM_init(void)
         return -1;
     }
 
+    s_mm_promote_batch_init();
+    if ((ret = pthread_create(&mm_promote_batch_thread, NULL,
+			      s_mm_promote_batch_thread, NULL))) {
+        DBG_LOG(SEVERE, MOD_MM,"MM promote batch thread not created. "
+		"Severe MM failure");
+        DBG_ERR(SEVERE, "MM promote batch thread not created. "
+		"Severe MM failure");
+        return -1;
+    }
+
     // counter alias
     snprintf(counter_str, 512, "ingest.fail.temp.pobj_cod_err_cnt");
     (void)nkn_mon_add(counter_str, NULL,
@@ -3432,6 +3445,293 @@ ingest_wait:;
     }
 }
 
+/*
+ * Batched promotion between the local disk tiers.
+ *
+ * Promotions out of a disk tier are queued per source disk (ptype and
+ * device id of the first extent) instead of being started one by one.
+ * A batch is taken when it is full or when its oldest entry has waited
+ * glob_mm_promote_batch_msecs.  The batch is sorted by block number, so
+ * the reads sweep the disk once; objects which share a container on the
+ * source (same URI directory) then reach DM2_put back to back and fill
+ * whole containers on the target tier.
+ *
+ * glob_mm_promote_max_disk_mb_per_sec caps the promotion read rate of
+ * each source disk in MiB/s, so that foreground reads of that disk keep
+ * their latency.  0 is no cap.  All the queues are started from
+ * s_mm_promote_batch_thread.
+ */
+#define MM_PROMOTE_BATCH_MAX	64
+#define MM_PROMOTE_MAX_DISKS	(1 << NKN_PHYSID_DEV_BITS)
+
+int glob_mm_promote_batch_size = 16;	/* 0 or 1 disables batching */
+int glob_mm_promote_batch_msecs = 500;
+int glob_mm_promote_max_disk_mb_per_sec = 0;
+
+uint64_t glob_mm_promote_batch_queued = 0;
+uint64_t glob_mm_promote_batch_stat_err = 0;
+uint64_t glob_mm_promote_batch_cnt = 0;
+uint64_t glob_mm_promote_batch_started = 0;
+uint64_t glob_mm_promote_batch_throttled = 0;
+
+typedef struct mm_promote_batch_ent {
+    TAILQ_ENTRY(mm_promote_batch_ent) entries;
+    nkn_cod_t		cod;
+    char		*uri;
+    off_t		offset;
+    off_t		req_len;
+    off_t		rem_len;
+    off_t		tot_len;
+    uint64_t		bytes;		// to be read from the source
+    uint64_t		blkno;		// of the first extent on the source
+    nkn_provider_type_t	src;
+    nkn_provider_type_t	dst;
+    int			flag;
+    time_t		update_time;
+    int			has_client_data;
+    am_object_data_t	client_data;
+} mm_promote_batch_ent_t;
+
+TAILQ_HEAD(mm_promote_batch_q_t, mm_promote_batch_ent);
+
+typedef struct mm_promote_disk {
+    struct mm_promote_batch_q_t	q;	// waiting, mm_promote_batch_mutex
+    int			cnt;
+    uint64_t		first_msecs;	// queue time of the oldest entry
+    struct mm_promote_batch_q_t	run;	// sorted batch, batch thread only
+    uint64_t		next_msecs;	// next read may start, rate cap
+} mm_promote_disk_t;
+
+static mm_promote_disk_t
+	mm_promote_disk[NKN_MM_max_pci_providers][MM_PROMOTE_MAX_DISKS];
+static pthread_mutex_t mm_promote_batch_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  mm_promote_batch_cond;
+
+static uint64_t
+s_mm_now_msecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int
+s_mm_promote_batch_cmp(const void *p1, const void *p2)
+{
+    const mm_promote_batch_ent_t *e1 = *(mm_promote_batch_ent_t * const *)p1;
+    const mm_promote_batch_ent_t *e2 = *(mm_promote_batch_ent_t * const *)p2;
+
+    if(e1->blkno < e2->blkno)
+	return -1;
+    return (e1->blkno > e2->blkno);
+}
+
+static void
+s_mm_promote_batch_init(void)
+{
+    pthread_condattr_t a;
+    int ptype, dev;
+
+    for(ptype = 0; ptype < NKN_MM_max_pci_providers; ptype++) {
+	for(dev = 0; dev < MM_PROMOTE_MAX_DISKS; dev++) {
+	    TAILQ_INIT(&mm_promote_disk[ptype][dev].q);
+	    TAILQ_INIT(&mm_promote_disk[ptype][dev].run);
+	}
+    }
+    pthread_condattr_init(&a);
+    pthread_condattr_setclock(&a, CLOCK_MONOTONIC);
+    pthread_cond_init(&mm_promote_batch_cond, &a);
+}
+
+/*
+ * Queue the promotion on its source disk.  Returns -1 if it can not be
+ * batched, the caller starts it right away then.
+ */
+static int
+s_mm_promote_batch_add(nkn_cod_t cod, char *uri, off_t offset,
+		       off_t req_len, off_t rem_len, off_t tot_len,
+		       nkn_provider_type_t src, nkn_provider_type_t dst,
+		       am_object_data_t *in_client_data, int flag,
+		       time_t update_time)
+{
+    mm_promote_batch_ent_t *ent;
+    mm_promote_disk_t	   *disk;
+    MM_stat_resp_t	   src_resp;
+    nkn_uol_t		   src_uol;
+
+    if(!mm_provider_array[src].stat)
+	return -1;
+
+    /* Find the disk and the block the object starts at */
+    src_uol.cod = cod;
+    src_uol.offset = offset;
+    src_uol.length = 1;
+    memset((char *)&src_resp, 0, sizeof(MM_stat_resp_t));
+    src_resp.ptype = src;
+    src_resp.in_flags |= MM_FLAG_IGNORE_EXPIRY;
+    if(mm_provider_array[src].stat(src_uol, &src_resp) ||
+	    src_resp.mm_stat_ret || !src_resp.physid2 ||
+	    (src_resp.content_len <= offset)) {
+	glob_mm_promote_batch_stat_err ++;
+	return -1;
+    }
+
+    ent = nkn_calloc_type(1, sizeof(*ent), mod_mm_promote_batch_t);
+    if(!ent)
+	return -1;
+    ent->uri = nkn_strdup_type(uri, mod_mm_promote_batch_t);
+    if(!ent->uri) {
+	free(ent);
+	return -1;
+    }
+    ent->cod	     = cod;
+    ent->offset	     = offset;
+    ent->req_len     = req_len;
+    ent->rem_len     = rem_len;
+    ent->tot_len     = tot_len;
+    ent->bytes	     = req_len ? req_len : (src_resp.content_len - offset);
+    ent->blkno	     = nkn_physid_to_sectornum(src_resp.physid2);
+    ent->src	     = src;
+    ent->dst	     = dst;
+    ent->flag	     = flag;
+    ent->update_time = update_time;
+    if(in_client_data) {
+	/* Only the scalar fields are used, no proto_data, see caller */
+	ent->client_data = *in_client_data;
+	ent->has_client_data = 1;
+    }
+
+    disk = &mm_promote_disk[src][nkn_physid_to_device(src_resp.physid2)];
+    pthread_mutex_lock(&mm_promote_batch_mutex);
+    if(!disk->cnt)
+	disk->first_msecs = s_mm_now_msecs();
+    TAILQ_INSERT_TAIL(&disk->q, ent, entries);
+    disk->cnt++;
+    glob_mm_promote_batch_queued ++;
+    if(disk->cnt >= glob_mm_promote_batch_size)
+	pthread_cond_signal(&mm_promote_batch_cond);
+    pthread_mutex_unlock(&mm_promote_batch_mutex);
+    return 0;
+}
+
+static void
+s_mm_promote_batch_start(mm_promote_batch_ent_t *ent)
+{
+    int ret;
+
+    ret = s_get_data_helper(ent->cod, ent->uri, ent->offset, ent->req_len,
+			    ent->rem_len, ent->tot_len, ent->src, ent->dst,
+			    NULL, 0, NULL,
+			    ent->has_client_data ? &ent->client_data : NULL,
+			    ent->flag, ent->update_time);
+    if(ret < 0) {
+	glob_mm_promote_uri_err ++;
+	s_mm_promote_complete(ent->cod, ent->uri, ent->src, ent->dst, 0, 0,
+			      NULL, 0, 0, NKN_MM_PROMOTE_GEN_ERR, ent->flag,
+			      0, -1, -1, ent->update_time, 0);
+    }
+    glob_mm_promote_batch_started ++;
+    free(ent->uri);
+    free(ent);
+}
+
+/*
+ * Move the next batch of the disk to its run queue in block order.
+ * Called with mm_promote_batch_mutex held.
+ */
+static void
+s_mm_promote_batch_take(mm_promote_disk_t *disk, uint64_t now)
+{
+    mm_promote_batch_ent_t *batch[MM_PROMOTE_BATCH_MAX];
+    int n = 0, i, max;
+
+    max = glob_mm_promote_batch_size;
+    if(max > MM_PROMOTE_BATCH_MAX)
+	max = MM_PROMOTE_BATCH_MAX;
+    while(n < max && (batch[n] = TAILQ_FIRST(&disk->q)) != NULL) {
+	TAILQ_REMOVE(&disk->q, batch[n], entries);
+	n++;
+    }
+    disk->cnt -= n;
+    disk->first_msecs = now;
+
+    qsort(batch, n, sizeof(batch[0]), s_mm_promote_batch_cmp);
+    for(i = 0; i < n; i++)
+	TAILQ_INSERT_TAIL(&disk->run, batch[i], entries);
+    glob_mm_promote_batch_cnt ++;
+}
+
+static void *
+s_mm_promote_batch_thread(void *dummy_var __attribute((unused)))
+{
+    mm_promote_batch_ent_t *ent;
+    mm_promote_disk_t	   *disk;
+    struct timespec	   abstime;
+    uint64_t		   now, wait, bytes_per_sec;
+    int			   ptype, dev;
+
+    prctl(PR_SET_NAME, "nvsd-mm-promote", 0, 0, 0);
+
+    while(1) {
+	now = s_mm_now_msecs();
+	wait = glob_mm_promote_batch_msecs;
+	bytes_per_sec =
+	    (uint64_t)glob_mm_promote_max_disk_mb_per_sec * 1024 * 1024;
+
+	for(ptype = 0; ptype < NKN_MM_max_pci_providers; ptype++) {
+	    for(dev = 0; dev < MM_PROMOTE_MAX_DISKS; dev++) {
+		disk = &mm_promote_disk[ptype][dev];
+
+		if(TAILQ_EMPTY(&disk->run) && disk->cnt) {
+		    pthread_mutex_lock(&mm_promote_batch_mutex);
+		    if((disk->cnt >= glob_mm_promote_batch_size) ||
+			    (now >= disk->first_msecs +
+			     glob_mm_promote_batch_msecs)) {
+			s_mm_promote_batch_take(disk, now);
+		    } else if(disk->first_msecs +
+			      glob_mm_promote_batch_msecs - now < wait) {
+			wait = disk->first_msecs +
+			       glob_mm_promote_batch_msecs - now;
+		    }
+		    pthread_mutex_unlock(&mm_promote_batch_mutex);
+		}
+
+		while((ent = TAILQ_FIRST(&disk->run)) != NULL) {
+		    if(bytes_per_sec && (disk->next_msecs > now)) {
+			glob_mm_promote_batch_throttled ++;
+			if(disk->next_msecs - now < wait)
+			    wait = disk->next_msecs - now;
+			break;
+		    }
+		    TAILQ_REMOVE(&disk->run, ent, entries);
+		    if(bytes_per_sec) {
+			if(disk->next_msecs < now)
+			    disk->next_msecs = now;
+			disk->next_msecs += (ent->bytes * 1000) / bytes_per_sec;
+		    }
+		    s_mm_promote_batch_start(ent);
+		}
+	    }
+	}
+
+	if(!wait)
+	    wait = 1;
+        clock_gettime(CLOCK_MONOTONIC, &abstime);
+	abstime.tv_sec += wait / 1000;
+	abstime.tv_nsec += (wait % 1000) * 1000000;
+	if(abstime.tv_nsec >= 1000000000) {
+	    abstime.tv_sec ++;
+	    abstime.tv_nsec -= 1000000000;
+	}
+	pthread_mutex_lock(&mm_promote_batch_mutex);
+	pthread_cond_timedwait(&mm_promote_batch_cond, &mm_promote_batch_mutex,
+			       &abstime);
+	pthread_mutex_unlock(&mm_promote_batch_mutex);
+    }
+    return NULL;
+}
+
 int
 MM_promote_uri(char *uri, nkn_provider_type_t src, nkn_provider_type_t dst,
 		nkn_cod_t in_cod, am_object_data_t *in_client_data,
@@ -3583,6 +3883,21 @@ skip_stat_check:;
 	glob_mm_partial_overwrite_avoided ++;
     }
 
+    /* Disk to disk promotion, hand it to the batch of its source disk */
+    if((glob_mm_promote_batch_size > 1) &&
+	    (src > Unknown_provider) && (src < NKN_MM_max_pci_providers) &&
+	    (dst > Unknown_provider) && (dst < NKN_MM_max_pci_providers) &&
+	    !(flag & (NKN_MM_HP_QUEUE | NKN_MM_UPDATE_CIM)) &&
+	    (!in_client_data ||
+	     (!(in_client_data->flags & (AM_OBJ_TYPE_STREAMING |
+					 AM_CIM_INGEST | AM_NEW_INGEST)) &&
+	      !in_client_data->proto_data))) {
+	if(!s_mm_promote_batch_add(cod, uri, offset, req_len, rem_len,
+				   tot_len, src, dst, in_client_data, flag,
+				   update_time))
+	    return 0;
+    }
+
     ret = s_get_data_helper(cod, uri, offset, req_len, rem_len, tot_len,
 			    src, dst, NULL, 0, in_proto_data, in_client_data, flag,
 			    update_time);
@@ -36,6 +36,7 @@
 #include "nkn_debug.h"
 #include "nkn_mgmt_defs.h"
 #include "nvsd_mgmt_lib.h"
+#include "nkn_cfg_params.h"
 
 /* Local Macros */
 #define	HTTP_STR	"http"
@@ -49,6 +50,7 @@ uint64_t global_pool_bandwidth = 0;
 
 /* resource pool header */
 #include "nvsd_resource_mgr.h"
+#include "nvsd_rp_tb.h"
 
 #define CHECK_FOR_BAD_RP_IDX(rp_index)                                      \
     do {									    \
@@ -154,6 +156,21 @@ typedef struct max_system_resource_st {
 static max_system_resource_t global_resource_max;
 
 uint64_t g_rsrc_bw_1sec_val[NKN_MAX_RESOURCE_POOL];
+/* per client session share of the pool bw, refreshed every second */
+static uint64_t g_rsrc_bw_pace_rate[NKN_MAX_RESOURCE_POOL];
+
+static void nvsd_rp_bw_update_pace_rate(int rp_index);
+static void nvsd_rp_bw_reset_tb(uint32_t rp_index);
+
+/*
+ * BW tokens are borrowed by the network threads in batches, see
+ * nvsd_rp_tb.h. The epoch moves on every 1 sec cleanup. Each sending
+ * thread claims one row of buckets on its first send.
+ */
+static AO_t g_rsrc_bw_epoch;
+static rp_tb_t g_rsrc_bw_tb[RP_TB_MAX_THREADS][NKN_MAX_RESOURCE_POOL];
+static AO_t g_rsrc_bw_tb_rows;
+static __thread rp_tb_t *t_rsrc_bw_tb;
 
 /* ------------------------------------------------------------------------- */
 
@@ -688,6 +705,7 @@ nvsd_resource_mgr_delete_cfg_handle_change(const bn_binding_array * arr,
 		/*
 		 * Clear the other allocated fields 
 		 */
+		nvsd_rp_bw_reset_tb(pstResourcePool->index);
 		memset(pstResourcePool, 0, sizeof (resource_pool_t));
 	    }
 
@@ -955,6 +973,42 @@ nvsd_rp_bw_timer_cleanup_1sec(void)
     return;
 }	/* end of nvsd_rp_bw_timer_cleanup_1sec */
 
+/*
+ * Bytes actually sent in this epoch: the pool used counter less the
+ * tokens the threads borrowed and have not spent yet.
+ */
+static uint64_t
+nvsd_rp_bw_sent(int rp_index, uint64_t used)
+{
+    uint64_t held = 0;
+    AO_t epoch = AO_load(&g_rsrc_bw_epoch);
+    AO_t rows = AO_load(&g_rsrc_bw_tb_rows);
+    AO_t t;
+
+    if (rows > RP_TB_MAX_THREADS)
+	rows = RP_TB_MAX_THREADS;
+    for (t = 0; t < rows; t++) {
+	if (g_rsrc_bw_tb[t][rp_index].epoch == epoch)
+	    held += g_rsrc_bw_tb[t][rp_index].tokens;
+    }
+    return (used > held) ? used - held : 0;
+}	/* end of nvsd_rp_bw_sent */
+
+/*
+ * A deleted pool index may be reused; drop the tokens the threads hold.
+ */
+static void
+nvsd_rp_bw_reset_tb(uint32_t rp_index)
+{
+    int t;
+
+    if (rp_index >= NKN_MAX_RESOURCE_POOL)
+	return;
+    for (t = 0; t < RP_TB_MAX_THREADS; t++) {
+	g_rsrc_bw_tb[t][rp_index].epoch = (AO_t)-1;
+    }
+}	/* end of nvsd_rp_bw_reset_tb */
+
 void
 nvsd_rp_cleanup_used(rp_type_en resource_type)
 {
@@ -987,19 +1041,54 @@ nvsd_rp_cleanup_used(rp_type_en resource_type)
 	    res =
 		&g_lstresrcpool.lstResourcePool[i].resources[resource_type - 1];
 	    if (resource_type == RESOURCE_POOL_TYPE_BW) {
-		g_rsrc_bw_1sec_val[i] = AO_load(&(res->used));
+		g_rsrc_bw_1sec_val[i] = nvsd_rp_bw_sent(i, AO_load(&(res->used)));
+		nvsd_rp_bw_update_pace_rate(i);
 	    }
 	    AO_store(&(res->used), 0);
 	}
     }
+    if (resource_type == RESOURCE_POOL_TYPE_BW) {
+	AO_fetch_and_add1(&g_rsrc_bw_epoch);
+    }
 
     return;
 }	/* end of nvsd_rp_cleanup */
 
+static rp_tb_t *
+nvsd_rp_bw_local_tb(int rp_index)
+{
+    if (rp_index < 0 || rp_index >= NKN_MAX_RESOURCE_POOL) {
+	return NULL;
+    }
+    if (t_rsrc_bw_tb == NULL) {
+	/*
+	 * First send of this thread, claim a row
+	 */
+	AO_t row = AO_fetch_and_add1(&g_rsrc_bw_tb_rows);
+
+	if (row >= RP_TB_MAX_THREADS) {
+	    return NULL;
+	}
+	t_rsrc_bw_tb = g_rsrc_bw_tb[row];
+    }
+    return &t_rsrc_bw_tb[rp_index];
+}	/* end of nvsd_rp_bw_local_tb */
+
 void
 nvsd_rp_bw_update_send(int rp_index, uint64_t byte_sent)
 {
-    nvsd_rp_alloc_resource(RESOURCE_POOL_TYPE_BW, rp_index, byte_sent);
+    resource_t *res;
+    rp_tb_t *tb;
+
+    tb = nvsd_rp_bw_local_tb(rp_index);
+    if (tb == NULL || !g_lstresrcpool.lstResourcePool[rp_index].name) {
+	nvsd_rp_alloc_resource(RESOURCE_POOL_TYPE_BW, rp_index, byte_sent);
+	return;
+    }
+    res = &g_lstresrcpool.lstResourcePool[rp_index].
+	resources[RESOURCE_POOL_TYPE_BW - 1];
+    rp_tb_charge(&res->used, AO_load(&res->max), AO_load(&g_rsrc_bw_epoch),
+	    tb, byte_sent, NM_tot_threads);
     return;
 }	/* end of nvsd_rp_bw_update_send */
 
@@ -1011,10 +1100,46 @@ nvsd_rp_bw_query_available_bw(int rp_index)
      * return -1: means unlimited
      * return 0: no more available bw
      */
+    resource_t *res;
+    rp_tb_t *tb;
 
-    return nvsd_rp_query_available(RESOURCE_POOL_TYPE_BW, rp_index);
+    tb = nvsd_rp_bw_local_tb(rp_index);
+    if (tb == NULL || !g_lstresrcpool.lstResourcePool[rp_index].name) {
+	return nvsd_rp_query_available(RESOURCE_POOL_TYPE_BW, rp_index);
+    }
+    res = &g_lstresrcpool.lstResourcePool[rp_index].
+	resources[RESOURCE_POOL_TYPE_BW - 1];
+    return rp_tb_available(AO_load(&res->used), AO_load(&res->max),
+	    AO_load(&g_rsrc_bw_epoch), tb);
 }	/* end of nvsd_bw_query_available_bw */
 
+static void
+nvsd_rp_bw_update_pace_rate(int rp_index)
+{
+    resource_pool_t *rp = &g_lstresrcpool.lstResourcePool[rp_index];
+    uint64_t bw_max;
+    uint64_t sessions;
+
+    bw_max = AO_load(&rp->resources[RESOURCE_POOL_TYPE_BW - 1].max);
+    sessions =
+	AO_load(&rp->resources[RESOURCE_POOL_TYPE_CLIENT_SESSION - 1].used);
+    /*
+     * Sessions pick this up on their next send, there is no need to
+     * touch the connections themselves.
+     */
+    g_rsrc_bw_pace_rate[rp_index] = bw_max / (sessions ? sessions : 1);
+    return;
+}	/* end of nvsd_rp_bw_update_pace_rate */
+
+uint64_t
+nvsd_rp_bw_query_pace_rate(int rp_index)
+{
+    if (rp_index < 0 || rp_index >= NKN_MAX_RESOURCE_POOL) {
+	return 0;
+    }
+    return g_rsrc_bw_pace_rate[rp_index];
+}	/* end of nvsd_rp_bw_query_pace_rate */
+
 uint64_t
 nvsd_rp_query_available(rp_type_en resource_type, uint32_t rp_index)
 {
@@ -1397,7 +1522,19 @@ bail:
 int
 nvsd_rp_adjust_bw(void)
 {
+    int i;
+
     nvsd_rp_set_total(RESOURCE_POOL_TYPE_BW, 1);
+    /*
+     * Paced sessions follow the new pool max through their socket
+     * pacing rate, nothing is re-queued.
+     */
+    for (i = 0; i < min(g_lstresrcpool.g_nresrc_pool, NKN_MAX_RESOURCE_POOL);
+	    i++) {
+	if (NULL != g_lstresrcpool.lstResourcePool[i].name) {
+	    nvsd_rp_bw_update_pace_rate(i);
+	}
+    }
     return 1;
 }	/* end fo nvsd_rp_adjust_bw */
 
@@ -0,0 +1,217 @@
+/*
+ * nvsd_rp_tb_bench: cost of charging resource pool bandwidth on the
+ * send path, with 1, 8 and 32 network threads sending on the same
+ * pool. Compares the shared counter (nvsd_rp_alloc_resource) with the
+ * per thread token buckets of nvsd_rp_tb.h, and reports how far the
+ * bytes sent in an epoch stay within the pool max.
+ *
+ * build: gcc -O2 -I../../../include nvsd_rp_tb_bench.c \
+ *		-o nvsd_rp_tb_bench -latomic_ops -lpthread
+ *
+ * usage: nvsd_rp_tb_bench [-n sends_per_thread] [-s send_size]
+ *        [-m pool_max_per_epoch] [-e epoch_usec]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "nvsd_rp_tb.h"
+
+#define MAX_THREADS	32
+#define CACHE_LINE	64
+
+typedef struct bench_pool {
+	AO_t used;
+	AO_t max;
+	AO_t epoch;
+	char pad[CACHE_LINE - 3 * sizeof(AO_t)];
+	uint64_t epoch_peak;	// most bytes sent in one epoch
+	int nthreads;
+	volatile int stop;
+} bench_pool_t;
+
+typedef struct bench_thr {
+	bench_pool_t *pool;
+	int use_tb;
+	int nthreads;
+	uint64_t sends;
+	uint64_t send_size;
+	uint64_t nsec;
+	volatile uint64_t sent;	// only written by the sender itself
+	rp_tb_t tb;
+	char pad[CACHE_LINE];
+} bench_thr_t;
+
+static uint64_t opt_sends = 2000000;
+static uint64_t opt_send_size = 1448;
+static uint64_t opt_max = 0;		// 0: unlimited (1 << 62)
+static uint64_t opt_epoch_usec = 1000;
+
+static bench_thr_t thr[MAX_THREADS];
+
+static uint64_t now_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* the legacy path, as nvsd_rp_alloc_resource() */
+static void legacy_charge(bench_pool_t *pool, uint64_t bytes)
+{
+	uint64_t used;
+
+	used = AO_fetch_and_add(&pool->used, bytes) + bytes;
+	if (used > AO_load(&pool->max)) {
+		AO_fetch_and_add(&pool->used, -bytes);
+	}
+}
+
+static uint64_t legacy_available(bench_pool_t *pool)
+{
+	uint64_t used = AO_load(&pool->used);
+	uint64_t max = AO_load(&pool->max);
+
+	return (max > used) ? max - used : 0;
+}
+
+static void *sender(void *arg)
+{
+	bench_thr_t *t = (bench_thr_t *)arg;
+	bench_pool_t *pool = t->pool;
+	uint64_t i, avail, len, start;
+
+	start = now_nsec();
+	for (i = 0; i < t->sends; i++) {
+		/* query before the send, charge after it, as nkn_http.c */
+		if (t->use_tb) {
+			avail = rp_tb_available(AO_load(&pool->used),
+				AO_load(&pool->max), AO_load(&pool->epoch),
+				&t->tb);
+		} else {
+			avail = legacy_available(pool);
+		}
+		len = (avail < t->send_size) ? avail : t->send_size;
+		if (len == 0) {
+			continue;
+		}
+		t->sent += len;
+		if (t->use_tb) {
+			rp_tb_charge(&pool->used, AO_load(&pool->max),
+				AO_load(&pool->epoch), &t->tb, len,
+				t->nthreads);
+		} else {
+			legacy_charge(pool, len);
+		}
+	}
+	t->nsec = now_nsec() - start;
+	return NULL;
+}
+
+/* the 1 sec timer of nvsd_rp_cleanup_used(), sped up */
+static void *cleaner(void *arg)
+{
+	bench_pool_t *pool = (bench_pool_t *)arg;
+	uint64_t last_sent = 0, sent;
+	int i;
+
+	while (!pool->stop) {
+		usleep(opt_epoch_usec);
+		for (sent = 0, i = 0; i < pool->nthreads; i++) {
+			sent += thr[i].sent;
+		}
+		if (sent - last_sent > pool->epoch_peak) {
+			pool->epoch_peak = sent - last_sent;
+		}
+		last_sent = sent;
+		AO_store(&pool->used, 0);
+		AO_fetch_and_add1(&pool->epoch);
+	}
+	return NULL;
+}
+
+static void run(int nthreads, int use_tb)
+{
+	pthread_t tid[MAX_THREADS], ctid;
+	bench_pool_t *pool;
+	uint64_t nsec = 0, sends = 0;
+	int i;
+
+	if (posix_memalign((void **)&pool, CACHE_LINE, sizeof(*pool))) {
+		exit(1);
+	}
+	memset(pool, 0, sizeof(*pool));
+	pool->max = opt_max ? opt_max : (1ULL << 62);
+	pool->nthreads = nthreads;
+	for (i = 0; i < nthreads; i++) {
+		memset(&thr[i], 0, sizeof(thr[i]));
+	}
+	pthread_create(&ctid, NULL, cleaner, pool);
+
+	for (i = 0; i < nthreads; i++) {
+		thr[i].pool = pool;
+		thr[i].use_tb = use_tb;
+		thr[i].nthreads = nthreads;
+		thr[i].sends = opt_sends;
+		thr[i].send_size = opt_send_size;
+		pthread_create(&tid[i], NULL, sender, &thr[i]);
+	}
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(tid[i], NULL);
+		nsec += thr[i].nsec;
+		sends += thr[i].sends;
+	}
+	pool->stop = 1;
+	pthread_join(ctid, NULL);
+
+	printf("%-8s threads=%2d  %7.1f ns/send", use_tb ? "bucket" : "shared",
+	       nthreads, (double)nsec / sends);
+	if (opt_max) {
+		printf("  peak epoch=%lu (%.1f%% of max)",
+		       (unsigned long)pool->epoch_peak,
+		       100.0 * pool->epoch_peak / opt_max);
+	}
+	printf("\n");
+	free(pool);
+}
+
+int main(int argc, char **argv)
+{
+	static const int nthreads[] = { 1, 8, 32 };
+	unsigned int i;
+	int c;
+
+	while ((c = getopt(argc, argv, "n:s:m:e:")) != -1) {
+		switch (c) {
+		case 'n':
+			opt_sends = strtoull(optarg, NULL, 0);
+			break;
+		case 's':
+			opt_send_size = strtoull(optarg, NULL, 0);
+			break;
+		case 'm':
+			opt_max = strtoull(optarg, NULL, 0);
+			break;
+		case 'e':
+			opt_epoch_usec = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n sends_per_thread] "
+				"[-s send_size] [-m pool_max_per_epoch] "
+				"[-e epoch_usec]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	for (i = 0; i < sizeof(nthreads) / sizeof(nthreads[0]); i++) {
+		run(nthreads[i], 0);
+		run(nthreads[i], 1);
+	}
+	return 0;
+}
@@ -45,6 +45,8 @@ NknCfgParamValue nknCfgParams[] =
 { { "debug_fd_trace", NKN_INT_TYPE }, &debug_fd_trace},
 { { "pmmaper_disable", NKN_INT_TYPE }, &om_pmap_config.pmapper_disable},
 { { "nm_handle_send_and_receive", NKN_INT_TYPE }, &nm_hdl_send_and_receive},
+{ { "nm_cpu_steer", NKN_INT_TYPE }, &nm_cpu_steer},
+{ { "kernel_pacing.enable", NKN_INT_TYPE }, &nkn_kernel_pacing_enable},
 { { "pe_url_category_lookup.enable", NKN_INT_TYPE }, &pe_url_category_lookup},
 { { "pe_url_cat_failover_bypass.enable", NKN_INT_TYPE }, &pe_ucflt_failover_bypass_enable},
 
@@ -267,19 +269,25 @@ NknCfgParamValue nknCfgParams[] =
 ////////////////////////////////////////////////////////////////////////////////
 
 { { "http.include_orig_key", NKN_STR_PTR_TYPE }, &include_orig_key},
+{ { "http.attr_compact_headers", NKN_INT_TYPE }, &glob_mime_hdr_attr_compact},
 
 // DM2 Config Values
 { { "dm2.num_preread_disk_threads", NKN_INT_TYPE},
     &glob_dm2_num_preread_disk_threads},
+{ { "dm2.preread_q_max", NKN_INT_TYPE}, &glob_dm2_preread_q_max},
 { { "dm2.throttle_writes", NKN_INT_TYPE }, &glob_dm2_throttle_writes},
 { { "dm2.small_write_enable", NKN_INT_TYPE }, &glob_dm2_small_write_enable},
 { { "dm2.small_write_min_size", NKN_INT_TYPE }, &glob_dm2_small_write_min_size},
+{ { "dm2.md_batch_msecs", NKN_INT_TYPE }, &glob_dm2_md_batch_msecs},
+{ { "dm2.md_batch_bytes", NKN_INT_TYPE }, &glob_dm2_md_batch_bytes},
 
 // AM config values
 { { "am.byte_serve_hotness_enable", NKN_INT_TYPE },
     &glob_am_bytes_based_hotness},
 { { "am.byte_serve_hotness_threshold", NKN_LONG_TYPE },
     &glob_am_bytes_based_hotness_threshold},
+{ { "am.admit_tinylfu", NKN_INT_TYPE }, &glob_am_admit_tinylfu},
+{ { "am.admit_sketch_width", NKN_INT_TYPE }, &glob_am_admit_sketch_width},
 
 // Push Ingest config values
 { { "mm.push_ingest_enabled", NKN_INT_TYPE },
@@ -291,6 +299,13 @@ NknCfgParamValue nknCfgParams[] =
 { { "mm.push_ingest_no_parallel_first_put", NKN_INT_TYPE },
     &glob_mm_push_ingest_parallel_ingest_restrict},
 
+// Batched promotion config values
+{ { "mm.promote_batch_size", NKN_INT_TYPE }, &glob_mm_promote_batch_size},
+{ { "mm.promote_batch_msecs", NKN_INT_TYPE }, &glob_mm_promote_batch_msecs},
+// MiB (1024 * 1024 bytes) per second per source disk, 0 is no cap
+{ { "mm.promote_max_disk_mb_per_sec", NKN_INT_TYPE },
+    &glob_mm_promote_max_disk_mb_per_sec},
+
 // ** Note: Add new entries after this line **
 
 { { NULL, NKN_INT_TYPE }, NULL },};
@@ -329,6 +344,7 @@ int net_use_nkn_stack = 0;
 int l4proxy_enabled = 0;
 int NM_tot_threads = 2;
 int nm_lb_policy = 0;
+int nm_cpu_steer = 0;
 int om_cache_no_cache_obj  = 0;
 const char * om_oomgr_queuefile = "/tmp/OOMGR.queue";
 int om_oomgr_queue_retries  = 2;
@@ -5,9 +5,12 @@
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <sys/param.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <errno.h>
+#include <time.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -60,6 +63,36 @@ static void (*ptrie_free)(void *ptr);
 
 #define UNUSED_ARGUMENT(x) (void)x
 
+/*
+ * Reader reference on the active trie_data_t.  The reference is only 
+ * valid if active_td did not change after taking it, otherwise the 
+ * update side may already be past its refcnt check of the stale trie.
+ */
+#define GET_TRIE_DATA(_ctx, _td) { \
+    uint64_t _val; \
+    while (1) { \
+    	_val = AO_load(&(_ctx)->active_td); \
+    	(_td) = (trie_data_t *)_val; \
+    	if (!(_td)) { \
+	    break; \
+	} \
+    	AO_fetch_and_add1_full(&(_td)->refcnt); \
+	if (AO_load_full(&(_ctx)->active_td) == _val) { \
+	    break; \
+	} \
+    	AO_fetch_and_sub1(&(_td)->refcnt); \
+    } \
+}
+
+#define SET_TRIE_DATA(_ctx, _td) { \
+    AO_store(&(_ctx)->active_td, (_td)); \
+    AO_nop_full(); \
+}
+
+#define RELEASE_TRIE_DATA(_td) { \
+    AO_fetch_and_sub1(&(_td)->refcnt); \
+}
+
 /*
  *******************************************************************************
  * Internal cp_trie interfaces
@@ -122,6 +155,33 @@ reset_cp_trie(trie_data_t *td)
     return 0;
 }
 
+/*
+ * switch_trie_data() - Make the ShadowTrie the CurrentTrie
+ *
+ * Returns when no reader references the stale trie (the new ShadowTrie).
+ */
+static void
+switch_trie_data(ptrie_context_t *ctx)
+{
+    trie_data_t *tmp_td;
+    struct pollfd pfd;
+    long refcnt;
+    int polls = 0;
+
+    SET_TRIE_DATA(ctx, (uint64_t)ctx->shdw_td);
+    tmp_td = ctx->cur_td;
+    ctx->cur_td = ctx->shdw_td;
+    ctx->shdw_td = tmp_td;
+
+    while ((refcnt = AO_load(&ctx->shdw_td->refcnt))) {
+    	if (!(++polls % 1000)) {
+	    LOGMSG("Waiting for (refcnt(%ld) == 0), ctx=%p trie=%p", 
+		   refcnt, ctx, ctx->shdw_td->trie);
+	}
+    	poll(&pfd, 0, 1); // 1 msec sleep
+    }
+}
+
 /*
  *******************************************************************************
  * Internal log callback function 
@@ -1230,91 +1290,255 @@ add_log_entry(ptrie_context_t *ctx, ptrie_xaction_type_t type,
 
 /*
  *******************************************************************************
- * External Interface Functions
+ * Snapshot mode, snapshot file interfaces
  *******************************************************************************
  */
+typedef struct snap_src { // write_snapshot() input
+    const char *key;
+    int key_strlen;
+    const app_data_t *ad;
+} snap_src_t;
+
+#define SNAP_KEY(_snap, _ix) ((_snap)->keys + (_snap)->en[(_ix)].key_off)
+#define SNAP_WBUFSIZE (1024 * 1024)
+
+static int 
+fsync_dir(const char *name)
+{
+    char dir[PATH_MAX];
+    char *p;
+    int fd;
+    int ret;
+
+    strncpy(dir, name, sizeof(dir));
+    dir[sizeof(dir) - 1] = '\0';
+    p = strrchr(dir, '/');
+    if (!p) {
+    	strcpy(dir, ".");
+    } else if (p == dir) {
+    	dir[1] = '\0';
+    } else {
+    	*p = '\0';
+    }
+
+    fd = open(dir, O_RDONLY|O_DIRECTORY);
+    if (fd < 0) {
+    	LOGMSG("open(%s) failed, errno=%d", dir, errno);
+	return 1;
+    }
+    ret = fsync(fd);
+    close(fd);
+    if (ret) {
+    	LOGMSG("fsync(%s) failed, errno=%d", dir, errno);
+	return 2;
+    }
+    return 0;
+}
+
+static int 
+flush_wbuf(int fd, const char *buf, size_t *pbytes)
+{
+    ssize_t bytes_written;
+
+    if (!*pbytes) {
+    	return 0;
+    }
+    bytes_written = write(fd, buf, *pbytes);
+    if (bytes_written != (ssize_t)*pbytes) {
+    	LOGMSG("write(%d) short xfer, bytes_written=%ld bytes=%ld",
+	       fd, bytes_written, *pbytes);
+    	return 1;
+    }
+    *pbytes = 0;
+    return 0;
+}
 
 /*
- * ptrie_init() - Subsystem initialization
- *
- * NULL proc arg will use the system default.
+ * write_snapshot() - Write snapshot file from keys sorted by strcmp()
  *
- * Return:
- *  ==0, Success
- *  !=0, Error
+ * The file is written as <name>.tmp and renamed to name once it is on
+ * stable storage.
  */
-int 
-ptrie_init(const ptrie_config_t *cfg)
+static int 
+write_snapshot(const char *name, const snap_src_t *src, long entries,
+	       long seqno, long log_gen, const fh_user_data_t *ud)
 {
-    assert(sizeof(file_header_t) == DEV_BSIZE);
+    char tmpname[PATH_MAX];
+    snap_header_t sh;
+    snap_entry_t *se;
+    char *buf = 0;
+    size_t bytes = 0;
+    long *stack = 0;
+    int sp = 0;
+    off_t key_off = 0;
+    ssize_t bytes_written;
+    long n;
+    long t;
+    int fd = -1;
+    int rv = 0;
 
-    if (!cfg) {
-    	return 1;
+    LOGMSG("name=%s entries=%ld seqno=%ld log_gen=%ld", 
+	   name, entries, seqno, log_gen);
+
+    snprintf(tmpname, sizeof(tmpname), "%s.tmp", name);
+
+    ////////////////////////////////////////////////////////////////////////////
+    while (1) { // Begin while
+    ////////////////////////////////////////////////////////////////////////////
+
+    buf = MALLOC(SNAP_WBUFSIZE);
+    stack = MALLOC((KEYMAXSIZE + 2) * sizeof(long));
+    if (!buf || !stack) {
+    	LOGMSG("malloc failed");
+	rv = 1;
+	break;
     }
 
-    if (cfg->interface_version != PTRIE_INTF_VERSION) {
-    	return 2;
+    fd = open(tmpname, O_CREAT|O_TRUNC|O_WRONLY, 0600);
+    if (fd < 0) {
+    	LOGMSG("open(%s) failed, errno=%d", tmpname, errno);
+	rv = 2;
+	break;
     }
 
-    if (cfg->log_level) {
-    	ptrie_log_level = cfg->log_level;
-    } else {
-    	ptrie_log_level = &ptrie_def_log_level;
+    memset(&sh, 0, sizeof(sh));
+    sh.u.hdr.version = SH_VERSION;
+    sh.u.hdr.magicno = SH_MAGICNO;
+    sh.u.hdr.seqno = seqno;
+    sh.u.hdr.log_gen = log_gen;
+    clock_gettime(CLOCK_REALTIME, &sh.u.hdr.ts);
+    sh.u.hdr.entries = entries;
+    sh.u.hdr.keys_foff = DEV_BSIZE + (entries * sizeof(snap_entry_t));
+    if (ud) {
+    	sh.u.hdr.ud = *ud;
     }
 
-    if (cfg->proc_logfunc) {
-    	ptrie_logfunc = cfg->proc_logfunc;
-    } else {
-    	ptrie_logfunc = internal_logfunc;
+    // Header is written last, the zero fill is not a valid header
+    memset(buf, 0, DEV_BSIZE);
+    bytes = DEV_BSIZE;
+
+    // Entries, the stack holds the entries which are a prefix of the last
+    for (n = 0; n < entries; n++) {
+    	while (sp) {
+	    t = stack[sp - 1];
+	    if ((src[t].key_strlen < src[n].key_strlen) &&
+	    	!memcmp(src[t].key, src[n].key, src[t].key_strlen)) {
+		break;
+	    }
+	    sp--;
+	}
+	if ((bytes + sizeof(*se)) > SNAP_WBUFSIZE) {
+	    if (flush_wbuf(fd, buf, &bytes)) {
+	    	rv = 3;
+		break;
+	    }
+	}
+	se = (snap_entry_t *)(buf + bytes);
+	se->key_off = key_off;
+	se->key_strlen = src[n].key_strlen;
+	se->prefix_ix = sp ? stack[sp - 1] : -1;
+	se->ad = *src[n].ad;
+	bytes += sizeof(*se);
+
+	stack[sp++] = n;
+	key_off += src[n].key_strlen + 1;
+    }
+    if (rv) {
+    	break;
     }
 
-    if (cfg->proc_malloc) {
-    	ptrie_malloc = cfg->proc_malloc;
-    } else {
-    	ptrie_malloc = malloc;
+    // Keys
+    for (n = 0; n < entries; n++) {
+	if ((bytes + src[n].key_strlen + 1) > SNAP_WBUFSIZE) {
+	    if (flush_wbuf(fd, buf, &bytes)) {
+	    	rv = 4;
+		break;
+	    }
+	}
+	memcpy(buf + bytes, src[n].key, src[n].key_strlen);
+	buf[bytes + src[n].key_strlen] = '\0';
+	bytes += src[n].key_strlen + 1;
+    }
+    if (rv || flush_wbuf(fd, buf, &bytes)) {
+    	rv = 5;
+    	break;
     }
 
-    if (cfg->proc_calloc) {
-    	ptrie_calloc = cfg->proc_calloc;
-    } else {
-    	ptrie_calloc = calloc;
+    sh.u.hdr.filesize = sh.u.hdr.keys_foff + key_off;
+    bytes_written = pwrite(fd, &sh, sizeof(sh), 0);
+    if (bytes_written != (ssize_t)sizeof(sh)) {
+    	LOGMSG("pwrite(%d) short xfer, bytes_written=%ld bytes=%ld",
+	       fd, bytes_written, sizeof(sh));
+	rv = 6;
+	break;
     }
 
-    if (cfg->proc_realloc) {
-    	ptrie_realloc = cfg->proc_realloc;
-    } else {
-    	ptrie_realloc = realloc;
+    if (fsync(fd)) {
+    	LOGMSG("fsync(%s) failed, errno=%d", tmpname, errno);
+	rv = 7;
+	break;
     }
+    close(fd);
+    fd = -1;
 
-    if (cfg->proc_free) {
-    	ptrie_free = cfg->proc_free;
-    } else {
-    	ptrie_free = free;
+    if (rename(tmpname, name)) {
+    	LOGMSG("rename(%s, %s) failed, errno=%d", tmpname, name, errno);
+	rv = 8;
+	break;
+    }
+    if (fsync_dir(name)) {
+	rv = 9;
+	break;
     }
+    break;
 
-    AO_store(&init_complete, 1);
+    ////////////////////////////////////////////////////////////////////////////
+    } // End while
+    ////////////////////////////////////////////////////////////////////////////
 
-    return 0;
+    if (fd >= 0) {
+    	close(fd);
+    }
+    if (rv) {
+    	unlink(tmpname);
+    }
+    if (buf) {
+    	FREE(buf);
+    }
+    if (stack) {
+    	FREE(stack);
+    }
+    return rv;
+}
+
+static void 
+close_snapshot(ptrie_snap_t *snap)
+{
+    if (snap) {
+    	if (snap->map) {
+	    munmap(snap->map, snap->mapsize);
+	}
+	if (snap->fd >= 0) {
+	    close(snap->fd);
+	}
+	FREE(snap);
+    }
 }
 
 /*
- * new_ptrie_context() - Create Persistent Trie (ptrie) context
- *
- * NULL proc arg implies no action required.
- *
- * Return:
- *  !=0, Success, pointer ptrie_context_t
- *  == 0, Error
+ * open_snapshot() - Map snapshot file, the entries are not read
  */
-ptrie_context_t *
-new_ptrie_context(void (*copy_app_data)(const app_data_t *src,
-				    	app_data_t *dest),
-		  void (*destruct_app_data)(app_data_t *d))
+static ptrie_snap_t *
+open_snapshot(const char *name)
 {
-    ptrie_context_t *ctx = 0;
+    ptrie_snap_t *snap;
+    const snap_header_t *sh;
+    struct stat sbuf;
+    char *map;
 
-    if (!AO_load(&init_complete)) {
-	LOGSEV("FATAL Subsystem not initialized, ptrie_init() not called");
+    snap = (ptrie_snap_t *)CALLOC(1, sizeof(ptrie_snap_t));
+    if (!snap) {
+    	LOGMSG("calloc failed");
 	return 0;
     }
 
@@ -1322,101 +1546,1987 @@ new_ptrie_context(void (*copy_app_data)(const app_data_t *src,
     while (1) { // Begin while
     ////////////////////////////////////////////////////////////////////////////
 
-    ctx = (ptrie_context_t *)CALLOC(1, sizeof(ptrie_context_t));
-    if (!ctx) {
-	LOGMSG("new_ptrie_context(), calloc failed");
+    snap->fd = open(name, O_RDONLY);
+    if (snap->fd < 0) {
+    	LOGMSG("open(%s) failed, errno=%d", name, errno);
 	break;
     }
-    ctx->f[0].file_fd = -1;
-    ctx->f[0].freemap.mapsize = MAX_TRIE_ENTRIES / NBBY;
-    ctx->f[0].freemap.map = CALLOC(1, ctx->f[0].freemap.mapsize);
-    if (!ctx->f[0].freemap.map) {
-	LOGMSG("f[0].freemap.map, calloc failed");
+
+    if (fstat(snap->fd, &sbuf)) {
+    	LOGMSG("fstat(%s) failed, errno=%d", name, errno);
 	break;
     }
-
-    ctx->f[1].file_fd = -1;
-    ctx->f[1].freemap.mapsize = MAX_TRIE_ENTRIES / NBBY;
-    ctx->f[1].freemap.map = CALLOC(1, ctx->f[1].freemap.mapsize);
-    if (!ctx->f[1].freemap.map) {
-	LOGMSG("f[1].freemap.map, calloc failed");
+    if (sbuf.st_size < DEV_BSIZE) {
+    	LOGMSG("%s short file, st_size=%ld", name, sbuf.st_size);
 	break;
     }
 
-    ctx->bi_ckpt_file_bmap.mapsize =  MAX_TRIE_ENTRIES / NBBY;
-    ctx->bi_ckpt_file_bmap.map = CALLOC(1, ctx->bi_ckpt_file_bmap.mapsize);
-    if (!ctx->bi_ckpt_file_bmap.map) {
-	LOGMSG("bi_ckpt_file_bmap.map, calloc failed");
+    map = mmap((void *) 0, sbuf.st_size, PROT_READ, MAP_SHARED, snap->fd, 0);
+    if (map == MAP_FAILED) {
+    	LOGMSG("mmap(%s) failed, errno=%d", name, errno);
 	break;
     }
-
-    ctx->log = CALLOC(1, sizeof(trie_xaction_log_t));
-    if (!ctx->log) {
-	LOGMSG("log, calloc failed");
+    snap->map = map;
+    snap->mapsize = sbuf.st_size;
+    madvise(snap->map, snap->mapsize, MADV_RANDOM);
+
+    sh = (const snap_header_t *)snap->map;
+    if ((sh->u.hdr.version != SH_VERSION) ||
+    	(sh->u.hdr.magicno != SH_MAGICNO) ||
+	(sh->u.hdr.filesize != sbuf.st_size) ||
+	(sh->u.hdr.entries < 0) ||
+	(sh->u.hdr.keys_foff != 
+	    (off_t)(DEV_BSIZE + (sh->u.hdr.entries * sizeof(snap_entry_t)))) ||
+	(sh->u.hdr.keys_foff > sh->u.hdr.filesize)) {
+	LOGMSG("%s invalid header, version=0x%x magic=0x%lx filesize=%ld "
+	       "st_size=%ld entries=%ld keys_foff=%ld",
+	       name, sh->u.hdr.version, sh->u.hdr.magicno, 
+	       sh->u.hdr.filesize, sbuf.st_size, sh->u.hdr.entries, 
+	       sh->u.hdr.keys_foff);
 	break;
     }
+    snap->hdr = sh;
+    snap->en = (const snap_entry_t *)(snap->map + DEV_BSIZE);
+    snap->keys = snap->map + sh->u.hdr.keys_foff;
 
-    ctx->copy_app_data = copy_app_data;
-    ctx->destruct_app_data = destruct_app_data;
-
-    return ctx;
+    LOGMSG("name=%s entries=%ld seqno=%ld log_gen=%ld", name, 
+	   sh->u.hdr.entries, sh->u.hdr.seqno, sh->u.hdr.log_gen);
+    return snap;
 
     ////////////////////////////////////////////////////////////////////////////
     } // End while
     ////////////////////////////////////////////////////////////////////////////
 
-    if (ctx) {
-	if (ctx->f[0].freemap.map) {
-	    FREE(ctx->f[0].freemap.map);
-	    ctx->f[0].freemap.map = 0;
-	}
-
-	if (ctx->f[1].freemap.map) {
-	    FREE(ctx->f[1].freemap.map);
-	    ctx->f[1].freemap.map = 0;
-	}
+    close_snapshot(snap);
+    return 0;
+}
 
-	if (ctx->bi_ckpt_file_bmap.map) {
-	    FREE(ctx->bi_ckpt_file_bmap.map);
-	    ctx->bi_ckpt_file_bmap.map = 0;
+/*
+ * snap_find() - Index of key, -1 if not found
+ */
+static long 
+snap_find(const ptrie_snap_t *snap, const char *key)
+{
+    long lo = 0;
+    long hi = snap->hdr->u.hdr.entries;
+    long mid;
+    int cmp;
+
+    while (lo < hi) {
+    	mid = lo + ((hi - lo) / 2);
+	cmp = strcmp(SNAP_KEY(snap, mid), key);
+	if (!cmp) {
+	    return mid;
+	} else if (cmp < 0) {
+	    lo = mid + 1;
+	} else {
+	    hi = mid;
 	}
+    }
+    return -1;
+}
 
-	if (ctx->log) {
-	    FREE(ctx->log);
-	    ctx->log = 0;
+/*
+ * snap_prefix_ix() - Index of the longest entry which is a prefix of key,
+ *		      -1 if none.  The prefix_ix chain of the result holds
+ *		      all other prefixes of key.
+ */
+static long 
+snap_prefix_ix(const ptrie_snap_t *snap, const char *key, int key_strlen)
+{
+    long lo = 0;
+    long hi = snap->hdr->u.hdr.entries;
+    long mid;
+    long ix;
+
+    // Last entry <= key, any prefix of key is also a prefix of it
+    while (lo < hi) {
+    	mid = lo + ((hi - lo) / 2);
+	if (strcmp(SNAP_KEY(snap, mid), key) <= 0) {
+	    lo = mid + 1;
+	} else {
+	    hi = mid;
 	}
+    }
 
-	if (ctx) {
-	    FREE(ctx);
-	    ctx = 0;
+    for (ix = lo - 1; ix >= 0; ix = snap->en[ix].prefix_ix) {
+    	if ((snap->en[ix].key_strlen <= key_strlen) &&
+	    !memcmp(SNAP_KEY(snap, ix), key, snap->en[ix].key_strlen)) {
+	    return ix;
 	}
     }
-    return 0;
+    return -1;
 }
 
 /*
- * delete_ptrie_context() - Delete Persistent Trie (ptrie) context
+ *******************************************************************************
+ * Snapshot mode, layered trie interfaces
+ *
+ * The view of a trie_data_t is td->trie over td->frozen over td->snap,
+ * the first layer holding a key decides.  DH_MAGICNO_FREE nodes 
+ * (tombstones) are keys deleted since the layers below were written.
+ *******************************************************************************
  */
-void 
-delete_ptrie_context(ptrie_context_t *ctx)
-{
-    if (ctx) {
-    	if (ctx->f[0].file_fd >= 0) {
-	    close(ctx->f[0].file_fd);
-	    ctx->f[0].file_fd = -1;
-	}
-
-    	if (ctx->f[0].freemap.map) {
-	    FREE(ctx->f[0].freemap.map);
-	    ctx->f[0].freemap.map = 0;
-    	}
+typedef struct view_match {
+    const app_data_t *ad;
+    node_data_t *nd; // !=0 => match in td->trie
+    int key_strlen;
+} view_match_t;
 
-    	if (ctx->f[1].file_fd >= 0) {
-	    close(ctx->f[1].file_fd);
-	    ctx->f[1].file_fd = -1;
-	}
+#define APPDATA2NODEDATA_SNAP(_ad) \
+	((node_data_t *)((char *)(_ad) - offsetof(node_data_t, ad)))
 
-    	if (ctx->f[1].freemap.map) {
+/*
+ * delta_put() - Add or update key in a delta trie, ad == 0 zero fills
+ */
+static int 
+delta_put(ptrie_context_t *ctx, cp_trie *trie, const char *key, 
+	  int key_strlen, long magicno, const app_data_t *ad)
+{
+    node_data_t *nd;
+    node_data_t tmp_nd;
+    int ret;
+
+    nd = (node_data_t *)cp_trie_exact_match(trie, (char *)key);
+    if (nd) {
+    	nd->dh.magicno = magicno;
+	if (ad && (ad != &nd->ad)) {
+	    if (ctx->copy_app_data) {
+	    	(*ctx->copy_app_data)(ad, &nd->ad);
+	    } else {
+	    	nd->ad = *ad;
+	    }
+	}
+	return 0;
+    }
+
+    memset(&tmp_nd, 0, sizeof(tmp_nd));
+    tmp_nd.dh.magicno = magicno;
+    tmp_nd.dh.loff = -1;
+    tmp_nd.dh.key_strlen = key_strlen;
+    tmp_nd.dh.incarnation = ctx->fnode_incarnation++;
+    if (ad) {
+    	tmp_nd.ad = *ad; // trie_copy_func() makes the copy
+    }
+    tmp_nd.ctx = ctx;
+
+    ret = cp_trie_add(trie, (char *)key, &tmp_nd);
+    if (ret) {
+    	LOGMSG("cp_trie_add() failed, trie=%p key=%s ret=%d", trie, key, ret);
+	return 1;
+    }
+    return 0;
+}
+
+static const app_data_t *
+view_exact_match(const trie_data_t *td, const char *key, node_data_t **pnd)
+{
+    node_data_t *nd;
+    long ix;
+
+    if (pnd) {
+    	*pnd = 0;
+    }
+
+    nd = (node_data_t *)cp_trie_exact_match(td->trie, (char *)key);
+    if (nd) {
+    	if (nd->dh.magicno != DH_MAGICNO) {
+	    return 0;
+	}
+	if (pnd) {
+	    *pnd = nd;
+	}
+	return &nd->ad;
+    }
+    if (td->reset) {
+    	return 0;
+    }
+
+    if (td->frozen) {
+    	nd = (node_data_t *)cp_trie_exact_match(td->frozen, (char *)key);
+	if (nd) {
+	    return (nd->dh.magicno == DH_MAGICNO) ? &nd->ad : 0;
+	}
+	if (td->frozen_reset) {
+	    return 0;
+	}
+    }
+
+    if (td->snap) {
+    	ix = snap_find(td->snap, key);
+	if (ix >= 0) {
+	    return &td->snap->en[ix].ad;
+	}
+    }
+    return 0;
+}
+
+/*
+ * delta_prefix_match() - Account the prefix matches of a delta trie,
+ *			  lengths set in decided are owned by a higher layer.
+ *			  key is cut temporarily to find the next shorter 
+ *			  match.
+ */
+static void 
+delta_prefix_match(cp_trie *trie, char *key, char *decided, int *count,
+		   view_match_t *vm, int top)
+{
+    node_data_t *nd;
+    int matches;
+    int len;
+    int cut = -1;
+    char cut_ch = 0;
+
+    if (!cp_trie_count(trie)) {
+    	return;
+    }
+
+    while (1) {
+    	nd = 0;
+    	matches = cp_trie_prefix_match(trie, key, (void **)&nd);
+	if ((matches <= 0) || !nd) {
+	    break;
+	}
+	len = nd->dh.key_strlen;
+	if (isclr(decided, len)) {
+	    setbit(decided, len);
+	    if (nd->dh.magicno == DH_MAGICNO) {
+	    	(*count)++;
+		if (!vm->ad || (len > vm->key_strlen)) {
+		    vm->ad = &nd->ad;
+		    vm->nd = top ? nd : 0;
+		    vm->key_strlen = len;
+		}
+	    }
+	}
+	if ((matches == 1) || !len) {
+	    break;
+	}
+	if (cut >= 0) {
+	    key[cut] = cut_ch;
+	}
+	cut = len - 1;
+	cut_ch = key[cut];
+	key[cut] = '\0';
+    }
+
+    if (cut >= 0) {
+    	key[cut] = cut_ch;
+    }
+}
+
+static void 
+snap_prefix_match(const ptrie_snap_t *snap, const char *key, int key_strlen,
+		  char *decided, int *count, view_match_t *vm)
+{
+    long ix;
+    int len;
+
+    for (ix = snap_prefix_ix(snap, key, key_strlen); ix >= 0; 
+    	 ix = snap->en[ix].prefix_ix) {
+	len = snap->en[ix].key_strlen;
+	if (isclr(decided, len)) {
+	    setbit(decided, len);
+	    (*count)++;
+	    if (!vm->ad || (len > vm->key_strlen)) {
+		vm->ad = &snap->en[ix].ad;
+		vm->nd = 0;
+		vm->key_strlen = len;
+	    }
+	}
+    }
+}
+
+/*
+ * view_prefix_match() - Longest prefix match of the view in vm
+ *
+ * Return: number of keys which are a prefix of key, as 
+ *	   cp_trie_prefix_match()
+ */
+static int 
+view_prefix_match(const trie_data_t *td, const char *key, view_match_t *vm)
+{
+    char buf[KEYMAXSIZE + 1];
+    char decided[(KEYMAXSIZE + NBBY) / NBBY];
+    int key_strlen;
+    int count = 0;
+
+    memset(vm, 0, sizeof(*vm));
+    memset(decided, 0, sizeof(decided));
+
+    // Keys are at most KEYMAXSIZE, so are the prefixes which can match
+    key_strlen = strnlen(key, KEYMAXSIZE);
+    memcpy(buf, key, key_strlen);
+    buf[key_strlen] = '\0';
+
+    delta_prefix_match(td->trie, buf, decided, &count, vm, 1);
+    if (!td->reset) {
+    	if (td->frozen) {
+	    delta_prefix_match(td->frozen, buf, decided, &count, vm, 0);
+	}
+	if (td->snap && !(td->frozen && td->frozen_reset)) {
+	    snap_prefix_match(td->snap, buf, key_strlen, decided, &count, vm);
+	}
+    }
+    return count;
+}
+
+static int 
+apply_log_rec(ptrie_context_t *ctx, trie_data_t *td, int type,
+	      const char *key, int key_strlen, const app_data_t *ad)
+{
+    int ret;
+
+    switch(type) {
+    case PT_XC_ADD:
+    case PT_XC_UPDATE:
+    	ret = delta_put(ctx, td->trie, key, key_strlen, DH_MAGICNO, ad);
+	break;
+
+    case PT_XC_DELETE:
+    	ret = delta_put(ctx, td->trie, key, key_strlen, DH_MAGICNO_FREE, 0);
+	break;
+
+    case PT_XC_RESET:
+    	// Delete all trie entries, hide the layers below
+    	ret = reset_cp_trie(td);
+	if (!ret) {
+	    td->reset = 1;
+	}
+	break;
+
+    default:
+	LOGMSG("Unknown type=%d", type);
+	ret = 6;
+	break;
+    }
+    return ret;
+}
+
+static int 
+apply_log2delta(ptrie_context_t *ctx, trie_data_t *td, trie_xaction_log_t *log)
+{
+    trie_xaction_entry_t *te;
+    int n;
+    int ret;
+
+    for (n = 0; n < log->entries; n++) {
+    	te = &log->en[n];
+	ret = apply_log_rec(ctx, td, te->type, te->fn.key, strlen(te->fn.key),
+			    &te->fn.nd.ad);
+	if (ret) {
+	    LOGMSG("apply_log_rec() failed, trie=%p key=%s type=%d ret=%d",
+		   td->trie, te->fn.key, te->type, ret);
+	    return ret;
+	}
+    }
+    return 0;
+}
+
+/*
+ *******************************************************************************
+ * Snapshot mode, delta log interfaces
+ *******************************************************************************
+ */
+#define FNV1A_64_INIT 0xcbf29ce484222325ULL
+
+typedef struct log_seg_map {
+    int fd;
+    char *map;
+    size_t size;
+} log_seg_map_t;
+
+/*
+ * log_group_proc_t - Called for each record (lr != 0) and then for the
+ *		      commit (lr == 0) of an intact group
+ */
+typedef int (*log_group_proc_t)(void *arg, const log_rec_t *lr, 
+				const log_commit_t *lc);
+
+static uint64_t 
+fnv1a_64(uint64_t h, const void *buf, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)buf;
+
+    while (len--) {
+    	h ^= *p++;
+	h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static void 
+log_seg_name(const ptrie_context_t *ctx, long gen, char *buf, int bufsize)
+{
+    snprintf(buf, bufsize, "%s.log.%ld", ctx->snap_name, gen);
+}
+
+static int 
+create_log_seg(ptrie_context_t *ctx, long gen, int *pfd)
+{
+    char name[PATH_MAX];
+    log_seg_header_t lh;
+    ssize_t bytes_written;
+    int fd;
+
+    log_seg_name(ctx, gen, name, sizeof(name));
+    fd = open(name, O_CREAT|O_TRUNC|O_RDWR, 0600);
+    if (fd < 0) {
+    	LOGMSG("open(%s) failed, errno=%d", name, errno);
+	return 1;
+    }
+
+    memset(&lh, 0, sizeof(lh));
+    lh.version = LS_VERSION;
+    lh.magicno = LS_MAGICNO;
+    lh.gen = gen;
+    bytes_written = pwrite(fd, &lh, sizeof(lh), 0);
+    if (bytes_written != (ssize_t)sizeof(lh)) {
+    	LOGMSG("pwrite(%s) short xfer, bytes_written=%ld bytes=%ld",
+	       name, bytes_written, sizeof(lh));
+	close(fd);
+	return 2;
+    }
+    if (fdatasync(fd) || fsync_dir(name)) {
+    	LOGMSG("sync of %s failed, errno=%d", name, errno);
+	close(fd);
+	return 3;
+    }
+    *pfd = fd;
+    return 0;
+}
+
+static void 
+unmap_log_seg(log_seg_map_t *lm)
+{
+    if (lm->map) {
+    	munmap(lm->map, lm->size);
+	lm->map = 0;
+    }
+    if (lm->fd >= 0) {
+    	close(lm->fd);
+	lm->fd = -1;
+    }
+}
+
+/*
+ * map_log_seg() - Open and map log segment gen
+ *
+ * Return: 0 => Success, -1 => Not found, >0 => Error
+ */
+static int 
+map_log_seg(ptrie_context_t *ctx, long gen, int oflags, log_seg_map_t *lm)
+{
+    char name[PATH_MAX];
+    struct stat sbuf;
+    const log_seg_header_t *lh;
+    char *map;
+
+    memset(lm, 0, sizeof(*lm));
+    lm->fd = -1;
+    log_seg_name(ctx, gen, name, sizeof(name));
+
+    lm->fd = open(name, oflags);
+    if (lm->fd < 0) {
+    	if (errno == ENOENT) {
+	    return -1;
+	}
+    	LOGMSG("open(%s) failed, errno=%d", name, errno);
+	return 1;
+    }
+    if (fstat(lm->fd, &sbuf)) {
+    	LOGMSG("fstat(%s) failed, errno=%d", name, errno);
+	unmap_log_seg(lm);
+	return 2;
+    }
+    if (sbuf.st_size < (off_t)sizeof(log_seg_header_t)) {
+    	LOGMSG("%s short file, st_size=%ld", name, sbuf.st_size);
+	unmap_log_seg(lm);
+	return 3;
+    }
+
+    map = mmap((void *) 0, sbuf.st_size, PROT_READ, MAP_SHARED, lm->fd, 0);
+    if (map == MAP_FAILED) {
+    	LOGMSG("mmap(%s) failed, errno=%d", name, errno);
+	unmap_log_seg(lm);
+	return 4;
+    }
+    lm->map = map;
+    lm->size = sbuf.st_size;
+    madvise(lm->map, lm->size, MADV_SEQUENTIAL);
+
+    lh = (const log_seg_header_t *)lm->map;
+    if ((lh->version != LS_VERSION) || (lh->magicno != LS_MAGICNO) || 
+    	(lh->gen != gen)) {
+	LOGMSG("%s invalid header, version=0x%x magic=0x%lx gen=%ld",
+	       name, lh->version, lh->magicno, lh->gen);
+	unmap_log_seg(lm);
+	return 5;
+    }
+    return 0;
+}
+
+/*
+ * scan_log_seg() - Validate and process the groups of a mapped segment,
+ *		    stops at the first torn or invalid group.
+ *
+ * Return: 0 => Success, *pend is the end of the last intact group
+ */
+static int 
+scan_log_seg(const log_seg_map_t *lm, log_group_proc_t proc, void *arg,
+	     off_t *pend)
+{
+    const log_rec_t *lr;
+    const log_commit_t *lc;
+    off_t goff = sizeof(log_seg_header_t);
+    off_t off;
+    off_t coff;
+    uint64_t csum;
+    size_t rsize;
+    int records;
+    int ret;
+
+    while (1) {
+    	// Validate group
+    	off = goff;
+	csum = FNV1A_64_INIT;
+	records = 0;
+	lc = 0;
+	while ((off + sizeof(int)) <= lm->size) {
+	    lr = (const log_rec_t *)(lm->map + off);
+	    if (lr->magicno == LR_MAGICNO_COMMIT) {
+	    	if ((off + sizeof(log_commit_t)) <= lm->size) {
+		    lc = (const log_commit_t *)lr;
+		}
+	    	break;
+	    }
+	    if ((lr->magicno != LR_MAGICNO) || 
+	    	((off + sizeof(log_rec_t)) > lm->size) ||
+		(lr->key_strlen < 0) || (lr->key_strlen > KEYMAXSIZE)) {
+		break;
+	    }
+	    rsize = LOG_REC_SIZE(lr->key_strlen);
+	    if (((off + rsize) > lm->size) || lr->key[lr->key_strlen]) {
+	    	break;
+	    }
+	    csum = fnv1a_64(csum, lr, rsize);
+	    records++;
+	    off += rsize;
+	}
+	if (!lc || (lc->records != records) || (lc->csum != csum)) {
+	    break;
+	}
+
+	// Process group
+	coff = off;
+	for (off = goff; off < coff; off += LOG_REC_SIZE(lr->key_strlen)) {
+	    lr = (const log_rec_t *)(lm->map + off);
+	    ret = (*proc)(arg, lr, lc);
+	    if (ret) {
+	    	return ret;
+	    }
+	}
+	ret = (*proc)(arg, 0, lc);
+	if (ret) {
+	    return ret;
+	}
+	goff = coff + sizeof(log_commit_t);
+    }
+    *pend = goff;
+    return 0;
+}
+
+/*
+ * log_append_xaction() - Append the xaction log as one group, not synced
+ */
+static int 
+log_append_xaction(ptrie_context_t *ctx, trie_xaction_log_t *log, 
+		   long seqno, const struct timespec *ts, 
+		   const fh_user_data_t *fhd)
+{
+    trie_xaction_entry_t *te;
+    log_rec_t *lr;
+    log_commit_t *lc;
+    size_t bytes = sizeof(log_commit_t);
+    size_t rsize;
+    ssize_t bytes_written;
+    uint64_t csum = FNV1A_64_INIT;
+    int key_strlen;
+    char *p;
+    int n;
+
+    for (n = 0; n < log->entries; n++) {
+    	bytes += LOG_REC_SIZE(strlen(log->en[n].fn.key));
+    }
+    if (bytes > ctx->log_bufsize) {
+    	p = REALLOC(ctx->log_buf, bytes);
+	if (!p) {
+	    LOGMSG("realloc failed, bytes=%ld", bytes);
+	    return 1;
+	}
+	ctx->log_buf = p;
+	ctx->log_bufsize = bytes;
+    }
+
+    p = ctx->log_buf;
+    for (n = 0; n < log->entries; n++) {
+    	te = &log->en[n];
+	key_strlen = strlen(te->fn.key);
+	rsize = LOG_REC_SIZE(key_strlen);
+
+	lr = (log_rec_t *)p;
+	memset(lr, 0, rsize);
+	lr->magicno = LR_MAGICNO;
+	lr->type = te->type;
+	lr->key_strlen = key_strlen;
+	lr->ad = te->fn.nd.ad;
+	memcpy(lr->key, te->fn.key, key_strlen);
+	csum = fnv1a_64(csum, lr, rsize);
+	p += rsize;
+    }
+
+    lc = (log_commit_t *)p;
+    memset(lc, 0, sizeof(*lc));
+    lc->magicno = LR_MAGICNO_COMMIT;
+    lc->records = log->entries;
+    lc->seqno = seqno;
+    lc->csum = csum;
+    lc->ts = *ts;
+    if (fhd) {
+    	lc->ud = *fhd;
+    }
+
+    bytes_written = pwrite(ctx->log_fd, ctx->log_buf, bytes, ctx->log_off);
+    if (bytes_written != (ssize_t)bytes) {
+    	LOGMSG("pwrite(fd=%d) short xfer, bytes_written=%ld bytes=%ld "
+	       "errno=%d", ctx->log_fd, bytes_written, bytes, errno);
+	if (ftruncate(ctx->log_fd, ctx->log_off)) {
+	    LOGMSG("ftruncate(fd=%d, %ld) failed, errno=%d", 
+	    	   ctx->log_fd, ctx->log_off, errno);
+	}
+	return 2;
+    }
+    ctx->log_off += bytes;
+    ctx->log_records += log->entries;
+    return 0;
+}
+
+/*
+ * log_commit_sync() - Make the group of seqno durable, synchronously
+ *		       or by the log sync thread (group commit)
+ */
+static int 
+log_commit_sync(ptrie_context_t *ctx, long seqno)
+{
+    int rv = 0;
+
+    pthread_mutex_lock(&ctx->sync_mutex);
+    ctx->written_seqno = seqno;
+    if (!ctx->group_commit_msecs) {
+    	if (fdatasync(ctx->log_fd)) {
+	    LOGSEV("fdatasync(fd=%d) failed, errno=%d",
+		   ctx->log_fd, errno);
+	    rv = 1;
+	} else {
+	    ctx->synced_seqno = seqno;
+	}
+	ctx->log_syncs++;
+    } else {
+	pthread_cond_broadcast(&ctx->sync_cond);
+    }
+    pthread_mutex_unlock(&ctx->sync_mutex);
+    return rv;
+}
+
+/*
+ * log_sync_thread() - Group commit, one fdatasync() for the groups 
+ *		       written within group_commit_msecs
+ */
+static void *
+log_sync_thread(void *arg)
+{
+    ptrie_context_t *ctx = (ptrie_context_t *)arg;
+    struct timespec now;
+    struct timespec due;
+    long seqno;
+    int fd;
+    int ret;
+
+    clock_gettime(CLOCK_MONOTONIC, &due);
+
+    pthread_mutex_lock(&ctx->sync_mutex);
+    while (!ctx->snap_shutdown) {
+    	if (ctx->sync_error || (ctx->written_seqno == ctx->synced_seqno)) {
+	    ctx->sync_now = 0;
+	    pthread_cond_wait(&ctx->sync_cond, &ctx->sync_mutex);
+	    continue;
+	}
+
+	// Let the group fill up, unless ptrie_sync() is waiting
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (!ctx->sync_now && ((now.tv_sec < due.tv_sec) || 
+	    ((now.tv_sec == due.tv_sec) && (now.tv_nsec < due.tv_nsec)))) {
+	    pthread_cond_timedwait(&ctx->sync_cond, &ctx->sync_mutex, &due);
+	    continue;
+	}
+
+	seqno = ctx->written_seqno;
+	fd = ctx->log_fd;
+	ctx->sync_busy = 1;
+	pthread_mutex_unlock(&ctx->sync_mutex);
+
+	ret = fdatasync(fd);
+
+	pthread_mutex_lock(&ctx->sync_mutex);
+	ctx->sync_busy = 0;
+	if (!ret) {
+	    if (seqno > ctx->synced_seqno) {
+	    	ctx->synced_seqno = seqno;
+	    }
+	} else {
+	    ctx->sync_error = errno;
+	    LOGSEV("fdatasync(fd=%d) failed, errno=%d",
+		   fd, errno);
+	}
+	ctx->log_syncs++;
+
+	clock_gettime(CLOCK_MONOTONIC, &due);
+	due.tv_sec += ctx->group_commit_msecs / 1000;
+	due.tv_nsec += (ctx->group_commit_msecs % 1000) * 1000000;
+	if (due.tv_nsec >= 1000000000) {
+	    due.tv_sec++;
+	    due.tv_nsec -= 1000000000;
+	}
+	pthread_cond_broadcast(&ctx->sync_cond);
+    }
+    pthread_mutex_unlock(&ctx->sync_mutex);
+    return 0;
+}
+
+typedef struct replay_arg {
+    ptrie_context_t *ctx;
+    trie_data_t *td[2];
+    long min_seqno; // Groups <= min_seqno are in the snapshot
+    long seqno;
+    long records;
+    fh_user_data_t ud;
+} replay_arg_t;
+
+static int 
+replay_proc(void *arg, const log_rec_t *lr, const log_commit_t *lc)
+{
+    replay_arg_t *ra = (replay_arg_t *)arg;
+    int n;
+    int ret;
+
+    if (lc->seqno <= ra->min_seqno) {
+    	return 0;
+    }
+    if (!lr) {
+    	ra->seqno = lc->seqno;
+	ra->ud = lc->ud;
+	return 0;
+    }
+
+    ra->records++;
+    for (n = 0; n < 2; n++) {
+    	if (ra->td[n]) {
+	    ret = apply_log_rec(ra->ctx, ra->td[n], lr->type, lr->key, 
+	    			lr->key_strlen, &lr->ad);
+	    if (ret) {
+	    	return ret;
+	    }
+	}
+    }
+    return 0;
+}
+
+/*
+ * recover_delta_from_log() - Rebuild td->trie from the live segment
+ */
+static int 
+recover_delta_from_log(ptrie_context_t *ctx, trie_data_t *td)
+{
+    log_seg_map_t lm;
+    replay_arg_t ra;
+    off_t end;
+    int ret;
+
+    ret = reset_cp_trie(td);
+    if (ret) {
+    	return 1;
+    }
+    td->reset = 0;
+
+    ret = map_log_seg(ctx, ctx->log_gen, O_RDONLY, &lm);
+    if (ret) {
+    	LOGMSG("map_log_seg(gen=%ld) failed, ret=%d", ctx->log_gen, ret);
+    	return 2;
+    }
+
+    memset(&ra, 0, sizeof(ra));
+    ra.ctx = ctx;
+    ra.td[0] = td;
+    ra.min_seqno = ctx->snap->hdr->u.hdr.seqno;
+    ret = scan_log_seg(&lm, replay_proc, &ra, &end);
+    unmap_log_seg(&lm);
+    if (ret) {
+    	LOGMSG("scan_log_seg(gen=%ld) failed, ret=%d", ctx->log_gen, ret);
+	return 3;
+    }
+    if (end != ctx->log_off) {
+    	LOGMSG("Log end mismatch, end=%ld log_off=%ld", end, ctx->log_off);
+    }
+    return 0;
+}
+
+/*
+ *******************************************************************************
+ * Snapshot mode, compaction
+ *
+ * The live delta is frozen on a new log segment, then the frozen segments
+ * are merged with the snapshot into a new snapshot by the compaction
+ * thread without holding snap_mutex.  Installing the snapshot drops the 
+ * frozen layer.
+ *******************************************************************************
+ */
+typedef struct compact_rec {
+    const char *key;
+    int key_strlen;
+    int type;
+    long order;
+    const app_data_t *ad;
+} compact_rec_t;
+
+typedef struct compact_arg {
+    compact_rec_t *rec;
+    long entries;
+    long maxentries;
+    long order;
+    int drop_snap; // PT_XC_RESET seen
+    long seqno;
+    fh_user_data_t ud;
+} compact_arg_t;
+
+static int 
+compact_collect_proc(void *arg, const log_rec_t *lr, const log_commit_t *lc)
+{
+    compact_arg_t *ca = (compact_arg_t *)arg;
+    compact_rec_t *rec;
+    long maxentries;
+
+    if (!lr) {
+    	ca->seqno = lc->seqno;
+	ca->ud = lc->ud;
+	return 0;
+    }
+    if (lr->type == PT_XC_RESET) {
+    	ca->entries = 0;
+	ca->drop_snap = 1;
+	return 0;
+    }
+
+    if (ca->entries >= ca->maxentries) {
+    	maxentries = ca->maxentries ? (2 * ca->maxentries) : (64 * 1024);
+	rec = REALLOC(ca->rec, maxentries * sizeof(compact_rec_t));
+	if (!rec) {
+	    LOGMSG("realloc failed, entries=%ld", maxentries);
+	    return 1;
+	}
+	ca->rec = rec;
+	ca->maxentries = maxentries;
+    }
+    rec = &ca->rec[ca->entries++];
+    rec->key = lr->key;
+    rec->key_strlen = lr->key_strlen;
+    rec->type = lr->type;
+    rec->order = ca->order++;
+    rec->ad = &lr->ad;
+    return 0;
+}
+
+static int 
+cmp_compact_rec(const void *p1, const void *p2)
+{
+    const compact_rec_t *r1 = (const compact_rec_t *)p1;
+    const compact_rec_t *r2 = (const compact_rec_t *)p2;
+    int cmp;
+
+    cmp = strcmp(r1->key, r2->key);
+    if (cmp) {
+    	return cmp;
+    }
+    return (r1->order > r2->order) - (r1->order < r2->order);
+}
+
+/*
+ * build_snapshot() - Merge snap with the log segments [snap log_gen, 
+ *		      live_gen) into a new snapshot file
+ */
+static int 
+build_snapshot(ptrie_context_t *ctx, const ptrie_snap_t *snap, long live_gen)
+{
+    compact_arg_t ca;
+    log_seg_map_t *lm;
+    snap_src_t *src = 0;
+    long snap_gen = snap->hdr->u.hdr.log_gen;
+    long nseg = live_gen - snap_gen;
+    long sn;
+    long ns;
+    long n;
+    long m;
+    off_t end;
+    int cmp;
+    int ret;
+    int rv = 0;
+
+    memset(&ca, 0, sizeof(ca));
+    ca.seqno = snap->hdr->u.hdr.seqno;
+    ca.ud = snap->hdr->u.hdr.ud;
+
+    lm = (log_seg_map_t *)CALLOC(nseg ? nseg : 1, sizeof(log_seg_map_t));
+    if (!lm) {
+    	LOGMSG("calloc failed");
+	return 1;
+    }
+    for (n = 0; n < nseg; n++) {
+    	lm[n].fd = -1;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    while (1) { // Begin while
+    ////////////////////////////////////////////////////////////////////////////
+
+    for (n = 0; n < nseg; n++) {
+    	ret = map_log_seg(ctx, snap_gen + n, O_RDONLY, &lm[n]);
+	if (ret) {
+	    LOGMSG("map_log_seg(gen=%ld) failed, ret=%d", snap_gen + n, ret);
+	    rv = 2;
+	    break;
+	}
+	ret = scan_log_seg(&lm[n], compact_collect_proc, &ca, &end);
+	if (ret) {
+	    LOGMSG("scan_log_seg(gen=%ld) failed, ret=%d", snap_gen + n, ret);
+	    rv = 3;
+	    break;
+	}
+    }
+    if (rv) {
+    	break;
+    }
+
+    // Last record of each key decides
+    qsort(ca.rec, ca.entries, sizeof(compact_rec_t), cmp_compact_rec);
+    for (n = 0, m = 0; n < ca.entries; n++) {
+    	if (((n + 1) < ca.entries) && 
+	    !strcmp(ca.rec[n].key, ca.rec[n + 1].key)) {
+	    continue;
+	}
+	ca.rec[m++] = ca.rec[n];
+    }
+    ca.entries = m;
+
+    sn = ca.drop_snap ? 0 : snap->hdr->u.hdr.entries;
+    src = (snap_src_t *)MALLOC(((sn + ca.entries) * sizeof(snap_src_t)) + 1);
+    if (!src) {
+    	LOGMSG("malloc failed, entries=%ld", sn + ca.entries);
+	rv = 4;
+	break;
+    }
+
+    // Merge join, the log record decides on equal keys
+    for (n = 0, m = 0, ns = 0; (n < sn) || (m < ca.entries); ) {
+    	if (m >= ca.entries) {
+	    cmp = -1;
+	} else if (n >= sn) {
+	    cmp = 1;
+	} else {
+	    cmp = strcmp(SNAP_KEY(snap, n), ca.rec[m].key);
+	}
+
+	if (cmp < 0) {
+	    src[ns].key = SNAP_KEY(snap, n);
+	    src[ns].key_strlen = snap->en[n].key_strlen;
+	    src[ns].ad = &snap->en[n].ad;
+	    ns++;
+	    n++;
+	} else {
+	    if (!cmp) {
+	    	n++;
+	    }
+	    if (ca.rec[m].type != PT_XC_DELETE) {
+		src[ns].key = ca.rec[m].key;
+		src[ns].key_strlen = ca.rec[m].key_strlen;
+		src[ns].ad = ca.rec[m].ad;
+		ns++;
+	    }
+	    m++;
+	}
+    }
+
+    ret = write_snapshot(ctx->snap_name, src, ns, ca.seqno, live_gen, &ca.ud);
+    if (ret) {
+    	LOGMSG("write_snapshot(%s) failed, ret=%d", ctx->snap_name, ret);
+	rv = 5;
+	break;
+    }
+    break;
+
+    ////////////////////////////////////////////////////////////////////////////
+    } // End while
+    ////////////////////////////////////////////////////////////////////////////
+
+    for (n = 0; n < nseg; n++) {
+    	unmap_log_seg(&lm[n]);
+    }
+    FREE(lm);
+    if (src) {
+    	FREE(src);
+    }
+    if (ca.rec) {
+    	FREE(ca.rec);
+    }
+    return rv;
+}
+
+/*
+ * rotate_log_seg() - Make the live segment durable and switch to gen+1
+ */
+static int 
+rotate_log_seg(ptrie_context_t *ctx)
+{
+    int old_fd;
+    int fd;
+    int rv = 0;
+
+    pthread_mutex_lock(&ctx->sync_mutex);
+    while (ctx->sync_busy) {
+    	pthread_cond_wait(&ctx->sync_cond, &ctx->sync_mutex);
+    }
+
+    while (1) {
+	// The frozen segment is complete on disk before gen+1 exists
+	if (fdatasync(ctx->log_fd)) {
+	    LOGSEV("fdatasync(fd=%d) failed, errno=%d",
+		   ctx->log_fd, errno);
+	    rv = 1;
+	    break;
+	}
+	ctx->synced_seqno = ctx->written_seqno;
+
+	if (create_log_seg(ctx, ctx->log_gen + 1, &fd)) {
+	    rv = 2;
+	    break;
+	}
+	old_fd = ctx->log_fd;
+	ctx->log_fd = fd;
+	ctx->log_gen++;
+	ctx->log_off = sizeof(log_seg_header_t);
+	ctx->log_records = 0;
+	close(old_fd);
+	break;
+    }
+
+    pthread_cond_broadcast(&ctx->sync_cond);
+    pthread_mutex_unlock(&ctx->sync_mutex);
+    return rv;
+}
+
+/*
+ * freeze_delta() - Move the live delta to the frozen layer, snap_mutex held
+ */
+static int 
+freeze_delta(ptrie_context_t *ctx)
+{
+    cp_trie *trie[2];
+    trie_data_t *td;
+
+    trie[0] = create_cp_trie();
+    trie[1] = create_cp_trie();
+    if (!trie[0] || !trie[1]) {
+    	LOGMSG("create_cp_trie() failed");
+	if (trie[0]) {
+	    cp_trie_destroy(trie[0]);
+	}
+	if (trie[1]) {
+	    cp_trie_destroy(trie[1]);
+	}
+	return 1;
+    }
+
+    if (rotate_log_seg(ctx)) {
+	cp_trie_destroy(trie[0]);
+	cp_trie_destroy(trie[1]);
+    	return 2;
+    }
+
+    td = ctx->shdw_td;
+    td->frozen = td->trie;
+    td->frozen_reset = td->reset;
+    td->trie = trie[0];
+    td->reset = 0;
+    switch_trie_data(ctx);
+
+    td = ctx->shdw_td;
+    cp_trie_destroy(td->trie);
+    td->trie = trie[1];
+    td->reset = 0;
+    td->frozen = ctx->cur_td->frozen;
+    td->frozen_reset = ctx->cur_td->frozen_reset;
+    return 0;
+}
+
+/*
+ * install_snapshot() - Replace the snapshot and frozen layers by the new 
+ *			snapshot file, snap_mutex held
+ */
+static int 
+install_snapshot(ptrie_context_t *ctx)
+{
+    ptrie_snap_t *snap;
+    ptrie_snap_t *old_snap = ctx->snap;
+    cp_trie *frozen = ctx->cur_td->frozen;
+    char name[PATH_MAX];
+    trie_data_t *td;
+    long gen;
+    int n;
+
+    snap = open_snapshot(ctx->snap_name);
+    if (!snap) {
+    	return 1;
+    }
+
+    for (n = 0; n < 2; n++) {
+    	td = ctx->shdw_td;
+	td->snap = snap;
+	td->frozen = 0;
+	td->frozen_reset = 0;
+	if (!n) {
+	    switch_trie_data(ctx);
+	}
+    }
+    ctx->snap = snap;
+    if (frozen) {
+    	cp_trie_destroy(frozen);
+    }
+
+    // Merged log segments
+    for (gen = old_snap->hdr->u.hdr.log_gen; gen < snap->hdr->u.hdr.log_gen; 
+    	 gen++) {
+	log_seg_name(ctx, gen, name, sizeof(name));
+	if (unlink(name) && (errno != ENOENT)) {
+	    LOGMSG("unlink(%s) failed, errno=%d", name, errno);
+	}
+    }
+    close_snapshot(old_snap);
+    return 0;
+}
+
+static void *
+compact_thread(void *arg)
+{
+    ptrie_context_t *ctx = (ptrie_context_t *)arg;
+    ptrie_snap_t *snap;
+    long live_gen;
+    int ret;
+
+    pthread_mutex_lock(&ctx->snap_mutex);
+    while (1) {
+    	while (!ctx->snap_shutdown && !ctx->compact_request) {
+	    pthread_cond_wait(&ctx->snap_cond, &ctx->snap_mutex);
+	}
+	if (ctx->snap_shutdown) {
+	    break;
+	}
+	ctx->compact_request = 0;
+	ctx->compact_running = 1;
+	ret = 0;
+
+	// No xaction in progress, a frozen layer left by recovery or 
+	// a failed compaction is merged first
+	if (!ctx->cur_td->frozen) {
+	    if (!ctx->log_records) {
+	    	ret = -1; // Nothing to do
+	    } else {
+		ret = freeze_delta(ctx);
+		if (ret) {
+		    LOGMSG("freeze_delta() failed, ret=%d", ret);
+		}
+	    }
+	}
+
+	if (!ret) {
+	    snap = ctx->snap;
+	    live_gen = ctx->log_gen;
+	    pthread_mutex_unlock(&ctx->snap_mutex);
+
+	    ret = build_snapshot(ctx, snap, live_gen);
+
+	    pthread_mutex_lock(&ctx->snap_mutex);
+	    if (!ret) {
+	    	ret = install_snapshot(ctx);
+	    }
+	    if (ret) {
+	    	LOGMSG("Compaction failed, ret=%d", ret);
+	    } else {
+	    	LOGMSG("Compaction done, log_gen=%ld entries=%ld", 
+		       ctx->snap->hdr->u.hdr.log_gen, 
+		       ctx->snap->hdr->u.hdr.entries);
+	    }
+	}
+	if (ret > 0) {
+	    ctx->compact_errors++;
+	}
+	ctx->compactions++;
+	ctx->compact_running = 0;
+	pthread_cond_broadcast(&ctx->snap_cond);
+    }
+    pthread_mutex_unlock(&ctx->snap_mutex);
+    return 0;
+}
+
+/*
+ *******************************************************************************
+ * Snapshot mode, external interface support
+ *******************************************************************************
+ */
+static int 
+snap_add(ptrie_context_t *ctx, const char *key, app_data_t *ad)
+{
+    trie_data_t *td = ctx->shdw_td;
+    data_header_t dh;
+    int key_strlen;
+    int ret;
+
+    key_strlen = strlen(key);
+    if (key_strlen > KEYMAXSIZE) {
+    	LOGMSG("key_strlen(%d) > KEYMAXSIZE, ctx=%p", key_strlen, ctx);
+	return 2;
+    }
+
+    memset(&dh, 0, sizeof(dh));
+    dh.loff = -1;
+    dh.key_strlen = key_strlen;
+    ret = add_log_entry(ctx, 
+    			view_exact_match(td, key, 0) ? PT_XC_UPDATE : PT_XC_ADD,
+			key, &dh, ad);
+    if (ret) {
+	LOGMSG("add_log_entry() failed, ctx=%p ret=%d", ctx, ret);
+	return (ret > 0) ? (200 + ret) : -1;
+    }
+
+    ret = delta_put(ctx, td->trie, key, key_strlen, DH_MAGICNO, ad);
+    if (ret) {
+    	return 3;
+    }
+    return 0;
+}
+
+static int 
+snap_remove(ptrie_context_t *ctx, const char *key)
+{
+    trie_data_t *td = ctx->shdw_td;
+    const app_data_t *ad;
+    data_header_t dh;
+    int ret;
+
+    ad = view_exact_match(td, key, 0);
+    if (!ad) {
+    	return 0;
+    }
+
+    memset(&dh, 0, sizeof(dh));
+    dh.loff = -1;
+    dh.key_strlen = strlen(key);
+    ret = add_log_entry(ctx, PT_XC_DELETE, key, &dh, ad);
+    if (ret) {
+	LOGMSG("add_log_entry() failed, ctx=%p ret=%d", ctx, ret);
+	return (ret > 0) ? (100 + ret) : -1;
+    }
+
+    ret = delta_put(ctx, td->trie, key, dh.key_strlen, DH_MAGICNO_FREE, 0);
+    if (ret) {
+    	return 2;
+    }
+    return 0;
+}
+
+static int 
+snap_reset(ptrie_context_t *ctx)
+{
+    data_header_t dh;
+    app_data_t ad;
+    int ret;
+
+    memset(&dh, 0, sizeof(dh));
+    memset(&ad, 0, sizeof(ad));
+    ret = add_log_entry(ctx, PT_XC_RESET, "", &dh, &ad);
+    if (ret) {
+	LOGMSG("add_log_entry() failed, ctx=%p ret=%d", ctx, ret);
+	return (ret > 0) ? (100 + ret) : -1;
+    }
+
+    ret = apply_log_rec(ctx, ctx->shdw_td, PT_XC_RESET, "", 0, 0);
+    if (ret) {
+	LOGMSG("apply_log_rec() failed, ctx=%p ret=%d", ctx, ret);
+    	return 2;
+    }
+    return 0;
+}
+
+/*
+ * snap_copy_up() - Return the delta trie node of key, a match in a lower
+ *		    layer is copied into the delta trie so that updates 
+ *		    through the returned app_data_t reach the delta.
+ */
+static node_data_t *
+snap_copy_up(ptrie_context_t *ctx, const char *key, int key_strlen,
+	     const app_data_t *ad, node_data_t *nd)
+{
+    char buf[KEYMAXSIZE + 1];
+
+    if (nd) {
+    	return nd;
+    }
+    memcpy(buf, key, key_strlen);
+    buf[key_strlen] = '\0';
+
+    if (delta_put(ctx, ctx->shdw_td->trie, buf, key_strlen, DH_MAGICNO, ad)) {
+    	return 0;
+    }
+    return (node_data_t *)cp_trie_exact_match(ctx->shdw_td->trie, buf);
+}
+
+static int 
+snap_tr_prefix_match(ptrie_context_t *ctx, const char *key, app_data_t **ad)
+{
+    view_match_t vm;
+    node_data_t *nd;
+    int rv;
+
+    *ad = 0;
+    rv = view_prefix_match(ctx->shdw_td, key, &vm);
+    if (rv <= 0) {
+    	return rv;
+    }
+    nd = snap_copy_up(ctx, key, vm.key_strlen, vm.ad, vm.nd);
+    if (!nd) {
+    	return 0;
+    }
+    *ad = &nd->ad;
+    return rv;
+}
+
+static app_data_t *
+snap_tr_exact_match(ptrie_context_t *ctx, const char *key)
+{
+    const app_data_t *ad;
+    node_data_t *nd;
+
+    ad = view_exact_match(ctx->shdw_td, key, &nd);
+    if (!ad) {
+    	return 0;
+    }
+    nd = snap_copy_up(ctx, key, strlen(key), ad, nd);
+    return nd ? &nd->ad : 0;
+}
+
+static int 
+snap_update_appdata(ptrie_context_t *ctx, const char *key,
+		    app_data_t *orig_ad, const app_data_t *new_ad)
+{
+    char nd_key[KEYMAXSIZE + 1];
+    node_data_t *nd;
+    int key_strlen;
+    int ret;
+
+    nd = APPDATA2NODEDATA_SNAP(orig_ad);
+    if (nd->dh.magicno != DH_MAGICNO) {
+    	return 2; // Invalid orig_ad ptr
+    }
+
+    // Log the node key, key may be longer after ptrie_tr_prefix_match()
+    key_strlen = nd->dh.key_strlen;
+    if ((key_strlen > KEYMAXSIZE) || 
+    	((int)strnlen(key, key_strlen) < key_strlen)) {
+	LOGMSG("key/node mismatch, key=%s key_strlen=%d", key, key_strlen);
+    	return 3;
+    }
+    memcpy(nd_key, key, key_strlen);
+    nd_key[key_strlen] = '\0';
+
+    ret = add_log_entry(ctx, PT_XC_UPDATE, nd_key, &nd->dh, new_ad);
+    if (ret) {
+    	LOGMSG("add_log_entry() failed, ctx=%p ret=%d", ctx, ret);
+	return (ret > 0) ? (100 + ret) : -1;
+    }
+    if (ctx->copy_app_data) {
+	(*ctx->copy_app_data)(new_ad, orig_ad);
+    } else {
+	*orig_ad = *new_ad;
+    }
+    return 0;
+}
+
+static int 
+snap_end_xaction(ptrie_context_t *ctx, int commit, fh_user_data_t *fhd)
+{
+    struct timespec ts;
+    off_t log_off;
+    long seqno;
+    int ret;
+    int rv = 0;
+
+    ////////////////////////////////////////////////////////////////////////////
+    while (1) { // Begin while
+    ////////////////////////////////////////////////////////////////////////////
+
+    if (!ctx->log->entries) {
+    	break; // Nothing do do
+    }
+
+    if (!commit) {
+	ret = recover_delta_from_log(ctx, ctx->shdw_td);
+	if (ret) {
+	    LOGSEV("FATAL recover_delta_from_log() failed, ret=%d", ret);
+	    rv = -10; // fatal error
+	}
+	break;
+    }
+
+    // Append the xaction to the delta log
+    seqno = ctx->log_seqno + 1;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    log_off = ctx->log_off;
+
+    ret = log_append_xaction(ctx, ctx->log, seqno, &ts, fhd);
+    if (!ret && log_commit_sync(ctx, seqno)) {
+    	if (ftruncate(ctx->log_fd, log_off)) {
+	    LOGSEV("FATAL ftruncate(fd=%d) failed, errno=%d", 
+	    	   ctx->log_fd, errno);
+	    rv = -20; // fatal error
+	    break;
+	}
+	ctx->log_off = log_off;
+	ctx->log_records -= ctx->log->entries;
+	ret = 10;
+    }
+    if (ret) {
+	LOGMSG("Log append failed, ret=%d", ret);
+	if (recover_delta_from_log(ctx, ctx->shdw_td)) {
+	    LOGSEV("FATAL recover_delta_from_log() failed");
+	    rv = -50; // fatal error
+	} else {
+	    rv = 100 + ret; // abort commit
+	}
+	break;
+    }
+    ctx->log_seqno = seqno;
+    if (fhd) {
+    	ctx->snap_ud = *fhd;
+    }
+
+    // Switch readers to updated delta, wait for the stale delta references
+    switch_trie_data(ctx);
+
+    // Apply log to stale delta
+    ret = apply_log2delta(ctx, ctx->shdw_td, ctx->log);
+    if (ret) {
+	LOGMSG("apply_log2delta() failed, trie=%p ret=%d", 
+	       ctx->shdw_td->trie, ret);
+	ret = recover_delta_from_log(ctx, ctx->shdw_td);
+	if (ret) {
+	    LOGSEV("recover_delta_from_log() failed, trie=%p ret=%d", 
+		   ctx->shdw_td->trie, ret);
+	    rv = -300; // fatal error
+	}
+    }
+
+    if ((ctx->log_records >= ctx->compact_log_records) && 
+    	!ctx->compact_running) {
+	ctx->compact_request = 1;
+	pthread_cond_broadcast(&ctx->snap_cond);
+    }
+    break;
+
+    ////////////////////////////////////////////////////////////////////////////
+    } // End while
+    ////////////////////////////////////////////////////////////////////////////
+
+    return rv;
+}
+
+typedef struct list_arg {
+    trie_data_t *td;
+    const ptrie_snap_t *snap; // Visible snapshot
+    cp_trie *listed;
+    void *proc_arg;
+    int (*proc)(const char *key, void *proc_arg);
+    int aborted;
+} list_arg_t;
+
+static int 
+list_log_key_proc(void *arg, const log_rec_t *lr, const log_commit_t *lc)
+{
+    list_arg_t *la = (list_arg_t *)arg;
+    int ret;
+
+    UNUSED_ARGUMENT(lc);
+    if (!lr || la->aborted || 
+    	((lr->type != PT_XC_ADD) && (lr->type != PT_XC_UPDATE))) {
+	return 0;
+    }
+    if (la->snap && (snap_find(la->snap, lr->key) >= 0)) {
+    	return 0; // Listed with the snapshot keys
+    }
+    if (!view_exact_match(la->td, lr->key, 0) ||
+    	cp_trie_exact_match(la->listed, (char *)lr->key)) {
+	return 0;
+    }
+    if (cp_trie_add(la->listed, (char *)lr->key, la)) {
+    	LOGMSG("cp_trie_add() failed, key=%s", lr->key);
+	la->aborted = 2;
+	return 0;
+    }
+
+    ret = (*la->proc)(lr->key, la->proc_arg);
+    if (ret) {
+	LOGMSG("list operation aborted, callback ret=%d", ret);
+	la->aborted = 1;
+    }
+    return 0;
+}
+
+/*
+ * snap_list_keys() - Keys of the td view, the visible snapshot keys 
+ *		      followed by the keys added by the log segments
+ */
+static int 
+snap_list_keys(ptrie_context_t *ctx, trie_data_t *td, void *proc_arg,
+	       int (*proc)(const char *key, void *proc_arg))
+{
+    list_arg_t la;
+    log_seg_map_t lm;
+    off_t end;
+    long gen;
+    long ix;
+    int ret;
+
+    memset(&la, 0, sizeof(la));
+    la.td = td;
+    la.proc_arg = proc_arg;
+    la.proc = proc;
+    if (!td->reset && !(td->frozen && td->frozen_reset)) {
+    	la.snap = td->snap;
+    }
+
+    if (la.snap) {
+    	for (ix = 0; ix < la.snap->hdr->u.hdr.entries; ix++) {
+	    if (!view_exact_match(td, SNAP_KEY(la.snap, ix), 0)) {
+	    	continue;
+	    }
+	    ret = (*proc)(SNAP_KEY(la.snap, ix), proc_arg);
+	    if (ret) {
+    		LOGMSG("list operation aborted, callback ret=%d", ret);
+		return 5;
+	    }
+	}
+    }
+
+    la.listed = cp_trie_create_trie(COLLECTION_MODE_NOSYNC, 0, 0);
+    if (!la.listed) {
+    	LOGMSG("cp_trie_create_trie() failed");
+	return 6;
+    }
+
+    // Segments not merged into the snapshot, the last one is live
+    for (gen = td->snap->hdr->u.hdr.log_gen; !la.aborted; gen++) {
+    	ret = map_log_seg(ctx, gen, O_RDONLY, &lm);
+	if (ret) {
+	    break;
+	}
+	scan_log_seg(&lm, list_log_key_proc, &la, &end);
+	unmap_log_seg(&lm);
+    }
+    cp_trie_destroy(la.listed);
+
+    return la.aborted ? (la.aborted == 1 ? 5 : 6) : 0;
+}
+
+static int 
+cmp_snap_src(const void *p1, const void *p2)
+{
+    return strcmp(((const snap_src_t *)p1)->key, ((const snap_src_t *)p2)->key);
+}
+
+/*
+ * import_ckpt_files() - Create the initial snapshot from the most recent
+ *			 consistent checkpoint file
+ */
+static int 
+import_ckpt_files(ptrie_context_t *ctx, const char *ckp_file1, 
+		  const char *ckp_file2)
+{
+    const char *name[2];
+    file_header_t fh[2];
+    file_header_t fh2;
+    fh_user_data_t ud;
+    struct stat sbuf;
+    file_node_data_t *fn;
+    snap_src_t *src = 0;
+    char *fmap = 0;
+    size_t fsize = 0;
+    long entries = 0;
+    int fd[2] = {-1, -1};
+    int use = -1;
+    int n;
+    int ret;
+    int rv = 0;
+
+    name[0] = ckp_file1;
+    name[1] = ckp_file2;
+    for (n = 0; n < 2; n++) {
+    	fd[n] = open(name[n], O_RDONLY);
+	if (fd[n] < 0) {
+	    continue;
+	}
+	if (fstat(fd[n], &sbuf) || (sbuf.st_size < META_HDRSIZE) ||
+	    read_file_header(fd[n], 1, &fh[n]) || 
+	    read_file_header(fd[n], 2, &fh2) ||
+	    memcmp(&fh[n], &fh2, sizeof(fh2)) ||
+	    (fh[n].u.hdr.version != FH_VERSION) ||
+	    (fh[n].u.hdr.magicno != FH_MAGICNO)) {
+	    LOGMSG("%s not consistent, not imported", name[n]);
+	    close(fd[n]);
+	    fd[n] = -1;
+	    continue;
+	}
+	if ((use < 0) || (fh[n].u.hdr.seqno > fh[use].u.hdr.seqno)) {
+	    use = n;
+	}
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    while (1) { // Begin while
+    ////////////////////////////////////////////////////////////////////////////
+
+    if (use < 0) {
+    	LOGMSG("No checkpoint file to import");
+	memset(&ud, 0, sizeof(ud));
+	rv = write_snapshot(ctx->snap_name, 0, 0, 0, 1, &ud);
+	break;
+    }
+
+    if (fstat(fd[use], &sbuf)) {
+    	LOGMSG("fstat(%s) failed, errno=%d", name[use], errno);
+	rv = 1;
+	break;
+    }
+    fsize = sbuf.st_size;
+    fmap = mmap((void *) 0, fsize, PROT_READ, MAP_SHARED, fd[use], 0);
+    if (fmap == MAP_FAILED) {
+    	LOGMSG("mmap(%s) failed, errno=%d", name[use], errno);
+	fmap = 0;
+	rv = 2;
+	break;
+    }
+    madvise(fmap, fsize, MADV_SEQUENTIAL);
+
+    src = (snap_src_t *)MALLOC((((fsize - META_HDRSIZE) / 
+			       sizeof(file_node_data_t)) + 1) * 
+			       sizeof(snap_src_t));
+    if (!src) {
+    	LOGMSG("malloc failed");
+	rv = 3;
+	break;
+    }
+
+    for (fn = (file_node_data_t *)(fmap + LOFF2FOFF(0)); 
+    	 (char *)(fn + 1) <= &fmap[fsize]; fn++) {
+    	if (fn->nd.dh.magicno == DH_MAGICNO) {
+	    src[entries].key = fn->key;
+	    src[entries].key_strlen = strnlen(fn->key, KEYMAXSIZE);
+	    src[entries].ad = &fn->nd.ad;
+	    entries++;
+	}
+    }
+    qsort(src, entries, sizeof(snap_src_t), cmp_snap_src);
+
+    ret = write_snapshot(ctx->snap_name, src, entries, 0, 1, 
+    			 &fh[use].u.hdr.ud);
+    if (ret) {
+    	rv = 4;
+	break;
+    }
+    LOGMSG("Imported %ld keys from %s, seqno=%ld", 
+	   entries, name[use], fh[use].u.hdr.seqno);
+    break;
+
+    ////////////////////////////////////////////////////////////////////////////
+    } // End while
+    ////////////////////////////////////////////////////////////////////////////
+
+    if (fmap) {
+    	munmap(fmap, fsize);
+    }
+    if (src) {
+    	FREE(src);
+    }
+    for (n = 0; n < 2; n++) {
+    	if (fd[n] >= 0) {
+	    close(fd[n]);
+	}
+    }
+    return rv;
+}
+
+/*
+ * close_snap_mode() - Stop the snapshot mode threads, release the layers
+ *		       shared by both trie_data_t(s)
+ */
+static void 
+close_snap_mode(ptrie_context_t *ctx)
+{
+    pthread_mutex_lock(&ctx->snap_mutex);
+    pthread_mutex_lock(&ctx->sync_mutex);
+    ctx->snap_shutdown = 1;
+    pthread_cond_broadcast(&ctx->sync_cond);
+    pthread_mutex_unlock(&ctx->sync_mutex);
+    pthread_cond_broadcast(&ctx->snap_cond);
+    pthread_mutex_unlock(&ctx->snap_mutex);
+
+    if (ctx->compact_tid) {
+    	pthread_join(ctx->compact_tid, 0);
+	ctx->compact_tid = 0;
+    }
+    if (ctx->sync_tid) {
+    	pthread_join(ctx->sync_tid, 0);
+	ctx->sync_tid = 0;
+    }
+
+    if (ctx->log_fd >= 0) {
+    	if (fdatasync(ctx->log_fd)) {
+	    LOGMSG("fdatasync(fd=%d) failed, errno=%d", ctx->log_fd, errno);
+	}
+    	close(ctx->log_fd);
+	ctx->log_fd = -1;
+    }
+
+    if (ctx->td[0].frozen) {
+    	cp_trie_destroy(ctx->td[0].frozen);
+    }
+    ctx->td[0].frozen = 0;
+    ctx->td[1].frozen = 0;
+    ctx->td[0].snap = 0;
+    ctx->td[1].snap = 0;
+
+    close_snapshot(ctx->snap);
+    ctx->snap = 0;
+
+    if (ctx->snap_name) {
+    	FREE(ctx->snap_name);
+	ctx->snap_name = 0;
+    }
+    if (ctx->log_buf) {
+    	FREE(ctx->log_buf);
+	ctx->log_buf = 0;
+	ctx->log_bufsize = 0;
+    }
+}
+
+/*
+ *******************************************************************************
+ * External Interface Functions
+ *******************************************************************************
+ */
+
+/*
+ * ptrie_init() - Subsystem initialization
+ *
+ * NULL proc arg will use the system default.
+ *
+ * Return:
+ *  ==0, Success
+ *  !=0, Error
+ */
+int 
+ptrie_init(const ptrie_config_t *cfg)
+{
+    assert(sizeof(file_header_t) == DEV_BSIZE);
+
+    if (!cfg) {
+    	return 1;
+    }
+
+    if (cfg->interface_version != PTRIE_INTF_VERSION) {
+    	return 2;
+    }
+
+    if (cfg->log_level) {
+    	ptrie_log_level = cfg->log_level;
+    } else {
+    	ptrie_log_level = &ptrie_def_log_level;
+    }
+
+    if (cfg->proc_logfunc) {
+    	ptrie_logfunc = cfg->proc_logfunc;
+    } else {
+    	ptrie_logfunc = internal_logfunc;
+    }
+
+    if (cfg->proc_malloc) {
+    	ptrie_malloc = cfg->proc_malloc;
+    } else {
+    	ptrie_malloc = malloc;
+    }
+
+    if (cfg->proc_calloc) {
+    	ptrie_calloc = cfg->proc_calloc;
+    } else {
+    	ptrie_calloc = calloc;
+    }
+
+    if (cfg->proc_realloc) {
+    	ptrie_realloc = cfg->proc_realloc;
+    } else {
+    	ptrie_realloc = realloc;
+    }
+
+    if (cfg->proc_free) {
+    	ptrie_free = cfg->proc_free;
+    } else {
+    	ptrie_free = free;
+    }
+
+    AO_store(&init_complete, 1);
+
+    return 0;
+}
+
+/*
+ * new_ptrie_context() - Create Persistent Trie (ptrie) context
+ *
+ * NULL proc arg implies no action required.
+ *
+ * Return:
+ *  !=0, Success, pointer ptrie_context_t
+ *  == 0, Error
+ */
+ptrie_context_t *
+new_ptrie_context(void (*copy_app_data)(const app_data_t *src,
+				    	app_data_t *dest),
+		  void (*destruct_app_data)(app_data_t *d))
+{
+    ptrie_context_t *ctx = 0;
+
+    if (!AO_load(&init_complete)) {
+	LOGSEV("FATAL Subsystem not initialized, ptrie_init() not called");
+	return 0;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    while (1) { // Begin while
+    ////////////////////////////////////////////////////////////////////////////
+
+    ctx = (ptrie_context_t *)CALLOC(1, sizeof(ptrie_context_t));
+    if (!ctx) {
+	LOGMSG("new_ptrie_context(), calloc failed");
+	break;
+    }
+    ctx->f[0].file_fd = -1;
+    ctx->f[0].freemap.mapsize = MAX_TRIE_ENTRIES / NBBY;
+    ctx->f[0].freemap.map = CALLOC(1, ctx->f[0].freemap.mapsize);
+    if (!ctx->f[0].freemap.map) {
+	LOGMSG("f[0].freemap.map, calloc failed");
+	break;
+    }
+
+    ctx->f[1].file_fd = -1;
+    ctx->f[1].freemap.mapsize = MAX_TRIE_ENTRIES / NBBY;
+    ctx->f[1].freemap.map = CALLOC(1, ctx->f[1].freemap.mapsize);
+    if (!ctx->f[1].freemap.map) {
+	LOGMSG("f[1].freemap.map, calloc failed");
+	break;
+    }
+
+    ctx->bi_ckpt_file_bmap.mapsize =  MAX_TRIE_ENTRIES / NBBY;
+    ctx->bi_ckpt_file_bmap.map = CALLOC(1, ctx->bi_ckpt_file_bmap.mapsize);
+    if (!ctx->bi_ckpt_file_bmap.map) {
+	LOGMSG("bi_ckpt_file_bmap.map, calloc failed");
+	break;
+    }
+
+    ctx->log = CALLOC(1, sizeof(trie_xaction_log_t));
+    if (!ctx->log) {
+	LOGMSG("log, calloc failed");
+	break;
+    }
+
+    ctx->copy_app_data = copy_app_data;
+    ctx->destruct_app_data = destruct_app_data;
+
+    return ctx;
+
+    ////////////////////////////////////////////////////////////////////////////
+    } // End while
+    ////////////////////////////////////////////////////////////////////////////
+
+    if (ctx) {
+	if (ctx->f[0].freemap.map) {
+	    FREE(ctx->f[0].freemap.map);
+	    ctx->f[0].freemap.map = 0;
+	}
+
+	if (ctx->f[1].freemap.map) {
+	    FREE(ctx->f[1].freemap.map);
+	    ctx->f[1].freemap.map = 0;
+	}
+
+	if (ctx->bi_ckpt_file_bmap.map) {
+	    FREE(ctx->bi_ckpt_file_bmap.map);
+	    ctx->bi_ckpt_file_bmap.map = 0;
+	}
+
+	if (ctx->log) {
+	    FREE(ctx->log);
+	    ctx->log = 0;
+	}
+
+	if (ctx) {
+	    FREE(ctx);
+	    ctx = 0;
+	}
+    }
+    return 0;
+}
+
+/*
+ * delete_ptrie_context() - Delete Persistent Trie (ptrie) context
+ */
+void 
+delete_ptrie_context(ptrie_context_t *ctx)
+{
+    if (ctx) {
+    	if (ctx->snap_mode) {
+	    close_snap_mode(ctx);
+	}
+
+    	if (ctx->f[0].file_fd >= 0) {
+	    close(ctx->f[0].file_fd);
+	    ctx->f[0].file_fd = -1;
+	}
+
+    	if (ctx->f[0].freemap.map) {
+	    FREE(ctx->f[0].freemap.map);
+	    ctx->f[0].freemap.map = 0;
+    	}
+
+    	if (ctx->f[1].file_fd >= 0) {
+	    close(ctx->f[1].file_fd);
+	    ctx->f[1].file_fd = -1;
+	}
+
+    	if (ctx->f[1].freemap.map) {
 	    FREE(ctx->f[1].freemap.map);
 	    ctx->f[1].freemap.map = 0;
     	}
@@ -1653,21 +3763,328 @@ ptrie_recover_from_ckpt(ptrie_context_t *ctx,
     return rv;
 }
 
-#define GET_TRIE_DATA(_ctx, _td) { \
-    uint64_t _val; \
-    _val = AO_load(&(_ctx)->active_td); \
-    (_td) = (trie_data_t *)_val; \
-    if ((_td)) { \
-    	AO_fetch_and_add1(&(_td)->refcnt); \
-    } \
+/*
+ * ptrie_recover_from_snapshot() - Recover Trie from snapshot and delta log
+ *
+ * Return:
+ *  ==0, Success
+ *  !=0, Error
+ */
+int 
+ptrie_recover_from_snapshot(ptrie_context_t *ctx, const char *snap_file,
+			    const char *ckp_file1, const char *ckp_file2,
+			    const ptrie_snap_config_t *cfg)
+{
+    pthread_condattr_t cattr;
+    struct stat sbuf;
+    log_seg_map_t lm;
+    replay_arg_t ra;
+    trie_data_t ftd;
+    fh_user_data_t ud;
+    char name[PATH_MAX];
+    const snap_header_t *sh;
+    long gen;
+    long last_gen;
+    off_t end;
+    int n;
+    int ret;
+    int rv = 0;
+
+    LOGMSG("snap_file=%s ckpt_f1=%s ckpt_f2=%s", snap_file,
+	   ckp_file1 ? ckp_file1 : "", ckp_file2 ? ckp_file2 : "");
+
+    ctx->f[0].file_fd = -1;
+    ctx->f[1].file_fd = -1;
+    ctx->td[0].trie = 0;
+    ctx->td[1].trie = 0;
+    ctx->log_fd = -1;
+    memset(&ftd, 0, sizeof(ftd));
+
+    ctx->snap_mode = 1;
+    ctx->group_commit_msecs = cfg ? cfg->group_commit_msecs : 0;
+    ctx->compact_log_records = (cfg && cfg->compact_log_records) ?
+		cfg->compact_log_records : PTRIE_DEF_COMPACT_LOG_RECORDS;
+    ctx->fnode_incarnation = 1;
+
+    pthread_mutex_init(&ctx->snap_mutex, 0);
+    pthread_cond_init(&ctx->snap_cond, 0);
+    pthread_mutex_init(&ctx->sync_mutex, 0);
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&ctx->sync_cond, &cattr);
+    pthread_condattr_destroy(&cattr);
+
+    ////////////////////////////////////////////////////////////////////////////
+    while (1) { // Begin while
+    ////////////////////////////////////////////////////////////////////////////
+
+    ctx->snap_name = MALLOC(strlen(snap_file) + 1);
+    if (!ctx->snap_name) {
+    	LOGMSG("malloc failed");
+	rv = 1;
+	break;
+    }
+    strcpy(ctx->snap_name, snap_file);
+
+    if (stat(snap_file, &sbuf)) {
+    	if (errno != ENOENT) {
+	    LOGMSG("stat(%s) failed, errno=%d", snap_file, errno);
+	    rv = 2;
+	    break;
+	}
+	if (ckp_file1 && ckp_file2) {
+	    ret = import_ckpt_files(ctx, ckp_file1, ckp_file2);
+	} else {
+	    memset(&ud, 0, sizeof(ud));
+	    ret = write_snapshot(snap_file, 0, 0, 0, 1, &ud);
+	}
+	if (ret) {
+	    LOGMSG("Initial snapshot %s not created, ret=%d", snap_file, ret);
+	    rv = 3;
+	    break;
+	}
+    }
+
+    ctx->snap = open_snapshot(snap_file);
+    if (!ctx->snap) {
+    	rv = 4;
+	break;
+    }
+    sh = ctx->snap->hdr;
+
+    ctx->td[0].trie = create_cp_trie();
+    ctx->td[1].trie = create_cp_trie();
+    if (!ctx->td[0].trie || !ctx->td[1].trie) {
+	LOGMSG("create_cp_trie() failed");
+    	rv = 5;
+	break;
+    }
+
+    // Segments merged into the snapshot, the removal was interrupted
+    for (gen = sh->u.hdr.log_gen - 1; gen > 0; gen--) {
+    	log_seg_name(ctx, gen, name, sizeof(name));
+	if (unlink(name)) {
+	    break;
+	}
+	LOGMSG("Removed merged log segment %s", name);
+    }
+
+    last_gen = sh->u.hdr.log_gen;
+    while (1) {
+    	log_seg_name(ctx, last_gen + 1, name, sizeof(name));
+	if (stat(name, &sbuf)) {
+	    break;
+	}
+	last_gen++;
+    }
+
+    memset(&ra, 0, sizeof(ra));
+    ra.ctx = ctx;
+    ra.min_seqno = sh->u.hdr.seqno;
+    ra.seqno = sh->u.hdr.seqno;
+    ra.ud = sh->u.hdr.ud;
+
+    // Segments frozen by an interrupted compaction
+    if (last_gen > sh->u.hdr.log_gen) {
+	ftd.trie = create_cp_trie();
+	if (!ftd.trie) {
+	    LOGMSG("create_cp_trie() failed");
+	    rv = 6;
+	    break;
+	}
+	ra.td[0] = &ftd;
+	for (gen = sh->u.hdr.log_gen; gen < last_gen; gen++) {
+	    ret = map_log_seg(ctx, gen, O_RDONLY, &lm);
+	    if (ret) {
+		LOGMSG("map_log_seg(gen=%ld) failed, ret=%d", gen, ret);
+		rv = 7;
+		break;
+	    }
+	    ret = scan_log_seg(&lm, replay_proc, &ra, &end);
+	    if (!ret && (end != (off_t)lm.size)) {
+	    	LOGMSG("Frozen log segment gen=%ld truncated at %ld, size=%ld",
+		       gen, end, lm.size);
+	    }
+	    unmap_log_seg(&lm);
+	    if (ret) {
+		LOGMSG("scan_log_seg(gen=%ld) failed, ret=%d", gen, ret);
+		rv = 8;
+		break;
+	    }
+	}
+	if (rv) {
+	    break;
+	}
+	for (n = 0; n < 2; n++) {
+	    ctx->td[n].frozen = ftd.trie;
+	    ctx->td[n].frozen_reset = ftd.reset;
+	}
+	ftd.trie = 0;
+	ctx->compact_request = 1;
+    }
+
+    // Live segment
+    ctx->log_gen = last_gen;
+    ret = map_log_seg(ctx, last_gen, O_RDWR, &lm);
+    if (ret) {
+    	// Missing or without a valid header, no commit can be in it
+	if (create_log_seg(ctx, last_gen, &ctx->log_fd)) {
+	    rv = 9;
+	    break;
+	}
+	ctx->log_off = sizeof(log_seg_header_t);
+    } else {
+	ra.td[0] = &ctx->td[0];
+	ra.td[1] = &ctx->td[1];
+	ra.records = 0;
+	ret = scan_log_seg(&lm, replay_proc, &ra, &end);
+	if (ret) {
+	    LOGMSG("scan_log_seg(gen=%ld) failed, ret=%d", last_gen, ret);
+	    unmap_log_seg(&lm);
+	    rv = 10;
+	    break;
+	}
+	if (end != (off_t)lm.size) {
+	    LOGMSG("Torn log segment gen=%ld, truncate size=%ld to %ld",
+		   last_gen, lm.size, end);
+	    if (ftruncate(lm.fd, end) || fdatasync(lm.fd)) {
+	    	LOGMSG("ftruncate(gen=%ld) failed, errno=%d", last_gen, errno);
+		unmap_log_seg(&lm);
+		rv = 11;
+		break;
+	    }
+	}
+	ctx->log_fd = lm.fd;
+	lm.fd = -1;
+	unmap_log_seg(&lm);
+	ctx->log_off = end;
+	ctx->log_records = ra.records;
+    }
+    ctx->log_seqno = ra.seqno;
+    ctx->snap_ud = ra.ud;
+    ctx->written_seqno = ra.seqno;
+    ctx->synced_seqno = ra.seqno;
+
+    for (n = 0; n < 2; n++) {
+	ctx->td[n].snap = ctx->snap;
+    }
+    AO_store(&ctx->active_td, (uint64_t)&ctx->td[0]);
+    ctx->cur_td = &ctx->td[0];
+    ctx->shdw_td = &ctx->td[1];
+
+    ret = pthread_create(&ctx->compact_tid, 0, compact_thread, ctx);
+    if (ret) {
+    	LOGMSG("pthread_create() failed, ret=%d", ret);
+	ctx->compact_tid = 0;
+	rv = 12;
+	break;
+    }
+    if (ctx->group_commit_msecs) {
+	ret = pthread_create(&ctx->sync_tid, 0, log_sync_thread, ctx);
+	if (ret) {
+	    LOGMSG("pthread_create() failed, ret=%d", ret);
+	    ctx->sync_tid = 0;
+	    rv = 13;
+	    break;
+	}
+    }
+
+    LOGMSG("Recovered seqno=%ld log_gen=%ld log_records=%ld", 
+	   ctx->log_seqno, ctx->log_gen, ctx->log_records);
+    break;
+
+    ////////////////////////////////////////////////////////////////////////////
+    } // End while
+    ////////////////////////////////////////////////////////////////////////////
+
+    if (ftd.trie) {
+    	cp_trie_destroy(ftd.trie);
+    }
+    if (rv) {
+    	close_snap_mode(ctx);
+
+	if (ctx->td[0].trie) {
+	    cp_trie_destroy(ctx->td[0].trie);
+	    ctx->td[0].trie = 0;
+	}
+	if (ctx->td[1].trie) {
+	    cp_trie_destroy(ctx->td[1].trie);
+	    ctx->td[1].trie = 0;
+	}
+	ctx->snap_mode = 0;
+    }
+    return rv;
 }
 
-#define SET_TRIE_DATA(_ctx, _td) { \
-    AO_store(&(_ctx)->active_td, (_td)); \
+/*
+ * ptrie_sync() - Update side, wait until all commits are on stable storage
+ *
+ * Return:
+ *  ==0, Success
+ *  !=0, Error
+ */
+int
+ptrie_sync(ptrie_context_t *ctx)
+{
+    long seqno;
+    int rv = 0;
+
+    if (!ctx->snap_mode) {
+    	return 0;
+    }
+
+    pthread_mutex_lock(&ctx->sync_mutex);
+    seqno = ctx->written_seqno;
+    while ((ctx->synced_seqno < seqno) && !ctx->sync_error && 
+    	   ctx->sync_tid) {
+	ctx->sync_now = 1;
+	pthread_cond_broadcast(&ctx->sync_cond);
+	pthread_cond_wait(&ctx->sync_cond, &ctx->sync_mutex);
+    }
+    if (ctx->sync_error || (ctx->synced_seqno < seqno)) {
+    	rv = 1;
+    }
+    pthread_mutex_unlock(&ctx->sync_mutex);
+    return rv;
 }
 
-#define RELEASE_TRIE_DATA(_td) { \
-    AO_fetch_and_sub1(&(_td)->refcnt); \
+/*
+ * ptrie_compact() - Update side, request a snapshot compaction
+ *
+ * Return:
+ *  ==0, Success
+ *  !=0, Error
+ */
+int
+ptrie_compact(ptrie_context_t *ctx, int wait)
+{
+    long errors;
+    long target;
+    int rv = 0;
+
+    if (!ctx->snap_mode) {
+    	return 1;
+    }
+    if (AO_load(&ctx->in_xaction)) {
+	LOGMSG("Invoked under ptrie_begin_xaction(), ctx=%p", ctx);
+    	return 2;
+    }
+
+    pthread_mutex_lock(&ctx->snap_mutex);
+    errors = ctx->compact_errors;
+    // A running compaction may have frozen the delta already
+    target = ctx->compactions + (ctx->compact_running ? 2 : 1);
+    ctx->compact_request = 1;
+    pthread_cond_broadcast(&ctx->snap_cond);
+
+    while (wait && !ctx->snap_shutdown && (ctx->compactions < target)) {
+    	pthread_cond_wait(&ctx->snap_cond, &ctx->snap_mutex);
+    }
+    if (wait && (ctx->compact_errors != errors)) {
+    	rv = 3;
+    }
+    pthread_mutex_unlock(&ctx->snap_mutex);
+    return rv;
 }
 
 /*
@@ -1683,6 +4100,8 @@ ptrie_prefix_match(ptrie_context_t *ctx, const char *key, app_data_t *ad)
 {
     trie_data_t *td;
     node_data_t *nd;
+    view_match_t vm;
+    const app_data_t *pad = 0;
     int rv = 0;
 
     GET_TRIE_DATA(ctx, td);
@@ -1691,12 +4110,20 @@ ptrie_prefix_match(ptrie_context_t *ctx, const char *key, app_data_t *ad)
     	return 0; // Should never happen
     }
 
-    rv = cp_trie_prefix_match(td->trie, (char *)key, (void **)&nd);
+    if (ctx->snap_mode) {
+    	rv = view_prefix_match(td, key, &vm);
+	pad = vm.ad;
+    } else {
+	rv = cp_trie_prefix_match(td->trie, (char *)key, (void **)&nd);
+	if (rv > 0) {
+	    pad = &nd->ad;
+	}
+    }
     if (rv > 0) {
     	if (ctx->copy_app_data) {
-	    (*ctx->copy_app_data)(&nd->ad, ad);
+	    (*ctx->copy_app_data)(pad, ad);
 	} else {
-	    *ad = nd->ad;
+	    *ad = *pad;
 	}
     } 
 
@@ -1720,6 +4147,7 @@ ptrie_exact_match(ptrie_context_t *ctx, const char *key, app_data_t *ad)
 {
     trie_data_t *td;
     node_data_t *nd;
+    const app_data_t *pad;
     int rv = 0;
 
     GET_TRIE_DATA(ctx, td);
@@ -1728,12 +4156,17 @@ ptrie_exact_match(ptrie_context_t *ctx, const char *key, app_data_t *ad)
     	return 1; // Should never happen
     }
 
-    nd = (node_data_t *)cp_trie_exact_match(td->trie, (char *)key); 
-    if (nd) {
+    if (ctx->snap_mode) {
+    	pad = view_exact_match(td, key, 0);
+    } else {
+	nd = (node_data_t *)cp_trie_exact_match(td->trie, (char *)key); 
+	pad = nd ? &nd->ad : 0;
+    }
+    if (pad) {
     	if (ctx->copy_app_data) {
-	    (*ctx->copy_app_data)(&nd->ad, ad);
+	    (*ctx->copy_app_data)(pad, ad);
 	} else {
-	    *ad = nd->ad;
+	    *ad = *pad;
 	}
     } else {
     	rv = 2;
@@ -1821,6 +4254,18 @@ ptrie_list_keys(ptrie_context_t *ctx, void *proc_arg,
     file_node_data_t *fn;
     file_header_t *filehdr_1;
     file_header_t *filehdr_2;
+    trie_data_t *td;
+
+    if (ctx->snap_mode) {
+	GET_TRIE_DATA(ctx, td);
+	if (!td) {
+	    LOGMSG("td == 0, ctx=%p", ctx);
+	    return 1; // Should never happen
+	}
+	rv = snap_list_keys(ctx, td, proc_arg, proc);
+	RELEASE_TRIE_DATA(td);
+	return rv;
+    }
 
     rv = ptrie_lock(ctx);
     if (rv) {
@@ -1905,6 +4350,9 @@ ptrie_tr_prefix_match(ptrie_context_t *ctx, const char *key, app_data_t **ad)
     	LOGMSG("ptrie_begin_xaction() not called, ctx=%p", ctx);
     	return 0; // ptrie_begin_xaction() not called
     }
+    if (ctx->snap_mode) {
+    	return snap_tr_prefix_match(ctx, key, ad);
+    }
 
     rv = cp_trie_prefix_match(ctx->shdw_td->trie, (char *)key, (void **)&nd);
     if (rv > 0) {
@@ -1937,6 +4385,9 @@ ptrie_tr_exact_match(ptrie_context_t *ctx, const char *key)
     	LOGMSG("ptrie_begin_xaction() not called, ctx=%p", ctx);
     	return 0; // ptrie_begin_xaction() not called
     }
+    if (ctx->snap_mode) {
+    	return snap_tr_exact_match(ctx, key);
+    }
 
     nd = (node_data_t *)cp_trie_exact_match(ctx->shdw_td->trie, (char *)key); 
     if (nd) {
@@ -1979,6 +4430,9 @@ ptrie_update_appdata(ptrie_context_t *ctx, const char *key,
     	LOGMSG("ptrie_begin_xaction() not called, ctx=%p", ctx);
     	return 1; // ptrie_begin_xaction() not called
     }
+    if (ctx->snap_mode) {
+    	return snap_update_appdata(ctx, key, orig_ad, new_ad);
+    }
 
     nd = APPDATA2NODEDATA(orig_ad);
     if (nd->dh.magicno != DH_MAGICNO) {
@@ -2030,6 +4484,9 @@ ptrie_add(ptrie_context_t *ctx, const char *key, app_data_t *ad)
     	LOGMSG("ptrie_begin_xaction() not called, ctx=%p", ctx);
     	return 1; // ptrie_begin_xaction() not called
     }
+    if (ctx->snap_mode) {
+    	return snap_add(ctx, key, ad);
+    }
 
     key_strlen = strlen(key);
     nd = (node_data_t *)cp_trie_exact_match(ctx->shdw_td->trie, (char *)key); 
@@ -2112,6 +4569,9 @@ ptrie_remove(ptrie_context_t *ctx, const char *key)
     	LOGMSG("ptrie_begin_xaction() not called, ctx=%p", ctx);
     	return 1; // ptrie_begin_action() not called
     }
+    if (ctx->snap_mode) {
+    	return snap_remove(ctx, key);
+    }
 
     nd = (node_data_t *)cp_trie_exact_match(ctx->shdw_td->trie, (char *)key); 
 
@@ -2178,6 +4638,10 @@ ptrie_reset(ptrie_context_t *ctx)
     data_header_t dh;
     app_data_t ad;
     
+    if (ctx->snap_mode) {
+    	return snap_reset(ctx);
+    }
+
     ////////////////////////////////////////////////////////////////////////////
     while (1) {
     ////////////////////////////////////////////////////////////////////////////
@@ -2234,7 +4698,9 @@ ptrie_reset(ptrie_context_t *ctx)
 const fh_user_data_t *
 ptrie_get_fh_data(ptrie_context_t *ctx)
 {
-    if (ctx->cur_ckpt_file) {
+    if (ctx->snap_mode) {
+    	return &ctx->snap_ud;
+    } else if (ctx->cur_ckpt_file) {
     	return &ctx->cur_ckpt_file->fhd1.u.hdr.ud;
     } else {
     	return 0;
@@ -2266,6 +4732,12 @@ ptrie_begin_xaction(ptrie_context_t *ctx)
     }
     ctx->log->entries = 0;
 
+    if (ctx->snap_mode) {
+    	// Excludes log segment and layer switches by the compaction thread
+    	pthread_mutex_lock(&ctx->snap_mutex);
+	return 0;
+    }
+
     rv = copy_ckpt_file_alloc_data(ctx);
     if (rv) {
 	LOGMSG("copy_ckpt_file_alloc_data(ctx=%p) failed, rv=%d", ctx, rv);
@@ -2294,9 +4766,6 @@ ptrie_end_xaction(ptrie_context_t *ctx, int commit, fh_user_data_t *fhd)
     int ret2;
     long seqno;
     struct timespec ts;
-    trie_data_t *tmp_td;
-    struct pollfd pfd;
-    long refcnt;
 
     LOGMSG("ctx=%p commit=%d fhd=%p", ctx, commit, fhd);
 
@@ -2304,6 +4773,14 @@ ptrie_end_xaction(ptrie_context_t *ctx, int commit, fh_user_data_t *fhd)
 	return 1; // ptrie_begin_action() not called
     }
 
+    if (ctx->snap_mode) {
+    	rv = snap_end_xaction(ctx, commit, fhd);
+	AO_fetch_and_sub1(&ctx->in_xaction);
+	ctx->log->entries = 0;
+	pthread_mutex_unlock(&ctx->snap_mutex);
+	return rv;
+    }
+
     ret = restore_ckpt_file_alloc_data(ctx);
     if (ret) {
     	LOGMSG("restore_ckpt_file_alloc_data(ctx=%p) failed, ret=%d", ctx, ret);
@@ -2368,26 +4845,8 @@ ptrie_end_xaction(ptrie_context_t *ctx, int commit, fh_user_data_t *fhd)
 	break;
     }
 
-    // Switch readers to updated trie 
-    SET_TRIE_DATA(ctx, (uint64_t)ctx->shdw_td);
-    tmp_td = ctx->cur_td;
-    ctx->cur_td = ctx->shdw_td;
-    ctx->shdw_td = tmp_td;
-
-    // Wait until no user references exist prior to updating the stale trie 
-    refcnt = 0;
-    while (1) {
-        // Always delay at least one interval
-    	if (refcnt) {
-	    LOGMSG("Waiting for (refcnt(%ld) == 0), ctx=%p trie=%p", 
-		   refcnt, ctx, ctx->shdw_td->trie);
-	}
-    	poll(&pfd, 0, 100); // 100 msec sleep
-	refcnt = AO_load(&ctx->shdw_td->refcnt);
-	if (!refcnt) {
-	    break;
-	}
-    }
+    // Switch readers to updated trie, wait for the stale trie references
+    switch_trie_data(ctx);
 
     // Apply log to stale trie
     ret = apply_log2trie(ctx, ctx->shdw_td, ctx->log);
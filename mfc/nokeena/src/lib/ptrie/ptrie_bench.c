@@ -0,0 +1,309 @@
+/*
+ * ptrie_bench.c - Checkpoint file mode against snapshot mode
+ *
+ *	For each mode:
+ *	  - load: -n keys added in transactions of MAX_XACTION_ENTRIES
+ *	  - small: -s transactions of -k key updates each
+ *	  - recover: new context recovered from the files just written
+ *	and a sample of the keys is verified after each recovery.
+ *
+ *	Modes: ckpt (ptrie_recover_from_ckpt()), snap (snapshot mode, one
+ *	fdatasync() per commit), group (snapshot mode, -g msecs group
+ *	commit).  Snapshot mode recovery is measured twice, with the keys
+ *	only in the delta log and after ptrie_compact().
+ *
+ *	build (see Makefile-other):
+ *	  cc -O2 -I../../include -o ptrie_bench ptrie_bench.c \
+ *		${LIB_PTRIE} -lcprops -lssl -lpthread -lrt
+ *
+ *	usage: ptrie_bench [-d dir] [-n keys] [-s xactions] [-k keys]
+ *		[-g msecs] [-m ckpt|snap|group]
+ *
+ *	ckpt mode needs 2 * ~1.1GB of disk in dir for 1M keys.
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <stdarg.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "ptrie/persistent_trie.h"
+
+static const char *dir = ".";
+static long nkeys = 1000000;
+static long small_xactions = 2000;
+static int small_keys = 10;
+static int group_msecs = 100;
+
+#define SAMPLE_STRIDE 997 // Verified and updated keys
+
+static char ckp_file1[PATH_MAX];
+static char ckp_file2[PATH_MAX];
+static char snap_file[PATH_MAX];
+
+static void
+copy_app_data(const app_data_t *src, app_data_t *dest)
+{
+    *dest = *src;
+}
+
+static void
+destruct_app_data(app_data_t *d)
+{
+}
+
+static int
+quiet_logfunc(ptrie_log_level_t level, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (level <= PT_LOGL_SEVERE) {
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+    }
+    return 0;
+}
+
+static double
+now_secs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+static void
+mkkey(long n, char *buf, int bufsize)
+{
+    // Prefix structured, as CB_TRIE keys
+    snprintf(buf, bufsize, "/vol%ld/dir%ld/obj-%ld", n % 64, (n / 64) % 1024,
+	     n);
+}
+
+static ptrie_context_t *
+open_ctx(const char *mode)
+{
+    ptrie_context_t *ctx;
+    ptrie_snap_config_t scfg;
+    int rv;
+
+    ctx = new_ptrie_context(copy_app_data, destruct_app_data);
+    assert(ctx != 0);
+
+    if (!strcmp(mode, "ckpt")) {
+    	rv = ptrie_recover_from_ckpt(ctx, ckp_file1, ckp_file2);
+    } else {
+    	memset(&scfg, 0, sizeof(scfg));
+	scfg.group_commit_msecs = strcmp(mode, "group") ? 0 : group_msecs;
+	scfg.compact_log_records = 1L << 40; // Only by ptrie_compact()
+    	rv = ptrie_recover_from_snapshot(ctx, snap_file, 0, 0, &scfg);
+    }
+    assert(rv == 0);
+    return ctx;
+}
+
+static void
+commit(ptrie_context_t *ctx, long *seqno)
+{
+    fh_user_data_t fhd;
+    int rv;
+
+    memset(&fhd, 0, sizeof(fhd));
+    fhd.data[0] = ++(*seqno);
+    rv = ptrie_end_xaction(ctx, 1, &fhd);
+    assert(rv == 0);
+}
+
+/*
+ * verify() - Check every SAMPLE_STRIDE key, the first updated samples
+ *	      carry the update
+ */
+static void
+verify(ptrie_context_t *ctx, long updated)
+{
+    app_data_t ad;
+    char key[256];
+    long n;
+    int rv;
+
+    for (n = 0; n < nkeys; n += SAMPLE_STRIDE) {
+    	mkkey(n, key, sizeof(key));
+	rv = ptrie_exact_match(ctx, key, &ad);
+	assert(rv == 0);
+	assert(ad.d[0] == n);
+	assert(ad.d[1] == (((n / SAMPLE_STRIDE) < updated) ? 1 : 0));
+	rv = ptrie_prefix_match(ctx, key, &ad);
+	assert(rv > 0);
+	assert(ad.d[0] == n);
+    }
+}
+
+static void
+run(const char *mode)
+{
+    ptrie_context_t *ctx;
+    app_data_t ad;
+    char key[256];
+    char name[PATH_MAX];
+    double t0;
+    double t;
+    long seqno = 0;
+    long samples = ((nkeys - 1) / SAMPLE_STRIDE) + 1;
+    long updated;
+    long n;
+    long x;
+    int k;
+    int rv;
+
+    unlink(ckp_file1);
+    unlink(ckp_file2);
+    for (n = 1; n < 64; n++) {
+    	snprintf(name, sizeof(name), "%s.log.%ld", snap_file, n);
+	unlink(name);
+    }
+    unlink(snap_file);
+
+    ctx = open_ctx(mode);
+
+    // Bulk load
+    memset(&ad, 0, sizeof(ad));
+    t0 = now_secs();
+    rv = ptrie_begin_xaction(ctx);
+    assert(rv == 0);
+    for (n = 0; n < nkeys; n++) {
+    	mkkey(n, key, sizeof(key));
+	ad.d[0] = n;
+	rv = ptrie_add(ctx, key, &ad);
+	if (rv < 0) {
+	    commit(ctx, &seqno);
+	    rv = ptrie_begin_xaction(ctx);
+	    assert(rv == 0);
+	    rv = ptrie_add(ctx, key, &ad);
+	}
+	assert(rv == 0);
+    }
+    commit(ctx, &seqno);
+    rv = ptrie_sync(ctx);
+    assert(rv == 0);
+    t = now_secs() - t0;
+    printf("%-5s load     %8ld keys    %7.2f secs %10.0f keys/s\n",
+	   mode, nkeys, t, nkeys / t);
+
+    // Small transactions, key updates spread over the trie
+    t0 = now_secs();
+    for (x = 0; x < small_xactions; x++) {
+	rv = ptrie_begin_xaction(ctx);
+	assert(rv == 0);
+	for (k = 0; k < small_keys; k++) {
+	    n = (((x * small_keys) + k) % samples) * SAMPLE_STRIDE;
+	    mkkey(n, key, sizeof(key));
+	    ad.d[0] = n;
+	    ad.d[1] = 1;
+	    rv = ptrie_add(ctx, key, &ad);
+	    assert(rv == 0);
+	}
+	commit(ctx, &seqno);
+    }
+    rv = ptrie_sync(ctx);
+    assert(rv == 0);
+    t = now_secs() - t0;
+    printf("%-5s small    %8ld xactions %7.2f secs %10.0f xactions/s\n",
+	   mode, small_xactions, t, small_xactions / t);
+
+    updated = small_xactions * small_keys;
+    verify(ctx, updated);
+
+    // Recovery
+    delete_ptrie_context(ctx);
+    t0 = now_secs();
+    ctx = open_ctx(mode);
+    t = now_secs() - t0;
+    printf("%-5s recover  %s %7.2f secs\n", mode,
+	   strcmp(mode, "ckpt") ? "(log)          " : "               ", t);
+    verify(ctx, updated);
+
+    if (strcmp(mode, "ckpt")) {
+    	t0 = now_secs();
+	rv = ptrie_compact(ctx, 1);
+	assert(rv == 0);
+	t = now_secs() - t0;
+	printf("%-5s compact                  %7.2f secs\n", mode, t);
+	verify(ctx, updated);
+
+	delete_ptrie_context(ctx);
+	t0 = now_secs();
+	ctx = open_ctx(mode);
+	t = now_secs() - t0;
+	printf("%-5s recover  (snapshot)      %7.2f secs\n", mode, t);
+	verify(ctx, updated);
+    }
+    delete_ptrie_context(ctx);
+}
+
+int
+main(int argc, char *argv[])
+{
+    ptrie_config_t cfg;
+    const char *only = 0;
+    int rv;
+    int c;
+
+    while ((c = getopt(argc, argv, "d:n:s:k:g:m:")) != -1) {
+    	switch (c) {
+	case 'd':
+	    dir = optarg;
+	    break;
+	case 'n':
+	    nkeys = atol(optarg);
+	    break;
+	case 's':
+	    small_xactions = atol(optarg);
+	    break;
+	case 'k':
+	    small_keys = atoi(optarg);
+	    break;
+	case 'g':
+	    group_msecs = atoi(optarg);
+	    break;
+	case 'm':
+	    only = optarg;
+	    break;
+	default:
+	    fprintf(stderr, "usage: %s [-d dir] [-n keys] [-s xactions] "
+	    	    "[-k keys] [-g msecs] [-m ckpt|snap|group]\n", argv[0]);
+	    return 1;
+	}
+    }
+    snprintf(ckp_file1, sizeof(ckp_file1), "%s/BENCH_CKP-1", dir);
+    snprintf(ckp_file2, sizeof(ckp_file2), "%s/BENCH_CKP-2", dir);
+    snprintf(snap_file, sizeof(snap_file), "%s/BENCH_SNAP", dir);
+
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.interface_version = PTRIE_INTF_VERSION;
+    cfg.proc_logfunc = quiet_logfunc;
+    rv = ptrie_init(&cfg);
+    assert(rv == 0);
+
+    if (!only || !strcmp(only, "ckpt")) {
+    	run("ckpt");
+    }
+    if (!only || !strcmp(only, "snap")) {
+    	run("snap");
+    }
+    if (!only || !strcmp(only, "group")) {
+    	run("group");
+    }
+    return 0;
+}
+
+/*
+ * End of ptrie_bench.c
+ */
@@ -36,6 +36,7 @@ typedef struct ocrp_app_data { // app_data_t overlay
 
 #define CKP_FILE_1 "./CKP-1"
 #define CKP_FILE_2 "./CKP-2"
+#define SNAP_FILE "./SNAP"
 
 void copy_app_data(const app_data_t *src, app_data_t *dest)
 {
@@ -887,13 +888,18 @@ main(int argc, char *argv[])
     ptrie_context_t *ctx;
     int rv;
     int tests_to_run = 0;
+    int snap_mode = 0;
     ptrie_config_t cfg;
+    ptrie_snap_config_t snap_cfg;
 
     if (argc > 1) {
     	tests_to_run = atoi(argv[1]);
     } else {
     	tests_to_run = 0; // Run all
     }
+    if ((argc > 2) && !strcmp(argv[2], "snap")) {
+    	snap_mode = 1; // ptrie_recover_from_snapshot()
+    }
 
     assert(sizeof(file_header_t) == DEV_BSIZE);
     assert(sizeof(ocrp_fh_user_data_t) <= sizeof(fh_user_data_t));
@@ -912,7 +918,13 @@ main(int argc, char *argv[])
     ctx = new_ptrie_context(copy_app_data, destruct_app_data);
     assert(ctx != 0);
 
-    rv = ptrie_recover_from_ckpt(ctx, CKP_FILE_1, CKP_FILE_2);
+    if (snap_mode) {
+    	memset(&snap_cfg, 0, sizeof(snap_cfg));
+	snap_cfg.compact_log_records = 300000;
+    	rv = ptrie_recover_from_snapshot(ctx, SNAP_FILE, 0, 0, &snap_cfg);
+    } else {
+    	rv = ptrie_recover_from_ckpt(ctx, CKP_FILE_1, CKP_FILE_2);
+    }
     assert(rv == 0);
 
     if (tests_to_run < 0) {